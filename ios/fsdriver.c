@@ -27,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #define FUSE_USE_VERSION 28 /* new api */    /*  21 for an old api (default) */
 
 #include "udparams.h"
@@ -42,6 +43,7 @@
 #include "udapi.h"
 #include "syapi.h"
 #include "ccgen.h"
+#include "ccmount.h"
 #include "fsdriver.h"
 
 /* The following macro may be missing on some platforms */
@@ -55,11 +57,45 @@
     -----------------------
  */
 
+/* Attribute cache: directory listing already carries the attributes of each entry. 
+   They are kept here for a short time so that the getattr that the kernel issues per 
+   entry after readdir is answered without a round trip to the server */
+
+#define ATTRCACHE_NUMBUCKETS    1024    /* number of hash buckets (a power of two) */
+#define ATTRCACHE_MAXENTRIES    16384   /* the cache is flushed when it grows over this limit */
+#define ATTRCACHE_TIMEOUT       2       /* seconds an entry is considered valid */
+
+typedef struct _attrentry
+{
+    struct _attrentry *next;    /* next entry in the same bucket */
+    NQ_UINT32 hash;             /* path hash */
+    NQ_UINT32 expires;          /* time (in seconds) when the entry becomes stale */
+    struct stat statBuf;        /* file attributes */
+    NQ_CHAR path[1];            /* FUSE path - variable length */
+}
+AttrEntry;
+
+/* Open file: FUSE runs its operations on several threads at once, so each open file carries its own 
+   guard instead of the whole driver being serialized. The guard keeps the position set by seek 
+   together with the read or write that follows it. */
+
+typedef struct
+{
+    NQ_HANDLE handle;   /* NQ file handle */
+    SYMutex guard;      /* serializes seek + read/write on this handle */
+}
+DriverFile;
+
+#define FSDRIVER_DEFMAXIO       (128 * 1024)    /* FUSE max_read/max_write when server limits are unknown */
+
 typedef struct
 {
     NQ_CHAR mntEntry[MNT_PATH_SIZE];                                /* mount entry */
-    NQ_CHAR fullPath[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];   /* full path (starts with mount entry) */ 
-    NQ_CHAR tempPath[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];   /* temp path (starts with mount entry) */ 
+    pthread_key_t threadKey;                                        /* releases NQ thread context on thread exit */
+    SYMutex attrGuard;                                              /* attribute cache protection */
+    AttrEntry *attrCache[ATTRCACHE_NUMBUCKETS];                     /* attribute cache buckets */
+    NQ_COUNT attrCount;                                             /* number of cached entries */
+    NQ_UINT32 attrGeneration;                                       /* advanced on every invalidation */
 }
 StaticData;
 
@@ -120,7 +156,19 @@ static int pathValid(const char *path);
 static int pathExist(const char *path);
 static char* getFullPath(const char* path, char* fullPath, int size);
 static void getAttr(FileInfo_t *fileInfo, struct stat *statBuf);
+static void getFindAttr(FindFileDataA_t *findFileData, struct stat *statBuf);
+static NQ_BOOL attrCacheGet(const char *path, struct stat *statBuf);
+static NQ_UINT32 attrCacheGeneration(void);
+static void attrCachePut(const char *path, const struct stat *statBuf, NQ_UINT32 generation);
+static void attrCacheRemove(const char *path);
+static void attrCacheFlush(void);
+static void attrCacheUnlink(NQ_UINT32 hash, const char *path);
+static void attrCacheClear(void);
 static void convertPathDelimiters(char *path);
+static void threadSubscribe(void);
+static void threadRelease(void *value);
+static DriverFile* fileCreate(NQ_HANDLE handle);
+static NQ_UINT32 getMountMaxIo(const NQ_CHAR *mountPoint, NQ_BOOL isRead);
 static int printUsage();
 
 
@@ -176,6 +224,11 @@ fsInit(
         return FALSE;
     }
 #endif /* SY_FORCEALLOCATION */
+    syMutexCreate(&staticData->attrGuard);
+    pthread_key_create(&staticData->threadKey, threadRelease);
+    syMemset(staticData->attrCache, 0, sizeof(staticData->attrCache));
+    staticData->attrCount = 0;
+    staticData->attrGeneration = 0;
     return TRUE;
 }
 
@@ -185,6 +238,13 @@ fsStop(
     void
     )
 {
+    if (staticData != NULL)
+    {
+        attrCacheFlush();
+        syMutexDelete(&staticData->attrGuard);
+        pthread_key_delete(staticData->threadKey);
+    }
+
     /* release memory */
 #ifdef SY_FORCEALLOCATION
     if (staticData != NULL)
@@ -212,6 +272,9 @@ fsDriverMain(
     NQ_BOOL messageSigning = FALSE;
     NQ_BOOL fuseDebugOn = FALSE;
     NQ_COUNT setCredentialsCnt = 0, setSecurityCnt = 0;
+    char *fuseArgv[6];
+    int fuseArgc = 0;
+    char fuseOptions[100];
 
     TRCB();  
 
@@ -348,8 +411,19 @@ fsDriverMain(
 
     syStrcpy(staticData->mntEntry, MOUNTPOINT);
 
-    TRC("about to call fuse_main");
-    result = fuse_main(fuseDebugOn ? 3 : 2, argv, &driverOperations, staticData);
+    /* FUSE splits requests at 4K unless big_writes is set: let it pass what the server accepts */
+    fuseArgv[fuseArgc++] = argv[0];
+    if (fuseDebugOn)
+        fuseArgv[fuseArgc++] = argv[1];
+    fuseArgv[fuseArgc++] = (char *)mountPoint;
+    fuseArgv[fuseArgc++] = "-o";
+    sySprintf(fuseOptions, "big_writes,max_read=%u,max_write=%u,max_readahead=%u", 
+        (unsigned)getMountMaxIo(MOUNTPOINT, TRUE), (unsigned)getMountMaxIo(MOUNTPOINT, FALSE), (unsigned)getMountMaxIo(MOUNTPOINT, TRUE));
+    fuseArgv[fuseArgc++] = fuseOptions;
+    fuseArgv[fuseArgc] = NULL;
+
+    TRC("about to call fuse_main with options: %s", fuseOptions);
+    result = fuse_main(fuseArgc, fuseArgv, &driverOperations, staticData);
     TRC("fuse_main returned  %d", result);
     
     /* fs mount is unmounted at this point */
@@ -387,13 +461,16 @@ void driverDestroy(void *userdata)
 
 static int driverUtime(const char *path, struct utimbuf *ubuf)
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_BOOL result;
     NQ_HANDLE handle;
     FileTime_t lastAccessTime, lastWriteTime;
 
     TRCB();
+    threadSubscribe();
     
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -415,7 +492,9 @@ static int driverUtime(const char *path, struct utimbuf *ubuf)
     cmCifsTimeToUTC((NQ_UINT32)ubuf->actime, &lastAccessTime.timeLow, &lastAccessTime.timeHigh);
     cmCifsTimeToUTC((NQ_UINT32)ubuf->modtime, &lastWriteTime.timeLow, &lastWriteTime.timeHigh);
 
-    if (!ccSetFileTime(handle, NULL, &lastAccessTime, &lastWriteTime))
+    result = ccSetFileTime(handle, NULL, &lastAccessTime, &lastWriteTime);
+    attrCacheRemove(path);
+    if (!result)
     {
         ccCloseHandle(handle);
         TRCERR("Failed to set file time: %s", fullPath);
@@ -431,11 +510,14 @@ static int driverUtime(const char *path, struct utimbuf *ubuf)
 int
 driverMkdir(const char *path, mode_t mode)
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_BOOL result;
 
     TRCB();
+    threadSubscribe();
     
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -444,7 +526,9 @@ driverMkdir(const char *path, mode_t mode)
     TRC("path: %s", path);
     TRC("full path: %s", fullPath);
 
-    if (!ccCreateDirectoryA((const NQ_CHAR *)fullPath))
+    result = ccCreateDirectoryA((const NQ_CHAR *)fullPath);
+    attrCacheRemove(path);
+    if (!result)
     {
         TRCERR("Failed to create directory: %s", fullPath);
         TRCE();
@@ -460,11 +544,14 @@ driverRmdir(
     const char *path
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_BOOL result;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -473,7 +560,9 @@ driverRmdir(
     TRC("path: %s", path);
     TRC("full path: %s", fullPath);
 
-    if (!ccRemoveDirectoryA((const NQ_CHAR *)fullPath))
+    result = ccRemoveDirectoryA((const NQ_CHAR *)fullPath);
+    attrCacheRemove(path);
+    if (!result)
     {
         TRCERR("Failed to delete directory: %s", fullPath);
         TRCE();
@@ -492,11 +581,14 @@ driverGetattr(
     )
 {
     FileInfo_t fileInfo;
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_UINT32 generation;
 
     TRCB();
+    threadSubscribe();
     
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -505,6 +597,14 @@ driverGetattr(
     TRC("path: %s", path);
     TRC("full path: %s", fullPath);
 
+    if (attrCacheGet(path, statbuf))
+    {
+        TRC("attributes cached for: %s", path);
+        TRCE();
+        return 0;
+    }
+    generation = attrCacheGeneration();
+
     if (syStrcmp(path, "/") == 0)
     {
         /* special case - mount folder */
@@ -538,6 +638,7 @@ driverGetattr(
     }
 
     getAttr(&fileInfo, statbuf);
+    attrCachePut(path, statbuf, generation);
 
     TRCE();
     return 0;
@@ -548,6 +649,11 @@ static inline NQ_HANDLE getFh(struct fuse_file_info *fi)
     return (NQ_HANDLE)(uintptr_t)fi->fh;
 }
 
+static inline DriverFile *getFile(struct fuse_file_info *fi)
+{
+    return (DriverFile *)(uintptr_t)fi->fh;
+}
+
 static int 
 driverFgetattr(
     const char *path, 
@@ -558,10 +664,11 @@ driverFgetattr(
     FileInfo_t fileInfo;
 
     TRCB();
+    threadSubscribe();
 
     TRC("handle: 0x%X, path: %s", (NQ_ULONG)fi->fh, path);
 
-    if (ccGetFileInformationByHandle(getFh(fi), &fileInfo) == FALSE)
+    if (ccGetFileInformationByHandle(getFile(fi)->handle, &fileInfo) == FALSE)
     {
         TRCERR("Failed to get file information for: %s", path);
         TRCE();        
@@ -582,13 +689,15 @@ driverOpendir(
     struct fuse_file_info *fi
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
     FindFileDataA_t findFileData;
     NQ_HANDLE dirHandle;
 
     TRCB();
+    threadSubscribe();
     
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -635,10 +744,27 @@ driverReaddir(
 {
     FindFileDataA_t findFileData;
     NQ_BOOL closeHandle = FALSE;
+    NQ_CHAR entryPath[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
+    NQ_COUNT prefixLen;
+    struct stat statBuf;
+    NQ_UINT32 generation;
 
     TRCB();
+    threadSubscribe();
     TRC("path: %s", path);
 
+    /* entry paths are composed as <path>/<name> */
+    prefixLen = (NQ_COUNT)syStrlen(path);
+    if (prefixLen + 2 > sizeof(entryPath))
+    {
+        TRCERR("Path is too long");
+        TRCE();
+        return -ENAMETOOLONG;
+    }
+    syStrcpy(entryPath, path);
+    if (prefixLen == 0 || entryPath[prefixLen - 1] != '/')
+        entryPath[prefixLen++] = '/';
+
     if (fi == NULL)
     {
         struct fuse_file_info fuseFileInfo;
@@ -658,12 +784,21 @@ driverReaddir(
     {
         return -ENOENT;
     }
+    generation = attrCacheGeneration();
     if (ccFindNextFileA(getFh(fi), &findFileData))
     {       
         do 
         {
             TRC("calling filler with name: %s", findFileData.fileName);
-            if (filler(buf, findFileData.fileName, NULL, 0) != 0) 
+
+            /* the listing carries attributes: keep them for the getattr that follows */
+            getFindAttr(&findFileData, &statBuf);
+            if (prefixLen + syStrlen(findFileData.fileName) < sizeof(entryPath))
+            {
+                syStrcpy(entryPath + prefixLen, findFileData.fileName);
+                attrCachePut(entryPath, &statBuf, generation);
+            }
+            if (filler(buf, findFileData.fileName, &statBuf, 0) != 0) 
             {
                 if (closeHandle)
                     ccFindClose(getFh(fi));
@@ -693,6 +828,7 @@ driverReleasedir(
     )
 {
     TRCB();
+    threadSubscribe();
     TRC("path: %s, handle: 0x%X", path, (NQ_ULONG)fi->fh);
 
     ccFindClose(getFh(fi));
@@ -708,6 +844,7 @@ driverStatfs(
     struct statvfs *statv
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
     NQ_UINT sectorsPerCluster;
     NQ_UINT bytesPerSector;
@@ -715,8 +852,9 @@ driverStatfs(
     NQ_UINT totalClusters;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -763,13 +901,15 @@ driverCreate(
     struct fuse_file_info *fi
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
     NQ_HANDLE handle;
     NQ_INT access;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -789,6 +929,7 @@ driverCreate(
     }
 
     handle = ccCreateFileA(fullPath, access, FILE_SM_COMPAT, FILE_LCL_UNKNOWN, FALSE, 0, FILE_CA_CREATE, FILE_OA_FAIL);
+    attrCacheRemove(path);
     if (handle == NULL)
     {
         TRCERR("Failed to create file: %s", fullPath);
@@ -797,8 +938,16 @@ driverCreate(
     }
     else
     {
-        NQ_HANDLE *h = (NQ_HANDLE *)&fi->fh;        
-        *h = handle;
+        DriverFile *file = fileCreate(handle);
+
+        if (file == NULL)
+        {
+            ccCloseHandle(handle);
+            TRCERR("Failed to allocate file: %s", fullPath);
+            TRCE();
+            return -ENOMEM;
+        }
+        fi->fh = (uint64_t)(uintptr_t)file;
         TRC("handle: 0x%X", (NQ_ULONG)handle);
     }
 
@@ -813,13 +962,15 @@ driverOpen(
     struct fuse_file_info *fi
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
     NQ_HANDLE handle;
     NQ_INT access;
 
     TRCB();
+    threadSubscribe();
     
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -847,8 +998,16 @@ driverOpen(
     }
     else
     {
-        NQ_HANDLE *h = (NQ_HANDLE *)&fi->fh;        
-        *h = handle;
+        DriverFile *file = fileCreate(handle);
+
+        if (file == NULL)
+        {
+            ccCloseHandle(handle);
+            TRCERR("Failed to allocate file: %s", fullPath);
+            TRCE();
+            return -ENOMEM;
+        }
+        fi->fh = (uint64_t)(uintptr_t)file;
         TRC("handle: 0x%X", (NQ_ULONG)handle);
     }
     
@@ -864,9 +1023,10 @@ driverFlush(
     )
 {
     TRCB();
+    threadSubscribe();
     TRC("path: %s, handle: 0x%X", path, (NQ_ULONG)fi->fh);
 
-    if (!ccFlushFile(getFh(fi)))
+    if (!ccFlushFile(getFile(fi)->handle))
     {
         TRCERR("Failed to flush file: %s", path);
 /*        TRCE();
@@ -894,10 +1054,20 @@ driverRelease(
     struct fuse_file_info *fi
     )
 {
+    DriverFile *file;
+    NQ_BOOL result;
+
     TRCB();
+    threadSubscribe();
     TRC("path: %s, handle: 0x%X", path, (NQ_ULONG)fi->fh);
     
-    if (!ccCloseHandle(getFh(fi)))
+    file = getFile(fi);
+    fi->fh = 0;
+    result = ccCloseHandle(file->handle);
+    attrCacheRemove(path);
+    syMutexDelete(&file->guard);
+    syFree(file);
+    if (!result)
     {
         TRCERR("Failed to close file: %s", path);
         TRCE();
@@ -917,24 +1087,31 @@ driverRead(
     struct fuse_file_info *fi
     )
 {
+    DriverFile  *file = getFile(fi);
     NQ_UINT32   position;
-    NQ_INT32    *highOffset = NULL;
+    NQ_INT32    highOffset = (NQ_INT32)(offset >> 32);
     NQ_UINT     readSize;
+    NQ_BOOL     result;
 
     TRCB();
+    threadSubscribe();
     
     TRC("path: %s", path);
     TRC("handle: 0x%X, size: %d, offset: %d", (NQ_ULONG)fi->fh, size, offset);
     
-    position = ccSetFilePointer(getFh(fi), (NQ_INT32)offset, highOffset, SEEK_FILE_BEGIN);
+    syMutexTake(&file->guard);
+    position = ccSetFilePointer(file->handle, (NQ_INT32)offset, &highOffset, SEEK_FILE_BEGIN);
     if (position == NQ_ERR_SEEKERROR)
     {
+        syMutexGive(&file->guard);
         TRCERR("Failed to set file pointer: %s", path);
         TRCE();
         return getLastError();
     }
 
-    if (!ccReadFile(getFh(fi), (NQ_BYTE *)buf, (NQ_UINT)size, &readSize))
+    result = ccReadFile(file->handle, (NQ_BYTE *)buf, (NQ_UINT)size, &readSize);
+    syMutexGive(&file->guard);
+    if (!result)
     {
         TRCERR("Failed to read: %s", path);
         TRCE();
@@ -955,53 +1132,38 @@ driverWrite(
     struct fuse_file_info *fi
     )
 {
+    DriverFile  *file = getFile(fi);
     NQ_UINT32   position;
-    NQ_INT32    *highOffset = NULL;
+    NQ_INT32    highOffset = (NQ_INT32)(offset >> 32);
     NQ_UINT     writtenSize;
-    NQ_BOOL     closeHandle = FALSE;
+    NQ_BOOL     result;
 
     TRCB();
+    threadSubscribe();
     TRC("path: %s", path);
     TRC("fi: %p", fi);
 
-/*
-	
-    if (fi == NULL)
-    {
-        struct fuse_file_info fuseFileInfo;
-
-        if (driverOpen(path, &fuseFileInfo) != 0)
-        {
-            TRCERR("Failed to open file: %s", path);
-            TRCE();
-            return getLastError();
-        }
-        fi = &fuseFileInfo;
-        closeHandle = TRUE;
-    }
-*/
     TRC("handle: 0x%X, size: %d, offset: %d", (NQ_ULONG)fi->fh, size, offset);
     
-    position = ccSetFilePointer(getFh(fi), (NQ_INT32)offset, highOffset, SEEK_FILE_BEGIN);
+    syMutexTake(&file->guard);
+    position = ccSetFilePointer(file->handle, (NQ_INT32)offset, &highOffset, SEEK_FILE_BEGIN);
     if (position == NQ_ERR_SEEKERROR)
     {
-        if (closeHandle)
-            ccCloseHandle(getFh(fi));
+        syMutexGive(&file->guard);
         TRCERR("Failed to set file pointer: %s", path);
         TRCE();
         return getLastError();
     }
 
-    if (!ccWriteFile(getFh(fi), (NQ_BYTE *)buf, (NQ_UINT)size, &writtenSize))
+    result = ccWriteFile(file->handle, (NQ_BYTE *)buf, (NQ_UINT)size, &writtenSize);
+    syMutexGive(&file->guard);
+    attrCacheRemove(path);
+    if (!result)
     {
-        if (closeHandle)
-            ccCloseHandle(getFh(fi));
         TRCERR("Failed to write: %s", path);
         TRCE();
         return getLastError();
     }
-    if (closeHandle)
-        ccCloseHandle(getFh(fi));
 
     TRC("Written %d bytes", writtenSize);
     TRCE();
@@ -1015,19 +1177,23 @@ driverRename(
     const char *newpath
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
+    NQ_CHAR newPathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPathOld;
     NQ_CHAR *fullPathNew;
+    NQ_BOOL result;
 
     TRCB();
+    threadSubscribe();
     TRC("path: %s", path);
     
-    if (!(fullPathOld = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPathOld = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
         return -1;
     }
-    if (!(fullPathNew = getFullPath(newpath, FSDRIVER_DATA->tempPath, sizeof(FSDRIVER_DATA->tempPath))))
+    if (!(fullPathNew = getFullPath(newpath, newPathBuf, sizeof(newPathBuf))))
     {
         TRCERR("Failed to get full path for: %s", newpath);
         TRCE();
@@ -1037,7 +1203,10 @@ driverRename(
     TRC("path: %s", fullPathOld);
     TRC("path: %s", fullPathNew);
 
-    if (!ccMoveFileA(fullPathOld, fullPathNew))
+    /* a directory rename moves all the paths below it */
+    result = ccMoveFileA(fullPathOld, fullPathNew);
+    attrCacheFlush();
+    if (!result)
     {
         TRCERR("Failed to rename: %s", path);
         TRCE();
@@ -1053,11 +1222,14 @@ driverUnlink(
     const char *path
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_BOOL result;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -1066,7 +1238,9 @@ driverUnlink(
     TRC("path: %s", path);
     TRC("full path: %s", fullPath);
 
-    if (!ccDeleteFileA(fullPath))
+    result = ccDeleteFileA(fullPath);
+    attrCacheRemove(path);
+    if (!result)
     {
         TRCERR("Failed to delete file: %s", fullPath);
         TRCE();
@@ -1084,12 +1258,16 @@ driverAccess(
     int mask
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
     FileInfo_t fileInfo;
+    struct stat statBuf;
+    NQ_UINT32 generation;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -1099,11 +1277,17 @@ driverAccess(
     TRC("full path: %s", fullPath);
     TRC("mask: 0x%X", mask);
 
-    if (!ccGetFileInformationByNameA(fullPath, &fileInfo))
+    if (!attrCacheGet(path, &statBuf))
     {
-        TRCERR("Failed to get file information for: %s", fullPath);
-        TRCE();        
-        return -ENOENT;
+        generation = attrCacheGeneration();
+        if (!ccGetFileInformationByNameA(fullPath, &fileInfo))
+        {
+            TRCERR("Failed to get file information for: %s", fullPath);
+            TRCE();        
+            return -ENOENT;
+        }
+        getAttr(&fileInfo, &statBuf);
+        attrCachePut(path, &statBuf, generation);
     }
 
     if (mask == F_OK)    
@@ -1112,7 +1296,7 @@ driverAccess(
         return 0;
     }
 
-    if ((fileInfo.attributes & CIFS_ATTR_READONLY) && (mask & W_OK))
+    if (!(statBuf.st_mode & S_IWUSR) && (mask & W_OK))
     {
         TRCE();        
         return -EACCES;
@@ -1129,11 +1313,14 @@ driverTruncate(
     off_t newsize
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_BOOL result;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -1143,7 +1330,9 @@ driverTruncate(
     TRC("full path: %s", fullPath);
     TRC("truncate to size: %d", newsize);
 
-    if (!ccSetFileSizeByNameA(fullPath, (NQ_UINT32)newsize, 0))
+    result = ccSetFileSizeByNameA(fullPath, (NQ_UINT32)newsize, (NQ_UINT32)(newsize >> 32));
+    attrCacheRemove(path);
+    if (!result)
     {
         TRCERR("Failed to truncate file: %s", fullPath);
         TRCE();
@@ -1162,10 +1351,15 @@ driverFtruncate(
     struct fuse_file_info *fi
     )
 {
+    NQ_BOOL result;
+
     TRCB();
+    threadSubscribe();
     TRC("handle: 0x%X, size: %d", (NQ_ULONG)fi->fh, offset);
 
-    if (!ccSetFileSizeByHandle(getFh(fi), (NQ_UINT32)offset, 0))
+    result = ccSetFileSizeByHandle(getFile(fi)->handle, (NQ_UINT32)offset, (NQ_UINT32)(offset >> 32));
+    attrCacheRemove(path);
+    if (!result)
     {
         TRCERR("Failed to ftruncate file");
         TRCE();
@@ -1272,11 +1466,14 @@ driverChmod(
     mode_t mode
     )
 {
+    NQ_CHAR pathBuf[CM_BUFFERLENGTH(NQ_CHAR, UD_FS_MAXPATHLEN)];
     NQ_CHAR *fullPath;
+    NQ_BOOL result;
 
     TRCB();
+    threadSubscribe();
 
-    if (!(fullPath = getFullPath(path, FSDRIVER_DATA->fullPath, sizeof(FSDRIVER_DATA->fullPath))))
+    if (!(fullPath = getFullPath(path, pathBuf, sizeof(pathBuf))))
     {
         TRCERR("Failed to get full path for: %s", path);
         TRCE();
@@ -1286,7 +1483,9 @@ driverChmod(
     TRC("full path: %s", fullPath);
     TRC("mode: 0x%X", mode);
 
-    if (!ccSetFileAttributesA(fullPath, (NQ_UINT32)syUnixMode2DosAttr((int)mode)))
+    result = ccSetFileAttributesA(fullPath, (NQ_UINT32)syUnixMode2DosAttr((int)mode));
+    attrCacheRemove(path);
+    if (!result)
     {
         TRCERR("Failed to chmod file");
         TRCE();
@@ -1425,6 +1624,273 @@ getAttr(
     /*statDump(statBuf);*/
 }
 
+
+static void 
+getFindAttr(
+    FindFileDataA_t *findFileData, 
+    struct stat *statBuf
+    )
+{
+    FileInfo_t fileInfo;
+
+    syMemset(&fileInfo, 0, sizeof(fileInfo));
+    fileInfo.creationTimeLow = findFileData->creationTimeLow;
+    fileInfo.creationTimeHigh = findFileData->creationTimeHigh;
+    fileInfo.lastAccessTimeLow = findFileData->lastAccessTimeLow;
+    fileInfo.lastAccessTimeHigh = findFileData->lastAccessTimeHigh;
+    fileInfo.lastWriteTimeLow = findFileData->lastWriteTimeLow;
+    fileInfo.lastWriteTimeHigh = findFileData->lastWriteTimeHigh;
+    fileInfo.attributes = findFileData->fileAttributes;
+    fileInfo.allocationSizeLow = findFileData->allocationSizeLow;
+    fileInfo.allocationSizeHigh = findFileData->allocationSizeHigh;
+    fileInfo.fileSizeLow = findFileData->fileSizeLow;
+    fileInfo.fileSizeHigh = findFileData->fileSizeHigh;
+    fileInfo.numberOfLinks = 1;     /* not reported in directory listing */
+
+    getAttr(&fileInfo, statBuf);
+}
+
+
+static NQ_UINT32
+attrCacheHash(
+    const char *path
+    )
+{
+    NQ_UINT32 hash = 5381;      /* djb2 */
+
+    for (; *path != '\0'; path++)
+        hash = (hash << 5) + hash + (NQ_BYTE)*path;
+    return hash;
+}
+
+
+/* current invalidation generation, taken before querying the server for attributes */
+static NQ_UINT32
+attrCacheGeneration(
+    void
+    )
+{
+    NQ_UINT32 generation;
+
+    syMutexTake(&staticData->attrGuard);
+    generation = staticData->attrGeneration;
+    syMutexGive(&staticData->attrGuard);
+    return generation;
+}
+
+
+/* find valid attributes for a path, stale entries are dropped on the way */
+static NQ_BOOL
+attrCacheGet(
+    const char *path, 
+    struct stat *statBuf
+    )
+{
+    NQ_UINT32 hash = attrCacheHash(path);
+    NQ_UINT32 now = (NQ_UINT32)syGetTimeInSec();
+    AttrEntry **pEntry;
+    NQ_BOOL result = FALSE;
+
+    syMutexTake(&staticData->attrGuard);
+    for (pEntry = &staticData->attrCache[hash & (ATTRCACHE_NUMBUCKETS - 1)]; *pEntry != NULL; )
+    {
+        AttrEntry *entry = *pEntry;
+
+        if (entry->expires <= now)
+        {
+            *pEntry = entry->next;
+            staticData->attrCount--;
+            syFree(entry);
+            continue;
+        }
+        if (entry->hash == hash && syStrcmp(entry->path, path) == 0)
+        {
+            *statBuf = entry->statBuf;
+            result = TRUE;
+            break;
+        }
+        pEntry = &entry->next;
+    }
+    syMutexGive(&staticData->attrGuard);
+    return result;
+}
+
+
+/* attributes queried before an invalidation of the given generation may be stale and are not cached */
+static void
+attrCachePut(
+    const char *path, 
+    const struct stat *statBuf,
+    NQ_UINT32 generation
+    )
+{
+    AttrEntry *entry;
+    NQ_UINT32 hash = attrCacheHash(path);
+
+    entry = (AttrEntry *)syMalloc(sizeof(AttrEntry) + syStrlen(path));
+    if (entry == NULL)
+        return;
+    entry->hash = hash;
+    entry->expires = (NQ_UINT32)syGetTimeInSec() + ATTRCACHE_TIMEOUT;
+    entry->statBuf = *statBuf;
+    syStrcpy(entry->path, path);
+
+    syMutexTake(&staticData->attrGuard);
+    if (generation != staticData->attrGeneration)
+    {
+        syMutexGive(&staticData->attrGuard);
+        syFree(entry);
+        return;
+    }
+    attrCacheUnlink(hash, path);
+    if (staticData->attrCount >= ATTRCACHE_MAXENTRIES)
+        attrCacheClear();
+    entry->next = staticData->attrCache[hash & (ATTRCACHE_NUMBUCKETS - 1)];
+    staticData->attrCache[hash & (ATTRCACHE_NUMBUCKETS - 1)] = entry;
+    staticData->attrCount++;
+    syMutexGive(&staticData->attrGuard);
+}
+
+
+/* invalidation follows the modifying call, keep its error for the caller */
+static void
+attrCacheRemove(
+    const char *path
+    )
+{
+    NQ_UINT32 error = (NQ_UINT32)syGetLastError();
+
+    syMutexTake(&staticData->attrGuard);
+    attrCacheUnlink(attrCacheHash(path), path);
+    staticData->attrGeneration++;
+    syMutexGive(&staticData->attrGuard);
+    sySetLastError(error);
+}
+
+
+static void
+attrCacheFlush(
+    void
+    )
+{
+    NQ_UINT32 error = (NQ_UINT32)syGetLastError();
+
+    syMutexTake(&staticData->attrGuard);
+    attrCacheClear();
+    staticData->attrGeneration++;
+    syMutexGive(&staticData->attrGuard);
+    sySetLastError(error);
+}
+
+
+/* drop the entry of a path, called with the cache guard taken */
+static void
+attrCacheUnlink(
+    NQ_UINT32 hash, 
+    const char *path
+    )
+{
+    AttrEntry **pEntry;
+
+    for (pEntry = &staticData->attrCache[hash & (ATTRCACHE_NUMBUCKETS - 1)]; *pEntry != NULL; pEntry = &(*pEntry)->next)
+    {
+        AttrEntry *entry = *pEntry;
+
+        if (entry->hash == hash && syStrcmp(entry->path, path) == 0)
+        {
+            *pEntry = entry->next;
+            staticData->attrCount--;
+            syFree(entry);
+            break;
+        }
+    }
+}
+
+
+/* drop all the entries, called with the cache guard taken */
+static void
+attrCacheClear(
+    void
+    )
+{
+    NQ_COUNT i;
+
+    for (i = 0; i < ATTRCACHE_NUMBUCKETS; i++)
+    {
+        while (staticData->attrCache[i] != NULL)
+        {
+            AttrEntry *entry = staticData->attrCache[i];
+
+            staticData->attrCache[i] = entry->next;
+            syFree(entry);
+        }
+    }
+    staticData->attrCount = 0;
+}
+
+
+/* make sure the calling FUSE worker thread has an NQ thread context; the context is released 
+   when the worker exits */
+static void
+threadSubscribe(
+    void
+    )
+{
+    if (pthread_getspecific(staticData->threadKey) == NULL)
+    {
+        ccThreadSubscribe();
+        pthread_setspecific(staticData->threadKey, staticData);
+    }
+}
+
+
+static void
+threadRelease(
+    void *value
+    )
+{
+    ccThreadUnsubscribe();
+}
+
+
+static DriverFile*
+fileCreate(
+    NQ_HANDLE handle
+    )
+{
+    DriverFile *file = (DriverFile *)syMalloc(sizeof(DriverFile));
+
+    if (file != NULL)
+    {
+        file->handle = handle;
+        syMutexCreate(&file->guard);
+    }
+    return file;
+}
+
+
+/* read/write limits negotiated with the server behind the mount point */
+static NQ_UINT32
+getMountMaxIo(
+    const NQ_CHAR *mountPoint,
+    NQ_BOOL isRead
+    )
+{
+    NQ_WCHAR mountPointW[MNT_PATH_SIZE];
+    CCMount *pMount;
+    NQ_UINT32 result = FSDRIVER_DEFMAXIO;
+
+    cmAnsiToUnicode(mountPointW, mountPoint);
+    pMount = ccMountFind(mountPointW);
+    if (pMount != NULL && pMount->server != NULL)
+    {
+        result = isRead ? pMount->server->maxRead : pMount->server->maxWrite;
+        if (result == 0)
+            result = FSDRIVER_DEFMAXIO;
+    }
+    return result;
+}
+
 #if 0
 static void statDump(struct stat *buff)
 {
@@ -44,18 +44,50 @@
 /* IPv6 related includes here */
 #endif /* UD_NQ_USETRANSPORTIPV6 */
 
-#if (defined(SY_UNICODEFILESYSTEM) && defined(UD_CM_UNICODEAPPLICATION)) || defined(UD_CC_INCLUDELDAP) || defined(UD_NQ_CODEPAGEUTF8)
-#include <iconv.h>
-#endif
-
 #if defined(SY_UNICODEFILESYSTEM) && defined(UD_CM_UNICODEAPPLICATION)
 #define UNICODEFILENAMES
 #endif
 
-#ifdef UD_NQ_CODEPAGEUTF8
-	 static iconv_t utf16LE_to_Utf8;
-	 static iconv_t utf8_to_Utf16LE;
-#endif /* UD_NQ_CODEPAGEUTF8 */ 
+#ifdef __APPLE__
+#define SY_KQUEUE
+#include <sys/event.h>
+#include <dirent.h>
+/* changes reported for a watched directory */
+#define WATCH_NOTES         (NOTE_WRITE | NOTE_EXTEND | NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE)
+#define WATCH_OPENFLAGS     (O_EVTONLY | O_DIRECTORY | O_CLOEXEC)
+#define WATCH_NUMBUCKETS    64      /* entry hash buckets per watched directory (a power of two) */
+#define WATCH_MAXPENDING    4096    /* queued events, more are reported as overflow */
+
+typedef struct WatchEntry
+{
+    struct WatchEntry* next;        /* next entry in the bucket */
+    NQ_BOOL isDirectory;            /* the entry is a directory */
+    NQ_BOOL seen;                   /* found by the current scan */
+    time_t mtime;                   /* modification time at the last scan */
+    off_t size;                     /* size at the last scan */
+    char name[1];                   /* entry name */
+}
+WatchEntry;     /* directory entry as found by the last scan */
+
+typedef struct WatchDir
+{
+    struct WatchDir* next;          /* next watched directory */
+    int fd;                         /* directory descriptor, also the watch descriptor */
+    NQ_BOOL gone;                   /* the directory was removed or renamed */
+    WatchEntry* entries[WATCH_NUMBUCKETS]; /* contents at the last scan */
+    char path[1];                   /* directory path */
+}
+WatchDir;       /* watched directory */
+
+typedef struct WatchEvent
+{
+    struct WatchEvent* next;        /* next queued event */
+    int wd;                         /* watch descriptor */
+    NQ_UINT32 event;                /* SY_FILEWATCH_xxx event */
+    char name[1];                   /* entry name */
+}
+WatchEvent;     /* event found by a scan and not read yet */
+#endif /* __APPLE__ */
 
 
 /* 64 bit offsets support */
@@ -78,6 +110,13 @@
 #define OPEN_RDWR_CREAT      (O_RDWR | O_CREAT)
 #endif /* LONG_FILES_SUPPORT */
 
+/* handle used only as a base for *at() lookups */
+#ifdef O_PATH
+#define OPEN_DIRHANDLE       (O_PATH | O_DIRECTORY)
+#else
+#define OPEN_DIRHANDLE       (O_RDONLY | O_DIRECTORY)
+#endif /* O_PATH */
+
 #define S_IWUGO (S_IWUSR | S_IWGRP | S_IWOTH)
 #define S_IRUGO (S_IRUSR | S_IRGRP | S_IROTH)
 
@@ -99,6 +138,13 @@ typedef struct
 #ifdef UD_CS_INCLUDEDIRECTTRANSFER
     int pipe[2];
 #endif /* UD_CS_INCLUDEDIRECTTRANSFER */
+#ifdef SY_KQUEUE
+    WatchDir* watchDirs;            /* watched directories */
+    WatchEvent* watchHead;          /* first queued event */
+    WatchEvent* watchTail;          /* last queued event */
+    NQ_COUNT watchPending;          /* number of queued events */
+    NQ_BOOL watchOverflow;          /* events were lost */
+#endif /* SY_KQUEUE */
 }
 StaticData;
 
@@ -124,25 +170,10 @@ void filenameToUtf8(
     const unsigned short* name   /* UTF-16 LE name buffer */
     )
 {
-    iconv_t convertor;
-    size_t inbytesleft = (syWStrlen(name) + 1) * sizeof(unsigned short);
-    size_t outbytesleft = sizeof(staticData->utf8Name);
-    char *in = (char *)name;
-    char *out = staticData->utf8Name;
-    
-    if ((convertor = iconv_open("UTF-8", "UTF-16LE")) == (iconv_t)-1)
-    {
-        printf("!! Unable to convert UTF-16LE to UTF-8 (iconv_open failed with errno %d)\n", errno);
-        return;
-    }
-
-    if (iconv(convertor, &in, &inbytesleft, &out, &outbytesleft) == (size_t)-1)
+    if (cmUtf16LEToUtf8(staticData->utf8Name, sizeof(staticData->utf8Name), name, -1) == NQ_FAIL)
     {
-        printf("!! Unable to convert UTF-16LE to UTF-8 (iconv failed with errno %d)\n", errno);
-        iconv_close(convertor);
-        return;
+        printf("!! Unable to convert UTF-16LE to UTF-8\n");
     }
-    iconv_close(convertor);
 }
 
 /* Convert file name from UTF-8 to UTF-16 LE */
@@ -152,25 +183,10 @@ void filenameFromUtf8(
     int size                /* buffer size */
     )
 {
-    iconv_t convertor;
-    size_t inbytesleft = strlen(staticData->utf8Name) + 1;
-    size_t outbytesleft = size;
-    char *in = staticData->utf8Name;
-    char *out = (char*)buffer;
-
-    if ((convertor = iconv_open("UTF-16LE", "UTF-8")) == (iconv_t)-1)
+    if (cmUtf8ToUtf16LE(buffer, (NQ_COUNT)size / sizeof(unsigned short), staticData->utf8Name, -1) == NQ_FAIL)
     {
-        printf("!! Unable to convert UTF-8 to UTF-16LE (iconv_open failed with errno %d)\n", errno);
-        return;
+        printf("!! Unable to convert UTF-8 to UTF-16LE\n");
     }
-
-    if (iconv(convertor, &in, &inbytesleft, &out, &outbytesleft) == (size_t)-1)
-    {
-        printf("!! Unable to convert UTF-8 to UTF-16LE (iconv failed with errno %d)\n", errno);
-        iconv_close(convertor);
-        return;
-    }
-    iconv_close(convertor);
 }
 #endif /* UNICODEFILENAMES */
 
@@ -844,6 +860,79 @@ Exit:
     return result;
 }
 
+/*
+ *====================================================================
+ * PURPOSE: get link speed of the adapter carrying an IP4 address
+ *--------------------------------------------------------------------
+ * PARAMS:  IN adapter IP in NBO
+ *
+ * RETURNS: link speed in Mbit/s or 0 when it is not known
+ *
+ * NOTES:   Linux reports it through sysfs, BSD systems through
+ *          the link level address of the interface
+ *====================================================================
+ */
+
+NQ_UINT32
+syGetAdapterLinkSpeed(
+    NQ_IPADDRESS4 ip
+    )
+{
+    struct ifaddrs* pIfa;
+    struct ifaddrs* saved = NULL;
+    const char* name = NULL;
+    NQ_UINT32 speed = 0;
+
+    if (getifaddrs(&saved) < 0)
+    {
+        syfPrintf((stderr, "[%s:%d][%s()] %d %s\n", __FILE__, __LINE__, __func__, errno, strerror(errno)));
+        return 0;
+    }
+
+    /* find the interface by its address */
+    for (pIfa = saved; pIfa != NULL; pIfa = pIfa->ifa_next)
+    {
+        if (pIfa->ifa_addr && pIfa->ifa_addr->sa_family == AF_INET && ((struct sockaddr_in*)pIfa->ifa_addr)->sin_addr.s_addr == ip)
+        {
+            name = pIfa->ifa_name;
+            break;
+        }
+    }
+    if (NULL == name)
+        goto Exit;
+
+#ifdef __linux__
+    {
+        char path[IFNAMSIZ + 32];
+        FILE* f;
+        int mbps = 0;
+
+        snprintf(path, sizeof(path), "/sys/class/net/%s/speed", name);
+        f = fopen(path, "r");
+        if (NULL != f)
+        {
+            /* virtual and disconnected adapters report -1 */
+            if (1 == fscanf(f, "%d", &mbps) && mbps > 0)
+                speed = (NQ_UINT32)mbps;
+            fclose(f);
+        }
+    }
+#elif defined(AF_LINK)
+    for (pIfa = saved; pIfa != NULL; pIfa = pIfa->ifa_next)
+    {
+        if (pIfa->ifa_addr && pIfa->ifa_addr->sa_family == AF_LINK && pIfa->ifa_data && 0 == strcmp(pIfa->ifa_name, name))
+        {
+            speed = (NQ_UINT32)(((struct if_data*)pIfa->ifa_data)->ifi_baudrate / 1000000);
+            break;
+        }
+    }
+#endif /* __linux__ */
+
+Exit:
+    freeifaddrs(saved);
+    return speed;
+}
+
 #if (0)
 
 int
@@ -1534,6 +1623,81 @@ syConnectSocket(
     return NQ_SUCCESS;
 }
 
+/*
+ *====================================================================
+ * PURPOSE: Start connecting to a remote server port without blocking
+ *--------------------------------------------------------------------
+ * PARAMS:  IN socket id
+ *          IN IP address of the server in NBO
+ *          IN port number of the server in NBO
+ *
+ * RETURNS: NQ_SUCCESS when connection is established or in progress,
+ *          NQ_FAIL otherwise
+ *
+ * NOTES:   the socket is left in non-blocking mode until
+ *          syConnectSocketComplete() is called for it
+ *
+ *====================================================================
+ */
+
+NQ_STATUS
+syConnectSocketStart(
+    SYSocketHandle sock,
+    const NQ_IPADDRESS *ip,
+    NQ_PORT port
+    )
+{
+    char buffer[MAX_SOCKADDR_SIZE];
+    struct sockaddr *saddr = (struct sockaddr*)buffer;
+    int size, flags;
+
+    if (!buildSockaddr(saddr, &size, ip, port))
+        return NQ_FAIL;
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == ERROR || fcntl(sock, F_SETFL, flags | O_NONBLOCK) == ERROR)
+        return NQ_FAIL;
+
+    if (connect(sock, saddr, (socklen_t)size) != OK && errno != EINPROGRESS)
+        return NQ_FAIL;
+
+    return NQ_SUCCESS;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Finish a connection started by syConnectSocketStart()
+ *--------------------------------------------------------------------
+ * PARAMS:  IN socket id
+ *
+ * RETURNS: NQ_SUCCESS or NQ_FAIL
+ *
+ * NOTES:   should be called when the socket becomes writable, restores
+ *          blocking mode
+ *
+ *====================================================================
+ */
+
+NQ_STATUS
+syConnectSocketComplete(
+    SYSocketHandle sock
+    )
+{
+    int error = 0, flags, val0 = 0, val1 = 1;
+    socklen_t len = sizeof(error);
+
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&error, &len) == ERROR || error != 0)
+        return NQ_FAIL;
+
+    flags = fcntl(sock, F_GETFL, 0);
+    if (flags == ERROR || fcntl(sock, F_SETFL, flags & ~O_NONBLOCK) == ERROR)
+        return NQ_FAIL;
+
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (char*)&val0, sizeof(val0));
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&val1, sizeof(val1));
+    return NQ_SUCCESS;
+}
+
 
 /*
  *====================================================================
@@ -1598,6 +1762,36 @@ sySelectSocket(
     return (num == ERROR)? NQ_FAIL : num;
 }
 
+/*
+ *====================================================================
+ * PURPOSE: Wait for pending connections on sockets
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT pointer to file set
+ *          IN select timeout in milliseconds
+ *
+ * RETURNS: number of sockets that completed connection (either way),
+ *          zero on timeout or NQ_FAIL on error
+ *
+ * NOTES:
+ *
+ *====================================================================
+ */
+
+NQ_INT
+sySelectConnectSocket(
+    SYSocketSet* pSet,
+    NQ_UINT32 timeout
+    )
+{
+    struct timeval tv;      /* timeout */
+    int num;                /* the result of select() */
+
+    tv.tv_sec = (time_t)(timeout / 1000);
+    tv.tv_usec = (suseconds_t)((timeout % 1000) * 1000);
+    num = select (FD_SETSIZE, NULL, pSet, NULL, &tv);
+    return (num == ERROR)? NQ_FAIL : num;
+}
+
 /*
  *====================================================================
  * PURPOSE: Receive a UDP message
@@ -2012,6 +2206,126 @@ syOpenFileForReadWrite(
 #endif /* UNICODEFILENAMES */
 }
 
+/*
+ *====================================================================
+ * PURPOSE: Open a directory handle for lookups relative to it
+ *--------------------------------------------------------------------
+ * PARAMS:  IN directory name
+ *
+ * RETURNS: file handle or invalid handle
+ *
+ * NOTES:   the handle is only a base for syGetFileInformationAt() and
+ *          syOpenFileAt() - release it with syCloseFile()
+ *====================================================================
+ */
+
+SYFile
+syOpenDirectoryHandle(
+    const NQ_WCHAR* name
+    )
+{
+#ifdef UNICODEFILENAMES
+    filenameToUtf8(name);
+    return open(staticData->utf8Name, OPEN_DIRHANDLE);
+#else
+    syUnicodeToAnsi(staticData->asciiName, name);
+    cmAnsiToFs(staticData->asciiName, sizeof(staticData->asciiName));
+    return open(staticData->asciiName, OPEN_DIRHANDLE);
+#endif /* UNICODEFILENAMES */
+}
+
+/*
+ *====================================================================
+ * PURPOSE: fill a file information structure for a name relative
+ *          to a directory handle
+ *--------------------------------------------------------------------
+ * PARAMS:  IN directory handle from syOpenDirectoryHandle()
+ *          IN file name relative to this directory
+ *          OUT file information structure
+ *
+ * RETURNS: NQ_SUCCESS or NQ_FAIL
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+NQ_STATUS
+syGetFileInformationAt(
+    SYFile dir,
+    const NQ_WCHAR* name,
+    SYFileInformation* fileInfo
+    )
+{
+    struct stat tmp;
+
+#ifdef UNICODEFILENAMES
+    filenameToUtf8(name);
+    if (fstatat(dir, staticData->utf8Name, &tmp, 0) == -1)
+        return NQ_FAIL;
+#else
+    syUnicodeToAnsi(staticData->asciiName, name);
+    cmAnsiToFs(staticData->asciiName, sizeof(staticData->asciiName));
+    if (fstatat(dir, staticData->asciiName, &tmp, 0) == -1)
+        return NQ_FAIL;
+#endif /* UNICODEFILENAMES */
+
+    statToFileInformation(&tmp, fileInfo);
+
+    return NQ_SUCCESS;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Open file relative to a directory handle
+ *--------------------------------------------------------------------
+ * PARAMS:  IN directory handle from syOpenDirectoryHandle()
+ *          IN file name relative to this directory
+ *          IN one of SY_OPENFILE_xxx
+ *          IN TRUE to deny further openings for read
+ *          IN TRUE to deny further openings for execute
+ *          IN TRUE to deny further openings for write
+ *
+ * RETURNS: file handle or invalid handle
+ *
+ * NOTES:   same as syOpenFileForRead/Write/ReadWrite but without
+ *          walking the path from the root
+ *====================================================================
+ */
+
+SYFile
+syOpenFileAt(
+    SYFile dir,
+    const NQ_WCHAR* name,
+    NQ_UINT access,
+    NQ_BOOL denyread,
+    NQ_BOOL denyexecute,
+    NQ_BOOL denywrite
+    )
+{
+    int flags;
+
+    switch (access)
+    {
+    case SY_OPENFILE_WRITE:
+        flags = OPEN_WRONLY;
+        break;
+    case SY_OPENFILE_READWRITE:
+        flags = OPEN_RDWR;
+        break;
+    default:
+        flags = OPEN_RDONLY;
+    }
+
+#ifdef UNICODEFILENAMES
+    filenameToUtf8(name);
+    return openat(dir, staticData->utf8Name, flags);
+#else
+    syUnicodeToAnsi(staticData->asciiName, name);
+    cmAnsiToFs(staticData->asciiName, sizeof(staticData->asciiName));
+    return openat(dir, staticData->asciiName, flags);
+#endif /* UNICODEFILENAMES */
+}
+
 /*
  *====================================================================
  * PURPOSE: Delete directory
@@ -2573,6 +2887,485 @@ syCloseDirectory(
     return closedir(dir) != ERROR ? NQ_SUCCESS : NQ_FAIL;
 }
 
+#ifdef SY_KQUEUE
+/* find watched directory by its descriptor */
+static WatchDir*
+watchFind(
+    int wd
+    )
+{
+    WatchDir* dir;
+
+    for (dir = staticData->watchDirs; dir != NULL; dir = dir->next)
+    {
+        if (dir->fd == wd)
+            return dir;
+    }
+    return NULL;
+}
+
+/* queue an event, when events cannot be queued an overflow is reported instead */
+static void
+watchQueue(
+    int wd,
+    NQ_UINT32 event,
+    const char* name
+    )
+{
+    WatchEvent* ev;
+
+    if (staticData->watchOverflow)
+        return;
+    if (staticData->watchPending >= WATCH_MAXPENDING ||
+        (ev = (WatchEvent*)syMalloc(sizeof(*ev) + strlen(name))) == NULL)
+    {
+        staticData->watchOverflow = TRUE;
+        return;
+    }
+    ev->next = NULL;
+    ev->wd = wd;
+    ev->event = event;
+    strcpy(ev->name, name);
+    if (staticData->watchTail != NULL)
+        staticData->watchTail->next = ev;
+    else
+        staticData->watchHead = ev;
+    staticData->watchTail = ev;
+    staticData->watchPending++;
+}
+
+/* drop queued events */
+static void
+watchDropEvents(
+    int wd,
+    NQ_BOOL all
+    )
+{
+    WatchEvent** pEv = &staticData->watchHead;
+
+    staticData->watchTail = NULL;
+    while (*pEv != NULL)
+    {
+        WatchEvent* ev = *pEv;
+
+        if (all || ev->wd == wd)
+        {
+            *pEv = ev->next;
+            staticData->watchPending--;
+            syFree(ev);
+            continue;
+        }
+        staticData->watchTail = ev;
+        pEv = &ev->next;
+    }
+}
+
+static NQ_UINT
+watchHash(
+    const char* name
+    )
+{
+    NQ_UINT hash = 5381;      /* djb2 */
+
+    for (; *name != '\0'; name++)
+        hash = (hash << 5) + hash + (NQ_BYTE)*name;
+    return hash & (WATCH_NUMBUCKETS - 1);
+}
+
+/* free the entries of the last scan */
+static void
+watchFreeEntries(
+    WatchDir* dir
+    )
+{
+    NQ_UINT i;
+
+    for (i = 0; i < WATCH_NUMBUCKETS; i++)
+    {
+        while (dir->entries[i] != NULL)
+        {
+            WatchEntry* entry = dir->entries[i];
+
+            dir->entries[i] = entry->next;
+            syFree(entry);
+        }
+    }
+}
+
+/* read the directory and compare it with the last scan, differences are queued when report is TRUE */
+static void
+watchScan(
+    WatchDir* dir,
+    NQ_BOOL report
+    )
+{
+    DIR* d;
+    struct dirent* de;
+    NQ_UINT i;
+
+    if ((d = opendir(dir->path)) == NULL)
+        return;
+    while ((de = readdir(d)) != NULL)
+    {
+        struct stat st;
+        WatchEntry* entry;
+        NQ_UINT bucket;
+        NQ_UINT32 flag;
+
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            continue;
+        flag = S_ISDIR(st.st_mode) ? SY_FILEWATCH_ISDIRECTORY : 0;
+        bucket = watchHash(de->d_name);
+        for (entry = dir->entries[bucket]; entry != NULL; entry = entry->next)
+        {
+            if (strcmp(entry->name, de->d_name) == 0)
+                break;
+        }
+        if (entry == NULL)
+        {
+            entry = (WatchEntry*)syMalloc(sizeof(*entry) + strlen(de->d_name));
+            if (entry == NULL)
+            {
+                staticData->watchOverflow = TRUE;
+                continue;
+            }
+            strcpy(entry->name, de->d_name);
+            entry->next = dir->entries[bucket];
+            dir->entries[bucket] = entry;
+            if (report)
+                watchQueue(dir->fd, SY_FILEWATCH_ADDED | flag, entry->name);
+        }
+        else if (report && (entry->mtime != st.st_mtime || entry->size != st.st_size))
+        {
+            watchQueue(dir->fd, SY_FILEWATCH_MODIFIED | flag, entry->name);
+        }
+        entry->isDirectory = flag != 0;
+        entry->mtime = st.st_mtime;
+        entry->size = st.st_size;
+        entry->seen = TRUE;
+    }
+    closedir(d);
+
+    for (i = 0; i < WATCH_NUMBUCKETS; i++)
+    {
+        WatchEntry** pEntry = &dir->entries[i];
+
+        while (*pEntry != NULL)
+        {
+            WatchEntry* entry = *pEntry;
+
+            if (!entry->seen)
+            {
+                if (report)
+                    watchQueue(dir->fd, SY_FILEWATCH_REMOVED | (entry->isDirectory ? SY_FILEWATCH_ISDIRECTORY : 0), entry->name);
+                *pEntry = entry->next;
+                syFree(entry);
+                continue;
+            }
+            entry->seen = FALSE;
+            pEntry = &entry->next;
+        }
+    }
+}
+
+/* stop watching a directory and release it */
+static void
+watchRelease(
+    WatchDir* dir
+    )
+{
+    WatchDir** pDir;
+
+    for (pDir = &staticData->watchDirs; *pDir != NULL; pDir = &(*pDir)->next)
+    {
+        if (*pDir == dir)
+        {
+            *pDir = dir->next;
+            break;
+        }
+    }
+    watchDropEvents(dir->fd, FALSE);
+    close(dir->fd);
+    watchFreeEntries(dir);
+    syFree(dir);
+}
+#endif /* SY_KQUEUE */
+
+/*
+ *====================================================================
+ * PURPOSE: Open a directory change watch
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: watch handle or invalid handle
+ *
+ * NOTES:   the handle is non-blocking
+ *
+ *====================================================================
+ */
+
+SYFileWatch
+syFileWatchOpen(
+    void
+    )
+{
+#ifdef SY_KQUEUE
+    int kq;
+
+    staticData->watchDirs = NULL;
+    staticData->watchHead = NULL;
+    staticData->watchTail = NULL;
+    staticData->watchPending = 0;
+    staticData->watchOverflow = FALSE;
+    kq = kqueue();
+    if (kq != ERROR)
+        fcntl(kq, F_SETFD, FD_CLOEXEC);
+    return kq;
+#else  /* SY_KQUEUE */
+    errno = ENOSYS;
+    return ERROR;
+#endif /* SY_KQUEUE */
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Close a directory change watch
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch handle
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *
+ *====================================================================
+ */
+
+void
+syFileWatchClose(
+    SYFileWatch watch
+    )
+{
+#ifdef SY_KQUEUE
+    while (staticData->watchDirs != NULL)
+        watchRelease(staticData->watchDirs);
+    watchDropEvents(ERROR, TRUE);
+    close(watch);
+#endif /* SY_KQUEUE */
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Start watching a directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch handle
+ *          IN directory name
+ *
+ * RETURNS: watch descriptor or NQ_FAIL
+ *
+ * NOTES:   watching the same directory twice returns the same descriptor,
+ *          the directory contents are kept to tell which entries changed
+ *
+ *====================================================================
+ */
+
+NQ_INT
+syFileWatchAdd(
+    SYFileWatch watch,
+    const NQ_WCHAR* dirName
+    )
+{
+#ifdef SY_KQUEUE
+    const char* path;
+    WatchDir* dir;
+    struct kevent change;
+
+#ifdef UNICODEFILENAMES
+    filenameToUtf8(dirName);
+    path = staticData->utf8Name;
+#else
+    syUnicodeToAnsi(staticData->asciiName, dirName);
+    cmAnsiToFs(staticData->asciiName, sizeof(staticData->asciiName));
+    path = staticData->asciiName;
+#endif /* UNICODEFILENAMES */
+
+    for (dir = staticData->watchDirs; dir != NULL; dir = dir->next)
+    {
+        if (strcmp(dir->path, path) == 0)
+            return dir->fd;
+    }
+
+    dir = (WatchDir*)syCalloc(1, sizeof(*dir) + strlen(path));
+    if (dir == NULL)
+        return NQ_FAIL;
+    strcpy(dir->path, path);
+    dir->fd = open(path, WATCH_OPENFLAGS);
+    if (dir->fd == ERROR)
+    {
+        syFree(dir);
+        return NQ_FAIL;
+    }
+    EV_SET(&change, dir->fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, WATCH_NOTES, 0, NULL);
+    if (kevent(watch, &change, 1, NULL, 0, NULL) == ERROR)
+    {
+        close(dir->fd);
+        syFree(dir);
+        return NQ_FAIL;
+    }
+    watchScan(dir, FALSE);
+    dir->next = staticData->watchDirs;
+    staticData->watchDirs = dir;
+    return dir->fd;
+#else  /* SY_KQUEUE */
+    return NQ_FAIL;
+#endif /* SY_KQUEUE */
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Stop watching a directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch handle
+ *          IN watch descriptor
+ *
+ * RETURNS: None
+ *
+ * NOTES:   closing the descriptor removes its kqueue filter
+ *
+ *====================================================================
+ */
+
+void
+syFileWatchRemove(
+    SYFileWatch watch,
+    NQ_INT wd
+    )
+{
+#ifdef SY_KQUEUE
+    WatchDir* dir = watchFind(wd);
+
+    if (dir != NULL)
+        watchRelease(dir);
+#endif /* SY_KQUEUE */
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Get next directory change
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch handle
+ *          OUT buffer for watch descriptor
+ *          OUT buffer for SY_FILEWATCH_xxx event
+ *          OUT buffer for a pointer to the entry name
+ *
+ * RETURNS: NQ_SUCCESS or NQ_FAIL when no more events are pending
+ *
+ * NOTES:   kqueue tells only that a directory changed, the changed entries are
+ *          found by comparing the directory with its previous contents. A rename
+ *          is reported as remove and add, a file modified in place is reported
+ *          when the directory itself changes
+ *
+ *====================================================================
+ */
+
+NQ_STATUS
+syFileWatchNext(
+    SYFileWatch watch,
+    NQ_INT* wd,
+    NQ_UINT32* event,
+    const NQ_WCHAR** fileName
+    )
+{
+#ifdef SY_KQUEUE
+    static NQ_WCHAR tcharName[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_FILENAMELEN)];
+    WatchEvent* ev;
+
+    if (staticData->watchHead == NULL && !staticData->watchOverflow)
+    {
+        struct kevent changes[16];
+        struct timespec timeout = {0, 0};
+        int num;
+        int i;
+
+        num = kevent(watch, NULL, 0, changes, (int)(sizeof(changes) / sizeof(changes[0])), &timeout);
+        for (i = 0; i < num; i++)
+        {
+            WatchDir* dir = watchFind((int)changes[i].ident);
+
+            if (dir == NULL || dir->gone)
+                continue;
+            if (changes[i].fflags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE))
+            {
+                /* the descriptor stays open until the watch is removed, so it is not reused meanwhile */
+                dir->gone = TRUE;
+                watchQueue(dir->fd, SY_FILEWATCH_GONE, "");
+            }
+            else if (changes[i].fflags & (NOTE_WRITE | NOTE_EXTEND))
+            {
+                watchScan(dir, TRUE);
+            }
+        }
+    }
+
+    if (staticData->watchOverflow)
+    {
+        WatchDir* dir;
+
+        /* start over from the current contents, removed directories are reported again */
+        watchDropEvents(ERROR, TRUE);
+        for (dir = staticData->watchDirs; dir != NULL; dir = dir->next)
+        {
+            if (!dir->gone)
+            {
+                watchFreeEntries(dir);
+                watchScan(dir, FALSE);
+            }
+        }
+        staticData->watchOverflow = FALSE;
+        for (dir = staticData->watchDirs; dir != NULL; dir = dir->next)
+        {
+            if (dir->gone)
+                watchQueue(dir->fd, SY_FILEWATCH_GONE, "");
+        }
+        *wd = ERROR;
+        *event = SY_FILEWATCH_OVERFLOW;
+        tcharName[0] = 0;
+        *fileName = tcharName;
+        return NQ_SUCCESS;
+    }
+
+    if ((ev = staticData->watchHead) == NULL)
+        return NQ_FAIL;
+    staticData->watchHead = ev->next;
+    if (staticData->watchHead == NULL)
+        staticData->watchTail = NULL;
+    staticData->watchPending--;
+
+    *wd = ev->wd;
+    *event = ev->event;
+    tcharName[0] = 0;
+    if (ev->name[0] != '\0')
+    {
+#ifdef UNICODEFILENAMES
+        strncpy(staticData->utf8Name, ev->name, sizeof(staticData->utf8Name) - 1);
+        staticData->utf8Name[sizeof(staticData->utf8Name) - 1] = '\0';
+        filenameFromUtf8(tcharName, sizeof(tcharName));
+#else
+        strncpy(staticData->asciiName, ev->name, sizeof(staticData->asciiName) - 1);
+        staticData->asciiName[sizeof(staticData->asciiName) - 1] = '\0';
+        cmFsToAnsi(staticData->asciiName, sizeof(staticData->asciiName));
+        syAnsiToUnicode(tcharName, staticData->asciiName);
+#endif /* UNICODEFILENAMES */
+    }
+    syFree(ev);
+    *fileName = tcharName;
+    return NQ_SUCCESS;
+#else  /* SY_KQUEUE */
+    return NQ_FAIL;
+#endif /* SY_KQUEUE */
+}
+
 /*
  *====================================================================
  * PURPOSE: Delete file
@@ -2826,31 +3619,19 @@ syUnicodeToUTF8N(
     NQ_COUNT size 
     )
 {
-    iconv_t convertor;
-    size_t inbytesleft = (syWStrlen(w) + 1) * sizeof(unsigned short);
-    size_t outbytesleft = size;
-    char *in = (char *)w;
-    char *out = u;
-    
+    NQ_INT res;
+
     TRCB();
 
-    if ((convertor = iconv_open("UTF-8", "UTF-16LE")) == (iconv_t)-1)
-    {
-        TRCERR("Unable to open converter (UTF-16LE to UTF-8)");
-        TRCE();
-        return;
-    }
-    TRC("opened converter");
-    if (iconv(convertor, &in, &inbytesleft, &out, &outbytesleft) == (size_t)-1)
+    res = cmUtf16LEToUtf8(u, size, w, -1);
+    if (res == NQ_FAIL)
     {
-        iconv_close(convertor);
         TRCERR("Unable to convert UTF-16LE to UTF-8");
         TRCE();
         return;
     }
-    iconv_close(convertor);
 
-    TRC("Remain unconverted %d symbols", outbytesleft);
+    TRC("Converted %d bytes", res);
     TRCE();
 }
 
@@ -2861,31 +3642,19 @@ syUTF8ToUnicodeN(
     NQ_COUNT size 
     )
 {
-    iconv_t convertor;
-    size_t inbytesleft = strlen(u) + 1;
-    size_t outbytesleft = size;
-    char *in = (char *)u;
-    char *out = (char*)w;
+    NQ_INT res;
 
     TRCB();
 
-    if ((convertor = iconv_open("UTF-16LE", "UTF-8")) == (iconv_t)-1)
+    res = cmUtf8ToUtf16LE(w, size / sizeof(NQ_WCHAR), u, -1);
+    if (res == NQ_FAIL)
     {
-        TRCERR("Unable to open converter (UTF-8 to UTF-16LE)");
-        TRCE();
-        return;
-    }
-
-    if (iconv(convertor, &in, &inbytesleft, &out, &outbytesleft) == (size_t)-1)
-    {
-        iconv_close(convertor);
         TRCERR("Unable to convert UTF-8 to UTF-16LE");
         TRCE();
         return;
     }
-    iconv_close(convertor);
 
-    TRC("Remain unconverted %d symbols", outbytesleft);
+    TRC("Converted %d symbols", res);
     TRCE();
 }
 #endif /* UD_CC_INCLUDELDAP */
@@ -2997,45 +3766,3 @@ void syThreadStart(SYThread *taskIdPtr, void (*startpoint)(void), NQ_BOOL backgr
 	pthread_attr_destroy(&attr);
 }
 
-#ifdef UD_NQ_CODEPAGEUTF8
-	
-void initCodePageUTF8()
-{
-	utf16LE_to_Utf8 = iconv_open("UTF-8", "UTF-16LE");
-	utf8_to_Utf16LE = iconv_open("UTF-16LE", "UTF-8");
-}
-
-NQ_UINT32 convertCodePageUTF8toUtf16LE(NQ_CHAR **inBuf, NQ_UINT32 *inBytesLeft, NQ_CHAR **outBuf, NQ_UINT32 *outBytesLeft)
-{
-	NQ_UINT32 size;
-	
-	size = (NQ_UINT32)iconv(utf8_to_Utf16LE, inBuf, (size_t*)inBytesLeft, outBuf, (size_t*)outBytesLeft);
-#ifdef SY_DEBUGMODE
-	if (size == -1)
-	{
-		int errsv = errno;
-		LOGERR(CM_TRC_LEVEL_ERROR, "failed conversion utf8_to_Utf16LE, error: %d %s\n", errsv, strerror(errsv));
-	}	
-#endif
-
-	return size;
-}
-NQ_UINT32 convertCodePageUtf16LEtoUTF8(NQ_CHAR **inBuf, NQ_UINT32 *inBytesLeft, NQ_CHAR **outBuf, NQ_UINT32 *outBytesLeft)
-{
-	NQ_UINT32 size;
-	
-	size = (NQ_UINT32)iconv(utf16LE_to_Utf8, inBuf, (size_t*)inBytesLeft, outBuf, (size_t*)outBytesLeft);
-#ifdef SY_DEBUGMODE
-	if (size == -1)
-	{
-		int errsv = errno;
-		LOGERR(CM_TRC_LEVEL_ERROR, "failed conversion utf16LE_to_Utf8, error: %d %s", errsv, strerror(errsv));
-	}
-#endif
-	return size;
-}
-					
-#endif /* UD_NQ_CODEPAGEUTF8 */
-
-
-
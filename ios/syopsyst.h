@@ -121,6 +121,11 @@ void syMutexGive(SYMutex* _m);
 #define sySemaphoreGetCount(_s , _val) sem_getvalue(&_s , _val)
 NQ_INT	sySemaphoreTimedTake( SYSemaphore *sem , NQ_INT timeout);
 
+/* atomic operations on 32-bit values, each is a full memory barrier */
+#define syAtomicAdd(_p, _val)                   __sync_add_and_fetch((_p), (_val))
+#define syAtomicCompareAndSwap(_p, _old, _new)  __sync_bool_compare_and_swap((_p), (_old), (_new))
+#define syMemoryBarrier()                       __sync_synchronize()
+
 /*
     Sockets
     -------
@@ -272,6 +277,20 @@ syConnectSocket(
     NQ_PORT port            /* port number of the server in NBO */
     );
 
+/* Start connecting to a remote server port without blocking */
+NQ_STATUS                   /* NQ_SUCCESS or NQ_FAIL */
+syConnectSocketStart(
+    SYSocketHandle sock,    /* socket handle */
+    const NQ_IPADDRESS *ip, /* IP address of the server in NBO */
+    NQ_PORT port            /* port number of the server in NBO */
+    );
+
+/* Finish a connection started by syConnectSocketStart() */
+NQ_STATUS                   /* NQ_SUCCESS or NQ_FAIL */
+syConnectSocketComplete(
+    SYSocketHandle sock     /* socket handle */
+    );
+
 /* Send bytes over a connected socket */
 NQ_INT                      /* NQ_SUCCESS or NQ_FAIL */
 sySendSocket(
@@ -297,6 +316,14 @@ sySelectSocket(
     NQ_UINT32 timeout       /* timeout in seconds */
     );
 
+/* Wait for pending connections on sockets */
+NQ_INT                      /* number of sockets that completed connection, zero on timeout or */
+                            /* NQ_FAIL on error */
+sySelectConnectSocket(
+    SYSocketSet* pset,      /* pointer to the file set */
+    NQ_UINT32 timeout       /* timeout in milliseconds */
+    );
+
 /* Receive a UDP message */
 NQ_INT                      /* number of bytes received or NQ_FAIL */
 syRecvFromSocket(
@@ -409,6 +436,56 @@ syCloseDirectory(
     SYDirectory dir
     );
 
+/* Directory change watch: reports changes made to watched directories by any process.
+   Implemented with kqueue on Darwin, otherwise syFileWatchOpen() fails. */
+
+#define SYFileWatch                     int
+#define syIsValidFileWatch(_w)          ((_w) != ERROR)
+
+#define SY_FILEWATCH_ADDED              1       /* entry created or moved in */
+#define SY_FILEWATCH_REMOVED            2       /* entry deleted or moved out */
+#define SY_FILEWATCH_MODIFIED           3       /* entry data or attributes changed */
+#define SY_FILEWATCH_RENAMEDOLD         4       /* entry renamed within the directory - old name */
+#define SY_FILEWATCH_RENAMEDNEW         5       /* entry renamed within the directory - new name */
+#define SY_FILEWATCH_GONE               6       /* watched directory removed, the watch no longer exists */
+#define SY_FILEWATCH_OVERFLOW           7       /* events were lost, watch descriptor is not set */
+#define SY_FILEWATCH_ISDIRECTORY        ((NQ_UINT32)0x100)  /* flag: the entry is a directory */
+
+/* Open a watch object, it never blocks when reading events */
+SYFileWatch                             /* watch handle or invalid handle */
+syFileWatchOpen(
+    void
+    );
+
+/* Close watch object with all its watches */
+void
+syFileWatchClose(
+    SYFileWatch watch                   /* watch handle */
+    );
+
+/* Start watching a directory */
+NQ_INT                                  /* watch descriptor or NQ_FAIL */
+syFileWatchAdd(
+    SYFileWatch watch,                  /* watch handle */
+    const NQ_WCHAR* dirName             /* full directory path */
+    );
+
+/* Stop watching a directory */
+void
+syFileWatchRemove(
+    SYFileWatch watch,                  /* watch handle */
+    NQ_INT wd                           /* watch descriptor */
+    );
+
+/* Get next pending event */
+NQ_STATUS                               /* NQ_SUCCESS or NQ_FAIL when no event is pending */
+syFileWatchNext(
+    SYFileWatch watch,                  /* watch handle */
+    NQ_INT* wd,                         /* buffer for watch descriptor */
+    NQ_UINT32* event,                   /* buffer for SY_FILEWATCH_xxx event (may include the directory flag) */
+    const NQ_WCHAR** fileName           /* buffer for a pointer to entry name (empty for directory events) */
+    );
+
 /*
     Files
     -----
@@ -481,6 +558,29 @@ syOpenFileForReadWrite(
     );
 
 
+/* access modes for syOpenFileAt() */
+#define SY_OPENFILE_READ                0
+#define SY_OPENFILE_WRITE               1
+#define SY_OPENFILE_READWRITE           2
+
+/* Open directory handle as a base for relative lookups */
+SYFile                                  /* file handle or invalid handle */
+syOpenDirectoryHandle(
+    const NQ_WCHAR* name                /* directory name */
+    );
+
+/* Open file relative to a directory handle */
+SYFile                                  /* file handle or invalid handle */
+syOpenFileAt(
+    SYFile dir,                         /* directory handle */
+    const NQ_WCHAR* name,               /* file name relative to dir */
+    NQ_UINT access,                     /* one of SY_OPENFILE_xxx */
+    NQ_BOOL denyread,                   /* true - to deny sharing for read */
+    NQ_BOOL denyexecute,                /* true - to deny sharing for execute */
+    NQ_BOOL denywrite                   /* true - to deny sharing for write */
+    );
+
+
 /* Truncate file */ 
 NQ_STATUS                               /* NQ_SUCCESS or NQ_FAIL */
 syTruncateFile(
@@ -557,6 +657,14 @@ syGetFileInformationByName(
     SYFileInformation* fileInfo         /* file information structure */
     );
 
+/* Read file information structure by name relative to a directory handle */
+NQ_STATUS                               /* NQ_SUCCESS or NQ_FAIL */
+syGetFileInformationAt(
+    SYFile dir,                         /* directory handle */
+    const NQ_WCHAR* name,               /* file name relative to dir */
+    SYFileInformation* fileInfo         /* file information structure */
+    );
+
 /* Update file information by either file name or file handle */
 NQ_STATUS                               /* NQ_SUCCESS or NQ_FAIL */
 sySetFileInformation(
@@ -679,6 +787,12 @@ syGetAdapter(
     NQ_IPADDRESS4 *wins     /* buffer for wins address in NBO (may be 0 for a B-node) */
     );
 
+/* Get link speed of the adapter carrying the given address */
+NQ_UINT32                   /* speed in Mbit/s or 0 when unknown */
+syGetAdapterLinkSpeed(
+    NQ_IPADDRESS4 ip        /* adapter IP in NBO */
+    );
+
 #ifdef UD_CS_INCLUDEDIRECTTRANSFER
 
 /*
@@ -1182,6 +1182,30 @@ udEventLog (
 
 #endif /* UD_NQ_INCLUDEEVENTLOG */
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+
+/*
+ *====================================================================
+ * PURPOSE: Return the full path of the durable handle journal
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT buffer for the result
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+void
+udGetDurableJournalFile(
+    NQ_CHAR* buffer
+    )
+{
+    udDefGetDurableJournalFile(buffer);
+}
+
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #ifdef UD_CS_INCLUDEDOMAINMEMBERSHIP
 
 NQ_BOOL
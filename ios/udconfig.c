@@ -75,6 +75,25 @@
 
 #endif
 
+#ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
+
+/* local users loaded from the password file */
+
+#define USER_HASHSIZE   64      /* number of hash buckets, power of 2 */
+#define USER_NONE       (-1)    /* end of a hash chain */
+
+typedef struct
+{
+    char name[50];              /* user name as it appears in the file */
+    char key[50];               /* lower case user name */
+    NQ_UINT32 rid;              /* user ID */
+    int nextByName;             /* next user in the same name bucket */
+    int nextByRid;              /* next user in the same ID bucket */
+}
+UserEntry;
+
+#endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
+
 typedef struct
 {
 /* buffers in the user space. The deafult implementation uses static buffers. */
@@ -103,6 +122,9 @@ typedef struct
     char shareSdFile[250];   /* full path to file for share SD */
     char tempFileName[250];  /* full path to a temporary file */
     char secretFile[250];        /* full path to a secret file */
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+    char durableFile[250];   /* full path to the durable handle journal */
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 #ifdef UD_NQ_INCLUDEEVENTLOG
     char logFile[250];       /* full path to file for event log */
 #endif /* UD_NQ_INCLUDEEVENTLOG */
@@ -117,6 +139,18 @@ typedef struct
     char userName[CM_USERNAMELENGTH];     /* buffer for user's name - set in udSetCredentials*/
     char password[UD_NQ_MAXPWDLEN];       /* buffer for user's password - set in udSetCredentials*/
     char domainNameOfServer[CM_NQ_HOSTNAMESIZE];  /* buffer for domain name with which the client conects to the server */
+#ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
+    UserEntry* users;            /* users in the order of the password file */
+    int numUsers;                /* number of loaded users */
+    int usersByName[USER_HASHSIZE];  /* hash buckets by lower case name */
+    int usersByRid[USER_HASHSIZE];   /* hash buckets by user ID */
+    int usersLoaded;             /* will be set to 1 when the user table reflects the password file */
+    int usersFilePresent;        /* password file existed when users were loaded */
+    time_t usersFileTime;        /* password file modification time */
+    off_t usersFileSize;         /* password file size */
+    ino_t usersFileIno;          /* password file inode, changes when the file is rewritten */
+    SYMutex usersGuard;          /* protects the user table against a reload while it is read */
+#endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
 }
 StaticData;
 
@@ -163,6 +197,16 @@ convertPasswordToText(
     const NQ_BYTE* password,
     NQ_CHAR* buffer
     );
+
+static void
+refreshUsers(
+    void
+    );
+
+static int
+hashUserName(
+    const char* key
+    );
 #endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
 
 #ifdef UD_NQ_INCLUDEEVENTLOG
@@ -309,6 +353,12 @@ udDefInit(
     staticData->logHandleFlag = 0;
     staticData->isSecretFileLoaded = 0;
     staticData->isSecretAvailable = 0;
+#ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
+    staticData->users = NULL;
+    staticData->numUsers = 0;
+    staticData->usersLoaded = 0;
+    syMutexCreate(&staticData->usersGuard);
+#endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
 
     return NQ_SUCCESS;
 }
@@ -331,6 +381,20 @@ udDefStop(
     )
 
 {
+#ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
+#ifdef SY_FORCEALLOCATION
+    if (NULL != staticData)
+#endif /* SY_FORCEALLOCATION */
+    {
+        if (NULL != staticData->users)
+            syFree(staticData->users);
+        staticData->users = NULL;
+        staticData->numUsers = 0;
+        staticData->usersLoaded = 0;
+        syMutexDelete(&staticData->usersGuard);
+    }
+#endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
+
     /* release memory */
 #ifdef SY_FORCEALLOCATION
     if (NULL != staticData)
@@ -1106,42 +1170,13 @@ udDefGetUserCount(
     void
     )
 {
-    ParseContext userParser;    /* parser for reading the password list */
-    NQ_COUNT count = 0;
-
-    setFileNames();
-    if (!parseInit(&userParser, staticData->passwordFile)) /* start parsing */
-    {
-        return 0;    /* no users */
-    }
-
-    /* cycle by lines of the parameter file */
-
-    while (1)
-    {
-        char ch;                        /* next character */
-
-        if (parseAtFileEnd(&userParser))    /* EOF */
-        {
-            parseStop(&userParser);
-            return count;
-        }
+    NQ_COUNT result;    /* number of users */
 
-        parseSkipSpaces(&userParser);
-        if (parseAtLineEnd(&userParser))            /* empty line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        if ((ch = parseGet(&userParser)) == '#')    /* comment  line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        parseUnget(&userParser, ch);
-        parseSkipLine(&userParser);
-        count++;
-    }
+    syMutexTake(&staticData->usersGuard);
+    refreshUsers();
+    result = (NQ_COUNT)staticData->numUsers;
+    syMutexGive(&staticData->usersGuard);
+    return result;
 }
 
 /*
@@ -1163,14 +1198,8 @@ udDefGetUserRidByName(
     NQ_UINT32* rid
     )
 {
-    ParseContext userParser;    /* parser for reading the password list */
-    NQ_STATIC char nextName[50];       /* next user name */
-    NQ_STATIC char userNameA[256];     /* user name in ASCII */
-    NQ_STATIC char password[256];     /* password in ASCII */
+    char userNameA[256];            /* user name in ASCII, on the stack since callers run concurrently */
     int i;
-    char userNumText[12];
-
-    /* start parsing passwords */
 
     syUnicodeToAnsi(userNameA, name);
 
@@ -1179,59 +1208,19 @@ udDefGetUserRidByName(
         userNameA[i] = (char)tolower(((int)userNameA[i]));
     }
 
-    setFileNames();
-    if (!parseInit(&userParser, staticData->passwordFile)) /* start parsing */
+    syMutexTake(&staticData->usersGuard);
+    refreshUsers();
+    for (i = staticData->usersByName[hashUserName(userNameA)]; i != USER_NONE; i = staticData->users[i].nextByName)
     {
-        return FALSE;           /* proceed without authentication */
-    }
-
-    /* cycle by lines of the parameter file */
-
-    while (1)
-    {
-        char ch;                        /* next character */
-
-        if (parseAtFileEnd(&userParser))    /* EOF */
-        {
-            parseStop(&userParser);
-            return FALSE;                   /* user not found */
-        }
-
-        parseSkipSpaces(&userParser);
-        if (parseAtLineEnd(&userParser))            /* empty line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        if ((ch = parseGet(&userParser)) == '#')    /* comment  line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        parseUnget(&userParser, ch);
-        parseSkipSpaces(&userParser);
-        parseName(&userParser, nextName, 50);      /* user name */
-        for (i = 0; i < strlen(nextName); i++)
-        {
-            nextName[i] = (char)tolower(((int)nextName[i]));
-        }
-        if (parseDelimiter(&userParser, ':'))
+        if (strcmp(userNameA, staticData->users[i].key) == 0)
         {
-            parseValue(&userParser, password, 70, ':');  /* password */
-        }
-        if (parseDelimiter(&userParser, ':'))
-        {
-            parseValue(&userParser, userNumText, sizeof(userNumText) - 1, ':');  /* ID */
-        }
-        parseSkipLine(&userParser);
-
-        if (strcmp(userNameA, nextName) == 0)
-        {
-            *rid = (NQ_UINT32)atol(userNumText);
-            parseStop(&userParser);
+            *rid = staticData->users[i].rid;
+            syMutexGive(&staticData->usersGuard);
             return TRUE; /* user found */
         }
     }
+    syMutexGive(&staticData->usersGuard);
+    return FALSE;                   /* user not found */
 }
 
 /*
@@ -1255,61 +1244,22 @@ udDefGetUserNameByRid(
     NQ_WCHAR* fullNameBuffer
     )
 {
-    ParseContext userParser;    /* parser for reading the password list */
-    char name[50];              /* next user name */
-    char userNumText[12];
-    NQ_STATIC char password[256];     /* password in ASCII */
-
-    setFileNames();
-    if (!parseInit(&userParser, staticData->passwordFile)) /* start parsing */
-    {
-        return FALSE;           /* proceed without authentication */
-    }
-
-    /* cycle by lines of the parameter file */
+    int i;
 
-    while (1)
+    syMutexTake(&staticData->usersGuard);
+    refreshUsers();
+    for (i = staticData->usersByRid[rid & (USER_HASHSIZE - 1)]; i != USER_NONE; i = staticData->users[i].nextByRid)
     {
-        char ch;                        /* next character */
-
-        if (parseAtFileEnd(&userParser))    /* EOF */
-        {
-            parseStop(&userParser);
-            return FALSE;                   /* user not found */
-        }
-
-        parseSkipSpaces(&userParser);
-        if (parseAtLineEnd(&userParser))            /* empty line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        if ((ch = parseGet(&userParser)) == '#')    /* comment  line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        parseUnget(&userParser, ch);
-        parseSkipSpaces(&userParser);
-        parseName(&userParser, name, 50);      /* user name */
-        if (parseDelimiter(&userParser, ':'))
+        if (rid == staticData->users[i].rid)
         {
-            parseValue(&userParser, password, 70, ':');  /* password */
-        }
-        if (parseDelimiter(&userParser, ':'))
-        {
-            parseValue(&userParser, userNumText, sizeof(userNumText) - 1, ':');  /* ID */
-        }
-        parseSkipLine(&userParser);
-
-        if ((NQ_INT)rid == (NQ_INT)atol(userNumText))
-        {
-            syAnsiToUnicode(nameBuffer, name);
-            syAnsiToUnicode(fullNameBuffer, name);
-            parseStop(&userParser);
+            syAnsiToUnicode(nameBuffer, staticData->users[i].name);
+            syAnsiToUnicode(fullNameBuffer, staticData->users[i].name);
+            syMutexGive(&staticData->usersGuard);
             return TRUE; /* user found */
         }
     }
+    syMutexGive(&staticData->usersGuard);
+    return FALSE;                   /* user not found */
 }
 
 /*
@@ -1337,63 +1287,23 @@ udDefGetUserInfo(
     NQ_WCHAR* description
     )
 {
-    ParseContext userParser;    /* parser for reading the password list */
-    char name[50];              /* next user name */
-    char userNumText[12];
-    NQ_STATIC char password[256];     /* password in ASCII */
+    const UserEntry* pUser;     /* user with this index */
 
-    setFileNames();
-    if (!parseInit(&userParser, staticData->passwordFile)) /* start parsing */
+    syMutexTake(&staticData->usersGuard);
+    refreshUsers();
+    if (index >= (NQ_UINT)staticData->numUsers)
     {
-        return FALSE;           /* proceed without authentication */
+        syMutexGive(&staticData->usersGuard);
+        return FALSE;                   /* user not found */
     }
 
-    /* cycle by lines of the parameter file */
-
-    while (1)
-    {
-        char ch;                        /* next character */
-
-        if (parseAtFileEnd(&userParser))    /* EOF */
-        {
-            parseStop(&userParser);
-            return FALSE;                   /* user not found */
-        }
-
-        parseSkipSpaces(&userParser);
-        if (parseAtLineEnd(&userParser))            /* empty line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        if ((ch = parseGet(&userParser)) == '#')    /* comment  line? */
-        {
-            parseSkipLine(&userParser);
-            continue;
-        }
-        parseUnget(&userParser, ch);
-        parseSkipSpaces(&userParser);
-        parseName(&userParser, name, 50);      /* user name */
-        if (parseDelimiter(&userParser, ':'))
-        {
-            parseValue(&userParser, password, 70, ':');  /* password */
-        }
-        if (parseDelimiter(&userParser, ':'))
-        {
-            parseValue(&userParser, userNumText, sizeof(userNumText) - 1, ':');  /* ID */
-        }
-        parseSkipLine(&userParser);
-
-        if (index-- <= 0)
-        {
-            *rid = (NQ_UINT32)atol(userNumText);
-            syAnsiToUnicode(shortName, name);
-            syAnsiToUnicode(fullName, name);
-            syAnsiToUnicode(description, ((NQ_INT)*rid) < 0? "Administrator":"Ordinary user");
-            parseStop(&userParser);
-            return TRUE; /* user found */
-        }
-    }
+    pUser = &staticData->users[index];
+    *rid = pUser->rid;
+    syAnsiToUnicode(shortName, pUser->name);
+    syAnsiToUnicode(fullName, pUser->name);
+    syMutexGive(&staticData->usersGuard);
+    syAnsiToUnicode(description, ((NQ_INT)*rid) < 0? "Administrator":"Ordinary user");
+    return TRUE; /* user found */
 }
 
 /*
@@ -1514,6 +1424,9 @@ udDefSetUserInfo
          fclose(tempFile);
         unlink(staticData->passwordFile);
          rename((const char*)staticData->tempFileName, staticData->passwordFile);
+        syMutexTake(&staticData->usersGuard);
+        staticData->usersLoaded = 0;
+        syMutexGive(&staticData->usersGuard);
         return TRUE;
     }
     else
@@ -1620,6 +1533,9 @@ udDefCreateUser(
      fclose(tempFile);
     unlink(staticData->passwordFile);
      rename((const char*)staticData->tempFileName, staticData->passwordFile);
+    syMutexTake(&staticData->usersGuard);
+    staticData->usersLoaded = 0;
+    syMutexGive(&staticData->usersGuard);
     return TRUE;
 }
 
@@ -1729,6 +1645,9 @@ udDefSetUserAsAdministrator(
      fclose(tempFile);
     unlink(staticData->passwordFile);
      rename((const char*)staticData->tempFileName, staticData->passwordFile);
+    syMutexTake(&staticData->usersGuard);
+    staticData->usersLoaded = 0;
+    syMutexGive(&staticData->usersGuard);
     return TRUE;
 }
 
@@ -1816,6 +1735,9 @@ udDefDeleteUserByRid(
     fclose(tempFile);
     unlink(staticData->passwordFile);
     rename((const char*)staticData->tempFileName, staticData->passwordFile);
+    syMutexTake(&staticData->usersGuard);
+    staticData->usersLoaded = 0;
+    syMutexGive(&staticData->usersGuard);
     return userDeleted? TRUE : FALSE;
 }
 
@@ -2487,6 +2409,14 @@ setFileNames(
             strcat(staticData->secretFile, "/");
         }
         strcat(staticData->secretFile, "secret.txt");
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+        strcpy(staticData->durableFile, NQ_CONFIGPATH);
+        if (*(staticData->durableFile + strlen(staticData->durableFile) - 1) != '/')
+        {
+            strcat(staticData->durableFile, "/");
+        }
+        strcat(staticData->durableFile, UD_CS_DURABLEJOURNAL_FILENAME);
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 
         staticData->fileNamesReady = 1;
     }
@@ -2640,8 +2570,199 @@ convertPasswordToText(
     }
 }
 
+/*
+ *====================================================================
+ * PURPOSE: calculate hash bucket for a user name
+ *--------------------------------------------------------------------
+ * PARAMS:  IN lower case user name
+ *
+ * RETURNS: bucket index
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static int
+hashUserName(
+    const char* key
+    )
+{
+    unsigned int hash = 5381;
+
+    for (; *key != '\0'; key++)
+        hash = hash * 33 + (unsigned char)*key;
+    return (int)(hash & (USER_HASHSIZE - 1));
+}
+
+/*
+ *====================================================================
+ * PURPOSE: make sure that the user table reflects the password file
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   The password file is parsed only when it was changed since
+ *          the last load - its time, size or inode differ - or when
+ *          this module rewrote it. A new table is built aside and then
+ *          replaces the old one so that a failure leaves the previous
+ *          users in place. The caller holds usersGuard.
+ *====================================================================
+ */
+
+static void
+refreshUsers(
+    void
+    )
+{
+    ParseContext userParser;    /* parser for reading the password list */
+    struct stat fileStat;       /* password file status */
+    int filePresent;            /* password file exists */
+    UserEntry* users = NULL;    /* new table */
+    int numUsers = 0;           /* number of users in the new table */
+    int maxUsers = 0;           /* allocated table size */
+    NQ_STATIC char password[256];     /* password in ASCII */
+    char userNumText[12];
+    int i;
+
+    setFileNames();
+    filePresent = (0 == stat(staticData->passwordFile, &fileStat));
+    if (staticData->usersLoaded && filePresent == staticData->usersFilePresent
+        && (!filePresent
+            || (   fileStat.st_mtime == staticData->usersFileTime
+                && fileStat.st_size == staticData->usersFileSize
+                && fileStat.st_ino == staticData->usersFileIno
+               )
+           )
+       )
+    {
+        return;     /* up to date */
+    }
+
+    if (filePresent && parseInit(&userParser, staticData->passwordFile)) /* start parsing */
+    {
+        /* cycle by lines of the parameter file */
+
+        while (!parseAtFileEnd(&userParser))
+        {
+            char ch;                        /* next character */
+            UserEntry* pUser;               /* next entry */
+
+            parseSkipSpaces(&userParser);
+            if (parseAtLineEnd(&userParser))            /* empty line? */
+            {
+                parseSkipLine(&userParser);
+                continue;
+            }
+            if ((ch = parseGet(&userParser)) == '#')    /* comment  line? */
+            {
+                parseSkipLine(&userParser);
+                continue;
+            }
+            if (numUsers == maxUsers)
+            {
+                UserEntry* newUsers;        /* expanded table */
+
+                newUsers = (UserEntry*)syMalloc(sizeof(UserEntry) * (size_t)(maxUsers + USER_HASHSIZE));
+                if (NULL == newUsers)
+                {
+                    parseStop(&userParser);
+                    if (NULL != users)
+                        syFree(users);
+                    return;     /* keep the previous table */
+                }
+                if (NULL != users)
+                {
+                    syMemcpy(newUsers, users, sizeof(UserEntry) * (size_t)numUsers);
+                    syFree(users);
+                }
+                users = newUsers;
+                maxUsers += USER_HASHSIZE;
+            }
+            pUser = &users[numUsers];
+            parseUnget(&userParser, ch);
+            parseSkipSpaces(&userParser);
+            parseName(&userParser, pUser->name, (int)sizeof(pUser->name) - 1);      /* user name */
+            userNumText[0] = '\0';
+            if (parseDelimiter(&userParser, ':'))
+            {
+                parseValue(&userParser, password, 70, ':');  /* password */
+            }
+            if (parseDelimiter(&userParser, ':'))
+            {
+                parseValue(&userParser, userNumText, sizeof(userNumText) - 1, ':');  /* ID */
+            }
+            parseSkipLine(&userParser);
+
+            for (i = 0; pUser->name[i] != '\0'; i++)
+            {
+                pUser->key[i] = (char)tolower(((int)pUser->name[i]));
+            }
+            pUser->key[i] = '\0';
+            pUser->rid = (NQ_UINT32)atol(userNumText);
+            numUsers++;
+        }
+        parseStop(&userParser);
+    }
+
+    /* replace the table - chains are built backwards so that the first
+       occurrence in the file is found first as it was by a sequential scan */
+    if (NULL != staticData->users)
+        syFree(staticData->users);
+    staticData->users = users;
+    staticData->numUsers = numUsers;
+    for (i = 0; i < USER_HASHSIZE; i++)
+    {
+        staticData->usersByName[i] = USER_NONE;
+        staticData->usersByRid[i] = USER_NONE;
+    }
+    for (i = numUsers - 1; i >= 0; i--)
+    {
+        int bucket = hashUserName(users[i].key);
+
+        users[i].nextByName = staticData->usersByName[bucket];
+        staticData->usersByName[bucket] = i;
+        bucket = (int)(users[i].rid & (USER_HASHSIZE - 1));
+        users[i].nextByRid = staticData->usersByRid[bucket];
+        staticData->usersByRid[bucket] = i;
+    }
+    staticData->usersFilePresent = filePresent;
+    if (filePresent)
+    {
+        staticData->usersFileTime = fileStat.st_mtime;
+        staticData->usersFileSize = fileStat.st_size;
+        staticData->usersFileIno = fileStat.st_ino;
+    }
+    staticData->usersLoaded = 1;
+}
+
 #endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+
+/*
+ *====================================================================
+ * PURPOSE: Return the full path of the durable handle journal
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT buffer for the result
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the journal is kept with the configuration files
+ *====================================================================
+ */
+
+void
+udDefGetDurableJournalFile(
+    NQ_CHAR* buffer
+    )
+{
+    setFileNames();
+    strcpy(buffer, staticData->durableFile);
+}
+
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #ifdef UD_CS_INCLUDEDOMAINMEMBERSHIP
 
 NQ_BOOL
@@ -335,6 +335,17 @@ void udSetCredentials (
         const char* domain
         );
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+
+/* get full path of the durable handle journal */
+
+void
+udDefGetDurableJournalFile(
+    NQ_CHAR *buffer         /* buffer for the result */
+    );
+
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #ifdef UD_CS_INCLUDEDOMAINMEMBERSHIP
 
 NQ_BOOL
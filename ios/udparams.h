@@ -228,9 +228,32 @@
 #define UD_NQ_INCLUDESMB2              /* comment this line to disable SMB2 support */
 #define UD_NQ_INCLUDESMB3              /* comment this line to disable SMB3 support */
 #define UD_NQ_INCLUDESMB311            /* comment this line to disable SMB3.1.1 support */
+/*#define UD_NQ_INCLUDECOMPRESSION*/       /* uncomment this line for SMB3.1.1 compression of reads and writes */
+
+/* SMB3.1.1 compression, only used when UD_NQ_INCLUDECOMPRESSION is defined:
+   - smallest read or write payload worth compressing (bytes)
+   - a payload is sent compressed only when that saves at least 1/UD_NQ_COMPRESSIONMINGAIN of it */
+#define UD_NQ_COMPRESSIONMINSIZE        4096
+#define UD_NQ_COMPRESSIONMINGAIN        8
+
 #define UD_CS_INCLUDEPERSISTENTFIDS    /* comment this line to disable SMB2 durable file ID support */
 /*#define UD_CS_FORCEINTERIMRESPONSES*/    /* comment this line to suppress sending interim responses */
 
+/* Durable handle journal, only used when UD_CS_INCLUDEPERSISTENTFIDS is defined:
+   - file name, in the configuration directory, that records durable opens so that clients may
+     reconnect them after a server restart
+   - number of durable opens the journal keeps */
+#define UD_CS_DURABLEJOURNAL_FILENAME   "nqdurable.jnl"
+#define UD_CS_DURABLEJOURNAL_SIZE       (UD_FS_NUMSERVERFILEOPEN * 2)
+
+/*#define UD_CS_INCLUDEMULTICHANNEL*/      /* uncomment this line for SMB3 multichannel support in the server */
+
+/* SMB3 multichannel, only used when UD_CS_INCLUDEMULTICHANNEL is defined:
+   - maximum number of additional connections bound to a session besides the one it was established on
+   - link speed reported for an adapter when the platform does not tell it (Mbit/s) */
+#define UD_CS_MAXCHANNELS               3
+#define UD_CS_DEFAULTLINKSPEED          1000
+
 
 /* Default number of credits NQ server grants:
    The bigger number may cause timeout on bulk upload/download operation,
@@ -378,11 +401,20 @@
 #define UD_CS_INCLUDESECURITYDESCRIPTORS    /* define this parameter if SDs are supported */
 /*#define UD_CS_INCLUDELOCALUSERMANAGEMENT*//* define this parameter to be able to set personal ACL for a local user */
 /*#define UD_CS_AUTHENTICATEANONYMOUS  */   /* allow anonymous user authentication */
+/*#define UD_CS_INCLUDEAUTHCACHE*/          /* define this parameter to cache NTLMv2 keys of verified local users */
+
+/* Verified credential cache, only used when UD_CS_INCLUDEAUTHCACHE is defined:
+   - number of cached user credentials
+   - time in seconds a credential stays cached after its last successful logon */
+#define UD_CS_AUTHCACHE_SIZE    64
+#define UD_CS_AUTHCACHE_TTL     300
 
 #define UD_CS_INCLUDEEXTENDEDSECURITY       /* SPNEGO NTLMSSP support */
 
 /*#define UD_CS_INCLUDEDIRECTTRANSFER*/		/* allow socket-to-file transfer */
 
+/*#define UD_CS_INCLUDENOTIFYWATCH*/        /* complete change notify requests on changes made outside of the server (Linux inotify only, the Darwin port has no watcher) */
+
 /*#define UD_CS_HIDE_NOACCESS_SHARE*/       /* define this parameter to hide shares for users that have no rights to use them */
 
 /*#define UD_CS_ALLOW_NONENCRYPTED_ACCESS_TO_ENCRYPTED_SHARE*/ /* define this parameter to allow non encrypted access to encrypted share */
@@ -430,6 +462,14 @@
 
 /*#define UD_CC_INCLUDEDFS */            /* uncomment this line for DFS support in the client */
 
+/*#define UD_CC_INCLUDEMULTICHANNEL*/      /* uncomment this line for SMB3 multichannel support in the client */
+
+/* SMB3 multichannel, only used when UD_CC_INCLUDEMULTICHANNEL is defined:
+   - maximum number of additional channels bound to a session besides the main connection
+   - minimum READ/WRITE payload size that is spread across channels */
+#define UD_CC_MAXCHANNELS           3
+#define UD_CC_CHANNELSTRIPESIZE     (64 * 1024)
+
 
 #define UD_CC_INCLUDEEXTENDEDSECURITY   /* comment this line to restrict */
 /*#define UD_CC_INCLUDEEXTENDEDSECURITY_KERBEROS */
@@ -445,6 +485,15 @@
 
 /* File name for capture output. This parameter is only used when
    the UD_NQ_INCLUDESMBCAPTURE Macro is defined. */
-#define UD_CM_CAPTURE_FILENAME "nq.pcap"
+#define UD_CM_CAPTURE_FILENAME "nq.pcapng"
+
+/* Capture tuning, only used when the UD_NQ_INCLUDESMBCAPTURE Macro is defined:
+   - number of packets the capture ring holds before new packets are dropped (a power of two)
+   - maximum number of packet bytes kept per packet (snap length)
+   - capture file size that triggers rotation and the number of files kept */
+#define UD_CM_CAPTURE_RINGSIZE      512
+#define UD_CM_CAPTURE_SNAPLEN       1024
+#define UD_CM_CAPTURE_MAXFILESIZE   (16 * 1024 * 1024)
+#define UD_CM_CAPTURE_MAXFILES      4
 
 #endif  /* _UDPARAMS_H_ */
@@ -473,6 +473,32 @@ NQ_HANDLE ccFindFirstFileW(const NQ_WCHAR *srchPath, FindFileDataW_t *findFileDa
 NQ_BOOL ccFindNextFileA(NQ_HANDLE handle, FindFileDataA_t *findFileData);   /* ASCII version */
 NQ_BOOL ccFindNextFileW(NQ_HANDLE handle, FindFileDataW_t *findFileData);   /* UNICODE version */
 
+/* Description
+   This function is called by application to find a number of next files
+   matching the specified wildcard at once. It works as a series of
+   <link ccFindNextFile, ccFindNextFile()> calls but returns as soon as
+   the entries already received from the server are exhausted, so
+   that a large directory can be listed with one call per
+   server response.
+   Parameters
+   handle :        Handle value returned by calling <link ccFindFirstFile, ccFindFirstFile()>.
+   findFileData :  Pointer to an array of structures, where NQ places the
+                   search results. See <link FindFileData_t, FindFileData_t structure>.
+   maxEntries :    Number of structures in the array.
+   Returns
+   This function returns the number of entries placed in the array, zero
+   when there are no more files (the error code is NQ_ERR_OK) or NQ_FAIL
+   on error. The application can inspect the error code for the failure reason.
+   See Also
+   <link ccFindNextFile, ccFindNextFile()>                                      */
+#ifdef UD_CM_UNICODEAPPLICATION
+    #define ccFindNextFiles ccFindNextFilesW
+#else
+    #define ccFindNextFiles ccFindNextFilesA
+#endif
+NQ_INT ccFindNextFilesA(NQ_HANDLE handle, FindFileDataA_t *findFileData, NQ_INT maxEntries);  /* ASCII version */
+NQ_INT ccFindNextFilesW(NQ_HANDLE handle, FindFileDataW_t *findFileData, NQ_INT maxEntries);  /* UNICODE version */
+
 /* Description
    This function is called by application to close the search
    handle
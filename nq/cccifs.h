@@ -459,6 +459,17 @@ typedef struct _cccifssmb
         	   Returns
         	   NQ_SUCCESS or error code.                                       */
     NQ_STATUS (* sendReceive)(void * pServer, void * pUser, void * pRequest, void * pResponse);
+    /* This function waits for the response to a request sent by sendRequest() and checks it
+       the same way as sendReceive() does.
+
+        	   Parameters
+        	   pServer :           Server handle.
+        	   pUser :           User handle.
+               pRequest :           The request that was sent. Its buffer may be already released.
+               pMatch :          The match that was passed to sendRequest().
+        	   Returns
+        	   NQ_SUCCESS or error code.                                       */
+    NQ_STATUS (* receiveResponse)(void * pServer, void * pUser, void * pRequest, void * pMatch);
     /* This function performs an old-fashioned RAP transaction.
 
         	   Parameters
@@ -36,6 +36,28 @@
 
 static NQ_COUNT callId;     /* running number */
 
+/* pool of bound pipes - a pipe returned by ccDcerpcDisconnect() is kept open and bound
+   so that the next connect to the same server and pipe with the same credentials
+   skips CREATE and BIND */
+
+#define POOL_SIZE 8                   /* max number of pipes kept in the pool */
+#define POOL_IDLETIMEOUT 60           /* seconds an unused pipe is kept */
+
+typedef struct
+{
+    NQ_HANDLE handle;                           /* bound pipe or NULL for a free slot */
+    NQ_WCHAR * host;                            /* server name as used for connect */
+    const CCDcerpcPipeDescriptor * pipeDesc;    /* pipe descriptor */
+    AMCredentialsW * credentials;               /* copy of credentials or NULL for default */
+    NQ_BOOL inUse;                              /* pipe is taken by a caller */
+    NQ_BOOL failed;                             /* a call failed - the pipe should not be reused */
+    NQ_UINT32 lastUsed;                         /* time when the pipe was returned (seconds) */
+}
+PooledPipe;
+
+static PooledPipe pool[POOL_SIZE];    /* pooled pipes */
+static SYMutex poolGuard;             /* pool protection */
+
 static const CMRpcDcerpcSyntaxId transferSyntax = {
     CM_RPC_TRANSFERSYNTAXSIGNATURE,
     CM_RPC_NDRVERSION
@@ -257,17 +279,179 @@ Error1:
     goto Exit;
 }
 
+/* compare credentials - NULL stands for default credentials */
+
+static NQ_BOOL sameCredentials(const AMCredentialsW * c1, const AMCredentialsW * c2)
+{
+    if (NULL == c1 || NULL == c2)
+        return c1 == c2;
+    return 0 == cmWStricmp(c1->domain.name, c2->domain.name)
+        && 0 == cmWStricmp(c1->user, c2->user)
+        && 0 == cmWStrcmp(c1->password, c2->password);
+}
+
+/* check that a pooled pipe can still be used, the file is held so that its server is not
+   disposed meanwhile */
+
+static NQ_BOOL isPipeHealthy(NQ_HANDLE handle)
+{
+    CCFile * pFile = (CCFile *)handle;     /* casted handle */
+    NQ_BOOL result;                        /* return value */
+
+    ccFileTake(handle);
+    result = ccValidateFileHandle(handle) && ccTransportIsConnected(&pFile->share->user->server->transport);
+    ccFileGive(handle);
+    return result;
+}
+
+/* free pool slot, returns the pipe handle for closing */
+
+static NQ_HANDLE releaseSlot(PooledPipe * pSlot)
+{
+    NQ_HANDLE handle = pSlot->handle;     /* pipe handle */
+
+    cmMemoryFree(pSlot->host);
+    if (NULL != pSlot->credentials)
+    {
+        syMemset(pSlot->credentials, 0, sizeof(*pSlot->credentials));
+        cmMemoryFree(pSlot->credentials);
+    }
+    syMemset(pSlot, 0, sizeof(*pSlot));
+    return handle;
+}
+
+/* find pool slot by pipe handle, should be called under guard */
+
+static PooledPipe * findSlot(NQ_HANDLE handle)
+{
+    NQ_COUNT i;     /* just a counter */
+
+    for (i = 0; i < POOL_SIZE; i++)
+    {
+        if (pool[i].handle == handle)
+            return &pool[i];
+    }
+    return NULL;
+}
+
+/* release idle pipes that expired or lost their connection, should be called under guard,
+   returns the number of handles placed in expired for closing after the guard is given */
+
+static NQ_COUNT sweepPool(NQ_UINT32 now, NQ_HANDLE * expired)
+{
+    NQ_COUNT numExpired = 0;        /* number of pipes to close */
+    NQ_COUNT i;                     /* just a counter */
+
+    for (i = 0; i < POOL_SIZE; i++)
+    {
+        PooledPipe * pSlot = &pool[i];     /* next slot */
+
+        if (NULL == pSlot->handle || pSlot->inUse)
+            continue;
+        if (now - pSlot->lastUsed > POOL_IDLETIMEOUT || !isPipeHealthy(pSlot->handle))
+            expired[numExpired++] = releaseSlot(pSlot);
+    }
+    return numExpired;
+}
+
+/* take a pooled pipe or NULL when there is none, expired pipes are closed */
+
+static NQ_HANDLE takePooledPipe(const NQ_WCHAR * hostName, const AMCredentialsW * pCredentials, const CCDcerpcPipeDescriptor * pipeDesc)
+{
+    NQ_HANDLE expired[POOL_SIZE];   /* pipes to close */
+    NQ_COUNT numExpired;            /* number of pipes to close */
+    NQ_HANDLE handle = NULL;        /* resulting handle */
+    NQ_UINT32 now;                  /* current time in seconds */
+    NQ_COUNT i;                     /* just a counter */
+
+    now = (NQ_UINT32)syGetTimeInSec();
+    syMutexTake(&poolGuard);
+    numExpired = sweepPool(now, expired);
+    for (i = 0; i < POOL_SIZE; i++)
+    {
+        PooledPipe * pSlot = &pool[i];     /* next slot */
+
+        if (NULL == pSlot->handle || pSlot->inUse)
+            continue;
+        if (NULL == handle && pSlot->pipeDesc == pipeDesc && 0 == cmWStricmp(pSlot->host, hostName) &&
+            sameCredentials(pSlot->credentials, pCredentials))
+        {
+            pSlot->inUse = TRUE;
+            pSlot->failed = FALSE;
+            handle = pSlot->handle;
+        }
+    }
+    syMutexGive(&poolGuard);
+
+    for (i = 0; i < numExpired; i++)
+    {
+        ccCloseHandle(expired[i]);
+    }
+    return handle;
+}
+
+/* register a new pipe in the pool, the pipe stays unpooled when there is no room */
+
+static void addPooledPipe(NQ_HANDLE handle, const NQ_WCHAR * hostName, const AMCredentialsW * pCredentials, const CCDcerpcPipeDescriptor * pipeDesc)
+{
+    PooledPipe * pSlot;     /* free slot */
+
+    syMutexTake(&poolGuard);
+    pSlot = findSlot(NULL);
+    if (NULL == pSlot)
+        goto Exit;
+    pSlot->host = cmMemoryCloneWString(hostName);
+    if (NULL == pSlot->host)
+        goto Exit;
+    if (NULL != pCredentials)
+    {
+        pSlot->credentials = (AMCredentialsW *)cmMemoryAllocate(sizeof(*pSlot->credentials));
+        if (NULL == pSlot->credentials)
+        {
+            releaseSlot(pSlot);
+            goto Exit;
+        }
+        syMemcpy(pSlot->credentials, pCredentials, sizeof(*pSlot->credentials));
+    }
+    pSlot->pipeDesc = pipeDesc;
+    pSlot->inUse = TRUE;
+    pSlot->failed = FALSE;
+    pSlot->handle = handle;
+
+Exit:
+    syMutexGive(&poolGuard);
+}
+
 /* -- API functions -- */
 
 NQ_BOOL ccDcerpcStart(void)
 {
     callId = 1;
+    syMemset(pool, 0, sizeof(pool));
+    syMutexCreate(&poolGuard);
     return TRUE;
 }
 
 void ccDcerpcShutdown(void)
 {
+    NQ_HANDLE pooled[POOL_SIZE];    /* pipes to close */
+    NQ_COUNT numPooled = 0;         /* number of pipes to close */
+    NQ_COUNT i;                     /* just a counter */
 
+    syMutexTake(&poolGuard);
+    for (i = 0; i < POOL_SIZE; i++)
+    {
+        if (NULL != pool[i].handle)
+            pooled[numPooled++] = releaseSlot(&pool[i]);
+    }
+    syMutexGive(&poolGuard);
+
+    for (i = 0; i < numPooled; i++)
+    {
+        if (ccValidateFileHandle(pooled[i]))
+            ccCloseHandle(pooled[i]);
+    }
+    syMutexDelete(&poolGuard);
 }
 
 NQ_HANDLE ccDcerpcConnect(const NQ_WCHAR * hostName, const AMCredentialsW * pCredentials, const CCDcerpcPipeDescriptor * pipeDesc, NQ_BOOL doDfs)
@@ -275,11 +459,23 @@ NQ_HANDLE ccDcerpcConnect(const NQ_WCHAR * hostName, const AMCredentialsW * pCre
     NQ_HANDLE handle;           /* resulting handle */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "host:%s credentials:%p pipe:%p dfs:%s", cmWDump(hostName), pCredentials, pipeDesc, doDfs ? "TRUE" : "FALSE");
+    handle = takePooledPipe(hostName, pCredentials, pipeDesc);
+    if (NULL != handle)
+    {
+        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "reusing pooled pipe %p", handle);
+        goto Exit;
+    }
     handle = connectPipe(hostName, NULL != pCredentials ? pCredentials : ccUserGetAnonymousCredentials(), pipeDesc, doDfs);
     if (NULL == handle)
     {
         handle = connectPipe(hostName, NULL, pipeDesc, doDfs);
     }
+    if (NULL != handle)
+    {
+        addPooledPipe(handle, hostName, pCredentials, pipeDesc);
+    }
+
+Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", handle);
     return handle;
 }
@@ -445,13 +641,59 @@ NQ_BOOL ccDcerpcCall(NQ_HANDLE pipeHandle, CCDcerpcRequestCallback request, CCDc
     result = res;
 
 Exit:
+    if (!result && NULL != pipeHandle)
+    {
+        PooledPipe * pSlot;     /* pool slot of this pipe */
+
+        /* the pipe may be out of sync - do not reuse it */
+        syMutexTake(&poolGuard);
+        pSlot = findSlot(pipeHandle);
+        if (NULL != pSlot)
+            pSlot->failed = TRUE;
+        syMutexGive(&poolGuard);
+    }
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
     return result;
 }
 
 NQ_STATUS ccDcerpcDisconnect(NQ_HANDLE pipeHandle)
 {
-    return ccCloseHandle(pipeHandle);
+    PooledPipe * pSlot;             /* pool slot of this pipe */
+    NQ_HANDLE expired[POOL_SIZE];   /* idle pipes to close */
+    NQ_COUNT numExpired;            /* number of pipes to close */
+    NQ_BOOL isPooled = FALSE;       /* the pipe was returned to the pool */
+    NQ_STATUS result = NQ_SUCCESS;  /* return value */
+    NQ_COUNT i;                     /* just a counter */
+
+    if (NULL == pipeHandle)
+        return ccCloseHandle(pipeHandle);
+
+    /* return a healthy pipe to the pool, idle pipes that expired meanwhile are closed */
+    syMutexTake(&poolGuard);
+    numExpired = sweepPool((NQ_UINT32)syGetTimeInSec(), expired);
+    pSlot = findSlot(pipeHandle);
+    if (NULL != pSlot)
+    {
+        if (!pSlot->failed && isPipeHealthy(pipeHandle))
+        {
+            pSlot->inUse = FALSE;
+            pSlot->lastUsed = (NQ_UINT32)syGetTimeInSec();
+            isPooled = TRUE;
+        }
+        else
+        {
+            releaseSlot(pSlot);
+        }
+    }
+    syMutexGive(&poolGuard);
+
+    for (i = 0; i < numExpired; i++)
+    {
+        ccCloseHandle(expired[i]);
+    }
+    if (!isPooled)
+        result = ccCloseHandle(pipeHandle);
+    return result;
 }
 
 #endif /* UD_NQ_INCLUDECIFSCLIENT */
@@ -109,6 +109,11 @@ NQ_HANDLE ccDcerpcConnect(const NQ_WCHAR * hostName, const AMCredentialsW * pCre
 /* Description
    Disconnect from a remote RPC pipe.
    
+   A healthy pipe is not closed but kept bound in a pool so
+   that the next ccDcerpcConnect() to the same server and pipe
+   with the same credentials reuses it. Pooled pipes are closed
+   after an idle timeout, after a failed call and on shutdown.
+   
    Parameters
    pipeHandle : Handle of an open pipe.
    Returns
@@ -26,6 +26,36 @@
 #ifdef UD_CC_INCLUDEDFS
 static NQ_BOOL dfsIsOn = TRUE; /* turn DFS on/off */
 
+#define CCDFS_MAXPROBES 8       /* max number of targets probed at once */
+#define CCDFS_PROBEWAIT 10      /* in seconds - max wait for the first target to connect */
+
+/* One round of probing targets of a DFS cache entry. It is shared by the
+   resolving thread and the probe threads and released by the last of them. */
+typedef struct
+{
+    NQ_COUNT refs;                  /* number of references: the resolving thread and pending probes */
+    NQ_COUNT numPending;            /* number of probes not completed yet */
+    NQ_BOOL isSignalled;            /* the resolving thread was woken up */
+    CMThreadCond done;              /* signalled on the first connect or when all probes fail */
+    NQ_BOOL hasCredentials;         /* credentials are valid */
+    AMCredentialsW credentials;     /* copy of user credentials */
+    NQ_WCHAR * path;                /* DFS path of the cache entry */
+} ProbeSet;
+
+/* probe of one target, the target path is item name */
+typedef struct
+{
+    CMItem item;                    /* list item */
+    ProbeSet * set;                 /* probe round */
+} ProbeJob;
+
+static CMList probeQueue;           /* targets waiting for a probe thread */
+static SYMutex probeGuard;          /* protects probe queue and probe rounds */
+static NQ_COUNT numProbeThreads;    /* number of running probe threads */
+static NQ_BOOL probeStop;           /* TRUE when probe threads should exit */
+static SYThread probeThread;        /* last started probe thread */
+static CMThreadCond probesDone;     /* signalled when the last probe thread exits on shutdown */
+
 static void logPrintResult(CCDfsResult result)
 {
     if (result.path)
@@ -242,7 +272,7 @@ static NQ_WCHAR * getDomainReferral(const NQ_WCHAR *dcName, const NQ_WCHAR *path
                     cmMemoryFree(pCredentials);
                 if (pShareReferral != NULL)
                 {
-                    ccDfsCacheAddPath(path, pDomainRef);
+                    ccDfsCacheAddPath(path, dcName, pDomainRef);
                     resultReferral = cmMemoryCloneWString(pDomainRef->netPath);
                     if (NULL == resultReferral)
                     {
@@ -287,6 +317,7 @@ static NQ_BOOL getReferrals(CCMount *pMount, CCShare *pShare, const NQ_WCHAR *pa
     NQ_WCHAR * netPath = NULL;
     NQ_WCHAR * serverHostComponent = NULL;
     NQ_WCHAR * pathComponent = NULL;
+    NQ_WCHAR * dcName = NULL;           /* DC of the referral domain */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "share:%p path:%s parser:%p", pShare, cmWDump(path), parser);
     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "path: %s", cmWDump((const NQ_WCHAR *)path));
@@ -338,10 +369,18 @@ static NQ_BOOL getReferrals(CCMount *pMount, CCShare *pShare, const NQ_WCHAR *pa
                 pEntry = ccDfsCacheFindDomain(pDomain);
                 cmMemoryFree(pDomain);
                 pDomain = NULL;
-                if (NULL != pEntry && NULL != pEntry->refList && NULL != pEntry->refList->first)
+                if (NULL != pEntry)
+                {
+                    if (NULL != pEntry->refList && NULL != pEntry->refList->first)
+                    {
+                        dcName = cmMemoryCloneWString(pEntry->refList->first->name);
+                    }
+                    ccDfsCacheRelease(pEntry);
+                }
+                if (NULL != dcName)
                 {
                     /* printReferrals(pEntry->refList); */
-                    LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "Found in domain cache DC: %s", cmWDump(pEntry->refList->first->name));
+                    LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "Found in domain cache DC: %s", cmWDump(dcName));
 
                     /* ask domain's dc for referral */
                     serverHostComponent = ccUtilsHostShareFromRemotePath(pRef->netPath);
@@ -356,9 +395,11 @@ static NQ_BOOL getReferrals(CCMount *pMount, CCShare *pShare, const NQ_WCHAR *pa
                     LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "serverHostComponent: %s", cmWDump(serverHostComponent));
                     LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "pathComponent: %s", cmWDump(pathComponent));
 
-                    domainReferral = getDomainReferral(pEntry->refList->first->name, serverHostComponent);
+                    domainReferral = getDomainReferral(dcName, serverHostComponent);
                     cmMemoryFree(serverHostComponent);
                     serverHostComponent = NULL;
+                    cmMemoryFree(dcName);
+                    dcName = NULL;
                     if (NULL != domainReferral)
                     {
                         netPath = ccUtilsComposePath(domainReferral, pathComponent);
@@ -404,7 +445,7 @@ static NQ_BOOL getReferrals(CCMount *pMount, CCShare *pShare, const NQ_WCHAR *pa
                         LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
                         goto Error;
                     }
-                    ccDfsCacheAddPath(path, pRef);
+                    ccDfsCacheAddPath(path, pShare->user->server->item.name, pRef);
                     isPathAdded = TRUE;
                 }
                 cmMemoryFree(netPath);
@@ -452,6 +493,7 @@ Exit:
     cmMemoryFree(netPath);
     cmMemoryFree(serverHostComponent);
     cmMemoryFree(pathComponent);
+    cmMemoryFree(dcName);
 
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", (result == NQ_SUCCESS && isPathAdded) ? "TRUE" : "FALSE");
     return (result == NQ_SUCCESS && isPathAdded);
@@ -546,6 +588,252 @@ static void getDomainDC(const NQ_WCHAR *dcName)
     }
     cmMemoryFree(pCredentials);
 
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+/* Refresh referrals of a cached path. Called by DFS cache from its refresh thread.
+ * Only targets that are already cached are prolonged, new targets are picked up
+ * on the next resolution after the entry expires.
+ */
+static void refreshReferrals(const NQ_WCHAR * path, const NQ_WCHAR * server)
+{
+    CCShare *pShare;
+    NQ_WCHAR *ipcPath;
+    const AMCredentialsW *pCredentials = NULL;
+    static const NQ_WCHAR ipcName[] = {cmWChar('I'), cmWChar('P'), cmWChar('C'), cmWChar('$'), cmWChar(0)};
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s server:%s", cmWDump(path), cmWDump(server));
+
+    /* connect to IPC$ share */
+    ipcPath = ccUtilsComposeRemotePathToShare(server, ipcName);
+    if (NULL == ipcPath)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+
+    pShare = ccShareConnect(ipcPath, NULL, &pCredentials, FALSE);
+    cmMemoryFree(ipcPath);
+    if (NULL != pShare)
+    {
+        CMList refs;
+        CMIterator iterator;
+        NQ_COUNT numRefreshed = 0;
+
+        cmListStart(&refs);
+        if (NQ_SUCCESS == pShare->user->server->smb->doQueryDfsReferrals(pShare, path + 1, parseReferralCallback, &refs))
+        {
+            cmListIteratorStart(&refs, &iterator);
+            while (cmListIteratorHasNext(&iterator))
+            {
+                CCDfsReferral * pRef = (CCDfsReferral *)cmListIteratorNext(&iterator);
+
+                if (ccDfsCacheRefreshPath(path, pRef))
+                    numRefreshed++;
+            }
+            cmListIteratorTerminate(&iterator);
+        }
+        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "refreshed %d referrals", numRefreshed);
+
+        cmListIteratorStart(&refs, &iterator);
+        while (cmListIteratorHasNext(&iterator))
+        {
+            CMItem * pItem;
+
+            pItem = cmListIteratorNext(&iterator);
+            cmListItemCheck(pItem);
+        }
+        cmListIteratorTerminate(&iterator);
+        cmListShutdown(&refs);
+        cmListItemUnlock((CMItem *)pShare);
+    }
+    cmMemoryFree(pCredentials);
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+/* release probe round when its last reference goes, called with probe guard taken */
+static void releaseProbeSet(ProbeSet * pSet)
+{
+    if (--pSet->refs > 0)
+        return;
+    cmThreadCondRelease(&pSet->done);
+    syMemset(&pSet->credentials, 0, sizeof(pSet->credentials));
+    cmMemoryFree(pSet->path);
+    cmMemoryFree(pSet);
+}
+
+/* probe completed, wake up the resolving thread on the first connect or when all probes failed,
+   called with probe guard taken */
+static void completeProbe(ProbeSet * pSet, NQ_BOOL isReachable)
+{
+    pSet->numPending--;
+    if (!pSet->isSignalled && (isReachable || 0 == pSet->numPending))
+    {
+        pSet->isSignalled = TRUE;
+        cmThreadCondSignal(&pSet->done);
+    }
+    releaseProbeSet(pSet);
+}
+
+/* connect to one target and measure how long it takes */
+static void probeTarget(ProbeSet * pSet, const NQ_WCHAR * target)
+{
+    const AMCredentialsW * pCredentials;    /* pointer to credentials */
+    CCShare * pProbe;                       /* connected share */
+    NQ_TIME start;                          /* probe start in milliseconds */
+    NQ_TIME end;                            /* probe end in milliseconds */
+    NQ_TIME elapsed;                        /* probe time */
+    NQ_UINT32 rtt;                          /* probe time in milliseconds */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s target:%s", cmWDump(pSet->path), cmWDump(target));
+
+    pCredentials = pSet->hasCredentials ? &pSet->credentials : NULL;
+    start = syGetTimeInMsec();
+    pProbe = ccShareConnect(target, NULL, &pCredentials, FALSE);
+    end = syGetTimeInMsec();
+    cmU64SubU64U64(&elapsed, &end, &start);
+    rtt = elapsed.low;
+    if (pCredentials != (pSet->hasCredentials ? &pSet->credentials : NULL))
+        cmMemoryFree(pCredentials);
+    if (NULL != pProbe)
+        cmListItemUnlock((CMItem *)pProbe);
+
+    ccDfsCacheProbeResult(pSet->path, target, NULL != pProbe, rtt);
+
+    syMutexTake(&probeGuard);
+    completeProbe(pSet, NULL != pProbe);
+    syMutexGive(&probeGuard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "connected:%s rtt:%u", NULL != pProbe ? "TRUE" : "FALSE", rtt);
+}
+
+/* probe thread: probes queued targets until the queue is empty */
+static void probeThreadBody(void)
+{
+    for (; ;)
+    {
+        NQ_WCHAR * target = NULL;           /* target to probe */
+        ProbeSet * pSet = NULL;             /* probe round */
+
+        syMutexTake(&probeGuard);
+        if (!probeStop && NULL != probeQueue.first)
+        {
+            pSet = ((ProbeJob *)probeQueue.first)->set;
+            target = cmMemoryCloneWString(probeQueue.first->name);
+            cmListItemRemoveAndDispose(probeQueue.first);
+            if (NULL == target)
+            {
+                LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+                completeProbe(pSet, FALSE);
+                syMutexGive(&probeGuard);
+                continue;
+            }
+        }
+        if (NULL == target)
+        {
+            /* only ccDfsShutdown() waits for the threads: signal under the guard so that nothing is touched after it */
+            if (0 == --numProbeThreads && probeStop)
+                cmThreadCondSignal(&probesDone);
+            syMutexGive(&probeGuard);
+            cmThreadUnsubscribe();
+            return;
+        }
+        syMutexGive(&probeGuard);
+
+        probeTarget(pSet, target);
+        cmMemoryFree(target);
+    }
+}
+
+/* Probe targets of a cache entry concurrently and wait for the first one to connect.
+ * Probe results rank the referral list of the entry, so that the callers connect
+ * to the fastest target first and fail over to the next best known-good one.
+ * Slower probes complete in the background.
+ */
+static void probeTargets(CCDfsCacheEntry * pCache, const AMCredentialsW * pCredentials)
+{
+    ProbeSet * pSet;            /* probe round */
+    CCDfsReferral ** targets;   /* targets to probe */
+    NQ_COUNT numTargets;        /* number of targets */
+    NQ_COUNT i;                 /* index in targets */
+    NQ_COUNT numQueued;         /* number of queued probes */
+    NQ_COUNT numThreads;        /* number of threads to start */
+
+    if (!ccDfsCacheClaimProbe(pCache))
+        return;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "entry:%s", cmWDump(pCache->item.name));
+
+    pSet = (ProbeSet *)cmMemoryAllocate(sizeof(ProbeSet));
+    if (NULL == pSet)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+    pSet->path = cmMemoryCloneWString(pCache->item.name);
+    if (NULL == pSet->path)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        cmMemoryFree(pSet);
+        goto Exit;
+    }
+    if (!cmThreadCondSet(&pSet->done))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to create probe condition");
+        cmMemoryFree(pSet->path);
+        cmMemoryFree(pSet);
+        goto Exit;
+    }
+    pSet->hasCredentials = (NULL != pCredentials);
+    if (pSet->hasCredentials)
+        syMemcpy(&pSet->credentials, pCredentials, sizeof(pSet->credentials));
+    pSet->refs = 1;
+    pSet->numPending = 0;
+    pSet->isSignalled = FALSE;
+
+    targets = ccDfsCacheGetTargets(pCache, &numTargets);
+    syMutexTake(&probeGuard);
+    if (!probeStop)
+    {
+        for (i = 0; i < numTargets; i++)
+        {
+            ProbeJob * pJob;
+
+            pJob = (ProbeJob *)cmListItemCreateAndAdd(&probeQueue, sizeof(ProbeJob), targets[i]->item.name, NULL, CM_LISTITEM_NOLOCK);
+            if (NULL == pJob)
+            {
+                LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+                continue;
+            }
+            pJob->set = pSet;
+            pSet->refs++;
+            pSet->numPending++;
+        }
+    }
+    numQueued = pSet->numPending;
+    for (numThreads = numQueued; numThreads > 0 && numProbeThreads < CCDFS_MAXPROBES; numThreads--)
+    {
+        numProbeThreads++;
+        syThreadStart(&probeThread, probeThreadBody, TRUE);
+    }
+    syMutexGive(&probeGuard);
+    cmMemoryFree(targets);
+
+    if (numQueued > 0)
+    {
+        if (!cmThreadCondWait(&pSet->done, CCDFS_PROBEWAIT))
+        {
+            LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "no target connected within %d seconds", CCDFS_PROBEWAIT);
+        }
+    }
+
+    syMutexTake(&probeGuard);
+    releaseProbeSet(pSet);
+    syMutexGive(&probeGuard);
+
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
@@ -609,6 +897,19 @@ NQ_BOOL ccDfsStart(void)
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON);
 
     ccDfsResolveOn(TRUE);
+    ccDfsCacheSetRefresh(refreshReferrals);
+
+    syMutexCreate(&probeGuard);
+    cmListStart(&probeQueue);
+    numProbeThreads = 0;
+    probeStop = FALSE;
+    if (!cmThreadCondSet(&probesDone))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to create probe condition");
+        cmListShutdown(&probeQueue);
+        syMutexDelete(&probeGuard);
+        goto Exit;
+    }
 
     /* get default domain dc */
     dcNameA = (NQ_CHAR *)cmMemoryAllocate(sizeof(NQ_CHAR) * (CM_NQ_HOSTNAMESIZE + 1));
@@ -661,7 +962,35 @@ Exit:
 
 void ccDfsShutdown(void)
 {
+#ifdef UD_CC_INCLUDEDFS
+    ccDfsCacheSetRefresh(NULL);
+
+    /* stop probing and drop targets not probed yet */
+    syMutexTake(&probeGuard);
+    probeStop = TRUE;
+    while (NULL != probeQueue.first)
+    {
+        ProbeSet * pSet = ((ProbeJob *)probeQueue.first)->set;
 
+        cmListItemRemoveAndDispose(probeQueue.first);
+        completeProbe(pSet, FALSE);
+    }
+
+    /* wait for the probe threads to leave - they still use the queue and the guard */
+    while (numProbeThreads > 0)
+    {
+        syMutexGive(&probeGuard);
+        if (!cmThreadCondWait(&probesDone, CCDFS_PROBEWAIT))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Still waiting for %d DFS probe threads", numProbeThreads);
+        }
+        syMutexTake(&probeGuard);
+    }
+    syMutexGive(&probeGuard);
+    cmListShutdown(&probeQueue);
+    cmThreadCondRelease(&probesDone);
+    syMutexDelete(&probeGuard);
+#endif /* UD_CC_INCLUDEDFS */
 }
 
 const NQ_WCHAR * ccDfsResolveHost(const NQ_WCHAR * host)
@@ -690,6 +1019,7 @@ const NQ_WCHAR * ccDfsResolveHost(const NQ_WCHAR * host)
         printReferrals(pEntry->refList);
         LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "Found in domain cache: %s", cmWDump(pEntry->refList->first->name));
         pResult = cmMemoryCloneWString(pEntry->refList->first->name);
+        ccDfsCacheRelease(pEntry);
         if (NULL == pResult)
         {
             LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
@@ -701,6 +1031,11 @@ const NQ_WCHAR * ccDfsResolveHost(const NQ_WCHAR * host)
     {
         NQ_STATUS status;
 
+        if (NULL != pEntry)
+        {
+            ccDfsCacheRelease(pEntry);
+        }
+
         domainA = cmMemoryCloneWStringAsAscii(host);
         dcNameA = (NQ_CHAR *)cmMemoryAllocate(sizeof(NQ_CHAR) * (CM_NQ_HOSTNAMESIZE + 1));
         if (NULL == dcNameA || NULL == domainA)
@@ -746,7 +1081,10 @@ Exit:
 CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR * file, CCDfsContext * context)
 {
 #ifdef UD_CC_INCLUDEDFS
-    CCDfsCacheEntry      *pCache;           /* cache entry pointer */
+    CCDfsCacheEntry      *pCache = NULL;    /* held cache entry */
+    CCDfsReferral        **targets = NULL;  /* ranked targets of the entry */
+    NQ_COUNT             numTargets;        /* number of targets */
+    NQ_COUNT             i;                 /* index in targets */
     NQ_WCHAR             *path = NULL;      /* network path to file */
     const AMCredentialsW *pCredentials;     /* pointer to credentials */
 #endif /* UD_CC_INCLUDEDFS */
@@ -775,17 +1113,21 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
            but some IO error occurred, so need to try another referral (if available) */
         CCDfsReferral * referralContext = (CCDfsReferral *)context->referral;
         CCDfsReferral * referral = NULL;
-        CMIterator iterator;
 
-        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "IO error on %p, %s, trying other referrals", referralContext, cmWDump(referralContext->item.name));
+        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "IO error on %p, trying other referrals", referralContext);
 
-        referralContext->isIOPerformed = TRUE;
-        referralContext->lastIOStatus = context->lastError;
+        /* record the failure so that the next best known-good target is tried first */
+        pCache = ccDfsCacheTargetFailed(context->referral, context->lastError);
+        if (NULL == pCache)
+        {
+            LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "referral is no longer cached");
+            goto Exit;
+        }
 
-        cmListIteratorStart(referralContext->item.master, &iterator);
-        while (cmListIteratorHasNext(&iterator) && res.share == NULL)
+        targets = ccDfsCacheGetTargets(pCache, &numTargets);
+        for (i = 0; i < numTargets && res.share == NULL; i++)
         {
-            referral = (CCDfsReferral *)cmListIteratorNext(&iterator);
+            referral = targets[i];
             LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " in list: %s, %p, isIOPerformed %d", cmWDump(referral->item.name), referral, referral->isIOPerformed);
 
             if (referral == referralContext)
@@ -808,7 +1150,8 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                 }
             }
         }
-        cmListIteratorTerminate(&iterator);
+        cmMemoryFree(targets);
+        targets = NULL;
         createResultPath(file, 0, referral ? &referral->item : NULL, &res);
         goto Exit;
     }
@@ -839,12 +1182,12 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
         {
             /* iterate through all referrals, return 1st successfully connected */
             CMItem * item = NULL;
-            CMIterator iterator;
 
-            cmListIteratorStart(pCache->refList, &iterator);
-            while (cmListIteratorHasNext(&iterator) && res.share == NULL)
+            probeTargets(pCache, pShare->user->credentials);
+            targets = ccDfsCacheGetTargets(pCache, &numTargets);
+            for (i = 0; i < numTargets && res.share == NULL; i++)
             {
-                item = cmListIteratorNext(&iterator);
+                item = &targets[i]->item;
                 LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " %s", cmWDump(item->name));
 
                 pCredentials = pShare->user->credentials;
@@ -852,7 +1195,8 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                 if (pCredentials !=  pShare->user->credentials)
                     cmMemoryFree(pCredentials);
             }
-            cmListIteratorTerminate(&iterator);
+            cmMemoryFree(targets);
+            targets = NULL;
 
             if (NULL != context)
                 context->referral = item;
@@ -871,12 +1215,12 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                 {
                     /* iterate through all referrals, return 1st successfully connected */
                     CMItem * item = NULL;
-                    CMIterator iterator;
 
-                    cmListIteratorStart(pCache->refList, &iterator);
-                    while (cmListIteratorHasNext(&iterator) && pRootShare == NULL)
+                    probeTargets(pCache, pShare->user->credentials);
+                    targets = ccDfsCacheGetTargets(pCache, &numTargets);
+                    for (i = 0; i < numTargets && pRootShare == NULL; i++)
                     {
-                        item = cmListIteratorNext(&iterator);
+                        item = &targets[i]->item;
                         LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " %s", cmWDump(item->name));
 
                         pCredentials = pShare->user->credentials;
@@ -887,25 +1231,27 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                         if (pCredentials !=  pShare->user->credentials)
                             cmMemoryFree(pCredentials);
                     }
-                    cmListIteratorTerminate(&iterator);
+                    cmMemoryFree(targets);
+                    targets = NULL;
                 }
 
                 /* ask root for referrals */
                 if (pRootShare && getReferrals(pMount ,pRootShare, path, parseReferralCallback))
                 {
                     /* return 1st found referral */
+                    ccDfsCacheRelease(pCache);
                     pCache = ccDfsCacheFindPath(path);
                     if (NULL != pCache)   /* found in cache */
                     {
                         /* iterate through all referrals, return 1st successfully connected */
                         CMItem * item = NULL;
-                        CMIterator iterator;
 
-                        cmListIteratorStart(pCache->refList, &iterator);
+                        probeTargets(pCache, pShare->user->credentials);
+                        targets = ccDfsCacheGetTargets(pCache, &numTargets);
 
-                        while (cmListIteratorHasNext(&iterator) && res.share == NULL)
+                        for (i = 0; i < numTargets && res.share == NULL; i++)
                         {
-                            item = cmListIteratorNext(&iterator);
+                            item = &targets[i]->item;
                             LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " %s", cmWDump(item->name));
 
                             pCredentials = pShare->user->credentials;
@@ -913,7 +1259,8 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                             if (pCredentials !=  pShare->user->credentials)
                                 cmMemoryFree(pCredentials);
                         }
-                        cmListIteratorTerminate(&iterator);
+                        cmMemoryFree(targets);
+                        targets = NULL;
 
                         if (NULL != context && NULL != res.share)
                             context->referral = item;
@@ -926,12 +1273,12 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
             {
                 /* iterate through all referrals, return 1st successfully connected */
                 CCDfsReferral *referral = NULL;
-                CMIterator iterator;
 
-                cmListIteratorStart(pCache->refList, &iterator);
-                while (cmListIteratorHasNext(&iterator) && res.share == NULL)
+                probeTargets(pCache, pShare->user->credentials);
+                targets = ccDfsCacheGetTargets(pCache, &numTargets);
+                for (i = 0; i < numTargets && res.share == NULL; i++)
                 {
-                    referral = (CCDfsReferral *)cmListIteratorNext(&iterator);
+                    referral = targets[i];
                     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " %s", cmWDump(referral->item.name));
 
                     if (referral->isIOPerformed && referral->lastIOStatus != NQ_SUCCESS)
@@ -941,7 +1288,8 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                     if (pCredentials !=  pShare->user->credentials)
                         cmMemoryFree(pCredentials);
                 }
-                cmListIteratorTerminate(&iterator);
+                cmMemoryFree(targets);
+                targets = NULL;
 
                 if (NULL != context && NULL != res.share)
                     context->referral = &referral->item;
@@ -963,12 +1311,12 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
             {
                 /* iterate through all referrals, return 1st successfully connected */
                 CMItem * item = NULL;
-                CMIterator iterator;
 
-                cmListIteratorStart(pCache->refList, &iterator);
-                while (cmListIteratorHasNext(&iterator) && res.share == NULL)
+                probeTargets(pCache, pShare->user->credentials);
+                targets = ccDfsCacheGetTargets(pCache, &numTargets);
+                for (i = 0; i < numTargets && res.share == NULL; i++)
                 {
-                    item = cmListIteratorNext(&iterator);
+                    item = &targets[i]->item;
                     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " %s", cmWDump(item->name));
 
                     pCredentials = pShare->user->credentials;
@@ -976,7 +1324,8 @@ CCDfsResult ccDfsResolvePath(CCMount *pMount, CCShare * pShare, const NQ_WCHAR *
                     if (pCredentials != pShare->user->credentials)
                         cmMemoryFree(pCredentials);
                 }
-                cmListIteratorTerminate(&iterator);
+                cmMemoryFree(targets);
+                targets = NULL;
 
                 if (NULL != context && NULL != res.share)
                     context->referral = item;
@@ -996,6 +1345,12 @@ Exit:
 	if (NULL != res.share)
 		ccMountAddShareLink(pMount, res.share);
 
+    cmMemoryFree(targets);
+    if (NULL != pCache)
+    {
+        ccDfsCacheRelease(pCache);
+    }
+
     cmMemoryFree(path);
     logPrintResult(res);
 #endif /* UD_CC_INCLUDEDFS */
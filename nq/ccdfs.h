@@ -54,6 +54,11 @@ typedef struct _ccdfsreferral
     NQ_BOOL isConnected;        /* whether this host is connected and user has logged in */
     NQ_BOOL isIOPerformed;      /* whether IO operation was performed at least once */
     NQ_STATUS lastIOStatus;     /* last IO operation status */ 
+    NQ_BOOL isProbed;           /* whether target was probed */
+    NQ_BOOL isReachable;        /* whether the probe connected to this target */
+    NQ_UINT32 rtt;              /* probe connect time in milliseconds */
+    NQ_UINT16 siteRank;         /* position in the server's list, which is ordered by site cost */
+    void * entry;               /* owning DFS cache entry or NULL */
 } CCDfsReferral;
 
 /* Description
@@ -21,11 +21,36 @@
 
 #define CCDFSCACHE_CLEANUPTIMER 1800    /* in seconds, each such period of time cache is checked and cleaned
                                            30 minutes is Windows default referral TTL */
+#define CCDFSCACHE_REFRESHRATIO 4       /* refresh referrals in the last 1/CCDFSCACHE_REFRESHRATIO of their TTL */
+#define CCDFSCACHE_REFRESHTIMEOUT 30    /* in seconds - max wait for the refresh thread on shutdown */
+#define CCDFSCACHE_RTTTOLERANCE 10      /* in milliseconds - probe times closer than this keep the server order */
+
+/* Node of the cache index. There is one node per path component and
+   components are kept folded to upper case, so that a lookup walks the
+   path once and matches whole components regardless of case. */
+typedef struct _trienode
+{
+    struct _trienode * parent;      /* parent node or NULL for the root */
+    struct _trienode * children;    /* first child node */
+    struct _trienode * next;        /* next sibling */
+    CCDfsCacheEntry * entry;        /* entry for the path ending at this node or NULL */
+    NQ_COUNT length;                /* component length in characters */
+    NQ_WCHAR * component;           /* folded component, allocated after the node */
+} TrieNode;
 
 static CMList pathCache;                /* DFS cache */
 static CMList domainCache;              /* DFS cache */
+static TrieNode pathRoot;               /* index of the DFS cache by path components */
+static TrieNode domainRoot;             /* index of the domain cache */
+static SYMutex guard;                   /* critical section for cache access */
 static NQ_BOOL isCacheOn;               /* indicates whether cache is maintained */
 static NQ_UINT32 cacheTTL;              /* timer for cache cleanup, zeroed every CCDFSCACHE_CLEANUPTIMER of seconds */
+static CMList refreshQueue;             /* paths scheduled for background refresh */
+static CCDfsCacheRefresh refreshCallback;   /* refreshes referrals of one path or NULL */
+static NQ_BOOL refreshRunning;          /* TRUE while the refresh thread is running */
+static NQ_BOOL refreshStop;             /* TRUE when the refresh thread should exit */
+static SYThread refreshThread;          /* background refresh thread */
+static CMThreadCond refreshDone;        /* signalled when the refresh thread exits after refreshStop was set */
 
 /* -- Local functions -- */
 
@@ -82,41 +107,344 @@ static NQ_BOOL unlockCallback(CMItem * pItem)
 {
     CCDfsCacheEntry * pEntry = (CCDfsCacheEntry *)pItem;
 
-    cmListShutdown(pEntry->refList);
-    cmMemoryFree(pEntry->refList);
+    if (NULL != pEntry->refList)
+    {
+        cmListShutdown(pEntry->refList);
+        cmMemoryFree(pEntry->refList);
+        pEntry->refList = NULL;
+    }
+    cmMemoryFree(pEntry->server);
+    pEntry->server = NULL;
 
     return FALSE;
 }
 
-static void removeReferral(CMList * list, const NQ_WCHAR * path)
+/* find the next path component skipping separators, returns NULL at the end of the path */
+static const NQ_WCHAR * nextComponent(const NQ_WCHAR * path, NQ_COUNT * length)
+{
+    const NQ_WCHAR * p;     /* pointer in the path */
+
+    while (cmWChar('\\') == *path || cmWChar('/') == *path)
+        path++;
+    if (cmWChar(0) == *path)
+        return NULL;
+    for (p = path; cmWChar(0) != *p && cmWChar('\\') != *p && cmWChar('/') != *p; p++)
+        ;
+    *length = (NQ_COUNT)(p - path);
+    return path;
+}
+
+/* fold path to upper case, the result should be freed */
+static NQ_WCHAR * foldPath(const NQ_WCHAR * path)
+{
+    NQ_WCHAR * folded = cmMemoryCloneWString(path);
+
+    if (NULL != folded)
+        cmWStrupr(folded);
+    return folded;
+}
+
+static TrieNode * findChild(const TrieNode * node, const NQ_WCHAR * component, NQ_COUNT length)
+{
+    TrieNode * child;       /* next child */
+
+    for (child = node->children; NULL != child; child = child->next)
+    {
+        if (child->length == length && 0 == syMemcmp(child->component, component, length * sizeof(NQ_WCHAR)))
+            break;
+    }
+    return child;
+}
+
+/* longest match of a folded path - the deepest node with an entry, expired entries are skipped when checkTtl is set */
+static CCDfsCacheEntry * trieFind(const TrieNode * root, const NQ_WCHAR * folded, NQ_BOOL checkTtl, NQ_BOOL * isExact)
+{
+    const TrieNode * node = root;       /* current node */
+    CCDfsCacheEntry * pEntry = NULL;    /* best match */
+    const NQ_WCHAR * component;         /* next path component */
+    NQ_COUNT length = 0;                /* component length */
+    NQ_COUNT rest;                      /* length of the following component */
+    NQ_UINT32 timeNow = (NQ_UINT32)syGetTimeInSec();
+
+    *isExact = FALSE;
+    for (component = nextComponent(folded, &length); NULL != component; component = nextComponent(component + length, &length))
+    {
+        node = findChild(node, component, length);
+        if (NULL == node)
+            break;
+        if (NULL != node->entry && (!checkTtl || timeNow < node->entry->ttl))
+        {
+            pEntry = node->entry;
+            *isExact = (NULL == nextComponent(component + length, &rest));
+        }
+    }
+    return pEntry;
+}
+
+/* exact lookup regardless of TTL */
+static CCDfsCacheEntry * findExact(const TrieNode * root, const NQ_WCHAR * path)
+{
+    CCDfsCacheEntry * pEntry = NULL;    /* result */
+    NQ_WCHAR * folded;                  /* folded path */
+    NQ_BOOL isExact;                    /* whole path matched */
+
+    folded = foldPath(path);
+    if (NULL == folded)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+    pEntry = trieFind(root, folded, FALSE, &isExact);
+    if (!isExact)
+        pEntry = NULL;
+    cmMemoryFree(folded);
+
+Exit:
+    return pEntry;
+}
+
+/* release nodes left without entries and children, up to the root */
+static void triePrune(TrieNode * node)
+{
+    while (NULL != node->parent && NULL == node->entry && NULL == node->children)
+    {
+        TrieNode * parent = node->parent;   /* next node to check */
+        TrieNode ** link;                   /* link to this node */
+
+        for (link = &parent->children; *link != node; link = &(*link)->next)
+            ;
+        *link = node->next;
+        cmMemoryFree(node);
+        node = parent;
+    }
+}
+
+static NQ_BOOL trieInsert(TrieNode * root, const NQ_WCHAR * path, CCDfsCacheEntry * pEntry)
+{
+    TrieNode * node = root;             /* current node */
+    NQ_WCHAR * folded;                  /* folded path */
+    const NQ_WCHAR * component;         /* next path component */
+    NQ_COUNT length = 0;                /* component length */
+    NQ_BOOL result = FALSE;             /* return value */
+
+    folded = foldPath(path);
+    if (NULL == folded)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+
+    for (component = nextComponent(folded, &length); NULL != component; component = nextComponent(component + length, &length))
+    {
+        TrieNode * child = findChild(node, component, length);
+
+        if (NULL == child)
+        {
+            child = (TrieNode *)cmMemoryAllocate((NQ_UINT)(sizeof(TrieNode) + length * sizeof(NQ_WCHAR)));
+            if (NULL == child)
+            {
+                LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+                triePrune(node);
+                goto Exit;
+            }
+            child->parent = node;
+            child->children = NULL;
+            child->entry = NULL;
+            child->length = length;
+            child->component = (NQ_WCHAR *)(child + 1);
+            syMemcpy(child->component, component, length * sizeof(NQ_WCHAR));
+            child->next = node->children;
+            node->children = child;
+        }
+        node = child;
+    }
+    if (node == root)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Empty path");
+        goto Exit;
+    }
+
+    node->entry = pEntry;
+    pEntry->node = node;
+    result = TRUE;
+
+Exit:
+    cmMemoryFree(folded);
+    return result;
+}
+
+static void trieClear(TrieNode * node)
+{
+    while (NULL != node->children)
+    {
+        TrieNode * child = node->children;  /* next child */
+
+        node->children = child->next;
+        trieClear(child);
+        cmMemoryFree(child);
+    }
+}
+
+/* remove entry from the index and the list and release it, an entry still held is released by its last holder */
+static void disposeEntry(CCDfsCacheEntry * pEntry)
+{
+    TrieNode * node = (TrieNode *)pEntry->node;
+
+    if (NULL != node)
+    {
+        node->entry = NULL;
+        pEntry->node = NULL;
+        triePrune(node);
+    }
+    if (pEntry->holds > 0)
+    {
+        if (!pEntry->isRemoved)
+        {
+            pEntry->isRemoved = TRUE;
+            cmListItemRemove((CMItem *)pEntry);
+        }
+        return;
+    }
+    unlockCallback((CMItem *)pEntry);
+    if (pEntry->isRemoved)
+        cmListItemDispose((CMItem *)pEntry);
+    else
+        cmListItemRemoveAndDispose((CMItem *)pEntry);
+}
+
+static void setEntryTtl(CCDfsCacheEntry * pEntry, NQ_UINT32 ttl)
+{
+    NQ_UINT32 timeNow = (NQ_UINT32)syGetTimeInSec();
+
+    pEntry->ttl = timeNow + ttl;
+    pEntry->refreshTime = timeNow + ttl - ttl / CCDFSCACHE_REFRESHRATIO;
+    pEntry->refreshing = FALSE;
+}
+
+static CCDfsReferral * addTarget(CCDfsCacheEntry * pEntry, const NQ_WCHAR * path, const CCDfsReferral * referral)
+{
+    CCDfsReferral * pRef;   /* new referral */
+
+    pRef = (CCDfsReferral *)cmListItemCreateAndAdd(pEntry->refList, sizeof(CCDfsReferral), referral->netPath, NULL, CM_LISTITEM_NOLOCK);
+    if (NULL == pRef)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Item was not created");
+        goto Exit;
+    }
+    pRef->isConnected = FALSE;
+    pRef->isIOPerformed = FALSE;
+    pRef->lastIOStatus = NQ_SUCCESS;
+    pRef->serverType = 0;
+    pRef->flags = 0;
+    pRef->ttl = (NQ_UINT32)syGetTimeInSec() + referral->ttl;
+    pRef->netPath = referral->netPath;
+    pRef->dfsPath = (NQ_WCHAR *)path;
+    pRef->isProbed = FALSE;
+    pRef->isReachable = FALSE;
+    pRef->rtt = 0;
+    pRef->siteRank = pEntry->numTargets++;
+    pRef->entry = pEntry;
+
+Exit:
+    return pRef;
+}
+
+/* rank of a target: known-good first, then not probed yet, then failed */
+static NQ_INT targetTier(const CCDfsReferral * pRef)
+{
+    if (pRef->isIOPerformed && NQ_SUCCESS != pRef->lastIOStatus)
+        return 2;
+    if (!pRef->isProbed)
+        return 1;
+    return pRef->isReachable ? 0 : 2;
+}
+
+/* whether target a should be tried before target b */
+static NQ_BOOL isBetterTarget(const CCDfsReferral * a, const CCDfsReferral * b)
+{
+    NQ_INT tierA = targetTier(a);
+    NQ_INT tierB = targetTier(b);
+
+    if (tierA != tierB)
+        return tierA < tierB;
+    if (0 == tierA)
+    {
+        if (a->rtt + CCDFSCACHE_RTTTOLERANCE < b->rtt)
+            return TRUE;
+        if (b->rtt + CCDFSCACHE_RTTTOLERANCE < a->rtt)
+            return FALSE;
+    }
+    return a->siteRank < b->siteRank;
+}
+
+/* order a snapshot of targets from the best to the worst, the list itself keeps the server order */
+static void rankTargets(CCDfsReferral ** targets, NQ_COUNT numTargets)
+{
+    NQ_COUNT sorted;        /* number of targets at the array head already sorted */
+
+    /* selection sort: move the best of the unsorted tail to its head */
+    for (sorted = 0; sorted + 1 < numTargets; sorted++)
+    {
+        NQ_COUNT best = sorted;     /* best target so far */
+        NQ_COUNT i;                 /* index in the tail */
+        CCDfsReferral * pRef;       /* swapped target */
+
+        for (i = sorted + 1; i < numTargets; i++)
+        {
+            if (isBetterTarget(targets[i], targets[best]))
+                best = i;
+        }
+        pRef = targets[sorted];
+        targets[sorted] = targets[best];
+        targets[best] = pRef;
+    }
+}
+
+/* find a target of an entry, called with guard taken - the referral list is walked without its own guard */
+static CCDfsReferral * findTarget(const CCDfsCacheEntry * pEntry, const NQ_WCHAR * name)
+{
+    CMItem * pItem;         /* next target */
+
+    if (NULL == pEntry->refList)
+        return NULL;
+    for (pItem = pEntry->refList->first; NULL != pItem; pItem = pItem->next)
+    {
+        if (0 == cmWStricmp(pItem->name, name))
+            break;
+    }
+    return (CCDfsReferral *)pItem;
+}
+
+static void removeReferral(TrieNode * root, const NQ_WCHAR * path)
 {
-    CMItem * pItem;
+    CCDfsCacheEntry * pEntry;
 
-    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "list:%p path:%s", list, cmWDump(path));
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "root:%p path:%s", root, cmWDump(path));
 
-    pItem = cmListItemFind(list, path, TRUE, FALSE);
-    if (NULL != pItem)
+    syMutexTake(&guard);
+    pEntry = findExact(root, path);
+    if (NULL != pEntry)
     {
-        cmListItemDispose(pItem); /* disposal callback will be called */
+        disposeEntry(pEntry);
     }
+    syMutexGive(&guard);
 
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
 
-static CCDfsCacheEntry * addReferral(CMList * list, const NQ_WCHAR * path, const CCDfsReferral * referral)
+/* called with guard taken */
+static CCDfsCacheEntry * addReferral(CMList * list, TrieNode * root, const NQ_WCHAR * path, const NQ_WCHAR * server, const CCDfsReferral * referral)
 {
     CCDfsCacheEntry * pEntry = NULL;
     CCDfsCacheEntry * pResult = NULL;
-    CMItem * pItem = NULL;
 
-    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "list:%p path:%s referral:%p", list, cmWDump(path), referral);
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "list:%p path:%s server:%s referral:%p", list, cmWDump(path), cmWDump(server), referral);
     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "referral: %s", cmWDump(referral->netPath));
 
     /* find existing referral in cache (same path) */
-    pItem = cmListItemFind(list, path, TRUE, FALSE);
-    if (NULL == pItem)
+    pEntry = findExact(root, path);
+    if (NULL == pEntry)
     {
-        CCDfsReferral * pRef = NULL;
         LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "not found, create new");
         pEntry = (CCDfsCacheEntry *)cmListItemCreate(sizeof(CCDfsCacheEntry), path, CM_LISTITEM_NOLOCK);
         if (NULL == pEntry)
@@ -124,48 +452,55 @@ static CCDfsCacheEntry * addReferral(CMList * list, const NQ_WCHAR * path, const
             LOGERR(CM_TRC_LEVEL_ERROR, "Item was not created");
             goto Exit;
         }
+        pEntry->refList = NULL;
+        pEntry->server = NULL;
+        pEntry->node = NULL;
+        pEntry->isProbed = FALSE;
+        pEntry->numTargets = 0;
+        pEntry->holds = 0;
+        pEntry->isRemoved = FALSE;
         pEntry->isRoot = referral->serverType == DFS_ROOT_TARGET;
-        pEntry->ttl = (NQ_UINT32)syGetTimeInSec() + referral->ttl;
         pEntry->numPathConsumed = referral->numPathConsumed;
+        pEntry->isExactMatch = FALSE;
         pEntry->lastIOStatus = NQ_ERR_ERROR;
+        setEntryTtl(pEntry, referral->ttl);
 #if SY_DEBUGMODE
         pEntry->item.dump = dumpOne;
 #endif /* SY_DEBUGMODE */
         if (!cmListItemAdd(list, (CMItem *)pEntry, unlockCallback))
         {
             LOGERR(CM_TRC_LEVEL_ERROR, "Item was not added");
-            goto Error1;
+            cmMemoryFree(pEntry);
+            goto Exit;
+        }
+
+        if (!trieInsert(root, path, pEntry))
+        {
+            goto Error;
+        }
+
+        if (NULL != server)
+        {
+            pEntry->server = cmMemoryCloneWString(server);
+            if (NULL == pEntry->server)
+            {
+                LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+                goto Error;
+            }
         }
 
         pEntry->refList = (CMList *)cmMemoryAllocate(sizeof(CMList));
         if (NULL == pEntry->refList)
         {
             LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
-            goto Error1;
+            goto Error;
         }
-
         cmListStart(pEntry->refList);
-        pItem = cmListItemCreate(sizeof(CCDfsReferral), referral->netPath, CM_LISTITEM_NOLOCK);
-        if (NULL == pItem)
-        {
-            LOGERR(CM_TRC_LEVEL_ERROR, "Item was not created");
-            goto Error2;
-        }
-        if (!cmListItemAdd(pEntry->refList, pItem, NULL))
+
+        if (NULL == addTarget(pEntry, path, referral))
         {
-            LOGERR(CM_TRC_LEVEL_ERROR, "Item was not added");
-            goto Error3;
+            goto Error;
         }
-        pRef = (CCDfsReferral *)pItem;
-        pRef->isConnected = FALSE;
-        pRef->isIOPerformed = FALSE;
-        pRef->lastIOStatus = NQ_SUCCESS;
-        pRef->serverType = 0;
-        pRef->flags = 0;
-        pRef->ttl = (NQ_UINT32)syGetTimeInSec() + referral->ttl;
-        pRef->isConnected = 0;
-        pRef->netPath = referral->netPath;
-        pRef->dfsPath = (NQ_WCHAR *)path;
     }
     else
     {
@@ -173,42 +508,32 @@ static CCDfsCacheEntry * addReferral(CMList * list, const NQ_WCHAR * path, const
 
         LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "found");
 
-        /* add additional referral into referrals list */
-        pEntry = (CCDfsCacheEntry *)pItem;
-
         /* do not add additional referral if it points to itself */
         if (cmWStricmp(pEntry->item.name, referral->netPath) != 0)
         {
-            /* do not add double referrals */
-            if (NULL == cmListItemFind(pEntry->refList, referral->netPath, TRUE, FALSE))
+            pRef = findTarget(pEntry, referral->netPath);
+            if (NULL == pRef)
             {
-                pItem = cmListItemCreate(sizeof(CCDfsReferral), referral->netPath, CM_LISTITEM_NOLOCK);
-                if (NULL == pItem)
+                /* add additional referral into referrals list */
+                if (NULL == addTarget(pEntry, path, referral))
                 {
-                    LOGERR(CM_TRC_LEVEL_ERROR, "Item was not created");
                     goto Exit;
                 }
-                if (!cmListItemAdd(pEntry->refList, pItem, NULL))
-                {
-                    LOGERR(CM_TRC_LEVEL_ERROR, "Item was not added");
-                    goto Error4;
-                }
                 LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "added into referrals list");
-
-                /* update entry's ttl to a new one */
-                pEntry->ttl = (NQ_UINT32)syGetTimeInSec() + referral->ttl;
-
-                pRef = (CCDfsReferral *)pItem;
-                pRef->isConnected = FALSE;
-                pRef->isIOPerformed = FALSE;
-                pRef->lastIOStatus = NQ_SUCCESS;
-                pRef->serverType = 0;
-                pRef->flags = 0;
+            }
+            else
+            {
+                /* the same referral again - keep it alive */
                 pRef->ttl = (NQ_UINT32)syGetTimeInSec() + referral->ttl;
-                pRef->isConnected = 0;
-                pRef->netPath = referral->netPath;
-                pRef->dfsPath = (NQ_WCHAR *)path;
+                LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "referral ttl updated");
             }
+
+            /* update entry's ttl to a new one */
+            setEntryTtl(pEntry, referral->ttl);
+        }
+        if (NULL == pEntry->server && NULL != server)
+        {
+            pEntry->server = cmMemoryCloneWString(server);
         }
     }
     pResult = pEntry;
@@ -217,28 +542,19 @@ Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pResult);
     return pResult;
 
-Error4:
-    cmMemoryFree(pItem);
-    goto Exit;
-
-Error3:
-    cmMemoryFree(pItem);
-
-Error2:
-    unlockCallback((CMItem *)pEntry);
-
-Error1:
-    cmMemoryFree(pEntry);
+Error:
+    disposeEntry(pEntry);
     goto Exit;
 }
 
+/* called with guard taken */
 static void cleanCache(CMList *pCache)
 {
     NQ_UINT32 timeNow = (NQ_UINT32)syGetTimeInSec();
     CMIterator iterator;
     CCDfsCacheEntry *pEntry;
     NQ_COUNT removed = 0;
-        
+
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "pCache:%p cacheTTL:%u timeNow:%u", pCache, cacheTTL, timeNow);
 
     if (cacheTTL < timeNow)
@@ -247,29 +563,27 @@ static void cleanCache(CMList *pCache)
         while (cmListIteratorHasNext(&iterator))
         {
             pEntry = (CCDfsCacheEntry *)cmListIteratorNext(&iterator);
-            if (pEntry->ttl > timeNow)
+            if (pEntry->ttl <= timeNow)
             {
                 removed++;
-                cmListItemCheck((CMItem *)pEntry);
-                cmListItemRemoveAndDispose((CMItem *)pEntry);
+                disposeEntry(pEntry);
             }
-            else
+            else if (0 == pEntry->holds && NULL != pEntry->refList)
             {
-                /* in ref list still can be entries with old TTL */
-                CMIterator iter;
+                /* in ref list still can be entries with old TTL, a held entry keeps them until it is released */
+                CMItem * pItem = pEntry->refList->first;
 
-                cmListIteratorStart(pEntry->refList, &iter);
-                while (cmListIteratorHasNext(&iter))
+                while (NULL != pItem)
                 {
-                    CCDfsReferral *ref = (CCDfsReferral *)cmListIteratorNext(&iter);
+                    CCDfsReferral *ref = (CCDfsReferral *)pItem;
 
-                    if (ref->ttl > timeNow)
+                    pItem = pItem->next;
+                    if (ref->ttl <= timeNow)
                     {
                         removed++;
                         cmListItemRemoveAndDispose((CMItem *)ref);
                     }
                 }
-                cmListIteratorTerminate(&iter);
             }
         }
         cmListIteratorTerminate(&iterator);
@@ -277,51 +591,148 @@ static void cleanCache(CMList *pCache)
         cacheTTL = (NQ_UINT32)syGetTimeInSec() + CCDFSCACHE_CLEANUPTIMER;
     }
 
-    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "removed %d entries", removed);
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "removed %d entries", removed);
+}
+
+/* background refresh of referrals about to expire */
+static void refreshThreadBody(void)
+{
+    for (; ;)
+    {
+        NQ_WCHAR * path = NULL;             /* path to refresh */
+        NQ_WCHAR * server = NULL;           /* server to query */
+        CCDfsCacheRefresh callback;         /* refresh callback */
+        CCDfsCacheEntry * pEntry;           /* cache entry */
+
+        syMutexTake(&guard);
+        if (!refreshStop && NULL != refreshQueue.first)
+        {
+            path = cmMemoryCloneWString(refreshQueue.first->name);
+            cmListItemRemoveAndDispose(refreshQueue.first);
+        }
+        if (NULL == path)
+        {
+            refreshRunning = FALSE;
+            /* only stopRefresh() waits for the thread: signal under the guard so that nothing is touched after it */
+            if (refreshStop)
+                cmThreadCondSignal(&refreshDone);
+            syMutexGive(&guard);
+            cmThreadUnsubscribe();
+            return;
+        }
+        pEntry = findExact(&pathRoot, path);
+        if (NULL != pEntry && NULL != pEntry->server)
+        {
+            server = cmMemoryCloneWString(pEntry->server);
+        }
+        callback = refreshCallback;
+        syMutexGive(&guard);
+
+        if (NULL != server && NULL != callback)
+        {
+            /* a failed refresh leaves the existing entry to expire normally */
+            (*callback)(path, server);
+        }
+
+        cmMemoryFree(server);
+        cmMemoryFree(path);
+    }
+}
+
+/* schedule background refresh when an entry enters the last part of its TTL, called with guard taken */
+static void scheduleRefresh(CCDfsCacheEntry * pEntry)
+{
+    if (pEntry->refreshing || NULL == pEntry->server || NULL == refreshCallback || refreshStop)
+        return;
+    if ((NQ_UINT32)syGetTimeInSec() < pEntry->refreshTime)
+        return;
+    if (NULL == cmListItemCreateAndAdd(&refreshQueue, sizeof(CMItem), pEntry->item.name, NULL, CM_LISTITEM_NOLOCK))
+        return;
+    pEntry->refreshing = TRUE;
+    if (!refreshRunning)
+    {
+        refreshRunning = TRUE;
+        syThreadStart(&refreshThread, refreshThreadBody, TRUE);
+    }
+}
+
+/* stop background refresh and wait for the thread to leave - it still uses the cache and the guard */
+static void stopRefresh(void)
+{
+    syMutexTake(&guard);
+    refreshStop = TRUE;
+    refreshCallback = NULL;
+    while (refreshRunning)
+    {
+        syMutexGive(&guard);
+        if (!cmThreadCondWait(&refreshDone, CCDFSCACHE_REFRESHTIMEOUT))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Still waiting for the DFS refresh thread");
+        }
+        syMutexTake(&guard);
+    }
+    syMutexGive(&guard);
 }
 
 /* -- API Functions */
 
 NQ_BOOL ccDfsCacheStart(void)
 {
+    NQ_BOOL result = FALSE;
+
+    syMutexCreate(&guard);
+    if (!cmThreadCondSet(&refreshDone))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to create DFS cache condition");
+        syMutexDelete(&guard);
+        goto Exit;
+    }
     cmListStart(&pathCache);
     cmListStart(&domainCache);
+    cmListStart(&refreshQueue);
 #if SY_DEBUGMODE
     pathCache.name = "pathCache";
     domainCache.name = "domainCache";
 #endif
+    syMemset(&pathRoot, 0, sizeof(pathRoot));
+    syMemset(&domainRoot, 0, sizeof(domainRoot));
+    refreshCallback = NULL;
+    refreshRunning = FALSE;
+    refreshStop = FALSE;
     cacheTTL = (NQ_UINT32)syGetTimeInSec() + CCDFSCACHE_CLEANUPTIMER;
     isCacheOn = TRUE;
-    return TRUE;
+    result = TRUE;
+
+Exit:
+    return result;
 }
 
 void ccDfsCacheShutdown(void)
 {
-    CMIterator  itr;
+    if (!isCacheOn)
+        return;
 
-    cmListIteratorStart(&pathCache, &itr);
-    while (cmListIteratorHasNext(&itr))
-    {
-        CMItem * pItem;
+    stopRefresh();
 
-        pItem = cmListIteratorNext(&itr);
-        cmListItemCheck(pItem);
+    syMutexTake(&guard);
+    while (NULL != pathCache.first)
+    {
+        disposeEntry((CCDfsCacheEntry *)pathCache.first);
     }
-    cmListIteratorTerminate(&itr);
-
-    cmListIteratorStart(&domainCache, &itr);
-    while (cmListIteratorHasNext(&itr))
+    while (NULL != domainCache.first)
     {
-        CMItem * pItem;
-
-        pItem = cmListIteratorNext(&itr);
-        cmListItemCheck(pItem);
+        disposeEntry((CCDfsCacheEntry *)domainCache.first);
     }
-    cmListIteratorTerminate(&itr);
-
+    trieClear(&pathRoot);
+    trieClear(&domainRoot);
     cmListShutdown(&pathCache);
     cmListShutdown(&domainCache);
+    cmListShutdown(&refreshQueue);
     isCacheOn = FALSE;
+    syMutexGive(&guard);
+
+    cmThreadCondRelease(&refreshDone);
+    syMutexDelete(&guard);
 }
 
 NQ_BOOL ccDfsIsCacheOn(void)
@@ -329,65 +740,216 @@ NQ_BOOL ccDfsIsCacheOn(void)
     return isCacheOn;
 }
 
+void ccDfsCacheSetRefresh(CCDfsCacheRefresh callback)
+{
+    if (NULL == callback)
+    {
+        stopRefresh();
+        return;
+    }
+    syMutexTake(&guard);
+    refreshCallback = callback;
+    refreshStop = FALSE;
+    syMutexGive(&guard);
+}
+
 CCDfsCacheEntry * ccDfsCacheFindPath(const NQ_WCHAR * path)
 {
-    CCDfsCacheEntry     *pEntryTemp;            /* for iterating entries */
-    CMIterator          iterator;               /* list iterator */
-    CCDfsCacheEntry     *pEntry = NULL;         /* entry candidate */
-    NQ_COUNT            maxEntryLength = 0;     /* max entry length  */
-    NQ_UINT32           timeNow = (NQ_UINT32)syGetTimeInSec();
+    CCDfsCacheEntry     *pEntry = NULL;         /* longest match */
+    NQ_WCHAR            *folded;                /* path folded to upper case */
+    NQ_BOOL             isExact = FALSE;        /* whole path matched */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s", cmWDump(path));
-#if SY_DEBUGMODE
-    dumpCache(&pathCache);
-#endif
-    /*LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "FIND : %s", cmWDump((const NQ_WCHAR *)path));*/
 
-    cmListIteratorStart(&pathCache, &iterator);
-    while (cmListIteratorHasNext(&iterator))
+    folded = foldPath(path);
+    if (NULL == folded)
     {
-        pEntryTemp = (CCDfsCacheEntry *)cmListIteratorNext(&iterator);
-        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " entry: %s", cmWDump((const NQ_WCHAR *)pEntryTemp->item.name));
-
-        /* looking for exact match or longest partial match using whole path components */
-        if (0 == cmWStrncmp(pEntryTemp->item.name, path, cmWStrlen(pEntryTemp->item.name)))
-        {
-            if ((timeNow < pEntryTemp->ttl) && (cmWStrlen(pEntryTemp->item.name) > maxEntryLength))
-            {
-                maxEntryLength = cmWStrlen(pEntryTemp->item.name);
-                pEntry = pEntryTemp;
-            }
-        }
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
     }
-    cmListIteratorTerminate(&iterator);
 
-    if (pEntry)
+    /* looking for exact match or longest partial match using whole path components */
+    syMutexTake(&guard);
+    pEntry = trieFind(&pathRoot, folded, TRUE, &isExact);
+    if (NULL != pEntry)
     {
-        pEntry->isExactMatch = (cmWStrlen(path) == cmWStrlen(pEntry->item.name));
+        pEntry->isExactMatch = isExact;
+        pEntry->holds++;
+        scheduleRefresh(pEntry);
     }
+    syMutexGive(&guard);
+    cmMemoryFree(folded);
+
     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "%s match: %s", pEntry && pEntry->isExactMatch ? "exact" : "best", pEntry ? cmWDump((const NQ_WCHAR *)pEntry->item.name) : "null");
+
+Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pEntry);
     return pEntry;
 }
 
+CCDfsReferral ** ccDfsCacheGetTargets(CCDfsCacheEntry * pEntry, NQ_COUNT * numTargets)
+{
+    CCDfsReferral ** targets = NULL;    /* ranked targets */
+    CMItem * pItem;                     /* next target */
+    NQ_COUNT count = 0;                 /* number of targets */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "entry:%s", cmWDump(pEntry->item.name));
+
+    syMutexTake(&guard);
+    if (NULL != pEntry->refList)
+    {
+        for (pItem = pEntry->refList->first; NULL != pItem; pItem = pItem->next)
+            count++;
+    }
+    if (count > 0)
+    {
+        targets = (CCDfsReferral **)cmMemoryAllocate((NQ_UINT)(count * sizeof(CCDfsReferral *)));
+        if (NULL == targets)
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+            count = 0;
+        }
+        else
+        {
+            for (pItem = pEntry->refList->first, count = 0; NULL != pItem; pItem = pItem->next)
+                targets[count++] = (CCDfsReferral *)pItem;
+            rankTargets(targets, count);
+        }
+    }
+    syMutexGive(&guard);
+
+    *numTargets = count;
+    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "best target: %s", count > 0 ? cmWDump(targets[0]->item.name) : "none");
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "targets:%d", count);
+    return targets;
+}
+
+void ccDfsCacheRelease(CCDfsCacheEntry * pEntry)
+{
+    syMutexTake(&guard);
+    if (0 == --pEntry->holds && pEntry->isRemoved)
+    {
+        disposeEntry(pEntry);
+    }
+    syMutexGive(&guard);
+}
+
 void ccDfsCacheRemovePath(const NQ_WCHAR * path)
 {
-    removeReferral(&pathCache, path);
+    removeReferral(&pathRoot, path);
 }
 
-CCDfsCacheEntry * ccDfsCacheAddPath(const NQ_WCHAR * path, const CCDfsReferral * referral)
+NQ_BOOL ccDfsCacheAddPath(const NQ_WCHAR * path, const NQ_WCHAR * server, const CCDfsReferral * referral)
 {
-    CCDfsCacheEntry * pEntry; /* resulted entries */
+    NQ_BOOL result; /* return value */
 
-    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s referral:%p", cmWDump(path), referral);
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s server:%s referral:%p", cmWDump(path), cmWDump(server), referral);
 
+    syMutexTake(&guard);
     cleanCache(&pathCache);
-    pEntry = addReferral(&pathCache, path, referral);
+    result = NULL != addReferral(&pathCache, &pathRoot, path, server, referral);
 #if SY_DEBUGMODE
     dumpCache(&pathCache);
 #endif
-    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pEntry);
-    return pEntry;
+    syMutexGive(&guard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
+    return result;
+}
+
+NQ_BOOL ccDfsCacheRefreshPath(const NQ_WCHAR * path, const CCDfsReferral * referral)
+{
+    CCDfsCacheEntry * pEntry;       /* cache entry */
+    CCDfsReferral * pRef = NULL;    /* cached referral */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s referral:%s", cmWDump(path), cmWDump(referral->netPath));
+
+    syMutexTake(&guard);
+    pEntry = findExact(&pathRoot, path);
+    if (NULL != pEntry)
+    {
+        pRef = findTarget(pEntry, referral->netPath);
+        if (NULL != pRef)
+        {
+            pRef->ttl = (NQ_UINT32)syGetTimeInSec() + referral->ttl;
+            setEntryTtl(pEntry, referral->ttl);
+        }
+    }
+    syMutexGive(&guard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", NULL != pRef ? "TRUE" : "FALSE");
+    return NULL != pRef;
+}
+
+NQ_BOOL ccDfsCacheClaimProbe(CCDfsCacheEntry * pEntry)
+{
+    NQ_BOOL result = FALSE;
+
+    syMutexTake(&guard);
+    if (!pEntry->isProbed && NULL != pEntry->refList && NULL != pEntry->refList->first && NULL != pEntry->refList->first->next)
+    {
+        pEntry->isProbed = TRUE;
+        result = TRUE;
+    }
+    syMutexGive(&guard);
+
+    return result;
+}
+
+void ccDfsCacheProbeResult(const NQ_WCHAR * path, const NQ_WCHAR * target, NQ_BOOL isReachable, NQ_UINT32 rtt)
+{
+    CCDfsCacheEntry * pEntry;       /* cache entry */
+    CCDfsReferral * pRef;           /* cached referral */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "path:%s target:%s reachable:%d rtt:%u", cmWDump(path), cmWDump(target), isReachable, rtt);
+
+    syMutexTake(&guard);
+    pEntry = findExact(&pathRoot, path);
+    if (NULL != pEntry)
+    {
+        pRef = findTarget(pEntry, target);
+        if (NULL != pRef)
+        {
+            pRef->isProbed = TRUE;
+            pRef->isReachable = isReachable;
+            pRef->rtt = rtt;
+        }
+    }
+    syMutexGive(&guard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+CCDfsCacheEntry * ccDfsCacheTargetFailed(const CMItem * referral, NQ_STATUS status)
+{
+    CCDfsCacheEntry * pResult = NULL;   /* entry of this target */
+    CMItem * pItem;                     /* next entry */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "referral:%p status:%d", referral, status);
+
+    /* the caller may keep the referral longer than the entry lives: only a target still cached is touched */
+    syMutexTake(&guard);
+    for (pItem = pathCache.first; NULL != pItem && NULL == pResult; pItem = pItem->next)
+    {
+        CCDfsCacheEntry * pEntry = (CCDfsCacheEntry *)pItem;
+        CMItem * pRef;
+
+        for (pRef = NULL != pEntry->refList ? pEntry->refList->first : NULL; NULL != pRef; pRef = pRef->next)
+        {
+            if (pRef == referral)
+            {
+                ((CCDfsReferral *)pRef)->isIOPerformed = TRUE;
+                ((CCDfsReferral *)pRef)->lastIOStatus = status;
+                pEntry->holds++;
+                pResult = pEntry;
+                break;
+            }
+        }
+    }
+    syMutexGive(&guard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pResult);
+    return pResult;
 }
 
 CCDfsCacheEntry * ccDfsCacheFindDomain(const NQ_WCHAR * domain)
@@ -395,10 +957,14 @@ CCDfsCacheEntry * ccDfsCacheFindDomain(const NQ_WCHAR * domain)
     CCDfsCacheEntry * pEntry; /* resulted entries */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "domain:%s", cmWDump(domain));
-#if SY_DEBUGMODE
-    dumpCache(&domainCache);
-#endif
-    pEntry = (CCDfsCacheEntry *)cmListItemFind(&domainCache, domain, TRUE, FALSE);
+
+    syMutexTake(&guard);
+    pEntry = findExact(&domainRoot, domain);
+    if (NULL != pEntry)
+    {
+        pEntry->holds++;
+    }
+    syMutexGive(&guard);
 
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pEntry);
     return pEntry;
@@ -406,13 +972,13 @@ CCDfsCacheEntry * ccDfsCacheFindDomain(const NQ_WCHAR * domain)
 
 void ccDfsCacheRemoveDomain(const NQ_WCHAR * domain)
 {
-    removeReferral(&domainCache, domain);
+    removeReferral(&domainRoot, domain);
 }
 
-CCDfsCacheEntry * ccDfsCacheAddDomain(const NQ_WCHAR * domain, const NQ_WCHAR * host, NQ_UINT32 ttl)
+NQ_BOOL ccDfsCacheAddDomain(const NQ_WCHAR * domain, const NQ_WCHAR * host, NQ_UINT32 ttl)
 {
     CCDfsReferral ref;
-    CCDfsCacheEntry * pEntry = NULL; /* resulted entries */
+    NQ_BOOL result = FALSE; /* return value */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "domain:%s host:%s ttl:%u", cmWDump(domain), cmWDump(host), ttl);
 
@@ -426,12 +992,14 @@ CCDfsCacheEntry * ccDfsCacheAddDomain(const NQ_WCHAR * domain, const NQ_WCHAR *
         goto Exit;
     }
 
-    pEntry = addReferral(&domainCache, domain, &ref);
+    syMutexTake(&guard);
+    result = NULL != addReferral(&domainCache, &domainRoot, domain, NULL, &ref);
+    syMutexGive(&guard);
     cmMemoryFree(ref.netPath);
 
 Exit:
-    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pEntry);
-    return pEntry;
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
+    return result;
 }
 
 #endif /* UD_NQ_INCLUDECIFSCLIENT */
@@ -49,8 +49,30 @@ typedef struct _ccdfscacheentry
     NQ_UINT32 ttl;                  /* time to live */
     NQ_BOOL isExactMatch;           /* exact match */
     NQ_STATUS lastIOStatus;         /* last status of IO operation */
+    NQ_WCHAR * server;              /* server that returned the referral or NULL */
+    NQ_UINT32 refreshTime;          /* time to start background refresh */
+    NQ_BOOL refreshing;             /* TRUE when background refresh was scheduled */
+    void * node;                    /* node in the cache index */
+    NQ_BOOL isProbed;               /* TRUE when targets were probed */
+    NQ_UINT16 numTargets;           /* number of targets added so far, gives the next site rank */
+    NQ_COUNT holds;                 /* number of callers using this entry */
+    NQ_BOOL isRemoved;              /* TRUE when the entry left the cache while held */
 } CCDfsCacheEntry; /* DFS cache entry. */
 
+/* Description
+   Callback for background refresh of referrals.
+   
+   DFS cache calls this function from a dedicated thread when a
+   path entry enters the last quarter of its TTL. The callback is
+   expected to query referrals for this path and to report the
+   targets still referred to by <link ccDfsCacheRefreshPath@NQ_WCHAR *@CCDfsReferral *, ccDfsCacheRefreshPath()>.
+   Parameters
+   path :    DFS path of the entry.
+   server :  Server that returned the cached referral.
+   Returns
+   None                                                             */
+typedef void (* CCDfsCacheRefresh)(const NQ_WCHAR * path, const NQ_WCHAR * server);
+
 /* -- API Functions */
 
 /* Description
@@ -74,8 +96,23 @@ void ccDfsCacheShutdown(void);
  */
 NQ_BOOL ccDfsIsCacheOn(void);
 
+/* Description
+   Set callback for background refresh of referrals about to expire.
+   Parameters
+   callback :  Refresh callback or NULL to stop background refresh.
+               NULL waits for the refresh in progress to complete.
+   Returns
+   None
+ */
+void ccDfsCacheSetRefresh(CCDfsCacheRefresh callback);
+
 /* Description
    Find cache entry by DFS path.
+   
+   The match is case insensitive and uses whole path components.
+   The longest path with an entry that has not expired wins.
+   
+   The entry is held until the caller releases it by <link ccDfsCacheRelease@CCDfsCacheEntry *, ccDfsCacheRelease()>.
    Parameters
    path :  Remote path, containing host name and share path. This
            may be a DFS path.
@@ -84,6 +121,34 @@ NQ_BOOL ccDfsIsCacheOn(void);
    the cache.                                                     */
 CCDfsCacheEntry * ccDfsCacheFindPath(const NQ_WCHAR * path);
 
+/* Description
+   Get entry targets ranked from the best to the worst: reachable
+   targets by probe time, then targets not probed yet, then failed
+   targets. Reachable targets with similar probe times keep the
+   server order, which reflects site cost.
+   
+   The result is a snapshot, so that no cache lock is held while
+   the caller connects to the targets. The targets stay valid while
+   the entry is held.
+   Parameters
+   pEntry :      Pointer to a held DFS cache entry.
+   numTargets :  Buffer for the number of targets.
+   Returns
+   Array of targets to be freed by the caller or NULL when there
+   are no targets or on error.                                      */
+CCDfsReferral ** ccDfsCacheGetTargets(CCDfsCacheEntry * pEntry, NQ_COUNT * numTargets);
+
+/* Description
+   Release an entry returned by one of the find functions.
+   
+   An entry removed from the cache while held is disposed on its
+   last release.
+   Parameters
+   pEntry :  Pointer to DFS cache entry.
+   Returns
+   None                                                            */
+void ccDfsCacheRelease(CCDfsCacheEntry * pEntry);
+
 /* Description
    Remove cache entry by DFS path.
    Parameters
@@ -97,11 +162,58 @@ void ccDfsCacheRemovePath(const NQ_WCHAR * path);
    Parameters
    path :      Remote path, containing host name and share path.
                This may be a DFS path.
+   server :    Server that returned this referral. It is queried
+               again on background refresh. May be NULL.
    referral :  Pointer to referral structure (see <link CCDfsReferral>).
    Returns
-   Pointer to newly created DFS cache entry or NULL on error
-   (although not expected).                                       */
-CCDfsCacheEntry * ccDfsCacheAddPath(const NQ_WCHAR * path, const CCDfsReferral * referral);
+   TRUE on success or FALSE on error (although not expected).     */
+NQ_BOOL ccDfsCacheAddPath(const NQ_WCHAR * path, const NQ_WCHAR * server, const CCDfsReferral * referral);
+
+/* Description
+   Prolong a cached referral that was returned again on refresh.
+   Parameters
+   path :      DFS path of the entry.
+   referral :  Referral as returned by the server.
+   Returns
+   TRUE when this referral is cached for this path, FALSE otherwise. */
+NQ_BOOL ccDfsCacheRefreshPath(const NQ_WCHAR * path, const CCDfsReferral * referral);
+
+/* Description
+   Claim probing of entry targets.
+   
+   Targets are probed once per entry. Probe results rank the
+   targets returned by <link ccDfsCacheGetTargets@CCDfsCacheEntry *@NQ_COUNT *, ccDfsCacheGetTargets()>.
+   Parameters
+   pEntry :  Pointer to DFS cache entry.
+   Returns
+   TRUE when the caller should probe entry targets, FALSE when they
+   were already probed or there is only one target.                  */
+NQ_BOOL ccDfsCacheClaimProbe(CCDfsCacheEntry * pEntry);
+
+/* Description
+   Record probe result of a target.
+   Parameters
+   path :         DFS path of the entry.
+   target :       Target path.
+   isReachable :  TRUE when the probe connected to the target.
+   rtt :          Probe time in milliseconds.
+   Returns
+   None                                                             */
+void ccDfsCacheProbeResult(const NQ_WCHAR * path, const NQ_WCHAR * target, NQ_BOOL isReachable, NQ_UINT32 rtt);
+
+/* Description
+   Record IO failure on a cached target, so that failover goes to
+   the next best known-good target.
+   
+   The referral may have left the cache since it was returned, then
+   nothing is recorded.
+   Parameters
+   referral :  Referral returned in a DFS context.
+   status :    IO status.
+   Returns
+   Held entry of this target or NULL when the target is no longer
+   cached. The entry should be released by <link ccDfsCacheRelease@CCDfsCacheEntry *, ccDfsCacheRelease()>. */
+CCDfsCacheEntry * ccDfsCacheTargetFailed(const CMItem * referral, NQ_STATUS status);
 
 /* Description
    Find cache entry by domain name.
@@ -109,7 +221,7 @@ CCDfsCacheEntry * ccDfsCacheAddPath(const NQ_WCHAR * path, const CCDfsReferral *
    domain :  Domain name. May be either NetBIOS or FQDN.
    Returns
    Pointer to DFS cache entry or NULL if the DFS path is not in
-   the cache.                                                   */
+   the cache. The entry should be released by <link ccDfsCacheRelease@CCDfsCacheEntry *, ccDfsCacheRelease()>. */
 CCDfsCacheEntry * ccDfsCacheFindDomain(const NQ_WCHAR * domain);
 
 /* Description
@@ -127,8 +239,7 @@ void ccDfsCacheRemoveDomain(const NQ_WCHAR * domain);
    host :    DC host name.
    ttl : time to luve in seconds
    Returns
-   Pointer to newly created DFS cache entry or NULL on error
-   (although not expected).                                  */
-CCDfsCacheEntry * ccDfsCacheAddDomain(const NQ_WCHAR * domain, const NQ_WCHAR * host, NQ_UINT32 ttl);
+   TRUE on success or FALSE on error (although not expected). */
+NQ_BOOL ccDfsCacheAddDomain(const NQ_WCHAR * domain, const NQ_WCHAR * host, NQ_UINT32 ttl);
 
 #endif /* _CCDFSCACHE_H_ */
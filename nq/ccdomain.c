@@ -59,6 +59,12 @@ typedef struct
 {
 	NQ_HANDLE netlogonHandle;
 	SYMutex netlogonGuard;
+	CCNetlogonCredential channel;       /* secure channel credentials */
+	NQ_UINT32 channelFlags;             /* flags negotiated on the secure channel */
+	NQ_BOOL channelOpen;                /* TRUE when the secure channel can be reused */
+	NQ_WCHAR channelDc[CM_BUFFERLENGTH(NQ_WCHAR, CM_DNS_NAMELEN)];      /* DC the channel was set up with */
+	NQ_WCHAR channelWorkstation[CM_BUFFERLENGTH(NQ_WCHAR, CM_NQ_HOSTNAMESIZE)]; /* computer name of the channel */
+	NQ_BYTE channelSecret[16];          /* secret the channel was set up with */
 }
 StaticData;
 
@@ -87,6 +93,7 @@ NQ_BOOL ccDomainStart(void)
 #endif /* SY_FORCEALLOCATION */
 
 	staticData->netlogonHandle = NULL;
+	staticData->channelOpen = FALSE;
 	syMutexCreate(&staticData->netlogonGuard);
 
 Exit:
@@ -814,9 +821,145 @@ nextNetlogonCredentials(
 
     cmDES112(creds->client, data, creds->sessionKey);
 
+    /* chain the stored credential as the DC does so that the channel can be reused */
+    *p = cmHtol32(temp + creds->sequence + 1);
+    syMemcpy(creds->seed, data, sizeof(creds->seed));
+
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
 
+/*
+ *====================================================================
+ * PURPOSE: drop the secure channel and the NETLOGON pipe
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   the caller holds the NETLOGON guard
+ *====================================================================
+ */
+static
+void
+closeSecureChannel(
+    void
+    )
+{
+    staticData->channelOpen = FALSE;
+    if (NULL != staticData->netlogonHandle)
+    {
+        ccDcerpcDisconnect(staticData->netlogonHandle);
+        staticData->netlogonHandle = NULL;
+    }
+}
+
+/*
+ *====================================================================
+ * PURPOSE: set up a NETLOGON secure channel
+ *--------------------------------------------------------------------
+ * PARAMS:  IN  DC name
+ *          IN  computer name
+ *          IN  domain secret
+ *
+ * RETURNS: NQ_SUCCESS or error code
+ *
+ * NOTES:   the caller holds the NETLOGON guard. The channel is kept
+ *          open for the following logons with the same DC, computer
+ *          name and secret.
+ *====================================================================
+ */
+static
+NQ_UINT32
+openSecureChannel(
+    const NQ_WCHAR * dc,
+    const NQ_WCHAR * workstation,
+    const NQ_BYTE secret[16]
+    )
+{
+    CCNetlogonCredential * credentials = &staticData->channel;
+    NQ_UINT32 status;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "dc:%s workstation:%s", cmWDump(dc), cmWDump(workstation));
+
+    /* generate client random challenge */
+    cmCreateRandomByteSequence(credentials->client, sizeof(credentials->client));
+
+    /* send client challenge and get server random challenge */
+    if ((status = ccNetrServerReqChallenge(getNetlogonHandle(dc), dc, workstation, credentials)) == NQ_SUCCESS)
+    {
+        /* init and generate next netlogon credentials */
+        initNetlogonCredentials(credentials, secret);
+
+        /* send new client challenge, get server's challenge */
+        status = ccNetrServerAuthenticate2(getNetlogonHandle(dc), dc, workstation, credentials, &staticData->channelFlags);
+    }
+
+    if (status == NQ_SUCCESS)
+    {
+        cmWStrncpy(staticData->channelDc, dc, CM_DNS_NAMELEN);
+        staticData->channelDc[CM_DNS_NAMELEN] = cmWChar('\0');
+        cmWStrncpy(staticData->channelWorkstation, workstation, CM_NQ_HOSTNAMESIZE);
+        staticData->channelWorkstation[CM_NQ_HOSTNAMESIZE] = cmWChar('\0');
+        syMemcpy(staticData->channelSecret, secret, sizeof(staticData->channelSecret));
+        staticData->channelOpen = TRUE;
+    }
+    else
+    {
+        closeSecureChannel();
+    }
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:0x%x", status);
+    return status;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: check whether the open secure channel may be reused
+ *--------------------------------------------------------------------
+ * PARAMS:  IN  DC name
+ *          IN  computer name
+ *          IN  domain secret
+ *
+ * RETURNS: TRUE when the channel matches
+ *
+ * NOTES:   the caller holds the NETLOGON guard
+ *====================================================================
+ */
+static
+NQ_BOOL
+isSecureChannelOpen(
+    const NQ_WCHAR * dc,
+    const NQ_WCHAR * workstation,
+    const NQ_BYTE secret[16]
+    )
+{
+    return staticData->channelOpen
+        && cmWStricmp(staticData->channelDc, dc) == 0
+        && cmWStricmp(staticData->channelWorkstation, workstation) == 0
+        && syMemcmp(staticData->channelSecret, secret, sizeof(staticData->channelSecret)) == 0;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: check whether SamLogon failed on the user credentials
+ *--------------------------------------------------------------------
+ * PARAMS:  IN  SamLogon status
+ *
+ * RETURNS: TRUE when the DC rejected the user, FALSE when the failure
+ *          may be caused by a stale secure channel
+ *
+ * NOTES:
+ *====================================================================
+ */
+static
+NQ_BOOL
+isLogonVerdict(
+    NQ_UINT32 status
+    )
+{
+    return status == NQ_ERR_LOGONFAILURE || status == NQ_ERR_BADPW || status == NQ_ERR_ACCOUNTLOCKEDOUT;
+}
+
 /*
  *====================================================================
  * PURPOSE: logon to domain
@@ -915,55 +1058,62 @@ netLogon(
 
     /* connect to NETLOGON (as admin) */
     {
-        CCNetlogonCredential credentials;
+        NQ_INT attempt;
 
 		syMutexTake(&staticData->netlogonGuard);
 
-        /* generate client random challenge */
-        cmCreateRandomByteSequence(credentials.client, sizeof(credentials.client));
-
-        /* send client challenge and get server random challenge */
-        if ((status = ccNetrServerReqChallenge(getNetlogonHandle(dc), dc, workstation, &credentials)) == NQ_SUCCESS)
+        /* reuse the secure channel of the previous logon, set up a new one once if it was dropped */
+        for (attempt = 0; attempt < 2; attempt++)
         {
-            NQ_UINT32 flags;
+            NQ_BOOL reused = isSecureChannelOpen(dc, workstation, secret);
 
-            /* init and generate next netlogon credentials */
-            initNetlogonCredentials(&credentials, secret);
+            if (!reused)
+            {
+                if (staticData->channelOpen)
+                    closeSecureChannel();
+                if ((status = openSecureChannel(dc, workstation, secret)) != NQ_SUCCESS)
+                    break;
+            }
 
-            /* send new client challenge, get server's challenge */
-			if ((status = ccNetrServerAuthenticate2(getNetlogonHandle(dc), dc, workstation, &credentials, &flags)) == NQ_SUCCESS)
+            nextNetlogonCredentials(&staticData->channel);
+
+            /* send new client challenge */
+            status = ccNetrLogonSamLogon(
+				                        getNetlogonHandle(dc),
+                                        domain,
+                                        dc,
+                                        username,
+                                        workstation,
+                                        serverChallenge,
+                                        lmPasswd,
+                                        lmPasswdLen,
+                                        ntlmPasswd,
+                                        ntlmPasswdLen,
+                                        &staticData->channel,
+                                        isExtendedSecurity,
+                                        userSessionKey,
+										userRid,
+										groupRid
+										);
+            if (status == NQ_SUCCESS)
             {
-                nextNetlogonCredentials(&credentials);
-
-                /* send new client challenge */
-                status = ccNetrLogonSamLogon(
-					                        getNetlogonHandle(dc),
-                                            domain,
-                                            dc,
-                                            username,
-                                            workstation,
-                                            serverChallenge,
-                                            lmPasswd,
-                                            lmPasswdLen,
-                                            ntlmPasswd,
-                                            ntlmPasswdLen,
-                                            &credentials,
-                                            isExtendedSecurity,
-                                            userSessionKey,
-											userRid,
-											groupRid
-											);
-                if (status == NQ_SUCCESS)
+                LOGDUMP("userSessionKey", userSessionKey, 16);
+                /* decrypt user session key (RC4) */
+                if (staticData->channelFlags & 0x00000004)
                 {
-                    LOGDUMP("userSessionKey", userSessionKey, 16);
-                    /* decrypt user session key (RC4) */
-                    if (flags & 0x00000004)
-                    {
-                        cmArcfourCrypt(userSessionKey, 16, credentials.sessionKey, 16);
-                        LOGDUMP("userSessionKey (after rc4)", userSessionKey, 16);
-                    }
+                    cmArcfourCrypt(userSessionKey, 16, staticData->channel.sessionKey, 16);
+                    LOGDUMP("userSessionKey (after rc4)", userSessionKey, 16);
                 }
+                break;
             }
+
+            /* the DC accepted the channel and rejected the user */
+            if (isLogonVerdict(status))
+                break;
+            closeSecureChannel();
+            if (!reused)
+                break;
+            LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "secure channel rejected (0x%x), setting up a new one", status);
         }
 
 		syMutexGive(&staticData->netlogonGuard);
@@ -72,6 +72,7 @@ static NQ_BOOL	 validateNegotiate(void *pServ, void *pUser, void *pShare);
 static void handleWaitingNotifyResponse(void *pServer, void *pFile);
 static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch, NQ_BOOL (*callback)(CMItem * pItem));
 static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequest, Response * pResponse);
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch);
 static void anyResponseCallback(void * transport);
 
 static void keyDerivation(void * user);
@@ -123,6 +124,7 @@ static const CCCifsSmb dialect =
         (NQ_STATUS (*)(void *))doEcho,
         (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch, NQ_BOOL (*callback)(CMItem * pItem)))sendRequest,
 		(NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pResponse))sendReceive,
+		(NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch))receiveResponse,
 		anyResponseCallback,
 		keyDerivation,
 		signalAllMatches,
@@ -189,6 +191,14 @@ static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequ
 	return pServer->smb->sendReceive(pServer, pUser, pRequest, pResponse);
 }
 
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch)
+{
+	cmListItemTake(&pServer->item);
+	cmListItemGive(&pServer->item);
+
+	return pServer->smb->receiveResponse(pServer, pUser, pRequest, pMatch);
+}
+
 /*
 	 * Server sends notify responses == response without request. Ex: break notification
 	 * If file ID for sent response isn't found. we save the response and try again on newly created files.
@@ -34,8 +34,64 @@
     SMB_DESIREDACCESS_READCONTROL |   \
     SMB_DESIREDACCESS_READATTRIBUTES)
 
+/* -- Structures -- */
+
+/* entry in the server file ID index */
+typedef struct
+{
+    CMItem item;        /* list item */
+    CCFile * file;      /* open file */
+}
+FileIdEntry;
+
 /* -- Static functions --- */
 
+/*
+ * Match callback for the file ID index
+ */
+static NQ_BOOL matchFileId(CMItem * pItem, const void * context)
+{
+    CCFile * pFile = ((FileIdEntry *)pItem)->file;
+
+    return 0 == syMemcmp(context, pFile->fid, sizeof(pFile->fid));
+}
+
+/*
+ * Remove file from the server file ID index
+ */
+static void unindexFile(CCFile * pFile)
+{
+    if (NULL != pFile->idEntry)
+    {
+        cmListItemRemoveAndDispose(pFile->idEntry);
+        pFile->idEntry = NULL;
+    }
+}
+
+/*
+ * Add file to the server file ID index or re-index it by its new ID
+ */
+static void indexFile(CCFile * pFile)
+{
+    FileIdEntry * pEntry;
+
+    unindexFile(pFile);
+    pEntry = (FileIdEntry *)cmListItemCreate(sizeof(FileIdEntry), NULL, CM_LISTITEM_EXCLUSIVE);
+    if (NULL == pEntry)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        return;
+    }
+    pEntry->file = pFile;
+    cmListItemSetKey((CMItem *)pEntry, cmListKeyFromBytes(pFile->fid, sizeof(pFile->fid)));
+    if (!cmListItemAdd(&pFile->share->user->server->fileIds, (CMItem *)pEntry, NULL))
+    {
+        cmListItemDispose((CMItem *)pEntry);
+        return;
+    }
+    pFile->idEntry = (CMItem *)pEntry;
+}
+
 /*
  * Explicitly close and dispose file:
  *  - disconnects from the share
@@ -51,6 +107,7 @@ static void disposeFile(CCFile * pFile)
     pServer = pFile->share->user->server;
     if (NULL!= pServer->smb && pFile->open)
         pServer->smb->doClose(pFile);
+    unindexFile(pFile);
     cmListItemRemoveAndDispose((CMItem *)pFile);
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
@@ -122,46 +179,15 @@ CCFile * ccFileFind(CCShare * pShare, const NQ_WCHAR * path)
 
 CCFile * ccFileFindById(CCServer * pServer, const NQ_BYTE * id)
 {
-    CMIterator userIterator;        /* user iterator */
-    CCFile * pFile;                 /* next file pointer */
+    FileIdEntry * pEntry;           /* index entry */
+    CCFile * pFile = NULL;          /* file pointer */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p id:%p", pServer, id);
 
-    cmListItemTake((CMItem *)pServer);    /* MR - Roseville July 7, 2014 */
-    ccServerIterateUsers(pServer, &userIterator);
-    while (cmListIteratorHasNext(&userIterator))
-    {
-        CCUser * pUser;                 /* next user pointer */
-        CMIterator shareIterator;       /* share iterator */
+    pEntry = (FileIdEntry *)cmListItemFindByKey(&pServer->fileIds, cmListKeyFromBytes(id, sizeof(pFile->fid)), matchFileId, id, FALSE);
+    if (NULL != pEntry)
+        pFile = pEntry->file;
 
-        pUser = (CCUser *)cmListIteratorNext(&userIterator);
-        ccUserIterateShares(pUser, &shareIterator);
-        while (cmListIteratorHasNext(&shareIterator))
-        {
-            CCShare * pShare;               /* next share pointer */
-            CMIterator  fileIterator;       /* file Iterator*/
-
-            pShare = (CCShare *)cmListIteratorNext(&shareIterator);
-            cmListIteratorStart(&pShare->files, &fileIterator);
-            while (cmListIteratorHasNext(&fileIterator))
-            {
-                pFile = (CCFile *)cmListIteratorNext(&fileIterator);
-                if (0 == syMemcmp(id, pFile->fid, sizeof(pFile->fid)))
-                {
-                    cmListIteratorTerminate(&shareIterator);
-                    cmListIteratorTerminate(&fileIterator);
-                    goto Exit;
-                }
-            }
-            cmListIteratorTerminate(&fileIterator);
-        }
-        cmListIteratorTerminate(&shareIterator);
-    }
-    pFile = NULL;
-
-Exit:
-    cmListIteratorTerminate(&userIterator);
-    cmListItemGive((CMItem *)pServer);    /* MR - Roseville July 7, 2014 */
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pFile);
     return pFile;
 }
@@ -327,6 +353,7 @@ CCFile * ccFileCreate(CCShare * pShare, const NQ_WCHAR * path)
     pFile->open = FALSE;
     pFile->share = pShare;
     pFile->disconnected = FALSE;
+    pFile->idEntry = NULL;
 #ifdef UD_NQ_INCLUDESMB2
     pFile->durableState = DURABLE_REQUIRED;
     pFile->durableFlags = 0;
@@ -552,6 +579,7 @@ NQ_BOOL ccCloseHandle(NQ_HANDLE handle)
 		}
     }
     pFile->open = FALSE;
+    unindexFile(pFile);
 
     cmListItemUnlock((CMItem *)pFile);
     sySetLastError((NQ_UINT32)res);
@@ -817,6 +845,7 @@ CCFile * ccFileCreateOnServer(
         {
             pFile->open = TRUE;
             cmU64Zero(&pFile->offset);
+            indexFile(pFile);
             pShare->user->server->smb->handleWaitingNotifyResponses(pShare->user->server, pFile);
             goto Exit;
         }
@@ -1628,6 +1657,11 @@ NQ_BOOL ccFileRestore(CCFile * pFile)
     }
     result = (NQ_SUCCESS == res);
     pFile->open = result;
+    /* the server may have assigned a new ID, a handle that was not restored must not be found by the old one */
+    if (result)
+        indexFile(pFile);
+    else
+        unindexFile(pFile);
 
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", res ? "TRUE" : "FALSE");
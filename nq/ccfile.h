@@ -66,6 +66,7 @@ typedef struct _ccfile
     NQ_BOOL isPipe;             /* TRUE when this is a pipe */
     NQ_BYTE grantedOplock;      /* Level of the oplock that has been granted*/
     NQ_BOOL disconnected;       /* TRUE when connection was disconnected */
+    CMItem * idEntry;           /* Entry in the server file ID index or NULL when not indexed. */
 #ifdef UD_NQ_INCLUDESMB2
     NQ_UINT durableState;       /* States: durable required / durable not required / durable granted. see above */
     NQ_Uuid durableHandle;      /* Durable handle. */
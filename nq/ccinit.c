@@ -156,6 +156,8 @@ ccShutdown(
 #ifdef UD_CC_INCLUDEDOMAINMEMBERSHIP
 	ccDomainShutdown();
 #endif /* UD_CC_INCLUDEDOMAINMEMBERSHIP */
+	ccDfsShutdown();        /* stops referral refresh while servers are still alive */
+	ccDcerpcShutdown();     /* closes pooled pipes while servers are still alive */
 	ccSearchShutdown();
 	ccMountShutdown();
 	ccServerShutdown();
@@ -165,7 +167,6 @@ ccShutdown(
 	ccUtilsShutdown();
 	ccTransportShutdown();
 	ccFileShutdown();
-	ccDfsShutdown();
 	ccDfsCacheShutdown();
 #ifdef UD_CC_INCLUDEOLDBROWSERAPI
 	ccBrowseShutdown();
@@ -173,7 +174,6 @@ ccShutdown(
 	ccNetworkShutdown();
 	ccWriteShutdown();
 	ccReadShutdown();
-	ccDcerpcShutdown();
 	ccSdescrShutdown();
 	ccSrvsvcShutdown();
 	ccSmb10Shutdown();
@@ -55,6 +55,7 @@ typedef struct
     CCLsaLookupSidsNamesCallback nameConsumer;     /* callback for getting translated names */
     NQ_UINT32 numSids;      /* number of SIDs */
     NQ_BOOL success;        /* TRUE when name was found */
+    NQ_UINT16 sidType;      /* SID type of the found name */
     CCLsaPolicyInfoDomain *info;
     NQ_UINT32 status;       /* RPC operation status */
 }
@@ -259,7 +260,8 @@ Exit:
  *
  * RETURNS: NQ_SUCCESS or error code
  *
- * NOTES:
+ * NOTES:   names qualified by a domain are served from the SID cache
+ *          when possible and cached after LookupNames2
  *====================================================================
  */
 
@@ -271,11 +273,24 @@ NQ_STATUS ccLsaGetUserToken(
     )
 {
     CallbackParams params;      /* parameters for OpenPolicy2/Close */
+    CMSdDomainSid sid;          /* full user SID */
+    NQ_UINT16 type;             /* cached SID type */
     NQ_BOOL res;                /* operation result */
     NQ_STATUS result = NQ_FAIL; /* return value */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "handle:%p name:%s domain:%s token:%p", pipeHandle, cmWDump(name), cmWDump(domain), token);
 
+    /* recently resolved names, an unqualified name may resolve differently on each host */
+    if (NULL != domain && cmSdCacheFindName(name, domain, &sid, &type) && sid.numAuths > 0)
+    {
+        syMemcpy(&token->domain, &sid, sizeof(token->domain));
+        token->domain.numAuths--;
+        token->rids[0] = sid.subs[token->domain.numAuths];
+        token->numRids = 1;
+        result = NQ_SUCCESS;
+        goto Exit;
+    }
+
     /* pass parameters */
     params.user = name;
     params.domain = domain;
@@ -309,6 +324,12 @@ NQ_STATUS ccLsaGetUserToken(
     }
 
     result = (params.success ? NQ_SUCCESS : NQ_FAIL);
+    if (params.success && NULL != domain && token->domain.numAuths < sizeof(sid.subs) / sizeof(sid.subs[0]))
+    {
+        syMemcpy(&sid, &token->domain, sizeof(sid));
+        sid.subs[sid.numAuths++] = token->rids[0];
+        cmSdCacheAdd(&sid, name, domain, params.sidType);
+    }
 
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", result);
@@ -853,7 +874,7 @@ static NQ_STATUS lookupNamesResponseCallback(
         LOGERR(CM_TRC_LEVEL_ERROR, "unexpected RIDs response:%ld, should be 1", v32);
         goto Exit;
     }
-    cmRpcParseSkip(&desc, 2);               /* rids - SID type */
+    cmRpcParseUint16(&desc, &callParams->sidType);              /* rids - SID type */
     cmRpcAllign(&desc, 4);
     cmRpcParseUint32(&desc, &callParams->token->rids[0]);       /* rid */
     callParams->token->numRids = 1;                             /* meanwhile */
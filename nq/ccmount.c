@@ -26,6 +26,7 @@ static CMList mounts;
 
 #define MOUNTNTPATH_SIZE 64
 #define SHAREPATH_SIZE   CM_NQ_HOSTNAMESIZE + UD_FS_MAXSHARELEN + 3
+#define MOUNTS_INDEXSIZE 32     /* initial number of buckets in the mount index */
 
 /* -- Local functions -- */
 
@@ -160,6 +161,7 @@ NQ_BOOL ccMountStart(void)
 #if SY_DEBUGMODE
     mounts.name = "mounts";
 #endif
+    cmListIndexStart(&mounts, MOUNTS_INDEXSIZE, FALSE);
     return TRUE;
 }
 
@@ -26,6 +26,8 @@
 
 /* -- Definitions -- */
 
+#define MIN_ENTRY_SIZE (24 * sizeof(NQ_UINT32))    /* minimal size of a directory entry in response */
+
 /* -- Static data -- */
 static CMList localSearches;
 
@@ -425,7 +427,7 @@ static NQ_STATUS findNextFile(NQ_HANDLE handle, FindFileDataW_t * findFileData)
 
     do 
     {
-        if (cmBufferReaderGetRemaining(&pSearch->parser) < (24 * sizeof(NQ_UINT32)))
+        if (cmBufferReaderGetRemaining(&pSearch->parser) < MIN_ENTRY_SIZE)
         {
             NQ_INT          counter;                                                    
 
@@ -618,6 +620,42 @@ Exit:
     return res;
 }
 
+NQ_INT ccFindNextFilesA(NQ_HANDLE handle, FindFileDataA_t *findFileData, NQ_INT maxEntries)
+{
+    FindFileDataW_t * findFileDataW = NULL;  /* file entries in Unicode */
+    NQ_INT res = NQ_FAIL;                    /* number of entries */
+    NQ_INT i;                                /* entry index */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "handle:%p find:%p max:%d", handle, findFileData, maxEntries);
+
+    if (NULL == findFileData || maxEntries <= 0)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Invalid parameter");
+        sySetLastError(NQ_ERR_BADPARAM);
+        goto Exit;
+    }
+
+    findFileDataW = (FindFileDataW_t *)cmMemoryAllocate((NQ_UINT)maxEntries * (NQ_UINT)sizeof(*findFileDataW));
+    if (NULL == findFileDataW)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR , "Out of memory");
+        sySetLastError(NQ_ERR_OUTOFMEMORY);
+        goto Exit;
+    }
+
+    res = ccFindNextFilesW(handle, findFileDataW, maxEntries);
+    for (i = 0; i < res; i++)
+    {
+        syMemcpy(&findFileData[i], &findFileDataW[i], sizeof(*findFileData) - sizeof(findFileData->fileName));
+        cmUnicodeToAnsiN(findFileData[i].fileName, findFileDataW[i].fileName, sizeof(findFileData->fileName));
+    }
+
+Exit:
+    cmMemoryFree(findFileDataW);
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+    return res;
+}
+
 NQ_HANDLE ccFindFirstFileW(const NQ_WCHAR * srchPath, FindFileDataW_t * findFileData, NQ_BOOL extractFirst)
 {
     CCMount * pMount;              /* mount point descriptor */
@@ -866,6 +904,60 @@ Exit:
     return result;
 }
 
+NQ_INT ccFindNextFilesW(NQ_HANDLE handle, FindFileDataW_t * findFileData, NQ_INT maxEntries)
+{
+    CCSearch * pSearch = (CCSearch *)handle;    /* casted search handle */
+    NQ_STATUS status;                           /* SMB status */
+    NQ_INT result = 0;                          /* number of entries */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "handle:%p find:%p max:%d", handle, findFileData, maxEntries);
+
+    if (NULL == handle || !ccValidateSearchHandle(handle))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Invalid Handle");
+        sySetLastError(NQ_ERR_INVALIDHANDLE);
+        result = NQ_FAIL;
+        goto Exit;
+    }
+
+    if (NULL == findFileData || maxEntries <= 0)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Invalid parameter");
+        sySetLastError(NQ_ERR_BADPARAM);
+        result = NQ_FAIL;
+        goto Exit;
+    }
+
+    while (result < maxEntries)
+    {
+        /* once we have entries, do not wait for the network to complete the batch */
+        if (result > 0 && !pSearch->localFile && cmBufferReaderGetRemaining(&pSearch->parser) < MIN_ENTRY_SIZE)
+            break;
+
+        status = findNextFile(handle, &findFileData[result]);
+        if (NQ_SUCCESS != status)
+        {
+            if (result > 0)
+                break;
+            if (NQ_ERR_NOFILES == status)
+            {
+                sySetLastError(NQ_SUCCESS);
+            }
+            else
+            {
+                sySetLastError((NQ_UINT32)status);
+                result = NQ_FAIL;
+            }
+            goto Exit;
+        }
+        result++;
+    }
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", result);
+    return result;
+}
+
 NQ_BOOL ccFindClose(NQ_HANDLE handle)
 {
 	NQ_BOOL result = FALSE;
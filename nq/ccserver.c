@@ -25,14 +25,102 @@
 #include "ccfile.h"
 #include "ccsearch.h"
 #include "ccdummysmb.h"
+#if defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL)
+#include "ccsmb30.h"
+#endif /* defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL) */
 
 #ifdef UD_NQ_INCLUDECIFSCLIENT
 
+/* -- Constants -- */
+#define SERVERS_INDEXSIZE 32    /* initial number of buckets in server indexes */
+#define FILEIDS_INDEXSIZE 64    /* initial number of buckets in the per-server file ID index */
+
+/* -- Structures -- */
+
+/* server address in the address index */
+typedef struct
+{
+    CMItem item;                /* list item */
+    CCServer * server;          /* server having this address */
+    NQ_IPADDRESS ip;            /* one of server addresses */
+}
+ServerAddress;
+
 /* -- Static data -- */
 static CMList servers;
+static CMList addresses;        /* addresses of all servers indexed by IP */
 
 /* -- local functions -- */
 
+/* address index key */
+static NQ_UINT32 ipToKey(const NQ_IPADDRESS * ip)
+{
+#ifdef UD_NQ_USETRANSPORTIPV6
+    if (CM_IPADDR_VERSION(*ip) == CM_IPADDR_IPV6)
+        return cmListKeyFromBytes((const NQ_BYTE *)CM_IPADDR_GET6(*ip), sizeof(NQ_IPADDRESS6));
+#endif /* UD_NQ_USETRANSPORTIPV6 */
+    {
+        NQ_IPADDRESS4 ip4 = CM_IPADDR_GET4(*ip);
+
+        return cmListKeyFromBytes((const NQ_BYTE *)&ip4, sizeof(ip4));
+    }
+}
+
+/* match callback for looking up an address */
+static NQ_BOOL matchAddress(CMItem * pItem, const void * context)
+{
+    return CM_IPADDR_EQUAL(((ServerAddress *)pItem)->ip, *(const NQ_IPADDRESS *)context);
+}
+
+/* match callback for removing one server address */
+static NQ_BOOL matchServerAddress(CMItem * pItem, const void * context)
+{
+    const ServerAddress * pPattern = (const ServerAddress *)context;
+
+    return ((ServerAddress *)pItem)->server == pPattern->server && CM_IPADDR_EQUAL(((ServerAddress *)pItem)->ip, pPattern->ip);
+}
+
+/* add server addresses to the address index */
+static void indexAddresses(CCServer * pServer)
+{
+    NQ_COUNT i;
+
+    for (i = 0; i < pServer->numIps; i++)
+    {
+        ServerAddress * pAddress;
+
+        pAddress = (ServerAddress *)cmListItemCreate(sizeof(ServerAddress), NULL, CM_LISTITEM_EXCLUSIVE);
+        if (NULL == pAddress)
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+            break;
+        }
+        pAddress->server = pServer;
+        pAddress->ip = pServer->ips[i];
+        cmListItemSetKey((CMItem *)pAddress, ipToKey(&pAddress->ip));
+        if (!cmListItemAdd(&addresses, (CMItem *)pAddress, NULL))
+            cmListItemDispose((CMItem *)pAddress);
+    }
+}
+
+/* remove server addresses from the address index */
+static void unindexAddresses(CCServer * pServer)
+{
+    NQ_COUNT i;
+
+    for (i = 0; i < pServer->numIps; i++)
+    {
+        ServerAddress pattern;  /* address to remove */
+        CMItem * pItem;
+
+        pattern.server = pServer;
+        pattern.ip = pServer->ips[i];
+        pItem = cmListItemFindByKey(&addresses, ipToKey(&pattern.ip), matchServerAddress, &pattern, FALSE);
+        if (NULL != pItem)
+            cmListItemRemoveAndDispose(pItem);
+    }
+}
+
 /* 
  * Dump object 
  */
@@ -70,6 +158,7 @@ static void disposeServer(CCServer * pServer)
         cmListItemCheck(pMasterUser);
     }
 	cmListShutdown(&pServer->users);
+	cmListShutdown(&pServer->fileIds);
 	if (pServer->threads.first != NULL)
 	{
 		CMIterator	itr;
@@ -231,48 +320,41 @@ static NQ_BOOL unlockCallback(CMItem * pItem)
 /* Find existing server by one of it's IPs */
 static CCServer * findServerByIp(const NQ_IPADDRESS * ips, NQ_INT numIps, const CCCifsSmb *pDialect)
 {
-    CMIterator iterator;         /* server iterator */
     CCServer * pServer;          /* pointer to server */
     CCServer * pResult = NULL;   /* return value */
+    NQ_INT j;                    /* index in IP addresses */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "ips:%p numIps:%d dialect:%p", ips, numIps, pDialect);
-    cmListIteratorStart(&servers, &iterator);
-    while (cmListIteratorHasNext(&iterator))
+    syMutexTake(&addresses.guard);
+    for (j = 0; j < numIps; j++)
     {
-        NQ_UINT i;
-        NQ_INT j;     /* index in IP addresses */
+        ServerAddress * pAddress;
+
+        pAddress = (ServerAddress *)cmListItemFindByKey(&addresses, ipToKey(&ips[j]), matchAddress, &ips[j], FALSE);
+        if (NULL == pAddress)
+            continue;
 
-        pServer = (CCServer *)cmListIteratorNext(&iterator);
-        for (i = 0; i < pServer->numIps; i++)
+        pServer = pAddress->server;
+        if (((CMItem *)pServer)->findable)
         {
-            for (j = 0; j < numIps; j++)
-            {
-                if (CM_IPADDR_EQUAL(ips[j], pServer->ips[i]))
-                {
-                    cmListIteratorTerminate(&iterator);
-                    if (((CMItem *)pServer)->findable)
-                    {
-                    	if ((pDialect == NULL && pServer->isTemporary) || (pDialect != NULL && pDialect != pServer->smb))
-						{
-							LOGERR(CM_TRC_LEVEL_ERROR, "Invalid pDialect");
-							goto Exit;
-						}
-                        cmListItemLock((CMItem *)pServer);
-                        pResult = pServer;
-                        goto Exit;
-                    }
-                    else
-                    {
-                        LOGERR(CM_TRC_LEVEL_ERROR, "Not findable");
-                        goto Exit;
-                  	}
-                }
-            }
+        	if ((pDialect == NULL && pServer->isTemporary) || (pDialect != NULL && pDialect != pServer->smb))
+			{
+				LOGERR(CM_TRC_LEVEL_ERROR, "Invalid pDialect");
+				goto Exit;
+			}
+            cmListItemLock((CMItem *)pServer);
+            pResult = pServer;
+            goto Exit;
         }
+        else
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Not findable");
+            goto Exit;
+      	}
     }
-    cmListIteratorTerminate(&iterator);
 
 Exit:
+    syMutexGive(&addresses.guard);
 	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", pResult);
     return pResult;
 }
@@ -318,9 +400,12 @@ static CCServer * createNewServer(const NQ_WCHAR * host, NQ_BOOL extendedSecurit
 	cmListStart(&pServer->async);
 	cmListStart(&pServer->expectedResponses);
     cmListStart(&pServer->waitingNotifyResponses);
+    cmListStart(&pServer->fileIds);
+    cmListIndexStart(&pServer->fileIds, FILEIDS_INDEXSIZE, TRUE);
     ccTransportInit(&pServer->transport);
 	pServer->ips = ips;
 	pServer->numIps = (NQ_COUNT)numIps;
+    indexAddresses(pServer);
     pServer->smbContext = NULL;
     pServer->firstSecurityBlob.data = NULL;
     pServer->useSigning = FALSE;
@@ -348,9 +433,19 @@ static CCServer * createNewServer(const NQ_WCHAR * host, NQ_BOOL extendedSecurit
 #ifdef UD_NQ_INCLUDESMB311
     pServer->isPreauthIntegOn = FALSE;
 #endif /* UD_NQ_INCLUDESMB311 */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    pServer->compressionAlgorithm = SMB2_COMPRESSION_NONE;
+    pServer->compressionChained = FALSE;
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 #ifdef UD_NQ_INCLUDESMBCAPTURE
     syMemset(&pServer->captureHdr , 0 , sizeof(CMCaptureHeader));
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    syMemset(pServer->channels, 0, sizeof(pServer->channels));
+    pServer->numChannels = 0;
+    pServer->nextChannel = 0;
+    pServer->channelsQueried = FALSE;
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
     pServer->creditGuard = (SYMutex *)cmMemoryAllocate(sizeof(*pServer->creditGuard));
    	syMutexCreate(pServer->creditGuard);
 
@@ -394,9 +489,13 @@ Exit:
 NQ_BOOL ccServerStart(void)
 {
 	cmListStart(&servers);
+	cmListStart(&addresses);
 #if SY_DEBUGMODE
     servers.name = "servers";
+    addresses.name = "server addresses";
 #endif
+	cmListIndexStart(&servers, SERVERS_INDEXSIZE, FALSE);
+	cmListIndexStart(&addresses, SERVERS_INDEXSIZE, TRUE);
 	return TRUE;
 }
 
@@ -481,6 +580,7 @@ void ccServerShutdown(void)
     }
     cmListIteratorTerminate(&serverItr);
 	cmListShutdown(&servers);
+	cmListShutdown(&addresses);
 }
 
 void ccServerDisconnectAll(void)
@@ -565,6 +665,9 @@ void ccServerDisconnect(CCServer * pServer)
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p", pServer);
     
     syMutexTake(&servers.guard);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    ccServerDropChannels(pServer);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
     pServer->transport.connected = TRUE;
 	if (NULL != pServer->transport.callback)
 		ccTransportDisconnect(&pServer->transport);
@@ -573,6 +676,7 @@ void ccServerDisconnect(CCServer * pServer)
 	cmMemoryFreeBlob(&pServer->firstSecurityBlob);
 	if (NULL != pServer->ips)
 	{
+		unindexAddresses(pServer);
 		cmMemoryFree(pServer->ips);
 		pServer->ips = NULL;
 		pServer->numIps = 0;
@@ -741,6 +845,7 @@ NQ_BOOL ccServerConnect(CCServer * pServer, const NQ_WCHAR * name)
 	const NQ_IPADDRESS * ips;	/* array of all server IPs */
 	NQ_INT numIps;		        /* number of resolved IPs */
 	const NQ_WCHAR * host;	    /* host name */
+	NQ_WCHAR * oldName;	        /* name the server was listed by */
 	NQ_BOOL result = FALSE;     /* return value */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p name:%s", pServer, cmWDump(name));
@@ -777,14 +882,23 @@ NQ_BOOL ccServerConnect(CCServer * pServer, const NQ_WCHAR * name)
    	pServer->ips = ips;
    	pServer->numIps = (NQ_COUNT)numIps;
    	pServer->calledName = NULL;
-    pServer->item.name = (NQ_WCHAR *)host;
+    /* re-index the server under its new name so that lookups by the old one miss */
+    oldName = pServer->item.name;
+    cmListItemSetName((CMItem *)pServer, (NQ_WCHAR *)host);
+    indexAddresses(pServer);
     /* connect to server */
     if (!connectServer(pServer, TRUE))
 	{
+        unindexAddresses(pServer);
+        cmListItemSetName((CMItem *)pServer, oldName);
 		cmMemoryFree(host);
         cmMemoryFree(pServer->ips);
+        pServer->ips = NULL;
+        pServer->numIps = 0;
 		goto Exit;
 	}
+	if (NULL != oldName)
+		cmMemoryFree(oldName);
 	result = TRUE;
 
 Exit:
@@ -797,6 +911,9 @@ NQ_BOOL ccServerReconnect(CCServer * pServer)
 {
 	CMIterator userIterator;		/* to enumerate users */
     NQ_BOOL result = FALSE;         /* operation result */
+#if defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL)
+    NQ_BOOL addChannels = FALSE;    /* whether to add channels after the server is released */
+#endif /* defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL) */
 	
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p", pServer);
 	
@@ -826,6 +943,9 @@ NQ_BOOL ccServerReconnect(CCServer * pServer)
 /*  cmListItemGive((CMItem *)pServer); */ /* To free other threads that should exit */
 /*	cmListItemTake((CMItem *)pServer); */
     pServer->smb->signalAllMatch(&pServer->transport);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    ccServerDropChannels(pServer);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
     pServer->transport.connected = TRUE;
     ccTransportDisconnect(&pServer->transport);
     pServer->smb->freeContext(pServer->smbContext, pServer);
@@ -935,10 +1055,17 @@ NQ_BOOL ccServerReconnect(CCServer * pServer)
 	if (result)
 	{
 		pServer->isReconnecting = FALSE;
+#if defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL)
+		addChannels = TRUE;
+#endif /* defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL) */
 	}
 
 Exit:
     cmListItemGive((CMItem *)pServer);
+#if defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL)
+    if (addChannels)
+        ccSmb30AddChannels(pServer);    /* exchanges with the server, must not hold it */
+#endif /* defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL) */
 	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
 	return result;
 }
@@ -1081,6 +1208,71 @@ void ccServerPostCredits(CCServer * pServer, NQ_COUNT credits)
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
 
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+
+NQ_BOOL ccServerTakeChannelCredits(CCServer * pServer, CCChannel * pChannel, NQ_COUNT credits)
+{
+    NQ_BOOL res = FALSE;    /* operation result */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL, "pServer:%p channel:%p credits:%d - %d", pServer, pChannel, pChannel->credits, credits);
+
+    syMutexTake(pServer->creditGuard);
+    if (pChannel->credits - (NQ_INT)credits > 0)
+    {
+        pChannel->credits -= (NQ_INT)credits;
+        res = TRUE;
+    }
+    syMutexGive(pServer->creditGuard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL, "%s credits: %d", res ? "TRUE" : "FALSE", pChannel->credits);
+    return res;
+}
+
+void ccServerPostChannelCredits(CCServer * pServer, CCChannel * pChannel, NQ_COUNT credits)
+{
+    LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL, "pServer:%p channel:%p credits:%d + %d", pServer, pChannel, pChannel->credits, credits);
+
+    syMutexTake(pServer->creditGuard);
+    pChannel->credits += (NQ_INT)credits;
+    syMutexGive(pServer->creditGuard);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+}
+
+void ccServerDropChannels(CCServer * pServer)
+{
+    CMIterator userIterator;    /* to enumerate users */
+    NQ_COUNT i;                 /* channel index */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p channels:%d", pServer, pServer->numChannels);
+
+    for (i = 0; i < pServer->numChannels; i++)
+    {
+        CCChannel * pChannel = &pServer->channels[i];
+
+        pChannel->isActive = FALSE;
+        if (NULL != pChannel->transport.item.guard)
+        {
+            pChannel->transport.connected = TRUE;
+            ccTransportDisconnect(&pChannel->transport);
+        }
+    }
+    pServer->numChannels = 0;
+    pServer->nextChannel = 0;
+    pServer->channelsQueried = FALSE;
+
+    cmListIteratorStart(&pServer->users, &userIterator);
+    while (cmListIteratorHasNext(&userIterator))
+    {
+        ccUserUnbindChannels((CCUser *)cmListIteratorNext(&userIterator));
+    }
+    cmListIteratorTerminate(&userIterator);
+
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
 #if SY_DEBUGMODE
 
 void ccServerDump(void)
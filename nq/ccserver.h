@@ -31,6 +31,27 @@
 #define CC_CAP_INFOPASSTHRU     4   /* Set when server supports passthrough information levels. */
 #define CC_CAP_LARGEMTU         8   /* Set when server supports multi-credit operations. */
 
+
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+/* Description
+   This structure describes an additional SMB3 channel bound to the sessions of a server.
+
+   Sequence windows and credits are per connection so each channel keeps its own message ID
+   and credit count. The transport is the first member so that a transport pointer passed
+   to transport callbacks can be converted to its channel. */
+typedef struct _ccchannel
+{
+	CCTransport transport;		/* Transport object. Must be first. */
+	NQ_IPADDRESS ip;			/* Server interface this channel is connected to. */
+	NQ_UINT64 mid;				/* Next message ID on this channel. */
+	NQ_INT credits;				/* Number of outstanding requests granted on this channel. */
+	NQ_BOOL isActive;			/* TRUE when the channel is bound and may carry requests. */
+#ifdef UD_NQ_INCLUDESMB311
+	NQ_BYTE preauthIntegHashVal[SMB3_PREAUTH_INTEG_HASH_LENGTH]; /* hash of this channel negotiate and binding */
+#endif /* UD_NQ_INCLUDESMB311 */
+}
+CCChannel; /* Additional SMB3 channel. */
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 	
 /* Description
    This structure describes a remote server.
@@ -73,6 +94,7 @@ typedef struct _ccserver
                                    all outstanding contexts, so that on server release it will release lost ones. */
     CMList expectedResponses;   /* List of async matches , used to free them when connection is broken etc. */
 	CMList waitingNotifyResponses; /* save notify responses if file ID wasn't found. try again for new created files */
+	CMList fileIds;             /* Open files of all users and shares indexed by file ID. */
     CMItem * masterUser;        /* Master user pointer - the one that will be used for signing (SMB1 only). */  
     NQ_BOOL useName;            /* TRUE when you should use the server name to connect*/
     NQ_BOOL isReconnecting;     /* TRUE if server is already reconnecting , used to stop recursion on reconnect*/
@@ -98,6 +120,16 @@ typedef struct _ccserver
 	NQ_BOOL isPreauthIntegOn;	/* is pre-authentication integrity validation on*/
 	NQ_BYTE preauthIntegHashVal[SMB3_PREAUTH_INTEG_HASH_LENGTH]; /* array to hold hash results of negotiate packets */
 #endif /* UD_NQ_INCLUDESMB311 */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    NQ_UINT16 compressionAlgorithm; /* negotiated compression algorithm or SMB2_COMPRESSION_NONE */
+    NQ_BOOL compressionChained; /* server supports chained compression */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    CCChannel channels[UD_CC_MAXCHANNELS]; /* additional channels bound to the sessions of this server */
+    NQ_COUNT numChannels;       /* number of channels opened in the array above */
+    NQ_COUNT nextChannel;       /* round robin position for spreading reads and writes */
+    NQ_BOOL channelsQueried;    /* TRUE when server interfaces were already queried on this connection */
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #ifdef UD_NQ_INCLUDESMBCAPTURE
     CMCaptureHeader captureHdr; /* structure for internal capture */
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
@@ -243,6 +275,38 @@ NQ_BOOL ccServerWaitForCredits(CCServer * server, NQ_COUNT credits);
    None. */
 void ccServerPostCredits(CCServer * server, NQ_COUNT credits);
 
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+/* Description
+   Take credits on an additional channel without waiting.
+
+   At least one credit is always left on the channel so that the server can keep granting.
+   Parameters
+   server : Server pointer.
+   channel : Channel pointer.
+   credits : Number of credits to take.
+   Returns
+   TRUE if the credits were taken, FALSE when the channel does not have enough credits. */
+NQ_BOOL ccServerTakeChannelCredits(CCServer * server, CCChannel * channel, NQ_COUNT credits);
+
+/* Description
+   Return credits granted on an additional channel.
+   Parameters
+   server : Server pointer.
+   channel : Channel pointer.
+   credits : Number of credits granted.
+   Returns
+   None. */
+void ccServerPostChannelCredits(CCServer * server, CCChannel * channel, NQ_COUNT credits);
+
+/* Description
+   Disconnect all additional channels of a server and unbind its users from them.
+   Parameters
+   server : Server pointer.
+   Returns
+   None. */
+void ccServerDropChannels(CCServer * server);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
 
 
 #ifdef SY_DEBUGMODE
@@ -19,6 +19,9 @@
 #include "ccutils.h"
 #include "ccdfs.h"
 #include "ccmount.h"
+#if defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL)
+#include "ccsmb30.h"
+#endif /* defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL) */
 
 #ifdef UD_NQ_INCLUDECIFSCLIENT
 
@@ -286,6 +289,9 @@ CCShare * ccShareConnect(const NQ_WCHAR * path, void *pMount, const AMCredential
                 if (pShare->connected)
                 {
                     cmListItemGive((CMItem *)pServer);
+#if defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL)
+                    ccSmb30AddChannels(pServer);  /* the interface query needs a session */
+#endif /* defined(UD_NQ_INCLUDESMB3) && defined(UD_CC_INCLUDEMULTICHANNEL) */
                     break;
                 }
             }
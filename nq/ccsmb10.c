@@ -191,6 +191,7 @@ static void readCallback(CCServer * pServer, Match * pContext);
 
 static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch, NQ_BOOL (*callback)(CMItem * pItem));
 static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequest, Response * pResponse);
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch);
 static void anyResponseCallback(void * transport);
 
 static NQ_STATUS composeCreateFileRequest(Request * request, CCFile * pFile);
@@ -251,6 +252,7 @@ static const CCCifsSmb dialect =
         (NQ_STATUS (*)(void *))doEcho,
         (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch, NQ_BOOL (*callback)(CMItem * pItem)))sendRequest,
         (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pResponse))sendReceive,
+        (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch))receiveResponse,
         anyResponseCallback,
         keyDerivation,
         signalAllMatches,
@@ -901,8 +903,6 @@ static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequ
 	NQ_STATUS res = NQ_ERR_OUTOFMEMORY; /* send result */
     CMThread * pThread;                 /* current thread */
     Match * pMatch;                     /* match structure pointer */
-    NQ_BOOL statusNT;                   /* TRUE if status is NT , FALSE if it isn't*/
-    CCUser * pMasterUser;               /* master (first) logged in user */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p user:%p request:%p", pServer, pUser, pRequest, pResponse);
 
@@ -936,6 +936,23 @@ static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequ
         goto Exit;
 	}
 
+	res = receiveResponse(pServer, pUser, pRequest, pMatch);
+
+Exit:
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+	return res;
+}
+
+/* wait for the response to a request that was sent and check it */
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch)
+{
+    Response * pResponse = pMatch->response;   /* response descriptor */
+    NQ_BOOL statusNT;                   /* TRUE if status is NT , FALSE if it isn't*/
+    CCUser * pMasterUser;               /* master (first) logged in user */
+    NQ_STATUS res;                      /* operation result */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p user:%p request:%p match:%p", pServer, pUser, pRequest, pMatch);
+
 	if (!cmThreadCondWait(pMatch->cond, ccConfigGetTimeout()))
 	{
 		pServer->smb->signalAllMatch(&pServer->transport);
@@ -32,6 +32,7 @@
 #include "cmbufman.h"
 #include "cmcrypt.h"
 #include "cmsdescr.h"
+#include "cmcompress.h"
 #include "ccsmb30.h"
 #ifdef UD_NQ_INCLUDESMB311
 #include "ccsmb311.h"
@@ -60,6 +61,7 @@ static NQ_STATUS doQueryDfsReferrals(CCShare * share, const NQ_WCHAR * path, CCC
 static NQ_STATUS doFindOpen(CCSearch * pSearch);
 static NQ_STATUS doFindMore(CCSearch * pSearch);
 static NQ_STATUS doFindClose(CCSearch * pSearch);
+static void disposeFindPrefetch(SearchMatch * pMatch);
 static NQ_STATUS doWrite(CCFile * pFile, const NQ_BYTE * data, NQ_UINT bytesToWrite, CCCifsWriteCallback callback, void * context, void *hook);
 static NQ_STATUS doRead(CCFile * pFile, const NQ_BYTE * data, NQ_UINT bytesToRead, CCCifsReadCallback callback, void * context, void *hook);
 #ifdef UD_CC_INCLUDESECURITYDESCRIPTORS	
@@ -89,6 +91,7 @@ static void readCallback(CCServer * pServer, Match * pContext);
 
 static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch, NQ_BOOL (*callback)(CMItem * pItem));
 static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequest, Response * pResponse);
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch);
 static void anyResponseCallback(void * transport);
 
 static void fileInfoResponseParser(CMBufferReader * pReader, CCFileInfo * pInfo, NQ_BYTE level);
@@ -101,6 +104,7 @@ static NQ_STATUS smb311ReadNegotiateContexts(CMBufferReader *reader, CCServer *p
 /* -- Static data */
 
 static const NQ_WCHAR rpcPrefix[] = { 0 };  /* value to prefix RPC pipe names */
+static CMList abandonedFinds;				/* prefetched requests still owned by the receive thread */
 
 static const CCCifsSmb dialect = 
 { 
@@ -145,6 +149,7 @@ static const CCCifsSmb dialect =
         (NQ_STATUS (*)(void *))doEcho,
         (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch, NQ_BOOL (*callback)(CMItem * pItem)))sendRequest,
 		(NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pResponse))sendReceive,
+		(NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch))receiveResponse,
 		anyResponseCallback,
 		keyDerivation,
 		signalAllMatches,
@@ -187,11 +192,27 @@ static const Command commandDescriptors[] = /* SMB2 descriptor */
 
 NQ_BOOL ccSmb20Start()
 {
+	cmListStart(&abandonedFinds);
+#if SY_DEBUGMODE
+	abandonedFinds.name = "abandonedFinds";
+#endif
 	return TRUE;
 }
 
 NQ_BOOL ccSmb20Shutdown()
 {
+	CMIterator iterator;	/* abandoned requests iterator */
+
+	cmListIteratorStart(&abandonedFinds, &iterator);
+	while (cmListIteratorHasNext(&iterator))
+	{
+		SearchMatch * pMatch = (SearchMatch *)cmListIteratorNext(&iterator);
+
+		cmListItemRemove((CMItem *)pMatch);
+		disposeFindPrefetch(pMatch);
+	}
+	cmListIteratorTerminate(&iterator);
+	cmListShutdown(&abandonedFinds);
 	return TRUE;
 }
 
@@ -419,6 +440,7 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
     cmBufferWriteUint64(&writer, &pContext->mid);
     
     /* add match to list only after mid was set */
+    pMatch->transport = &pServer->transport;
     cmListItemAdd(&pServer->expectedResponses, (CMItem *)pMatch, callback);
 
     /* prepare MID for next request */
@@ -532,6 +554,21 @@ static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequ
 		goto Exit;
 	}
 	
+	res = receiveResponse(pServer, pUser, pRequest, pMatch);
+
+Exit:
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+	return res;
+}
+
+/* wait for the response to a request that was sent and check it */
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch)
+{
+	Response * pResponse = pMatch->response;	/* response descriptor */
+	NQ_STATUS res;				/* operation result */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p user:%p request:%p match:%p", pServer, pUser, pRequest, pMatch);
+
     if (!cmThreadCondWait(pMatch->cond, ccConfigGetTimeout()))
 	{
     	pServer->smb->signalAllMatch(&pServer->transport);
@@ -1202,6 +1239,10 @@ static NQ_STATUS doNegotiate(CCServer * pServer, CMBlob * inBlob)
 #ifdef UD_NQ_INCLUDESMB311
 	NQ_UINT contextOffset = 0;  /* offset in bytes */
 #endif /* UD_NQ_INCLUDESMB311 */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    const NQ_UINT16 * algorithms; /* supported compression algorithms */
+    NQ_COUNT numAlgorithms;     /* number of those algorithms */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p inBlob:%p", pServer, inBlob);
 
@@ -1235,6 +1276,9 @@ static NQ_STATUS doNegotiate(CCServer * pServer, CMBlob * inBlob)
 	cmBufferWriteUint16(&request.writer, 0);	/* reserved */
 #ifdef UD_NQ_INCLUDESMB3
     capabilities |= (SMB2_CAPABILITY_ENCRYPTION | SMB2_CAPABILITY_LARGE_MTU);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    capabilities |= SMB2_CAPABILITY_MULTI_CHANNEL;
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #endif /* UD_NQ_INCLUDESMB3 */
     cmBufferWriteUint32(&request.writer, capabilities);	            	/* capabilities */
 	cmBufferWriteUint32(&request.writer, pServer->clientGuidPartial);	/* client GUID */
@@ -1246,7 +1290,11 @@ static NQ_STATUS doNegotiate(CCServer * pServer, CMBlob * inBlob)
 	contextOffset += (NQ_UINT)(actualDialects * 2) + 4 + 2 + 2; /* 2 bytes per dialect + offset (32) + count (2) + reserved (2)*/
 	contextOffset += contextOffset % 8? 8 - contextOffset % 8 : 0;
 	cmBufferWriteUint32(&request.writer, contextOffset);	/* context offset in bytes */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	cmBufferWriteUint16(&request.writer, 3);	/* context count - how many */
+#else
 	cmBufferWriteUint16(&request.writer, 2);	/* context count - how many */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 	cmBufferWriteUint16(&request.writer, 0);	/* reserved */
 #else
 	cmBufferWriteUint32(&request.writer, 0);	/* client start time */
@@ -1292,6 +1340,24 @@ static NQ_STATUS doNegotiate(CCServer * pServer, CMBlob * inBlob)
 	cmBufferWriteUint16(&request.writer, CIPHER_AES128GCM);                	/* optional cipher */
 	cmBufferWriteUint16(&request.writer, CIPHER_AES128CCM);                	/* optional cipher */
 
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	cmBufferWriterAlign(&request.writer, request.header._start, 8); 				/* 8 byte alignment */
+
+	/* context 3 - compression algorithms */
+	/**************************************/
+	numAlgorithms = cmCompressionGetAlgorithms(&algorithms);
+	cmBufferWriteUint16(&request.writer, SMB2_COMPRESSION_CAPABILITIES);    /* context type */
+	cmBufferWriteUint16(&request.writer, (NQ_UINT16)(8 + 2 * numAlgorithms)); /* data length - count, padding, flags and algorithms */
+	cmBufferWriteUint32(&request.writer, 0);                                /* reserved(4) */
+	cmBufferWriteUint16(&request.writer, (NQ_UINT16)numAlgorithms);         /* algorithm count */
+	cmBufferWriteUint16(&request.writer, 0);                                /* padding */
+	cmBufferWriteUint32(&request.writer, SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED); /* flags */
+	for (i = 0; i < numAlgorithms; i++)
+		cmBufferWriteUint16(&request.writer, algorithms[i]);                /* algorithms in the order of preference */
+	pServer->compressionAlgorithm = SMB2_COMPRESSION_NONE;
+	pServer->compressionChained = FALSE;
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+
 #endif /* UD_NQ_INCLUDESMB311 */
 
 	packetLen = cmBufferWriterGetDataCount(&request.writer) - 4;			/* NBT header */
@@ -2445,6 +2511,9 @@ static NQ_STATUS doFindOpen(CCSearch * pSearch)
 		res = NQ_ERR_OUTOFMEMORY;
 		goto Exit;
 	}
+	pContext->prefetch = NULL;
+	pContext->noMoreFiles = FALSE;
+	pContext->lostStatus = NQ_SUCCESS;
 	pSearch->context = pContext;
 	if (ccUtilsFilePathHasWildcards(pSearch->item.name))
 	{
@@ -2530,17 +2599,246 @@ Exit:
 	return res;
 }
 
-static NQ_STATUS doFindMore(CCSearch * pSearch)
+static NQ_BOOL writeFindRequest(Request * pRequest, CCSearch * pSearch, NQ_WCHAR * pattern, NQ_BOOL restart)
 {
-	Request request;			/* request descriptor */
-	Response response;			/* response descriptor */
-	SearchContext * pContext;	/* casted pointer */
-	NQ_WCHAR * pattern = NULL;  /* search pattern */
+	SearchContext * pContext = (SearchContext *)pSearch->context;	/* casted pointer */
+	NQ_UINT32 outputLen = pSearch->server->maxTrans;	/* output buffer length as negotiated */
 	NQ_BYTE * pNameOffset;	/* pointer to the name offset field */
 	NQ_UINT16 nameOffset;	/* name offset */
 	NQ_BYTE * pTemp;		/* temporary pointer in th writer */
 	NQ_UINT16 nameLen;		/* name length in bytes (not including terminator) */
+
+	if (!prepareSingleRequestByShare(pRequest, pSearch->share, SMB2_CMD_QUERYDIRECTORY, outputLen))
+	{
+		return FALSE;
+	}
+
+	/* compose request */
+	writeHeader(pRequest);
+	cmBufferWriteByte(&pRequest->writer, SMB2_FILEINFO_BOTHDIRECTORY);	/* info class */
+	cmBufferWriteByte(&pRequest->writer, restart? 1 : 0); 				/* flags - restart */
+	cmBufferWriteUint32(&pRequest->writer, 0);							/* file index */
+	cmBufferWriteBytes(&pRequest->writer, pContext->fid, sizeof(pContext->fid)); /* file ID */
+	pNameOffset = cmBufferWriterGetPosition(&pRequest->writer);
+	cmBufferWriterSkip(&pRequest->writer, sizeof(NQ_UINT16));		/* name offset */
+	nameLen = (NQ_UINT16)(sizeof(NQ_WCHAR) * cmWStrlen(pattern)); 
+	cmBufferWriteUint16(&pRequest->writer, nameLen);				/* name length */
+	cmBufferWriteUint32(&pRequest->writer, outputLen);				/* output buffer length */
+	if (0 == nameLen)
+	{
+		nameOffset = 0;
+	}
+	else
+	{
+		nameOffset = (NQ_UINT16)cmSmb2HeaderGetWriterOffset(&pRequest->header, &pRequest->writer);
+	}
+	pTemp = cmBufferWriterGetPosition(&pRequest->writer);
+	cmBufferWriterSetPosition(&pRequest->writer, pNameOffset);
+	cmBufferWriteUint16(&pRequest->writer, nameOffset);			/* name offset */
+	cmBufferWriterSetPosition(&pRequest->writer, pTemp);
+	pRequest->tail.data = (NQ_BYTE *)pattern;
+	pRequest->tail.len = nameLen; 
+	return TRUE;
+}
+
+static void setFindBuffer(CCSearch * pSearch, Response * pResponse)
+{
 	NQ_UINT32 outputLen;	/* output buffer length */
+
+	cmBufferReaderSkip(&pResponse->reader, sizeof(NQ_UINT16));	/* output buffer offset */
+	cmBufferReadUint32(&pResponse->reader, &outputLen);			/* output buffer length */
+	cmBufferReaderInit(
+		&pSearch->parser,
+		cmBufferReaderGetPosition(&pResponse->reader),
+		(NQ_COUNT)outputLen
+		);
+	
+	pSearch->buffer = pResponse->buffer;		/* to be released later */
+}
+
+/*
+ * Dispose a prefetched request together with a response buffer that was not 
+ * consumed 
+ */
+static void disposeFindPrefetch(SearchMatch * pMatch)
+{
+	cmBufManGive(pMatch->response.buffer);
+	cmThreadCondRelease(&pMatch->cond);
+	cmMemoryFree(pMatch);
+}
+
+/*
+ * Dispose those abandoned prefetched requests that the receive thread has 
+ * finished with meanwhile 
+ */
+static void reapFindPrefetches(void)
+{
+	CMIterator iterator;	/* abandoned requests iterator */
+
+	cmListIteratorStart(&abandonedFinds, &iterator);
+	while (cmListIteratorHasNext(&iterator))
+	{
+		SearchMatch * pMatch = (SearchMatch *)cmListIteratorNext(&iterator);
+
+		if (cmThreadCondWait(&pMatch->cond, 0))
+		{
+			cmListItemRemove((CMItem *)pMatch);
+			disposeFindPrefetch(pMatch);
+		}
+	}
+	cmListIteratorTerminate(&iterator);
+}
+
+/*
+ * Release a prefetched request. When it is still expected, it is removed from 
+ * the list of expected responses and a late response will not be matched. The 
+ * receive thread fills a matched response while holding the transport lock but 
+ * signals the match only after releasing it, so a match that was not expected 
+ * any more is disposed only after its signal was consumed. A match that is not 
+ * signalled in time is parked and disposed later 
+ */
+static void releaseFindPrefetch(CCServer * pServer, SearchMatch * pMatch)
+{
+	NQ_BOOL isExpected;		/* the match is still in the list */
+
+	reapFindPrefetches();
+
+	cmListItemTake(&pServer->item);
+	ccTransportLock(pMatch->match.transport);
+	isExpected = NULL != pMatch->match.item.master;
+	if (isExpected)
+		cmListItemRemove((CMItem *)pMatch);
+	ccTransportUnlock(pMatch->match.transport);
+	cmListItemGive(&pServer->item);
+
+	if (!isExpected && !pMatch->isSignalled && !cmThreadCondWait(&pMatch->cond, ccConfigGetTimeout()))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Prefetched response is still being received, parking its context");
+		cmListItemAdd(&abandonedFinds, (CMItem *)pMatch, NULL);
+		return;
+	}
+	disposeFindPrefetch(pMatch);
+}
+
+/*
+ * Send next QUERY_DIRECTORY without waiting for the response. The response 
+ * is received into the search context and collected by the next doFindMore() 
+ */
+static void startFindPrefetch(CCSearch * pSearch, NQ_WCHAR * pattern)
+{
+	SearchContext * pContext = (SearchContext *)pSearch->context;	/* casted pointer */
+	Request request;			/* request descriptor */
+	SearchMatch * pMatch;		/* expected response */
+	NQ_STATUS res;				/* send result */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "search:%p", pSearch);
+
+	request.buffer = NULL;
+
+	/* this match is never disposed by the list, we release it ourselves */
+	pMatch = (SearchMatch *)cmMemoryAllocate(sizeof(SearchMatch));
+	if (NULL == pMatch)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		goto Exit;
+	}
+	syMemset(pMatch, 0, sizeof(SearchMatch));
+	pMatch->match.item.isStatic = TRUE;
+	if (!cmThreadCondSet(&pMatch->cond))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Failed to create condition");
+		cmMemoryFree(pMatch);
+		goto Exit;
+	}
+	pMatch->match.thread = cmThreadGetCurrent();
+	if (NULL == pMatch->match.thread)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, ">>>No thread object.");
+		goto Error;
+	}
+	pMatch->match.response = &pMatch->response;
+	pMatch->match.transport = &pSearch->server->transport;
+	pMatch->match.cond = &pMatch->cond;
+	pMatch->match.server = pSearch->server;
+	pMatch->match.userId = pSearch->share->user->uid;
+	pMatch->match.isResponseAllocated = FALSE;
+	pMatch->match.matchExtraInfo = MATCHINFO_NONE;
+
+	if (!writeFindRequest(&request, pSearch, pattern, FALSE))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		goto Error;
+	}
+	res = pSearch->server->smb->sendRequest(pSearch->server, pSearch->share->user, &request, &pMatch->match, NULL);
+	if (NQ_SUCCESS != res)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Failed to send prefetch request: %d", res);
+		goto Error;
+	}
+	/* the response is checked against the request descriptor, its buffers are gone by then */
+	pMatch->request = request;
+	pMatch->request.buffer = NULL;
+	pMatch->request.tail.data = NULL;
+	pContext->prefetch = pMatch;
+	goto Exit;
+
+Error:
+	/* a request that was not queued cannot be matched */
+	if (NULL != pMatch->match.item.master)
+	{
+		releaseFindPrefetch(pSearch->server, pMatch);
+	}
+	else
+	{
+		cmThreadCondRelease(&pMatch->cond);
+		cmMemoryFree(pMatch);
+	}
+
+Exit:
+	cmBufManGive(request.buffer);
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+/*
+ * Wait for the prefetched response and install it as the current buffer. The 
+ * response is checked by the dialect the same way as a synchronous one. When 
+ * no valid response arrived, the entries the server returned for the request 
+ * are lost and the search fails rather than skipping them 
+ */
+static NQ_STATUS collectFindPrefetch(CCSearch * pSearch)
+{
+	SearchContext * pContext = (SearchContext *)pSearch->context;	/* casted pointer */
+	SearchMatch * pMatch = pContext->prefetch;	/* expected response */
+	CCServer * pServer = pSearch->server;		/* server pointer */
+	NQ_STATUS res;								/* exchange result */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "search:%p", pSearch);
+
+	pContext->prefetch = NULL;
+	res = pServer->smb->receiveResponse(pServer, pSearch->share->user, &pMatch->request, &pMatch->match);
+	pMatch->isSignalled = NQ_ERR_TIMEOUT != res && NQ_ERR_NOTCONNECTED != res;
+	if (NQ_SUCCESS == res)
+	{
+		setFindBuffer(pSearch, &pMatch->response);
+		pMatch->response.buffer = NULL;	/* now owned by the search */
+	}
+	else if (!pMatch->isSignalled || !pMatch->response.wasReceived || NQ_ERR_SIGNATUREFAIL == res)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Prefetched response lost: %d", res);
+		pContext->lostStatus = res;
+	}
+
+	releaseFindPrefetch(pServer, pMatch);
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+	return res;
+}
+
+static NQ_STATUS doFindMore(CCSearch * pSearch)
+{
+	Request request;			/* request descriptor */
+	Response response;			/* response descriptor */
+	SearchContext * pContext;	/* casted pointer */
+	NQ_WCHAR * pattern = NULL;  /* search pattern */
 	NQ_STATUS res;			/* exchange result */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "search:%p", pSearch);
@@ -2568,56 +2866,53 @@ static NQ_STATUS doFindMore(CCSearch * pSearch)
 		res = NQ_ERR_OUTOFMEMORY;
 		goto Exit;
 	}
-    if (!prepareSingleRequestByShare(&request, pSearch->share, SMB2_CMD_QUERYDIRECTORY, 65536))
+
+	if (pContext->noMoreFiles)
 	{
-		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
-		res = NQ_ERR_OUTOFMEMORY;
+		/* the server already reported the end of the search */
+		res = NQ_ERR_NOFILES;
 		goto Exit;
 	}
-	
-	/* compose request */
-	writeHeader(&request);
-	cmBufferWriteByte(&request.writer, SMB2_FILEINFO_BOTHDIRECTORY);	/* info class */
-	cmBufferWriteByte(&request.writer, pSearch->isFirst? 1 : 0); 		/* flags - restart */
-	cmBufferWriteUint32(&request.writer, 0);							/* file index */
-	cmBufferWriteBytes(&request.writer, pContext->fid, sizeof(pContext->fid)); /* file ID */
-	pNameOffset = cmBufferWriterGetPosition(&request.writer);
-	cmBufferWriterSkip(&request.writer, sizeof(NQ_UINT16));		/* name offset */
-	nameLen = (NQ_UINT16)(sizeof(NQ_WCHAR) * cmWStrlen(pattern)); 
-	cmBufferWriteUint16(&request.writer, nameLen);				/* name length */
-	cmBufferWriteUint32(&request.writer, 65536);				/* outout buffer length */
-	if (0 == nameLen)
+
+	if (NQ_SUCCESS != pContext->lostStatus)
 	{
-		nameOffset = 0;
+		/* a prefetched batch was lost, continuing would skip its entries */
+		res = pContext->lostStatus;
+		goto Exit;
+	}
+
+	if (NULL != pContext->prefetch)
+	{
+		/* the request was sent while the application parsed the previous buffer */
+		res = collectFindPrefetch(pSearch);
 	}
 	else
 	{
-		nameOffset = (NQ_UINT16)cmSmb2HeaderGetWriterOffset(&request.header, &request.writer);
+		if (!writeFindRequest(&request, pSearch, pattern, pSearch->isFirst))
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+			res = NQ_ERR_OUTOFMEMORY;
+			goto Exit;
+		}
+
+		res = pSearch->server->smb->sendReceive(pSearch->server, pSearch->share->user, &request, &response);
+		if (NQ_SUCCESS != res)
+		{
+			cmBufManGive(response.buffer);
+			goto Exit;
+		}
+		setFindBuffer(pSearch, &response);
 	}
-	pTemp = cmBufferWriterGetPosition(&request.writer);
-	cmBufferWriterSetPosition(&request.writer, pNameOffset);
-	cmBufferWriteUint16(&request.writer, nameOffset);			/* name offset */
-	cmBufferWriterSetPosition(&request.writer, pTemp);
-	request.tail.data = (NQ_BYTE *)pattern;
-	request.tail.len = nameLen; 
 
-	res = pSearch->server->smb->sendReceive(pSearch->server, pSearch->share->user, &request, &response);
-	if (NQ_SUCCESS != res)
+	/* keep one request ahead of the application until the server reports the end */
+	if (NQ_SUCCESS == res)
 	{
-		cmBufManGive(response.buffer);
-		goto Exit;
+		startFindPrefetch(pSearch, pattern);
+	}
+	else if (NQ_ERR_NOFILES == res)
+	{
+		pContext->noMoreFiles = TRUE;
 	}
-
-	/* parse response */
-	cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT16));	/* output buffer offset */
-	cmBufferReadUint32(&response.reader, &outputLen);			/* output buffer length */
-	cmBufferReaderInit(
-		&pSearch->parser,
-		cmBufferReaderGetPosition(&response.reader),
-		(NQ_COUNT)outputLen
-		);
-	
-	pSearch->buffer = response.buffer;		/* to be released later */
 
 Exit:
 	cmMemoryFree(pattern);
@@ -2646,6 +2941,14 @@ static NQ_STATUS doFindClose(CCSearch * pSearch)
 		goto Exit;
 	}
 
+	/* drain the outstanding request so that its response is not matched after close */
+	if (NULL != pContext->prefetch)
+	{
+		pContext->prefetch->isSignalled = cmThreadCondWait(&pContext->prefetch->cond, ccConfigGetTimeout());
+		releaseFindPrefetch(pSearch->server, pContext->prefetch);
+		pContext->prefetch = NULL;
+	}
+
 	if (!prepareSingleRequestByShare(&request, pSearch->share, SMB2_CMD_CLOSE, 0))
 	{
 		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
@@ -3000,7 +3303,13 @@ static NQ_STATUS doRead(CCFile * pFile, const NQ_BYTE * buffer, NQ_UINT bytesToR
 	/* compose request */
 	writeHeader(&request);
 	cmBufferWriteByte(&request.writer, 0x50);					/* padding */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	/* ask for a compressed response only when it may pay off */
+	cmBufferWriteByte(&request.writer, (pServer->compressionAlgorithm != SMB2_COMPRESSION_NONE && bytesToRead >= UD_NQ_COMPRESSIONMINSIZE) ?
+					  SMB2_READFLAG_REQUEST_COMPRESSED : 0);	/* flags */
+#else
 	cmBufferWriteByte(&request.writer, 0);						/* reserved */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 	cmBufferWriteUint32(&request.writer, bytesToRead);			/* length */
 	cmBufferWriteUint64(&request.writer, &pFile->offset);		/* offset */
 	cmBufferWriteBytes(&request.writer, pFile->fid, sizeof(pFile->fid));	/* file ID */
@@ -3769,6 +4078,9 @@ static void signalAllMatches(void * trans)
 		Match * pMatch;
 
 		pMatch = (Match *)cmListIteratorNext(&iterator);
+		/* a broken additional channel only fails requests sent over it */
+		if (pTransport != &pServer->transport && pMatch->transport != pTransport)
+			continue;
 		if (pMatch->cond != NULL)
 			cmThreadCondSignal(pMatch->cond);
 		if (pMatch->isResponseAllocated)
@@ -3783,6 +4095,12 @@ static void signalAllMatches(void * trans)
 	cmListItemGive((CMItem *)pServer);
 }
 
+/* This function will be used only in ccsmb30*/
+NQ_BOOL ccSmb20PrepareSingleRequest(void * pRequest, void * pServer, void * pUser, NQ_UINT16 command)
+{
+	return prepareSingleRequest((CCServer *)pServer, (CCUser *)pUser, (Request *)pRequest, command);
+}
+
 /* This function will be used only in ccsmb30*/
 NQ_BOOL ccSmb20PrepareSingleRequestByShare(void * pRequest, const void * pShare, NQ_UINT16 command, NQ_UINT32 dataLen)
 {
@@ -3839,9 +4157,18 @@ static NQ_STATUS smb311ReadNegotiateContexts(CMBufferReader *reader, CCServer *p
 	for (; contextCount > 0; --contextCount)
 	{
 		NQ_UINT16 contextType, dataLength;
+		NQ_BYTE * pData;						/* context data start */
 		cmBufferReadUint16(reader, &contextType);
 		cmBufferReadUint16(reader, &dataLength);
 		cmBufferReaderSkip(reader, 4);			/* reserved (4) */
+		pData = cmBufferReaderGetPosition(reader);
+		if (dataLength > cmBufferReaderGetRemaining(reader))
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "Negotiate context %d exceeds the response", contextType);
+			sySetLastError(NQ_ERR_BADPARAM);
+			res = NQ_ERR_BADPARAM;
+			goto Exit;
+		}
 
 		switch (contextType)
 		{
@@ -3908,11 +4235,35 @@ static NQ_STATUS smb311ReadNegotiateContexts(CMBufferReader *reader, CCServer *p
 				}
 			}
 			break;
+#ifdef UD_NQ_INCLUDECOMPRESSION
+			case SMB2_COMPRESSION_CAPABILITIES:
+			{
+				NQ_UINT16 algorithm, algorithmCount;
+				NQ_UINT32 flags;
+
+				cmBufferReadUint16(reader, &algorithmCount);
+				cmBufferReaderSkip(reader, 2);			/* padding */
+				cmBufferReadUint32(reader, &flags);
+				for (; algorithmCount > 0; --algorithmCount)
+				{
+					cmBufferReadUint16(reader, &algorithm);
+					if (algorithm != SMB2_COMPRESSION_NONE && NULL != cmCompressionGetCodec(algorithm))
+					{
+						pServer->compressionAlgorithm = algorithm;
+						break;
+					}
+				}
+				pServer->compressionChained = (flags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED) != 0;
+				LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Compression algorithm: %d, chained: %d", pServer->compressionAlgorithm, pServer->compressionChained);
+			}
+			break;
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 			default:
 			{
 				LOGERR(CM_TRC_LEVEL_ERROR, "Received unsupported negotiation context: %d\n", contextType);
 			}
 		}
+		cmBufferReaderSetPosition(reader, pData + dataLength); /* skip unread context data */
 
 		if (contextCount > 1)
 			cmBufferReaderAlign(reader, reader->origin, 8); /* next context is 8 byte aligned */
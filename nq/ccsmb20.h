@@ -64,6 +64,11 @@ const CCCifsSmb * ccSmb20GetCifs(void);
  */
 NQ_STATUS ccSmb20DoNegotiateResponse(CCServer * pServer, const NQ_BYTE * data, NQ_COUNT len, CMBlob * pBlob);
 
+/*
+ * Function is used only in ccsmb30.c to prepare requests
+ */
+NQ_BOOL ccSmb20PrepareSingleRequest(void * pRequest, void * pServer, void * pUser, NQ_UINT16 command);
+
 /*
  * Function is used only in ccsmb30.c to prepare requests
  */
@@ -78,6 +78,7 @@ typedef struct
 	CMItem item;			/* inherits from item */
 	Response * response;	/* pointer to response structure */
 	CCServer * server;		/* server pointer */
+	CCTransport * transport;	/* connection the request was sent over */
 	NQ_UINT64 mid;			/* to match request and response */
 	CMThreadCond * cond;	/* condition to raise */
 	NQ_BYTE hdrBuf[HEADERANDSTRUCT_SIZE];	/* header + structure size for signing check */
@@ -135,7 +136,21 @@ typedef struct
 
 typedef struct
 {
-	NQ_BYTE fid[16];	/* context file ID */
+	Match match;			/* inherits from Match */
+	Response response;		/* response to the outstanding request */
+	CMThreadCond cond;		/* raised when the response arrives */
+	Request request;		/* the sent request, without its buffers */
+	NQ_BOOL isSignalled;	/* the condition was raised and consumed */
+}
+SearchMatch;	/* Context for a QUERY_DIRECTORY request sent ahead of time while
+				   the application still parses the previous response */
+
+typedef struct
+{
+	NQ_BYTE fid[16];		/* context file ID */
+	SearchMatch * prefetch;	/* outstanding QUERY_DIRECTORY request or NULL */
+	NQ_BOOL noMoreFiles;	/* the server reported STATUS_NO_MORE_FILES */
+	NQ_STATUS lostStatus;	/* not NQ_SUCCESS when a prefetched response was lost */
 }
 SearchContext;	/* SMB2 search context */
 
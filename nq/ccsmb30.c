@@ -33,6 +33,8 @@
 #include "cmbufman.h"
 #include "cmcrypt.h"
 #include "cmsdescr.h"
+#include "cmcompress.h"
+#include "amspnego.h"
 
 
 #ifdef UD_NQ_INCLUDECIFSCLIENT
@@ -48,6 +50,12 @@ static void handleWaitingNotifyResponse(void *pServer, void *pFile);
 
 static NQ_BOOL checkMessageSignatureSMB3(CCUser *pUser, NQ_BYTE *pHeaderIn, NQ_COUNT headerDataLength, NQ_BYTE* buffer, NQ_COUNT bufLength);
 
+/* credits */
+static void postCredits(CCServer * pServer, CCTransport * pTransport, NQ_COUNT credits);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+static CCChannel * pickChannel(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch, NQ_COUNT creditCharge);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
 static const Command commandDescriptors[] = /* SMB2 descriptor */
 {
 	{ 128, 36, 65, NULL, NULL}, 				/* SMB2 NEGOTIATE 0x0000 */
@@ -75,6 +83,7 @@ static const Command commandDescriptors[] = /* SMB2 descriptor */
 /* CCCifsSmb methods */
 static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch, NQ_BOOL (*callback)(CMItem * pItem));
 static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequest, Response * pResponse);
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch);
 static void anyResponseCallback(void * transport);
 
 static void keyDerivation(void * user);
@@ -95,6 +104,7 @@ NQ_BOOL ccSmb30Start(void)
 	tempDialect.anyResponseCallback = anyResponseCallback;
 	tempDialect.sendRequest = (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch, NQ_BOOL (*callback)(CMItem * pItem)))sendRequest;
 	tempDialect.sendReceive = (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pResponse))sendReceive;
+	tempDialect.receiveResponse = (NQ_STATUS (*)(void * pServer, void * pUser, void * pRequest, void * pMatch))receiveResponse;
 	tempDialect.handleWaitingNotifyResponses = handleWaitingNotifyResponse;
 	tempDialect.keyDerivation = keyDerivation;
 	tempDialect.validateNegotiate = validateNegotiate;
@@ -176,7 +186,19 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
     Context * pContext;         /* server context */
     NQ_STATUS result = NQ_SUCCESS; /* return value */
     NQ_BYTE * encryptedBuf = NULL; /* encrypted buffer */
+    NQ_BYTE * sendBuf = pRequest->buffer;   /* message to send, preceded by NBT header */
+    NQ_COUNT sendLen;                       /* length of that message without the tail */
+    NQ_COUNT tailLen = pRequest->tail.len;  /* length of the tail to send after it */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    NQ_BYTE * compressedBuf = NULL;         /* compressed message */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     NQ_COUNT creditCharge = 1;
+    CCTransport * pTransport = &pServer->transport;       /* connection to send over */
+    NQ_UINT64 * pMid;                                     /* message ID of that connection */
+    const CMBlob * pSigningKey = &pUser->macSessionKey;   /* signing key on that connection */
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    CCChannel * pChannel = NULL;                          /* additional channel or NULL */
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p user:%p request:%p match:%p", pServer, pUser, pRequest, pMatch);
 	if (pServer->smbContext == NULL)
@@ -191,6 +213,15 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 		creditCharge = pRequest->header.creditCharge;
 	}
 
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    pChannel = pickChannel(pServer, pUser, pRequest, pMatch, creditCharge);
+    if (NULL != pChannel)
+    {
+        pTransport = &pChannel->transport;
+        pSigningKey = &pUser->channelKeys[pChannel - pServer->channels];
+    }
+    else
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
     if (!ccServerWaitForCredits(pServer, creditCharge))
     {
 		result = NQ_ERR_TIMEOUT;
@@ -198,11 +229,11 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
     }    
 
     cmListItemTake(&pServer->item);
-    ccTransportLock(&pServer->transport);
+    ccTransportLock(pTransport);
 
-    if (!pServer->transport.connected || !pUser->logged)
+    if (!pTransport->connected || !pUser->logged)
 	{
-    	if (!pServer->transport.connected)
+    	if (!pTransport->connected)
     	{
 			LOGERR(CM_TRC_LEVEL_ERROR, " transport isn't connected");
 			result = NQ_ERR_NOTCONNECTED;
@@ -220,24 +251,30 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 
     /* write down MID */
     pContext = (Context *)pServer->smbContext;
-    pRequest->header.mid = pMatch->mid = pContext->mid;
+    pMid = &pContext->mid;
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    if (NULL != pChannel)
+        pMid = &pChannel->mid;  /* sequence windows are per connection */
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+    pRequest->header.mid = pMatch->mid = *pMid;
     packetLen = cmBufferWriterGetDataCount(&pRequest->writer) - 4;	/* NBT header */
     cmBufferWriterInit(&writer, pRequest->buffer + SEQNUMBEROFFSET, (NQ_COUNT)packetLen);
-    cmBufferWriteUint64(&writer, &pContext->mid);
+    cmBufferWriteUint64(&writer, pMid);
  
     /* add match to list only after mid was set */
+    pMatch->transport = pTransport;
     cmListItemAdd(&pServer->expectedResponses, (CMItem *)pMatch, callback);
 
     /* prepare MID for next request */
-    cmU64AddU32(&pContext->mid, (NQ_UINT32)(pRequest->header.creditCharge > 0 ? pRequest->header.creditCharge : 1));
+    cmU64AddU32(pMid, (NQ_UINT32)(pRequest->header.creditCharge > 0 ? pRequest->header.creditCharge : 1));
 
 	/* compose signature */
 	if (!pRequest->encrypt && ccServerUseSignatures(pServer) && ccUserUseSignatures(pUser) 
         && (pRequest->header.command != SMB2_CMD_SESSIONSETUP))
 	{
 		cmSmb3CalculateMessageSignature(
-			pUser->macSessionKey.data,
-			pUser->macSessionKey.len,
+			pSigningKey->data,
+			pSigningKey->len,
 			pRequest->buffer + 4,
 			(NQ_UINT)packetLen,
 			pRequest->tail.data,
@@ -254,7 +291,30 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
     	cmCapturePacketWritePacket(pRequest->tail.data, pRequest->tail.len);
     cmCapturePacketWriteEnd();
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
-    
+
+    sendLen = (NQ_COUNT)packetLen;
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    /* compress write data - only the main connection negotiated compression */
+    if (pRequest->header.command == SMB2_CMD_WRITE && pServer->compressionAlgorithm != SMB2_COMPRESSION_NONE
+        && pTransport == &pServer->transport && tailLen > 0)
+    {
+        compressedBuf = (NQ_BYTE *)cmMemoryAllocate((NQ_UINT)(packetLen + tailLen + 4));
+        if (NULL != compressedBuf)
+        {
+            NQ_COUNT compressedLen = cmSmb2CompressMessage(pServer->compressionAlgorithm, pServer->compressionChained,
+                pRequest->buffer + 4, (NQ_COUNT)packetLen, pRequest->tail.data, tailLen, compressedBuf + 4, (NQ_COUNT)packetLen + tailLen);
+
+            if (compressedLen != (NQ_COUNT)NQ_FAIL)
+            {
+                LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Write compressed: %d -> %d bytes", packetLen + tailLen, compressedLen);
+                sendBuf = compressedBuf;
+                sendLen = compressedLen;
+                tailLen = 0;
+            }
+        }
+    }
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+
     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Request: command=%u, credit charge=%d, credits req=%d, mid=%u/%u, sid.low=0x%x, signed:%d, async:%d, pid(async.high)=0x%x, tid(async.low)=0x%x",
         pRequest->header.command, pRequest->header.creditCharge, pRequest->header.credits, pRequest->header.mid.high, pRequest->header.mid.low, pRequest->header.sid.low, (pRequest->header.flags & SMB2_FLAG_SIGNED) > 0,
         (pRequest->header.flags & SMB2_FLAG_ASYNC_COMMAND) > 0,
@@ -263,7 +323,7 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 
 	if (pRequest->encrypt && ccUserUseSignatures(pUser) && pRequest->header.command != SMB2_CMD_SESSIONSETUP)
 	{
-		NQ_UINT32 msgLen = packetLen + pRequest->tail.len;
+		NQ_UINT32 msgLen = sendLen + tailLen;
 
 		encryptedBuf = (NQ_BYTE *)cmMemoryAllocate((NQ_UINT)(msgLen + SMB2_TRANSFORMHEADER_SIZE + 4));
 		if (encryptedBuf != NULL)
@@ -282,13 +342,13 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 			addPoint +=20;
 			cmSmb2TransformHeaderWrite(&transformHeader , &writer);
 			msgPoint = cmBufferWriterGetPosition(&writer);
-			cmBufferWriteBytes(&writer , pRequest->buffer + 4  , (NQ_COUNT)packetLen);
-			cmBufferWriteBytes(&writer , pRequest->tail.data , pRequest->tail.len);
+			cmBufferWriteBytes(&writer , sendBuf + 4  , sendLen);
+			cmBufferWriteBytes(&writer , pRequest->tail.data , tailLen);
 			cmSmb3EncryptMessage(pUser->decryptionKey.data, transformHeader.nonce, msgPoint, (NQ_UINT)msgLen, addPoint,
 				SMB2_TRANSFORMHEADER_SIZE - 20 , addPoint - 16, pUser->server->isAesGcm);
 
 			if (!ccTransportSend(
-							&pServer->transport,
+							pTransport,
 							encryptedBuf,
 							(NQ_COUNT)(msgLen + SMB2_TRANSFORMHEADER_SIZE),
 							(NQ_COUNT)(msgLen + SMB2_TRANSFORMHEADER_SIZE)
@@ -335,10 +395,10 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 #endif /* UD_NQ_INCLUDESMB311 */
 
 		if (!ccTransportSend(
-				&pServer->transport,
-				pRequest->buffer,
-				(NQ_COUNT)(packetLen + pRequest->tail.len),
-				(NQ_COUNT)packetLen
+				pTransport,
+				sendBuf,
+				sendLen + tailLen,
+				sendLen
 				)
 			)
 		{
@@ -346,8 +406,8 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 			goto Error;
 		}
 
-		if (0 != pRequest->tail.len &&
-			!ccTransportSendTail(&pServer->transport, pRequest->tail.data, pRequest->tail.len)
+		if (0 != tailLen &&
+			!ccTransportSendTail(pTransport, pRequest->tail.data, tailLen)
 			)
 		{
 			result = (NQ_STATUS)syGetLastError();
@@ -356,8 +416,11 @@ static NQ_STATUS sendRequest(CCServer * pServer, CCUser * pUser, Request * pRequ
 	}
 
 Error:
-	ccTransportUnlock(&pServer->transport);
+	ccTransportUnlock(pTransport);
 	cmMemoryFree(encryptedBuf);
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	cmMemoryFree(compressedBuf);
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 
 Exit:
 	cmListItemGive(&pServer->item);
@@ -412,6 +475,21 @@ static NQ_STATUS sendReceive(CCServer * pServer, CCUser * pUser, Request * pRequ
 		goto Exit;
 	}
 
+	res = receiveResponse(pServer, pUser, pRequest, pMatch);
+
+Exit:
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+	return res;
+}
+
+/* wait for the response to a request that was sent and check it */
+static NQ_STATUS receiveResponse(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch)
+{
+	Response * pResponse = pMatch->response;	/* response descriptor */
+	NQ_STATUS res;				/* operation result */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p user:%p request:%p match:%p", pServer, pUser, pRequest, pMatch);
+
     if (!cmThreadCondWait(pMatch->cond, ccConfigGetTimeout()))
 	{
 		if ((!pServer->transport.connected || NULL == pResponse->buffer)
@@ -610,7 +688,7 @@ static void handleWaitingNotifyResponse(void *pserver, void *pfile)
 }
 
 
-static void handleNotification(CCServer *pServer, CMSmb2Header *header, CMBlob *decryptPacket)
+static void handleNotification(CCServer *pServer, CCTransport *pTransport, CMSmb2Header *header, CMBlob *decryptPacket)
 {
 	Response* pResponse;
 	NQ_BYTE * pFid;             				/* pointer to file ID in the notification */
@@ -633,7 +711,7 @@ static void handleNotification(CCServer *pServer, CMSmb2Header *header, CMBlob *
 	if (decryptPacket->data != NULL)
 	{
 		/* handle notification should release transport when done - for decrypted packet case. reading from transport is done already */
-		ccTransportReceiveEnd(&pServer->transport);
+		ccTransportReceiveEnd(pTransport);
 
 		pResponse->tailLen = (NQ_COUNT)(decryptPacket->len - HEADERANDSTRUCT_SIZE);
 		pResponse->buffer = (NQ_BYTE *)cmBufManTake(pResponse->tailLen);
@@ -649,7 +727,7 @@ static void handleNotification(CCServer *pServer, CMSmb2Header *header, CMBlob *
 
 		cmMemoryFreeBlob(decryptPacket);
 	}
-	else if (pServer->transport.recv.remaining > 0)
+	else if (pTransport->recv.remaining > 0)
 	{
 
 		if (pServer->smbContext == NULL)
@@ -658,7 +736,7 @@ static void handleNotification(CCServer *pServer, CMSmb2Header *header, CMBlob *
 			goto Error;
 		}
 
-		pResponse->tailLen = pServer->transport.recv.remaining;
+		pResponse->tailLen = pTransport->recv.remaining;
 		pResponse->buffer = (NQ_BYTE *)cmBufManTake(pResponse->tailLen);
 		if (NULL == pResponse->buffer)
 		{
@@ -667,13 +745,13 @@ static void handleNotification(CCServer *pServer, CMSmb2Header *header, CMBlob *
 			goto Error;
 		}
 
-		if (pResponse->tailLen != ccTransportReceiveBytes(&pServer->transport, pResponse->buffer, pResponse->tailLen))
+		if (pResponse->tailLen != ccTransportReceiveBytes(pTransport, pResponse->buffer, pResponse->tailLen))
 		{
 			LOGERR(CM_TRC_LEVEL_ERROR, "Transport receive error.");
 			goto Error;
 		}
 
-		ccTransportReceiveEnd(&pServer->transport);
+		ccTransportReceiveEnd(pTransport);
 	}
 
 #ifdef UD_NQ_INCLUDESMBCAPTURE
@@ -728,7 +806,7 @@ static void handleNotification(CCServer *pServer, CMSmb2Header *header, CMBlob *
 	goto Exit1;
 
 Error:
-	ccTransportReceiveEnd(&pServer->transport);
+	ccTransportReceiveEnd(pTransport);
 
 Exit1:
 #ifdef UD_NQ_INCLUDESMBCAPTURE
@@ -745,6 +823,60 @@ Exit:
 	LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
 
+#ifdef UD_NQ_INCLUDECOMPRESSION
+#define MAXRESPONSESTRUCT_SIZE	64	/* IOCTL response structure (the largest ahead of data) with alignment */
+
+/* replace a compression transform with the message it carries */
+static NQ_BOOL decompressPacket(CCServer * pServer, CMBlob * packet)
+{
+	NQ_BYTE * original;		/* decompressed message */
+	NQ_COUNT length;		/* its length */
+	NQ_COUNT maxLength;		/* the longest response the negotiated sizes allow */
+	NQ_BOOL result = FALSE;	/* return value */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "pServer:%p packet:%p", pServer, packet);
+
+	if (SMB2_COMPRESSION_NONE == pServer->compressionAlgorithm)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Compression transform while compression was not negotiated");
+		goto Exit;
+	}
+	length = cmSmb2GetDecompressedLength(packet->data, packet->len);
+	if ((NQ_COUNT)NQ_FAIL == length)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Malformed compression transform header");
+		goto Exit;
+	}
+	/* only READ, IOCTL and QUERY responses carry large data: header and command structure ahead of at most max read/transact bytes */
+	maxLength = (NQ_COUNT)(pServer->maxRead > pServer->maxTrans ? pServer->maxRead : pServer->maxTrans) + SMB2_HEADERSIZE + MAXRESPONSESTRUCT_SIZE;
+	if (length > maxLength)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Decompressed length %d exceeds the negotiated maximum %d", length, maxLength);
+		goto Exit;
+	}
+	original = (NQ_BYTE *)cmMemoryAllocate(length);
+	if (NULL == original)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		goto Exit;
+	}
+	if (length != cmSmb2DecompressMessage(pServer->compressionAlgorithm, packet->data, packet->len, original, length))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Failed to decompress message");
+		cmMemoryFree(original);
+		goto Exit;
+	}
+	cmMemoryFree(packet->data);
+	packet->data = original;
+	packet->len = length;
+	result = TRUE;
+
+Exit:
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", result);
+	return result;
+}
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+
 static void anyResponseCallback(void * transport)
 {
 	CCTransport * 	pTransport = (CCTransport *)transport; 	/* casted to transport entry */
@@ -776,6 +908,9 @@ static void anyResponseCallback(void * transport)
 		    Match * pMatch;
     		
 		    pMatch = (Match *)cmListIteratorNext(&iterator);
+		    /* a broken additional channel only fails requests sent over it */
+		    if (pTransport != &pServer->transport && pMatch->transport != pTransport)
+		    	continue;
 		    if (pMatch->cond != NULL)
 		    	cmThreadCondSignal(pMatch->cond);
 		    if (pMatch->isResponseAllocated)
@@ -868,6 +1003,24 @@ static void anyResponseCallback(void * transport)
 		tHdr = NULL;
 		syMemcpy(buffer , decryptPacket.data , sizeof(buffer));
 	}
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	else if (0 == syMemcmp(buffer, cmSmb2CmprsHdrProtocolId, sizeof(cmSmb2CmprsHdrProtocolId)))
+	{
+		/* the whole transform is needed to decompress */
+		decryptPacket.len = 4 + pTransport->recv.remaining;
+		decryptPacket.data = (NQ_BYTE *)cmMemoryAllocate(decryptPacket.len);
+		if (NULL == decryptPacket.data)
+		{
+			goto Error;
+		}
+		syMemcpy(decryptPacket.data, buffer, 4);
+		res = ccTransportReceiveBytes(pTransport, decryptPacket.data + 4, decryptPacket.len - 4);
+		if ((NQ_COUNT)NQ_FAIL == res)
+		{
+			goto Error;
+		}
+	}
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 	else
 	{
 		res = ccTransportReceiveBytes(pTransport, &buffer[4], sizeof(buffer) - 4);
@@ -876,10 +1029,23 @@ static void anyResponseCallback(void * transport)
 			goto Error;
 		}
 	}
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	/* compression transform, either plain or carried by a transform header */
+	if (NULL != decryptPacket.data && decryptPacket.len >= sizeof(cmSmb2CmprsHdrProtocolId)
+		&& 0 == syMemcmp(decryptPacket.data, cmSmb2CmprsHdrProtocolId, sizeof(cmSmb2CmprsHdrProtocolId)))
+	{
+		if (!decompressPacket(pServer, &decryptPacket) || decryptPacket.len < HEADERANDSTRUCT_SIZE)
+		{
+			goto Error;
+		}
+		res = decryptPacket.len;
+		syMemcpy(buffer , decryptPacket.data , sizeof(buffer));
+	}
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 	pServer->captureHdr.receiving = TRUE;
-	cmCapturePacketWriteStart(&pServer->captureHdr , (NQ_UINT)(decryptPacket.data != NULL ? decryptPacket.len : HEADERANDSTRUCT_SIZE + pServer->transport.recv.remaining));
+	cmCapturePacketWriteStart(&pServer->captureHdr , (NQ_UINT)(decryptPacket.data != NULL ? decryptPacket.len : HEADERANDSTRUCT_SIZE + pTransport->recv.remaining));
 	cmCapturePacketWritePacket( buffer, HEADERANDSTRUCT_SIZE);
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
 	cmBufferReaderInit(&reader, buffer, res); /* starting from SMB header */
@@ -892,7 +1058,7 @@ static void anyResponseCallback(void * transport)
 		Match * pMatch;
 		
 		pMatch = (Match *)cmListIteratorNext(&iterator);
-		if (pMatch->server == pServer && 0 == cmU64Cmp(&pMatch->mid, &header.mid)) 
+		if (pMatch->server == pServer && pMatch->transport == pTransport && 0 == cmU64Cmp(&pMatch->mid, &header.mid))
 		{
 			NQ_UINT16 length;			/* structure length */
 			
@@ -929,14 +1095,14 @@ static void anyResponseCallback(void * transport)
 				}
 				else
 				{
-					len = pServer->transport.recv.remaining;
+					len = pTransport->recv.remaining;
 					tempBuf = (NQ_BYTE *)cmMemoryAllocate(len);
 					if (NULL == tempBuf)
 					{
 					    LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
 					    goto Error;
 					}
-					ccTransportReceiveBytes(&pServer->transport, tempBuf, len);
+					ccTransportReceiveBytes(pTransport, tempBuf, len);
 				}
 				cmCapturePacketWritePacket(tempBuf , len);
 				cmCapturePacketWriteEnd();
@@ -990,7 +1156,7 @@ static void anyResponseCallback(void * transport)
 					}
 					else
                     {
-						pResponse->tailLen = pServer->transport.recv.remaining;
+						pResponse->tailLen = pTransport->recv.remaining;
                         pResponse->buffer = NULL;
                     }
 
@@ -1018,16 +1184,16 @@ static void anyResponseCallback(void * transport)
 									HEADERANDSTRUCT_SIZE;	/* shift back on header size and more structure size */
 			    		}
 					}
-					else if (pServer->transport.recv.remaining > 0 )
+					else if (pTransport->recv.remaining > 0 )
 	                {
 						Response * pResponse = pMatch->response;  /* associated response */
 						NQ_COUNT receivedBytes;
 
-						pResponse->tailLen = pServer->transport.recv.remaining;
+						pResponse->tailLen = pTransport->recv.remaining;
 						pResponse->buffer = cmBufManTake(pResponse->tailLen);
 						if (NULL != pResponse->buffer)
 						{
-							if (pResponse->tailLen == (receivedBytes = ccTransportReceiveBytes(&pServer->transport, pResponse->buffer, pResponse->tailLen)))
+							if (pResponse->tailLen == (receivedBytes = ccTransportReceiveBytes(pTransport, pResponse->buffer, pResponse->tailLen)))
 							{
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 								cmCapturePacketWritePacket( pResponse->buffer, pResponse->tailLen);
@@ -1063,20 +1229,20 @@ static void anyResponseCallback(void * transport)
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 					cmCapturePacketWriteEnd();
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
-	                ccTransportReceiveEnd(&pServer->transport);
+	                ccTransportReceiveEnd(pTransport);
 	                pMatch->response->wasReceived = TRUE;
 					cmThreadCondSignal(pMatch->cond);
 				}
 			}
             if (header.credits > 0)
-                ccServerPostCredits(pServer, header.credits);
+                postCredits(pServer, pTransport, header.credits);
 			goto Exit;
-		} /*if (pMatch->server == pServer && 0 == cmU64Cmp(&pMatch->mid, &header.mid))*/
+		} /*if (pMatch->server == pServer && pMatch->transport == pTransport && 0 == cmU64Cmp(&pMatch->mid, &header.mid))*/
 	}
 	cmListIteratorTerminate(&iterator);
     if (NULL != commandDescriptors[header.command].notificationHandle)
     {
-    	handleNotification(pServer, &header, &decryptPacket);
+    	handleNotification(pServer, pTransport, &header, &decryptPacket);
     	goto Exit;
     }
     else
@@ -1090,10 +1256,10 @@ ErrorAndCredits:
 	/* for some reason the match wasn't found. or some other error occurred. still update credits. */
 	if (header.credits > 0)
 	{
-		ccServerPostCredits(pServer, header.credits);
+		postCredits(pServer, pTransport, header.credits);
 	}
 Error:
-	ccTransportReceiveEnd(&pServer->transport);
+	ccTransportReceiveEnd(pTransport);
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 	cmCapturePacketWriteEnd();
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
@@ -1109,7 +1275,7 @@ static void writeCallback(CCServer * pServer, Match * pContext)
 {
 	WriteMatch * pMatch = (WriteMatch *)pContext;	/* casted pointer */
 	NQ_BYTE buffer[20];								/* buffer for structure */
-	NQ_UINT tailLen = pServer->transport.recv.remaining;	/* bytes remaining */
+	NQ_UINT tailLen = pContext->transport->recv.remaining;	/* bytes remaining */
 	Response * pResponse = pContext->response;				/* response structure pointer */
 	NQ_UINT32 count = 0;     								/* bytes written */
     NQ_UINT32     currentTime;                    /* Current Time for checking timed-out responses*/
@@ -1125,12 +1291,12 @@ static void writeCallback(CCServer * pServer, Match * pContext)
 		count = 1;
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
 	}
-	else if ( tailLen != ccTransportReceiveBytes(&pServer->transport, buffer, tailLen))
+	else if ( tailLen != ccTransportReceiveBytes(pContext->transport, buffer, tailLen))
 	{
-    	ccTransportReceiveEnd(&pServer->transport);
+    	ccTransportReceiveEnd(pContext->transport);
 		goto Exit;
 	}
-    ccTransportReceiveEnd(&pServer->transport);
+    ccTransportReceiveEnd(pContext->transport);
 #ifdef UD_NQ_INCLUDESMBCAPTURE
     cmCapturePacketWritePacket( buffer, (NQ_UINT)(count == 1 ? pResponse->tailLen : tailLen));
 	cmCapturePacketWriteEnd();
@@ -1208,7 +1374,7 @@ static void readCallback(CCServer * pServer, Match * pContext)
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 		NQ_COUNT res =
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
-		ccTransportReceiveBytes(&pServer->transport, buffer, pResponse->tailLen );
+		ccTransportReceiveBytes(pContext->transport, buffer, pResponse->tailLen );
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 		if (res > 0)
 		{
@@ -1217,7 +1383,7 @@ static void readCallback(CCServer * pServer, Match * pContext)
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
 		count = 0;
 	}
-	else if (READSTRUCT_SIZE == ccTransportReceiveBytes(&pServer->transport, buffer, READSTRUCT_SIZE))
+	else if (READSTRUCT_SIZE == ccTransportReceiveBytes(pContext->transport, buffer, READSTRUCT_SIZE))
 	{
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 		cmCapturePacketWritePacket( buffer,READSTRUCT_SIZE );
@@ -1232,12 +1398,12 @@ static void readCallback(CCServer * pServer, Match * pContext)
 		    offset = (NQ_BYTE)(offset - (SMB2_HEADERSIZE + 16));	/* bytes to skip */
 		    if (offset > 0 )
 		    {
-			    ccTransportReceiveBytes(&pServer->transport, buffer, (NQ_COUNT)offset);	/* read padding */
+			    ccTransportReceiveBytes(pContext->transport, buffer, (NQ_COUNT)offset);	/* read padding */
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 				cmCapturePacketWritePacket(buffer,offset );
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
 		    }
-		    ccTransportReceiveBytes(&pServer->transport, pMatch->buffer, (NQ_COUNT)count);	/* read into application buffer */
+		    ccTransportReceiveBytes(pContext->transport, pMatch->buffer, (NQ_COUNT)count);	/* read into application buffer */
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 		    cmCapturePacketWritePacket(pMatch->buffer, (NQ_UINT)count);
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
@@ -1247,7 +1413,7 @@ static void readCallback(CCServer * pServer, Match * pContext)
 	{
 		count = 0;
 	}
-    ccTransportReceiveEnd(&pServer->transport);
+    ccTransportReceiveEnd(pContext->transport);
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 	cmCapturePacketWriteEnd();
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
@@ -1503,6 +1669,9 @@ static NQ_BOOL validateNegotiate(void *pServ, void *_pUser, void* _pShareIPC)
 	offset = cmSmb2HeaderGetWriterOffset(&request.header, &request.writer);
 #ifdef UD_NQ_INCLUDESMB3
     capabilities |= (SMB2_CAPABILITY_ENCRYPTION | SMB2_CAPABILITY_LARGE_MTU);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    capabilities |= SMB2_CAPABILITY_MULTI_CHANNEL;
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #endif /* UD_NQ_INCLUDESMB3 */
 	cmBufferWriteUint32(&request.writer, capabilities);					/* client capabilities */
 	cmBufferWriteUint32(&request.writer, pServer->clientGuidPartial);	/* client GUID */
@@ -1660,5 +1829,866 @@ static NQ_BOOL checkMessageSignatureSMB3(CCUser *pUser, NQ_BYTE *pHeaderIn, NQ_C
 	return result;
 }
 
+/* -- Credits and additional channels -- */
+
+/* return credits granted on the connection a response arrived on */
+static void postCredits(CCServer * pServer, CCTransport * pTransport, NQ_COUNT credits)
+{
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+	if (pTransport != &pServer->transport)
+	{
+		ccServerPostChannelCredits(pServer, (CCChannel *)pTransport, credits);
+		return;
+	}
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+	ccServerPostCredits(pServer, credits);
+}
+
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+
+#define INTERFACEINFO_ENTRYSIZE		152		/* size of NETWORK_INTERFACE_INFO entry */
+#define INTERFACEINFO_MAXOUTPUT		8192	/* max output response for the interface query */
+#define INTERFACEINFO_FAMILYIPV4	0x0002	/* sockaddr_in family */
+#define INTERFACEINFO_FAMILYIPV6	0x0017	/* sockaddr_in6 family */
+
+typedef struct
+{
+	NQ_IPADDRESS ip;			/* interface address */
+	NQ_UINT64 linkSpeed;		/* link speed in bits per second */
+}
+ServerInterface;	/* one server interface as reported by FSCTL_QUERY_NETWORK_INTERFACE_INFO */
+
+typedef struct
+{
+	CCServer * server;			/* server object */
+	CCUser * user;				/* user being bound */
+	CCChannel * channel;		/* channel to bind to */
+	CMBlob sessionKey;			/* session key produced by the binding authentication */
+	CMBlob macKey;				/* signing key produced by the binding authentication */
+	CMBlob channelKey;			/* derived channel signing key */
+#ifdef UD_NQ_INCLUDESMB311
+	NQ_BYTE preauthIntegHashVal[SMB3_PREAUTH_INTEG_HASH_LENGTH]; /* hash of this binding */
+#endif /* UD_NQ_INCLUDESMB311 */
+}
+BindContext;	/* context of binding a user to a channel */
+
+/*
+ * Choose a connection for a request:
+ * 	- only large reads and writes are spread over channels
+ *  - the main connection takes its turn in the round robin
+ *  - a channel is used when it is bound for this user and has enough credits
+ * Returns NULL when the request should go over the main connection.
+ */
+static CCChannel * pickChannel(CCServer * pServer, CCUser * pUser, Request * pRequest, Match * pMatch, NQ_COUNT creditCharge)
+{
+	CCChannel * pChannel = NULL;	/* the result */
+	NQ_UINT32 payload;				/* read or write size */
+	NQ_COUNT slots;					/* main connection and channels */
+	NQ_COUNT i;						/* just a counter */
+
+	if (0 == pServer->numChannels || pRequest->encrypt)
+		return NULL;
+
+	switch (pRequest->header.command)
+	{
+		case SMB2_CMD_READ:
+			payload = ((ReadMatch *)pMatch)->count;
+			break;
+		case SMB2_CMD_WRITE:
+			payload = pRequest->tail.len;
+			break;
+		default:
+			return NULL;
+	}
+	if (payload < UD_CC_CHANNELSTRIPESIZE)
+		return NULL;
+
+	cmListItemTake(&pServer->item);
+	slots = pServer->numChannels + 1;
+	for (i = 0; i < slots; i++)
+	{
+		NQ_COUNT slot = pServer->nextChannel++ % slots;
+		CCChannel * pCandidate;
+
+		if (0 == slot)
+			break;	/* main connection turn */
+
+		pCandidate = &pServer->channels[slot - 1];
+		if (pCandidate->isActive && pCandidate->transport.connected && NULL != pUser->channelKeys[slot - 1].data
+			&& ccServerTakeChannelCredits(pServer, pCandidate, creditCharge))
+		{
+			pChannel = pCandidate;
+			break;
+		}
+	}
+	cmListItemGive(&pServer->item);
+
+	return pChannel;
+}
+
+/*
+ * Cleanup callback of a channel transport. Called when the channel connection breaks.
+ * Only requests sent over this channel are released, the main connection is not affected.
+ * Striped reads and writes fail at once so that the caller does not wait for its timeout.
+ */
+static void channelBrokenCallback(void * context)
+{
+	CCChannel * pChannel = (CCChannel *)context;
+	CCServer * pServer = (CCServer *)pChannel->transport.server;
+	CMIterator iterator;
+	CMList failed;					/* reads and writes to fail, completed outside of the response list */
+	NQ_UINT32 currentTime;			/* for checking timed-out requests */
+	NQ_UINT32 readInfo;				/* match info of a read */
+	NQ_UINT32 writeInfo;			/* match info of a write */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "channel:%p", pChannel);
+
+	readInfo = MATCHINFO_READ;
+	writeInfo = MATCHINFO_WRITE;
+
+	pChannel->isActive = FALSE;
+	if (NULL == pServer)
+		goto Exit;
+
+	cmListStart(&failed);
+	cmListIteratorStart(&pServer->expectedResponses, &iterator);
+	while (cmListIteratorHasNext(&iterator))
+	{
+		Match * pMatch = (Match *)cmListIteratorNext(&iterator);
+
+		if (pMatch->transport == &pChannel->transport)
+		{
+			if (pMatch->item.locks == 0)
+			{
+				if (0 != (pMatch->matchExtraInfo & (readInfo | writeInfo)))
+				{
+					NQ_BOOL (*callback)(CMItem * pItem) = pMatch->item.callback;	/* disposes the response */
+
+					cmListItemRemove(&pMatch->item);
+					cmListItemAdd(&failed, &pMatch->item, callback);
+				}
+				else
+					cmListItemRemoveAndDispose(&pMatch->item);
+			}
+			else
+				cmListItemRemove(&pMatch->item);
+		}
+	}
+	cmListIteratorTerminate(&iterator);
+
+	currentTime = (NQ_UINT32)syGetTimeInSec();
+	while (NULL != failed.first)
+	{
+		Match * pMatch = (Match *)failed.first;
+
+		if (0 != (pMatch->matchExtraInfo & readInfo))
+		{
+			ReadMatch * pRead = (ReadMatch *)pMatch;
+
+			LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Read mid:%u failed on a broken channel", pMatch->mid.low);
+			if ((pRead->timeCreated + pRead->setTimeout) > currentTime)
+				pRead->callback(NQ_ERR_NOTCONNECTED, 0, pRead->context, TRUE);
+		}
+		else
+		{
+			WriteMatch * pWrite = (WriteMatch *)pMatch;
+
+			LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Write mid:%u failed on a broken channel", pMatch->mid.low);
+			if ((pWrite->timeCreated + pWrite->setTimeout) > currentTime)
+				pWrite->callback(NQ_ERR_NOTCONNECTED, 0, pWrite->context);
+		}
+		cmListItemRemoveAndDispose(&pMatch->item);
+	}
+	cmListShutdown(&failed);
+
+Exit:
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+/* close a channel that was connected but is not usable */
+static void closeChannel(CCChannel * pChannel)
+{
+	pChannel->isActive = FALSE;
+	if (NULL != pChannel->transport.item.guard)
+	{
+		ccTransportDisconnect(&pChannel->transport);
+	}
+}
+
+/*
+ * Query server interfaces over IPC$ and return the fastest ones except for the interface
+ * of the main connection. Interfaces are sorted by link speed, fastest first.
+ */
+static NQ_COUNT queryInterfaces(CCServer * pServer, CCUser * pUser, ServerInterface * interfaces)
+{
+	Request request;				/* request descriptor */
+	Response response;				/* response descriptor */
+	NQ_STATUS res;					/* exchange result */
+	CCShare * pShare;				/* IPC$ share */
+	const AMCredentialsW * pCredentials = pUser->credentials;	/* user credentials */
+	NQ_UINT32 temp32Uint;			/* for parsing 4-byte values */
+	NQ_UINT32 offset;				/* output offset */
+	NQ_UINT32 outputCount;			/* output length */
+	NQ_UINT32 entryOffset = 0;		/* offset of the current entry in the output */
+	NQ_COUNT numInterfaces = 0;		/* the result */
+	NQ_BYTE * pOutput;				/* start of the output */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p user:%p", pServer, pUser);
+
+	request.buffer = NULL;
+	response.buffer = NULL;
+
+	pShare = ccShareConnectIpc(pServer, &pCredentials);
+	if (NULL == pShare)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Failed to connect to IPC$");
+		goto Exit2;
+	}
+
+	if (!ccSmb20PrepareSingleRequestByShare(&request, pShare, SMB2_CMD_IOCTL, 0))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		goto Exit;
+	}
+
+	/* compose request - start with header*/
+	cmSmb2HeaderWrite(&request.header, &request.writer);
+	cmBufferWriteUint16(&request.writer, 0x39);							/* ioctl structure size*/
+	cmBufferWriteUint16(&request.writer, 0x0);							/* reserved */
+	cmBufferWriteUint32(&request.writer, SMB_IOCTL_QUERY_NETWORK_INTERFACEINFO);	/* CtlCode: FSCTL_QUERY_NETWORK_INTERFACE_INFO */
+	cmBufferWriteUint32(&request.writer, 0xFFFFFFFF);					/* set special file ID */
+	cmBufferWriteUint32(&request.writer, 0xFFFFFFFF);					/* file ID */
+	cmBufferWriteUint32(&request.writer, 0xFFFFFFFF);					/* file ID */
+	cmBufferWriteUint32(&request.writer, 0xFFFFFFFF);					/* file ID */
+	cmBufferWriteUint32(&request.writer, 0);							/* Input offset */
+	cmBufferWriteUint32(&request.writer, 0);							/* Input count */
+	cmBufferWriteUint32(&request.writer, 0);							/* Max Input Response */
+	cmBufferWriteUint32(&request.writer, 0);							/* Output offset */
+	cmBufferWriteUint32(&request.writer, 0);							/* Output count */
+	cmBufferWriteUint32(&request.writer, INTERFACEINFO_MAXOUTPUT);		/* Max Output Response */
+	cmBufferWriteUint32(&request.writer, SMB2_0_IOCTL_IS_FSCTL);		/* flags: FSCTL */
+	cmBufferWriteUint32(&request.writer, 0);							/* reserved */
+
+	res = pServer->smb->sendReceive(pServer, pShare->user, &request, &response);
+	if (NQ_SUCCESS != res)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Interface query failed: %d", res);
+		goto Exit;
+	}
+
+	/* parse response */
+	cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT16));	/* reserved */
+	cmBufferReadUint32(&response.reader, &temp32Uint);			/* CtlCode */
+	if (temp32Uint != SMB_IOCTL_QUERY_NETWORK_INTERFACEINFO)
+	{
+		LOGERR(CM_TRC_LEVEL_WARNING, "Bad CtlCode: %x in interface query.", temp32Uint);
+		goto Exit;
+	}
+	cmBufferReaderSkip(&response.reader, 4 * sizeof(NQ_UINT32));	/* file ID */
+	cmBufferReaderSkip(&response.reader, 2 * sizeof(NQ_UINT32));	/* InputOffset and InputCount */
+	cmBufferReadUint32(&response.reader, &offset);				/* OutputOffset */
+	cmBufferReadUint32(&response.reader, &outputCount);			/* OutputCount */
+	cmSmb2HeaderSetReaderOffset(&response.header, &response.reader, (NQ_UINT16)offset);
+	pOutput = cmBufferReaderGetPosition(&response.reader);
+	if (outputCount > cmBufferReaderGetRemaining(&response.reader))
+	{
+		LOGERR(CM_TRC_LEVEL_WARNING, "Bad output count: %u in interface query.", outputCount);
+		goto Exit;
+	}
+
+	/* parse NETWORK_INTERFACE_INFO entries */
+	while (entryOffset + INTERFACEINFO_ENTRYSIZE <= outputCount)
+	{
+		ServerInterface entry;		/* parsed interface */
+		NQ_UINT32 next;				/* offset to the next entry */
+		NQ_UINT16 family;			/* address family */
+		NQ_BOOL isValid = FALSE;	/* whether the address is usable */
+		NQ_COUNT i;					/* just a counter */
+
+		cmBufferReaderSetPosition(&response.reader, pOutput + entryOffset);
+		cmBufferReadUint32(&response.reader, &next);				/* Next */
+		cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT32));	/* IfIndex */
+		cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT32));	/* Capability */
+		cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT32));	/* reserved */
+		cmBufferReadUint64(&response.reader, &entry.linkSpeed);		/* LinkSpeed */
+		cmBufferReadUint16(&response.reader, &family);				/* sockaddr family */
+		cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT16));	/* port */
+		if (INTERFACEINFO_FAMILYIPV4 == family)
+		{
+			NQ_IPADDRESS4 ip4;
+
+			cmBufferReadBytes(&response.reader, (NQ_BYTE *)&ip4, sizeof(ip4));
+			CM_IPADDR_ASSIGN4(entry.ip, ip4);
+			isValid = (ip4 != 0);
+		}
+#ifdef UD_NQ_USETRANSPORTIPV6
+		else if (INTERFACEINFO_FAMILYIPV6 == family)
+		{
+			NQ_IPADDRESS6 ip6;
+
+			cmBufferReaderSkip(&response.reader, sizeof(NQ_UINT32));	/* flow info */
+			cmBufferReadBytes(&response.reader, (NQ_BYTE *)ip6, sizeof(ip6));
+			CM_IPADDR_ASSIGN6(entry.ip, ip6);
+			isValid = TRUE;
+		}
+#endif /* UD_NQ_USETRANSPORTIPV6 */
+
+		/* skip the main connection and duplicates */
+		if (isValid && CM_IPADDR_EQUAL(entry.ip, pServer->transport.preferredIp))
+			isValid = FALSE;
+		for (i = 0; isValid && i < numInterfaces; i++)
+		{
+			if (CM_IPADDR_EQUAL(entry.ip, interfaces[i].ip))
+				isValid = FALSE;
+		}
+
+		/* insert sorted by link speed keeping the fastest ones */
+		if (isValid)
+		{
+			for (i = numInterfaces; i > 0 && cmU64Cmp(&interfaces[i - 1].linkSpeed, &entry.linkSpeed) < 0; i--)
+			{
+				if (i < UD_CC_MAXCHANNELS)
+					interfaces[i] = interfaces[i - 1];
+			}
+			if (i < UD_CC_MAXCHANNELS)
+			{
+				interfaces[i] = entry;
+				if (numInterfaces < UD_CC_MAXCHANNELS)
+					numInterfaces++;
+			}
+		}
+
+		if (0 == next)
+			break;
+		entryOffset += next;
+	}
+
+Exit:
+	cmBufManGive(request.buffer);
+	cmBufManGive(response.buffer);
+	cmListItemUnlock((CMItem *)pShare);
+Exit2:
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "interfaces:%d", numInterfaces);
+	return numInterfaces;
+}
+
+/*
+ * Connect a channel to one server interface and negotiate the session dialect on it.
+ * On success the transport is left in setting up state so that binding can be done inline.
+ */
+static NQ_BOOL openChannel(CCServer * pServer, CCChannel * pChannel, const NQ_IPADDRESS * ip)
+{
+	Request request;				/* request descriptor */
+	CMBufferReader reader;			/* response reader */
+	CMSmb2Header header;			/* response header */
+	NQ_BYTE * pResponse = NULL;		/* response buffer */
+	NQ_COUNT packetLen;				/* packet length of both in and out packets */
+	NQ_UINT16 dialect;				/* negotiated dialect */
+	NQ_BYTE serverGUID[16];			/* server GUID on this channel */
+	NQ_UINT32 capabilities;			/* client capabilities */
+	NQ_BOOL result = FALSE;			/* return value */
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+	CMCaptureHeader captureHdr;		/* not used for channels */
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+#ifdef UD_NQ_INCLUDESMB311
+	NQ_UINT contextOffset;			/* offset in bytes */
+#endif /* UD_NQ_INCLUDESMB311 */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p channel:%p", pServer, pChannel);
+
+	request.buffer = NULL;
+	syMemset(pChannel, 0, sizeof(*pChannel));
+	pChannel->ip = *ip;
+	ccTransportInit(&pChannel->transport);
+	pChannel->transport.server = pServer;
+	if (!ccTransportConnect(&pChannel->transport, ip, 1, pServer->item.name, channelBrokenCallback, pChannel
+#ifdef UD_NQ_USETRANSPORTNETBIOS
+		,FALSE
+#endif /* UD_NQ_USETRANSPORTNETBIOS */
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+		,&captureHdr
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+		))
+	{
+		syMutexDelete(pChannel->transport.item.guard);
+		cmMemoryFree(pChannel->transport.item.guard);
+		pChannel->transport.item.guard = NULL;
+		LOGERR(CM_TRC_LEVEL_ERROR, "Failed to connect channel");
+		goto Exit;
+	}
+
+	if (!ccSmb20PrepareSingleRequest(&request, pServer, NULL, SMB2_CMD_NEGOTIATE))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		goto Error;
+	}
+
+	/* compose request - only the dialect of the session is offered */
+	request.header.mid = pChannel->mid;
+	cmU64Inc(&pChannel->mid);
+	cmSmb2HeaderWrite(&request.header, &request.writer);
+	cmBufferWriteUint16(&request.writer, commandDescriptors[SMB2_CMD_NEGOTIATE].requestStructSize);
+	cmBufferWriteUint16(&request.writer, 1);							/* number of dialects */
+	cmBufferWriteUint16(&request.writer, nqGetMessageSigning()? 1: 0);	/* signing: enabled */
+	cmBufferWriteUint16(&request.writer, 0);							/* reserved */
+	capabilities = SMB2_CAPABILITY_ENCRYPTION | SMB2_CAPABILITY_LARGE_MTU | SMB2_CAPABILITY_MULTI_CHANNEL;
+	cmBufferWriteUint32(&request.writer, capabilities);					/* capabilities */
+	cmBufferWriteUint32(&request.writer, pServer->clientGuidPartial);	/* client GUID - same as on the main connection */
+	cmBufferWriteZeroes(&request.writer, 12);							/* client GUID */
+#ifdef UD_NQ_INCLUDESMB311
+	if (SMB3_1_1_DIALECTREVISION == pServer->serverDialectRevision)
+	{
+		contextOffset = cmSmb2HeaderGetWriterOffset(&request.header, &request.writer);
+		contextOffset += 2 + 4 + 2 + 2;	/* dialect + offset (32) + count (2) + reserved (2)*/
+		contextOffset += contextOffset % 8? 8 - contextOffset % 8 : 0;
+		cmBufferWriteUint32(&request.writer, contextOffset);			/* context offset in bytes */
+		cmBufferWriteUint16(&request.writer, 2);						/* context count */
+		cmBufferWriteUint16(&request.writer, 0);						/* reserved */
+		cmBufferWriteUint16(&request.writer, pServer->serverDialectRevision);
+
+		cmBufferWriterAlign(&request.writer, request.header._start, 8); 				/* 8 byte alignment */
+		cmBufferWriteUint16(&request.writer, SMB2_PREAUTH_INTEGRITY_CAPABILITIES);		/* context type  */
+		cmBufferWriteUint16(&request.writer, SMB2_PREAUTH_INTEGRITY_CONTEXT_LEN_BYTES );/* context length bytes  */
+		cmBufferWriteUint32(&request.writer, 0);										/* reserved */
+		cmBufferWriteUint16(&request.writer, 1);										/* hash algorithm count */
+		cmBufferWriteUint16(&request.writer, SMB2_PREAUTH_INTEGRITY_SALT_SIZE);			/* salt length */
+		cmBufferWriteUint16(&request.writer, SHA_512);          					  	/* hash algorithm/s */
+		cmBufferWriteRandomBytes(&request.writer, SMB2_PREAUTH_INTEGRITY_SALT_SIZE);	/* salt bytes */
+		cmBufferWriterAlign(&request.writer, request.header._start, 8); 				/* 8 byte alignment */
+		cmBufferWriteUint16(&request.writer, SMB2_ENCRYPTION_CAPABILITIES);     		/* context type */
+		cmBufferWriteUint16(&request.writer, SMB2_ENCRYPTION_CCONTEXT_LEN_BYTES); 		/* data length */
+		cmBufferWriteUint32(&request.writer, 0);                                		/* reserved(4) */
+		cmBufferWriteUint16(&request.writer, 2);                                		/* cipher count */
+		cmBufferWriteUint16(&request.writer, CIPHER_AES128GCM);                			/* optional cipher */
+		cmBufferWriteUint16(&request.writer, CIPHER_AES128CCM);                			/* optional cipher */
+	}
+	else
+#endif /* UD_NQ_INCLUDESMB311 */
+	{
+		cmBufferWriteZeroes(&request.writer, 8);						/* client start time */
+		cmBufferWriteUint16(&request.writer, pServer->serverDialectRevision);
+	}
+	packetLen = cmBufferWriterGetDataCount(&request.writer) - 4;		/* NBT header */
+
+#ifdef UD_NQ_INCLUDESMB311
+	if (SMB3_1_1_DIALECTREVISION == pServer->serverDialectRevision)
+		cmSmb311CalcMessagesHash(request.header._start, packetLen, pChannel->preauthIntegHashVal, NULL);
+#endif /* UD_NQ_INCLUDESMB311 */
+
+	/* send and receive inline since the channel is still setting up */
+	ccTransportLock(&pChannel->transport);
+	if (!ccTransportSendSync(&pChannel->transport, request.buffer, packetLen, packetLen))
+	{
+		ccTransportUnlock(&pChannel->transport);
+		goto Error;
+	}
+	pResponse = ccTransportReceiveAll(&pChannel->transport, &packetLen);
+	ccTransportUnlock(&pChannel->transport);
+	if (NULL == pResponse)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "No negotiate response on channel");
+		goto Error;
+	}
+
+	/* parse response */
+	cmBufferReaderInit(&reader, pResponse, packetLen);
+	cmSmb2HeaderRead(&header, &reader);
+	if (SMB_STATUS_SUCCESS != header.status)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Channel negotiate failed: 0x%x", header.status);
+		goto Error;
+	}
+	pChannel->credits = header.credits;		/* the initial credit was spent on the negotiate */
+	cmBufferReaderSkip(&reader, sizeof(NQ_UINT16));	/* structure size */
+	cmBufferReaderSkip(&reader, sizeof(NQ_UINT16));	/* security mode */
+	cmBufferReadUint16(&reader, &dialect);			/* dialect revision */
+	if (dialect != pServer->serverDialectRevision)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Dialect mismatch on channel: 0x%x", dialect);
+		goto Error;
+	}
+	cmBufferReaderSkip(&reader, sizeof(NQ_UINT16));	/* context count or reserved */
+	cmBufferReadBytes(&reader, serverGUID, sizeof(serverGUID));	/* server GUID */
+	if (0 != syMemcmp(serverGUID, pServer->serverGUID, sizeof(serverGUID)))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Interface belongs to another server");
+		goto Error;
+	}
+#ifdef UD_NQ_INCLUDESMB311
+	if (SMB3_1_1_DIALECTREVISION == pServer->serverDialectRevision)
+		cmSmb311CalcMessagesHash(pResponse, packetLen, pChannel->preauthIntegHashVal, NULL);
+#endif /* UD_NQ_INCLUDESMB311 */
+	result = TRUE;
+	goto Exit;
+
+Error:
+	closeChannel(pChannel);
+
+Exit:
+	cmBufManGive(request.buffer);
+	cmBufManGive(pResponse);
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
+	return result;
+}
+
+/* derive the channel signing key from the signing key of the binding authentication */
+static NQ_BOOL deriveChannelKey(BindContext * pContext)
+{
+	CMBlob * macKey = &pContext->macKey;
+
+	if (NULL == macKey->data)
+		return FALSE;
+	if (macKey->len > pContext->server->smb->maxSigningKeyLen)
+		macKey->len = pContext->server->smb->maxSigningKeyLen;  /* restrict bigger keys */
+
+	cmMemoryFreeBlob(&pContext->channelKey);
+	pContext->channelKey.data = (NQ_BYTE *)cmMemoryAllocate(macKey->len);
+	if (NULL == pContext->channelKey.data)
+		return FALSE;
+	pContext->channelKey.len = macKey->len;
+#ifdef UD_NQ_INCLUDESMB311
+	if (SMB3_1_1_DIALECTREVISION == pContext->server->serverDialectRevision)
+	{
+		cmKeyDerivation(macKey->data, macKey->len, (NQ_BYTE*)"SMBSigningKey\0", 14, pContext->preauthIntegHashVal,
+			SMB3_PREAUTH_INTEG_HASH_LENGTH, pContext->channelKey.data);
+	}
+	else
+#endif /* UD_NQ_INCLUDESMB311 */
+	{
+		cmKeyDerivation(macKey->data, macKey->len, (NQ_BYTE*)"SMB2AESCMAC\0", 12, (NQ_BYTE*)"SmbSign\0", 8, pContext->channelKey.data);
+	}
+	return TRUE;
+}
+
+/*
+ * Security exchange callback for binding a user to a channel. Sends one binding SESSION_SETUP
+ * over the channel. The request is signed with the session signing key, the final response
+ * with the channel signing key.
+ */
+static NQ_STATUS bindSessionSetup(void * context, const CMBlob * outBlob, CMBlob * inBlob)
+{
+	BindContext * pContext = (BindContext *)context;
+	CCChannel * pChannel = pContext->channel;
+	CCUser * pUser = pContext->user;
+	Request request;				/* request descriptor */
+	CMBufferReader reader;			/* response reader */
+	CMSmb2Header header;			/* response header */
+	NQ_BYTE * pResponse = NULL;		/* response buffer */
+	NQ_COUNT packetLen;				/* request length */
+	NQ_COUNT responseLen;			/* response length */
+	NQ_UINT16 blobOffset;			/* offset from header to the security buffer */
+	NQ_UINT16 blobLength;			/* security buffer length */
+	CMBlob blob;					/* received blob */
+	NQ_STATUS res = NQ_ERR_LOGONFAILURE;	/* return value */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "channel:%p user:%p", pChannel, pUser);
+
+	inBlob->data = NULL;
+	inBlob->len = 0;
+	if (!ccSmb20PrepareSingleRequest(&request, pContext->server, pUser, SMB2_CMD_SESSIONSETUP))
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		res = NQ_ERR_OUTOFMEMORY;
+		goto Exit;
+	}
+
+	/* compose request */
+	request.header.flags |= SMB2_FLAG_SIGNED;
+	request.header.mid = pChannel->mid;
+	cmU64Inc(&pChannel->mid);
+	request.header.credits = (NQ_UINT16)(pChannel->credits < SMB2_CLIENT_MAX_CREDITS_TO_REQUEST ? SMB2_CLIENT_MAX_CREDITS_TO_REQUEST - pChannel->credits : 1);
+	cmSmb2HeaderWrite(&request.header, &request.writer);
+	cmBufferWriteUint16(&request.writer, commandDescriptors[SMB2_CMD_SESSIONSETUP].requestStructSize);
+	cmBufferWriteByte(&request.writer, SMB2_SESSIONSETUP_FLAGBINDING);	/* binding to an existing session */
+	cmBufferWriteByte(&request.writer, 1);								/* security mode: signing enabled */
+	cmBufferWriteUint32(&request.writer, 0);							/* capabilities */
+	cmBufferWriteUint32(&request.writer, 0);							/* channel */
+	cmBufferWriteUint16(&request.writer, (NQ_UINT16)(cmSmb2HeaderGetWriterOffset(&request.header, &request.writer) + 12));	/* blob offset */
+	cmBufferWriteUint16(&request.writer, (NQ_UINT16)outBlob->len);		/* blob length */
+	cmBufferWriteZeroes(&request.writer, 8);							/* previous session ID */
+	packetLen = cmBufferWriterGetDataCount(&request.writer) - 4;		/* NBT header */
+	request.tail = *outBlob;
+
+	cmSmb3CalculateMessageSignature(pUser->macSessionKey.data, pUser->macSessionKey.len, request.buffer + 4, (NQ_UINT)packetLen,
+		request.tail.data, request.tail.len, request.header._start + SMB2_SECURITY_SIGNATURE_OFFSET);
+
+#ifdef UD_NQ_INCLUDESMB311
+	if (SMB3_1_1_DIALECTREVISION == pContext->server->serverDialectRevision)
+	{
+		NQ_BYTE * packetBuf = cmBufManTake(packetLen + request.tail.len);
+
+		if (NULL == packetBuf)
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "Allocating memory for hashing message failed.");
+			res = NQ_ERR_OUTOFMEMORY;
+			goto Exit;
+		}
+		syMemcpy(packetBuf, request.buffer + 4, packetLen);
+		syMemcpy(packetBuf + packetLen, request.tail.data, request.tail.len);
+		cmSmb311CalcMessagesHash(packetBuf, packetLen + request.tail.len, pContext->preauthIntegHashVal, NULL);
+		cmBufManGive(packetBuf);
+	}
+#endif /* UD_NQ_INCLUDESMB311 */
+
+	ccTransportLock(&pChannel->transport);
+	pChannel->credits--;
+	if (!ccTransportSend(&pChannel->transport, request.buffer, packetLen + request.tail.len, packetLen)
+		|| (0 != request.tail.len && !ccTransportSendTail(&pChannel->transport, request.tail.data, request.tail.len)))
+	{
+		ccTransportUnlock(&pChannel->transport);
+		res = NQ_ERR_NOTCONNECTED;
+		goto Exit;
+	}
+	pResponse = ccTransportReceiveAll(&pChannel->transport, &responseLen);
+	ccTransportUnlock(&pChannel->transport);
+	if (NULL == pResponse)
+	{
+		res = NQ_ERR_NOTCONNECTED;
+		goto Exit;
+	}
+
+	/* parse response */
+	cmBufferReaderInit(&reader, pResponse, responseLen);
+	cmSmb2HeaderRead(&header, &reader);
+	pChannel->credits += header.credits;
+	if (SMB_STATUS_MORE_PROCESSING_REQUIRED == header.status)
+	{
+#ifdef UD_NQ_INCLUDESMB311
+		if (SMB3_1_1_DIALECTREVISION == pContext->server->serverDialectRevision)
+			cmSmb311CalcMessagesHash(pResponse, responseLen, pContext->preauthIntegHashVal, NULL);
+#endif /* UD_NQ_INCLUDESMB311 */
+	}
+	else if (SMB_STATUS_SUCCESS == header.status)
+	{
+		NQ_BYTE sigReceived[SMB2_SECURITY_SIGNATURE_SIZE];
+		NQ_BYTE * sig = pResponse + SMB2_SECURITY_SIGNATURE_OFFSET;
+
+		if (!deriveChannelKey(pContext))
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "No signing key for channel");
+			goto Exit;
+		}
+		syMemcpy(sigReceived, sig, sizeof(sigReceived));
+		syMemset(sig, 0, sizeof(sigReceived));
+		cmSmb3CalculateMessageSignature(pContext->channelKey.data, pContext->channelKey.len, pResponse, responseLen, NULL, 0, sig);
+		if (0 == (header.flags & SMB2_FLAG_SIGNED) || 0 != syMemcmp(sigReceived, sig, sizeof(sigReceived)))
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "Binding response signature mismatch");
+			cmMemoryFreeBlob(&pContext->channelKey);
+			res = NQ_ERR_SIGNATUREFAIL;
+			goto Exit;
+		}
+	}
+	else
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Binding failed: 0x%x", header.status);
+		res = (NQ_STATUS)ccErrorsStatusToNq(header.status, TRUE);
+		goto Exit;
+	}
+
+	cmBufferReaderSkip(&reader, sizeof(NQ_UINT16));	/* structure size */
+	cmBufferReaderSkip(&reader, sizeof(NQ_UINT16));	/* session flags */
+	cmBufferReadUint16(&reader, &blobOffset);		/* blob offset */
+	cmBufferReadUint16(&reader, &blobLength);		/* blob length */
+	res = NQ_SUCCESS;
+	if (blobLength > 0)
+	{
+		cmSmb2HeaderSetReaderOffset(&header, &reader, blobOffset);
+		blob.data = cmBufferReaderGetPosition(&reader);
+		blob.len = blobLength;
+		*inBlob = cmMemoryCloneBlob(&blob);
+		if (NULL == inBlob->data)
+			res = NQ_ERR_OUTOFMEMORY;
+	}
+
+Exit:
+	cmBufManGive(request.buffer);
+	cmBufManGive(pResponse);
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+	return res;
+}
+
+/* bind one user session to a channel and store the channel signing key */
+static NQ_BOOL bindChannel(CCServer * pServer, CCChannel * pChannel, CCUser * pUser)
+{
+	BindContext context;			/* binding context */
+	NQ_BOOL restrictCrypters;		/* whether to allow all crypters or not */
+	NQ_STATUS status;				/* SPNEGO status */
+	NQ_COUNT index = (NQ_COUNT)(pChannel - pServer->channels);	/* channel index */
+	NQ_BOOL result = FALSE;			/* return value */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p channel:%p user:%p", pServer, pChannel, pUser);
+
+	syMemset(&context, 0, sizeof(context));
+	context.server = pServer;
+	context.user = pUser;
+	context.channel = pChannel;
+#ifdef UD_NQ_INCLUDESMB311
+	syMemcpy(context.preauthIntegHashVal, pChannel->preauthIntegHashVal, sizeof(context.preauthIntegHashVal));
+#endif /* UD_NQ_INCLUDESMB311 */
+
+	restrictCrypters = (pServer->capabilities & CC_CAP_MESSAGESIGNING) && pServer->smb->restrictCrypters;
+	status = amSpnegoClientLogon(&context, pServer->item.name, pUser->credentials, restrictCrypters,
+		&pServer->firstSecurityBlob, &context.sessionKey, &context.macKey, bindSessionSetup);
+	if (AM_SPNEGO_SUCCESS == status && NULL != context.channelKey.data)
+	{
+		cmMemoryFreeBlob(&pUser->channelKeys[index]);
+		pUser->channelKeys[index] = context.channelKey;
+		result = TRUE;
+	}
+	else
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "User %s was not bound to channel, status: %d", cmWDump(pUser->credentials->user), status);
+		cmMemoryFreeBlob(&context.channelKey);
+	}
+	amSpnegoFreeKey(&context.sessionKey);
+	amSpnegoFreeKey(&context.macKey);
+
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
+	return result;
+}
+
+/* whether a user session may be bound to a channel */
+static NQ_BOOL isUserBindable(CCUser * pUser)
+{
+	return pUser->logged && !pUser->isAnonymous && !pUser->isGuest && NULL != pUser->macSessionKey.data && ccUserUseSignatures(pUser);
+}
+
+void ccSmb30AddChannels(CCServer * pServer)
+{
+	ServerInterface interfaces[UD_CC_MAXCHANNELS];	/* server interfaces to connect to */
+	NQ_COUNT numInterfaces;							/* number of interfaces */
+	CCUser ** users = NULL;							/* locked users to bind, the first one queries interfaces */
+	NQ_COUNT numUsers = 0;							/* number of users */
+	CMIterator iterator;							/* user iterator */
+	NQ_COUNT i;										/* just a counter */
+	NQ_COUNT j;										/* just a counter */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "server:%p", pServer);
+
+	cmListItemTake(&pServer->item);
+	if (pServer->channelsQueried || pServer->isReconnecting || NULL == pServer->smb
+		|| CCCIFS_ILLEGALSMBREVISION == pServer->smb->revision || pServer->smb->revision < SMB3_DIALECTREVISION
+		|| 0 == (pServer->serverCapabilites & SMB2_CAPABILITY_MULTI_CHANNEL))
+	{
+		cmListItemGive(&pServer->item);
+		goto Exit;
+	}
+	pServer->channelsQueried = TRUE;
+
+	/* collect users that can sign, the exchanges below are done without holding the server or the user list */
+	ccServerIterateUsers(pServer, &iterator);
+	while (cmListIteratorHasNext(&iterator))
+	{
+		if (isUserBindable((CCUser *)cmListIteratorNext(&iterator)))
+			numUsers++;
+	}
+	cmListIteratorTerminate(&iterator);
+	if (numUsers > 0)
+	{
+		users = (CCUser **)cmMemoryAllocate((NQ_UINT)(numUsers * sizeof(CCUser *)));
+		if (NULL == users)
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+			numUsers = 0;
+		}
+		else
+		{
+			numUsers = 0;
+			ccServerIterateUsers(pServer, &iterator);
+			while (cmListIteratorHasNext(&iterator))
+			{
+				CCUser * pUser = (CCUser *)cmListIteratorNext(&iterator);
+
+				if (isUserBindable(pUser))
+				{
+					cmListItemLock((CMItem *)pUser);
+					users[numUsers++] = pUser;
+				}
+			}
+			cmListIteratorTerminate(&iterator);
+		}
+	}
+	cmListItemGive(&pServer->item);
+	if (0 == numUsers)
+	{
+		LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "No signing user to bind channels with");
+		goto Exit;
+	}
+
+	numInterfaces = queryInterfaces(pServer, users[0], interfaces);
+	for (i = 0; i < numInterfaces; i++)
+	{
+		CCChannel * pChannel;
+		NQ_BOOL isOpen;
+		NQ_BOOL isBound = FALSE;
+
+		/* reserve the next slot, an inactive channel is not picked for requests */
+		cmListItemTake(&pServer->item);
+		if (!pServer->channelsQueried || pServer->numChannels >= UD_CC_MAXCHANNELS)
+		{
+			/* channels were dropped on reconnect meanwhile or all slots are used */
+			cmListItemGive(&pServer->item);
+			break;
+		}
+		pChannel = &pServer->channels[pServer->numChannels];
+		if (NULL != pChannel->transport.item.guard)
+		{
+			LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Previous channel in slot %d is still being released", pServer->numChannels);
+			cmListItemGive(&pServer->item);
+			break;
+		}
+		pServer->numChannels++;
+		cmListItemGive(&pServer->item);
+
+		isOpen = openChannel(pServer, pChannel, &interfaces[i].ip);
+		if (isOpen)
+		{
+			for (j = 0; j < numUsers; j++)
+			{
+				if (bindChannel(pServer, pChannel, users[j]))
+					isBound = TRUE;
+			}
+		}
+
+		cmListItemTake(&pServer->item);
+		if (!pServer->channelsQueried)
+		{
+			/* dropped while binding: the drop closed this channel */
+			cmListItemGive(&pServer->item);
+			break;
+		}
+		if (!isBound || !pChannel->transport.connected)
+		{
+			if (isOpen)
+				closeChannel(pChannel);
+
+			/* a channel that is still being released keeps its slot */
+			if (NULL == pChannel->transport.item.guard)
+				pServer->numChannels--;
+			cmListItemGive(&pServer->item);
+			continue;
+		}
+
+		/* from now on responses on this channel are processed in the receive thread */
+		ccTransportSetResponseCallback(&pChannel->transport, pServer->smb->anyResponseCallback, pServer);
+		pChannel->isActive = TRUE;
+		ccTransportDiscardSettingUp(&pChannel->transport);
+		LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Channel %d bound, credits: %d", pServer->numChannels, pChannel->credits);
+		cmListItemGive(&pServer->item);
+	}
+
+Exit:
+	for (j = 0; j < numUsers; j++)
+	{
+		cmListItemUnlock((CMItem *)users[j]);
+	}
+	cmMemoryFree(users);
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
+
 #endif /* UD_NQ_INCLUDESMB3 */
 #endif /* UD_NQ_INCLUDECIFSCLIENT */
@@ -66,4 +66,20 @@ void ccSmb30SetDialect(CCCifsSmb * smbDialect);
 
 NQ_STATUS ccSmb30DoNegotiateResponse(CCServer * pServer, const NQ_BYTE * data, NQ_COUNT len, CMBlob * pBlob);
 
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+/* Description
+   Open additional channels to a multichannel server and bind its user sessions to them.
+
+   The server interfaces are queried over IPC$. A channel is opened to each of the fastest
+   interfaces except for the one of the main connection. This function does nothing when
+   channels were already queried on the current connection or when the server does not
+   support multichannel.
+   Parameters
+   pServer : Server object pointer.
+   Returns
+   None.
+ */
+void ccSmb30AddChannels(CCServer * pServer);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
 #endif /* _CCSMB20_H_	 */
@@ -19,12 +19,12 @@
 #include "cmfinddc.h"
 #include "cmlist.h"
 #include "ccserver.h"
-#ifdef UD_NQ_INCLUDESMBCAPTURE
 #include "nssocket.h"
-#endif /* UD_NQ_INCLUDESMBCAPTURE */
 
 /* -- Constants -- */
 #define TRANSPORT_IDLETIMEOUT (15*60) /* 15 min Timeout for transport , this mimics windows disconnection after 15 min*/
+#define CONNECT_STAGGER 250           /* msec to wait for a connection attempt before starting the next one in parallel */
+#define CONNECT_TIMEOUT (20*1000)     /* msec to wait for pending attempts after the last one was started */
 
 
 /*#define SIMULATE_DISCONNECT*/ /* simulate transport disconnect - debug purposes only */
@@ -171,7 +171,8 @@ static void receiveThreadBody(void)
                         		pTransport->doDisconnect = TRUE;
                         		pTransport->connected = FALSE;
 								pServer->smb->signalAllMatch(pTransport);
-                        	    pServer->connectionBroke = TRUE;
+								if (pTransport == &pServer->transport)	/* an additional channel does not break the session */
+	                        	    pServer->connectionBroke = TRUE;
 								cmListItemGive((CMItem *)pServer);
                         	}
 
@@ -192,16 +193,33 @@ static void receiveThreadBody(void)
 	} /* while (doReceive) */
 }
 
+/* one address/transport combination to connect over */
+typedef struct
+{
+    NSSocketHandle socket;      /* socket being connected or NULL */
+    NQ_IPADDRESS ip;            /* server address */
+    NQ_UINT transportType;      /* transport to use */
+}
+ConnectAttempt;
+
+/* milliseconds passed since the given time */
+static NQ_UINT32 elapsedMsec(const NQ_TIME * since)
+{
+    NQ_TIME curr = syGetTimeInMsec();
+    NQ_TIME diff;
+
+    cmU64SubU64U64(&diff, &curr, since);
+    return diff.low;
+}
+
 /*
- * An attempt to connect server 
+ * Start an attempt to connect server
  */
-static NSSocketHandle connectOneTransportByOneIp(NQ_INT transportType, const NQ_IPADDRESS * ip, CMNetBiosNameInfo * nbInfo)
+static NSSocketHandle startOneTransportByOneIp(NQ_INT transportType, const NQ_IPADDRESS * ip, CMNetBiosNameInfo * nbInfo)
 {
-    NQ_STATUS res;              /* operation result */
     NSSocketHandle socket;      /* socket handle */
 
 	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "transportType:%d ip:%p nbInfo:%p", transportType, ip, nbInfo);
-    /*LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Transport: %d", transportType);*/
 
     /* Create TCP socket */
     socket = nsSocket(NS_SOCKET_STREAM, (NQ_UINT)transportType);
@@ -211,24 +229,111 @@ static NSSocketHandle connectOneTransportByOneIp(NQ_INT transportType, const NQ_
         goto Exit;
     }
 
-    /* Connect to remote Server */
-    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "before nsConnect: %s", nbInfo->name);
-    res = nsConnect(socket, (NQ_IPADDRESS *)ip, nbInfo);
-    if (res == NQ_FAIL)
+    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "before nsConnectStart: %s, %s", cmIPDump(ip), nbInfo->name);
+    if (nsConnectStart(socket, (NQ_IPADDRESS *)ip, nbInfo) == NQ_FAIL)
     {
         nsClose(socket);
         socket = NULL;
-        LOGERR(CM_TRC_LEVEL_ERROR, "nsConnect() failed");
+        LOGERR(CM_TRC_LEVEL_ERROR, "nsConnectStart() failed");
         goto Exit;
     }
 
-    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Connected to %s, %s", cmIPDump(ip), nbInfo->name);
-
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", socket);
     return socket;
 }
 
+/*
+ * Connect server over the first address/transport that answers. Attempts are started
+ * one by one in the given order, the next one is started when the previous did not
+ * complete within CONNECT_STAGGER or failed. Returns the index of the winning attempt
+ * or NQ_FAIL. All other sockets are closed.
+ */
+static NQ_INT connectParallel(ConnectAttempt * attempts, NQ_INT numAttempts, CMNetBiosNameInfo * nbInfo)
+{
+    NQ_TIME startTime;          /* when the first attempt was started */
+    NQ_UINT32 nextStart = 0;    /* when to start the next attempt (msec since start) */
+    NQ_UINT32 lastStart = 0;    /* when the last attempt was started (msec since start) */
+    NQ_INT next = 0;            /* next attempt to start */
+    NQ_INT pending = 0;         /* number of attempts in progress */
+    NQ_INT i;                   /* just a counter */
+    NQ_INT result = NQ_FAIL;    /* return value */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "attempts:%p numAttempts:%d nbInfo:%p", attempts, numAttempts, nbInfo);
+
+    startTime = syGetTimeInMsec();
+    for (;;)
+    {
+        SYSocketSet socketSet;  /* write set */
+        NQ_UINT32 elapsed;      /* msec since start */
+        NQ_UINT32 timeout;      /* select timeout in msec */
+
+        elapsed = elapsedMsec(&startTime);
+        if (next < numAttempts && (pending == 0 || elapsed >= nextStart))
+        {
+            attempts[next].socket = startOneTransportByOneIp((NQ_INT)attempts[next].transportType, &attempts[next].ip, nbInfo);
+            if (NULL != attempts[next].socket)
+            {
+                pending++;
+                lastStart = elapsed;
+            }
+            nextStart = elapsed + CONNECT_STAGGER;
+            next++;
+            continue;
+        }
+        if (pending == 0 || elapsed - lastStart >= CONNECT_TIMEOUT)
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "No connection attempt succeeded");
+            goto Exit;
+        }
+
+        timeout = CONNECT_TIMEOUT - (elapsed - lastStart);
+        if (next < numAttempts && nextStart - elapsed < timeout)
+            timeout = nextStart - elapsed;
+
+        syClearSocketSet(&socketSet);
+        for (i = 0; i < next; i++)
+        {
+            if (NULL != attempts[i].socket)
+                syAddSocketToSet(((SocketSlot *)attempts[i].socket)->socket, &socketSet);
+        }
+        if (NQ_FAIL == sySelectConnectSocket(&socketSet, timeout))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "sySelectConnectSocket() failed");
+            goto Exit;
+        }
+
+        for (i = 0; i < next; i++)
+        {
+            if (NULL == attempts[i].socket || !syIsSocketSet(((SocketSlot *)attempts[i].socket)->socket, &socketSet))
+                continue;
+
+            if (NQ_SUCCESS == nsConnectComplete(attempts[i].socket, &attempts[i].ip, nbInfo))
+            {
+                LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Connected to %s, %s", cmIPDump(&attempts[i].ip), nbInfo->name);
+                result = i;
+                goto Exit;
+            }
+            LOGERR(CM_TRC_LEVEL_ERROR, "nsConnectComplete() failed");
+            nsClose(attempts[i].socket);
+            attempts[i].socket = NULL;
+            pending--;
+        }
+    }
+
+Exit:
+    for (i = 0; i < next; i++)
+    {
+        if (i != result && NULL != attempts[i].socket)
+        {
+            nsClose(attempts[i].socket);
+            attempts[i].socket = NULL;
+        }
+    }
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", result);
+    return result;
+}
+
 
 /* -- API Functions */
 
@@ -319,6 +424,7 @@ void ccTransportInit(CCTransport * transport)
 {
     transport->connected = FALSE;
     transport->callback  = NULL;
+    transport->preferredTransport = 0;
     cmListItemInit(&transport->item);
 }
 
@@ -337,11 +443,13 @@ NQ_BOOL ccTransportConnect(
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
     )
 {
-    NSSocketHandle socket;		/* resulting handle */
     CMNetBiosNameInfo nbInfo;	/* NetBIOS name information */
     NQ_CHAR * aHost = NULL;		/* host name in ASCII */
     NQ_UINT * transportTypes = NULL;   /* transport types ordered by priorities */
     NQ_UINT * transportList = NULL;   /* transport types ordered by priorities */
+    ConnectAttempt * attempts = NULL; /* address/transport combinations to try */
+    NQ_INT numAttempts = 0;           /* number of combinations */
+    NQ_INT winner;                    /* index of the connected combination */
     NQ_BOOL result = FALSE;
 #ifdef UD_NQ_USETRANSPORTNETBIOS
     NQ_BOOL hasNBTransport = FALSE;
@@ -400,6 +508,14 @@ NQ_BOOL ccTransportConnect(
     }
 #endif /* UD_NQ_USETRANSPORTNETBIOS */
 
+    attempts = (ConnectAttempt *)cmMemoryAllocate((NQ_UINT)(sizeof(ConnectAttempt) * (NQ_UINT)numIps * (cmGetNumOfAvailableTransports() + 1)));
+	if (NULL == attempts)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		goto Exit;
+	}
+
+    /* compose address/transport combinations in the order of transport priorities */
     for (cmGetTransportPriorities(transportList); *transportTypes != 0; transportTypes++)
     {
     	NQ_INT i;	/* just a counter */
@@ -423,39 +539,59 @@ NQ_BOOL ccTransportConnect(
             }
 #endif /* UD_NQ_USETRANSPORTNETBIOS */
 
-		    if (NULL != (socket = connectOneTransportByOneIp((NQ_INT)*transportTypes, &ips[i], &nbInfo)))
-		    {
-#ifdef UD_NQ_INCLUDESMBCAPTURE
-		    	{
-		    		SocketSlot *	serverSock = (SocketSlot *)socket;
-		    		NQ_IPADDRESS 	serverIp;
-		    		NQ_PORT			serverPort;
-
-		    		syGetSocketPortAndIP(serverSock->socket , &serverIp , &serverPort);
-
-		    		captureHdr->dstIP = ips[i];
-		    		captureHdr->dstPort = *transportTypes == NS_TRANSPORT_NETBIOS ? CM_NB_SESSIONSERVICEPORT : CM_NB_SESSIONSERVICEPORTIP ;
-		    		captureHdr->srcIP = serverIp;
-		    		captureHdr->srcPort = 0;
-		    		captureHdr->receiving = FALSE;
-		    	}
-#endif /* UD_NQ_INCLUDESMBCAPTURE */
-			    pTransport->socket = socket;
-			    pTransport->connected = TRUE;
-                pTransport->isReceiving = TRUE;
-                pTransport->isSettingUp = TRUE;
-                syMutexCreate(&pTransport->guard);
-			    cmListItemAdd(&connections, (CMItem *)pTransport, NULL);
-                notifyListChange();
-				result = TRUE;
-			    goto Exit;
-		    }
+            attempts[numAttempts].socket = NULL;
+            attempts[numAttempts].ip = ips[i];
+            attempts[numAttempts].transportType = *transportTypes;
+
+            /* the combination that succeeded last time goes first */
+            if (pTransport->preferredTransport == *transportTypes && CM_IPADDR_EQUAL(pTransport->preferredIp, ips[i]) && numAttempts > 0)
+            {
+                ConnectAttempt preferred = attempts[numAttempts];
+
+                syMemmove(&attempts[1], &attempts[0], sizeof(ConnectAttempt) * (NQ_UINT)numAttempts);
+                attempts[0] = preferred;
+            }
+            numAttempts++;
 		}
     }
 
+    winner = connectParallel(attempts, numAttempts, &nbInfo);
+    if (NQ_FAIL == winner)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to connect %s", cmWDump(host));
+        goto Exit;
+    }
+
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+	{
+		SocketSlot *	serverSock = (SocketSlot *)attempts[winner].socket;
+		NQ_IPADDRESS 	serverIp;
+		NQ_PORT			serverPort;
+
+		syGetSocketPortAndIP(serverSock->socket , &serverIp , &serverPort);
+
+		captureHdr->dstIP = attempts[winner].ip;
+		captureHdr->dstPort = attempts[winner].transportType == NS_TRANSPORT_NETBIOS ? CM_NB_SESSIONSERVICEPORT : CM_NB_SESSIONSERVICEPORTIP ;
+		captureHdr->srcIP = serverIp;
+		captureHdr->srcPort = 0;
+		captureHdr->receiving = FALSE;
+	}
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    pTransport->preferredIp = attempts[winner].ip;
+    pTransport->preferredTransport = attempts[winner].transportType;
+    pTransport->socket = attempts[winner].socket;
+    pTransport->connected = TRUE;
+    pTransport->isReceiving = TRUE;
+    pTransport->isSettingUp = TRUE;
+    syMutexCreate(&pTransport->guard);
+    cmListItemAdd(&connections, (CMItem *)pTransport, NULL);
+    notifyListChange();
+    result = TRUE;
+
 Exit:
     cmMemoryFree(aHost);
     cmMemoryFree(transportList);
+    cmMemoryFree(attempts);
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", result ? "TRUE" : "FALSE");
     return result;
 }
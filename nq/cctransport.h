@@ -69,6 +69,8 @@ typedef struct _cctransport
     NQ_BOOL isWaitingDisconectCond;
     CMThreadCond disconnectCond;
     SYMutex guard;                          	/* Critical section guard for this transport. */
+    NQ_IPADDRESS preferredIp;					/* Server address of the last successful connection. */
+    NQ_UINT preferredTransport;					/* Transport of the last successful connection or zero. */
 }
 CCTransport;	/* Transport entry */	
 
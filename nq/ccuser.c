@@ -21,6 +21,9 @@
 
 #ifdef UD_NQ_INCLUDECIFSCLIENT
 
+/* -- Constants -- */
+#define SHARES_INDEXSIZE 8      /* initial number of buckets in the share index */
+
 /* -- Static data -- */
 
 static NQ_BOOL isInit = FALSE;
@@ -196,6 +199,7 @@ static CCUser * createUser(CCServer * pServer, const AMCredentialsW * pCredentia
 	pUser->server = pServer;
 	pUser->logged = FALSE;
 	cmListStart(&pUser->shares);
+	cmListIndexStart(&pUser->shares, SHARES_INDEXSIZE, FALSE);
     pUser->credentials = (AMCredentialsW *)cmMemoryAllocate(sizeof(AMCredentialsW));
 	if (NULL == pUser->credentials)
 	{
@@ -219,6 +223,9 @@ static CCUser * createUser(CCServer * pServer, const AMCredentialsW * pCredentia
 #ifdef UD_NQ_INCLUDESMB311
     pUser->isPreauthIntegOn = FALSE;
 #endif /* UD_NQ_INCLUDESMB311 */
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+    syMemset(pUser->channelKeys, 0, sizeof(pUser->channelKeys));
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #endif /* UD_NQ_INCLUDESMB3 */
    	pUser->isGuest = FALSE;
 #if SY_DEBUGMODE
@@ -474,12 +481,29 @@ void ccUserLogoff(CCUser * pUser)
 	cmMemoryFreeBlob(&pUser->encryptionKey);
 	cmMemoryFreeBlob(&pUser->decryptionKey);
 	cmMemoryFreeBlob(&pUser->applicationKey);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+	ccUserUnbindChannels(pUser);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #endif /* UD_NQ_INCLUDESMB3 */
 
 Exit:
 	LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
 
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+void ccUserUnbindChannels(CCUser * pUser)
+{
+	NQ_COUNT i;		/* channel index */
+
+	LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "user:%p", pUser);
+
+	for (i = 0; i < UD_CC_MAXCHANNELS; i++)
+		cmMemoryFreeBlob(&pUser->channelKeys[i]);
+
+	LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+}
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
 NQ_BOOL ccUserLogon(CCUser * pUser)
 {
 	NQ_STATUS status;	        /* SPNEGO status */
@@ -508,6 +532,9 @@ NQ_BOOL ccUserLogon(CCUser * pUser)
 	cmMemoryFreeBlob(&pUser->encryptionKey);
 	cmMemoryFreeBlob(&pUser->decryptionKey);
 	cmMemoryFreeBlob(&pUser->applicationKey);
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+	ccUserUnbindChannels(pUser);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #endif /* UD_NQ_INCLUDESMB3 */
 
 #ifdef UD_CC_INCLUDEEXTENDEDSECURITY
@@ -52,6 +52,9 @@ typedef struct _ccuser
 	NQ_BOOL isPreauthIntegOn;	/* is pre-authentication integrity validation on*/
 	NQ_BYTE preauthIntegHashVal[SMB3_PREAUTH_INTEG_HASH_LENGTH]; /* array to hold hash results of negotiate packets */
 #endif /* UD_NQ_INCLUDESMB311 */
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+	CMBlob channelKeys[UD_CC_MAXCHANNELS]; /* signing keys of this session on additional channels. NULL when not bound */
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
 #endif /* UD_NQ_INCLUDESMB3 */
 } CCUser; /* User logon. */
 
@@ -178,6 +181,16 @@ void ccUserLogoff(CCUser * pUser);
    TRUE on success or FALSE on failure. */
 NQ_BOOL ccUserLogon(CCUser * pUser);
 
+#ifdef UD_CC_INCLUDEMULTICHANNEL
+/* Description
+   Forget the bindings of this session to additional channels.
+   Parameters
+   pUser :  Pointer to the user object.
+   Returns
+   None. */
+void ccUserUnbindChannels(CCUser * pUser);
+#endif /* UD_CC_INCLUDEMULTICHANNEL */
+
 /* Description
    Reconnect existing shares.
    Parameters
@@ -19,29 +19,91 @@
 #include "cmparams.h"
 #include "udconfig.h"
 
+/* --- Capture ring ---
+ * Packets are copied into a ring of fixed size records and written to disk by a background thread.
+ * Producers reserve a record with a compare-and-swap on ringHead and publish it by advancing the record
+ * sequence, so the only shared state touched per packet is a few atomic counters. A thread composes one
+ * packet at a time (start, payload, end); the record it is composing is found through the composer table.
+ * Shutdown clears 'initialized' and stops the writer, which exits once the composers are released; a
+ * producer re-checks the flag after taking its composer, so once no composer is used nobody touches the
+ * ring any more. When the writer does not exit in time, shutdown leaves the capture resources to it.
+ */
+#define RING_MASK			(UD_CM_CAPTURE_RINGSIZE - 1)
+#define MAX_NETHEADERS		(14 + 40 + 32 + 4)	/* ethernet + IPv6 + TCP + NetBIOS */
+#define MAX_COMPOSERS		32					/* threads composing a packet at the same time */
+#define WRITEBUFFER_SIZE	(64 * 1024)			/* writer thread output buffer */
+#define WRITER_TIMEOUT		1					/* seconds the writer sleeps when the ring is empty */
+#define SHUTDOWN_TIMEOUT	5					/* seconds to wait for producers and for the writer */
+#define WRITER_IDLE			0					/* no writer thread */
+#define WRITER_RUNNING		1					/* the writer thread runs, shutdown releases the resources */
+#define WRITER_ABANDONED	2					/* shutdown did not wait, the writer releases the resources */
+
+typedef struct
+{
+	volatile NQ_UINT32 sequence;	/* position + 1 when published, position + ring size when free again */
+	NQ_UINT32 position;				/* ring position this record was reserved at */
+	NQ_TIME time;					/* capture time (msec) */
+	NQ_UINT32 originalLength;		/* packet length including the generated headers */
+	NQ_UINT32 length;				/* bytes kept in data */
+	NQ_UINT32 limit;				/* maximum bytes to keep for this packet */
+	NQ_BYTE data[MAX_NETHEADERS + UD_CM_CAPTURE_SNAPLEN];
+}
+CaptureRecord;
+
+typedef struct
+{
+	volatile NQ_UINT32 used;		/* non-zero while owned by a thread */
+	SYThread owner;					/* composing thread */
+	CaptureRecord * record;			/* record being composed or NULL when the packet is not captured */
+}
+Composer;
+
 /* --- Static Data --- */
 static SYFile file = syInvalidFile();
-static NQ_BOOL initialized = FALSE;
-static SYMutex	fileGuard;
-static SYMutex  staticGuard;
-static NQ_UINT  totalPacketLen = 0 ;
+static volatile NQ_BOOL initialized = FALSE;
+static CaptureRecord * ring = NULL;
+static volatile NQ_UINT32 ringHead = 0;		/* next position to reserve - producers */
+static NQ_UINT32 ringTail = 0;				/* next position to write - writer thread */
+static Composer composers[MAX_COMPOSERS];
+static NQ_UINT snapLength = UD_CM_CAPTURE_SNAPLEN;
+static volatile NQ_UINT32 filterVersion = 0;	/* odd while the filter is being changed */
+static volatile NQ_BOOL filterActive = FALSE;
+static NQ_IPADDRESS filterIp;
+static NQ_PORT filterPort = 0;
+static CMCaptureStatistics statistics;
+static SYThread writerThread;
+static CMThreadCond writerWakeup;			/* signalled when half of the ring has been filled */
+static CMThreadCond writerDone;				/* signalled when the writer exits */
+static volatile NQ_BOOL writerStop = FALSE;
+static volatile NQ_UINT32 writerState = WRITER_IDLE;
+static NQ_BYTE * writeBuffer = NULL;
+static NQ_UINT writeBufferUsed = 0;
+static NQ_UINT32 fileSize = 0;
+static NQ_CHAR fileName[UD_FS_MAXPATHLEN];	/* current capture file, rotated files get a .<n> suffix */
 #ifdef UD_NQ_USETRANSPORTIPV4
-static NQ_UINT16 IPv4Id = 1;
+static volatile NQ_UINT32 IPv4Id = 1;
 #endif /* UD_NQ_USETRANSPORTIPV4 */
 
-/* --- PCAP Header constants ---*/
-static const NQ_BYTE pcapBlockOrderMagic[] = {0xD4 , 0XC3 , 0xB2 , 0xA1};
-static const NQ_BYTE pcapBlockVersion[]    = {0x02 , 0x00 , 0x04 , 0x00};
-static const NQ_BYTE pcapBlockSnapLen[]    = {0xFF , 0xFF , 0x00 , 0x00};
-static const NQ_UINT pcapFileHeaderSize = sizeof(pcapBlockOrderMagic) + sizeof(pcapBlockVersion) + sizeof(pcapBlockSnapLen) + 3 + 9;
-static const NQ_BYTE pcapHeaderLen = sizeof(NQ_UINT32) * 4;
+/* --- PCAPNG block constants --- */
+#define PCAPNG_SHB			0x0A0D0D0A		/* section header block */
+#define PCAPNG_IDB			0x00000001		/* interface description block */
+#define PCAPNG_ISB			0x00000005		/* interface statistics block */
+#define PCAPNG_EPB			0x00000006		/* enhanced packet block */
+#define PCAPNG_BYTEORDER	0x1A2B3C4D
+#define PCAPNG_SHBSIZE		28
+#define PCAPNG_IDBSIZE		32
+#define PCAPNG_ISBSIZE		40
+#define PCAPNG_EPBSIZE		32				/* without packet data */
+#define PCAPNG_LINKETHERNET	1
+#define PCAPNG_IFTSRESOL	9				/* if_tsresol option */
+#define PCAPNG_TSRESOLMSEC	3				/* timestamps in 10^-3 seconds */
+#define PCAPNG_ISBIFDROP	5				/* isb_ifdrop option */
 
 /* --- Ethernet Header --- */
 static const NQ_BYTE ethernetHeader[] = { 0x01 , 0x02 , 0x03 , 0x04 , 0x05 , 0x06 , 0x11 ,
 										  0x12 , 0x13 , 0x14 , 0x15 , 0x16};
 static const NQ_BYTE ethernetIPv4[] = {0x08 , 0x00};
 static const NQ_BYTE ethernetIPv6[] = {0x86 , 0xdd};
-static const NQ_INT ethernetHeaderLength = 14;
 
 /* --- IPv4 Header Constants --- */
 static const NQ_INT ipv4HeaderLength = 20;
@@ -58,77 +120,97 @@ static const NQ_INT tcpHeaderLength = 32;
 static const NQ_BYTE tcpHeaderLen =  0x80;
 static const NQ_BYTE tcpFlags = 0x10;
 static const NQ_BYTE tcpWindowSize[] = { 1 , 0 };
-static NQ_UINT32  sequenceNumber = 1;
+static volatile NQ_UINT32 sequenceNumber = 1;
 
 static const NQ_INT netBiosHeaderLength = 4;
 
-/* --- Constants For Large Packets --- */
-/*
- * maxPacketLen -> Maximal Length of the packet, if the length is larger than this constant the packet will be cut.
- * cutPacketLen -> Size of the packet after it has been cut.
- */
-static const NQ_UINT maxPacketLen = 10240 , cutPacketLen = 10225;
-
 /* --- static functions --- */
-static void preparePcapFile(NQ_BYTE * buffer);
-static void preparePcapHeader(CMBufferWriter * writer , NQ_UINT length , NQ_BOOL isIpv6);
 static NQ_BOOL prepareIpHeader(const CMCaptureHeader * header , CMBufferWriter * writer , NQ_UINT length);
 static void prepareTcpHeader(const CMCaptureHeader * header , CMBufferWriter * writer , NQ_UINT length);
 static void prepareNetBiosHeader(NQ_BYTE * buffer , NQ_UINT length);
-static NQ_INT writeToFile(const NQ_BYTE *buffer, NQ_UINT32 size);
-
-static NQ_BOOL captureWrite = FALSE;
+static NQ_BOOL filterMatch(const CMCaptureHeader * header);
+static Composer * composerFind(void);
+static Composer * composerTake(void);
+static void composerRelease(Composer * composer);
+static NQ_BOOL composersIdle(void);
+static CaptureRecord * ringReserve(void);
+static void ringPublish(CaptureRecord * record);
+static void ringDrain(void);
+static void writerThreadBody(void);
+static void writeRecord(const CaptureRecord * record);
+static void writeFileHeader(void);
+static void writeStatistics(void);
+static void writeFlush(void);
+static void makeFileName(NQ_WCHAR * name , NQ_INT index);
+static NQ_BOOL fileOpen(void);
+static void fileRotate(void);
+static void captureRelease(void);
 
 NQ_BOOL cmCaptureStart(void)
 {
-	static NQ_WCHAR filename[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN)];
-	NQ_BYTE * pcapFileHeader = NULL;
-	NQ_UINT	  res = 0;
+	NQ_UINT32 i;
 	NQ_BOOL   result = FALSE;
 
 	if (!initialized)
 	{
-		NQ_WCHAR *nameW;
-		NQ_WCHAR pathSep[CM_BUFFERLENGTH(NQ_WCHAR, 2)];
-		pcapFileHeader = (NQ_BYTE *)cmMemoryAllocate(pcapFileHeaderSize);
-		cmAnsiToUnicode(filename, NQ_CONFIGPATH);
+		if (WRITER_IDLE != writerState)
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "previous capture writer is still running");
+			goto Exit;
+		}
+		syStrcpy(fileName, NQ_CONFIGPATH);
 		if (NQ_CONFIGPATH[syStrlen(NQ_CONFIGPATH) - 1] != SY_PATHSEPARATOR)
 		{
-			pathSep[0] = cmWChar(SY_PATHSEPARATOR);
-			pathSep[sizeof(NQ_WCHAR)] = cmWChar(0);
-			syWStrcat(filename, pathSep);
+			NQ_CHAR pathSep[2];
+
+			pathSep[0] = SY_PATHSEPARATOR;
+			pathSep[1] = '\0';
+			syStrcat(fileName, pathSep);
 		}
-		nameW = cmMemoryCloneAString(UD_CM_CAPTURE_FILENAME);
-		syWStrcat(filename, nameW);
-		cmMemoryFree(nameW);
+		syStrcat(fileName, UD_CM_CAPTURE_FILENAME);
 
-		syDeleteFile(filename);
-		file = syCreateFile(filename, FALSE, FALSE, FALSE);
-		if (!syIsValidFile(file))
+		ring = (CaptureRecord *)cmMemoryAllocate((NQ_UINT)(sizeof(CaptureRecord) * UD_CM_CAPTURE_RINGSIZE));
+		writeBuffer = (NQ_BYTE *)cmMemoryAllocate(WRITEBUFFER_SIZE);
+		if (NULL == ring || NULL == writeBuffer)
 		{
-			syPrintf("Could not create capture file:%s, error: %d\n", cmWDump(filename), syGetLastError());
-			goto Exit;
+			syPrintf("Could not allocate capture buffers\n");
+			goto Error;
 		}
-
-		totalPacketLen = pcapFileHeaderSize;
-		syMutexCreate(&fileGuard);
-		syMutexCreate(&staticGuard);
-		preparePcapFile(pcapFileHeader);
-		res = (NQ_UINT)writeToFile(pcapFileHeader , (NQ_UINT32)pcapFileHeaderSize);
-		if (res != pcapFileHeaderSize)
+		for (i = 0; i < UD_CM_CAPTURE_RINGSIZE; i++)
+			ring[i].sequence = i;
+		ringHead = 0;
+		ringTail = 0;
+		writeBufferUsed = 0;
+		syMemset(composers , 0 , sizeof(composers));
+		syMemset(&statistics , 0 , sizeof(statistics));
+
+		if (!fileOpen())
+			goto Error;
+
+		if (!cmThreadCondSet(&writerWakeup))
+			goto Error1;
+		if (!cmThreadCondSet(&writerDone))
 		{
-			syPrintf("Could not write pcap header to file, error: %d\n", syGetLastError());
-			syCloseFile(file);
-			syDeleteFile(filename);
-			goto Exit;
+			cmThreadCondRelease(&writerWakeup);
+			goto Error1;
 		}
-
+		writerStop = FALSE;
+		writerState = WRITER_RUNNING;
 		initialized = TRUE;
+		syThreadStart(&writerThread, writerThreadBody, TRUE);
 	}
     result = TRUE;
-
+	goto Exit;
+
+Error1:
+	syCloseFile(file);
+	file = syInvalidFile();
+Error:
+	cmMemoryFree(ring);
+	ring = NULL;
+	cmMemoryFree(writeBuffer);
+	writeBuffer = NULL;
 Exit:
-	cmMemoryFree(pcapFileHeader);
 	return result;
 }
 
@@ -136,53 +218,372 @@ void cmCaptureShutdown(void)
 {
 	if (initialized)
 	{
+		/* stop producers: new packets are rejected, packets being composed are completed */
 		initialized = FALSE;
-		syMutexDelete(&fileGuard);
-		syMutexDelete(&staticGuard);
-		syCloseFile(file);
+		syMemoryBarrier();
+
+		/* the writer waits for the producers, drains what was published and exits */
+		writerStop = TRUE;
+		cmThreadCondSignal(&writerWakeup);
+		if (!cmThreadCondWait(&writerDone , SHUTDOWN_TIMEOUT))
+		{
+			if (syAtomicCompareAndSwap(&writerState , WRITER_RUNNING , WRITER_ABANDONED))
+			{
+				LOGERR(CM_TRC_LEVEL_ERROR, "capture writer did not complete, it releases the capture resources on exit");
+				return;
+			}
+			/* the writer has exited meanwhile, wait for its signal before releasing the condition */
+			cmThreadCondWait(&writerDone , SHUTDOWN_TIMEOUT);
+		}
+		captureRelease();
+	}
+}
+
+void cmCaptureSetFilter(const NQ_IPADDRESS * ip, NQ_PORT port)
+{
+	NQ_UINT32 version;
+
+	/* one thread changes the filter at a time, producers copy it again when it changed meanwhile */
+	do
+	{
+		version = filterVersion & ~(NQ_UINT32)1;
+	}
+	while (!syAtomicCompareAndSwap(&filterVersion , version , version + 1));
+	syMemoryBarrier();
+	if (NULL != ip)
+	{
+		filterIp = *ip;
+		filterPort = port;
+	}
+	filterActive = NULL != ip;
+	syMemoryBarrier();
+	filterVersion = version + 2;
+}
+
+void cmCaptureSetSnapLength(NQ_UINT length)
+{
+	snapLength = length > UD_CM_CAPTURE_SNAPLEN ? UD_CM_CAPTURE_SNAPLEN : length;
+}
+
+void cmCaptureGetStatistics(CMCaptureStatistics * stats)
+{
+	*stats = statistics;
+}
+
+/* packets of a connection are captured when the filter matches its remote or local end */
+static NQ_BOOL filterMatch(const CMCaptureHeader * header)
+{
+	NQ_IPADDRESS ip;
+	NQ_PORT port;
+	NQ_BOOL active;
+	NQ_UINT32 version;
+
+	if (!filterActive)
+		return TRUE;
+	do
+	{
+		version = filterVersion;
+		syMemoryBarrier();
+		active = filterActive;
+		ip = filterIp;
+		port = filterPort;
+		syMemoryBarrier();
+	}
+	while ((version & 1) != 0 || version != filterVersion);
+	if (!active)
+		return TRUE;
+	if (CM_IPADDR_EQUAL(header->srcIP , ip) && (port == 0 || port == header->srcPort))
+		return TRUE;
+	if (CM_IPADDR_EQUAL(header->dstIP , ip) && (port == 0 || port == header->dstPort))
+		return TRUE;
+	return FALSE;
+}
+
+static Composer * composerFind(void)
+{
+	SYThread self = syThreadGetCurrent();
+	NQ_INT i;
+
+	for (i = 0; i < MAX_COMPOSERS; i++)
+	{
+		if (composers[i].used && composers[i].owner == self)
+			return &composers[i];
+	}
+	return NULL;
+}
+
+static Composer * composerTake(void)
+{
+	NQ_INT i;
+
+	for (i = 0; i < MAX_COMPOSERS; i++)
+	{
+		if (!composers[i].used && syAtomicCompareAndSwap(&composers[i].used , 0 , 1))
+		{
+			composers[i].record = NULL;
+			composers[i].owner = syThreadGetCurrent();
+			return &composers[i];
+		}
+	}
+	return NULL;
+}
+
+static NQ_BOOL composersIdle(void)
+{
+	NQ_INT i;
+
+	for (i = 0; i < MAX_COMPOSERS; i++)
+	{
+		if (composers[i].used)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void composerRelease(Composer * composer)
+{
+	composer->record = NULL;
+	syMemset(&composer->owner , 0 , sizeof(composer->owner));
+	syMemoryBarrier();
+	composer->used = 0;
+}
+
+/* reserve the record at ringHead, NULL when the ring is full */
+static CaptureRecord * ringReserve(void)
+{
+	for (;;)
+	{
+		NQ_UINT32 position = ringHead;
+		CaptureRecord * record = &ring[position & RING_MASK];
+		NQ_INT32 diff = (NQ_INT32)(record->sequence - position);
+
+		if (diff == 0)
+		{
+			if (syAtomicCompareAndSwap(&ringHead , position , position + 1))
+			{
+				record->position = position;
+				return record;
+			}
+		}
+		else if (diff < 0)
+		{
+			return NULL;
+		}
+		/* another thread took this record meanwhile, retry with the new head */
+	}
+}
+
+static void ringPublish(CaptureRecord * record)
+{
+	NQ_UINT32 position = record->position;
+
+	syAtomicAdd(&statistics.captured , 1);
+	syMemoryBarrier();
+	record->sequence = position + 1;
+	/* wake the writer each time another half of the ring has been filled */
+	if (((position + 1) & (UD_CM_CAPTURE_RINGSIZE / 2 - 1)) == 0)
+		cmThreadCondSignal(&writerWakeup);
+}
+
+static void ringDrain(void)
+{
+	for (;;)
+	{
+		CaptureRecord * record = &ring[ringTail & RING_MASK];
+
+		if (record->sequence != ringTail + 1)
+			break;
+		syMemoryBarrier();
+		writeRecord(record);
+		syMemoryBarrier();
+		record->sequence = ringTail + UD_CM_CAPTURE_RINGSIZE;
+		ringTail++;
+	}
+	writeFlush();
+	if (fileSize >= UD_CM_CAPTURE_MAXFILESIZE)
+		fileRotate();
+}
+
+static void writerThreadBody(void)
+{
+	for (;;)
+	{
+		/* sampled before draining so that the last packets are written */
+		NQ_BOOL stop = writerStop && composersIdle();
+
+		ringDrain();
+		if (stop)
+			break;
+		cmThreadCondWait(&writerWakeup , WRITER_TIMEOUT);
 	}
+	writeStatistics();
+	writeFlush();
+	if (syAtomicCompareAndSwap(&writerState , WRITER_RUNNING , WRITER_IDLE))
+	{
+		cmThreadCondSignal(&writerDone);
+		return;
+	}
+	/* shutdown did not wait for us */
+	captureRelease();
+	syMemoryBarrier();
+	writerState = WRITER_IDLE;
 }
 
-static NQ_INT writeToFile(const NQ_BYTE *buffer, NQ_UINT32 size)
+/* release the capture resources once the writer has exited */
+static void captureRelease(void)
 {
-	NQ_BOOL		cutPacket = FALSE;
-	NQ_UINT 	remainingLen = totalPacketLen;
-	NQ_INT		res;
-
-	cutPacket = (cutPacketLen - totalPacketLen < size) ? TRUE : FALSE;
-	syMutexTake(&staticGuard);
-	totalPacketLen += (NQ_UINT)((cutPacket) ? (cutPacketLen - totalPacketLen) : size);
-	syMutexGive(&staticGuard);
-	res = syWriteFile(file , buffer , (NQ_COUNT)((cutPacket) ?  (cutPacketLen - remainingLen) : size));
-	return res;
+	syCloseFile(file);
+	file = syInvalidFile();
+	cmMemoryFree(writeBuffer);
+	writeBuffer = NULL;
+	cmMemoryFree(ring);
+	ring = NULL;
+	cmThreadCondRelease(&writerWakeup);
+	cmThreadCondRelease(&writerDone);
 }
 
-static void preparePcapFile(NQ_BYTE * buffer)
+static void writeRecord(const CaptureRecord * record)
 {
 	CMBufferWriter	writer;
+	NQ_UINT32		padded = (record->length + 3) & ~(NQ_UINT32)3;
+	NQ_UINT32		blockLength = PCAPNG_EPBSIZE + padded;
+
+	if (writeBufferUsed + blockLength > WRITEBUFFER_SIZE)
+		writeFlush();
+	cmBufferWriterInit(&writer , writeBuffer + writeBufferUsed , (NQ_COUNT)blockLength);
+	cmBufferWriteUint32(&writer , PCAPNG_EPB);
+	cmBufferWriteUint32(&writer , blockLength);
+	cmBufferWriteUint32(&writer , 0);		/* interface */
+	cmBufferWriteUint32(&writer , record->time.high);
+	cmBufferWriteUint32(&writer , record->time.low);
+	cmBufferWriteUint32(&writer , record->length);
+	cmBufferWriteUint32(&writer , record->originalLength);
+	cmBufferWriteBytes(&writer , record->data , (NQ_COUNT)record->length);
+	cmBufferWriteZeroes(&writer , (NQ_COUNT)(padded - record->length));
+	cmBufferWriteUint32(&writer , blockLength);
+	writeBufferUsed += (NQ_UINT)blockLength;
+}
 
-	cmBufferWriterInit(&writer , buffer , pcapFileHeaderSize);
-#ifdef SY_BIGENDIANHOST
-	cmBufferWriterSetByteOrder(&writer , FALSE); /* set buffer writer to stop rotating the value */
-#endif /* SY_BIGENDIANHOST */
-	cmBufferWriteBytes(&writer , pcapBlockOrderMagic , sizeof(pcapBlockOrderMagic));
-	cmBufferWriteBytes(&writer , pcapBlockVersion , sizeof(pcapBlockVersion));
-	cmBufferWriteZeroes(&writer , 8);
-	cmBufferWriteBytes(&writer , pcapBlockSnapLen , sizeof(pcapBlockSnapLen));
-	cmBufferWriteByte(&writer , 1);
+/* section header and the single (ethernet) interface, timestamps in msec */
+static void writeFileHeader(void)
+{
+	CMBufferWriter	writer;
+
+	cmBufferWriterInit(&writer , writeBuffer + writeBufferUsed , PCAPNG_SHBSIZE + PCAPNG_IDBSIZE);
+	cmBufferWriteUint32(&writer , PCAPNG_SHB);
+	cmBufferWriteUint32(&writer , PCAPNG_SHBSIZE);
+	cmBufferWriteUint32(&writer , PCAPNG_BYTEORDER);
+	cmBufferWriteUint16(&writer , 1);		/* version 1.0 */
+	cmBufferWriteUint16(&writer , 0);
+	cmBufferWriteUint32(&writer , 0xFFFFFFFF);	/* section length not specified */
+	cmBufferWriteUint32(&writer , 0xFFFFFFFF);
+	cmBufferWriteUint32(&writer , PCAPNG_SHBSIZE);
+
+	cmBufferWriteUint32(&writer , PCAPNG_IDB);
+	cmBufferWriteUint32(&writer , PCAPNG_IDBSIZE);
+	cmBufferWriteUint16(&writer , PCAPNG_LINKETHERNET);
+	cmBufferWriteUint16(&writer , 0);
+	cmBufferWriteUint32(&writer , (NQ_UINT32)(MAX_NETHEADERS + snapLength));
+	cmBufferWriteUint16(&writer , PCAPNG_IFTSRESOL);
+	cmBufferWriteUint16(&writer , 1);
+	cmBufferWriteByte(&writer , PCAPNG_TSRESOLMSEC);
 	cmBufferWriteZeroes(&writer , 3);
+	cmBufferWriteUint32(&writer , 0);		/* end of options */
+	cmBufferWriteUint32(&writer , PCAPNG_IDBSIZE);
+	writeBufferUsed += PCAPNG_SHBSIZE + PCAPNG_IDBSIZE;
+}
+
+/* drop counter, written when a file is closed */
+static void writeStatistics(void)
+{
+	CMBufferWriter	writer;
+	NQ_TIME			now = syGetTimeInMsec();
+
+	if (writeBufferUsed + PCAPNG_ISBSIZE > WRITEBUFFER_SIZE)
+		writeFlush();
+	cmBufferWriterInit(&writer , writeBuffer + writeBufferUsed , PCAPNG_ISBSIZE);
+	cmBufferWriteUint32(&writer , PCAPNG_ISB);
+	cmBufferWriteUint32(&writer , PCAPNG_ISBSIZE);
+	cmBufferWriteUint32(&writer , 0);		/* interface */
+	cmBufferWriteUint32(&writer , now.high);
+	cmBufferWriteUint32(&writer , now.low);
+	cmBufferWriteUint16(&writer , PCAPNG_ISBIFDROP);
+	cmBufferWriteUint16(&writer , 8);
+	cmBufferWriteUint32(&writer , statistics.dropped);
+	cmBufferWriteUint32(&writer , 0);
+	cmBufferWriteUint32(&writer , 0);		/* end of options */
+	cmBufferWriteUint32(&writer , PCAPNG_ISBSIZE);
+	writeBufferUsed += PCAPNG_ISBSIZE;
+}
+
+static void writeFlush(void)
+{
+	NQ_INT res;
+
+	if (writeBufferUsed == 0)
+		return;
+	res = syWriteFile(file , writeBuffer , (NQ_COUNT)writeBufferUsed);
+	if (res != (NQ_INT)writeBufferUsed)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "capture write failed, error: %d", syGetLastError());
+	}
+	fileSize += writeBufferUsed;
+	writeBufferUsed = 0;
+}
+
+/* index 0 is the current file, older ones are <name>.1 ... <name>.<UD_CM_CAPTURE_MAXFILES - 1> */
+static void makeFileName(NQ_WCHAR * name , NQ_INT index)
+{
+	NQ_CHAR nameA[UD_FS_MAXPATHLEN + 8];
+
+	if (index == 0)
+		syStrcpy(nameA , fileName);
+	else
+		sySprintf(nameA , "%s.%d" , fileName , index);
+	cmAnsiToUnicode(name , nameA);
+}
+
+static NQ_BOOL fileOpen(void)
+{
+	NQ_WCHAR name[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN + 8)];
+
+	makeFileName(name , 0);
+	syDeleteFile(name);
+	file = syCreateFile(name, FALSE, FALSE, FALSE);
+	if (!syIsValidFile(file))
+	{
+		syPrintf("Could not create capture file:%s, error: %d\n", cmWDump(name), syGetLastError());
+		return FALSE;
+	}
+	fileSize = 0;
+	statistics.files++;
+	writeFileHeader();
+	writeFlush();
+	return TRUE;
 }
 
-static void preparePcapHeader(CMBufferWriter * writer , NQ_UINT length , NQ_BOOL isIpv6)
+static void fileRotate(void)
 {
-	NQ_UINT32	packetLen = (NQ_UINT32)length  + (NQ_UINT32)tcpHeaderLength + (NQ_UINT32)sizeof(ethernetHeader) + 2;
-	NQ_UINT32   timeMicroSec = 0;
-
-	packetLen += (NQ_UINT32)(isIpv6 ? ipv6HeaderLength : ipv4HeaderLength);
-	cmBufferWriteUint32(writer , (NQ_UINT32)syGetTimeInSec());
-	cmBufferWriteUint32(writer , timeMicroSec);
-	cmBufferWriteUint32(writer , cmHtol32(packetLen));
-	cmBufferWriteUint32(writer , cmHtol32(packetLen));
+	NQ_WCHAR oldName[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN + 8)];
+	NQ_WCHAR newName[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN + 8)];
+	NQ_INT i;
+
+	writeStatistics();
+	writeFlush();
+	syCloseFile(file);
+	makeFileName(newName , UD_CM_CAPTURE_MAXFILES - 1);
+	syDeleteFile(newName);
+	for (i = UD_CM_CAPTURE_MAXFILES - 1; i > 0; i--)
+	{
+		makeFileName(oldName , i - 1);
+		makeFileName(newName , i);
+		syRenameFile(oldName , newName);
+	}
+	if (!fileOpen())
+	{
+		/* keep draining the ring so that producers are not blocked, packets are lost until shutdown */
+		LOGERR(CM_TRC_LEVEL_ERROR, "capture file rotation failed");
+	}
 }
 
 static NQ_BOOL prepareIpHeader(const CMCaptureHeader * header , CMBufferWriter * writer , NQ_UINT length)
@@ -197,10 +598,7 @@ static NQ_BOOL prepareIpHeader(const CMCaptureHeader * header , CMBufferWriter *
 			cmBufferWriteByte(writer , IPv4Type);
 			cmBufferWriteByte(writer  , 0);
 			cmBufferWriteUint16(writer , (NQ_UINT16)cmHtob16(length + (NQ_UINT)ipv4HeaderLength + (NQ_UINT)tcpHeaderLength)); /* IP + TCP + Length*/
-			cmBufferWriteUint16(writer , (NQ_UINT16)cmHtob16(IPv4Id));
-			syMutexTake(&staticGuard);
-			IPv4Id++;
-			syMutexGive(&staticGuard);
+			cmBufferWriteUint16(writer , (NQ_UINT16)cmHtob16((NQ_UINT16)syAtomicAdd(&IPv4Id , 1)));
 			cmBufferWriteBytes(writer , IPv4Flags , sizeof(IPv4Flags));
 			cmBufferWriteUint32(writer , header->receiving ?  CM_IPADDR_GET4(header->dstIP) : CM_IPADDR_GET4(header->srcIP));
 			cmBufferWriteUint32(writer , header->receiving ?  CM_IPADDR_GET4(header->srcIP) : CM_IPADDR_GET4(header->dstIP));
@@ -250,10 +648,7 @@ static void prepareTcpHeader(const CMCaptureHeader * header , CMBufferWriter * w
 
 	cmBufferWriteUint16(writer , (NQ_UINT16)(header->receiving ?  cmHtob16(header->dstPort) : cmHtob16(header->srcPort)));
 	cmBufferWriteUint16(writer , (NQ_UINT16)(header->receiving ? cmHtob16(header->srcPort) : cmHtob16(header->dstPort)));
-	syMutexTake(&staticGuard);
-	sequenceNumber += length;
-	syMutexGive(&staticGuard);
-	cmBufferWriteUint32(writer , cmHtob32(sequenceNumber));
+	cmBufferWriteUint32(writer , cmHtob32(syAtomicAdd(&sequenceNumber , length)));
 	cmBufferWriteZeroes(writer , 4);
 	cmBufferWriteByte(writer , tcpHeaderLen);
 	cmBufferWriteByte(writer , tcpFlags);
@@ -276,15 +671,10 @@ static void prepareNetBiosHeader(NQ_BYTE * buffer , NQ_UINT length)
 void cmCapturePacketWriteStart(const CMCaptureHeader * header ,NQ_UINT length)
 {
 	CMBufferWriter	writer;
-	NQ_BYTE  		buffer[128]; /* packetHeaderLength */
-	NQ_UINT32		packetHeaderLength = (NQ_UINT32)(pcapHeaderLen + ethernetHeaderLength  + tcpHeaderLength + netBiosHeaderLength);
+	Composer *		composer;
+	CaptureRecord *	record = NULL;
 	CMNetBiosSessionMessage	nbHeader;
-	NQ_UINT16		totalLen = (NQ_UINT16)((length > maxPacketLen) ? cutPacketLen : length);
-#ifndef UD_NQ_USETRANSPORTIPV6
-	NQ_BOOL 		isIPv6 = CM_IPADDR_VERSION(header->srcIP) != CM_IPADDR_IPV4;
-#else
-	NQ_BOOL 		isIPv6 = CM_IPADDR_VERSION(header->srcIP) == CM_IPADDR_IPV6;
-#endif /* UD_NQ_USETRANSPORTIPV6*/
+	NQ_UINT			ipLength = length + (NQ_UINT)netBiosHeaderLength;
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "header:%p len:%u", header, length);
 
@@ -293,24 +683,51 @@ void cmCapturePacketWriteStart(const CMCaptureHeader * header ,NQ_UINT length)
         LOGERR(CM_TRC_LEVEL_ERROR, " not initialized");
 		goto Exit;
 	}
-	packetHeaderLength += (NQ_UINT32)(isIPv6 ? ipv6HeaderLength : ipv4HeaderLength);
-	syMutexTake(&fileGuard);
-	
-	if (!captureWrite)
-		captureWrite = TRUE;
-	else
+
+	composer = composerFind();
+	if (NULL != composer)
 	{
 		LOGERR(CM_TRC_LEVEL_ERROR, " capture start without ending first");
+		if (NULL != composer->record)
+			ringPublish(composer->record);
+		composer->record = NULL;
+	}
+	else
+	{
+		composer = composerTake();
+		if (NULL == composer)
+		{
+			syAtomicAdd(&statistics.dropped , 1);
+			goto Exit;
+		}
+		/* shutdown may have started after the check above, it waits only for composers it can see */
+		if (!initialized)
+		{
+			composerRelease(composer);
+			goto Exit;
+		}
 	}
-	syMutexTake(&staticGuard);
-	totalPacketLen = 0;
-	syMutexGive(&staticGuard);
+	if (!filterMatch(header))
+	{
+		syAtomicAdd(&statistics.filtered , 1);
+		goto Exit;
+	}
+	record = ringReserve();
+	if (NULL == record)
+	{
+		syAtomicAdd(&statistics.dropped , 1);
+		goto Exit;
+	}
+	composer->record = record;
+
+	/* IP length is 16 bits: packets larger than that are described as the largest possible one */
+	if (ipLength > 0xFFFF - (NQ_UINT)(ipv6HeaderLength + tcpHeaderLength))
+		ipLength = 0xFFFF - (NQ_UINT)(ipv6HeaderLength + tcpHeaderLength);
 
-	cmBufferWriterInit(&writer , buffer , (NQ_COUNT)packetHeaderLength);
+	cmBufferWriterInit(&writer , record->data , MAX_NETHEADERS);
 #ifdef SY_BIGENDIANHOST
 	cmBufferWriterSetByteOrder(&writer , FALSE); /* set buffer writer to stop rotating the value */
 #endif /* SY_BIGENDIANHOST */
-	preparePcapHeader(&writer , (NQ_UINT)(totalLen + netBiosHeaderLength), isIPv6);
 	cmBufferWriteBytes(&writer , ethernetHeader , sizeof(ethernetHeader));
 	switch (CM_IPADDR_VERSION(header->srcIP))
 	{
@@ -334,15 +751,17 @@ void cmCapturePacketWriteStart(const CMCaptureHeader * header ,NQ_UINT length)
 			break;
 		}
 	}
-	prepareIpHeader(header , &writer , (NQ_UINT)(totalLen + netBiosHeaderLength));
-	prepareTcpHeader(header , &writer , (NQ_UINT)(totalLen + netBiosHeaderLength));
-	prepareNetBiosHeader((NQ_BYTE *)&nbHeader , totalLen);
+	prepareIpHeader(header , &writer , ipLength);
+	prepareTcpHeader(header , &writer , ipLength);
+	prepareNetBiosHeader((NQ_BYTE *)&nbHeader , length);
 	cmBufferWriteBytes(&writer , (NQ_BYTE *)&nbHeader , (NQ_COUNT)netBiosHeaderLength);
 
-	writeToFile(buffer , packetHeaderLength);
-	syMutexTake(&staticGuard);
-	totalPacketLen = 0;
-	syMutexGive(&staticGuard);
+	record->time = syGetTimeInMsec();
+	record->length = (NQ_UINT32)cmBufferWriterGetDataCount(&writer);
+	record->limit = record->length + (NQ_UINT32)snapLength;
+	record->originalLength = record->length + (NQ_UINT32)length;
+	if (length > snapLength)
+		syAtomicAdd(&statistics.truncated , 1);
 
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
@@ -350,13 +769,22 @@ Exit:
 
 void cmCapturePacketWritePacket(NQ_BYTE * packet ,NQ_UINT length  )
 {
+	Composer *		composer;
+	CaptureRecord *	record;
+
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "packet:%p len:%u", packet, length);
-	if (!initialized)
-	{
-        LOGERR(CM_TRC_LEVEL_ERROR, " not initialized");
+
+	/* not checking 'initialized': a packet started before shutdown is completed and shutdown waits for it */
+	composer = composerFind();
+	if (NULL == composer || NULL == composer->record)
 		goto Exit;
-	}
-	writeToFile(packet , length);
+
+	/* bytes past the snap length are counted in the original length only */
+	record = composer->record;
+	if (length > record->limit - record->length)
+		length = (NQ_UINT)(record->limit - record->length);
+	syMemcpy(record->data + record->length , packet , length);
+	record->length += (NQ_UINT32)length;
 
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
@@ -364,14 +792,17 @@ Exit:
 
 void cmCapturePacketWriteEnd()
 {
+	Composer *	composer;
+
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON);
-	if (!initialized)
-	{
-        LOGERR(CM_TRC_LEVEL_ERROR, " not initialized");
+
+	/* not checking 'initialized': a packet started before shutdown is completed and shutdown waits for it */
+	composer = composerFind();
+	if (NULL == composer)
 		goto Exit;
-	}
-    captureWrite = FALSE;
-	syMutexGive(&fileGuard);	
+	if (NULL != composer->record)
+		ringPublish(composer->record);
+	composerRelease(composer);
 
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
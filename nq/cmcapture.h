@@ -31,9 +31,23 @@ typedef struct{
 	NQ_BOOL receiving;
 }CMCaptureHeader;
 
+typedef struct{
+	NQ_UINT32 captured;		/* packets passed to the writer */
+	NQ_UINT32 truncated;	/* captured packets cut to the snap length */
+	NQ_UINT32 filtered;		/* packets skipped by the connection filter */
+	NQ_UINT32 dropped;		/* packets lost because the capture ring was full */
+	NQ_UINT32 files;		/* capture files created, including rotations */
+}CMCaptureStatistics;
+
 NQ_BOOL cmCaptureStart(void);
 void cmCaptureShutdown(void);
 
+/* capture only packets to/from this address and port (port 0 - any port), NULL to capture all */
+void cmCaptureSetFilter(const NQ_IPADDRESS * ip, NQ_PORT port);
+/* number of packet bytes kept per packet, up to UD_CM_CAPTURE_SNAPLEN */
+void cmCaptureSetSnapLength(NQ_UINT length);
+void cmCaptureGetStatistics(CMCaptureStatistics * stats);
+
 void cmCapturePacketWriteStart(const CMCaptureHeader * header ,NQ_UINT length);
 void cmCapturePacketWritePacket(NQ_BYTE * packet ,NQ_UINT length  );
 void cmCapturePacketWriteEnd();
@@ -0,0 +1,742 @@
+/*********************************************************************
+ *
+ *           Copyright (c) 2026 by Visuality Systems, Ltd.
+ *
+ *********************************************************************
+ * FILE NAME     : $Workfile:$
+ * ID            : $Header:$
+ * REVISION      : $Revision:$
+ *--------------------------------------------------------------------
+ * DESCRIPTION   : SMB 3.1.1 compression
+ *                 contains LZNT1 and plain LZ77 codecs (MS-XCA) and
+ *                 composing/parsing of the compression transform
+ *                 header (MS-SMB2 2.2.42)
+ *--------------------------------------------------------------------
+ * DEPENDENCIES  : None
+ *--------------------------------------------------------------------
+ * CREATION DATE : 19-Oct-2026
+ ********************************************************************/
+
+#include "cmapi.h"
+#include "cmcompress.h"
+
+#ifdef UD_NQ_INCLUDECOMPRESSION
+
+/* -- Match finder shared by the codecs -- */
+
+#define MINMATCH    3                   /* shortest match both formats can encode */
+#define HASHBITS    12                  /* 4096 entries in the match table */
+#define HASHSIZE    (1 << HASHBITS)
+
+/* hash of the three bytes starting at p */
+static NQ_UINT32 hash3(const NQ_BYTE * p)
+{
+    NQ_UINT32 v = ((NQ_UINT32)p[0] << 16) | ((NQ_UINT32)p[1] << 8) | (NQ_UINT32)p[2];
+
+    return (v * 0x9E3779B1U) >> (32 - HASHBITS);
+}
+
+/* Remember position pos in the match table. Entries hold position + 1 so that zero means empty */
+static void insertPosition(NQ_UINT32 * table, const NQ_BYTE * in, NQ_COUNT pos, NQ_COUNT end)
+{
+    if (pos + MINMATCH <= end)
+        table[hash3(in + pos)] = (NQ_UINT32)pos + 1;
+}
+
+/* Find a match for the bytes at pos among earlier bytes starting at or after first and no further than maxOffset back.
+   Only the latest position with the same hash is tried, which keeps compression fast at some cost in ratio.
+   Returns match length (zero when shorter than MINMATCH) and sets its offset. */
+static NQ_COUNT findMatch(NQ_UINT32 * table, const NQ_BYTE * in, NQ_COUNT pos, NQ_COUNT end, NQ_COUNT first, NQ_COUNT maxOffset, NQ_COUNT maxLength, NQ_COUNT * offset)
+{
+    NQ_UINT32 * pEntry;     /* table entry for this position */
+    NQ_COUNT candidate;     /* earlier position with the same hash */
+    NQ_COUNT length = 0;    /* match length */
+
+    if (pos + MINMATCH > end)
+        return 0;
+
+    pEntry = &table[hash3(in + pos)];
+    candidate = (NQ_COUNT)*pEntry;
+    *pEntry = (NQ_UINT32)pos + 1;
+    if (0 == candidate--)
+        return 0;
+    if (candidate < first || pos - candidate > maxOffset)
+        return 0;
+
+    if (maxLength > end - pos)
+        maxLength = end - pos;
+    while (length < maxLength && in[candidate + length] == in[pos + length])
+        length++;
+    if (length < MINMATCH)
+        return 0;
+
+    *offset = pos - candidate;
+    return length;
+}
+
+static NQ_UINT16 getUint16(const NQ_BYTE * p)
+{
+    return (NQ_UINT16)(p[0] | (p[1] << 8));
+}
+
+static NQ_UINT32 getUint32(const NQ_BYTE * p)
+{
+    return (NQ_UINT32)p[0] | ((NQ_UINT32)p[1] << 8) | ((NQ_UINT32)p[2] << 16) | ((NQ_UINT32)p[3] << 24);
+}
+
+static void putUint16(NQ_BYTE * p, NQ_UINT32 v)
+{
+    p[0] = (NQ_BYTE)v;
+    p[1] = (NQ_BYTE)(v >> 8);
+}
+
+static void putUint32(NQ_BYTE * p, NQ_UINT32 v)
+{
+    p[0] = (NQ_BYTE)v;
+    p[1] = (NQ_BYTE)(v >> 8);
+    p[2] = (NQ_BYTE)(v >> 16);
+    p[3] = (NQ_BYTE)(v >> 24);
+}
+
+/* -- Plain LZ77 (MS-XCA 2.3, 2.4) -- */
+
+#define LZ77_MAXOFFSET  8192
+#define LZ77_MAXTOKEN   (2 + 1 + 1 + 2 + 4 + 4)  /* match token with all length extensions and the next flags word */
+
+static NQ_COUNT lz77Compress(const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    NQ_UINT32 * table;          /* match table */
+    NQ_UINT32 flags = 0;        /* literal/match flags collected so far */
+    NQ_COUNT flagCount = 0;     /* number of collected flags */
+    NQ_COUNT flagPos = 0;       /* where the current flags word goes */
+    NQ_COUNT halfBytePos = 0;   /* byte holding a spare length nibble or zero */
+    NQ_COUNT inPos = 0;         /* input position */
+    NQ_COUNT outPos = 4;        /* output position, after the first flags word */
+    NQ_COUNT result = (NQ_COUNT)NQ_FAIL;
+
+    table = (NQ_UINT32 *)cmMemoryAllocate(HASHSIZE * sizeof(NQ_UINT32));
+    if (NULL == table)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+    syMemset(table, 0, HASHSIZE * sizeof(NQ_UINT32));
+
+    while (inPos < inLen)
+    {
+        NQ_COUNT offset;    /* match offset */
+        NQ_COUNT length;    /* match length */
+
+        if (outPos + LZ77_MAXTOKEN > outSize)
+            goto Exit;
+
+        length = findMatch(table, in, inPos, inLen, 0, LZ77_MAXOFFSET, inLen, &offset);
+        if (0 == length)
+        {
+            out[outPos++] = in[inPos++];
+            flags <<= 1;
+        }
+        else
+        {
+            NQ_UINT32 matchLength = (NQ_UINT32)(length - MINMATCH);
+            NQ_UINT32 token = (NQ_UINT32)(offset - 1) << 3;
+            NQ_COUNT i;
+
+            if (matchLength < 7)
+            {
+                putUint16(out + outPos, token | matchLength);
+                outPos += 2;
+            }
+            else
+            {
+                putUint16(out + outPos, token | 7);
+                outPos += 2;
+                matchLength -= 7;
+                /* two consecutive long matches share one byte for their length nibbles */
+                if (0 == halfBytePos)
+                {
+                    halfBytePos = outPos;
+                    out[outPos++] = (NQ_BYTE)(matchLength < 15 ? matchLength : 15);
+                }
+                else
+                {
+                    out[halfBytePos] |= (NQ_BYTE)((matchLength < 15 ? matchLength : 15) << 4);
+                    halfBytePos = 0;
+                }
+                if (matchLength >= 15)
+                {
+                    matchLength -= 15;
+                    if (matchLength < 255)
+                    {
+                        out[outPos++] = (NQ_BYTE)matchLength;
+                    }
+                    else
+                    {
+                        out[outPos++] = 255;
+                        matchLength += 15 + 7;
+                        if (matchLength < 0x10000)
+                        {
+                            putUint16(out + outPos, matchLength);
+                            outPos += 2;
+                        }
+                        else
+                        {
+                            putUint16(out + outPos, 0);
+                            putUint32(out + outPos + 2, matchLength);
+                            outPos += 6;
+                        }
+                    }
+                }
+            }
+            flags = (flags << 1) | 1;
+            for (i = 1; i < length; i++)
+                insertPosition(table, in, inPos + i, inLen);
+            inPos += length;
+        }
+
+        if (++flagCount == 32)
+        {
+            putUint32(out + flagPos, flags);
+            flags = 0;
+            flagCount = 0;
+            flagPos = outPos;
+            outPos += 4;
+        }
+    }
+
+    /* unused flags are set so that the decompressor stops at the end of input */
+    flags = (0 == flagCount) ? 0xFFFFFFFF : (flags << (32 - flagCount)) | (((NQ_UINT32)1 << (32 - flagCount)) - 1);
+    putUint32(out + flagPos, flags);
+    result = outPos;
+
+Exit:
+    cmMemoryFree(table);
+    return result;
+}
+
+static NQ_COUNT lz77Decompress(const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    NQ_UINT32 flags = 0;        /* current flags word */
+    NQ_COUNT flagCount = 0;     /* flags left in it */
+    NQ_COUNT halfBytePos = 0;   /* byte holding a spare length nibble or zero */
+    NQ_COUNT inPos = 0;         /* input position */
+    NQ_COUNT outPos = 0;        /* output position */
+
+    for (;;)
+    {
+        if (0 == flagCount)
+        {
+            if (inPos == inLen)
+                break;
+            if (inLen - inPos < 4)
+                return (NQ_COUNT)NQ_FAIL;
+            flags = getUint32(in + inPos);
+            inPos += 4;
+            flagCount = 32;
+        }
+        flagCount--;
+
+        if (0 == (flags & ((NQ_UINT32)1 << flagCount)))
+        {
+            if (inPos == inLen)
+                break;
+            if (outPos == outSize)
+                return (NQ_COUNT)NQ_FAIL;
+            out[outPos++] = in[inPos++];
+        }
+        else
+        {
+            NQ_UINT32 length;   /* match length */
+            NQ_COUNT offset;    /* match offset */
+            NQ_UINT16 token;    /* offset and length */
+
+            if (inPos == inLen)
+                break;
+            if (inLen - inPos < 2)
+                return (NQ_COUNT)NQ_FAIL;
+            token = getUint16(in + inPos);
+            inPos += 2;
+            offset = (NQ_COUNT)(token >> 3) + 1;
+            length = token & 7;
+            if (7 == length)
+            {
+                if (0 == halfBytePos)
+                {
+                    if (inPos == inLen)
+                        return (NQ_COUNT)NQ_FAIL;
+                    length = in[inPos] & 0x0F;
+                    halfBytePos = inPos++;
+                }
+                else
+                {
+                    length = in[halfBytePos] >> 4;
+                    halfBytePos = 0;
+                }
+                if (15 == length)
+                {
+                    if (inPos == inLen)
+                        return (NQ_COUNT)NQ_FAIL;
+                    length = in[inPos++];
+                    if (255 == length)
+                    {
+                        if (inLen - inPos < 2)
+                            return (NQ_COUNT)NQ_FAIL;
+                        length = getUint16(in + inPos);
+                        inPos += 2;
+                        if (0 == length)
+                        {
+                            if (inLen - inPos < 4)
+                                return (NQ_COUNT)NQ_FAIL;
+                            length = getUint32(in + inPos);
+                            inPos += 4;
+                        }
+                        if (length < 15 + 7)
+                            return (NQ_COUNT)NQ_FAIL;
+                        length -= 15 + 7;
+                    }
+                    length += 15;
+                }
+                length += 7;
+            }
+            length += MINMATCH;
+
+            if (offset > outPos || length > outSize - outPos)
+                return (NQ_COUNT)NQ_FAIL;
+            /* byte by byte as the source may overlap what is being written */
+            for (; length > 0; length--, outPos++)
+                out[outPos] = out[outPos - offset];
+        }
+    }
+
+    return outPos;
+}
+
+/* -- LZNT1 (MS-XCA 2.5) -- */
+
+#define LZNT1_CHUNKSIZE         4096
+#define LZNT1_SIGNATURE         0x3000  /* chunk header signature bits */
+#define LZNT1_COMPRESSEDCHUNK   0x8000  /* chunk header flag */
+#define LZNT1_SIZEMASK          0x0FFF  /* chunk header data size minus one */
+
+/* Number of bits a token spends on the length at pos bytes into a chunk. The rest holds the offset */
+static NQ_UINT lznt1LengthBits(NQ_COUNT pos)
+{
+    NQ_UINT bits = 12;
+
+    for (pos = pos > 0 ? pos - 1 : 0; pos >= 0x10; pos >>= 1)
+        bits--;
+    return bits;
+}
+
+/* Compress one chunk of input between start and end into at most outSize bytes */
+static NQ_COUNT lznt1CompressChunk(NQ_UINT32 * table, const NQ_BYTE * in, NQ_COUNT start, NQ_COUNT end, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    NQ_COUNT pos = start;   /* input position */
+    NQ_COUNT outPos = 0;    /* output position */
+    NQ_COUNT flagPos = 0;   /* byte holding flags of the current group */
+    NQ_UINT bit = 0;        /* next flag in the group */
+
+    while (pos < end)
+    {
+        NQ_UINT lengthBits = lznt1LengthBits(pos - start);
+        NQ_COUNT offset;    /* match offset */
+        NQ_COUNT length;    /* match length */
+
+        if (0 == bit)
+        {
+            if (outPos == outSize)
+                return (NQ_COUNT)NQ_FAIL;
+            flagPos = outPos++;
+            out[flagPos] = 0;
+        }
+
+        length = findMatch(table, in, pos, end, start, pos - start, ((NQ_COUNT)1 << lengthBits) - 1 + MINMATCH, &offset);
+        if (0 == length)
+        {
+            if (outPos == outSize)
+                return (NQ_COUNT)NQ_FAIL;
+            out[outPos++] = in[pos++];
+        }
+        else
+        {
+            NQ_COUNT i;
+
+            if (outSize - outPos < 2)
+                return (NQ_COUNT)NQ_FAIL;
+            putUint16(out + outPos, ((NQ_UINT32)(offset - 1) << lengthBits) | (NQ_UINT32)(length - MINMATCH));
+            outPos += 2;
+            out[flagPos] |= (NQ_BYTE)(1 << bit);
+            for (i = 1; i < length; i++)
+                insertPosition(table, in, pos + i, end);
+            pos += length;
+        }
+        bit = (bit + 1) & 7;
+    }
+
+    return outPos;
+}
+
+static NQ_COUNT lznt1Compress(const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    NQ_UINT32 * table;      /* match table */
+    NQ_COUNT start;         /* chunk start */
+    NQ_COUNT outPos = 0;    /* output position */
+    NQ_COUNT result = (NQ_COUNT)NQ_FAIL;
+
+    table = (NQ_UINT32 *)cmMemoryAllocate(HASHSIZE * sizeof(NQ_UINT32));
+    if (NULL == table)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+    syMemset(table, 0, HASHSIZE * sizeof(NQ_UINT32));
+
+    for (start = 0; start < inLen; start += LZNT1_CHUNKSIZE)
+    {
+        NQ_COUNT chunkLen = inLen - start < LZNT1_CHUNKSIZE ? inLen - start : LZNT1_CHUNKSIZE;
+        NQ_COUNT room;          /* space for chunk data */
+        NQ_COUNT packedLen;     /* compressed chunk data length */
+
+        if (outSize - outPos < 2)
+            goto Exit;
+        room = outSize - outPos - 2;
+
+        /* a chunk that does not get smaller is stored as is */
+        packedLen = lznt1CompressChunk(table, in, start, start + chunkLen, out + outPos + 2, room < chunkLen ? room : chunkLen - 1);
+        if ((NQ_COUNT)NQ_FAIL != packedLen)
+        {
+            putUint16(out + outPos, LZNT1_COMPRESSEDCHUNK | LZNT1_SIGNATURE | (NQ_UINT32)(packedLen - 1));
+        }
+        else
+        {
+            if (room < chunkLen)
+                goto Exit;
+            syMemcpy(out + outPos + 2, in + start, chunkLen);
+            putUint16(out + outPos, LZNT1_SIGNATURE | (NQ_UINT32)(chunkLen - 1));
+            packedLen = chunkLen;
+        }
+        outPos += 2 + packedLen;
+    }
+    result = outPos;
+
+Exit:
+    cmMemoryFree(table);
+    return result;
+}
+
+/* Decompress one compressed chunk into at most outSize bytes */
+static NQ_COUNT lznt1DecompressChunk(const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    NQ_COUNT inPos = 0;     /* input position */
+    NQ_COUNT outPos = 0;    /* output position */
+
+    while (inPos < inLen)
+    {
+        NQ_BYTE flags = in[inPos++];    /* group flags */
+        NQ_UINT bit;                    /* flag index */
+
+        for (bit = 0; bit < 8 && inPos < inLen; bit++)
+        {
+            if (0 == (flags & (1 << bit)))
+            {
+                if (outPos == outSize)
+                    return (NQ_COUNT)NQ_FAIL;
+                out[outPos++] = in[inPos++];
+            }
+            else
+            {
+                NQ_UINT lengthBits = lznt1LengthBits(outPos);
+                NQ_UINT16 token;    /* offset and length */
+                NQ_COUNT offset;    /* match offset */
+                NQ_COUNT length;    /* match length */
+
+                if (inLen - inPos < 2)
+                    return (NQ_COUNT)NQ_FAIL;
+                token = getUint16(in + inPos);
+                inPos += 2;
+                offset = (NQ_COUNT)(token >> lengthBits) + 1;
+                length = (NQ_COUNT)(token & ((1 << lengthBits) - 1)) + MINMATCH;
+                if (offset > outPos || length > outSize - outPos)
+                    return (NQ_COUNT)NQ_FAIL;
+                for (; length > 0; length--, outPos++)
+                    out[outPos] = out[outPos - offset];
+            }
+        }
+    }
+
+    return outPos;
+}
+
+static NQ_COUNT lznt1Decompress(const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    NQ_COUNT inPos = 0;     /* input position */
+    NQ_COUNT outPos = 0;    /* output position */
+
+    while (inLen - inPos >= 2)
+    {
+        NQ_UINT16 header = getUint16(in + inPos);   /* chunk header */
+        NQ_COUNT chunkLen;                          /* chunk data length */
+        NQ_COUNT unpackedLen;                       /* its length after decompression */
+
+        if (0 == header)
+            break;      /* optional terminator */
+        inPos += 2;
+        chunkLen = (NQ_COUNT)(header & LZNT1_SIZEMASK) + 1;
+        if (chunkLen > inLen - inPos)
+            return (NQ_COUNT)NQ_FAIL;
+
+        if (header & LZNT1_COMPRESSEDCHUNK)
+        {
+            unpackedLen = lznt1DecompressChunk(in + inPos, chunkLen, out + outPos, outSize - outPos);
+            if ((NQ_COUNT)NQ_FAIL == unpackedLen)
+                return (NQ_COUNT)NQ_FAIL;
+        }
+        else
+        {
+            if (chunkLen > outSize - outPos)
+                return (NQ_COUNT)NQ_FAIL;
+            syMemcpy(out + outPos, in + inPos, chunkLen);
+            unpackedLen = chunkLen;
+        }
+        inPos += chunkLen;
+        outPos += unpackedLen;
+    }
+
+    return outPos;
+}
+
+/* -- Codec table -- */
+
+/* codecs in the order of preference: LZ77 is the faster one */
+static const CMCompressionCodec codecs[] =
+{
+    { SMB2_COMPRESSION_LZ77, lz77Compress, lz77Decompress },
+    { SMB2_COMPRESSION_LZNT1, lznt1Compress, lznt1Decompress }
+};
+
+static const NQ_UINT16 algorithms[] = { SMB2_COMPRESSION_LZ77, SMB2_COMPRESSION_LZNT1 };
+
+const CMCompressionCodec * cmCompressionGetCodec(NQ_UINT16 algorithm)
+{
+    NQ_COUNT i;
+
+    for (i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++)
+    {
+        if (codecs[i].algorithm == algorithm)
+            return &codecs[i];
+    }
+    return NULL;
+}
+
+NQ_COUNT cmCompressionGetAlgorithms(const NQ_UINT16 ** pAlgorithms)
+{
+    *pAlgorithms = algorithms;
+    return sizeof(algorithms) / sizeof(algorithms[0]);
+}
+
+/* -- Compression transform -- */
+
+#define PAYLOADHEADER_SIZE  8   /* chained payload header: algorithm, flags, length */
+
+/* decompress a payload that must restore exactly outLen bytes */
+static NQ_BOOL decompressPayload(NQ_UINT16 algorithm, const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outLen)
+{
+    const CMCompressionCodec * pCodec = cmCompressionGetCodec(algorithm);
+
+    if (NULL == pCodec)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unsupported compression algorithm: %d", algorithm);
+        return FALSE;
+    }
+    if (outLen != pCodec->decompress(in, inLen, out, outLen))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Malformed compressed payload, algorithm: %d", algorithm);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+NQ_COUNT cmSmb2CompressMessage(NQ_UINT16 algorithm, NQ_BOOL chained, const NQ_BYTE * head, NQ_COUNT headLen, const NQ_BYTE * data, NQ_COUNT dataLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    const CMCompressionCodec * pCodec;  /* codec to use */
+    CMBufferWriter writer;              /* to compose headers */
+    NQ_COUNT headerLen;                 /* transform and payload headers */
+    NQ_COUNT maxLen;                    /* most the compressed data may take */
+    NQ_COUNT packedLen;                 /* compressed data length */
+    NQ_COUNT result = (NQ_COUNT)NQ_FAIL;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_TOOL, "algorithm:%d chained:%d headLen:%d dataLen:%d", algorithm, chained, headLen, dataLen);
+
+    pCodec = cmCompressionGetCodec(algorithm);
+    if (NULL == pCodec || dataLen < UD_NQ_COMPRESSIONMINSIZE)
+        goto Exit;
+
+    headerLen = chained ? SMB2_CHAINEDCOMPRESSIONHEADER_SIZE + PAYLOADHEADER_SIZE + PAYLOADHEADER_SIZE + 4 : SMB2_COMPRESSIONHEADER_SIZE;
+    if (headerLen + headLen >= outSize)
+        goto Exit;
+    maxLen = dataLen - dataLen / UD_NQ_COMPRESSIONMINGAIN;
+    if (maxLen > outSize - headerLen - headLen)
+        maxLen = outSize - headerLen - headLen;
+
+    /* give up as soon as the output grows beyond the gain we want */
+    packedLen = pCodec->compress(data, dataLen, out + headerLen + headLen, maxLen);
+    if ((NQ_COUNT)NQ_FAIL == packedLen)
+    {
+        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Payload of %d bytes does not compress well enough, sending it as is", dataLen);
+        goto Exit;
+    }
+
+    cmBufferWriterInit(&writer, out, headerLen + headLen);
+    cmBufferWriteBytes(&writer, cmSmb2CmprsHdrProtocolId, sizeof(cmSmb2CmprsHdrProtocolId));
+    if (chained)
+    {
+        cmBufferWriteUint32(&writer, (NQ_UINT32)(headLen + dataLen));   /* original size */
+        cmBufferWriteUint16(&writer, SMB2_COMPRESSION_NONE);            /* header payload: algorithm */
+        cmBufferWriteUint16(&writer, SMB2_COMPRESSION_FLAG_CHAINED);    /* flags */
+        cmBufferWriteUint32(&writer, (NQ_UINT32)headLen);               /* length */
+        cmBufferWriteBytes(&writer, head, headLen);
+        cmBufferWriteUint16(&writer, algorithm);                        /* data payload: algorithm */
+        cmBufferWriteUint16(&writer, SMB2_COMPRESSION_FLAG_NONE);       /* flags */
+        cmBufferWriteUint32(&writer, (NQ_UINT32)(4 + packedLen));       /* length */
+        cmBufferWriteUint32(&writer, (NQ_UINT32)dataLen);               /* original payload size */
+    }
+    else
+    {
+        cmBufferWriteUint32(&writer, (NQ_UINT32)dataLen);               /* original compressed segment size */
+        cmBufferWriteUint16(&writer, algorithm);                        /* algorithm */
+        cmBufferWriteUint16(&writer, SMB2_COMPRESSION_FLAG_NONE);       /* flags */
+        cmBufferWriteUint32(&writer, (NQ_UINT32)headLen);               /* offset to compressed data */
+        cmBufferWriteBytes(&writer, head, headLen);
+    }
+    result = headerLen + headLen + packedLen;
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_TOOL, "result:%d", result);
+    return result;
+}
+
+NQ_COUNT cmSmb2GetDecompressedLength(const NQ_BYTE * in, NQ_COUNT inLen)
+{
+    CMBufferReader reader;      /* to parse the header */
+    NQ_UINT32 originalSize;     /* original (segment) size */
+    NQ_UINT16 flags;            /* chained or not */
+    NQ_UINT32 offset;           /* uncompressed bytes ahead of compressed data */
+
+    if (inLen < SMB2_COMPRESSIONHEADER_SIZE || 0 != syMemcmp(in, cmSmb2CmprsHdrProtocolId, sizeof(cmSmb2CmprsHdrProtocolId)))
+        return (NQ_COUNT)NQ_FAIL;
+
+    cmBufferReaderInit(&reader, in, inLen);
+    cmBufferReaderSkip(&reader, sizeof(cmSmb2CmprsHdrProtocolId));
+    cmBufferReadUint32(&reader, &originalSize);
+    cmBufferReaderSkip(&reader, 2);             /* algorithm */
+    cmBufferReadUint16(&reader, &flags);
+    if (flags & SMB2_COMPRESSION_FLAG_CHAINED)
+        return (NQ_COUNT)originalSize;
+
+    cmBufferReadUint32(&reader, &offset);
+    if (offset > inLen - SMB2_COMPRESSIONHEADER_SIZE || originalSize > (NQ_UINT32)-1 - offset)
+        return (NQ_COUNT)NQ_FAIL;
+    return (NQ_COUNT)(originalSize + offset);
+}
+
+NQ_COUNT cmSmb2DecompressMessage(NQ_UINT16 negotiated, const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize)
+{
+    CMBufferReader reader;      /* to parse headers */
+    NQ_COUNT length;            /* original message length */
+    NQ_UINT32 originalSize;     /* original (segment) size */
+    NQ_UINT16 algorithm;        /* compression algorithm */
+    NQ_UINT16 flags;            /* chained or not */
+    NQ_COUNT result = (NQ_COUNT)NQ_FAIL;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_TOOL, "negotiated:%d in:%p inLen:%d out:%p outSize:%d", negotiated, in, inLen, out, outSize);
+
+    if (SMB2_COMPRESSION_NONE == negotiated)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Compression was not negotiated");
+        goto Exit;
+    }
+    length = cmSmb2GetDecompressedLength(in, inLen);
+    if ((NQ_COUNT)NQ_FAIL == length || length > outSize)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Malformed compression transform header or message too long");
+        goto Exit;
+    }
+
+    cmBufferReaderInit(&reader, in, inLen);
+    cmBufferReaderSkip(&reader, sizeof(cmSmb2CmprsHdrProtocolId));
+    cmBufferReadUint32(&reader, &originalSize);
+    if (0 == (getUint16(in + 10) & SMB2_COMPRESSION_FLAG_CHAINED))
+    {
+        NQ_UINT32 offset;       /* uncompressed bytes ahead of compressed data */
+
+        cmBufferReadUint16(&reader, &algorithm);
+        cmBufferReadUint16(&reader, &flags);
+        cmBufferReadUint32(&reader, &offset);
+        if (algorithm != negotiated)
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Algorithm %d was not negotiated", algorithm);
+            goto Exit;
+        }
+        syMemcpy(out, cmBufferReaderGetPosition(&reader), offset);
+        cmBufferReaderSkip(&reader, (NQ_UINT)offset);
+        if (!decompressPayload(algorithm, cmBufferReaderGetPosition(&reader), cmBufferReaderGetRemaining(&reader), out + offset, (NQ_COUNT)originalSize))
+            goto Exit;
+    }
+    else
+    {
+        NQ_COUNT outPos = 0;    /* restored so far */
+
+        while (cmBufferReaderGetRemaining(&reader) > 0)
+        {
+            NQ_UINT32 payloadLen;   /* payload length after its header */
+
+            if (cmBufferReaderGetRemaining(&reader) < PAYLOADHEADER_SIZE)
+                goto Malformed;
+            cmBufferReadUint16(&reader, &algorithm);
+            cmBufferReadUint16(&reader, &flags);
+            cmBufferReadUint32(&reader, &payloadLen);
+            if (payloadLen > cmBufferReaderGetRemaining(&reader))
+                goto Malformed;
+
+            if (SMB2_COMPRESSION_NONE == algorithm)
+            {
+                if (payloadLen > length - outPos)
+                    goto Malformed;
+                syMemcpy(out + outPos, cmBufferReaderGetPosition(&reader), payloadLen);
+                outPos += (NQ_COUNT)payloadLen;
+            }
+            else
+            {
+                NQ_UINT32 payloadSize;  /* original payload size */
+
+                if (algorithm != negotiated)
+                {
+                    LOGERR(CM_TRC_LEVEL_ERROR, "Algorithm %d was not negotiated", algorithm);
+                    goto Exit;
+                }
+                if (payloadLen < 4)
+                    goto Malformed;
+                payloadSize = getUint32(cmBufferReaderGetPosition(&reader));
+                if (payloadSize > length - outPos)
+                    goto Malformed;
+                if (!decompressPayload(algorithm, cmBufferReaderGetPosition(&reader) + 4, (NQ_COUNT)payloadLen - 4, out + outPos, (NQ_COUNT)payloadSize))
+                    goto Exit;
+                outPos += (NQ_COUNT)payloadSize;
+            }
+            cmBufferReaderSkip(&reader, (NQ_UINT)payloadLen);
+        }
+        if (outPos != length)
+            goto Malformed;
+    }
+    result = length;
+    goto Exit;
+
+Malformed:
+    LOGERR(CM_TRC_LEVEL_ERROR, "Malformed chained compression payload");
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_TOOL, "result:%d", result);
+    return result;
+}
+
+#endif /* UD_NQ_INCLUDECOMPRESSION */
@@ -0,0 +1,60 @@
+/*********************************************************************
+ *
+ *           Copyright (c) 2026 by Visuality Systems, Ltd.
+ *
+ *********************************************************************
+ * FILE NAME     : $Workfile:$
+ * ID            : $Header:$
+ * REVISION      : $Revision:$
+ *--------------------------------------------------------------------
+ * DESCRIPTION   : SMB 3.1.1 compression
+ *                 contains LZNT1 and plain LZ77 codecs and the
+ *                 compression transform header
+ *--------------------------------------------------------------------
+ * DEPENDENCIES  : None
+ *--------------------------------------------------------------------
+ * CREATION DATE : 19-Oct-2026
+ ********************************************************************/
+
+#ifndef _CMCOMPRESS_H_
+#define _CMCOMPRESS_H_
+
+#include "cmapi.h"
+#include "cmsmb2.h"
+
+#ifdef UD_NQ_INCLUDECOMPRESSION
+
+/* Compress or decompress inLen bytes into at most outSize bytes.
+   Returns the number of bytes written or (NQ_COUNT)NQ_FAIL when the result does not fit or the input is malformed. */
+typedef NQ_COUNT (*CMCompressionFunction)(const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize);
+
+typedef struct
+{
+    NQ_UINT16 algorithm;                /* SMB2_COMPRESSION_* identifier */
+    CMCompressionFunction compress;     /* compressor */
+    CMCompressionFunction decompress;   /* decompressor */
+}
+CMCompressionCodec;
+
+/* Find the codec for an algorithm identifier. Returns NULL when the algorithm is not supported */
+const CMCompressionCodec * cmCompressionGetCodec(NQ_UINT16 algorithm);
+
+/* Get the identifiers of supported algorithms in the order of preference. Returns their number */
+NQ_COUNT cmCompressionGetAlgorithms(const NQ_UINT16 ** algorithms);
+
+/* Compress an SMB2 message into a compression transform.
+   The message consists of a head (SMB2 header and command structure) that is sent as is and of data that gets compressed.
+   Returns the length of the transform written into out or (NQ_COUNT)NQ_FAIL when data is shorter than UD_NQ_COMPRESSIONMINSIZE
+   or does not compress well enough to be worth it. */
+NQ_COUNT cmSmb2CompressMessage(NQ_UINT16 algorithm, NQ_BOOL chained, const NQ_BYTE * head, NQ_COUNT headLen, const NQ_BYTE * data, NQ_COUNT dataLen, NQ_BYTE * out, NQ_COUNT outSize);
+
+/* Get the length of the original message carried by a compression transform. Returns (NQ_COUNT)NQ_FAIL when it is malformed */
+NQ_COUNT cmSmb2GetDecompressedLength(const NQ_BYTE * in, NQ_COUNT inLen);
+
+/* Restore the original message from a compression transform. Only the negotiated algorithm (and uncompressed chained payloads)
+   is accepted. Returns its length or (NQ_COUNT)NQ_FAIL on error */
+NQ_COUNT cmSmb2DecompressMessage(NQ_UINT16 negotiated, const NQ_BYTE * in, NQ_COUNT inLen, NQ_BYTE * out, NQ_COUNT outSize);
+
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+
+#endif /* _CMCOMPRESS_H_ */
@@ -19,11 +19,11 @@
 
 #include "cmapi.h"
 #include "cmcp.h"
-#include "syopsyst.h"
 
 
 #ifdef UD_NQ_CODEPAGEUTF8
 
+/* inLength is in bytes, outLength is in bytes, -1 means "not limited" */
 static NQ_INT
 cp8Utf8ToUtf16LE(
     NQ_WCHAR* wStr,
@@ -32,18 +32,19 @@ cp8Utf8ToUtf16LE(
     NQ_INT outLength
     )
 {
-    NQ_CHAR *outStr = (NQ_CHAR*)wStr;
-    /* regular call the out length is set to -1. but iconv can't recieve -1.*/
-    NQ_UINT32 outLen;
-    NQ_UINT32 inLen = (NQ_UINT32)inLength;
-    if (outLength < 0 || outLength < inLength / 2)
-        outLen = (NQ_UINT32)(inLength * 2 + 1);
-    else 
-        outLen = (NQ_UINT32)outLength * 2;
+    NQ_COUNT outSize;
+    NQ_INT result;
 
-    return (NQ_INT)convertCodePageUTF8toUtf16LE((NQ_CHAR**)&aStr, &inLen, &outStr, &outLen);   
+    if (outLength < 0)
+        outSize = (NQ_COUNT)(inLength < 0 ? syStrlen(aStr) : (NQ_COUNT)inLength) + 1;
+    else
+        outSize = (NQ_COUNT)outLength / (NQ_COUNT)sizeof(NQ_WCHAR);
+
+    result = cmUtf8ToUtf16LE(wStr, outSize, aStr, inLength);
+    return result == NQ_FAIL ? 0 : result * (NQ_INT)sizeof(NQ_WCHAR);
 }
 
+/* inLength is in bytes, outLength is in bytes, -1 means "not limited" */
 static NQ_INT
 cp8Utf16LEToUtf8(
     NQ_CHAR* aStr,
@@ -52,15 +53,18 @@ cp8Utf16LEToUtf8(
     NQ_INT outLength
     )
 {
-    NQ_CHAR *inStr = (NQ_CHAR*)wStr;
-    NQ_UINT32 outLen;
-    NQ_UINT32 inLen = (NQ_UINT32)inLength * 2;
-    if (outLength < 0 || outLength < inLength * 2)
-        outLen = (NQ_UINT32)(inLength / 2 + 1);
-    else 
-        outLen = (NQ_UINT32)outLength / 2 + 1;
+    NQ_COUNT outSize;
+    NQ_INT result;
+
+    if (inLength >= 0)
+        inLength /= (NQ_INT)sizeof(NQ_WCHAR);
+    if (outLength < 0)
+        outSize = (NQ_COUNT)(inLength < 0 ? cmWStrlen(wStr) : (NQ_COUNT)inLength) * 4 + 1;  /* up to 4 bytes per symbol */
+    else
+        outSize = (NQ_COUNT)outLength;
 
-    return (NQ_INT)convertCodePageUtf16LEtoUTF8(&inStr, &inLen, &aStr, &outLen);
+    result = cmUtf16LEToUtf8(aStr, outSize, wStr, inLength);
+    return result == NQ_FAIL ? 0 : result;
 }
 
 static NQ_INT
@@ -87,7 +91,6 @@ const CMCodepage* cmCpInitUtf8(
     void
     )
 {
-    initCodePageUTF8();
     return &encUTF8;
 }
 
@@ -16,6 +16,96 @@
 #include "cmlist.h"
 #include "cmmemory.h"
 
+/* -- Constants -- */
+#define INDEX_MAXLOAD 2     /* average chain length that causes the index to grow */
+
+/* -- Static functions -- */
+
+/* calculate name hash ignoring case */
+static NQ_UINT32 hashName(const NQ_WCHAR * name)
+{
+    NQ_UINT32 hash = 5381;      /* djb2 */
+
+    if (NULL == name)
+        return 0;
+    for (; *name != 0; name++)
+    {
+        NQ_WCHAR c;             /* folded character */
+
+        cmWToupper(&c, name);
+        hash = (hash << 5) + hash + cmLtoh16(c);
+    }
+    return hash;
+}
+
+/* place item into its bucket, the list should be protected */
+static void indexLink(CMList * pList, CMItem * pItem)
+{
+    CMItem ** bucket = &pList->index[pItem->key & (pList->indexSize - 1)];
+
+    pItem->indexNext = *bucket;
+    *bucket = pItem;
+    pList->indexCount++;
+}
+
+/* remove item from its bucket, the list should be protected */
+static void indexUnlink(CMList * pList, CMItem * pItem)
+{
+    CMItem ** pNext;
+
+    for (pNext = &pList->index[pItem->key & (pList->indexSize - 1)]; NULL != *pNext; pNext = &(*pNext)->indexNext)
+    {
+        if (*pNext == pItem)
+        {
+            *pNext = pItem->indexNext;
+            pItem->indexNext = NULL;
+            pList->indexCount--;
+            break;
+        }
+    }
+}
+
+/* re-hash all list items into a new set of buckets, the list should be protected */
+static NQ_BOOL indexRebuild(CMList * pList, NQ_COUNT size)
+{
+    CMItem ** index;
+    CMItem * pItem;
+
+    index = (CMItem **)cmMemoryAllocate((NQ_UINT)(sizeof(CMItem *) * size));
+    if (NULL == index)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        return FALSE;
+    }
+    syMemset(index, 0, sizeof(CMItem *) * size);
+    cmMemoryFree(pList->index);
+    pList->index = index;
+    pList->indexSize = size;
+    pList->indexCount = 0;
+    for (pItem = pList->first; NULL != pItem; pItem = pItem->next)
+    {
+        if (!pList->indexByKey)
+            pItem->key = hashName(pItem->name);
+        indexLink(pList, pItem);
+    }
+    return TRUE;
+}
+
+/* check found item and lock it when required */
+static CMItem * pickFound(CMItem * pItem, NQ_BOOL lock)
+{
+    NQ_BOOL findable;
+
+    cmListItemTake(pItem);
+    findable = pItem->findable;
+    cmListItemGive(pItem);
+    if (!findable)
+        return NULL;
+    if (lock)
+        cmListItemLock(pItem);
+    return pItem;
+}
+
 /* -- API functions -- */
 void cmListItemInit(CMItem * item)
 {
@@ -29,6 +119,8 @@ void cmListItemInit(CMItem * item)
 	item->findable 	= FALSE;
 	item->isStatic	= FALSE;
 	item->beingDisposed = FALSE;
+	item->indexNext = NULL;
+	item->key		= 0;
 #if SY_DEBUGMODE
 	item->dump      = NULL;
 #endif
@@ -40,15 +132,37 @@ void cmListStart(CMList * pList)
     pList->name = "";
 #endif
     pList->first = pList->last = NULL;
+    pList->index = NULL;
+    pList->indexSize = 0;
+    pList->indexCount = 0;
+    pList->indexByKey = FALSE;
     syMutexCreate(&pList->guard);
     pList->isUsed = TRUE;
 }
 
+NQ_BOOL cmListIndexStart(CMList * pList, NQ_COUNT size, NQ_BOOL byKey)
+{
+    NQ_COUNT buckets = 1;
+    NQ_BOOL result;
+
+    while (buckets < size)
+        buckets <<= 1;
+
+    syMutexTake(&pList->guard);
+    pList->indexByKey = byKey;
+    result = indexRebuild(pList, buckets);
+    syMutexGive(&pList->guard);
+    return result;
+}
+
 void cmListShutdown(CMList * pList)
 {
 	syMutexTake(&pList->guard);
     cmListRemoveAndDisposeAll(pList);
 	pList->isUsed = FALSE;
+    cmMemoryFree(pList->index);
+    pList->index = NULL;
+    pList->indexSize = 0;
     syMutexGive(&pList->guard);
     syMutexDelete(&pList->guard);
 }
@@ -93,6 +207,14 @@ NQ_BOOL cmListItemAdd(CMList * pList, CMItem * pItem, NQ_BOOL (*callback)(CMItem
     pItem->next = NULL;
     pItem->beingDisposed = FALSE;
     pItem->findable = TRUE;
+    if (NULL != pList->index)
+    {
+        if (!pList->indexByKey)
+            pItem->key = hashName(pItem->name);
+        indexLink(pList, pItem);
+        if (pList->indexCount > pList->indexSize * INDEX_MAXLOAD)
+            indexRebuild(pList, pList->indexSize * 2);
+    }
     cmListItemGive(pItem);
     syMutexGive(&pList->guard);
     result = TRUE;
@@ -205,6 +327,8 @@ NQ_BOOL cmListItemRemove(CMItem * pItem)
     */
     syMutexTake(&pList->guard);
     cmListItemTake(pItem);
+    if (NULL != pList->index)
+        indexUnlink(pList, pItem);
     if (NULL == pItem->prev)  /* first in the list */
     {
 #if SY_DEBUGMODE
@@ -462,7 +586,24 @@ CMItem * cmListItemFind(CMList * pList, const NQ_WCHAR * name, NQ_BOOL ignoringC
         goto Exit;
 
 	LOGMSG(CM_TRC_LEVEL_CMLIST, "Find item: %s and lock: %s", cmWDump(name), lock ? "yes" : "no");
-    
+
+    if (pList->isUsed && NULL != pList->index && !pList->indexByKey)
+    {
+        NQ_UINT32 key = hashName(name);
+
+        syMutexTake(&pList->guard);
+        for (pItem = pList->index[key & (pList->indexSize - 1)]; NULL != pItem; pItem = pItem->indexNext)
+        {
+            if (pItem->key == key && NULL != pItem->name && (ignoringCase ? (0 == cmWStricmp(name, pItem->name)) : (0 == cmWStrcmp(name, pItem->name))))
+            {
+                pItem = pickFound(pItem, lock);
+                break;
+            }
+        }
+        syMutexGive(&pList->guard);
+        goto Done;
+    }
+
     cmListIteratorStart(pList, &iterator);
     while (cmListIteratorHasNext(&iterator))
     {
@@ -496,10 +637,100 @@ Error:
 Exit:
 	if (name != NULL)
 		cmListIteratorTerminate(&iterator);
+Done:
     LOGFE(CM_TRC_LEVEL_CMLIST, "result:%p", pItem);
     return pItem;
 }
 
+void cmListItemSetKey(CMItem * pItem, NQ_UINT32 key)
+{
+    CMList * pList = pItem->master;
+
+    if (NULL == pList || NULL == pList->index)
+    {
+        pItem->key = key;
+        return;
+    }
+    if (!pList->indexByKey)
+        return;     /* key is the name hash */
+    syMutexTake(&pList->guard);
+    if (pItem->master == pList)
+    {
+        indexUnlink(pList, pItem);
+        pItem->key = key;
+        indexLink(pList, pItem);
+    }
+    else
+    {
+        pItem->key = key;
+    }
+    syMutexGive(&pList->guard);
+}
+
+void cmListItemSetName(CMItem * pItem, NQ_WCHAR * name)
+{
+    CMList * pList = pItem->master;
+
+    if (NULL == pList || NULL == pList->index || pList->indexByKey)
+    {
+        pItem->name = name;
+        return;
+    }
+    syMutexTake(&pList->guard);
+    if (pItem->master == pList)
+    {
+        indexUnlink(pList, pItem);
+        pItem->name = name;
+        pItem->key = hashName(name);
+        indexLink(pList, pItem);
+    }
+    else
+    {
+        pItem->name = name;
+    }
+    syMutexGive(&pList->guard);
+}
+
+CMItem * cmListItemFindByKey(CMList * pList, NQ_UINT32 key, NQ_BOOL (*match)(CMItem * pItem, const void * context), const void * context, NQ_BOOL lock)
+{
+    CMItem * pItem = NULL;
+    CMItem * pResult = NULL;
+
+	LOGFB(CM_TRC_LEVEL_CMLIST, "list:%p key:0x%x lock:%s", pList, key, lock ? "TRUE" : "FALSE");
+
+    if (!pList->isUsed)
+        goto Exit;
+
+    syMutexTake(&pList->guard);
+    pItem = (NULL != pList->index && pList->indexByKey) ? pList->index[key & (pList->indexSize - 1)] : pList->first;
+    while (NULL != pItem)
+    {
+        if (pItem->key == key && (NULL == match || match(pItem, context)))
+        {
+            pResult = pickFound(pItem, lock);
+            break;
+        }
+        pItem = (NULL != pList->index && pList->indexByKey) ? pItem->indexNext : pItem->next;
+    }
+    syMutexGive(&pList->guard);
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_CMLIST, "result:%p", pResult);
+    return pResult;
+}
+
+NQ_UINT32 cmListKeyFromBytes(const NQ_BYTE * data, NQ_COUNT size)
+{
+    NQ_UINT32 hash = 2166136261UL;  /* FNV-1a */
+
+    for (; size > 0; size--, data++)
+    {
+        hash ^= *data;
+        hash *= 16777619UL;
+    }
+    return hash;
+}
+
 void cmListItemTake(CMItem * pItem)
 {
 	if (pItem->beingDisposed)	return;
@@ -39,6 +39,10 @@ typedef struct _cmlist
     struct _cmitem * first;  /* Pointer to the first item in the list or NULL when the list is empty. */
     struct _cmitem * last;   /* Pointer to the last item in the list or NULL when the list is empty. */
     NQ_BOOL          isUsed; /* set to FALSE only after the list was disposed */
+    struct _cmitem ** index; /* Hash index buckets or NULL when the list is not indexed. */
+    NQ_COUNT indexSize;      /* Number of buckets in the index (a power of two). */
+    NQ_COUNT indexCount;     /* Number of items in the index. */
+    NQ_BOOL  indexByKey;     /* TRUE when items are indexed by key, FALSE when by name. */
 #if SY_DEBUGMODE
     NQ_CHAR * name; /* List name (for debug purposes only). */
 #endif /* SY_DEBUGMODE */
@@ -70,6 +74,8 @@ typedef struct _cmitem
     NQ_BOOL beingDisposed;    /* <i>TRUE</i> when this item is being disposed. */
     NQ_BOOL findable;         /* TRUE if item can be found in list */
     NQ_BOOL isStatic;         /* TRUE if item should not be disposed , Default - FALSE*/  
+    struct _cmitem * indexNext; /* Next item in the same bucket of the master list index. */
+    NQ_UINT32 key;            /* Item key in a list indexed by key or name hash in a list indexed by name. */
 #if SY_DEBUGMODE
     void (*dump)(struct _cmitem * item);  /* Dump callback. This value may be NULL. */
 #endif /* SY_DEBUGMODE */
@@ -119,6 +125,28 @@ void cmListStart(CMList * list);
    None                                                                                                       */
 void cmListShutdown(CMList * list);
 
+/* Description
+   This function adds a hash index to a linked list.
+   
+   An indexed list is still a linked list. Besides, its items are
+   hashed either by name or by key so that cmListItemFind() and
+   cmListItemFindByKey() do not scan the entire list. The index
+   is kept in sync by <link cmListItemAdd@CMList *@CMItem *@NQ_BOOL (*)(CMItem *), cmListItemAdd()>
+   and <link cmListItemRemove@CMItem *, cmListItemRemove()>
+   and grows with the number of items.
+   
+   Items are hashed by name ignoring case, so that both
+   case-sensitive and case-insensitive lookups use the index.
+   Parameters
+   list :   Pointer to the list. It may already have items.
+   size :   Initial number of buckets.
+   byKey :  TRUE to index items by <i>key</i>, FALSE to index
+            them by name.
+   Returns
+   TRUE on success, FALSE when out of memory. On failure the
+   list remains a plain linked list.                                                     */
+NQ_BOOL cmListIndexStart(CMList * list, NQ_COUNT size, NQ_BOOL byKey);
+
 /* Description
    This function check a list and reports whether it has at least one item.
    Parameters
@@ -392,6 +420,61 @@ void cmListItemCheck(CMItem * item);
 CMItem * cmListItemFind(CMList * list, const NQ_WCHAR * name, NQ_BOOL ignoringCase , NQ_BOOL lock);
 
 
+/* Description
+   This function sets item key and re-indexes the item if its
+   list is indexed by key.
+   
+   The key may be set either before or after the item is added
+   to the list. In a list indexed by name the key is the name
+   hash and this call has no effect.
+   Parameters
+   item :  Pointer to the item.
+   key :   New key value.
+   Returns
+   None                                                          */
+void cmListItemSetKey(CMItem * item, NQ_UINT32 key);
+
+/* Description
+   This function replaces item name and re-indexes the item if
+   its list is indexed by name, so that it is found by the new
+   name only.
+   
+   The item takes ownership of the new name. The old name is
+   not released.
+   Parameters
+   item :  Pointer to the item.
+   name :  New name (allocated).
+   Returns
+   None                                                          */
+void cmListItemSetName(CMItem * item, NQ_WCHAR * name);
+
+/* Description
+   This function looks for an item in the list by its key.
+   
+   Since different items may have the same key, the caller may
+   supply a callback to match an item with the same key.
+   Parameters
+   list :     Pointer to the list.
+   key :      Item key.
+   match :    Callback function that returns TRUE for the
+              required item. This value may be NULL, then the
+              first item with the same key is returned.
+   context :  Context to pass to the callback.
+   lock:      Whether to lock the item if found or not.
+   Returns
+   Pointer to the item or NULL if item was not found.          */
+CMItem * cmListItemFindByKey(CMList * list, NQ_UINT32 key, NQ_BOOL (*match)(CMItem * item, const void * context), const void * context, NQ_BOOL lock);
+
+/* Description
+   This function calculates a key for an arbitrary binary value,
+   such as a file ID.
+   Parameters
+   data :  Pointer to the data.
+   size :  Data length in bytes.
+   Returns
+   Key value.                                                    */
+NQ_UINT32 cmListKeyFromBytes(const NQ_BYTE * data, NQ_COUNT size);
+
 #if SY_DEBUGMODE
 /* Description
    This function prints a list of items. For each item it prints
@@ -20,7 +20,11 @@
 
 /* -- Definitions -- */
 
-#define CACHEITEM_TIMEOUT 10    /* in seconds */
+#define CACHEITEM_TIMEOUT 10        /* in seconds */
+#define CACHEITEM_NEGATIVETIMEOUT 3 /* in seconds - TTL of a failed resolution */
+#define CACHE_NUMBUCKETS 64         /* number of hash buckets in the name cache (power of two) */
+#define CACHE_REFRESHRATIO 4        /* refresh positive entries in the last 1/CACHE_REFRESHRATIO of their TTL */
+#define PENDING_TIMEOUT 30          /* in seconds - max wait for a duplicate query to complete */
 
 typedef struct 
 {
@@ -38,22 +42,59 @@ typedef struct
 } 
 Method;                                 /* resolution method */
 
+typedef struct
+{
+    SYSocketHandle socket;              /* private socket for this query */
+    void * context;                     /* method-specific context */
+    NQ_STATUS status;                   /* method status - same values as in Method */
+    NQ_IPADDRESS serverIp;              /* server IP address */
+    CMResolverMethodDescriptor method;  /* copy of the method descriptor */
+}
+QueryMethod;                            /* one method as used by one name query */
+
+typedef struct
+{
+    QueryMethod * methods;              /* snapshot of the enabled methods */
+    NQ_COUNT numMethods;                /* number of methods in the snapshot */
+}
+Query;                                  /* per-query context, allows concurrent resolution of different names */
+
 typedef struct
 {
     CMItem item;                        /* inherited object */
-    NQ_UINT32 time;                       /* time when this entry was cached */
-    NQ_COUNT numIps;                    /* number of IPs */
+    NQ_UINT32 time;                     /* time when this entry was cached */
+    NQ_UINT32 ttl;                      /* time to live of this entry in seconds */
+    NQ_COUNT numIps;                    /* number of IPs, zero for a negative entry */
     const NQ_IPADDRESS * ips;           /* IP addresses */
+    NQ_BOOL refreshing;                 /* TRUE when background refresh was scheduled */
 }
 CacheEntry;                             /* an association between host name and IP(s) */
 
+typedef struct
+{
+    CMItem item;                        /* inherited object - named by the host being resolved */
+    CMThreadCond cond;                  /* signalled when resolution completes */
+    NQ_COUNT waiters;                   /* number of threads waiting for this query */
+    NQ_BOOL done;                       /* TRUE when resolution completed */
+    NQ_COUNT numIps;                    /* number of resolved IPs */
+    NQ_IPADDRESS * ips;                 /* resolved IPs or NULL */
+}
+PendingQuery;                           /* name resolution in progress */
+
 /* -- Static data -- */
 
 typedef struct
 {
-    SYMutex guard;                  /* critical section guard */
+    SYMutex guard;                  /* critical section guard for cache, pending queries and method list */
+    SYMutex exchangeGuard;          /* guards the shared method sockets (IP-to-name and DC queries) */
     CMList methods;                 /* list of registered methods */
-    CMList cache;                   /* cached associations */
+    CMList cache[CACHE_NUMBUCKETS]; /* cached associations hashed by name */
+    CMList pending;                 /* name queries in progress */
+    CMList refresh;                 /* names scheduled for background refresh */
+    NQ_BOOL refreshRunning;         /* TRUE while the refresh thread is running */
+    SYThread refreshThread;         /* background refresh thread */
+    CMThreadCond refreshDone;       /* signalled when the refresh thread exits during shutdown */
+    NQ_BOOL shutdown;               /* TRUE when module is being shut down */
     NQ_BOOL cacheEnabled;           /* cache state (enabled by default) */
     NQ_UINT32 cacheTimeout;           /* cache item timeout */
     CMResolverNameToIpA nameToIpA;  /* name-to-ip external method (ASCII) */
@@ -84,8 +125,8 @@ static NQ_BOOL methodUnlockCallback(CMItem * pItem)
     return TRUE;
 }
 
-#ifdef UD_NQ_CLOSESOCKETS
-static NQ_BOOL bindClientSocket(Method *pMethod)
+/* create a UDP socket bound to any local address in the family of the given server */
+static SYSocketHandle createClientSocket(const NQ_IPADDRESS * serverIp)
 {
     NQ_STATUS res = NQ_FAIL;                   /* operation result */
 #ifdef UD_NQ_USETRANSPORTIPV4
@@ -95,15 +136,14 @@ static NQ_BOOL bindClientSocket(Method *pMethod)
     NQ_IPADDRESS anyIp6 = CM_IPADDR_ANY6;      /* for binding */
 #endif
     SYSocketHandle socket = syInvalidSocket();
-    NQ_UINT family = (NQ_UINT)CM_IPADDR_VERSION(pMethod->serverIp);   /* IP family */
-
+    NQ_UINT family = (NQ_UINT)CM_IPADDR_VERSION(*serverIp);   /* IP family */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON);
-    pMethod->socket = syInvalidSocket();
+
     socket = syCreateSocket(FALSE, family);
     if (!syIsValidSocket(socket))
     {
-        LOGERR(CM_TRC_LEVEL_ERROR, "Error creating socket for method %d", (CMItem *)pMethod->item.name);
+        LOGERR(CM_TRC_LEVEL_ERROR, "Error creating resolver socket");
         goto Exit;
     }
 
@@ -126,17 +166,21 @@ static NQ_BOOL bindClientSocket(Method *pMethod)
 #endif /* defined(UD_NQ_USETRANSPORTIPV4) && defined(UD_NQ_USETRANSPORTIPV6) */
     if (res == NQ_FAIL)
     {
-        LOGERR(CM_TRC_LEVEL_ERROR, "Error binding DNS socket");
+        LOGERR(CM_TRC_LEVEL_ERROR, "Error binding resolver socket");
         syCloseSocket(socket);
-        goto Exit;
+        socket = syInvalidSocket();
     }
 
-    pMethod->socket = socket;
-
 Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
+    return socket;
+}
 
-    return (res == NQ_FAIL)? FALSE : TRUE;
+#ifdef UD_NQ_CLOSESOCKETS
+static NQ_BOOL bindClientSocket(Method *pMethod)
+{
+    pMethod->socket = createClientSocket(&pMethod->serverIp);
+    return syIsValidSocket(pMethod->socket);
 }
 #endif /* UD_NQ_CLOSESOCKETS */
 
@@ -440,60 +484,98 @@ Exit:
     return name;
 }
 
-static void validateCache(NQ_UINT32 timeout)
+/* calculate hash bucket for a name, ignoring case */
+static CMList * nameToBucket(const NQ_WCHAR * name)
+{
+    NQ_UINT32 hash = 5381;      /* djb2 */
+
+    for (; *name != 0; name++)
+    {
+        NQ_WCHAR c;             /* folded character */
+
+        cmWToupper(&c, name);
+        hash = (hash << 5) + hash + cmLtoh16(c);
+    }
+    return &staticData->cache[hash & (CACHE_NUMBUCKETS - 1)];
+}
+
+static void disposeCacheEntry(CacheEntry * pEntry)
+{
+    cmListItemCheck((CMItem *)pEntry);
+    cmListItemRemoveAndDispose((CMItem *)pEntry);
+}
+
+static void validateBucket(CMList * bucket, NQ_BOOL flush, NQ_UINT32 curTime)
 {
     CMIterator iterator;            /* for iterating cache items */
-    NQ_UINT32 curTime;                /* current time in seconds */
 
-    curTime  = (NQ_UINT32)syGetTimeInSec();
-    cmListIteratorStart(&staticData->cache, &iterator);
+    cmListIteratorStart(bucket, &iterator);
     while (cmListIteratorHasNext(&iterator))
     {
-        const CacheEntry * pEntry;   /* next cache entry */
+        CacheEntry * pEntry;        /* next cache entry */
         
-        pEntry = (const CacheEntry *)cmListIteratorNext(&iterator);
-	    if ((timeout == 0) || (timeout < (curTime - pEntry->time)))
+        pEntry = (CacheEntry *)cmListIteratorNext(&iterator);
+        if (flush || (pEntry->ttl < (curTime - pEntry->time)))
         {
-            cmListItemCheck((CMItem *)pEntry);
-            cmListItemRemoveAndDispose((CMItem *)pEntry);
+            disposeCacheEntry(pEntry);
         }
     }
     cmListIteratorTerminate(&iterator);
 }
 
-static const CacheEntry * lookupNameInCache(const NQ_WCHAR * name)
+static void validateCache(NQ_BOOL flush)
+{
+    NQ_UINT32 curTime = (NQ_UINT32)syGetTimeInSec();    /* current time in seconds */
+    NQ_COUNT i;                                         /* bucket index */
+
+    for (i = 0; i < CACHE_NUMBUCKETS; i++)
+    {
+        validateBucket(&staticData->cache[i], flush, curTime);
+    }
+}
+
+static CacheEntry * lookupNameInCache(const NQ_WCHAR * name)
 {
-    validateCache(staticData->cacheTimeout);
-    return staticData->cacheEnabled ? (const CacheEntry *)cmListItemFind(&staticData->cache, name, TRUE, FALSE) : NULL;
+    CMList * bucket;            /* hash bucket for this name */
+
+    if (!staticData->cacheEnabled)
+        return NULL;
+    bucket = nameToBucket(name);
+    validateBucket(bucket, FALSE, (NQ_UINT32)syGetTimeInSec());
+    return (CacheEntry *)cmListItemFind(bucket, name, TRUE, FALSE);
 }
 
 static const CacheEntry * lookupIpInCache(const NQ_IPADDRESS * ip)
 {
     CMIterator iterator;               /* for iterating cache items */
     const CacheEntry * pEntry = NULL;  /* next cache entry */
+    NQ_COUNT bucket;                   /* bucket index */
 
-    validateCache(staticData->cacheTimeout);
     if (!staticData->cacheEnabled)
-        goto Exit1;
-    cmListIteratorStart(&staticData->cache, &iterator);
-    while (cmListIteratorHasNext(&iterator))
+        goto Exit;
+    validateCache(FALSE);
+    for (bucket = 0; bucket < CACHE_NUMBUCKETS; bucket++)
     {
-        NQ_COUNT i;                 /* index in IPs */
-
-        pEntry = (const CacheEntry *)cmListIteratorNext(&iterator);
-        for (i = 0; i < pEntry->numIps; i++)
+        cmListIteratorStart(&staticData->cache[bucket], &iterator);
+        while (cmListIteratorHasNext(&iterator))
         {
-            if (CM_IPADDR_EQUAL(*ip, pEntry->ips[i]))
+            NQ_COUNT i;                 /* index in IPs */
+
+            pEntry = (const CacheEntry *)cmListIteratorNext(&iterator);
+            for (i = 0; i < pEntry->numIps; i++)
             {
-                goto Exit;
+                if (CM_IPADDR_EQUAL(*ip, pEntry->ips[i]))
+                {
+                    cmListIteratorTerminate(&iterator);
+                    goto Exit;
+                }
             }
         }
+        cmListIteratorTerminate(&iterator);
     }
     pEntry = NULL;
 
 Exit:
-    cmListIteratorTerminate(&iterator);
-Exit1:
     return pEntry;
 }
 
@@ -504,48 +586,153 @@ Exit1:
  */
 static NQ_BOOL cacheEntryUnlockCallback(CMItem * pItem)
 {
-    const CacheEntry * pEntry = (const CacheEntry *)pItem;  /* casted pointer */
+    CacheEntry * pEntry = (CacheEntry *)pItem;  /* casted pointer */
     if (NULL != pEntry->ips)
     {
         cmMemoryFree(pEntry->ips);
+        pEntry->ips = NULL;
     }
     return FALSE;
 }
 
-
+/* add positive (numIps > 0) or negative (numIps == 0) entry, replacing an existing one */
 static void addToCache(const NQ_WCHAR * name, const NQ_IPADDRESS * ips, NQ_COUNT numIps)
 {
     CacheEntry * pEntry;        /* new cache entry */
+    CMList * bucket;            /* hash bucket for this name */
 
-    if (NULL == name || NULL == ips || !staticData->cacheEnabled)
+    if (NULL == name || !staticData->cacheEnabled)
     {
         goto Exit;
     }
+    if (NULL == ips)
+        numIps = 0;
+
+    bucket = nameToBucket(name);
+    pEntry = (CacheEntry *)cmListItemFind(bucket, name, TRUE, FALSE);
+    if (NULL != pEntry)
+    {
+        disposeCacheEntry(pEntry);
+    }
 
-    pEntry = (CacheEntry *)cmListItemCreateAndAdd(&staticData->cache, sizeof(CacheEntry), name, cacheEntryUnlockCallback, CM_LISTITEM_NOLOCK);
+    pEntry = (CacheEntry *)cmListItemCreateAndAdd(bucket, sizeof(CacheEntry), name, cacheEntryUnlockCallback, CM_LISTITEM_NOLOCK);
     if (NULL == pEntry)
     {
         goto Exit;
     }
-    pEntry->ips = (const NQ_IPADDRESS *)cmMemoryAllocate((NQ_UINT)(numIps * sizeof(NQ_IPADDRESS)));
-    if (NULL == pEntry->ips)
+    pEntry->ips = NULL;
+    if (numIps > 0)
     {
-        cmListItemRemoveAndDispose((CMItem *)pEntry);
-        goto Exit;
+        pEntry->ips = (const NQ_IPADDRESS *)cmMemoryAllocate((NQ_UINT)(numIps * sizeof(NQ_IPADDRESS)));
+        if (NULL == pEntry->ips)
+        {
+            cmListItemRemoveAndDispose((CMItem *)pEntry);
+            goto Exit;
+        }
+        syMemcpy(pEntry->ips, ips, numIps * sizeof(NQ_IPADDRESS));
+        pEntry->ttl = staticData->cacheTimeout;
+    }
+    else
+    {
+        pEntry->ttl = staticData->cacheTimeout < CACHEITEM_NEGATIVETIMEOUT ? staticData->cacheTimeout : CACHEITEM_NEGATIVETIMEOUT;
     }
-    syMemcpy(pEntry->ips, ips, numIps * sizeof(NQ_IPADDRESS));
     pEntry->numIps = numIps;
+    pEntry->refreshing = FALSE;
     pEntry->time = (NQ_UINT32)syGetTimeInSec();
 
 Exit:
     return;
 }
 
+/* create query context as a snapshot of the enabled name-to-IP methods, each with its own socket */
+static NQ_BOOL queryCreate(Query * pQuery)
+{
+    CMIterator iterator;        /* method iterator */
+    NQ_COUNT num = 0;           /* number of methods */
+    NQ_BOOL result = FALSE;
+
+    pQuery->methods = NULL;
+    pQuery->numMethods = 0;
+
+    for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator); )
+    {
+        Method * pMethod = (Method *)cmListIteratorNext(&iterator);
+        if (pMethod->enabled && pMethod->method.type != NQ_RESOLVER_DNS_DC && pMethod->method.type != NQ_RESOLVER_NETBIOS_DC)
+            num++;
+    }
+    cmListIteratorTerminate(&iterator);
+
+    if (0 == num)
+    {
+        result = TRUE;
+        goto Exit;
+    }
+
+    pQuery->methods = (QueryMethod *)cmMemoryAllocate((NQ_UINT)(sizeof(QueryMethod) * num));
+    if (NULL == pQuery->methods)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+
+    for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator) && pQuery->numMethods < num; )
+    {
+        Method * pMethod = (Method *)cmListIteratorNext(&iterator);
+        QueryMethod * pQueryMethod;
+
+        if (!pMethod->enabled || pMethod->method.type == NQ_RESOLVER_DNS_DC || pMethod->method.type == NQ_RESOLVER_NETBIOS_DC)
+            continue;
+        pQueryMethod = &pQuery->methods[pQuery->numMethods];
+        pQueryMethod->socket = createClientSocket(&pMethod->serverIp);
+        if (!syIsValidSocket(pQueryMethod->socket))
+            continue;
+        pQueryMethod->method = pMethod->method;
+        pQueryMethod->serverIp = pMethod->serverIp;
+        pQueryMethod->context = NULL;
+        pQueryMethod->status = NQ_ERR_MOREDATA;
+        pQuery->numMethods++;
+    }
+    cmListIteratorTerminate(&iterator);
+    result = TRUE;
+
+Exit:
+    return result;
+}
+
+static void queryDispose(Query * pQuery)
+{
+    NQ_COUNT i;                 /* method index */
+
+    for (i = 0; i < pQuery->numMethods; i++)
+    {
+        syCloseSocket(pQuery->methods[i].socket);
+        cmMemoryFree(pQuery->methods[i].context);    /* will handle NULL */
+    }
+    cmMemoryFree(pQuery->methods);                   /* will handle NULL */
+    pQuery->methods = NULL;
+    pQuery->numMethods = 0;
+}
+
+/* callback for pending query disposal */
+static NQ_BOOL pendingUnlockCallback(CMItem * pItem)
+{
+    PendingQuery * pPending = (PendingQuery *)pItem;  /* casted pointer */
+
+    cmThreadCondRelease(&pPending->cond);
+    cmMemoryFree(pPending->ips);                      /* will handle NULL */
+    pPending->ips = NULL;
+    cmListItemRemove(pItem);        /* completed query is already removed */
+    cmListItemDispose(pItem);
+    return TRUE;
+}
+
 /* -- API Functions */
 
 NQ_BOOL cmResolverStart(void)
 {
     NQ_BOOL result = NQ_FAIL;
+    NQ_COUNT i;                 /* bucket index */
+
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON);
 
     /* allocate memory */
@@ -564,10 +751,26 @@ NQ_BOOL cmResolverStart(void)
     staticData->nameToIpA = NULL;
     staticData->nameToIpW = NULL;
     syMutexCreate(&staticData->guard);
+    syMutexCreate(&staticData->exchangeGuard);
     staticData->cacheEnabled = TRUE;
     staticData->cacheTimeout = CACHEITEM_TIMEOUT;
+    staticData->refreshRunning = FALSE;
+    staticData->shutdown = FALSE;
+    if (!cmThreadCondSet(&staticData->refreshDone))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to create resolver condition");
+        syMutexDelete(&staticData->guard);
+        syMutexDelete(&staticData->exchangeGuard);
+        result = FALSE;
+        goto Exit;
+    }
     cmListStart(&staticData->methods);
-    cmListStart(&staticData->cache);
+    for (i = 0; i < CACHE_NUMBUCKETS; i++)
+    {
+        cmListStart(&staticData->cache[i]);
+    }
+    cmListStart(&staticData->pending);
+    cmListStart(&staticData->refresh);
     result = TRUE;
 
 Exit:
@@ -578,16 +781,41 @@ Exit:
 void cmResolverShutdown(void)
 {
     CMIterator  itr;
+    NQ_COUNT i;                 /* bucket index */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON);
 
-    cmListIteratorStart(&staticData->cache, &itr);
-    while (cmListIteratorHasNext(&itr))
+    /* stop background refresh and wait for the thread to leave - it still uses the lists and the guard */
+    syMutexTake(&staticData->guard);
+    staticData->shutdown = TRUE;
+    while (staticData->refreshRunning)
+    {
+        syMutexGive(&staticData->guard);
+        if (!cmThreadCondWait(&staticData->refreshDone, PENDING_TIMEOUT))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Still waiting for the resolver refresh thread");
+        }
+        syMutexTake(&staticData->guard);
+    }
+    syMutexGive(&staticData->guard);
+
+    for (i = 0; i < CACHE_NUMBUCKETS; i++)
     {
-        CacheEntry * pEntry;
+        cmListIteratorStart(&staticData->cache[i], &itr);
+        while (cmListIteratorHasNext(&itr))
+        {
+            CacheEntry * pEntry;
+
+            pEntry = (CacheEntry *)cmListIteratorNext(&itr);
+            cmListItemCheck((CMItem *)pEntry);
+        }
+        cmListIteratorTerminate(&itr);
+    }
 
-        pEntry = (CacheEntry *)cmListIteratorNext(&itr);
-        cmListItemCheck((CMItem *)pEntry);
+    cmListIteratorStart(&staticData->pending, &itr);
+    while (cmListIteratorHasNext(&itr))
+    {
+        cmListItemCheck(cmListIteratorNext(&itr));
     }
     cmListIteratorTerminate(&itr);
 
@@ -602,7 +830,14 @@ void cmResolverShutdown(void)
     cmListIteratorTerminate(&itr);
 
     cmListShutdown(&staticData->methods);
-    cmListShutdown(&staticData->cache);
+    for (i = 0; i < CACHE_NUMBUCKETS; i++)
+    {
+        cmListShutdown(&staticData->cache[i]);
+    }
+    cmListShutdown(&staticData->pending);
+    cmListShutdown(&staticData->refresh);
+    cmThreadCondRelease(&staticData->refreshDone);
+    syMutexDelete(&staticData->exchangeGuard);
     syMutexDelete(&staticData->guard);
 
 #ifdef SY_FORCEALLOCATION
@@ -622,7 +857,7 @@ void cmResolverCacheSet(NQ_UINT32 timeout)
     if ((timeout == 0) && staticData->cacheEnabled)
     {
         /* empty cache */
-        validateCache(0);
+        validateCache(TRUE);
     }
     staticData->cacheEnabled = (timeout != 0);
     staticData->cacheTimeout = timeout;
@@ -764,6 +999,7 @@ void cmResolverRemoveMethod(const CMResolverMethodDescriptor * descriptor, const
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "descriptor:%p serverIP:%p", descriptor, serverIp);
 
+    syMutexTake(&staticData->exchangeGuard);
     syMutexTake(&staticData->guard);
 
     for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator); )
@@ -778,6 +1014,7 @@ void cmResolverRemoveMethod(const CMResolverMethodDescriptor * descriptor, const
     }
     cmListIteratorTerminate(&iterator);
     syMutexGive(&staticData->guard);
+    syMutexGive(&staticData->exchangeGuard);
 
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
@@ -795,9 +1032,10 @@ const NQ_WCHAR * cmResolverGetHostName(const NQ_IPADDRESS * ip)
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "ip:%p", ip);
 
-    syMutexTake(&staticData->guard);
+    syMutexTake(&staticData->exchangeGuard);
 
     /* look in cache */
+    syMutexTake(&staticData->guard);
     pEntry = lookupIpInCache(ip);
     if (NULL != pEntry)
     {
@@ -806,8 +1044,10 @@ const NQ_WCHAR * cmResolverGetHostName(const NQ_IPADDRESS * ip)
         {
             LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
         }
+        syMutexGive(&staticData->guard);
         goto Exit1;
     }
+    syMutexGive(&staticData->guard);
 
     prepareMethods();    
 
@@ -937,13 +1177,15 @@ const NQ_WCHAR * cmResolverGetHostName(const NQ_IPADDRESS * ip)
 Error:
     pName = pName == NULL ? externalIpToName(ip) : pName;
 Exit2:
+    syMutexTake(&staticData->guard);
     addToCache(pName, ip, 1);
+    syMutexGive(&staticData->guard);
 
 Exit1:
 #ifdef UD_NQ_CLOSESOCKETS
     closeSockets();
 #endif
-    syMutexGive(&staticData->guard);
+    syMutexGive(&staticData->exchangeGuard);
 
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%s", cmWDump(pName));
     return pName;
@@ -1013,38 +1255,21 @@ Exit:
 	return res;
 }
 
-const NQ_IPADDRESS * cmResolverGetHostIps(const NQ_WCHAR * host, NQ_INT * numIps)
+/* resolve host name over the private sockets of a query context - no module locks are held */
+static const NQ_IPADDRESS * queryResolveName(Query * pQuery, const NQ_WCHAR * host, NQ_INT * numIps)
 {
     NQ_TIME selectTimeStamp, timeDiff;          /* time when the current select started */
     NQ_TIME currentTimeout;                     /* timeout of the current select */
     NQ_TIME zero = {0, 0}, tmpTime;
-    CMIterator iterator;                        /* method iterator */
     const NQ_IPADDRESS * result = NULL;         /* resulted array of IPs */
     NQ_IPADDRESS * methodIPArray = NULL;        /* one method result */
     NQ_INT methodNumIps;                        /* number of IPs returned by one method */
-    const CacheEntry * pEntry;					/* entry in the cache */
     NQ_UINT priorityToActivate = 1;				/* each resolver method has activation priority. we start from 1 which is highest*/
     NQ_COUNT numPendingMethods = 0;				/* valid method flag */
+    NQ_COUNT i;                                 /* method index */
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "host:%s numIps:%p", cmWDump(host), numIps);
 
-    syMutexTake(&staticData->guard);
-
-    /* look in cache */
-    pEntry = lookupNameInCache(host);
-    if (NULL != pEntry)
-    {
-        result = (const NQ_IPADDRESS *)cmMemoryAllocate((NQ_UINT)(sizeof(NQ_IPADDRESS) * pEntry->numIps));
-        if (NULL != result)
-        {
-            syMemcpy(result, pEntry->ips, sizeof(NQ_IPADDRESS) * pEntry->numIps);
-            *numIps = (NQ_INT)pEntry->numIps;
-        }
-        goto Exit1;
-    }
-
-    prepareMethods();  
-
     *numIps = 0;
 
     /* loop by the smallest timeout until either all timeouts expire */
@@ -1056,40 +1281,29 @@ const NQ_IPADDRESS * cmResolverGetHostIps(const NQ_WCHAR * host, NQ_INT * numIps
         cmU64Zero(&currentTimeout);
 
         syClearSocketSet(&set);
-        for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator); )
+        for (i = 0; i < pQuery->numMethods; i++)
         {
-        	Method * pMethod = (Method *)cmListIteratorNext(&iterator);
-            if (!pMethod->enabled || pMethod->method.type == NQ_RESOLVER_DNS_DC || pMethod->method.type == NQ_RESOLVER_NETBIOS_DC)
-                continue;
-            switch(pMethod->status)
+            QueryMethod * pMethod = &pQuery->methods[i];
+
+            if (NQ_ERR_MOREDATA == pMethod->status && priorityToActivate == pMethod->method.activationPriority)
             {
-            case NQ_SUCCESS:
-                break;
-            case NQ_ERR_MOREDATA:
-            	if (priorityToActivate == pMethod->method.activationPriority)
+                pMethod->status = (*pMethod->method.requestByName)(pMethod->socket, host, pMethod->context, &pMethod->serverIp);
+                if (pMethod->status >= 0)
                 {
-                    pMethod->status = (*pMethod->method.requestByName)(pMethod->socket, host, pMethod->context, &pMethod->serverIp);
-                    if (pMethod->status >= 0)
+                    if (pMethod->status > 1)
+                        numPendingMethods += (NQ_COUNT)pMethod->status;
+                    else
+                        ++numPendingMethods;
+                    pMethod->status = NQ_SUCCESS;
+                    if (cmU64Cmp(&pMethod->method.timeout, &currentTimeout) > 0)
                     {
-                    	if (pMethod->status > 1)
-							numPendingMethods += (NQ_COUNT)pMethod->status;
-						else
-							++numPendingMethods;
-                        pMethod->status = NQ_SUCCESS;
-                        if (cmU64Cmp(&pMethod->method.timeout, &currentTimeout) > 0)
-                        {
-                        	/* set to max timeout value */
-                        	cmU64AssignU64(&currentTimeout, &pMethod->method.timeout);
-                        }
-                        syAddSocketToSet(pMethod->socket, &set);
+                        /* set to max timeout value */
+                        cmU64AssignU64(&currentTimeout, &pMethod->method.timeout);
                     }
+                    syAddSocketToSet(pMethod->socket, &set);
                 }
-                break;
-            default:
-                break;
             }
         }
-        cmListIteratorTerminate(&iterator);
 
         LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Select on socket set - host IPs, priority: %d, pending: %d, timeout: %d",
                 priorityToActivate, numPendingMethods, cmTimeConvertMSecToSec(&currentTimeout));
@@ -1097,137 +1311,330 @@ const NQ_IPADDRESS * cmResolverGetHostIps(const NQ_WCHAR * host, NQ_INT * numIps
         selectTimeStamp = syGetTimeInMsec();
         while (numPendingMethods > 0)
         {
-        	NQ_UINT32 curTo = cmTimeConvertMSecToSec(&currentTimeout);
+            NQ_UINT32 curTo = cmTimeConvertMSecToSec(&currentTimeout);
 
-			if (cmU64Cmp(&currentTimeout, &zero) <= 0)
-			{
-				LOGERR(CM_TRC_LEVEL_ERROR, "Resolve IPs Select timeout, method priority: %d.", priorityToActivate);
-				break;
-			}
+            if (cmU64Cmp(&currentTimeout, &zero) <= 0)
+            {
+                LOGERR(CM_TRC_LEVEL_ERROR, "Resolve IPs Select timeout, method priority: %d.", priorityToActivate);
+                break;
+            }
 
-			switch (sySelectSocket(&set, curTo))
-			{
-			case 0:  /* timeout */
-				LOGERR(CM_TRC_LEVEL_ERROR, "Select timeout, method priority: %d.", priorityToActivate);
-				breakWhile = TRUE;
-				break;
+            switch (sySelectSocket(&set, curTo))
+            {
+            case 0:  /* timeout */
+                LOGERR(CM_TRC_LEVEL_ERROR, "Select timeout, method priority: %d.", priorityToActivate);
+                breakWhile = TRUE;
+                break;
 
-			case NQ_FAIL: /* error the select failed  */
-				LOGERR(CM_TRC_LEVEL_ERROR, "Select failed");
-				goto Exit2;
-				break;
+            case NQ_FAIL: /* error the select failed  */
+                LOGERR(CM_TRC_LEVEL_ERROR, "Select failed");
+                goto Exit;
 
-			default: /* datagram ready for reading */
-				for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator); )
-				{
-					Method * pMethod = (Method *)cmListIteratorNext(&iterator);
-					if (!pMethod->enabled || pMethod->method.type == NQ_RESOLVER_DNS_DC || pMethod->method.type == NQ_RESOLVER_NETBIOS_DC)
-						continue;
-					if (syIsSocketSet(pMethod->socket, &set))
-					{
-						syClearSocketFromSet(pMethod->socket, &set);
-						syAddSocketToSet(pMethod->socket, &set);
-						--numPendingMethods;
-						pMethod->status = (*pMethod->method.responseByName)(pMethod->socket, &methodIPArray, &methodNumIps, &pMethod->context);
-						switch (pMethod->status)
-						{
-						case NQ_SUCCESS:
-							cmMemoryFree(pMethod->context); /* will handle NULL */
-							pMethod->context = NULL;
-							mergeIpAddresses(&result, numIps, &methodIPArray, methodNumIps);
-							wasResponse = TRUE;
-							break;
-						case NQ_ERR_MOREDATA:
-						case NQ_FAIL:
-							cmMemoryFree(pMethod->context); /* will handle NULL */
-							pMethod->context = NULL;
-							cmMemoryFree(methodIPArray);
-							methodIPArray = NULL;
-							break;
-						default:    /* error */
-							break;
-						}
-					}
-				}
-				cmListIteratorTerminate(&iterator);
-			}
+            default: /* datagram ready for reading */
+                for (i = 0; i < pQuery->numMethods; i++)
+                {
+                    QueryMethod * pMethod = &pQuery->methods[i];
 
-			if (breakWhile)
-				break;
+                    if (syIsSocketSet(pMethod->socket, &set))
+                    {
+                        --numPendingMethods;
+                        pMethod->status = (*pMethod->method.responseByName)(pMethod->socket, &methodIPArray, &methodNumIps, &pMethod->context);
+                        switch (pMethod->status)
+                        {
+                        case NQ_SUCCESS:
+                            cmMemoryFree(pMethod->context); /* will handle NULL */
+                            pMethod->context = NULL;
+                            mergeIpAddresses(&result, numIps, &methodIPArray, methodNumIps);
+                            wasResponse = TRUE;
+                            break;
+                        case NQ_ERR_MOREDATA:
+                        case NQ_FAIL:
+                            cmMemoryFree(pMethod->context); /* will handle NULL */
+                            pMethod->context = NULL;
+                            cmMemoryFree(methodIPArray);
+                            methodIPArray = NULL;
+                            break;
+                        default:    /* error */
+                            break;
+                        }
+                    }
+                }
 
-			/* check pending requests */
-			if (wasResponse)
-			{
-				for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator); )
-				{
-					Method * pMethod = (Method *)cmListIteratorNext(&iterator);
+                /* rebuild the set from sockets of the methods that are still waiting */
+                syClearSocketSet(&set);
+                for (i = 0; i < pQuery->numMethods; i++)
+                {
+                    if (NQ_SUCCESS == pQuery->methods[i].status && priorityToActivate == pQuery->methods[i].method.activationPriority)
+                        syAddSocketToSet(pQuery->methods[i].socket, &set);
+                }
+            }
 
-					if (NQ_ERR_MOREDATA == pMethod->status && pMethod->method.waitAnyway)
-					{
-						wasResponse = FALSE;
-						break;
-					}
-				}
-				cmListIteratorTerminate(&iterator);
-				if (wasResponse && 0 == numPendingMethods)
-				{
-					goto Exit2;
-				}
-			}
+            if (breakWhile)
+                break;
 
-			/* recalculate timeout */
-			tmpTime = syGetTimeInMsec();
-			cmU64SubU64U64(&timeDiff, &tmpTime, &selectTimeStamp);
-			if (cmU64Cmp(&timeDiff, &zero) > 0)
-			{
-				if (cmU64Cmp(&timeDiff, &currentTimeout) > 0)
-					currentTimeout = zero;
-				else
-				{
-					NQ_TIME tmp = currentTimeout;
+            /* check pending requests */
+            if (wasResponse)
+            {
+                for (i = 0; i < pQuery->numMethods; i++)
+                {
+                    if (NQ_ERR_MOREDATA == pQuery->methods[i].status && pQuery->methods[i].method.waitAnyway)
+                    {
+                        wasResponse = FALSE;
+                        break;
+                    }
+                }
+                if (wasResponse && 0 == numPendingMethods)
+                {
+                    goto Exit;
+                }
+            }
 
-					cmU64SubU64U64(&currentTimeout, &tmp, &timeDiff);
-				}
+            /* recalculate timeout */
+            tmpTime = syGetTimeInMsec();
+            cmU64SubU64U64(&timeDiff, &tmpTime, &selectTimeStamp);
+            if (cmU64Cmp(&timeDiff, &zero) > 0)
+            {
+                if (cmU64Cmp(&timeDiff, &currentTimeout) > 0)
+                    currentTimeout = zero;
+                else
+                {
+                    NQ_TIME tmp = currentTimeout;
 
-				cmU64AddU64(&selectTimeStamp, &timeDiff);
-			}
-		} /*while (numPendingMethods > 0)*/
+                    cmU64SubU64U64(&currentTimeout, &tmp, &timeDiff);
+                }
+
+                cmU64AddU64(&selectTimeStamp, &timeDiff);
+            }
+        } /*while (numPendingMethods > 0)*/
 
         /* advance activation priority or abort */
+        if (NULL == result && priorityToActivate < RESOLVER_MAX_ACTIVATION_PRIORITY)
+        {
+            ++priorityToActivate;
+            numPendingMethods = 0;
+            continue;
+        }
         if (NULL == result)
         {
-        	if (priorityToActivate < RESOLVER_MAX_ACTIVATION_PRIORITY)
-        	{
-        		++priorityToActivate;
-        		continue;
-        	}
-        	else
-        	{
-        		LOGERR(CM_TRC_LEVEL_ERROR, "All methods failed");
-        	}
-		}
+            LOGERR(CM_TRC_LEVEL_ERROR, "All methods failed");
+        }
+        goto Exit;
+    }
 
-		goto Exit2;
+Exit:
+    if (NULL == result)
+    {
+        result = externalNameToIp(host, numIps);
     }
-Exit2:
-	if (NULL == result)
-	{
-		result = externalNameToIp(host, numIps);
-	}
 
-	if (*numIps > 1)
-	{
-		orderIPAddreses(&result, (NQ_COUNT)*numIps);
-	}
+    if (*numIps > 1)
+    {
+        orderIPAddreses(&result, (NQ_COUNT)*numIps);
+    }
 
-	/* add to cache an ordered list */
-    addToCache(host, result, (NQ_COUNT)*numIps);
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", result);
+    return result;
+}
 
-Exit1:
-#ifdef UD_NQ_CLOSESOCKETS
-    closeSockets();
-#endif
+/* complete a pending query: store its result and wake up the waiters */
+static void completePending(PendingQuery * pPending, const NQ_IPADDRESS * ips, NQ_INT numIps)
+{
+    pPending->done = TRUE;
+    if (NULL != ips && numIps > 0)
+    {
+        pPending->ips = (NQ_IPADDRESS *)cmMemoryAllocate((NQ_UINT)(sizeof(NQ_IPADDRESS) * (NQ_UINT)numIps));
+        if (NULL != pPending->ips)
+        {
+            syMemcpy(pPending->ips, ips, sizeof(NQ_IPADDRESS) * (NQ_UINT)numIps);
+            pPending->numIps = (NQ_COUNT)numIps;
+        }
+    }
+    cmListItemRemove((CMItem *)pPending);   /* new queries for this name will not join it */
+    if (pPending->waiters > 0)
+    {
+        /* waiters pass the signal on to each other, the last one disposes */
+        cmThreadCondSignal(&pPending->cond);
+    }
+    else
+    {
+        pendingUnlockCallback((CMItem *)pPending);
+    }
+}
+
+/* wait for the completion of an identical query started by another thread, called and returns with guard taken */
+static const NQ_IPADDRESS * joinPending(PendingQuery * pPending, NQ_INT * numIps)
+{
+    NQ_IPADDRESS * result = NULL;   /* copy of the resolved IPs */
+
+    pPending->waiters++;
+    syMutexGive(&staticData->guard);
+    cmThreadCondWait(&pPending->cond, PENDING_TIMEOUT);
+    syMutexTake(&staticData->guard);
+
+    *numIps = 0;
+    if (pPending->done && pPending->numIps > 0)
+    {
+        result = (NQ_IPADDRESS *)cmMemoryAllocate((NQ_UINT)(sizeof(NQ_IPADDRESS) * pPending->numIps));
+        if (NULL != result)
+        {
+            syMemcpy(result, pPending->ips, sizeof(NQ_IPADDRESS) * pPending->numIps);
+            *numIps = (NQ_INT)pPending->numIps;
+        }
+    }
+    pPending->waiters--;
+    if (pPending->done)
+    {
+        if (pPending->waiters > 0)
+            cmThreadCondSignal(&pPending->cond);
+        else
+            pendingUnlockCallback((CMItem *)pPending);
+    }
+    return result;
+}
+
+/* background refresh of positive cache entries about to expire */
+static void refreshThreadBody(void)
+{
+    for (; ;)
+    {
+        NQ_WCHAR * host = NULL;                 /* name to refresh */
+        const NQ_IPADDRESS * ips;               /* resolved IPs */
+        NQ_INT numIps = 0;                      /* number of resolved IPs */
+        Query query;                            /* query context */
+        NQ_BOOL queryValid;                     /* query context was created */
+
+        syMutexTake(&staticData->guard);
+        if (!staticData->shutdown && NULL != staticData->refresh.first)
+        {
+            host = cmMemoryCloneWString(staticData->refresh.first->name);
+            cmListItemRemoveAndDispose(staticData->refresh.first);
+        }
+        if (NULL == host)
+        {
+            staticData->refreshRunning = FALSE;
+            /* only shutdown waits for the thread: signal under the guard so that nothing is touched after it */
+            if (staticData->shutdown)
+                cmThreadCondSignal(&staticData->refreshDone);
+            syMutexGive(&staticData->guard);
+            return;
+        }
+        queryValid = queryCreate(&query);
+        syMutexGive(&staticData->guard);
+
+        ips = queryValid ? queryResolveName(&query, host, &numIps) : NULL;
+        if (queryValid)
+            queryDispose(&query);
+
+        syMutexTake(&staticData->guard);
+        if (NULL != ips)
+        {
+            /* a failed refresh leaves the existing entry to expire normally */
+            addToCache(host, ips, (NQ_COUNT)numIps);
+        }
+        syMutexGive(&staticData->guard);
+
+        cmMemoryFree(ips);
+        cmMemoryFree(host);
+    }
+}
+
+/* schedule background refresh when a positive entry enters the last part of its TTL, called with guard taken */
+static void scheduleRefresh(CacheEntry * pEntry)
+{
+    NQ_UINT32 age = (NQ_UINT32)syGetTimeInSec() - pEntry->time;   /* entry age in seconds */
+
+    if (pEntry->refreshing || 0 == pEntry->numIps || staticData->shutdown)
+        return;
+    if (age < pEntry->ttl - pEntry->ttl / CACHE_REFRESHRATIO)
+        return;
+    if (NULL == cmListItemCreateAndAdd(&staticData->refresh, sizeof(CMItem), pEntry->item.name, NULL, CM_LISTITEM_NOLOCK))
+        return;
+    pEntry->refreshing = TRUE;
+    if (!staticData->refreshRunning)
+    {
+        staticData->refreshRunning = TRUE;
+        syThreadStart(&staticData->refreshThread, refreshThreadBody, TRUE);
+    }
+}
+
+const NQ_IPADDRESS * cmResolverGetHostIps(const NQ_WCHAR * host, NQ_INT * numIps)
+{
+    const NQ_IPADDRESS * result = NULL;         /* resulted array of IPs */
+    CacheEntry * pEntry;                        /* entry in the cache */
+    PendingQuery * pPending;                    /* query in progress */
+    Query query;                                /* per-query context */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "host:%s numIps:%p", cmWDump(host), numIps);
+
+    *numIps = 0;
+
+    syMutexTake(&staticData->guard);
+
+    /* look in cache */
+    pEntry = lookupNameInCache(host);
+    if (NULL != pEntry)
+    {
+        if (pEntry->numIps > 0)
+        {
+            result = (const NQ_IPADDRESS *)cmMemoryAllocate((NQ_UINT)(sizeof(NQ_IPADDRESS) * pEntry->numIps));
+            if (NULL != result)
+            {
+                syMemcpy(result, pEntry->ips, sizeof(NQ_IPADDRESS) * pEntry->numIps);
+                *numIps = (NQ_INT)pEntry->numIps;
+            }
+            scheduleRefresh(pEntry);
+        }
+        else
+        {
+            LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Negative cache hit: %s", cmWDump(host));
+        }
+        syMutexGive(&staticData->guard);
+        goto Exit;
+    }
+
+    /* join an identical query in progress */
+    pPending = (PendingQuery *)cmListItemFind(&staticData->pending, host, TRUE, FALSE);
+    if (NULL != pPending)
+    {
+        result = joinPending(pPending, numIps);
+        syMutexGive(&staticData->guard);
+        goto Exit;
+    }
+
+    pPending = (PendingQuery *)cmListItemCreateAndAdd(&staticData->pending, sizeof(PendingQuery), host, pendingUnlockCallback, CM_LISTITEM_NOLOCK);
+    if (NULL != pPending)
+    {
+        pPending->waiters = 0;
+        pPending->done = FALSE;
+        pPending->numIps = 0;
+        pPending->ips = NULL;
+        if (!cmThreadCondSet(&pPending->cond))
+        {
+            cmListItemRemoveAndDispose((CMItem *)pPending);
+            pPending = NULL;
+        }
+    }
+    if (!queryCreate(&query))
+    {
+        if (NULL != pPending)
+            completePending(pPending, NULL, 0);
+        syMutexGive(&staticData->guard);
+        goto Exit;
+    }
+    syMutexGive(&staticData->guard);
+
+    /* network exchange runs without the module guard so that other names resolve concurrently */
+    result = queryResolveName(&query, host, numIps);
+    queryDispose(&query);
+
+    syMutexTake(&staticData->guard);
+    /* add to cache an ordered list or a negative entry */
+    addToCache(host, result, (NQ_COUNT)*numIps);
+    if (NULL != pPending)
+        completePending(pPending, result, *numIps);
     syMutexGive(&staticData->guard);
+
+Exit:
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p", result);
     return result;
 }
@@ -1276,7 +1683,7 @@ const NQ_WCHAR * cmResolverGetDCName(const NQ_WCHAR * domain, NQ_INT * numDCs)
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "domain:%s numDCs:%p", cmWDump(domain), numDCs);
 
-    syMutexTake(&staticData->guard);
+    syMutexTake(&staticData->exchangeGuard);
 
     prepareMethods();
 
@@ -1441,7 +1848,7 @@ const NQ_WCHAR * cmResolverGetDCName(const NQ_WCHAR * domain, NQ_INT * numDCs)
     }
 
 Exit:
-    syMutexGive(&staticData->guard);
+    syMutexGive(&staticData->exchangeGuard);
 	LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%p, numDCs:%d", pResult, *numDCs);
     return pResult;
 }
@@ -1466,6 +1873,7 @@ void cmResolverEnableMethod(NQ_INT type, NQ_BOOL unicast, NQ_BOOL multicast)
 
     LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "type:%d unicast:%s multicast:%s", unicast, unicast ? "TRUE" : "FALSE", multicast ? "TRUE" : "FALSE");
 
+    syMutexTake(&staticData->exchangeGuard);
     syMutexTake(&staticData->guard);
 
     for (cmListIteratorStart(&staticData->methods, &iterator); cmListIteratorHasNext(&iterator); )
@@ -1482,6 +1890,7 @@ void cmResolverEnableMethod(NQ_INT type, NQ_BOOL unicast, NQ_BOOL multicast)
     }
     cmListIteratorTerminate(&iterator);
     syMutexGive(&staticData->guard);
+    syMutexGive(&staticData->exchangeGuard);
 
     LOGFE(CM_TRC_LEVEL_FUNC_COMMON);
 }
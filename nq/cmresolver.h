@@ -146,7 +146,8 @@ void cmResolverRemoveMethod(const CMResolverMethodDescriptor * descriptor, const
 /*  Description
 	This function sets resolver cache state.
 
-	Resolver cache is enabled by default.
+	Resolver cache is enabled by default. Failed resolutions are cached as
+	negative entries for a shorter period (at most the given timeout).
 
 	Parameters
 	timeout : timeout/ttl value for entry cache (0 to disable cache)
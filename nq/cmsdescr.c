@@ -32,6 +32,23 @@
 
 #if defined(UD_CS_INCLUDESECURITYDESCRIPTORS) || defined(UD_CC_INCLUDESECURITYDESCRIPTORS) || defined (UD_CC_INCLUDEDOMAINMEMBERSHIP) || defined(UD_CS_INCLUDEPASSTHROUGH)
 
+/* SID/name cache */
+
+#define NAMECACHE_SIZE      64      /* initial number of cached SIDs */
+#define NAMECACHE_MAXSIZE   1024    /* max number of cached SIDs, see cmSdCacheReserve() */
+#define NAMECACHE_TTL       300     /* entry lifetime in seconds */
+
+typedef struct
+{
+    CMSdDomainSid sid;              /* full SID including the RID */
+    NQ_UINT16 type;                 /* SID type, CM_SD_RIDTYPE_UNKNOWN for an unmapped SID */
+    NQ_WCHAR name[CM_BUFFERLENGTH(NQ_WCHAR, CM_SD_NAMECACHELENGTH)];   /* account name */
+    NQ_WCHAR domain[CM_BUFFERLENGTH(NQ_WCHAR, CM_SD_NAMECACHELENGTH)]; /* domain name */
+    NQ_UINT32 expires;              /* expiration time in seconds, zero for a free entry */
+    NQ_UINT32 lastUsed;             /* cache clock value of the last hit, the least recent entry is recycled */
+}
+NameCacheEntry;
+
 /* local domain alias SId */
 
 typedef struct
@@ -49,6 +66,10 @@ typedef struct
     CMSdDomainSid domainSid;
 #endif /* UD_NQ_INCLUDECIFSSERVER */
     NQ_CHAR tempName[256];    /* name in ASCII */
+    NameCacheEntry * nameCache;                 /* SID/name cache */
+    NQ_UINT nameCacheSize;                      /* number of entries in the cache */
+    NQ_UINT32 nameCacheClock;                   /* running counter for lastUsed */
+    SYMutex nameCacheGuard;                     /* cache protection */
 }
 StaticData;
 
@@ -421,6 +442,16 @@ cmSdInit(
     staticData->computerSidSet = FALSE;
     cmSdGetComputerSid();
 #endif /* UD_NQ_INCLUDECIFSSERVER */
+    staticData->nameCache = (NameCacheEntry *)cmMemoryAllocate((NQ_UINT)(NAMECACHE_SIZE * sizeof(NameCacheEntry)));
+    if (NULL == staticData->nameCache)
+    {
+        result = NQ_FAIL;
+        goto Exit;
+    }
+    syMemset(staticData->nameCache, 0, NAMECACHE_SIZE * sizeof(NameCacheEntry));
+    staticData->nameCacheSize = NAMECACHE_SIZE;
+    staticData->nameCacheClock = 0;
+    syMutexCreate(&staticData->nameCacheGuard);
 
 Exit:
      return result;
@@ -441,14 +472,276 @@ cmSdExit(
     void
     )
 {
+#ifdef SY_FORCEALLOCATION
+    if (NULL == staticData)
+        return;
+#endif /* SY_FORCEALLOCATION */
+    syMutexDelete(&staticData->nameCacheGuard);
+    cmMemoryFree(staticData->nameCache);
+    staticData->nameCache = NULL;
+
     /* release memory */
 #ifdef SY_FORCEALLOCATION
-    if (NULL != staticData)
-        cmMemoryFree(staticData);
+    cmMemoryFree(staticData);
     staticData = NULL;
 #endif /* SY_FORCEALLOCATION */
 }
 
+/*
+ *====================================================================
+ * PURPOSE: compare two full SIDs
+ *--------------------------------------------------------------------
+ * PARAMS:  IN first SID
+ *          IN second SID
+ *
+ * RETURNS: TRUE on match
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static NQ_BOOL
+sameSid(
+    const CMSdDomainSid* sid1,
+    const CMSdDomainSid* sid2
+    )
+{
+    return sid1->revision == sid2->revision
+        && sid1->numAuths == sid2->numAuths
+        && 0 == syMemcmp(sid1->idAuth, sid2->idAuth, sizeof(sid1->idAuth))
+        && 0 == syMemcmp(sid1->subs, sid2->subs, sid1->numAuths * sizeof(sid1->subs[0]));
+}
+
+/*
+ *====================================================================
+ * PURPOSE: find a cached translation for a SID
+ *--------------------------------------------------------------------
+ * PARAMS:  IN SID to look for
+ *          OUT buffer for account name or NULL
+ *          OUT buffer for domain name or NULL
+ *          OUT buffer for SID type
+ *
+ * RETURNS: TRUE when a live entry was found
+ *
+ * NOTES:   an unmapped SID is also cached - it is reported with
+ *          CM_SD_RIDTYPE_UNKNOWN type and empty names
+ *          name buffers should accommodate CM_SD_NAMECACHELENGTH
+ *          characters
+ *====================================================================
+ */
+
+NQ_BOOL
+cmSdCacheFindSid(
+    const CMSdDomainSid* sid,
+    NQ_WCHAR* name,
+    NQ_WCHAR* domain,
+    NQ_UINT16* type
+    )
+{
+    NQ_UINT32 curTime = (NQ_UINT32)syGetTimeInSec();  /* current time */
+    NQ_UINT i;                                          /* just a counter */
+    NQ_BOOL result = FALSE;                             /* return value */
+
+    syMutexTake(&staticData->nameCacheGuard);
+    for (i = 0; i < staticData->nameCacheSize; i++)
+    {
+        NameCacheEntry* pEntry = &staticData->nameCache[i];
+
+        if (pEntry->expires <= curTime || !sameSid(&pEntry->sid, sid))
+            continue;
+        pEntry->lastUsed = ++staticData->nameCacheClock;
+        if (NULL != name)
+            syWStrcpy(name, pEntry->name);
+        if (NULL != domain)
+            syWStrcpy(domain, pEntry->domain);
+        *type = pEntry->type;
+        result = TRUE;
+        break;
+    }
+    syMutexGive(&staticData->nameCacheGuard);
+    return result;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: find a cached SID for an account name
+ *--------------------------------------------------------------------
+ * PARAMS:  IN account name to look for
+ *          IN domain name or NULL to match any domain
+ *          OUT buffer for SID
+ *          OUT buffer for SID type
+ *
+ * RETURNS: TRUE when a live mapped entry was found
+ *
+ * NOTES:   names are compared case insensitive
+ *====================================================================
+ */
+
+NQ_BOOL
+cmSdCacheFindName(
+    const NQ_WCHAR* name,
+    const NQ_WCHAR* domain,
+    CMSdDomainSid* sid,
+    NQ_UINT16* type
+    )
+{
+    NQ_UINT32 curTime = (NQ_UINT32)syGetTimeInSec();  /* current time */
+    NQ_UINT i;                                          /* just a counter */
+    NQ_BOOL result = FALSE;                             /* return value */
+
+    syMutexTake(&staticData->nameCacheGuard);
+    for (i = 0; i < staticData->nameCacheSize; i++)
+    {
+        NameCacheEntry* pEntry = &staticData->nameCache[i];
+
+        if (   pEntry->expires <= curTime
+            || CM_SD_RIDTYPE_UNKNOWN == pEntry->type
+            || 0 != cmWStricmp(pEntry->name, name)
+            || (NULL != domain && 0 != cmWStricmp(pEntry->domain, domain))
+           )
+            continue;
+        pEntry->lastUsed = ++staticData->nameCacheClock;
+        syMemcpy(sid, &pEntry->sid, sizeof(*sid));
+        *type = pEntry->type;
+        result = TRUE;
+        break;
+    }
+    syMutexGive(&staticData->nameCacheGuard);
+    return result;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: cache a SID translation
+ *--------------------------------------------------------------------
+ * PARAMS:  IN SID
+ *          IN account name or NULL for an unmapped SID
+ *          IN domain name or NULL
+ *          IN SID type
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   an existing entry for the same SID is overwritten, otherwise
+ *          a free or expired entry is used and, when there is none, the
+ *          least recently used entry is recycled
+ *          names that do not fit into CM_SD_NAMECACHELENGTH are not
+ *          cached
+ *====================================================================
+ */
+
+void
+cmSdCacheAdd(
+    const CMSdDomainSid* sid,
+    const NQ_WCHAR* name,
+    const NQ_WCHAR* domain,
+    NQ_UINT16 type
+    )
+{
+    NQ_UINT32 curTime = (NQ_UINT32)syGetTimeInSec();  /* current time */
+    NameCacheEntry* pVictim = NULL;                     /* entry to use */
+    NQ_UINT i;                                          /* just a counter */
+
+    if (   (NULL != name && syWStrlen(name) > CM_SD_NAMECACHELENGTH)
+        || (NULL != domain && syWStrlen(domain) > CM_SD_NAMECACHELENGTH)
+       )
+        return;
+
+    syMutexTake(&staticData->nameCacheGuard);
+    for (i = 0; i < staticData->nameCacheSize; i++)
+    {
+        NameCacheEntry* pEntry = &staticData->nameCache[i];
+
+        if (pEntry->expires > curTime && sameSid(&pEntry->sid, sid))
+        {
+            pVictim = pEntry;
+            break;
+        }
+        if (NULL == pVictim || (pVictim->expires > curTime && (pEntry->expires <= curTime || pEntry->lastUsed < pVictim->lastUsed)))
+            pVictim = pEntry;
+    }
+    syMemcpy(&pVictim->sid, sid, sizeof(pVictim->sid));
+    pVictim->type = type;
+    if (NULL == name)
+        pVictim->name[0] = cmWChar(0);
+    else
+        syWStrcpy(pVictim->name, name);
+    if (NULL == domain)
+        pVictim->domain[0] = cmWChar(0);
+    else
+        syWStrcpy(pVictim->domain, domain);
+    pVictim->expires = curTime + NAMECACHE_TTL;
+    pVictim->lastUsed = ++staticData->nameCacheClock;
+    syMutexGive(&staticData->nameCacheGuard);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: make room for the SIDs of one request
+ *--------------------------------------------------------------------
+ * PARAMS:  IN number of SIDs the caller is about to resolve
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   the cache grows up to NAMECACHE_MAXSIZE entries so that
+ *          translations resolved in a batch are not recycled before
+ *          the caller reads them back, it never shrinks
+ *====================================================================
+ */
+
+void
+cmSdCacheReserve(
+    NQ_UINT count
+    )
+{
+    NameCacheEntry* pCache;     /* grown cache */
+
+    if (count > NAMECACHE_MAXSIZE)
+        count = NAMECACHE_MAXSIZE;
+
+    syMutexTake(&staticData->nameCacheGuard);
+    if (count <= staticData->nameCacheSize)
+        goto Exit;
+    pCache = (NameCacheEntry *)cmMemoryAllocate((NQ_UINT)(count * sizeof(NameCacheEntry)));
+    if (NULL == pCache)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+        goto Exit;
+    }
+    syMemset(pCache, 0, count * sizeof(NameCacheEntry));
+    syMemcpy(pCache, staticData->nameCache, staticData->nameCacheSize * sizeof(NameCacheEntry));
+    cmMemoryFree(staticData->nameCache);
+    staticData->nameCache = pCache;
+    staticData->nameCacheSize = count;
+
+Exit:
+    syMutexGive(&staticData->nameCacheGuard);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: drop all cached SID translations
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   called when local accounts change
+ *====================================================================
+ */
+
+void
+cmSdCacheFlush(
+    void
+    )
+{
+    NQ_UINT i;      /* just a counter */
+
+    syMutexTake(&staticData->nameCacheGuard);
+    for (i = 0; i < staticData->nameCacheSize; i++)
+        staticData->nameCache[i].expires = 0;
+    syMutexGive(&staticData->nameCacheGuard);
+}
+
 /*
  *====================================================================
  * PURPOSE: check security descriptor
@@ -2021,6 +2314,9 @@ cmSdLookupName(
 {
     NQ_UINT i;                        /* just a counter */
     NQ_BOOL result = TRUE;
+    CMSdDomainSid sid;                /* cached or composed SID */
+    NQ_UINT16 type;                   /* cached SID type */
+    NQ_WCHAR hostName[CM_BUFFERLENGTH(NQ_WCHAR, CM_NQ_HOSTNAMESIZE)];   /* local domain name */
 
     cmUnicodeToAnsiN(staticData->tempName, name, sizeof(staticData->tempName));
     for (i = 0; i < sizeof(localAliases)/sizeof(localAliases[0]); i++)
@@ -2031,7 +2327,21 @@ cmSdLookupName(
             goto Exit;
         }
     }
+
+    /* local users are cached with the host name as their domain */
+    syAnsiToUnicode(hostName, cmNetBiosGetHostNameZeroed());
+    if (cmSdCacheFindName(name, hostName, &sid, &type))
+    {
+        *rid = sid.subs[sid.numAuths - 1];
+        goto Exit;
+    }
     result = udGetUserRidByName(name, rid);
+    if (result)
+    {
+        syMemcpy(&sid, cmSdGetComputerSid(), sizeof(sid));
+        sid.subs[sid.numAuths++] = *rid;
+        cmSdCacheAdd(&sid, name, hostName, (NQ_UINT16)cmSdGetRidType(*rid));
+    }
 
 Exit:
     return result;
@@ -194,6 +194,49 @@ cmSdExit(
     void
     );
 
+/* SID/name cache */
+
+#define CM_SD_NAMECACHELENGTH   64      /* max name length in a cache entry */
+
+/* find a cached translation for a SID */
+NQ_BOOL                         /* TRUE when found */
+cmSdCacheFindSid(
+    const CMSdDomainSid* sid,   /* SID to look for */
+    NQ_WCHAR* name,             /* buffer for account name or NULL */
+    NQ_WCHAR* domain,           /* buffer for domain name or NULL */
+    NQ_UINT16* type             /* buffer for SID type */
+    );
+
+/* find a cached SID for an account name */
+NQ_BOOL                         /* TRUE when found */
+cmSdCacheFindName(
+    const NQ_WCHAR* name,       /* account name */
+    const NQ_WCHAR* domain,     /* domain name or NULL for any */
+    CMSdDomainSid* sid,         /* buffer for SID */
+    NQ_UINT16* type             /* buffer for SID type */
+    );
+
+/* cache a SID translation */
+void
+cmSdCacheAdd(
+    const CMSdDomainSid* sid,   /* SID */
+    const NQ_WCHAR* name,       /* account name or NULL */
+    const NQ_WCHAR* domain,     /* domain name or NULL */
+    NQ_UINT16 type              /* SID type */
+    );
+
+/* make room for the SIDs of one request */
+void
+cmSdCacheReserve(
+    NQ_UINT count               /* number of SIDs about to be resolved */
+    );
+
+/* drop all cached SID translations */
+void
+cmSdCacheFlush(
+    void
+    );
+
 /* check security descriptor */
 NQ_BOOL                                 /* TRUE when valid */
 cmSdIsValid(
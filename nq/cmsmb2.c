@@ -28,6 +28,7 @@
 /* SMB2 identification bytes {0xFE, 'S', 'M', 'B'} */
 const NQ_BYTE cmSmb2ProtocolId[4] = {0xFE, 0x53, 0x4D, 0x42};
 const NQ_BYTE cmSmb2TrnsfrmHdrProtocolId[4] = {0xFD, 0x53, 0x4D, 0x42};
+const NQ_BYTE cmSmb2CmprsHdrProtocolId[4] = {0xFC, 0x53, 0x4D, 0x42};
 
 static void smb2HeaderInit(CMSmb2Header *header)
 {
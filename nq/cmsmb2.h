@@ -24,6 +24,7 @@
 /* SMB2 protocol identification bytes */
 extern const NQ_BYTE cmSmb2ProtocolId[4];
 extern const NQ_BYTE cmSmb2TrnsfrmHdrProtocolId[4];
+extern const NQ_BYTE cmSmb2CmprsHdrProtocolId[4];
 
 typedef NQ_UINT16 CSDialect;
 /* SMB2 negotiate dialect string */
@@ -54,6 +55,7 @@ typedef NQ_UINT16 CSDialect;
 /* SMB2 context types */
 #define SMB2_PREAUTH_INTEGRITY_CAPABILITIES 0x0001
 #define SMB2_ENCRYPTION_CAPABILITIES        0x0002
+#define SMB2_COMPRESSION_CAPABILITIES       0x0003
 
 /* SMB2 context lengths */
 #define SMB2_PREAUTH_INTEGRITY_CONTEXT_LEN_BYTES 0x0026
@@ -67,6 +69,25 @@ typedef NQ_UINT16 CSDialect;
 /* Hash algorithms */
 #define SHA_512                 0x0001
 
+/* Compression algorithms */
+#define SMB2_COMPRESSION_NONE           0x0000
+#define SMB2_COMPRESSION_LZNT1          0x0001
+#define SMB2_COMPRESSION_LZ77           0x0002
+#define SMB2_COMPRESSION_LZ77_HUFFMAN   0x0003
+#define SMB2_COMPRESSION_PATTERN_V1     0x0004
+
+/* Compression capabilities context flags */
+#define SMB2_COMPRESSION_CAPABILITIES_FLAG_NONE     0x00000000
+#define SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED  0x00000001
+
+/* Compression transform header flags */
+#define SMB2_COMPRESSION_FLAG_NONE      0x0000
+#define SMB2_COMPRESSION_FLAG_CHAINED   0x0001
+
+/* Compression transform header sizes */
+#define SMB2_COMPRESSIONHEADER_SIZE         16  /* unchained */
+#define SMB2_CHAINEDCOMPRESSIONHEADER_SIZE  8   /* chained, followed by payload headers */
+
 /* dialect control functions */
 void csSetSmbDialect(CSDialect smbDialect, NQ_BOOL on);
 NQ_BOOL csGetSmbDialect(CSDialect smbDialect);
@@ -116,6 +137,20 @@ NQ_BOOL csGetSmbDialect(CSDialect smbDialect);
 #define SMB2_OPLOCK_LEVEL_BATCH     0x09
 #define SMB2_OPLOCK_LEVEL_LEASE     0xFF
 
+/* Lease states and flags */
+#define SMB2_LEASE_NONE             0x00
+#define SMB2_LEASE_READ_CACHING     0x01
+#define SMB2_LEASE_HANDLE_CACHING   0x02
+#define SMB2_LEASE_WRITE_CACHING    0x04
+#define SMB2_LEASE_FLAG_BREAK_IN_PROGRESS       0x00000002
+#define SMB2_LEASE_FLAG_PARENT_LEASE_KEY_SET    0x00000004
+#define SMB2_NOTIFY_BREAK_LEASE_FLAG_ACK_REQUIRED 0x01
+#define SMB2_LEASE_KEY_SIZE         16
+#define SMB2_LEASE_V1_SIZE          32  /* RqLs context data, SMB 2.1 */
+#define SMB2_LEASE_V2_SIZE          52  /* RqLs context data, SMB 3.x */
+#define SMB2_LEASE_BREAK_SIZE       44  /* lease break notification structure size */
+#define SMB2_LEASE_ACK_SIZE         36  /* lease break acknowledgment/response structure size */
+
 
 /* Encryption Parameters */
 #define SMB2_ENCRYPTION_AES128_CCM	0x0001
@@ -254,6 +289,10 @@ void cmTimeWrite(CMBufferWriter *writer, const CMTime *time);
 
 #define SMB2_0_IOCTL_IS_FSCTL				0x00000001
 
+/* SMB2 read request flags */
+#define SMB2_READFLAG_READ_UNBUFFERED		0x01
+#define SMB2_READFLAG_REQUEST_COMPRESSED	0x02
+
 /* Oplock levels */
 #define SMB2_OPLOCK_NONE      0x00
 #define SMB2_OPLOCK_II        0x01
@@ -618,6 +618,259 @@ cmAnsiToUnicodeN(
 #endif
 }
 
+/*
+ *====================================================================
+ * PURPOSE: Convert UTF-8 string to UTF-16LE string
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT destination string
+ *          IN destination buffer size in characters, including
+ *             the terminator
+ *          IN source string
+ *          IN source length in bytes or -1 for a null-terminated
+ *             string
+ *
+ * RETURNS: number of characters placed, not including the terminator
+ *          or NQ_FAIL when the source is not a valid UTF-8 sequence
+ *          or the result does not fit into the buffer
+ *
+ * NOTES:   This is a native replacement for iconv() on the file name
+ *          path. Plain ASCII runs are processed a 32-bit word at a time.
+ *          Overlong sequences, surrogates and values above U+10FFFF
+ *          are rejected.
+ *====================================================================
+ */
+
+NQ_INT
+cmUtf8ToUtf16LE(
+    NQ_WCHAR* w,
+    NQ_COUNT wSize,
+    const NQ_CHAR* u,
+    NQ_INT uLength
+    )
+{
+    const NQ_BYTE* in = (const NQ_BYTE*)u;
+    const NQ_BYTE* inEnd;
+    NQ_WCHAR* out = w;
+    NQ_WCHAR* outEnd;
+    NQ_INT result = NQ_FAIL;
+
+    if (NULL == w || NULL == u || 0 == wSize)
+        goto Exit;
+
+    inEnd = in + (uLength < 0 ? syStrlen(u) : (NQ_COUNT)uLength);
+    outEnd = w + wSize - 1;     /* reserve room for the terminator */
+
+    while (in < inEnd)
+    {
+        NQ_UINT32 c;
+        NQ_COUNT extra;
+        NQ_UINT32 minValue;
+
+        /* ASCII fast path: four bytes per iteration while none has the high bit set
+           and none is a terminator */
+        while (inEnd - in >= 4 && outEnd - out >= 4)
+        {
+            NQ_UINT32 word;
+
+            syMemcpy(&word, in, sizeof(word));
+            if (((word | ((word - 0x01010101) & ~word)) & 0x80808080) != 0)
+                break;
+            out[0] = cmHtol16((NQ_WCHAR)in[0]);
+            out[1] = cmHtol16((NQ_WCHAR)in[1]);
+            out[2] = cmHtol16((NQ_WCHAR)in[2]);
+            out[3] = cmHtol16((NQ_WCHAR)in[3]);
+            in += 4;
+            out += 4;
+        }
+        if (in >= inEnd)
+            break;
+
+        c = *in++;
+        if (c == 0)
+            break;
+        if (c < 0x80)
+        {
+            extra = 0;
+            minValue = 0;
+        }
+        else if ((c & 0xE0) == 0xC0)
+        {
+            extra = 1;
+            minValue = 0x80;
+            c &= 0x1F;
+        }
+        else if ((c & 0xF0) == 0xE0)
+        {
+            extra = 2;
+            minValue = 0x800;
+            c &= 0x0F;
+        }
+        else if ((c & 0xF8) == 0xF0)
+        {
+            extra = 3;
+            minValue = 0x10000;
+            c &= 0x07;
+        }
+        else
+        {
+            goto Exit;
+        }
+
+        if ((NQ_COUNT)(inEnd - in) < extra)
+            goto Exit;
+        for (; extra > 0; extra--, in++)
+        {
+            if ((*in & 0xC0) != 0x80)
+                goto Exit;
+            c = (c << 6) | (*in & 0x3F);
+        }
+        if (c < minValue || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+            goto Exit;
+
+        if (c >= 0x10000)
+        {
+            if (outEnd - out < 2)
+                goto Exit;
+            c -= 0x10000;
+            *out++ = cmHtol16((NQ_WCHAR)(0xD800 | (c >> 10)));
+            *out++ = cmHtol16((NQ_WCHAR)(0xDC00 | (c & 0x3FF)));
+        }
+        else
+        {
+            if (out >= outEnd)
+                goto Exit;
+            *out++ = cmHtol16((NQ_WCHAR)c);
+        }
+    }
+    result = (NQ_INT)(out - w);
+
+Exit:
+    if (NULL != w && wSize > 0)
+        *out = 0;
+    return result;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Convert UTF-16LE string to UTF-8 string
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT destination string
+ *          IN destination buffer size in bytes, including the
+ *             terminator
+ *          IN source string
+ *          IN source length in characters or -1 for a
+ *             null-terminated string
+ *
+ * RETURNS: number of bytes placed, not including the terminator
+ *          or NQ_FAIL when the source contains an unpaired surrogate
+ *          or the result does not fit into the buffer
+ *
+ * NOTES:   This is a native replacement for iconv() on the file name
+ *          path. Plain ASCII runs are processed four characters at a
+ *          time.
+ *====================================================================
+ */
+
+NQ_INT
+cmUtf16LEToUtf8(
+    NQ_CHAR* u,
+    NQ_COUNT uSize,
+    const NQ_WCHAR* w,
+    NQ_INT wLength
+    )
+{
+    const NQ_WCHAR* in = w;
+    const NQ_WCHAR* inEnd;
+    NQ_BYTE* out = (NQ_BYTE*)u;
+    NQ_BYTE* outEnd;
+    NQ_INT result = NQ_FAIL;
+
+    if (NULL == u || NULL == w || 0 == uSize)
+        goto Exit;
+
+    inEnd = in + (wLength < 0 ? cmWStrlen(w) : (NQ_COUNT)wLength);
+    outEnd = out + uSize - 1;   /* reserve room for the terminator */
+
+    while (in < inEnd)
+    {
+        NQ_UINT32 c;
+
+        /* ASCII fast path: four characters per iteration */
+        while (inEnd - in >= 4 && outEnd - out >= 4)
+        {
+            NQ_WCHAR c0 = cmLtoh16(in[0]);
+            NQ_WCHAR c1 = cmLtoh16(in[1]);
+            NQ_WCHAR c2 = cmLtoh16(in[2]);
+            NQ_WCHAR c3 = cmLtoh16(in[3]);
+
+            if (((c0 | c1 | c2 | c3) & 0xFF80) != 0 || c0 == 0 || c1 == 0 || c2 == 0 || c3 == 0)
+                break;
+            out[0] = (NQ_BYTE)c0;
+            out[1] = (NQ_BYTE)c1;
+            out[2] = (NQ_BYTE)c2;
+            out[3] = (NQ_BYTE)c3;
+            in += 4;
+            out += 4;
+        }
+        if (in >= inEnd)
+            break;
+
+        c = cmLtoh16(*in);
+        in++;
+        if (c == 0)
+            break;
+        if (c >= 0xD800 && c <= 0xDFFF)
+        {
+            NQ_UINT32 low;
+
+            if (c >= 0xDC00 || in >= inEnd)
+                goto Exit;
+            low = cmLtoh16(*in);
+            if (low < 0xDC00 || low > 0xDFFF)
+                goto Exit;
+            in++;
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+        }
+
+        if (c < 0x80)
+        {
+            if (out >= outEnd)
+                goto Exit;
+            *out++ = (NQ_BYTE)c;
+        }
+        else if (c < 0x800)
+        {
+            if (outEnd - out < 2)
+                goto Exit;
+            *out++ = (NQ_BYTE)(0xC0 | (c >> 6));
+            *out++ = (NQ_BYTE)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            if (outEnd - out < 3)
+                goto Exit;
+            *out++ = (NQ_BYTE)(0xE0 | (c >> 12));
+            *out++ = (NQ_BYTE)(0x80 | ((c >> 6) & 0x3F));
+            *out++ = (NQ_BYTE)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            if (outEnd - out < 4)
+                goto Exit;
+            *out++ = (NQ_BYTE)(0xF0 | (c >> 18));
+            *out++ = (NQ_BYTE)(0x80 | ((c >> 12) & 0x3F));
+            *out++ = (NQ_BYTE)(0x80 | ((c >> 6) & 0x3F));
+            *out++ = (NQ_BYTE)(0x80 | (c & 0x3F));
+        }
+    }
+    result = (NQ_INT)(out - (NQ_BYTE*)u);
+
+Exit:
+    if (NULL != u && uSize > 0)
+        *out = 0;
+    return result;
+}
+
 /*
  *====================================================================
  * PURPOSE: Convert Unicode string into an ANSI string for immediate printout
@@ -116,6 +116,22 @@ cmAnsiToUnicodeN(
     NQ_UINT size
     );
 
+NQ_INT
+cmUtf8ToUtf16LE(
+    NQ_WCHAR* w,
+    NQ_COUNT wSize,
+    const NQ_CHAR* u,
+    NQ_INT uLength
+    );
+
+NQ_INT
+cmUtf16LEToUtf8(
+    NQ_CHAR* u,
+    NQ_COUNT uSize,
+    const NQ_WCHAR* w,
+    NQ_INT wLength
+    );
+
 NQ_CHAR*
 cmWDump(
     const NQ_WCHAR* w
@@ -219,6 +219,12 @@
 #if (defined(UD_NQ_INCLUDESMB311) && !defined(UD_NQ_INCLUDESMB3))
 #error UD_NQ_INCLUDESMB311 requires UD_NQ_INCLUDESMB3
 #endif
+#if (defined(UD_CS_INCLUDEMULTICHANNEL) && !defined(UD_NQ_INCLUDESMB3))
+#error UD_CS_INCLUDEMULTICHANNEL requires UD_NQ_INCLUDESMB3
+#endif
+#if (defined(UD_NQ_INCLUDECOMPRESSION) && !defined(UD_NQ_INCLUDESMB311))
+#error UD_NQ_INCLUDECOMPRESSION requires UD_NQ_INCLUDESMB311
+#endif
 
 #if (defined(UD_CS_INCLUDESECURITYDESCRIPTORS) || defined(UD_CC_INCLUDESECURITYDESCRIPTORS) || defined (UD_CC_INCLUDEDOMAINMEMBERSHIP) || defined(UD_CS_INCLUDEPASSTHROUGH)) && !defined(UD_CM_SECURITYDESCRIPTORLENGTH)
 #error Any Security Descriptor Define Or Domain Membership or Passthrough Requires UD_CM_SECURITYDESCRIPTORLENGTH
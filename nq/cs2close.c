@@ -219,7 +219,7 @@ NQ_UINT32 csSmb2OnClose(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *rea
 
     /* complete oplock break operation (send late response) if required */
 
-    if (pFile->oplockGranted && pFile->isBreakingOpLock)
+    if ((pFile->oplockGranted && pFile->isBreakingOpLock) || csBreakLeaseClose(pFile))
     {
         CMBufferWriter packet;
 
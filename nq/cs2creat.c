@@ -34,6 +34,12 @@
 #define CONTEXT_DHNC    0x04
 #define CONTEXT_ALSI    0x08
 #define CONTEXT_MXAC    0x10
+#define CONTEXT_RQLS    0x20
+#define CONTEXT_DH2Q    0x40
+#define CONTEXT_DH2C    0x80
+
+#define DURABLE_DEFAULTTIMEOUT  60000   /* durable timeout when the client leaves it to the server (ms) */
+#define DURABLE_MAXTIMEOUT      300000  /* longest durable timeout granted (ms) */
 
 /* Table of context parsers */
 static NQ_BOOL parseSecd(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext * context);
@@ -41,15 +47,21 @@ static NQ_BOOL parseDhnq(CMBufferReader * reader, NQ_UINT32 len,  CSCreateContex
 static NQ_BOOL parseDhnc(CMBufferReader * reader,  NQ_UINT32 len, CSCreateContext * context);
 static NQ_BOOL parseAlsi(CMBufferReader * reader,  NQ_UINT32 len, CSCreateContext * context);
 static NQ_BOOL parseMxac(CMBufferReader * reader,  NQ_UINT32 len, CSCreateContext * context);
+static NQ_BOOL parseRqLs(CMBufferReader * reader,  NQ_UINT32 len, CSCreateContext * context);
+static NQ_BOOL parseDh2q(CMBufferReader * reader,  NQ_UINT32 len, CSCreateContext * context);
+static NQ_BOOL parseDh2c(CMBufferReader * reader,  NQ_UINT32 len, CSCreateContext * context);
 static NQ_UINT32 performSecd(CSCreateParams * params, const CSCreateContext * context);
 static NQ_UINT32 performAlsi(CSCreateParams * params, const CSCreateContext * context);
 #ifdef UD_CS_INCLUDEPERSISTENTFIDS 
 /*static NQ_UINT32 performDhnq(CSCreateParams * params, const CSCreateContext * context);*/
 static NQ_UINT32 performDhnc(CSCreateParams * params, const CSCreateContext * context);
+static NQ_UINT32 performDh2c(CSCreateParams * params, const CSCreateContext * context);
 #endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 static NQ_UINT32 packMxac(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context);
+static NQ_UINT32 packRqLs(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context);
 #ifdef UD_CS_INCLUDEPERSISTENTFIDS 
-/*static NQ_UINT32 packDhnq(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context);*/
+static NQ_UINT32 packDhnq(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context);
+static NQ_UINT32 packDh2q(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context);
 #endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 typedef struct 
 {
@@ -64,13 +76,16 @@ ContextParser contextDescriptors[] = {
     { "MxAc", CONTEXT_MXAC, parseMxac, NULL, packMxac },
     { "SecD", CONTEXT_SECD, parseSecd, performSecd, NULL },
 #ifdef UD_CS_INCLUDEPERSISTENTFIDS 
-    { "DHnQ", CONTEXT_DHNQ, parseDhnq, NULL, NULL, /*performDhnq, packDhnq*/ },
+    { "DHnQ", CONTEXT_DHNQ, parseDhnq, NULL, packDhnq },
     { "DHnC", CONTEXT_DHNC, parseDhnc, performDhnc, NULL },
+    { "DH2Q", CONTEXT_DH2Q, parseDh2q, NULL, packDh2q },
+    { "DH2C", CONTEXT_DH2C, parseDh2c, performDh2c, NULL },
 #else /* UD_CS_INCLUDEPERSISTENTFIDS */
     { "DHnQ", CONTEXT_DHNQ, parseDhnq, NULL, NULL },
     { "DHnC", CONTEXT_DHNC, parseDhnc, NULL, NULL },
 #endif /* UD_CS_INCLUDEPERSISTENTFIDS */
     { "ALSi", CONTEXT_ALSI, parseAlsi, performAlsi, NULL },
+    { "RqLs", CONTEXT_RQLS, parseRqLs, NULL, packRqLs },
 };
 
 /* Convert Posiz access mask into NT access mask */
@@ -196,6 +211,9 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
 
     /* parse contexts */
     params.context.flags = 0;
+    params.context.leaseRequested = FALSE;
+    params.context.durableRequested = FALSE;
+    params.context.durableGranted = FALSE;
     cmBufferReaderSetPosition(reader, in->_start + contextOffset);
     while (contextLen > 0)
     {
@@ -284,6 +302,7 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
     params.uid = user->uid;
     params.unicodeRequired = TRUE;
     params.user = user;
+    params.sharingViolation = FALSE;
 
     /* Fix "create options". For an existing file Win SMB2 does not bother to set directory/file 
        flags. Since NQ common SMB1/2 processing checks those bits we need to fill up this gap */
@@ -309,6 +328,7 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
     if (callCommon)
     {
         returnValue = csCreateCommonProcessing(&params);
+        params.sharingViolation = (SMB_STATUS_SHARING_VIOLATION == returnValue);
         if (0 != returnValue && SMB_STATUS_SHARING_VIOLATION != returnValue)
         {
             LOGERR(CM_TRC_LEVEL_ERROR, "failed, value 0x%x", returnValue);
@@ -374,8 +394,8 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
 #endif
         params.file->nid = pName->nid;
     }
-    /* check for oplock break */
-    if ((oplockLevel != SMB2_OPLOCK_LEVEL_NONE) && csBreakCheck(&params) == TRUE)
+    /* check for oplock or lease break */
+    if ((oplockLevel != SMB2_OPLOCK_LEVEL_NONE || csBreakLeaseConflict(&params)) && csBreakCheck(&params) == TRUE)
     {
         CSFile *pFile;
 		 NQ_UINT32 asyncId = 0;     /* generated Async ID */
@@ -431,6 +451,7 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
 #endif /*UD_CS_INCLUDERPC_SPOOLSS */
         )
     {
+        params.context.flags &= (NQ_UINT32)~CONTEXT_RQLS;
         cmBufferWriteByte(writer, SMB2_OPLOCK_LEVEL_NONE); 
     }
     else
@@ -443,7 +464,21 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
             return SMB_STATUS_UNSUCCESSFUL;
         }
 
-		if (oplockLevel != SMB2_OPLOCK_LEVEL_NONE)
+        if (oplockLevel == SMB2_OPLOCK_LEVEL_LEASE)
+        {
+            /* leases are granted by state rather than refused after a break */
+            if (!params.context.leaseRequested || connection->dialect < CS_DIALECT_SMB210 ||
+                csGetFilesCount() > MAX_NUM_OPLOCK_OPEN_FILES ||
+                csGetUniqueFilesCount() > MAX_NUM_OPLOCK_OPEN_UNIQUE_FILES)
+            {
+                oplockLevel = SMB2_OPLOCK_LEVEL_NONE;
+            }
+            else
+            {
+                csBreakGrantLease(params.file, &params.context);
+            }
+        }
+		else if (oplockLevel != SMB2_OPLOCK_LEVEL_NONE)
 		{
             if (params.file->isDirectory || pName->wasOplockBroken)
             {
@@ -458,24 +493,16 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
                 }
                 else
                 {
-        			if (0 != csGetFileInformationByName(tree->share, params.fileName, &params.fileInfo
-#ifdef UD_NQ_INCLUDEEVENTLOG
-        					,user
-#endif /* UD_NQ_INCLUDEEVENTLOG */
-                        	))
-        			{
-        				LOGERR(CM_TRC_LEVEL_ERROR, "Unable to get file info");
-        				LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
-        				return SMB_STATUS_OBJECT_NAME_INVALID;
-        			}
-
-                    /* we grant LEVEL II oplock for readonly file */
+                    /* we grant LEVEL II oplock for readonly file
+                       (the information was read by the common create processing) */
         		    oplockLevel = (params.fileInfo.attributes & SY_ATTR_READONLY) ? SMB2_OPLOCK_LEVEL_NONE : SMB2_OPLOCK_LEVEL_BATCH;
                 }
             }
 		}
+        if (oplockLevel != SMB2_OPLOCK_LEVEL_LEASE)
+            params.context.flags &= (NQ_UINT32)~CONTEXT_RQLS;
         cmBufferWriteByte(writer, oplockLevel);
-        params.file->oplockGranted = oplockLevel != SMB2_OPLOCK_LEVEL_NONE;
+        params.file->oplockGranted = oplockLevel != SMB2_OPLOCK_LEVEL_NONE && oplockLevel != SMB2_OPLOCK_LEVEL_LEASE;
         params.file->breakContext.socket = csDispatchGetSocket();
         params.file->breakContext.isSmb2 = TRUE;
 #ifdef UD_NQ_INCLUDESMB3
@@ -484,6 +511,30 @@ NQ_UINT32 csSmb2OnCreate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *re
 		params.file->user = user;
 		params.file->uid = user->uid;
 		params.file->tid = tree->tid;
+
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+        /* durable handles are granted to opens the client caches handles for */
+        if (params.context.durableRequested && 
+            (oplockLevel == SMB2_OPLOCK_LEVEL_BATCH || 
+             (oplockLevel == SMB2_OPLOCK_LEVEL_LEASE && (params.context.leaseState & SMB2_LEASE_HANDLE_CACHING))))
+        {
+            params.context.durableGranted = TRUE;
+            params.file->durableFlags = CS_DURABLE_REQUIRED;
+            params.file->durableTimeout = DURABLE_DEFAULTTIMEOUT;
+            csDurableSetOwner(params.file, user);
+            if (params.context.durableV2)
+            {
+                if (0 == params.context.durableTimeout)
+                    params.context.durableTimeout = DURABLE_DEFAULTTIMEOUT;
+                if (params.context.durableTimeout > DURABLE_MAXTIMEOUT)
+                    params.context.durableTimeout = DURABLE_MAXTIMEOUT;
+                params.file->durableFlags |= CS_DURABLE_V2;
+                params.file->durableTimeout = params.context.durableTimeout;
+                syMemcpy(params.file->durableGuid, params.context.createGuid, sizeof(params.file->durableGuid));
+                csDurableJournalAdd(params.file, &params);
+            }
+        }
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
     }
  
     cmBufferWriteByte(writer, 0);       /* reserved */
@@ -554,10 +605,58 @@ static NQ_BOOL parseSecd(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext
 static NQ_BOOL parseDhnq(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext * context)
 {
     LOGFB(CM_TRC_LEVEL_MESS_SOME);
+    if (!context->durableRequested)
+    {
+        context->durableRequested = TRUE;
+        context->durableV2 = FALSE;
+        context->durableTimeout = 0;
+    }
+    LOGFE(CM_TRC_LEVEL_MESS_SOME);
+    return TRUE;
+}
+
+/*====================================================================
+ * PURPOSE: Durable Handle Request V2 Context parser
+ *--------------------------------------------------------------------
+ * PARAMS:  IN reader - request reader pointing to the context data
+ *               IN len - context data length
+ *               IN/OUT context - pointer to the create context
+ *
+ * RETURNS: TRUE to call common processing, FALSE to skip
+ *====================================================================
+ */
+static NQ_BOOL parseDh2q(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext * context)
+{
+    LOGFB(CM_TRC_LEVEL_MESS_SOME);
+    cmBufferReadUint32(reader, &context->durableTimeout);
+    cmBufferReaderSkip(reader, 4 + 8);      /* flags, reserved */
+    cmBufferReadBytes(reader, context->createGuid, sizeof(context->createGuid));
+    context->durableRequested = TRUE;
+    context->durableV2 = TRUE;
     LOGFE(CM_TRC_LEVEL_MESS_SOME);
     return TRUE;
 }
 
+/*====================================================================
+ * PURPOSE: Durable Handle Reconnect V2 Context parser
+ *--------------------------------------------------------------------
+ * PARAMS:  IN reader - request reader pointing to the context data
+ *               IN len - context data length
+ *               IN/OUT context - pointer to the create context
+ *
+ * RETURNS: TRUE to call common processing, FALSE to skip
+ *====================================================================
+ */
+static NQ_BOOL parseDh2c(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext * context)
+{
+    LOGFB(CM_TRC_LEVEL_MESS_SOME);
+    context->durableReopen = cmBufferReaderGetPosition(reader);
+    cmBufferReaderSkip(reader, 16);         /* file id */
+    cmBufferReadBytes(reader, context->createGuid, sizeof(context->createGuid));
+    LOGFE(CM_TRC_LEVEL_MESS_SOME);
+    return FALSE;
+}
+
 /*====================================================================
  * PURPOSE: Durable ID Re-open Context parser
  *--------------------------------------------------------------------
@@ -611,6 +710,45 @@ static NQ_BOOL parseMxac(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext
     return TRUE;
 }
 
+/*====================================================================
+ * PURPOSE: Lease Request Context parser
+ *--------------------------------------------------------------------
+ * PARAMS:  IN reader - request reader pointing to the context data
+ *               IN len - context data length
+ *               IN/OUT context - pointer to the create context
+ *
+ * RETURNS: TRUE to call common processing, FALSE to skip
+ *
+ * NOTES:   both SMB2.1 (v1) and SMB3 (v2) layouts are recognized by length
+ *====================================================================
+ */
+static NQ_BOOL parseRqLs(CMBufferReader * reader, NQ_UINT32 len, CSCreateContext * context)
+{
+    LOGFB(CM_TRC_LEVEL_MESS_SOME);
+    if (len < SMB2_LEASE_V1_SIZE)
+    {
+        LOGMSG(CM_TRC_LEVEL_MESS_SOME, "short lease context ignored: %d", len);
+        LOGFE(CM_TRC_LEVEL_MESS_SOME);
+        return TRUE;
+    }
+    cmBufferReadBytes(reader, context->leaseKey, SMB2_LEASE_KEY_SIZE);
+    cmBufferReadUint32(reader, &context->leaseState);
+    cmBufferReadUint32(reader, &context->leaseFlags);
+    cmBufferReaderSkip(reader, 8);      /* lease duration */
+    context->leaseV2 = len >= SMB2_LEASE_V2_SIZE;
+    context->leaseEpoch = 0;
+    syMemset(context->parentLeaseKey, 0, sizeof(context->parentLeaseKey));
+    if (context->leaseV2)
+    {
+        cmBufferReadBytes(reader, context->parentLeaseKey, SMB2_LEASE_KEY_SIZE);
+        cmBufferReadUint16(reader, &context->leaseEpoch);
+    }
+    context->leaseFlags &= SMB2_LEASE_FLAG_PARENT_LEASE_KEY_SET;
+    context->leaseRequested = TRUE;
+    LOGFE(CM_TRC_LEVEL_MESS_SOME);
+    return TRUE;
+}
+
 /*====================================================================
  * PURPOSE: Maximal Access Context packer
  *--------------------------------------------------------------------
@@ -633,6 +771,36 @@ static NQ_UINT32 packMxac(CMBufferWriter * writer,  CSCreateParams * params, con
     return sizeof(NQ_UINT32) * 2;
 }
 
+/*====================================================================
+ * PURPOSE: Lease Response Context packer
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT writer - response pointing to the context data
+ *               IN params - pointer to common Create parameters
+ *               IN context - pointer to the create context
+ *
+ * RETURNS: entry size or zero when entry should be skipped
+ *====================================================================
+ */
+
+static NQ_UINT32 packRqLs(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context)
+{
+    LOGFB(CM_TRC_LEVEL_MESS_SOME);
+    cmBufferWriteBytes(writer, context->leaseKey, SMB2_LEASE_KEY_SIZE);
+    cmBufferWriteUint32(writer, context->leaseState);
+    cmBufferWriteUint32(writer, context->leaseFlags);
+    cmBufferWriteZeroes(writer, 8);     /* lease duration */
+    if (context->leaseV2)
+    {
+        cmBufferWriteBytes(writer, context->parentLeaseKey, SMB2_LEASE_KEY_SIZE);
+        cmBufferWriteUint16(writer, context->leaseEpoch);
+        cmBufferWriteUint16(writer, 0); /* reserved */
+        LOGFE(CM_TRC_LEVEL_MESS_SOME);
+        return SMB2_LEASE_V2_SIZE;
+    }
+    LOGFE(CM_TRC_LEVEL_MESS_SOME);
+    return SMB2_LEASE_V1_SIZE;
+}
+
 /*====================================================================
  * PURPOSE: Duarble ID Query Context packer
  *--------------------------------------------------------------------
@@ -644,24 +812,64 @@ static NQ_UINT32 packMxac(CMBufferWriter * writer,  CSCreateParams * params, con
  *====================================================================
  */
 #ifdef UD_CS_INCLUDEPERSISTENTFIDS
-#if 0
 static NQ_UINT32 packDhnq(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context)
 {
     LOGFB(CM_TRC_LEVEL_MESS_SOME);
-    cmBufferWriteUint16(writer, params->file->fid);
-    cmBufferWriteUint16(writer, 0);
-    cmBufferWriteUint32(writer, 0);
-    cmBufferWriteUint32(writer, 0);
-    cmBufferWriteUint32(writer, 0);
-    /* undocumented 16 bytes of zeroes */
-    cmBufferWriteUint32(writer, 0);
-    cmBufferWriteUint32(writer, 0);
-    cmBufferWriteUint32(writer, 0);
-    cmBufferWriteUint32(writer, 0);
+    if (!context->durableGranted || context->durableV2)
+    {
+        LOGFE(CM_TRC_LEVEL_MESS_SOME);
+        return 0;
+    }
+    cmBufferWriteZeroes(writer, 8);     /* reserved */
     LOGFE(CM_TRC_LEVEL_MESS_SOME);
-    return 16 + 16;
+    return 8;
+}
+
+/*====================================================================
+ * PURPOSE: Durable Handle V2 Query Context packer
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT writer - response pointing to the context data
+ *               IN params - pointer to common Create parameters
+ *               IN context - pointer to the create context
+ *
+ * RETURNS: entry size or zero when entry should be skipped
+ *====================================================================
+ */
+static NQ_UINT32 packDh2q(CMBufferWriter * writer,  CSCreateParams * params, const CSCreateContext * context)
+{
+    LOGFB(CM_TRC_LEVEL_MESS_SOME);
+    if (!context->durableGranted || !context->durableV2)
+    {
+        LOGFE(CM_TRC_LEVEL_MESS_SOME);
+        return 0;
+    }
+    cmBufferWriteUint32(writer, context->durableTimeout);
+    cmBufferWriteUint32(writer, 0);     /* flags: not persistent */
+    LOGFE(CM_TRC_LEVEL_MESS_SOME);
+    return 8;
+}
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+/*====================================================================
+ * PURPOSE: Bind a disconnected durable file to the reconnecting tree
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT params - pointer to common Create parameters
+ *
+ * RETURNS: None
+ *====================================================================
+ */
+static void rebindDurable(CSCreateParams * params)
+{
+    CSTree * pTree = csGetTreeByTid(params->tid);
+
+    params->file->durableFlags &= (NQ_UINT16)~CS_DURABLE_DISCONNECTED;
+    params->file->user = params->user;
+    params->file->uid = params->uid;
+    params->file->tid = params->tid;
+    if (NULL != pTree)
+        params->file->session = pTree->session;
 }
-#endif
 #endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 
 /*====================================================================
@@ -747,6 +955,20 @@ static NQ_UINT32 performDhnc(CSCreateParams * params, const CSCreateContext * co
     fid = *(CSFid*)context->durableReopen;
     params->file = csGetFileByFid(fid, params->tid, params->uid);
     if (NULL == params->file)
+    {
+        /* the open was preserved after its connection was lost */
+        params->file = csGetFileByJustFid(fid);
+        if (NULL != params->file && !(params->file->durableFlags & CS_DURABLE_DISCONNECTED))
+            params->file = NULL;
+        if (NULL != params->file && !csDurableIsOwner(&params->file->durableOwner, params->user))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Unable to reconnect: fid 0x%x belongs to another user", fid);
+            params->file = NULL;
+        }
+        if (NULL != params->file)
+            rebindDurable(params);
+    }
+    if (NULL == params->file)
     {
         LOGERR(CM_TRC_LEVEL_ERROR, "Unable to reconnect: fid 0x%x not found", fid);
         LOGFE(CM_TRC_LEVEL_MESS_SOME);
@@ -761,6 +983,72 @@ static NQ_UINT32 performDhnc(CSCreateParams * params, const CSCreateContext * co
     LOGFE(CM_TRC_LEVEL_MESS_SOME);
     return 0;
 }
+
+/*====================================================================
+ * PURPOSE: Durable Handle Reconnect V2 performer
+ *--------------------------------------------------------------------
+ * PARAMS:  IN params - pointer to common Create parameters
+ *               IN context - pointer to the create context
+ *
+ * RETURNS: 0 on success or error code in NT format
+ *
+ * NOTES:   an open preserved in memory is bound to the new session,
+ *          an open recorded in the journal before server restart is
+ *          reopened with the access and share mode it was granted
+ *====================================================================
+ */
+static NQ_UINT32 performDh2c(CSCreateParams * params, const CSCreateContext * context)
+{
+    CSDurableRecord * pRecord;  /* open preserved over restart */
+    NQ_UINT32 status = 0;       /* return value */
+
+    LOGFB(CM_TRC_LEVEL_MESS_SOME);
+
+    params->file = cs2GetFileByDurableGuid(context->createGuid);
+    if (NULL != params->file)
+    {
+        CSName * pName = csGetNameByNid(params->file->nid);
+
+        if (!csDurableIsOwner(&params->file->durableOwner, params->user) || NULL == pName || 0 != cmWStrcmp(pName->name, params->fileName))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Unable to reconnect: durable open does not match %s", cmWDump(params->fileName));
+            params->file = NULL;
+            status = SMB_STATUS_OBJECT_NAME_NOT_FOUND;
+            goto Exit;
+        }
+        rebindDurable(params);
+        if (NQ_SUCCESS != csGetFileInformation(params->file, params->fileName, &params->fileInfo))
+        {
+            LOGERR(CM_TRC_LEVEL_ERROR, "Unable to query file info for: %s", cmWDump(params->fileName));
+        }
+        params->takenAction = SMB_OPEN2_DOOPEN;
+        goto Exit;
+    }
+
+    pRecord = csDurableJournalFind(context->createGuid, params->fileName, params->user);
+    if (NULL == pRecord)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to reconnect: no durable open for %s", cmWDump(params->fileName));
+        status = SMB_STATUS_OBJECT_NAME_NOT_FOUND;
+        goto Exit;
+    }
+    params->desiredAccess = pRecord->desiredAccess;
+    params->sharedAccess = pRecord->sharedAccess;
+    params->createOptions = pRecord->createOptions;
+    params->disposition = SMB_NTCREATEANDX_FILEOPEN;
+    params->context.leaseState &= pRecord->leaseState;
+    status = csCreateCommonProcessing(params);
+    if (0 != status)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to reopen durable file, status: 0x%x", status);
+        goto Exit;
+    }
+    csDurableJournalClaim(pRecord, params->file);
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_MESS_SOME);
+    return status;
+}
 #endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 
 /*====================================================================
@@ -822,6 +1110,7 @@ cs2PackCreateContexts(CMBufferWriter *writer, CSCreateContext *context)
     NQ_UINT32 contextLen = 0;
     NQ_COUNT i;
     NQ_BYTE * nextOffsetPtr = 0;        /* pointer to the next offset field in contexts */
+    NQ_BYTE * lastOffsetPtr = 0;        /* next offset field of the last packed context */
     NQ_BYTE * contextOffsetPtr;         /* pointer to create context offset in response */
 
     TRCB();
@@ -855,6 +1144,14 @@ cs2PackCreateContexts(CMBufferWriter *writer, CSCreateContext *context)
 
             cmBufferWriterSetPosition(writer, nextOffsetPtr + 0x10 + allignedNameLen);
             dataLen = contextDescriptors[i].packer(writer, NULL, context);
+            if (0 == dataLen)
+            {
+                /* context was not granted - drop the entry */
+                cmBufferWriterSetPosition(writer, nextOffsetPtr);
+                nextOffsetPtr = lastOffsetPtr;
+                continue;
+            }
+            lastOffsetPtr = nextOffsetPtr;
             contextLen += dataLen + 0x10 + allignedNameLen;
             cmBufferWriterAlign(writer, contextOffsetPtr, 8);
             tempPtr = cmBufferWriterGetPosition(writer);
@@ -27,6 +27,18 @@ typedef struct
     NQ_COUNT sdLen;         /* security descriptor length */
     NQ_BYTE * durableReopen;/* pointer to re-open ID */
     NQ_UINT64 allocSize;    /* allocation size */
+    NQ_BOOL leaseRequested; /* TRUE when RqLs context was sent */
+    NQ_BOOL leaseV2;        /* TRUE for version 2 (SMB 3.x) lease context */
+    NQ_BYTE leaseKey[16];   /* client lease key */
+    NQ_BYTE parentLeaseKey[16]; /* parent directory lease key (v2 only) */
+    NQ_UINT32 leaseState;   /* IN requested lease state, OUT granted lease state */
+    NQ_UINT32 leaseFlags;   /* lease flags */
+    NQ_UINT16 leaseEpoch;   /* lease epoch (v2 only) */
+    NQ_BOOL durableRequested; /* TRUE when DHnQ or DH2Q context was sent */
+    NQ_BOOL durableV2;      /* TRUE for DH2Q/DH2C */
+    NQ_BOOL durableGranted; /* OUT the open was made durable */
+    NQ_BYTE createGuid[16]; /* DH2Q/DH2C create GUID */
+    NQ_UINT32 durableTimeout; /* IN requested, OUT granted timeout in milliseconds */
 }
 CSCreateContext;
 
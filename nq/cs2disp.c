@@ -19,6 +19,7 @@
 #include "cs2disp.h"
 #include "csdispat.h"
 #include "nssocket.h"
+#include "cmcompress.h"
 #ifdef UD_CS_MESSAGESIGNINGPOLICY
 #include "cssignin.h"
 #endif
@@ -290,6 +291,15 @@ csSmb2DispatchRequest(
     CSSocketDescriptor * sockDescr;
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
     NQ_BOOL 	encryptedPacket = FALSE;
+    NQ_BOOL 	bufferedPacket = FALSE;    /* the whole request was already read into the buffer */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+    NQ_BOOL 	compressedPacket = FALSE;  /* request arrived in a compression transform */
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    NQ_BOOL 	compressResponse = FALSE;  /* client asked for a compressed read response */
+    NQ_BOOL 	compressedResponse = FALSE;/* response was compressed */
+    NQ_COUNT 	msgLength;                 /* decompressed message length */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     CSSession *connection = csGetSessionBySocket();
 #ifdef UD_NQ_INCLUDESMB3
     static NQ_BYTE ctxBuff[SHA512_CTXSIZE];
@@ -313,7 +323,7 @@ csSmb2DispatchRequest(
     {
     	NQ_BOOL res;
 		
-    	encryptedPacket = TRUE;
+    	encryptedPacket = bufferedPacket = TRUE;
     	res = cs2TransformHeaderDecrypt( recvDescr , request , length);
     	if (res)
     	{
@@ -328,11 +338,63 @@ csSmb2DispatchRequest(
     	}
     }
 #endif /* UD_NQ_INCLUDESMB3 */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    if ((syMemcmp(request , cmSmb2CmprsHdrProtocolId , sizeof(cmSmb2CmprsHdrProtocolId)) == 0
+    	|| (encryptedPacket && syMemcmp(pBuf - 4 , cmSmb2CmprsHdrProtocolId , sizeof(cmSmb2CmprsHdrProtocolId)) == 0))
+    	&& (connection == NULL || connection->compressionAlgorithm == SMB2_COMPRESSION_NONE))
+    {
+		LOGERR(CM_TRC_LEVEL_ERROR, "Compression transform while compression was not negotiated");
+		LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+		return FALSE;
+    }
+    if (syMemcmp(request , cmSmb2CmprsHdrProtocolId , sizeof(cmSmb2CmprsHdrProtocolId)) == 0)
+    {
+    	/* the whole transform is needed to decompress it */
+    	if (length > UD_NS_BUFFERSIZE - 4 || NQ_FAIL == nsRecvIntoBuffer(recvDescr, pBuf, length))
+    	{
+			LOGERR(CM_TRC_LEVEL_ERROR, "Error reading compressed packet");
+			LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+			return FALSE;
+    	}
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+    	cmCapturePacketWritePacket(pBuf, length);
+    	cmCapturePacketWriteEnd();
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    	msgLength = cs2TransformHeaderDecompress(connection->compressionAlgorithm, request, length + 4, UD_NS_BUFFERSIZE);
+    	if (msgLength == (NQ_COUNT)NQ_FAIL)
+    	{
+			LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+			return FALSE;
+    	}
+    	length = msgLength - 4;
+    	bufferedPacket = TRUE;
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+    	compressedPacket = TRUE;
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    }
+    else if (encryptedPacket && syMemcmp(pBuf - 4 , cmSmb2CmprsHdrProtocolId , sizeof(cmSmb2CmprsHdrProtocolId)) == 0)
+    {
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+    	cmCapturePacketWritePacket(pBuf - 4, length);
+    	cmCapturePacketWriteEnd();
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    	msgLength = cs2TransformHeaderDecompress(connection->compressionAlgorithm, pBuf - 4, length, UD_NS_BUFFERSIZE - SMB2_TRANSFORMHEADER_SIZE);
+    	if (msgLength == (NQ_COUNT)NQ_FAIL)
+    	{
+			LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+			return FALSE;
+    	}
+    	length = msgLength;
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+    	compressedPacket = TRUE;
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    }
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     staticData->encrypedPacket = encryptedPacket;
     /* according to nsGetBuffer() implementation its return value can not be NULL */
     response = nsGetBuffer();
 
-    if (!encryptedPacket)
+    if (!bufferedPacket)
     {
 		if (NQ_FAIL == nsRecvIntoBuffer(recvDescr, pBuf, 62)) /* read the rest of the header + StructureSize */
 		{
@@ -341,18 +403,22 @@ csSmb2DispatchRequest(
 			return NQ_FAIL;
 		}
     }
-    else
+    else if (encryptedPacket)
     {
     	syMemset(response , 0 , UD_NS_BUFFERSIZE);
     	response += SMB2_TRANSFORMHEADER_SIZE;
     }
     
 #ifdef UD_NQ_INCLUDESMBCAPTURE
-    if (!encryptedPacket)
+    if (!bufferedPacket)
     {
     	cmCapturePacketWritePacket(request + 4, 62);
     }
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    else if (!compressedPacket) /* compressed packets were captured as received */
+#else /* UD_NQ_INCLUDECOMPRESSION */
     else
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     {
     	cmCapturePacketWritePacket(pBuf - 4 , length);
     	cmCapturePacketWriteEnd();
@@ -413,7 +479,7 @@ csSmb2DispatchRequest(
 #ifdef UD_CS_MESSAGESIGNINGPOLICY            
                     && ((in.flags & SMB2_FLAG_SIGNED) == 0)
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */            
-					&& !encryptedPacket
+					&& !bufferedPacket
             )
             { 
                 /* use DirectTransfer - read according to word count */
@@ -424,7 +490,7 @@ csSmb2DispatchRequest(
             else
 #endif /* UD_CS_INCLUDEDIRECTTRANSFER */
             {
-                msgLen = (!encryptedPacket) ? nsRecvIntoBuffer(recvDescr, pBuf, length) : (NQ_INT)length; /* read the rest of the packet */
+                msgLen = (!bufferedPacket) ? nsRecvIntoBuffer(recvDescr, pBuf, length) : (NQ_INT)length; /* read the rest of the packet */
             }
             if (msgLen == NQ_FAIL)
             {
@@ -436,7 +502,7 @@ csSmb2DispatchRequest(
 
 #ifdef UD_NQ_INCLUDESMBCAPTURE
 #ifdef UD_CS_INCLUDEDIRECTTRANSFER
-            if (e->flags & FLAG_DTIN && !encryptedPacket)
+            if (e->flags & FLAG_DTIN && !bufferedPacket)
             {
             	NQ_BYTE *	tempBuf;
             	NQ_UINT32	dataLen;
@@ -464,7 +530,7 @@ csSmb2DispatchRequest(
             else
 #endif /* UD_CS_INCLUDEDIRECTTRANSFER */
             {
-            	if (!encryptedPacket)
+            	if (!bufferedPacket)
 				{
 					cmCapturePacketWritePacket(pBuf, (NQ_UINT)msgLen);
 					cmCapturePacketWriteEnd();
@@ -472,6 +538,13 @@ csSmb2DispatchRequest(
             }
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
         }
+
+#ifdef UD_NQ_INCLUDECOMPRESSION
+        /* a single read may ask for compressed data (flags follow structure size and padding) */
+        compressResponse = isFirstInChain && in.command == SMB2_CMD_READ && in.next == 0
+                && connection != NULL && connection->compressionAlgorithm != SMB2_COMPRESSION_NONE
+                && (*((NQ_BYTE *)in._start + SMB2_HEADERSIZE + 3) & SMB2_READFLAG_REQUEST_COMPRESSED) != 0;
+#endif /* UD_NQ_INCLUDECOMPRESSION */
         
       /* try DT OUT */
 #ifdef UD_CS_INCLUDEDIRECTTRANSFER
@@ -482,6 +555,9 @@ csSmb2DispatchRequest(
                 && ((in.flags & SMB2_FLAG_SIGNED) == 0)
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */            
 				&& !encryptedPacket
+#ifdef UD_NQ_INCLUDECOMPRESSION
+				&& !compressResponse    /* compression needs the data in the buffer */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
         )
         { 
             /* use DirectTransfer - prepare socket */
@@ -518,7 +594,8 @@ csSmb2DispatchRequest(
 
 			connection->credits -=  creditsGranted - 1;
 
-            if (size == e->size)
+            /* the oplock break command also carries lease break acknowledgments */
+            if (size == e->size || (in.command == SMB2_CMD_OPLOCKBREAK && size == SMB2_LEASE_ACK_SIZE))
             {
                 NQ_BOOL nosess = (e->flags & FLAG_NOSESSION) != 0;
                 
@@ -765,6 +842,12 @@ csSmb2DispatchRequest(
 		{
 			CSUser *	pUser = NULL;
 
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+			/* channel binding in progress hashes into the temporary user */
+			if (connection->bindingUid != (CSUid)CS_ILLEGALID)
+				pUser = csGetUserByUid(connection->bindingUid);
+			else
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
 			pUser = csGetUserByUid((CSUid)sessionIdToUid(out.sid.low));
 			if (pUser != NULL && pUser->preauthIntegOn)
 			{
@@ -773,12 +856,42 @@ csSmb2DispatchRequest(
 		}
     }
 
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    /* compress read data - the header and the read response structure are sent as is */
+    if (compressResponse && out.status == SMB_STATUS_SUCCESS && written > SMB2_HEADERSIZE + 16)
+    {
+    	NQ_BYTE * compressed = (NQ_BYTE *)cmMemoryAllocate((NQ_UINT)written);
+
+    	if (compressed != NULL)
+    	{
+    		NQ_COUNT compressedLen = cmSmb2CompressMessage(connection->compressionAlgorithm, connection->compressionChained,
+    			primary.origin, SMB2_HEADERSIZE + 16, primary.origin + SMB2_HEADERSIZE + 16, (NQ_COUNT)written - (SMB2_HEADERSIZE + 16),
+    			compressed, (NQ_COUNT)written);
+
+    		if (compressedLen != (NQ_COUNT)NQ_FAIL)
+    		{
+    			LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Read response compressed: %d -> %d bytes", written, compressedLen);
+    			syMemcpy(primary.origin, compressed, compressedLen);
+    			written = (NQ_INT)compressedLen;
+    			packetLen = compressedLen;
+    			compressedResponse = TRUE;
+    		}
+    		cmMemoryFree(compressed);
+    	}
+    }
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+
     if (encryptedPacket)
     {
     	NQ_INT yes = SMB2_TRANSFORMHEADER_SIZE;
 
     	yes -= nsSkipHeader(recvDescr->socket, response) == response ? 0 : 4;
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    	/* the user can not be found from a compressed response */
+    	cs2TransformHeaderEncrypt(compressedResponse ? session : NULL, response - yes, (NQ_COUNT)written);
+#else
     	cs2TransformHeaderEncrypt(NULL, response - yes, (NQ_COUNT)written);
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     	response -= SMB2_TRANSFORMHEADER_SIZE;
     	written += SMB2_TRANSFORMHEADER_SIZE;
     	packetLen = (NQ_COUNT)written;
@@ -1088,7 +1201,8 @@ NQ_UINT32 csSmb2SendInterimResponse(
          LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
          return 0;
     }
-    pSession = csGetSessionById(pUser->session);
+    /* the user may be bound to several connections, respond on this one */
+    pSession = csGetSessionBySpecificSocket(staticData->savedSocket);
     if (NULL == pSession)
     {
         LOGERR(CM_TRC_LEVEL_ERROR, "Sending interim response failed, invalid session");
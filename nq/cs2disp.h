@@ -140,6 +140,13 @@ NQ_BOOL cs2TransformHeaderEncrypt(	CSUser	*	user,
 NQ_BOOL cs2TransformHeaderDecrypt(	NSRecvDescr * recvDescr,
 									NQ_BYTE * request,
 									NQ_COUNT length);
+#ifdef UD_NQ_INCLUDECOMPRESSION
+/* decompress a compression transform in place, accepting only the negotiated algorithm. Returns the message length or (NQ_COUNT)NQ_FAIL */
+NQ_COUNT cs2TransformHeaderDecompress(	NQ_UINT16 algorithm,
+										NQ_BYTE * message,
+										NQ_COUNT length,
+										NQ_COUNT bufferSize);
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 
 #endif
 
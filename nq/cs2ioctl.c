@@ -62,6 +62,9 @@ static NQ_UINT32 handleGetObjectId(IoctlContext *);
 static NQ_UINT32 handleTransceive(IoctlContext *); 
 #endif /* UD_CS_INCLUDERPC */   
 static NQ_UINT32 handleVerifyNegot(IoctlContext *);
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+static NQ_UINT32 handleQueryInterfaces(IoctlContext *);
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
 IoctlMethodDescriptor ioctlMethods[] = {
     { 0x00060194, 0,            NULL },                   /* FSCTL_DFS_GET_REFERRALS */
     { 0x0011400C, FL_USEFID,    NULL },                   /* FSCTL_PIPE_PEEK */
@@ -75,6 +78,9 @@ IoctlMethodDescriptor ioctlMethods[] = {
     { 0x00140078, 0,            NULL },                   /* FSCTL_SRV_REQUEST_RESUME_KEY */
     { 0x000900c0, FL_USEFID,    handleGetObjectId },      /* FSCTL_SRV_GET_OBJECT_ID */
     { 0x00140204, FL_USESID,	handleVerifyNegot }, 	  /* FSCTL_VALIDATE_NEGOTIATE_INFO */
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    { 0x001401FC, FL_USESID,    handleQueryInterfaces },  /* FSCTL_QUERY_NETWORK_INTERFACE_INFO */
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
     };
 
 #ifdef UD_CS_INCLUDERPC
@@ -434,7 +440,11 @@ static NQ_UINT32 handleVerifyNegot(IoctlContext * context)
     	return SMB_STATUS_INVALID_HANDLE;
     }
 
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+	cmBufferWriteUint32(&context->writer, pSession->dialect >= CS_DIALECT_SMB30 ? SMB2_CAPABILITY_ENCRYPTION | SMB2_CAPABILITY_MULTI_CHANNEL : 0x0); /* capabilities*/
+#else /* UD_CS_INCLUDEMULTICHANNEL */
 	cmBufferWriteUint32(&context->writer, pSession->dialect >= CS_DIALECT_SMB30 ? SMB2_CAPABILITY_ENCRYPTION : 0x0); /* capabilities*/
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
 	cmUuidWrite(&context->writer, cs2GetServerUuid());           /* server GUID */
 	cmBufferWriteUint16(&context->writer, securityMode);         /* security mode */
 	switch (pSession->dialect)
@@ -456,5 +466,98 @@ static NQ_UINT32 handleVerifyNegot(IoctlContext * context)
 	return NQ_SUCCESS;
 }
 
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+
+#define INTERFACE_INFO_SIZE     152     /* NETWORK_INTERFACE_INFO with the socket address */
+#define SOCKADDR_STORAGE_SIZE   128     /* socket address field */
+#define SOCKADDR_FAMILY_IPV4    0x0002
+#define SOCKADDR_FAMILY_IPV6    0x0017
+
+/*====================================================================
+ * PURPOSE: Report server network interfaces to the client
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT context - IOCTL context
+ *
+ * RETURNS: 0 on success or error code in NT format
+ *
+ * NOTES:   one entry per self IP address, the link speed is queried
+ *          from the platform and defaults to UD_CS_DEFAULTLINKSPEED
+ *====================================================================
+ */
+static NQ_UINT32 handleQueryInterfaces(IoctlContext * context)
+{
+	const CMSelfIp * pSelfIp;            /* next self IP */
+	CSSession * pSession;                /* requesting connection */
+	NQ_BYTE * pLast = NULL;              /* last written entry */
+	NQ_UINT32 ifIndex = 0;               /* interface index */
+	NQ_UINT32 result = NQ_SUCCESS;
+
+	pSession = csGetSessionById(context->file->session);
+	if (pSession == NULL)
+	{
+		return SMB_STATUS_INVALID_HANDLE;
+	}
+	if (pSession->dialect < CS_DIALECT_SMB30)
+	{
+		return SMB_STATUS_NOT_SUPPORTED;
+	}
+
+	for (cmSelfipIterate(); NULL != (pSelfIp = cmSelfipNext()); )
+	{
+		NQ_UINT32 speed = 0;             /* link speed in Mbit/s */
+		NQ_UINT64 linkSpeed;             /* link speed in bit/s */
+		NQ_BYTE * pAddress;              /* start of the socket address */
+
+		if ((ifIndex + 1) * INTERFACE_INFO_SIZE > context->maxOutputResponse)
+		{
+			LOGERR(CM_TRC_LEVEL_ERROR, "No room for more interfaces");
+			result = SMB_STATUS_BUFFER_OVERFLOW;
+			break;
+		}
+
+		if (CM_IPADDR_VERSION(pSelfIp->ip) == CM_IPADDR_IPV4)
+			speed = syGetAdapterLinkSpeed(CM_IPADDR_GET4(pSelfIp->ip));
+		cmU64MultU32U32(&linkSpeed, speed == 0 ? UD_CS_DEFAULTLINKSPEED : speed, 1000000);
+
+		pLast = cmBufferWriterGetPosition(&context->writer);
+		cmBufferWriteUint32(&context->writer, INTERFACE_INFO_SIZE);  /* next, zeroed for the last one */
+		cmBufferWriteUint32(&context->writer, ++ifIndex);            /* interface index */
+		cmBufferWriteUint32(&context->writer, 0);                    /* capability: neither RSS nor RDMA */
+		cmBufferWriteUint32(&context->writer, 0);                    /* reserved */
+		cmBufferWriteUint64(&context->writer, &linkSpeed);           /* link speed */
+		pAddress = cmBufferWriterGetPosition(&context->writer);
+#ifdef UD_NQ_USETRANSPORTIPV6
+		if (CM_IPADDR_VERSION(pSelfIp->ip) == CM_IPADDR_IPV6)
+		{
+			cmBufferWriteUint16(&context->writer, SOCKADDR_FAMILY_IPV6); /* family */
+			cmBufferWriteUint16(&context->writer, 0);                    /* port */
+			cmBufferWriteUint32(&context->writer, 0);                    /* flow info */
+			cmBufferWriteBytes(&context->writer, (const NQ_BYTE *)CM_IPADDR_GET6(pSelfIp->ip), sizeof(NQ_IPADDRESS6));
+			cmBufferWriteUint32(&context->writer, 0);                    /* scope ID */
+		}
+		else
+#endif /* UD_NQ_USETRANSPORTIPV6 */
+		{
+			NQ_IPADDRESS4 ip = CM_IPADDR_GET4(pSelfIp->ip);
+
+			cmBufferWriteUint16(&context->writer, SOCKADDR_FAMILY_IPV4); /* family */
+			cmBufferWriteUint16(&context->writer, 0);                    /* port */
+			cmBufferWriteBytes(&context->writer, (const NQ_BYTE *)&ip, sizeof(ip));  /* address in NBO */
+		}
+		cmBufferWriteZeroes(&context->writer, (NQ_COUNT)(SOCKADDR_STORAGE_SIZE - (cmBufferWriterGetPosition(&context->writer) - pAddress)));
+	}
+	cmSelfipTerminate();
+
+	if (NULL == pLast)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "No interfaces to report");
+		return result == NQ_SUCCESS ? SMB_STATUS_NOT_SUPPORTED : result;
+	}
+	cmPutSUint32(pLast, 0);                                          /* no next entry */
+	return result;
+}
+
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+
 #endif /* defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2) */
 
@@ -22,6 +22,7 @@
 #include "csauth.h"
 #include "amspnego.h"
 #include "cmcrypt.h"
+#include "cmcompress.h"
 
 #if defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2)
 
@@ -33,6 +34,12 @@ Structure to hold values for negotiation response that are specific per dialect.
 
 */
 
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+#define SMB3_CAPABILITY_CHANNELS SMB2_CAPABILITY_MULTI_CHANNEL   /* sessions may be bound to more connections */
+#else /* UD_CS_INCLUDEMULTICHANNEL */
+#define SMB3_CAPABILITY_CHANNELS 0
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+
 typedef struct NegotRespPerDialect
 {    
     NQ_UINT32 capability;                   /* Capabilities flags */
@@ -40,9 +47,11 @@ typedef struct NegotRespPerDialect
 } NegotRespPerDialect;
 
 static const NegotRespPerDialect respPerDialect[] = {{0, CS_SMB2_MAX_READ_SIZE},                                                      /* dialect 2.0.2 */
-                                                     {0, CS_SMB2_MAX_READ_SIZE},                                                      /* dialect 2.1 */
-                                                     {SMB2_CAPABILITY_ENCRYPTION, CS_SMB2_MAX_READ_SIZE - SMB2_TRANSFORMHEADER_SIZE}, /* dialect 3.0 */
-                                                     {0, CS_SMB2_MAX_READ_SIZE - SMB2_TRANSFORMHEADER_SIZE }};                        /* dialect 3.1.1 */
+                                                     {SMB2_CAPABILITY_LEASING, CS_SMB2_MAX_READ_SIZE},                                /* dialect 2.1 */
+                                                     {SMB2_CAPABILITY_ENCRYPTION | SMB2_CAPABILITY_LEASING | SMB2_CAPABILITY_DIRECTORY_LEASING | SMB3_CAPABILITY_CHANNELS,
+                                                      CS_SMB2_MAX_READ_SIZE - SMB2_TRANSFORMHEADER_SIZE},                             /* dialect 3.0 */
+                                                     {SMB2_CAPABILITY_LEASING | SMB2_CAPABILITY_DIRECTORY_LEASING | SMB3_CAPABILITY_CHANNELS,
+                                                      CS_SMB2_MAX_READ_SIZE - SMB2_TRANSFORMHEADER_SIZE }};                           /* dialect 3.1.1 */
 /* SMB 3.1.1 will notify encryption capability with negotiation context. */
 
 
@@ -62,7 +71,7 @@ static void writeSecurityData(CMBufferWriter *writer)
     LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
 }
 
-static void writeResponseData(CMSmb2Header *header, CMBufferWriter *writer , NQ_INT dialect, NQ_INT numContext, NQ_INT cipher, NQ_INT chosenHashAlgo)
+static void writeResponseData(CMSmb2Header *header, CMBufferWriter *writer , NQ_INT dialect, NQ_INT numContext, NQ_INT cipher, NQ_INT chosenHashAlgo, NQ_UINT16 compression, NQ_UINT32 compressionFlags)
 {
     CMTime time;
     CMBufferWriter sbw;
@@ -100,7 +109,7 @@ static void writeResponseData(CMSmb2Header *header, CMBufferWriter *writer , NQ_
     cmBufferWriteUint16(writer, (NQ_UINT16)dialect);      /* dialect revision */
     cmBufferWriteUint16(writer, (NQ_UINT16) numContext); /* 3.1.1 and higher context count otherwise 0 */
     cmUuidWrite(writer, cs2GetServerUuid());              /* server GUID */
-    cmBufferWriteUint32(writer, respPerDialect[dialectRespEntry].capability);         /* capabilities (0) */
+    cmBufferWriteUint32(writer, respPerDialect[dialectRespEntry].capability);         /* capabilities */
     cmBufferWriteUint32(writer, CS_MAXBUFFERSIZE);        /* max transact size */
     cmBufferWriteUint32(writer, respPerDialect[dialectRespEntry].maxReadSize);/* max read size */
     cmBufferWriteUint32(writer, CS_SMB2_MAX_WRITE_SIZE);  /* max write size */
@@ -149,7 +158,7 @@ static void writeResponseData(CMSmb2Header *header, CMBufferWriter *writer , NQ_
          cmBufferWriterAlign(writer, writer->origin, 8);                    /* 8 byte alignment */
         
          /* cipher context - not mandatory for 3.1.1 */
-         if (numContext > 1)
+         if (cipher == CIPHER_AES128GCM || cipher == CIPHER_AES128CCM)
          {
              cmBufferWriteUint16(writer, SMB2_ENCRYPTION_CAPABILITIES);     /* 3.1.1 context type */ 
              cmBufferWriteUint16(writer, 4);                                /* data length - 4 bytes to reply with one cipher. */ 
@@ -157,6 +166,20 @@ static void writeResponseData(CMSmb2Header *header, CMBufferWriter *writer , NQ_
              cmBufferWriteUint16(writer, 1);                                /* cipher count */
              cmBufferWriteUint16(writer, (NQ_UINT16)cipher);                /* chosen cipher */
          }
+#ifdef UD_NQ_INCLUDECOMPRESSION
+         /* compression context - only when an algorithm was chosen */
+         if (compression != SMB2_COMPRESSION_NONE)
+         {
+             cmBufferWriterAlign(writer, writer->origin, 8);                /* 8 byte alignment */
+             cmBufferWriteUint16(writer, SMB2_COMPRESSION_CAPABILITIES);    /* 3.1.1 context type */
+             cmBufferWriteUint16(writer, 10);                               /* data length - 10 bytes to reply with one algorithm */
+             cmBufferWriteUint32(writer, 0);                                /* reserved(4) */
+             cmBufferWriteUint16(writer, 1);                                /* algorithm count */
+             cmBufferWriteUint16(writer, 0);                                /* padding */
+             cmBufferWriteUint32(writer, compressionFlags);                 /* flags */
+             cmBufferWriteUint16(writer, compression);                      /* chosen algorithm */
+         }
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     }
 #endif /* UD_NQ_INCLUDESMB311 */
 
@@ -270,6 +293,35 @@ static NQ_INT chooseCipher(CMBufferReader *reader, NQ_UINT16 dataLength)
 			
     return chosenCipher;
 }
+
+#ifdef UD_NQ_INCLUDECOMPRESSION
+static NQ_UINT16 chooseCompression(CMBufferReader *reader, NQ_UINT16 dataLength, NQ_UINT32 *flags)
+{
+	NQ_UINT16 algorithm, algorithmCount;
+	NQ_UINT16 chosenAlgorithm = SMB2_COMPRESSION_NONE;
+
+	*flags = 0;
+	if (dataLength < 8)
+		return SMB2_COMPRESSION_NONE;
+
+	cmBufferReadUint16(reader, &algorithmCount);
+	cmBufferReaderSkip(reader, 2);				/* padding */
+	cmBufferReadUint32(reader, flags);
+	if (algorithmCount > (dataLength - 8) / 2)
+		algorithmCount = (NQ_UINT16)((dataLength - 8) / 2);
+
+	/* the client lists algorithms in the order of its preference */
+	for (; algorithmCount > 0 && chosenAlgorithm == SMB2_COMPRESSION_NONE; --algorithmCount)
+	{
+		cmBufferReadUint16(reader, &algorithm);
+		if (algorithm != SMB2_COMPRESSION_NONE && NULL != cmCompressionGetCodec(algorithm))
+			chosenAlgorithm = algorithm;
+	}
+	*flags &= SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED;	/* chaining is the only capability we know */
+
+	return chosenAlgorithm;
+}
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 #endif /* UD_NQ_INCLUDESMB311 */
 
 static NQ_INT chooseDialect(CMBufferReader *reader, NQ_UINT16 count)
@@ -327,6 +379,8 @@ NQ_UINT32 csSmb2OnNegotiate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader
 #endif /* UD_NQ_INCLUDESMB311 */
 #endif /* UD_NQ_INCLUDESMB3 */
     NQ_INT chosenCipher = 0, chosenHashAlgo = 0, numContextOnResponse = 0;
+    NQ_UINT16 chosenCompression = SMB2_COMPRESSION_NONE;
+    NQ_UINT32 compressionFlags = 0;
 
     LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL);
 
@@ -355,9 +409,13 @@ NQ_UINT32 csSmb2OnNegotiate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader
 	    for (; contextCount > 0; --contextCount)
 	    {
 			NQ_UINT16 contextType, dataLength;
+			NQ_BYTE * pData;						/* context data start */
 			cmBufferReadUint16(reader, &contextType);
 			cmBufferReadUint16(reader, &dataLength);
 			cmBufferReaderSkip(reader, 4);			/* reserved (4) */
+			pData = cmBufferReaderGetPosition(reader);
+			if (dataLength > cmBufferReaderGetRemaining(reader))
+				return SMB_STATUS_INVALID_PARAMETER;
 
 			switch (contextType)
 			{
@@ -371,9 +429,17 @@ NQ_UINT32 csSmb2OnNegotiate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader
 	        		if (chosenCipher != NQ_FAIL)
 	        			++numContextOnResponse;
 	        		break;
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	        	case SMB2_COMPRESSION_CAPABILITIES:
+	        		chosenCompression = chooseCompression(reader, dataLength, &compressionFlags);
+	        		if (chosenCompression != SMB2_COMPRESSION_NONE)
+	        			++numContextOnResponse;
+	        		break;
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 	        	default:
 	        		LOGERR(CM_TRC_LEVEL_ERROR, "Received unsupported negotiation context: %d\n", contextType);
 			}
+			cmBufferReaderSetPosition(reader, pData + dataLength); /* skip unread context data */
 			
 			if (contextCount > 1)
 				cmBufferReaderAlign(reader, reader->origin, 8); /* next context is 8 byte aligned */
@@ -392,6 +458,13 @@ NQ_UINT32 csSmb2OnNegotiate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader
     if (chosenDialect != NQ_FAIL)
     {
         status = negotiate(&connection , chosenDialect, (chosenCipher == CIPHER_AES128GCM));
+#ifdef UD_NQ_INCLUDECOMPRESSION
+        if (0 == status)
+        {
+            connection->compressionAlgorithm = chosenCompression;
+            connection->compressionChained = (compressionFlags & SMB2_COMPRESSION_CAPABILITIES_FLAG_CHAINED) != 0;
+        }
+#endif /* UD_NQ_INCLUDECOMPRESSION */
     }
     else if (chosenDialect == NQ_FAIL && connection->dialect == CS_DIALECT_SMB2)
     {
@@ -407,7 +480,7 @@ NQ_UINT32 csSmb2OnNegotiate(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader
 	}
 #endif /* UD_NQ_INCLUDESMB311 */
 
-    writeResponseData(out, writer, chosenDialect, numContextOnResponse, chosenCipher, chosenHashAlgo);
+    writeResponseData(out, writer, chosenDialect, numContextOnResponse, chosenCipher, chosenHashAlgo, chosenCompression, compressionFlags);
 
     LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
     return status;
@@ -439,7 +512,7 @@ NQ_UINT32 csSmb2OnSmb1Negotiate(NQ_BYTE **response , NQ_BOOL anySmb2)
         cmBufferWriterInit(&writer, *response - 32, 0);
         cmSmb2HeaderInitForResponse(&header, &writer, 1);
         cmSmb2HeaderWrite(&header, &writer);
-        writeResponseData(&header, &writer , anySmb2 ? SMB2ANY_DIALECTREVISION : SMB2_DIALECTREVISION, 0, 0, 0);
+        writeResponseData(&header, &writer , anySmb2 ? SMB2ANY_DIALECTREVISION : SMB2_DIALECTREVISION, 0, 0, 0, SMB2_COMPRESSION_NONE, 0);
 
         *response = cmBufferWriterGetPosition(&writer);
     }
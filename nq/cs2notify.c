@@ -184,6 +184,9 @@ NQ_UINT32 csSmb2OnChangeNotify(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
             TRCE();
             return csErrorReturn(SMB_STATUS_DELETE_PENDING, DOS_ERRbadfid);
         }
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+        csNotifyWatch(pName->name, (flags & FLAGS_RECURSIVE) != 0);
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
     }
 
     /* we send interim response now - notice the server should not sign an interim response */
@@ -196,6 +199,7 @@ NQ_UINT32 csSmb2OnChangeNotify(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
     pFile->notifyFilter = completionFilter;
     pFile->notifyTree = flags & FLAGS_RECURSIVE;
     pFile->notifyAid = out->aid;
+    pFile->notifyBufferLength = bufferLength;
 
     LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
     return SMB_STATUS_PENDING;
@@ -469,5 +473,137 @@ cs2NotifySend(
     LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
 }
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+
+/*====================================================================
+ * PURPOSE: Complete a pending notify request with file change records
+ *--------------------------------------------------------------------
+ * PARAMS:  IN directory with a pending request
+ *          IN path of the changed directory relative to this one or NULL
+ *          IN changes in the changed directory
+ *          IN number of changes
+ *          IN TRUE when changes were lost
+ *
+ * RETURNS: FALSE when no change matches the completion filter and the
+ *          request was left pending
+ *
+ * NOTES:   FILE_NOTIFY_INFORMATION records are sent. On overflow or when
+ *          the records do not fit into the client buffer an empty
+ *          STATUS_NOTIFY_ENUM_DIR response makes the client re-read
+ *          the directory. The caller restores the socket.
+ *====================================================================
+ */
+
+NQ_BOOL
+cs2NotifySendChanges(
+    CSFile* pFile,
+    const NQ_WCHAR* prefix,
+    const CSNotifyChange* changes,
+    NQ_COUNT numChanges,
+    NQ_BOOL overflow
+    )
+{
+    CMBufferWriter writer;          /* response writer */
+    NQ_BYTE* bufferStart;           /* start of file entries */
+    NQ_BYTE* pEntry = NULL;         /* last written entry */
+    NQ_UINT32 limit;                /* maximum length of file entries */
+    NQ_COUNT prefixLen;             /* prefix length in characters */
+    NQ_BOOL matched = overflow;     /* some change matches the filter */
+    NQ_COUNT dataLen;               /* number of bytes to send */
+    NQ_COUNT i;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_TOOL);
+
+    for (i = 0; !matched && i < numChanges; i++)
+        matched = (pFile->notifyFilter & csNotifyChangeFilter(changes[i].action)) != 0;
+    if (!matched)
+    {
+        LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+        return FALSE;
+    }
+
+    csDispatchSetSocket(pFile->notifyContext.socket);
+    cs2DispatchPrepareLateResponse(&pFile->notifyContext, SMB_STATUS_SUCCESS);
+    cmBufferWriterInit(&writer, pFile->notifyContext.commandData, pFile->notifyContext.commandDataSize);
+    cmBufferWriteUint16(&writer, 9);                            /* structure size */
+    cmBufferWriteUint16(&writer, SMB2_HEADERSIZE + 4 + 2 * 2);  /* buffer offset */
+    cmBufferWriteUint32(&writer, 0);                            /* buffer length */
+    bufferStart = cmBufferWriterGetPosition(&writer);
+    limit = cmBufferWriterGetRemaining(&writer);
+    if (limit > pFile->notifyBufferLength)
+        limit = pFile->notifyBufferLength;
+    prefixLen = (prefix == NULL)? 0 : syWStrlen(prefix) + 1;
+
+    for (i = 0; !overflow && i < numChanges; i++)
+    {
+        NQ_UINT32 nameLen;          /* name length in bytes */
+        NQ_BYTE* savedPtr;          /* saved position */
+
+        if ((pFile->notifyFilter & csNotifyChangeFilter(changes[i].action)) == 0)
+            continue;
+
+        if (pEntry != NULL)
+            cmBufferWriterAlign(&writer, bufferStart, 4);
+        nameLen = (NQ_UINT32)((prefixLen + syWStrlen(changes[i].name)) * sizeof(NQ_WCHAR));
+        if ((NQ_UINT32)(cmBufferWriterGetPosition(&writer) - bufferStart) + 3 * 4 + nameLen > limit)
+        {
+            overflow = TRUE;
+            break;
+        }
+
+        /* link the previous entry to this one */
+        savedPtr = cmBufferWriterGetPosition(&writer);
+        if (pEntry != NULL)
+        {
+            cmBufferWriterSetPosition(&writer, pEntry);
+            cmBufferWriteUint32(&writer, (NQ_UINT32)(savedPtr - pEntry));   /* next entry offset */
+            cmBufferWriterSetPosition(&writer, savedPtr);
+        }
+        pEntry = savedPtr;
+
+        cmBufferWriteUint32(&writer, 0);                    /* next entry offset */
+        cmBufferWriteUint32(&writer, changes[i].action & SMB_NOTIFYCHANGE_ACTIONMASK);
+        cmBufferWriteUint32(&writer, nameLen);              /* file name length */
+        if (prefix != NULL)
+        {
+            cmBufferWriteUnicodeNoNull(&writer, prefix);
+            cmBufferWriteUint16(&writer, (NQ_UINT16)'\\');
+        }
+        cmBufferWriteUnicodeNoNull(&writer, changes[i].name);
+    }
+
+    if (overflow)
+    {
+        /* make the client enumerate the directory */
+        cs2DispatchPrepareLateResponse(&pFile->notifyContext, SMB_STATUS_ENUMDIR);
+        cmBufferWriterInit(&writer, pFile->notifyContext.commandData, pFile->notifyContext.commandDataSize);
+        cmBufferWriteUint16(&writer, 9);                            /* structure size */
+        cmBufferWriteUint16(&writer, SMB2_HEADERSIZE + 4 + 2 * 2);  /* buffer offset */
+        cmBufferWriteUint32(&writer, 0);                            /* buffer length */
+        cmBufferWriteByte(&writer, 0xff);                           /* error data */
+        dataLen = (NQ_COUNT)(cmBufferWriterGetPosition(&writer) - pFile->notifyContext.commandData);
+    }
+    else
+    {
+        NQ_BYTE* savedPtr = cmBufferWriterGetPosition(&writer);   /* end of entries */
+
+        cmBufferWriterSetPosition(&writer, bufferStart - 4);
+        cmBufferWriteUint32(&writer, (NQ_UINT32)(savedPtr - bufferStart));  /* buffer length */
+        dataLen = (NQ_COUNT)(savedPtr - pFile->notifyContext.commandData);
+    }
+
+    if (!cs2DispatchSendLateResponse(&pFile->notifyContext, dataLen))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Error sending NOTIFY CHANGE response");
+    }
+    /* clear notify request */
+    pFile->notifyPending = FALSE;
+
+    LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+    return TRUE;
+}
+
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
 #endif /* defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2) */
 
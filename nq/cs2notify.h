@@ -19,6 +19,8 @@
 #define _CS2NOTIFY_H_
 
 #include "cmsmb2.h"
+#include "csdataba.h"
+#include "csnotify.h"
 
 #if defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2)
 
@@ -62,6 +64,18 @@ cs2NotifySend(
     void
     );
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+/* complete a pending notify request with file change records */
+NQ_BOOL                             /* FALSE when no change matches the completion filter */
+cs2NotifySendChanges(
+    CSFile* pFile,                  /* directory with a pending request */
+    const NQ_WCHAR* prefix,         /* path of the watched directory relative to this one or NULL */
+    const CSNotifyChange* changes,  /* changes in the watched directory */
+    NQ_COUNT numChanges,            /* number of changes */
+    NQ_BOOL overflow                /* TRUE when changes were lost */
+    );
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
 #endif /* UD_NQ_INCLUDESMB2 */
 
 #endif /* defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2) */
@@ -38,6 +38,456 @@ isConnectionSigningRequired(
 }
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */
 
+#ifdef CS_AUTH_ASYNCLOGON
+
+/* session setup waiting for pass-through logon */
+typedef struct
+{
+    CSLateResponseContext response; /* saved response context */
+    NQ_BYTE securityMode;           /* client security mode */
+    NQ_UINT32 headerFlags;          /* request header flags */
+    NQ_UINT64 previousSid;          /* previous session ID */
+    NQ_COUNT blobLength;            /* response blob length */
+    NQ_BYTE * blob;                 /* response blob, follows this structure */
+}
+ParkedSessionSetup;
+
+#endif /* CS_AUTH_ASYNCLOGON */
+
+/*====================================================================
+ * PURPOSE: Update session on authentication result
+ *--------------------------------------------------------------------
+ * PARAMS:  IN connection - pointer to the session structure
+ *          IN session - pointer to the user structure or NULL
+ *          IN result - authentication result
+ *          IN previousSid - previous session ID from the request
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   on success releases the previous session and derives SMB3
+ *          keys, reports logon event
+ *====================================================================
+ */
+static void completeSessionSetup(CSSession *connection, CSUser *session, NQ_UINT32 result, NQ_UINT64 previousSid)
+{
+    CSUser* previousSession;
+#ifdef UD_NQ_INCLUDEEVENTLOG
+    UDUserAccessEvent   eventInfo;
+#endif
+
+    if (result == NQ_SUCCESS && NULL != session)
+    {
+
+        session->authenticated = TRUE;
+        session->preservesCase = (UD_FS_FILESYSTEMATTRIBUTES & CM_FS_CASESENSITIVESEARCH) == 0;
+        session->supportsNotify = TRUE;
+#ifdef UD_NQ_INCLUDESMB3
+        session->preauthIntegOn = FALSE;
+#endif /* UD_NQ_INCLUDESMB3 */
+        
+        /* release previous session, if authenticated for the same user */
+        if (previousSid.low != 0)
+        {
+            previousSid.low = sessionIdToUid(previousSid.low);
+            if ((NULL != session)&& 
+                (session->uid != previousSid.low) && 
+                ((previousSession = csGetUserByUid((CSUid)previousSid.low)) != NULL)
+               )
+            {
+                if (syWStrncmp(session->name, previousSession->name, syWStrlen(session->name)) == 0)
+                {
+                    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Releasing previous sid = 0x%x", previousSid.low);
+                    csReleaseUser(previousSession->uid , TRUE);
+                }
+            }  
+        }
+#ifdef UD_NQ_INCLUDESMB3
+        if (connection->dialect == CS_DIALECT_SMB30)
+        {
+        	TRCDUMP("Session Key" , session->sessionKey , sizeof(session->sessionKey));
+        	cmKeyDerivation( session->sessionKey, sizeof(session->sessionKey)    , (NQ_BYTE*)"SMB2AESCMAC\0", 12 , (NQ_BYTE*)"SmbSign\0"   , 8  , (NQ_BYTE *)session->signingKey );
+        	cmKeyDerivation( session->sessionKey, sizeof(session->encryptionKey) , (NQ_BYTE*)"SMB2AESCCM\0" , 11 , (NQ_BYTE*)"ServerOut\0" , 10 , (NQ_BYTE *)session->encryptionKey );
+        	cmKeyDerivation( session->sessionKey, sizeof(session->decryptionKey) , (NQ_BYTE*)"SMB2AESCCM\0" , 11 , (NQ_BYTE*)"ServerIn \0" , 10 , (NQ_BYTE *)session->decryptionKey );
+        	cmKeyDerivation( session->sessionKey, sizeof(session->applicationKey), (NQ_BYTE*)"SMB2APP\0"    , 8 , (NQ_BYTE*)"SmbRpc\0"    , 7  , (NQ_BYTE *)session->applicationKey);
+        	TRCDUMP("Signing Key" , session->signingKey , sizeof(session->signingKey));
+        }
+        else /* connection->dialect == CS_DIALECT_SMB311 */
+        {
+			TRCDUMP("Session Key" , session->sessionKey , sizeof(session->sessionKey));
+			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBSigningKey\0",   14 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->signingKey );
+			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBS2CCipherKey\0", 16 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->encryptionKey );
+			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBC2SCipherKey\0", 16 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->decryptionKey );
+			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBAppKey\0",       10 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->applicationKey);
+			TRCDUMP("Signing Key" , session->signingKey , sizeof(session->signingKey));
+        }
+#endif /* UD_NQ_INCLUDESMB3 */
+#ifdef UD_NQ_INCLUDEEVENTLOG
+    	eventInfo.rid = csGetUserRid(session);
+		udEventLog(UD_LOG_MODULE_CS,
+				   UD_LOG_CLASS_USER,
+				   UD_LOG_USER_LOGON,
+				   (NQ_WCHAR*)session->name,
+				   &connection->ip,
+				   0,
+				   (const NQ_BYTE *)&eventInfo);
+#endif /* UD_NQ_INCLUDEEVENTLOG */
+    }
+    else if (result != SMB_STATUS_MORE_PROCESSING_REQUIRED)
+    {
+#ifdef UD_NQ_INCLUDEEVENTLOG
+    	if (result != csErrorReturn(SMB_STATUS_LOGON_FAILURE, DOS_ERRnoaccess))
+    	{
+    		NQ_WCHAR noName[] = CM_WCHAR_NULL_STRING;
+
+			eventInfo.rid = (session != NULL) ? csGetUserRid(session) : CS_ILLEGALID;
+			udEventLog(UD_LOG_MODULE_CS,
+					   UD_LOG_CLASS_USER,
+					   UD_LOG_USER_LOGON,
+					   (session != NULL) ? (NQ_WCHAR *)&session->name : (NQ_WCHAR *)&noName,
+					   &connection->ip,
+					   result,
+					   (const NQ_BYTE *)&eventInfo);
+    	}
+#endif /* UD_NQ_INCLUDEEVENTLOG */
+    }
+}
+
+#ifdef UD_CS_MESSAGESIGNINGPOLICY
+/*====================================================================
+ * PURPOSE: Decide on security signatures for the connection
+ *--------------------------------------------------------------------
+ * PARAMS:  IN connection - pointer to the session structure
+ *          IN session - pointer to the user structure
+ *          IN securityMode - client security mode
+ *          IN headerFlags - request header flags
+ *
+ * RETURNS: TRUE when the response should be signed
+ *
+ * NOTES:
+ *====================================================================
+ */
+static NQ_BOOL setSessionSigning(CSSession *connection, CSUser *session, NQ_BYTE securityMode, NQ_UINT32 headerFlags)
+{
+    NQ_BOOL sign = FALSE;
+
+#ifdef UD_CS_INCLUDEPASSTHROUGH
+    if (connection->usePassthrough && session->isDomainUser && !session->authBySamlogon)
+    {
+        /* disable signing */
+        connection->signingOn = FALSE;
+    }
+    else
+#endif /* UD_CS_INCLUDEPASSTHROUGH */
+    {
+         connection->signingOn = isConnectionSigningRequired(securityMode, headerFlags);
+         sign = connection->signingOn && !session->isAnonymous && !session->isGuest && session->authenticated;
+    }
+    TRC("Connection signing%s mandatory.", connection->signingOn ? "" : " not");
+    return sign;
+}
+#endif /* UD_CS_MESSAGESIGNINGPOLICY */
+
+/*====================================================================
+ * PURPOSE: Calculate session flags for the response
+ *--------------------------------------------------------------------
+ * PARAMS:  IN connection - pointer to the session structure
+ *          IN session - pointer to the user structure or NULL
+ *
+ * RETURNS: session flags
+ *
+ * NOTES:
+ *====================================================================
+ */
+static NQ_UINT16 getSessionFlags(const CSSession *connection, const CSUser *session)
+{
+    NQ_UINT16 sessionFlags = 0;
+
+    if (NULL != session)
+    {
+#ifdef UD_NQ_INCLUDESMB3
+        if (connection->dialect >= CS_DIALECT_SMB30 && session->isEncrypted)
+            sessionFlags = SMB2_SESSIONSETUP_ENCRYPT;
+        else
+#endif /* UD_NQ_INCLUDESMB3 */
+            sessionFlags = (NQ_UINT16)(session->isAnonymous ? SMB2_SESSIONSETUP_ANONYM : (session->isGuest ? SMB2_SESSIONSETUP_GUEST : 0));
+    }
+    return sessionFlags;
+}
+
+#ifdef CS_AUTH_ASYNCLOGON
+
+/*====================================================================
+ * PURPOSE: Complete session setup on pass-through logon result
+ *--------------------------------------------------------------------
+ * PARAMS:  IN session - pointer to the user structure or NULL when
+ *             it was released
+ *          IN status - logon status
+ *          IN context - parked session setup
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   called on the server thread, sends the final response
+ *          over the saved late response context
+ *====================================================================
+ */
+static void onLogonComplete(CSUser *session, NQ_UINT32 status, void *context)
+{
+    ParkedSessionSetup *parked = (ParkedSessionSetup *)context;
+    CSSession *connection;
+    CMBufferWriter writer;
+    NQ_BOOL sign = FALSE;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL);
+
+    connection = csGetSessionBySpecificSocket(parked->response.socket);
+    if (NULL == connection)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Connection closed while logon was in progress");
+        goto Exit;
+    }
+
+    completeSessionSetup(connection, session, status, parked->previousSid);
+#ifdef UD_CS_MESSAGESIGNINGPOLICY
+    if (NQ_SUCCESS == status && NULL != session)
+        sign = setSessionSigning(connection, session, parked->securityMode, parked->headerFlags);
+#endif /* UD_CS_MESSAGESIGNINGPOLICY */
+
+    cs2DispatchPrepareLateResponse(&parked->response, status);
+    cmBufferWriterInit(&writer, parked->response.commandData, parked->response.commandDataSize);
+    if (NQ_SUCCESS == status && NULL != session)
+    {
+        cmBufferWriteUint16(&writer, SMB2_SESSION_SETUP_RESPONSE_DATASIZE);   /* constant data length */
+        cmBufferWriteUint16(&writer, getSessionFlags(connection, session));  /* session flags */
+        cmBufferWriteUint16(&writer, SMB2_HEADERSIZE + 8);                    /* security blob offset */
+        cmBufferWriteUint16(&writer, (NQ_UINT16)parked->blobLength);          /* security blob size */
+        cmBufferWriteBytes(&writer, parked->blob, parked->blobLength);
+#ifdef UD_NQ_INCLUDESMB311
+        /* successful session setup is always signed in 3.1.1 */
+        if (connection->dialect == CS_DIALECT_SMB311)
+            sign = TRUE;
+#endif /* UD_NQ_INCLUDESMB311 */
+        if (sign)
+            *(parked->response.commandData - SMB2_HEADERSIZE + 16) |= SMB2_FLAG_SIGNED;
+    }
+    else
+    {
+        cmBufferWriteUint16(&writer, 9);    /* error response structure size */
+        cmBufferWriteUint16(&writer, 0);    /* reserved */
+        cmBufferWriteUint32(&writer, 0);    /* byte count */
+        cmBufferWriteByte(&writer, 0);      /* error data */
+    }
+    if (!cs2DispatchSendLateResponse(&parked->response, cmBufferWriterGetDataCount(&writer)))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Error sending session setup response");
+    }
+
+Exit:
+    cmMemoryFree(parked);
+    LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+}
+
+/*====================================================================
+ * PURPOSE: Park session setup until pass-through logon completes
+ *--------------------------------------------------------------------
+ * PARAMS:  IN in - pointer to the parsed SMB2 header descriptor
+ *          IN session - pointer to the user structure
+ *          IN securityMode - client security mode
+ *          IN previousSid - previous session ID from the request
+ *          IN blob - response security blob
+ *          IN blobLength - response blob length
+ *
+ * RETURNS: SMB_STATUS_NORESPONSE or error code
+ *
+ * NOTES:   sends interim response, the final response is sent by
+ *          onLogonComplete()
+ *====================================================================
+ */
+static NQ_UINT32 parkSessionSetup(const CMSmb2Header *in, CSUser *session, NQ_BYTE securityMode, NQ_UINT64 previousSid, const NQ_BYTE *blob, NQ_COUNT blobLength)
+{
+    ParkedSessionSetup *parked;
+    CMSmb2Header interim;
+
+    parked = (ParkedSessionSetup *)cmMemoryAllocate((NQ_UINT)(sizeof(*parked) + blobLength));
+    if (NULL == parked)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unable to allocate session setup context");
+        csReleaseUser(session->uid, FALSE);
+        return SMB_STATUS_INSUFFICIENT_RESOURCES;
+    }
+    parked->securityMode = securityMode;
+    parked->headerFlags = in->flags;
+    parked->previousSid = previousSid;
+    parked->blobLength = blobLength;
+    parked->blob = (NQ_BYTE *)(parked + 1);
+    syMemcpy(parked->blob, blob, blobLength);
+
+    /* respond on the new session */
+    interim = *in;
+    interim.sid.low = (NQ_UINT32)uidToSessionId(session->uid);
+    interim.sid.high = 0;
+    interim.aid.low = csSmb2SendInterimResponse(&interim);
+    interim.aid.high = 0;
+    if (0 == interim.aid.low)
+    {
+        cmMemoryFree(parked);
+        csReleaseUser(session->uid, FALSE);
+        return SMB_STATUS_INSUFFICIENT_RESOURCES;
+    }
+    cs2DispatchSaveResponseContext(&parked->response, &interim);
+
+    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Session setup for sid=0x%x waits for DC", interim.sid.low);
+    csAuthSetLogonCompletion(session, onLogonComplete, parked);
+    return SMB_STATUS_NORESPONSE;
+}
+
+#endif /* CS_AUTH_ASYNCLOGON */
+
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+
+/*====================================================================
+ * PURPOSE: Validate a request to bind the connection to a session
+ *--------------------------------------------------------------------
+ * PARAMS:  IN in - pointer to the parsed SMB2 header descriptor
+ *          IN reader - request reader pointing to the second command field
+ *          IN connection - pointer to the session structure
+ *          OUT session - temporary user authenticating the binding or NULL
+ *          OUT boundSession - the user to bind to
+ *
+ * RETURNS: 0 on success or error code in NT format
+ *
+ * NOTES:   the session must be established on another connection with
+ *          the same dialect and the request must be signed with its key
+ *====================================================================
+ */
+static NQ_UINT32 startBinding(CMSmb2Header *in, const CMBufferReader *reader, CSSession *connection, CSUser **session, CSUser **boundSession)
+{
+    CSUser * target;
+    CSSession * targetConnection;
+    NQ_BYTE * sig = in->_start + SMB2_SECURITY_SIGNATURE_OFFSET;
+    NQ_BYTE sigReceived[SMB2_SECURITY_SIGNATURE_SIZE];
+
+    if (connection->dialect < CS_DIALECT_SMB30)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Channel binding over dialect 0x%x", connection->dialect);
+        return SMB_STATUS_REQUEST_NOT_ACCEPTED;
+    }
+
+    target = csGetUserToBind((CSUid)sessionIdToUid(in->sid.low));
+    if (NULL == target || !target->authenticated)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Binding to unknown sid = 0x%x", in->sid.low);
+        return SMB_STATUS_USER_SESSION_DELETED;
+    }
+    if (target->isAnonymous || target->isGuest)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Binding to anonymous or guest session");
+        return SMB_STATUS_NOT_SUPPORTED;
+    }
+    targetConnection = csGetSessionById(target->session);
+    if (NULL == targetConnection || targetConnection == connection || targetConnection->dialect != connection->dialect)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Binding over the same connection or another dialect");
+        return SMB_STATUS_INVALID_PARAMETER;
+    }
+    if (NULL != csGetUserByUid(target->uid))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Connection is already bound to sid = 0x%x", in->sid.low);
+        return SMB_STATUS_REQUEST_NOT_ACCEPTED;
+    }
+
+    /* binding request is signed with the session signing key */
+    if (0 == (in->flags & SMB2_FLAG_SIGNED))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unsigned binding request");
+        return SMB_STATUS_INVALID_PARAMETER;
+    }
+    syMemcpy(sigReceived, sig, sizeof(sigReceived));
+    syMemset(sig, 0, SMB2_SECURITY_SIGNATURE_SIZE);
+    cmSmb3CalculateMessageSignature(target->signingKey, sizeof(target->signingKey), in->_start, (NQ_UINT)(reader->length + 4), NULL, 0, sig);
+    if (0 != syMemcmp(sigReceived, sig, sizeof(sigReceived)))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Binding request signature doesn't match");
+        return SMB_STATUS_ACCESS_DENIED;
+    }
+
+    /* continue authentication in progress */
+    *session = (connection->bindingUid != (CSUid)CS_ILLEGALID) ? csGetUserByUid(connection->bindingUid) : NULL;
+    *boundSession = target;
+    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Binding to sid = 0x%x", in->sid.low);
+    return NQ_SUCCESS;
+}
+
+/*====================================================================
+ * PURPOSE: Bind the connection on authentication result
+ *--------------------------------------------------------------------
+ * PARAMS:  IN connection - pointer to the session structure
+ *          IN session - temporary user authenticating the binding or NULL
+ *          IN boundSession - the user to bind to
+ *          IN result - authentication result
+ *
+ * RETURNS: 0 on success or error code in NT format
+ *
+ * NOTES:   the channel signing key is derived from the temporary user
+ *          which is released once the exchange is over
+ *====================================================================
+ */
+static NQ_UINT32 completeBinding(CSSession *connection, CSUser *session, CSUser *boundSession, NQ_UINT32 result)
+{
+    NQ_BYTE signingKey[SMB_SESSIONKEY_LENGTH];
+
+    if (NULL != session && result == SMB_STATUS_MORE_PROCESSING_REQUIRED)
+    {
+        connection->bindingUid = session->uid;
+        return result;
+    }
+    connection->bindingUid = (CSUid)CS_ILLEGALID;
+    if (NULL == session)
+    {
+        return result == NQ_SUCCESS ? SMB_STATUS_LOGON_FAILURE : result;
+    }
+
+#ifdef CS_AUTH_ASYNCLOGON
+    if (result == SMB_STATUS_PENDING)
+    {
+        /* late response would not carry the bound session */
+        LOGERR(CM_TRC_LEVEL_ERROR, "Binding does not wait for pass-through logon");
+        result = SMB_STATUS_REQUEST_NOT_ACCEPTED;
+    }
+#endif /* CS_AUTH_ASYNCLOGON */
+    if (result == NQ_SUCCESS && (session->isAnonymous || session->isGuest || 0 != cmWStrcmp(session->name, boundSession->name)
+        || 0 != cmWStricmp(session->domain, boundSession->domain) || session->isDomainUser != boundSession->isDomainUser))
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Binding authenticated another user");
+        result = SMB_STATUS_ACCESS_DENIED;
+    }
+    if (result == NQ_SUCCESS)
+    {
+        if (connection->dialect == CS_DIALECT_SMB30)
+        {
+            cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMB2AESCMAC\0", 12, (NQ_BYTE*)"SmbSign\0", 8, signingKey);
+        }
+        else /* connection->dialect == CS_DIALECT_SMB311 */
+        {
+            cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBSigningKey\0", 14, session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH, signingKey);
+        }
+        if (!csBindUserChannel(boundSession, connection, signingKey))
+        {
+            result = SMB_STATUS_INSUFFICIENT_RESOURCES;
+        }
+        else
+        {
+            LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Connection bound to uid %d", boundSession->uid);
+#ifdef UD_CS_MESSAGESIGNINGPOLICY
+            connection->signingOn = TRUE;
+#endif /* UD_CS_MESSAGESIGNINGPOLICY */
+        }
+    }
+    csReleaseUser(session->uid, result == NQ_SUCCESS);
+    return result;
+}
+
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+
 /*====================================================================
  * PURPOSE: Perform Session Setup processing
  *--------------------------------------------------------------------
@@ -64,18 +514,29 @@ NQ_UINT32 csSmb2OnSessionSetup(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
     NQ_UINT32 result;
     NQ_BYTE securityMode;
     NQ_UINT64 previousSid;
-    CSUser* previousSession;
-    NQ_UINT16	sessionFlags;
 #ifdef UD_NQ_INCLUDESMB311
     NQ_BOOL firstSessionSetup = FALSE;
     NQ_BYTE preauthTemp[SMB3_PREAUTH_INTEG_HASH_LENGTH];
 #endif
-#ifdef UD_NQ_INCLUDEEVENTLOG
-    UDUserAccessEvent   eventInfo;
-#endif
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    CSUser * boundSession = NULL;   /* session this connection is being bound to */
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
     
     LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL);
 
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    /* the request starts with the flags field */
+    if (in->sid.low != 0 && (*cmBufferReaderGetPosition(reader) & SMB2_SESSIONSETUP_FLAGBINDING))
+    {
+        result = startBinding(in, reader, connection, &session, &boundSession);
+        if (result != NQ_SUCCESS)
+        {
+            LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+            return result;
+        }
+    }
+    else
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
     /* check whether reauthentication is needed */
     if (in->sid.low != 0)
     {
@@ -89,6 +550,14 @@ NQ_UINT32 csSmb2OnSessionSetup(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
         }
         else
         {
+#ifdef CS_AUTH_ASYNCLOGON
+            if (expiredSession->pendingLogon != 0)
+            {
+                LOGERR(CM_TRC_LEVEL_ERROR, "Session setup while logon is in progress");
+                LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+                return SMB_STATUS_REQUEST_NOT_ACCEPTED;
+            }
+#endif /* CS_AUTH_ASYNCLOGON */
             /* check whether session has expired */
             if (!csUserHasExpired(expiredSession->uid))
             {
@@ -129,7 +598,7 @@ NQ_UINT32 csSmb2OnSessionSetup(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
 #endif
 
     /* read request */
-    cmBufferReaderSkip(reader, 1);           /* skip vc number */
+    cmBufferReaderSkip(reader, 1);           /* skip flags */
     cmBufferReadByte(reader, &securityMode); /* security mode */
     cmBufferReaderSkip(reader, 8);           /* skip capabilities and channel */
 
@@ -182,80 +651,44 @@ NQ_UINT32 csSmb2OnSessionSetup(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
 
     }
 #endif
-    if (result == NQ_SUCCESS && NULL != session)
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    if (NULL != boundSession)
     {
-
-        session->authenticated = TRUE;
-        session->preservesCase = (UD_FS_FILESYSTEMATTRIBUTES & CM_FS_CASESENSITIVESEARCH) == 0;
-        session->supportsNotify = TRUE;
-#ifdef UD_NQ_INCLUDESMB3
-        session->preauthIntegOn = FALSE;
-#endif /* UD_NQ_INCLUDESMB3 */
-        
-        /* release previous session, if authenticated for the same user */
-        if (previousSid.low != 0)
-        {
-            previousSid.low = sessionIdToUid(previousSid.low);
-            if ((NULL != session)&& 
-                (session->uid != previousSid.low) && 
-                ((previousSession = csGetUserByUid((CSUid)previousSid.low)) != NULL)
-               )
-            {
-                if (syWStrncmp(session->name, previousSession->name, syWStrlen(session->name)) == 0)
-                {
-                    LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Releasing previous sid = 0x%x", previousSid.low);
-                    csReleaseUser(previousSession->uid , TRUE);
-                }
-            }  
-        }
-#ifdef UD_NQ_INCLUDESMB3
-        if (connection->dialect == CS_DIALECT_SMB30)
+        result = completeBinding(connection, session, boundSession, result);
+        if (result != NQ_SUCCESS && result != SMB_STATUS_MORE_PROCESSING_REQUIRED)
         {
-        	TRCDUMP("Session Key" , session->sessionKey , sizeof(session->sessionKey));
-        	cmKeyDerivation( session->sessionKey, sizeof(session->sessionKey)    , (NQ_BYTE*)"SMB2AESCMAC\0", 12 , (NQ_BYTE*)"SmbSign\0"   , 8  , (NQ_BYTE *)session->signingKey );
-        	cmKeyDerivation( session->sessionKey, sizeof(session->encryptionKey) , (NQ_BYTE*)"SMB2AESCCM\0" , 11 , (NQ_BYTE*)"ServerOut\0" , 10 , (NQ_BYTE *)session->encryptionKey );
-        	cmKeyDerivation( session->sessionKey, sizeof(session->decryptionKey) , (NQ_BYTE*)"SMB2AESCCM\0" , 11 , (NQ_BYTE*)"ServerIn \0" , 10 , (NQ_BYTE *)session->decryptionKey );
-        	cmKeyDerivation( session->sessionKey, sizeof(session->applicationKey), (NQ_BYTE*)"SMB2APP\0"    , 8 , (NQ_BYTE*)"SmbRpc\0"    , 7  , (NQ_BYTE *)session->applicationKey);
-        	TRCDUMP("Signing Key" , session->signingKey , sizeof(session->signingKey));
-        }
-        else /* connection->dialect == CS_DIALECT_SMB311 */
-        {
-			TRCDUMP("Session Key" , session->sessionKey , sizeof(session->sessionKey));
-			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBSigningKey\0",   14 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->signingKey );
-			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBS2CCipherKey\0", 16 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->encryptionKey );
-			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBC2SCipherKey\0", 16 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->decryptionKey );
-			cmKeyDerivation(session->sessionKey, sizeof(session->sessionKey), (NQ_BYTE*)"SMBAppKey\0",       10 , session->preauthIntegHashVal, SMB3_PREAUTH_INTEG_HASH_LENGTH , (NQ_BYTE *)session->applicationKey);
-			TRCDUMP("Signing Key" , session->signingKey , sizeof(session->signingKey));
+            LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+            return result;
         }
-#endif /* UD_NQ_INCLUDESMB3 */
-#ifdef UD_NQ_INCLUDEEVENTLOG
-    	eventInfo.rid = csGetUserRid(session);
-		udEventLog(UD_LOG_MODULE_CS,
-				   UD_LOG_CLASS_USER,
-				   UD_LOG_USER_LOGON,
-				   (NQ_WCHAR*)session->name,
-				   &connection->ip,
-				   0,
-				   (const NQ_BYTE *)&eventInfo);
-#endif /* UD_NQ_INCLUDEEVENTLOG */
+
+        /* respond on the bound session */
+        cmBufferWriterSkip(&outSecurityBlob, outBlobLen);
+        out->sid.high = 0;
+        out->sid.low = (NQ_UINT32)uidToSessionId(boundSession->uid);
+        if (result == NQ_SUCCESS)
+            out->flags |= SMB2_FLAG_SIGNED;
+        cmBufferWriteUint16(writer, SMB2_SESSION_SETUP_RESPONSE_DATASIZE);                             /* constant data length */
+        cmBufferWriteUint16(writer, getSessionFlags(connection, boundSession));                        /* session flags */
+        cmBufferWriteUint16(writer, (NQ_UINT16)(cmSmb2HeaderGetWriterOffset(out, writer) + 4));        /* security blob offset */
+        cmBufferWriteUint16(writer, (NQ_UINT16)cmBufferWriterGetDataCount(&outSecurityBlob));          /* security blob size */
+        cmBufferWriterSync(writer, &outSecurityBlob);
+
+        LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+        return result;
     }
-    else if (result != SMB_STATUS_MORE_PROCESSING_REQUIRED)
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+#ifdef CS_AUTH_ASYNCLOGON
+    if (result == SMB_STATUS_PENDING)
     {
-#ifdef UD_NQ_INCLUDEEVENTLOG
-    	if (result != csErrorReturn(SMB_STATUS_LOGON_FAILURE, DOS_ERRnoaccess))
-    	{
-    		NQ_WCHAR noName[] = CM_WCHAR_NULL_STRING;
+        result = parkSessionSetup(in, session, securityMode, previousSid, outSecurityBlob.current, outBlobLen);
+        LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+        return result;
+    }
+#endif /* CS_AUTH_ASYNCLOGON */
 
-			eventInfo.rid = (session != NULL) ? csGetUserRid(session) : CS_ILLEGALID;
-			udEventLog(UD_LOG_MODULE_CS,
-					   UD_LOG_CLASS_USER,
-					   UD_LOG_USER_LOGON,
-					   (session != NULL) ? (NQ_WCHAR *)&session->name : (NQ_WCHAR *)&noName,
-					   &connection->ip,
-					   result,
-					   (const NQ_BYTE *)&eventInfo);
-    	}
-#endif /* UD_NQ_INCLUDEEVENTLOG */
+    completeSessionSetup(connection, session, result, previousSid);
+    if ((result != NQ_SUCCESS || NULL == session) && result != SMB_STATUS_MORE_PROCESSING_REQUIRED)
+    {
         LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
 
         return result;
@@ -270,38 +703,16 @@ NQ_UINT32 csSmb2OnSessionSetup(CMSmb2Header *in, CMSmb2Header *out, CMBufferRead
     out->sid.low = (NQ_UINT32)(session != NULL ? uidToSessionId(session->uid) : 0);
 #ifdef UD_CS_MESSAGESIGNINGPOLICY
     /* decide on security signatures */
-    if (session)
+    if (session && setSessionSigning(connection, session, securityMode, in->flags))
     {
-#ifdef UD_CS_INCLUDEPASSTHROUGH
-        if (connection->usePassthrough && session->isDomainUser && !session->authBySamlogon)
-        {
-            /* disable signing */
-            connection->signingOn = FALSE;
-        }
-        else
-#endif /* UD_CS_INCLUDEPASSTHROUGH */
-        {
-             connection->signingOn = isConnectionSigningRequired(securityMode, in->flags);
-             out->flags |= (connection->signingOn && !session->isAnonymous && !session->isGuest && session->authenticated) ? SMB2_FLAG_SIGNED : 0;
-        }
-        TRC("Connection signing%s mandatory.", connection->signingOn ? "" : " not");
+        out->flags |= SMB2_FLAG_SIGNED;
     }
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */
 
     LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "sid=0x%x", (session != NULL ? uidToSessionId(session->uid) : 0));
 
     cmBufferWriteUint16(writer, SMB2_SESSION_SETUP_RESPONSE_DATASIZE);                             /* constant data length */
-    sessionFlags = 0;
-    if (NULL != session)
-    {
-#ifdef UD_NQ_INCLUDESMB3
-        if (connection->dialect >= CS_DIALECT_SMB30 && session->isEncrypted)
-            sessionFlags = SMB2_SESSIONSETUP_ENCRYPT;
-        else
-#endif /* UD_NQ_INCLUDESMB3 */
-            sessionFlags = (NQ_UINT16)(session->isAnonymous ? SMB2_SESSIONSETUP_ANONYM : (session->isGuest ? SMB2_SESSIONSETUP_GUEST : 0));
-    }
-    cmBufferWriteUint16(writer, sessionFlags);                                                     /* session flags */
+    cmBufferWriteUint16(writer, getSessionFlags(connection, session));                                                   /* session flags */
     cmBufferWriteUint16(writer, (NQ_UINT16)(cmSmb2HeaderGetWriterOffset(out, writer) + 4));        /* security blob offset */   
     cmBufferWriteUint16(writer, (NQ_UINT16)cmBufferWriterGetDataCount(&outSecurityBlob));          /* security blob size */    
     cmBufferWriterSync(writer, &outSecurityBlob);
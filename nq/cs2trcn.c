@@ -176,6 +176,7 @@ NQ_UINT32 csSmb2OnTreeConnect(CMSmb2Header *in, CMSmb2Header *out, CMBufferReade
     
     /* fill tree information */
     tree->share = pShare;
+    csEvaluateShareAccess(tree);
     if (!pShare->ipcFlag)
     {
         udServerShareConnect(pShare->name);
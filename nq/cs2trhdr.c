@@ -17,6 +17,7 @@
 #include "cmsmb2.h"
 #include "csdataba.h"
 #include "cmcrypt.h"
+#include "cmcompress.h"
 #include "cs2disp.h"
 
 #if defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB3)
@@ -165,4 +166,33 @@ NQ_BOOL cs2TransformHeaderDecrypt(	NSRecvDescr * recvDescr,
 
 	return res;
 }
+
+#ifdef UD_NQ_INCLUDECOMPRESSION
+NQ_COUNT cs2TransformHeaderDecompress(	NQ_UINT16 algorithm,
+										NQ_BYTE * message,
+										NQ_COUNT length,
+										NQ_COUNT bufferSize)
+{
+	NQ_BYTE * compressed;	/* copy of the compression transform */
+	NQ_COUNT msgLen;		/* decompressed message length */
+
+	/* the message is restored in the same buffer so decompress from a copy */
+	compressed = (NQ_BYTE *)cmMemoryAllocate(length);
+	if (NULL == compressed)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Out of memory");
+		return (NQ_COUNT)NQ_FAIL;
+	}
+	syMemcpy(compressed, message, length);
+	msgLen = cmSmb2DecompressMessage(algorithm, compressed, length, message, bufferSize);
+	cmMemoryFree(compressed);
+	if (msgLen == (NQ_COUNT)NQ_FAIL || msgLen < SMB2_HEADERSIZE)
+	{
+		LOGERR(CM_TRC_LEVEL_ERROR, "Failed to decompress message");
+		return (NQ_COUNT)NQ_FAIL;
+	}
+
+	return msgLen;
+}
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 #endif  /* defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2) */
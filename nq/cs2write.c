@@ -19,6 +19,7 @@
 #include "csutils.h"
 #include "csdcerpc.h"
 #include "cs2disp.h"
+#include "csbreak.h"
 
 #if defined(UD_NQ_INCLUDECIFSSERVER) && defined(UD_NQ_INCLUDESMB2)
 
@@ -301,6 +302,7 @@ NQ_UINT32 csSmb2OnWrite(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *rea
                     return error;
                 }
                 csGetNameByNid(pFile->nid)->isDirty = TRUE;   
+                csBreakLeaseOnChange(NULL, pFile);
             }
     
             /* update file offsets */
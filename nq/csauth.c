@@ -26,6 +26,8 @@
 #include "amspnego.h"
 #include "amntlmss.h"
 #include "cmlist.h"
+#include "csdispat.h"
+#include "cscontrl.h"
 #ifdef UD_CS_INCLUDEPASSTHROUGH
 #include "ccapi.h"
 #include "ccserver.h"
@@ -52,6 +54,72 @@ typedef struct {
 }
 Pdc;
 
+#ifdef CS_AUTH_ASYNCLOGON
+
+#define MAX_PENDINGLOGONS   8       /* number of pass-through logons in progress */
+#define LOGON_WAITTIMEOUT   5       /* idle wakeup of the logon thread in seconds */
+#define LOGON_STOPTIMEOUT   60      /* time to wait for the logon thread to exit in seconds */
+
+/* pass-through logon states */
+#define LOGON_FREE          0       /* slot is not used */
+#define LOGON_QUEUED        1       /* waits for the logon thread */
+#define LOGON_RUNNING       2       /* NETLOGON in progress */
+#define LOGON_DONE          3       /* waits for completion on the server thread */
+
+/*
+    Pass-through logon performed by the logon thread
+*/
+
+typedef struct
+{
+    NQ_INT state;                   /* one of LOGON_* values */
+    NQ_UINT32 id;                   /* logon ID saved in the user descriptor */
+    CSUid uid;                      /* user waiting for the logon */
+    NSSocketHandle socket;          /* socket of the user connection */
+    CSAuthLogonCompletion completion;   /* completion callback */
+    void * context;                 /* completion context */
+    NQ_WCHAR domain[CM_BUFFERLENGTH(NQ_WCHAR, CM_NQ_HOSTNAMESIZE)];  /* user domain */
+    NQ_WCHAR user[CM_BUFFERLENGTH(NQ_WCHAR, CM_USERNAMELENGTH)];     /* user name */
+    NQ_WCHAR host[CM_BUFFERLENGTH(NQ_WCHAR, CM_NQ_HOSTNAMESIZE)];    /* own host name */
+    NQ_BYTE challenge[8];           /* server challenge */
+    NQ_BYTE secret[16];             /* computer account secret */
+    NQ_BYTE passwords[CM_CRYPT_MAX_NTLMV2NTLMSSPRESPONSESIZE];  /* LM and NTLM blobs */
+    AMNtlmDescriptor descr;         /* descriptor of the blobs above */
+    NQ_BYTE clientKey[SMB_SESSIONKEY_LENGTH];   /* session key supplied by client */
+    NQ_BOOL hasClientKey;           /* whether client supplied a session key */
+    NQ_BOOL isExtendedSecurity;     /* NETLOGON extended security flag */
+    NQ_BOOL isSsp;                  /* extended security flag for local authentication */
+    NQ_BOOL succeeded;              /* NETLOGON result */
+    NQ_BYTE sessionKey[SMB_SESSIONKEY_LENGTH];  /* session key returned by DC */
+    NQ_UINT32 userRid;              /* user RID returned by DC */
+    NQ_UINT32 groupRid;             /* group RID returned by DC */
+}
+PendingLogon;
+
+#endif /* CS_AUTH_ASYNCLOGON */
+
+/* NTLMv2 key (NTOWFv2) variants in the order they are tried */
+#define V2HASH_CASESENSITIVEDOMAIN  0   /* domain name as sent by client */
+#define V2HASH_DOMAIN               1   /* domain name in upper case */
+#define V2HASH_NULLDOMAIN           2   /* empty domain name */
+#define V2HASH_NUMVARIANTS          3
+
+/*
+    NTLMv2 keys of a local user with verified credentials
+*/
+
+typedef struct
+{
+    NQ_WCHAR user[CM_BUFFERLENGTH(NQ_WCHAR, CM_USERNAMELENGTH)];     /* user name */
+    NQ_WCHAR domain[CM_BUFFERLENGTH(NQ_WCHAR, CM_NQ_HOSTNAMESIZE)];  /* domain name as sent by client */
+    NQ_BYTE fingerprint[16];                        /* MD5 of the NT hash */
+    NQ_BYTE v2hash[V2HASH_NUMVARIANTS][16];         /* NTLMv2 keys */
+    NQ_BOOL hasV2hash[V2HASH_NUMVARIANTS];          /* TRUE for a calculated key */
+    NQ_COUNT matched;                               /* key variant that matched last */
+    NQ_UINT32 expiration;                           /* time when entry expires, zero for a free entry */
+}
+CachedCredential;
+
 /*
     static data declarations
 */
@@ -60,6 +128,19 @@ typedef struct
 {
     NQ_BYTE buffer[CM_NB_DATAGRAMBUFFERSIZE];
     Pdc pdc;
+#ifdef UD_CS_INCLUDEAUTHCACHE
+    CachedCredential credentials[UD_CS_AUTHCACHE_SIZE]; /* verified credential cache */
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+#ifdef CS_AUTH_ASYNCLOGON
+    PendingLogon logons[MAX_PENDINGLOGONS]; /* pass-through logons in progress */
+    NQ_UINT32 nextLogonId;                  /* ID of the next logon */
+    SYMutex logonGuard;                     /* guards logon states */
+    SYThread logonThread;                   /* thread performing NETLOGON */
+    CMThreadCond logonWakeup;               /* signalled when a logon is queued */
+    CMThreadCond logonDone;                 /* signalled when the logon thread exits */
+    NQ_BOOL logonThreadStarted;             /* TRUE after the logon thread was started */
+    NQ_BOOL logonStop;                      /* TRUE to stop the logon thread */
+#endif /* CS_AUTH_ASYNCLOGON */
 }
 StaticData;
 
@@ -97,10 +178,47 @@ typedef struct
 #define KEY_NTLM 2
 #define KEY_NTLMV2 3
 
+/* NTLMv2 key variant names for trace */
+static const NQ_CHAR* const v2hashNames[V2HASH_NUMVARIANTS] = { " (csd)", "", " - null domain" };
+
 /*
     Static functions
     ----------------
  */
+static void                         /* calculate or get cached NTLMv2 key */
+getV2Hash(
+    CachedCredential* cred,             /* cached keys or NULL */
+    const NQ_WCHAR* domain,             /* domain name */
+    const NQ_WCHAR* user,               /* user name */
+    const NQ_BYTE* ntlm,                /* NT hash */
+    NQ_COUNT variant,                   /* key variant */
+    NQ_BYTE* v2hash                     /* buffer for the key */
+    );
+
+#ifdef UD_CS_INCLUDEAUTHCACHE
+static CachedCredential*            /* find cache entry */
+findCredential(
+    const NQ_WCHAR* user,               /* user name */
+    const NQ_WCHAR* domain,             /* domain name */
+    const NQ_BYTE* ntlm                 /* NT hash */
+    );
+
+static void                         /* add or refresh entry after successful logon */
+credentialVerified(
+    CachedCredential* cred,             /* cached keys or NULL */
+    const NQ_WCHAR* user,               /* user name */
+    const NQ_WCHAR* domain,             /* domain name */
+    const NQ_BYTE* ntlm,                /* NT hash */
+    NQ_COUNT variant,                   /* key variant that matched */
+    const NQ_BYTE* v2hash               /* key that matched */
+    );
+
+static void                         /* wipe cache entry */
+wipeCredential(
+    CachedCredential* cred              /* cached keys */
+    );
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+
 #if defined (UD_CS_INCLUDELOCALUSERMANAGEMENT) || defined(UD_CS_MESSAGESIGNINGPOLICY)
 /* Generate session key */
 static void
@@ -164,6 +282,51 @@ authenticateSpnego(
     );
 #endif /* UD_CS_INCLUDEEXTENDEDSECURITY */
 
+static NQ_UINT32                    /* error code or NQ_SUCCESS */
+authenticateLocally(
+    CSUser* pUser,                  /* user structure pointer */
+    CSSession* pSession,            /* session structure */
+    const NQ_WCHAR* domain,         /* domain name */
+    const NQ_WCHAR* userName,       /* user name */
+    AMNtlmDescriptor* descr,        /* NTLM blob descriptor */
+    const NQ_BYTE* pSessionKey,     /* client supplied session key or NULL */
+    NQ_BOOL isSsp                   /* TRUE for extended security */
+    );
+
+#if defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH)
+static void                         /* apply successful pass-through logon */
+acceptPassthrough(
+    CSUser* pUser,                  /* user structure with the session key from DC */
+    const CSSession* pSession,      /* session structure */
+    AMNtlmDescriptor* descr,        /* NTLM blob descriptor */
+    const NQ_BYTE* pSessionKey,     /* client supplied session key or NULL */
+    NQ_BOOL isExtendedSecurity,     /* NETLOGON extended security flag */
+    CMSdRid userRid,                /* user RID returned by DC */
+    CMSdRid groupRid                /* group RID returned by DC */
+    );
+#endif /* defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH) */
+
+#ifdef CS_AUTH_ASYNCLOGON
+static NQ_BOOL                      /* queue pass-through logon for the logon thread */
+queueLogon(
+    CSUser* pUser,                  /* user structure */
+    const CSSession* pSession,      /* session structure */
+    const NQ_WCHAR* domain,         /* domain name */
+    const NQ_WCHAR* userName,       /* user name */
+    const NQ_WCHAR* hostName,       /* own host name */
+    const AMNtlmDescriptor* descr,  /* NTLM blob descriptor */
+    const NQ_BYTE* pSessionKey,     /* client supplied session key or NULL */
+    NQ_BOOL isExtendedSecurity,     /* NETLOGON extended security flag */
+    NQ_BOOL isSsp,                  /* extended security flag for local authentication */
+    const NQ_BYTE* secret           /* computer account secret */
+    );
+
+static void                         /* logon thread */
+logonThreadBody(
+    void
+    );
+#endif /* CS_AUTH_ASYNCLOGON */
+
 static NQ_BOOL                  /* returns TRUE is there is a local user */
 isLocalUserOk(
     CSUser* pUser,              /* user structure pointer */
@@ -231,6 +394,16 @@ csAuthInit(
 
     staticData->pdc.name[0] = '\0';
     staticData->pdc.connected = FALSE;
+#ifdef UD_CS_INCLUDEAUTHCACHE
+    syMemset(staticData->credentials, 0, sizeof(staticData->credentials));
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+#ifdef CS_AUTH_ASYNCLOGON
+    syMemset(staticData->logons, 0, sizeof(staticData->logons));
+    staticData->nextLogonId = 1;
+    staticData->logonThreadStarted = FALSE;
+    staticData->logonStop = FALSE;
+    syMutexCreate(&staticData->logonGuard);
+#endif /* CS_AUTH_ASYNCLOGON */
 
 #ifdef UD_CS_INCLUDEEXTENDEDSECURITY
     amSpnegoServerSetSessionKeyCallback(getCurrentSessionKey);
@@ -258,6 +431,40 @@ csAuthShutdown(void)
 {
     TRCB();
 
+#ifdef CS_AUTH_ASYNCLOGON
+    if (staticData->logonThreadStarted)
+    {
+        NQ_COUNT i;
+
+        staticData->logonStop = TRUE;
+        cmThreadCondSignal(&staticData->logonWakeup);
+        if (!cmThreadCondWait(&staticData->logonDone, LOGON_STOPTIMEOUT))
+        {
+            /* the thread still waits for DC and refers to static data */
+            TRCERR("Logon thread did not exit");
+            TRCE();
+            return;
+        }
+        cmThreadCondRelease(&staticData->logonWakeup);
+        cmThreadCondRelease(&staticData->logonDone);
+        staticData->logonThreadStarted = FALSE;
+        for (i = 0; i < MAX_PENDINGLOGONS; i++)
+        {
+            if (staticData->logons[i].state != LOGON_FREE)
+                cmMemoryFree(staticData->logons[i].context);
+        }
+    }
+    syMutexDelete(&staticData->logonGuard);
+#endif /* CS_AUTH_ASYNCLOGON */
+#ifdef UD_CS_INCLUDEAUTHCACHE
+    {
+        NQ_COUNT i;
+
+        for (i = 0; i < UD_CS_AUTHCACHE_SIZE; i++)
+            wipeCredential(&staticData->credentials[i]);
+    }
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+
     /* release memory */
 #ifdef SY_FORCEALLOCATION
     if (NULL != staticData)
@@ -310,7 +517,9 @@ csAuthGetPDCName(
  *
  * RETURNS: error code or NQ_SUCCESS
  *
- * NOTES:   none
+ * NOTES:   SMB_STATUS_PENDING means that an SMB2 pass-through logon was
+ *          queued to the logon thread. The caller should set its
+ *          completion with csAuthSetLogonCompletion().
  *====================================================================
  */
 NQ_UINT32
@@ -551,6 +760,7 @@ csAuthenticateUser(
 
 	/* save user name, credentials, session key */
     syWStrcpy((*pUser)->name, userName);
+    syWStrcpy((*pUser)->domain, domain);
 	syMemcpy(passwords, descr.pLm, descr.lmLen);
 	syMemcpy(passwords + descr.lmLen, descr.pNtlm, descr.ntlmLen);
 	credentialsLen = descr.lmLen + descr.ntlmLen;
@@ -620,7 +830,19 @@ csAuthenticateUser(
 
 			if (pSession->dialect == CS_DIALECT_SMB1 && pRequest->wordCount == SMB_SESSIONSETUPANDXSSP_REQUEST_WORDCOUNT)
 				isExtendedSecurity = TRUE;
-					
+
+#ifdef CS_AUTH_ASYNCLOGON
+            /* SMB2 session setup is completed when the logon thread is done with DC */
+            if (pSession->dialect != CS_DIALECT_SMB1
+                && queueLogon(*pUser, pSession, domain, userName, hostName, &descr, pSessionKey, isExtendedSecurity,
+                              pRequest->wordCount == SMB_SESSIONSETUPANDXSSP_REQUEST_WORDCOUNT, secret))
+            {
+                TRC("Passthrough (NetLogon) authentication queued");
+                TRCE();
+                return SMB_STATUS_PENDING;
+            }
+#endif /* CS_AUTH_ASYNCLOGON */
+
             TRC("Getting session key from DC (passthrough NetLogon)");
             TRCDUMP("server challenge (encryptionKey)", pSession->encryptionKey, 8);
             TRCDUMP("secret", secret, 16);
@@ -643,37 +865,7 @@ csAuthenticateUser(
 
             {
                 TRC("Passthrough (NetLogon) authentication succeeded");
-                TRCDUMP("Session key:", (*pUser)->sessionKey, 16);
-
-                if (0 != (descr.flags & NTLMSSP_NEGOTIATE_EXTENDED_SECURITY) && descr.lmLen == 24 && descr.ntlmLen == 24) 
-                {
-                    TRC("Generating extended security (ntlmv2) session key");
-                    cmGenerateExtSecuritySessionKey((*pUser)->sessionKey, pSession->sessionNonce, (*pUser)->sessionKey);                        
-                }
-
-                if (pSessionKey)  /* client supplied session key */
-                {
-                    if (descr.flags & NTLMSSP_NEGOTIATE_KEY_EXCH) /* session key should be decrypted*/
-                    {
-                        TRC("Client supplied encrypted session key");
-                        TRCDUMP("encrypted session key (sess setup auth mess)", pSessionKey, 16);
-                        cmArcfourCrypt((NQ_BYTE*)pSessionKey, 16, (*pUser)->sessionKey, sizeof((*pUser)->sessionKey));
-                    }
-                    syMemcpy((*pUser)->sessionKey, pSessionKey, sizeof((*pUser)->sessionKey));
-                }
-                TRCDUMP("Session key (final)", (*pUser)->sessionKey, 16);
-                (*pUser)->isExtendSecAuth = isExtendedSecurity;
-                (*pUser)->authBySamlogon = TRUE;
-                descr.isNtlmAuthenticated = TRUE;
-#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
-				TRC("userRid:%d, groupRid:%d", userRid, groupRid);
-				(*pUser)->token.rids[0] = userRid;
-				(*pUser)->token.rids[1] = groupRid;
-				(*pUser)->token.numRids = 2;
-#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
-#ifdef UD_CS_MESSAGESIGNINGPOLICY
-                createSigningContextSmb(*pUser, &descr);
-#endif /* UD_CS_MESSAGESIGNINGPOLICY */
+                acceptPassthrough(*pUser, pSession, &descr, pSessionKey, isExtendedSecurity, userRid, groupRid);
                 TRCE();
                 return NQ_SUCCESS;
             }
@@ -685,24 +877,78 @@ csAuthenticateUser(
         }
     }
 #endif /* defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH) */
-   
+
+    res = authenticateLocally(
+            *pUser,
+            pSession,
+            domain,
+            userName,
+            &descr,
+#ifdef UD_CS_INCLUDEEXTENDEDSECURITY
+            pSessionKey,
+            pRequest->wordCount == SMB_SESSIONSETUPANDXSSP_REQUEST_WORDCOUNT
+#else /* UD_CS_INCLUDEEXTENDEDSECURITY */
+            NULL,
+            FALSE
+#endif /* UD_CS_INCLUDEEXTENDEDSECURITY */
+            );
+
+    TRCE();
+    return res;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Authenticate user by the local user list
+ *--------------------------------------------------------------------
+ * PARAMS:  IN pointer to the user descriptor
+ *          IN pointer to the session descriptor
+ *          IN domain name
+ *          IN user name
+ *          IN/OUT pointer to the NTLM blob descriptor
+ *          IN/OUT client supplied session key or NULL
+ *          IN TRUE for extended security
+ *
+ * RETURNS: error code or NQ_SUCCESS
+ *
+ * NOTES:   the user is released on failure
+ *====================================================================
+ */
+
+static NQ_UINT32
+authenticateLocally(
+    CSUser* pUser,
+    CSSession* pSession,
+    const NQ_WCHAR* domain,
+    const NQ_WCHAR* userName,
+    AMNtlmDescriptor* descr,
+    const NQ_BYTE* pSessionKey,
+    NQ_BOOL isSsp
+    )
+{
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    CMSdRid userRid;                /* RID for user */
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+
+    TRCB();
+
     TRC("Performing local authentication");
 
 #ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
     /* if user will be locally authenticated this value will be > 0 */
-    (*pUser)->token.numRids = 0;
+    pUser->token.numRids = 0;
 #endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
-    (*pUser)->isDomainUser = FALSE;
+    pUser->isDomainUser = FALSE;
 
     if (isLocalUserOk(
-            *pUser,
+            pUser,
             domain,
             userName,
             pSession->encryptionKey,
-            &descr
+            descr
 #ifdef UD_CS_INCLUDEEXTENDEDSECURITY
             ,
-            pRequest->wordCount == SMB_SESSIONSETUPANDXSSP_REQUEST_WORDCOUNT
+            isSsp
 #endif /* UD_CS_INCLUDEEXTENDEDSECURITY */           
 #ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
             ,
@@ -711,7 +957,7 @@ csAuthenticateUser(
             )
         )
     {
-        if ((*pUser)->isGuest)
+        if (pUser->isGuest)
         {
             TRCE();
             return NQ_SUCCESS;
@@ -720,15 +966,15 @@ csAuthenticateUser(
 #ifdef UD_CS_INCLUDEEXTENDEDSECURITY
         if (NULL != pSessionKey)
         {
-            if (descr.flags & NTLMSSP_NEGOTIATE_KEY_EXCH) /* client supplied encrypted session key */
+            if (descr->flags & NTLMSSP_NEGOTIATE_KEY_EXCH) /* client supplied encrypted session key */
             {
-                cmArcfourCrypt((NQ_BYTE*)pSessionKey, 16, (*pUser)->sessionKey, sizeof((*pUser)->sessionKey));
+                cmArcfourCrypt((NQ_BYTE*)pSessionKey, 16, pUser->sessionKey, sizeof(pUser->sessionKey));
             }
-            syMemcpy((*pUser)->sessionKey, pSessionKey, sizeof((*pUser)->sessionKey));
+            syMemcpy(pUser->sessionKey, pSessionKey, sizeof(pUser->sessionKey));
         }     
 #endif /* UD_CS_INCLUDEEXTENDEDSECURITY */
 #ifdef UD_CS_MESSAGESIGNINGPOLICY
-        createSigningContextSmb(*pUser, &descr);
+        createSigningContextSmb(pUser, descr);
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */
     }
     else
@@ -738,42 +984,465 @@ csAuthenticateUser(
 #endif /* UD_NQ_INCLUDEEVENTLOG */
         TRCERR("Local authentication failed");
 #ifdef UD_NQ_INCLUDEEVENTLOG
-    	eventInfo.rid = csGetUserRid((*pUser));
+    	eventInfo.rid = csGetUserRid(pUser);
 		udEventLog(UD_LOG_MODULE_CS,
 				   UD_LOG_CLASS_USER,
 				   UD_LOG_USER_LOGON,
-				   (*pUser)->name,
-				   (*pUser)->ip,
+				   pUser->name,
+				   pUser->ip,
 				   csErrorReturn(SMB_STATUS_LOGON_FAILURE, DOS_ERRnoaccess),
 				   (const NQ_BYTE *)&eventInfo);
 #endif /* UD_NQ_INCLUDEEVENTLOG */
-		csReleaseUser((*pUser)->uid, TRUE);
+		csReleaseUser(pUser->uid, TRUE);
         TRCE();
         return csErrorReturn(SMB_STATUS_LOGON_FAILURE, DOS_ERRnoaccess);
     }
 
 #ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
-    (*pUser)->token.numRids = 2;
-    (*pUser)->token.rids[0] = userRid;
-    (*pUser)->token.rids[1] = CM_SD_RIDALIASUSER;
+    pUser->token.numRids = 2;
+    pUser->token.rids[0] = userRid;
+    pUser->token.rids[1] = CM_SD_RIDALIASUSER;
 
     if (cmSdIsAdmin(userRid))         /* administrator */
     {
-        (*pUser)->token.numRids = 4;
-        (*pUser)->token.rids[2] = CM_SD_RIDGROUPADMINS;
-        (*pUser)->token.rids[3] = CM_SD_RIDALIASADMIN;
+        pUser->token.numRids = 4;
+        pUser->token.rids[2] = CM_SD_RIDGROUPADMINS;
+        pUser->token.rids[3] = CM_SD_RIDALIASADMIN;
     }
-	syMemcpy(&(*pUser)->token.domain, cmSdGetComputerSid(), sizeof((*pUser)->token.domain));
+	syMemcpy(&pUser->token.domain, cmSdGetComputerSid(), sizeof(pUser->token.domain));
 #endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
 
 #ifdef UD_NQ_INCLUDESMB3
-    (*pUser)->isEncrypted = csIsServerEncrypted();
+    pUser->isEncrypted = csIsServerEncrypted();
 #endif /* UD_NQ_INCLUDESMB3 */
 
     TRCE();
     return NQ_SUCCESS;
 }
 
+#if defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH)
+
+/*
+ *====================================================================
+ * PURPOSE: Apply successful pass-through logon to the user
+ *--------------------------------------------------------------------
+ * PARAMS:  IN pointer to the user descriptor with the session key from DC
+ *          IN pointer to the session descriptor
+ *          IN/OUT pointer to the NTLM blob descriptor
+ *          IN/OUT client supplied session key or NULL
+ *          IN NETLOGON extended security flag
+ *          IN user RID returned by DC
+ *          IN group RID returned by DC
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   completes the session key and the security token
+ *====================================================================
+ */
+
+static void
+acceptPassthrough(
+    CSUser* pUser,
+    const CSSession* pSession,
+    AMNtlmDescriptor* descr,
+    const NQ_BYTE* pSessionKey,
+    NQ_BOOL isExtendedSecurity,
+    CMSdRid userRid,
+    CMSdRid groupRid
+    )
+{
+    TRCB();
+
+    TRCDUMP("Session key:", pUser->sessionKey, 16);
+
+    if (0 != (descr->flags & NTLMSSP_NEGOTIATE_EXTENDED_SECURITY) && descr->lmLen == 24 && descr->ntlmLen == 24) 
+    {
+        TRC("Generating extended security (ntlmv2) session key");
+        cmGenerateExtSecuritySessionKey(pUser->sessionKey, pSession->sessionNonce, pUser->sessionKey);                        
+    }
+
+    if (pSessionKey)  /* client supplied session key */
+    {
+        if (descr->flags & NTLMSSP_NEGOTIATE_KEY_EXCH) /* session key should be decrypted*/
+        {
+            TRC("Client supplied encrypted session key");
+            TRCDUMP("encrypted session key (sess setup auth mess)", pSessionKey, 16);
+            cmArcfourCrypt((NQ_BYTE*)pSessionKey, 16, pUser->sessionKey, sizeof(pUser->sessionKey));
+        }
+        syMemcpy(pUser->sessionKey, pSessionKey, sizeof(pUser->sessionKey));
+    }
+    TRCDUMP("Session key (final)", pUser->sessionKey, 16);
+    pUser->isExtendSecAuth = isExtendedSecurity;
+    pUser->authBySamlogon = TRUE;
+    descr->isNtlmAuthenticated = TRUE;
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    TRC("userRid:%d, groupRid:%d", userRid, groupRid);
+    pUser->token.rids[0] = userRid;
+    pUser->token.rids[1] = groupRid;
+    pUser->token.numRids = 2;
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+#ifdef UD_CS_MESSAGESIGNINGPOLICY
+    createSigningContextSmb(pUser, descr);
+#endif /* UD_CS_MESSAGESIGNINGPOLICY */
+    TRCE();
+}
+
+#endif /* defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH) */
+
+#ifdef CS_AUTH_ASYNCLOGON
+
+/*
+ *====================================================================
+ * PURPOSE: Queue pass-through logon to the logon thread
+ *--------------------------------------------------------------------
+ * PARAMS:  IN pointer to the user descriptor
+ *          IN pointer to the session descriptor
+ *          IN domain name
+ *          IN user name
+ *          IN own host name
+ *          IN pointer to the NTLM blob descriptor
+ *          IN client supplied session key or NULL
+ *          IN NETLOGON extended security flag
+ *          IN extended security flag for local authentication
+ *          IN computer account secret
+ *
+ * RETURNS: TRUE when queued, FALSE to authenticate synchronously
+ *
+ * NOTES:   the logon thread is started on the first logon
+ *====================================================================
+ */
+
+static NQ_BOOL
+queueLogon(
+    CSUser* pUser,
+    const CSSession* pSession,
+    const NQ_WCHAR* domain,
+    const NQ_WCHAR* userName,
+    const NQ_WCHAR* hostName,
+    const AMNtlmDescriptor* descr,
+    const NQ_BYTE* pSessionKey,
+    NQ_BOOL isExtendedSecurity,
+    NQ_BOOL isSsp,
+    const NQ_BYTE* secret
+    )
+{
+    PendingLogon* logon = NULL;     /* free logon slot */
+    NQ_COUNT i;                     /* just a counter */
+    NQ_BOOL result = FALSE;         /* return value */
+
+    TRCB();
+
+    syMutexTake(&staticData->logonGuard);
+
+    if (!staticData->logonThreadStarted)
+    {
+        if (!cmThreadCondSet(&staticData->logonWakeup))
+        {
+            TRCERR("Unable to create logon thread condition");
+            goto Exit;
+        }
+        if (!cmThreadCondSet(&staticData->logonDone))
+        {
+            cmThreadCondRelease(&staticData->logonWakeup);
+            TRCERR("Unable to create logon thread condition");
+            goto Exit;
+        }
+        staticData->logonStop = FALSE;
+        staticData->logonThreadStarted = TRUE;
+        syThreadStart(&staticData->logonThread, logonThreadBody, TRUE);
+    }
+
+    for (i = 0; i < MAX_PENDINGLOGONS; i++)
+    {
+        if (staticData->logons[i].state == LOGON_FREE)
+        {
+            logon = &staticData->logons[i];
+            break;
+        }
+    }
+    if (NULL == logon)
+    {
+        TRC("Too many logons in progress");
+        goto Exit;
+    }
+
+    logon->id = staticData->nextLogonId++;
+    if (0 == staticData->nextLogonId)
+        staticData->nextLogonId = 1;
+    logon->uid = pUser->uid;
+    logon->socket = csDispatchGetSocket();
+    logon->completion = NULL;
+    logon->context = NULL;
+    syWStrncpy(logon->domain, domain, CM_NQ_HOSTNAMESIZE);
+    logon->domain[CM_NQ_HOSTNAMESIZE] = cmWChar('\0');
+    syWStrncpy(logon->user, userName, CM_USERNAMELENGTH);
+    logon->user[CM_USERNAMELENGTH] = cmWChar('\0');
+    syWStrncpy(logon->host, hostName, CM_NQ_HOSTNAMESIZE);
+    logon->host[CM_NQ_HOSTNAMESIZE] = cmWChar('\0');
+    syMemcpy(logon->challenge, pSession->encryptionKey, sizeof(logon->challenge));
+    syMemcpy(logon->secret, secret, sizeof(logon->secret));
+    syMemcpy(logon->passwords, descr->pLm, descr->lmLen);
+    syMemcpy(logon->passwords + descr->lmLen, descr->pNtlm, descr->ntlmLen);
+    logon->descr = *descr;
+    logon->descr.pLm = logon->passwords;
+    logon->descr.pNtlm = logon->passwords + descr->lmLen;
+    logon->hasClientKey = NULL != pSessionKey;
+    if (logon->hasClientKey)
+        syMemcpy(logon->clientKey, pSessionKey, sizeof(logon->clientKey));
+    logon->isExtendedSecurity = isExtendedSecurity;
+    logon->isSsp = isSsp;
+    logon->succeeded = FALSE;
+    logon->state = LOGON_QUEUED;
+    pUser->pendingLogon = logon->id;
+    result = TRUE;
+
+Exit:
+    syMutexGive(&staticData->logonGuard);
+    if (result)
+        cmThreadCondSignal(&staticData->logonWakeup);
+    TRCE();
+    return result;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Wake the server loop up on a completed logon
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   sends a control command to the internal server socket, the
+ *          response is not awaited
+ *====================================================================
+ */
+
+static void
+wakeServer(
+    void
+    )
+{
+    NQ_UINT32 code = CS_CONTROL_LOGONDONE;      /* control command */
+    NQ_IPADDRESS localhost = CM_IPADDR_LOCAL;   /* server address */
+    SYSocketHandle sock;                        /* for internal communication */
+
+#ifdef UD_NQ_USETRANSPORTIPV6
+    if (udGetTransportPriority(NS_TRANSPORT_IPV6) && !udGetTransportPriority(NS_TRANSPORT_IPV4))
+    {
+        NQ_IPADDRESS localhostv6 = CM_IPADDR_LOCAL6;
+
+        localhost = localhostv6;
+        sock = syCreateSocket(FALSE, CM_IPADDR_IPV6);
+    }
+    else
+#endif /* UD_NQ_USETRANSPORTIPV6 */
+    {
+        sock = syCreateSocket(FALSE, CM_IPADDR_IPV4);
+    }
+    if (!syIsValidSocket(sock))
+    {
+        TRCERR("Unable to create internal communication socket");
+        return;
+    }
+    if (sySendToSocket(sock, (NQ_BYTE*)&code, sizeof(code), &localhost, syHton16(CS_CONTROL_PORT)) <= 0)
+    {
+        TRCERR("Logon completion not sent");
+    }
+    syCloseSocket(sock);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Logon thread body
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   performs NETLOGON for queued logons so that the server loop
+ *          does not wait for DC. Results are applied on the server
+ *          thread by csAuthCompleteLogons().
+ *====================================================================
+ */
+
+static void
+logonThreadBody(
+    void
+    )
+{
+    for (;;)
+    {
+        PendingLogon* logon = NULL;     /* next logon to perform */
+        NQ_BOOL stop;                   /* stop request */
+        NQ_COUNT i;                     /* just a counter */
+
+        syMutexTake(&staticData->logonGuard);
+        stop = staticData->logonStop;
+        for (i = 0; !stop && i < MAX_PENDINGLOGONS; i++)
+        {
+            if (staticData->logons[i].state == LOGON_QUEUED)
+            {
+                logon = &staticData->logons[i];
+                logon->state = LOGON_RUNNING;
+                break;
+            }
+        }
+        syMutexGive(&staticData->logonGuard);
+
+        if (stop)
+            break;
+        if (NULL == logon)
+        {
+            cmThreadCondWait(&staticData->logonWakeup, LOGON_WAITTIMEOUT);
+            continue;
+        }
+
+        TRC("Getting session key from DC (passthrough NetLogon)");
+        logon->succeeded = ccNetLogonW(logon->domain,
+                                       logon->user,
+                                       logon->host,
+                                       logon->challenge,
+                                       logon->descr.pLm,
+                                       logon->descr.lmLen,
+                                       logon->descr.pNtlm,
+                                       logon->descr.ntlmLen,
+                                       NULL,
+                                       logon->secret,
+                                       logon->isExtendedSecurity,
+                                       logon->sessionKey,
+                                       &logon->userRid,
+                                       &logon->groupRid);
+
+        syMutexTake(&staticData->logonGuard);
+        logon->state = LOGON_DONE;
+        syMutexGive(&staticData->logonGuard);
+        wakeServer();
+    }
+    cmThreadCondSignal(&staticData->logonDone);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Set completion for a pending pass-through logon
+ *--------------------------------------------------------------------
+ * PARAMS:  IN pointer to the user descriptor
+ *          IN completion callback
+ *          IN completion context
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   the context should be allocated by cmMemoryAllocate(). It
+ *          is released here when the user is gone before the logon
+ *          completes, otherwise the callback owns it.
+ *====================================================================
+ */
+
+void
+csAuthSetLogonCompletion(
+    CSUser* pUser,
+    CSAuthLogonCompletion completion,
+    void* context
+    )
+{
+    NQ_COUNT i;     /* just a counter */
+
+    TRCB();
+
+    syMutexTake(&staticData->logonGuard);
+    for (i = 0; i < MAX_PENDINGLOGONS; i++)
+    {
+        PendingLogon* logon = &staticData->logons[i];
+
+        if (logon->state != LOGON_FREE && logon->id == pUser->pendingLogon)
+        {
+            logon->completion = completion;
+            logon->context = context;
+            break;
+        }
+    }
+    syMutexGive(&staticData->logonGuard);
+
+    TRCE();
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Complete pass-through logons done by the logon thread
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   called on the server thread with the database locked. When
+ *          DC rejected the user local authentication is tried as in
+ *          synchronous logon.
+ *====================================================================
+ */
+
+void
+csAuthCompleteLogons(
+    void
+    )
+{
+    NSSocketHandle savedSocket = csDispatchGetSocket();     /* socket to restore */
+    NQ_COUNT i;                                             /* just a counter */
+
+    TRCB();
+
+    for (i = 0; i < MAX_PENDINGLOGONS; i++)
+    {
+        PendingLogon* logon = &staticData->logons[i];
+        CSUser* pUser;              /* user waiting for the logon */
+        CSSession* pSession = NULL; /* user session */
+        NQ_UINT32 status;           /* logon status */
+        NQ_INT state;               /* logon state */
+
+        syMutexTake(&staticData->logonGuard);
+        state = logon->state;
+        syMutexGive(&staticData->logonGuard);
+        if (state != LOGON_DONE)
+            continue;
+
+        csDispatchSetSocket(logon->socket);
+        pUser = csGetUserByUid(logon->uid);
+        if (NULL == pUser || pUser->pendingLogon != logon->id || NULL == (pSession = csGetSessionById(pUser->session)))
+        {
+            TRC("User released while logon was in progress");
+            cmMemoryFree(logon->context);
+        }
+        else
+        {
+            pUser->pendingLogon = 0;
+            if (logon->succeeded)
+            {
+                TRC("Passthrough (NetLogon) authentication succeeded");
+                syMemcpy(pUser->sessionKey, logon->sessionKey, sizeof(pUser->sessionKey));
+                acceptPassthrough(pUser, pSession, &logon->descr, logon->hasClientKey ? logon->clientKey : NULL, logon->isExtendedSecurity, logon->userRid, logon->groupRid);
+                status = NQ_SUCCESS;
+            }
+            else
+            {
+                TRCERR("Passthrough (NetLogon) authentication failed");
+                status = authenticateLocally(pUser, pSession, logon->domain, logon->user, &logon->descr, logon->hasClientKey ? logon->clientKey : NULL, logon->isSsp);
+                if (NQ_SUCCESS != status)
+                    pUser = NULL;   /* released */
+            }
+            if (NULL != logon->completion)
+                logon->completion(pUser, status, logon->context);
+        }
+
+        syMutexTake(&staticData->logonGuard);
+        logon->context = NULL;
+        logon->state = LOGON_FREE;
+        syMutexGive(&staticData->logonGuard);
+    }
+
+    csDispatchSetSocket(savedSocket);
+    TRCE();
+}
+
+#endif /* CS_AUTH_ASYNCLOGON */
+
 /*
  *====================================================================
  * PURPOSE: Perform local user authentication
@@ -819,8 +1488,11 @@ isLocalUserOk(
 #ifndef UD_CS_INCLUDESECURITYDESCRIPTORS
     NQ_UINT32 userRid[1];                   /* dummy for user RID */
 #endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
-    const NQ_WCHAR zeroWStr[] = {0,0};
     NQ_UINT16 enclen = 0;
+    CachedCredential* cred = NULL;          /* cached NTLMv2 keys or NULL */
+    NQ_COUNT first = 0;                     /* NTLMv2 key to try first */
+    NQ_COUNT variant;                       /* NTLMv2 key variant */
+    NQ_COUNT i;                             /* just a counter */
 #if (defined(UD_CS_INCLUDELOCALUSERMANAGEMENT) || defined(UD_CS_MESSAGESIGNINGPOLICY)) && defined(UD_CS_INCLUDEEXTENDEDSECURITY)
     CSSession* session;                     /* session structure */      
 #endif
@@ -861,6 +1533,10 @@ isLocalUserOk(
                 cmAnsiToUnicode(password.unicode, buffer);
                 cmMD4(password.ntlm, (NQ_BYTE*)password.unicode, (NQ_UINT)(cmWStrlen(password.unicode) * sizeof(NQ_WCHAR)));
             }
+#ifdef UD_CS_INCLUDEAUTHCACHE
+            if (NULL != (cred = findCredential(user, domain, password.ntlm)))
+                first = cred->matched;
+#endif /* UD_CS_INCLUDEAUTHCACHE */
 
             if (pBlob->ntlmLen > 0)
             {
@@ -899,82 +1575,46 @@ isLocalUserOk(
 
                 if (encryptLevel & CS_AUTH_ENCRYPTION_NTLMV2)
                 {
-					TRC("trying NTLMv2 (csd)");
-
-					/* check NTLMv2 passwords */
-					cmCreateV2Hash(domain, TRUE, user, password.ntlm, sizeof(password.ntlm), v2hash);
-					if (encryptNTLMv2(key, v2hash, pBlob->pNtlm, pBlob->ntlmLen, pUser))
-					{
-						pBlob->isNtlmAuthenticated = TRUE;
-						TRC(" NTLMv2 (csd) passwords match");
-						TRCE();
-						return TRUE;
-					}
-
-					TRC("trying NTLMv2");
-
-					/* check NTLMv2 passwords */
-					cmCreateV2Hash(domain, FALSE, user, password.ntlm, sizeof(password.ntlm), v2hash);
-					if (encryptNTLMv2(key, v2hash, pBlob->pNtlm, pBlob->ntlmLen, pUser))
+					/* check NTLMv2 passwords, the key that matched last time first */
+					for (i = 0; i < V2HASH_NUMVARIANTS; i++)
 					{
-						pBlob->isNtlmAuthenticated = TRUE;
-						TRC(" NTLMv2 passwords match");
-						TRCE();
-						return TRUE;
+						variant = (first + i) % V2HASH_NUMVARIANTS;
+						TRC("trying NTLMv2%s", v2hashNames[variant]);
+						getV2Hash(cred, domain, user, password.ntlm, variant, v2hash);
+						if (encryptNTLMv2(key, v2hash, pBlob->pNtlm, pBlob->ntlmLen, pUser))
+						{
+#ifdef UD_CS_INCLUDEAUTHCACHE
+							credentialVerified(cred, user, domain, password.ntlm, variant, v2hash);
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+							pBlob->isNtlmAuthenticated = TRUE;
+							TRC(" NTLMv2%s passwords match", v2hashNames[variant]);
+							TRCE();
+							return TRUE;
+						}
 					}
-
-					TRC("trying NTLMv2 - null domain");
-
-					/* check NTLMv2 passwords */
-					cmCreateV2Hash(zeroWStr, FALSE, user, password.ntlm, sizeof(password.ntlm), v2hash);
-					if (encryptNTLMv2(key, v2hash, pBlob->pNtlm, pBlob->ntlmLen, pUser))
-					{
-						pBlob->isNtlmAuthenticated = TRUE;
-						TRC(" NTLMv2 null domain passwords match");
-						TRCE();
-						return TRUE;
-                    }
                 }
             }
             if (pBlob->lmLen > 0)
             {
             	if (encryptLevel & CS_AUTH_ENCRYPTION_LMV2)
             	{
-					TRC("trying LMv2 (csd)");
-
-					/* check LMv2 passwords with case sensitive domain */
-					cmCreateV2Hash(domain, TRUE, user, password.ntlm, sizeof(password.ntlm), v2hash);
-					if (encryptLMv2(key, v2hash, pBlob->pLm, pUser))
+					/* check LMv2 passwords, the key that matched last time first */
+					for (i = 0; i < V2HASH_NUMVARIANTS; i++)
 					{
-						pBlob->isLmAuthenticated = TRUE;
-						TRC(" LMv2 (csd) passwords match");
-						TRCE();
-						return TRUE;
-					}
-
-					TRC("trying LMv2");
-
-					/* check LMv2 passwords */
-					cmCreateV2Hash(domain, FALSE, user, password.ntlm, sizeof(password.ntlm), v2hash);
-					if (encryptLMv2(key, v2hash, pBlob->pLm, pUser))
-					{
-						pBlob->isLmAuthenticated = TRUE;
-						TRC(" LMv2 passwords match");
-						TRCE();
-						return TRUE;
+						variant = (first + i) % V2HASH_NUMVARIANTS;
+						TRC("trying LMv2%s", v2hashNames[variant]);
+						getV2Hash(cred, domain, user, password.ntlm, variant, v2hash);
+						if (encryptLMv2(key, v2hash, pBlob->pLm, pUser))
+						{
+#ifdef UD_CS_INCLUDEAUTHCACHE
+							credentialVerified(cred, user, domain, password.ntlm, variant, v2hash);
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+							pBlob->isLmAuthenticated = TRUE;
+							TRC(" LMv2%s passwords match", v2hashNames[variant]);
+							TRCE();
+							return TRUE;
+						}
 					}
-
-					TRC("trying LMv2 - null domain");
-
-					/* check LMv2 passwords */
-					cmCreateV2Hash(zeroWStr, FALSE, user, password.ntlm, sizeof(password.ntlm), v2hash);
-					if (encryptLMv2(key, v2hash, pBlob->pLm, pUser))
-					{
-						pBlob->isLmAuthenticated = TRUE;
-						TRC(" LMv2 null domain passwords match");
-						TRCE();
-						return TRUE;
-                    }
             	}
             }
         }
@@ -1012,6 +1652,207 @@ isLocalUserOk(
     return FALSE;
 }
 
+/*
+ *====================================================================
+ * PURPOSE: Calculate or get cached NTLMv2 key
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT cached keys or NULL
+ *          IN domain name
+ *          IN user name
+ *          IN NT hash
+ *          IN key variant
+ *          OUT buffer for the key
+ *
+ * RETURNS: None
+ *
+ * NOTES:   a calculated key is saved in the cache entry
+ *====================================================================
+ */
+
+static void
+getV2Hash(
+    CachedCredential* cred,
+    const NQ_WCHAR* domain,
+    const NQ_WCHAR* user,
+    const NQ_BYTE* ntlm,
+    NQ_COUNT variant,
+    NQ_BYTE* v2hash
+    )
+{
+    const NQ_WCHAR zeroWStr[] = {0,0};
+
+    if (NULL != cred && cred->hasV2hash[variant])
+    {
+        syMemcpy(v2hash, cred->v2hash[variant], 16);
+        return;
+    }
+
+    switch (variant)
+    {
+        case V2HASH_CASESENSITIVEDOMAIN:
+            cmCreateV2Hash(domain, TRUE, user, ntlm, 16, v2hash);
+            break;
+        case V2HASH_DOMAIN:
+            cmCreateV2Hash(domain, FALSE, user, ntlm, 16, v2hash);
+            break;
+        case V2HASH_NULLDOMAIN:
+        default:
+            cmCreateV2Hash(zeroWStr, FALSE, user, ntlm, 16, v2hash);
+            break;
+    }
+
+    if (NULL != cred)
+    {
+        syMemcpy(cred->v2hash[variant], v2hash, 16);
+        cred->hasV2hash[variant] = TRUE;
+    }
+}
+
+#ifdef UD_CS_INCLUDEAUTHCACHE
+
+/*
+ *====================================================================
+ * PURPOSE: Find cached NTLMv2 keys of a local user
+ *--------------------------------------------------------------------
+ * PARAMS:  IN user name
+ *          IN domain name as sent by client
+ *          IN NT hash of the user password
+ *
+ * RETURNS: cache entry or NULL when there is none
+ *
+ * NOTES:   entries are matched by the MD5 fingerprint of the NT hash so
+ *          that a password change invalidates the entry. Nothing is
+ *          added here, see credentialVerified().
+ *====================================================================
+ */
+
+static CachedCredential*
+findCredential(
+    const NQ_WCHAR* user,
+    const NQ_WCHAR* domain,
+    const NQ_BYTE* ntlm
+    )
+{
+    NQ_UINT32 curTime = (NQ_UINT32)syGetTimeInSec();  /* current time */
+    NQ_BYTE hash[16];                                 /* copy of the NT hash */
+    NQ_BYTE fingerprint[16];                          /* NT hash fingerprint */
+    CachedCredential* result = NULL;                  /* return value */
+    NQ_COUNT i;                                       /* just a counter */
+
+    syMemcpy(hash, ntlm, sizeof(hash));
+    cmMD5(fingerprint, hash, sizeof(hash));
+
+    for (i = 0; i < UD_CS_AUTHCACHE_SIZE; i++)
+    {
+        CachedCredential* cred = &staticData->credentials[i];
+
+        if (0 != cred->expiration && (NQ_INT32)(cred->expiration - curTime) <= 0)
+            wipeCredential(cred);
+        if (0 == cred->expiration)
+            continue;
+        if (0 == cmWStricmp(cred->user, user) && 0 == cmWStrcmp(cred->domain, domain))
+        {
+            if (0 == syMemcmp(cred->fingerprint, fingerprint, sizeof(fingerprint)))
+            {
+                TRC("Using cached NTLMv2 keys");
+                result = cred;
+                break;
+            }
+            /* password has changed */
+            wipeCredential(cred);
+        }
+    }
+
+    syMemset(hash, 0, sizeof(hash));
+    syMemset(fingerprint, 0, sizeof(fingerprint));
+    return result;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Cache or refresh NTLMv2 keys after successful logon
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT cached keys or NULL
+ *          IN user name
+ *          IN domain name as sent by client
+ *          IN NT hash of the user password
+ *          IN key variant that matched
+ *          IN key that matched
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the matched variant is tried first next time. A new entry
+ *          replaces a free or the oldest entry, so failed logons never
+ *          evict verified users.
+ *====================================================================
+ */
+
+static void
+credentialVerified(
+    CachedCredential* cred,
+    const NQ_WCHAR* user,
+    const NQ_WCHAR* domain,
+    const NQ_BYTE* ntlm,
+    NQ_COUNT variant,
+    const NQ_BYTE* v2hash
+    )
+{
+    NQ_UINT32 curTime = (NQ_UINT32)syGetTimeInSec();  /* current time */
+    NQ_BYTE hash[16];                                 /* copy of the NT hash */
+    NQ_COUNT i;                                       /* just a counter */
+
+    if (NULL == cred)
+    {
+        if (cmWStrlen(user) > CM_USERNAMELENGTH || cmWStrlen(domain) > CM_NQ_HOSTNAMESIZE)
+            return;
+
+        for (i = 0; i < UD_CS_AUTHCACHE_SIZE; i++)
+        {
+            CachedCredential* pEntry = &staticData->credentials[i];
+
+            if (0 == pEntry->expiration)
+            {
+                cred = pEntry;
+                break;
+            }
+            if (NULL == cred || (NQ_INT32)(pEntry->expiration - cred->expiration) < 0)
+                cred = pEntry;
+        }
+        wipeCredential(cred);
+        cmWStrcpy(cred->user, user);
+        cmWStrcpy(cred->domain, domain);
+        syMemcpy(hash, ntlm, sizeof(hash));
+        cmMD5(cred->fingerprint, hash, sizeof(hash));
+        syMemset(hash, 0, sizeof(hash));
+    }
+    syMemcpy(cred->v2hash[variant], v2hash, 16);
+    cred->hasV2hash[variant] = TRUE;
+    cred->matched = variant;
+    cred->expiration = curTime + UD_CS_AUTHCACHE_TTL;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Wipe cached NTLMv2 keys
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT cache entry
+ *
+ * RETURNS: None
+ *
+ * NOTES:   keys are password equivalents and should not stay in memory
+ *====================================================================
+ */
+
+static void
+wipeCredential(
+    CachedCredential* cred
+    )
+{
+    syMemset(cred, 0, sizeof(*cred));
+}
+
+#endif /* UD_CS_INCLUDEAUTHCACHE */
+
 #if defined (UD_CS_INCLUDELOCALUSERMANAGEMENT) || defined(UD_CS_MESSAGESIGNINGPOLICY)
 
 /*
@@ -59,6 +59,33 @@ csAuthenticateUser(
     const NQ_BYTE** pOsName                         /* pointer to the OS name */
     );
 
+#if defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH) && defined(UD_NQ_INCLUDESMB2)
+/* SMB2 pass-through logons are performed by a separate thread */
+#define CS_AUTH_ASYNCLOGON
+
+/* Called on the server thread when a queued logon completes */
+typedef void
+(*CSAuthLogonCompletion)(
+    CSUser* pUser,                                  /* user descriptor or NULL when it was released */
+    NQ_UINT32 status,                               /* logon status */
+    void* context                                   /* completion context */
+    );
+
+/* Set completion for the logon queued by csAuthenticateUser() */
+void
+csAuthSetLogonCompletion(
+    CSUser* pUser,                                  /* user waiting for the logon */
+    CSAuthLogonCompletion completion,               /* completion callback */
+    void* context                                   /* allocated completion context */
+    );
+
+/* Complete logons done by the logon thread */
+void
+csAuthCompleteLogons(
+    void
+    );
+#endif /* defined(UD_CS_INCLUDEEXTENDEDSECURITY) && defined(UD_CS_INCLUDEPASSTHROUGH) && defined(UD_NQ_INCLUDESMB2) */
+
 #ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
 /* Fill user token  */
 NQ_BOOL                         /* TRUE if succeeded */
@@ -42,8 +42,25 @@ static NQ_BOOL breakSmb(CSFile *pFile);
 It uses functions from cmsmb2 to compose and send a break request. The request is composed in a static buffer.
  */
 static NQ_BOOL breakSmb2(CSFile *pFile);
+
+/*
+Lease break notification is composed the same way. It is sent once per lease key and carries the new lease state.
+ */
+static NQ_BOOL breakLease(CSFile *pFile, NQ_UINT32 newState, NQ_BOOL ackRequired);
+
+/* send a composed SMB2 break packet over the connection of the given file */
+static NQ_BOOL sendSmb2Break(CSFile *pFile, NQ_COUNT packetLen);
+
+/* the state a lease held by pHolder should be broken to when pParams opens the same name */
+static NQ_UINT32 leaseBreakTarget(const CSFile *pHolder, const CSCreateParams *pParams);
+
+/* TRUE when two handles share the same lease */
+#define sameLease(_f, _key) ((_f)->leaseGranted && 0 == syMemcmp((_f)->leaseKey, (_key), SMB2_LEASE_KEY_SIZE))
 #endif /* #ifdef UD_NQ_INCLUDESMB2 */
 
+/* mark the file being opened as create pending and save its response context */
+static void savePendingCreate(CSCreateParams * pParams);
+
 
 /*API function NQ_BOOL csBreakCheck(CSFile * pFile). This function enumerates CSFile structures of the same CSName and looks for  oplockGranted. 
 For the first TRUE value it calls either breakSmb() of breakSmb2() - see below. This function sets breakContext for the file whose oplock is being broken. 
@@ -86,26 +103,7 @@ csBreakCheck(
         if (pFilePrevGranted->oplockGranted)
         {
         	 /* mark breaking file as create pending and save header for late response */
-        	pFile->isCreatePending = TRUE;
-        	csDispatchSaveResponseContext(&pFile->breakContext);
-
-#ifdef UD_NQ_INCLUDESMB2
-			if (pFile->breakContext.isSmb2)
-			{
-				/* save command data */
-				pFile->breakContext.prot.smb2.commandData.oplockBreak.fid = pParams->file->fid;
-				pFile->breakContext.prot.smb2.commandData.oplockBreak.createAction = pParams->takenAction;
-				pFile->breakContext.prot.smb2.commandData.oplockBreak.fileInfo = pParams->fileInfo;
-				pFile->breakContext.prot.smb2.commandData.oplockBreak.context = pParams->context;
-			}
-			else
-#endif /* UD_NQ_INCLUDESMB2 */
-			{
-				/* save command data */
-				pFile->breakContext.prot.smb1.commandData.lockingAndX.fid = pParams->file->fid;
-				pFile->breakContext.prot.smb1.commandData.lockingAndX.createAction = pParams->takenAction;
-				pFile->breakContext.prot.smb1.commandData.lockingAndX.fileInfo = pParams->fileInfo;
-			}
+        	savePendingCreate(pParams);
 
 			if (pFilePrevGranted->isBreakingOpLock != TRUE)
 			{
@@ -127,11 +125,321 @@ csBreakCheck(
         	}
         }
     }
+
+#ifdef UD_NQ_INCLUDESMB2
+    /* break conflicting leases held under other keys, one notification per key */
+    for (pFilePrevGranted = pName->first; pFilePrevGranted != NULL; pFilePrevGranted = pFilePrevGranted->next)
+    {
+        NQ_UINT32 newState;     /* state to break to */
+        NQ_BOOL ackRequired;    /* client has to acknowledge */
+        CSFile *pSibling;       /* handle with the same lease key */
+
+        if (pFilePrevGranted == pFile || !pFilePrevGranted->leaseGranted)
+            continue;
+        if (pParams->context.leaseRequested && sameLease(pFilePrevGranted, pParams->context.leaseKey))
+            continue;
+        if (pFilePrevGranted->isBreakingLease)
+        {
+            /* wait for the break in progress */
+            savePendingCreate(pParams);
+            result = TRUE;
+            continue;
+        }
+        newState = leaseBreakTarget(pFilePrevGranted, pParams);
+        if (newState == pFilePrevGranted->leaseState)
+            continue;
+
+        /* handle and write caching must be flushed by the client before the open proceeds */
+        ackRequired = 0 != (pFilePrevGranted->leaseState & (SMB2_LEASE_WRITE_CACHING | SMB2_LEASE_HANDLE_CACHING));
+        if (!breakLease(pFilePrevGranted, newState, ackRequired))
+            ackRequired = FALSE;
+        for (pSibling = pName->first; pSibling != NULL; pSibling = pSibling->next)
+        {
+            if (!sameLease(pSibling, pFilePrevGranted->leaseKey))
+                continue;
+            pSibling->leaseEpoch++;
+            if (ackRequired)
+            {
+                pSibling->isBreakingLease = TRUE;
+                pSibling->leaseBreakTo = newState;
+            }
+            else
+            {
+                pSibling->leaseState = newState;
+            }
+        }
+        if (ackRequired)
+        {
+            savePendingCreate(pParams);
+            result = TRUE;
+        }
+    }
+#endif /* UD_NQ_INCLUDESMB2 */
     LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
     return result;
 }
 
 
+/*
+Save the create context on the file being opened so that csBreakComplete() can send its late response.
+*/
+static void savePendingCreate(CSCreateParams * pParams)
+{
+    CSFile *pFile = pParams->file;
+
+    pFile->isCreatePending = TRUE;
+    csDispatchSaveResponseContext(&pFile->breakContext);
+
+#ifdef UD_NQ_INCLUDESMB2
+    if (pFile->breakContext.isSmb2)
+    {
+        /* save command data */
+        pFile->breakContext.prot.smb2.commandData.oplockBreak.fid = pFile->fid;
+        pFile->breakContext.prot.smb2.commandData.oplockBreak.createAction = pParams->takenAction;
+        pFile->breakContext.prot.smb2.commandData.oplockBreak.fileInfo = pParams->fileInfo;
+        pFile->breakContext.prot.smb2.commandData.oplockBreak.context = pParams->context;
+    }
+    else
+#endif /* UD_NQ_INCLUDESMB2 */
+    {
+        /* save command data */
+        pFile->breakContext.prot.smb1.commandData.lockingAndX.fid = pFile->fid;
+        pFile->breakContext.prot.smb1.commandData.lockingAndX.createAction = pParams->takenAction;
+        pFile->breakContext.prot.smb1.commandData.lockingAndX.fileInfo = pParams->fileInfo;
+    }
+}
+
+#ifdef UD_NQ_INCLUDESMB2
+
+/*
+Lease state left to a holder once another handle opens the same name: write caching is always lost,
+handle caching is lost when the open failed on sharing and everything is lost when the open truncates.
+Read caching alone is the least a lease may hold.
+*/
+static NQ_UINT32 leaseBreakTarget(const CSFile *pHolder, const CSCreateParams *pParams)
+{
+    NQ_UINT32 state = pHolder->leaseState & (NQ_UINT32)~SMB2_LEASE_WRITE_CACHING;
+
+    if (pParams->sharingViolation)
+        state &= (NQ_UINT32)~SMB2_LEASE_HANDLE_CACHING;
+    if (pParams->disposition == SMB_NTCREATEANDX_FILESUPERSEDE ||
+        pParams->disposition == SMB_NTCREATEANDX_FILEOVERWRITE ||
+        pParams->disposition == SMB_NTCREATEANDX_FILEOVERWRITEIF)
+        state = SMB2_LEASE_NONE;
+    if (!(state & SMB2_LEASE_READ_CACHING))
+        state = SMB2_LEASE_NONE;
+    return state;
+}
+
+/*
+API function csBreakLeaseConflict(). Returns TRUE when opening this name requires breaking a lease held
+under another key. It is used to call csBreakCheck() for opens that did not request an oplock.
+*/
+NQ_BOOL csBreakLeaseConflict(const CSCreateParams * pParams)
+{
+    CSName *pName;
+    CSFile *pHolder;
+
+    if (NULL == pParams->file || (pName = csGetNameByNid(pParams->file->nid)) == NULL)
+        return FALSE;
+
+    for (pHolder = pName->first; pHolder != NULL; pHolder = pHolder->next)
+    {
+        if (pHolder == pParams->file || !pHolder->leaseGranted)
+            continue;
+        if (pParams->context.leaseRequested && sameLease(pHolder, pParams->context.leaseKey))
+            continue;
+        if (pHolder->isBreakingLease || leaseBreakTarget(pHolder, pParams) != pHolder->leaseState)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*
+API function csBreakGrantLease(). Grants the requested lease state to a newly opened file as far as other
+handles on the same name allow and writes the granted state back into the create context. Handles of the same
+lease key share one state, so the grant may upgrade them as well.
+*/
+NQ_UINT32 csBreakGrantLease(CSFile * pFile, CSCreateContext * pContext)
+{
+    CSName *pName;
+    CSFile *pOther;
+    NQ_UINT32 state = pContext->leaseState & (SMB2_LEASE_READ_CACHING | SMB2_LEASE_HANDLE_CACHING | SMB2_LEASE_WRITE_CACHING);
+    NQ_UINT16 epoch = pContext->leaseEpoch;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_TOOL, "fid: 0x%x, requested: 0x%x", pFile->fid, state);
+
+    if ((pName = csGetNameByNid(pFile->nid)) == NULL)
+    {
+        state = SMB2_LEASE_NONE;
+        goto Exit;
+    }
+
+    if (pFile->isDirectory)
+    {
+        CSSession *pSession = pFile->user != NULL ? csGetSessionById(pFile->user->session) : NULL;
+
+        /* directory leases come with SMB 3.0 and never cache writes */
+        if (NULL == pSession || pSession->dialect < CS_DIALECT_SMB30)
+            state = SMB2_LEASE_NONE;
+        state &= (NQ_UINT32)~SMB2_LEASE_WRITE_CACHING;
+    }
+
+    for (pOther = pName->first; pOther != NULL; pOther = pOther->next)
+    {
+        if (pOther == pFile)
+            continue;
+        if (sameLease(pOther, pContext->leaseKey))
+        {
+            /* the lease already exists: never downgrade it by another open */
+            state |= pOther->isBreakingLease ? pOther->leaseBreakTo : pOther->leaseState;
+            if (pOther->leaseEpoch > epoch)
+                epoch = pOther->leaseEpoch;
+            continue;
+        }
+        if (pOther->oplockGranted)
+        {
+            state = SMB2_LEASE_NONE;
+            break;
+        }
+        /* any other handle rules out exclusive caching */
+        state &= (NQ_UINT32)~SMB2_LEASE_WRITE_CACHING;
+        if (pOther->isBreakingLease && !(pOther->leaseBreakTo & SMB2_LEASE_HANDLE_CACHING))
+            state &= (NQ_UINT32)~SMB2_LEASE_HANDLE_CACHING;
+    }
+    if (!(state & SMB2_LEASE_READ_CACHING))
+        state = SMB2_LEASE_NONE;
+
+    epoch++;
+    pFile->leaseGranted = TRUE;
+    pFile->leaseV2 = pContext->leaseV2;
+    syMemcpy(pFile->leaseKey, pContext->leaseKey, SMB2_LEASE_KEY_SIZE);
+    for (pOther = pName->first; pOther != NULL; pOther = pOther->next)
+    {
+        if (sameLease(pOther, pContext->leaseKey))
+        {
+            pOther->leaseState = state;
+            pOther->leaseEpoch = epoch;
+        }
+    }
+
+Exit:
+    pContext->leaseState = state;
+    pContext->leaseEpoch = epoch;
+    LOGFE(CM_TRC_LEVEL_FUNC_TOOL, "granted: 0x%x", state);
+    return state;
+}
+
+/*
+API function csBreakLeaseClose(). Called before a file is closed. Returns TRUE when this handle was the last
+one its lease break was waiting for, so that pending creates may proceed.
+*/
+NQ_BOOL csBreakLeaseClose(CSFile * pFile)
+{
+    CSName *pName;
+    CSFile *pOther;
+
+    if (!pFile->leaseGranted || !pFile->isBreakingLease || (pName = csGetNameByNid(pFile->nid)) == NULL)
+        return FALSE;
+
+    for (pOther = pName->first; pOther != NULL; pOther = pOther->next)
+    {
+        if (pOther != pFile && sameLease(pOther, pFile->leaseKey))
+            return FALSE;
+    }
+    pFile->isBreakingLease = FALSE;
+    for (pOther = pName->first; pOther != NULL; pOther = pOther->next)
+    {
+        if (pOther->isBreakingLease)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+API function csBreakParentLease(). Called when the server changes the contents of a directory. Directory leases
+on the parent lose read caching at once, the client is not expected to acknowledge this break.
+*/
+void csBreakParentLease(const NQ_WCHAR * fileName)
+{
+    NQ_STATIC NQ_WCHAR parentName[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_FILENAMELEN)];
+    NQ_WCHAR * pSep;
+    CSName *pName;
+    CSFile *pHolder;
+
+    syWStrncpy(parentName, fileName, UD_FS_FILENAMELEN);
+    parentName[UD_FS_FILENAMELEN] = 0;
+    if ((pSep = syWStrrchr(parentName, cmWChar(SY_PATHSEPARATOR))) == NULL)
+        return;
+    *pSep = 0;
+    if ((pName = csGetNameByName(parentName)) == NULL)
+        return;
+
+    for (pHolder = pName->first; pHolder != NULL; pHolder = pHolder->next)
+    {
+        CSFile *pSibling;
+
+        if (!pHolder->leaseGranted || !pHolder->isDirectory || SMB2_LEASE_NONE == pHolder->leaseState || pHolder->isBreakingLease)
+            continue;
+        breakLease(pHolder, SMB2_LEASE_NONE, FALSE);
+        for (pSibling = pName->first; pSibling != NULL; pSibling = pSibling->next)
+        {
+            if (sameLease(pSibling, pHolder->leaseKey))
+            {
+                pSibling->leaseState = SMB2_LEASE_NONE;
+                pSibling->leaseEpoch++;
+            }
+        }
+    }
+}
+
+/*
+API function csBreakLeaseOnChange(). Called before the server writes, resizes, renames or deletes a file. Leases
+held under any key other than the one of the changing handle lose all caching, handle and write caching have to be
+flushed so the client is asked to acknowledge, but the change itself does not wait for it.
+*/
+void csBreakLeaseOnChange(const NQ_WCHAR * fileName, const CSFile * pFile)
+{
+    CSName *pName;
+    CSFile *pHolder;
+
+    pName = (pFile != NULL) ? csGetNameByNid(pFile->nid) : csGetNameByName(fileName);
+    if (pName == NULL)
+        return;
+
+    for (pHolder = pName->first; pHolder != NULL; pHolder = pHolder->next)
+    {
+        NQ_BOOL ackRequired;    /* client has to acknowledge */
+        CSFile *pSibling;       /* handle with the same lease key */
+
+        if (pHolder == pFile || !pHolder->leaseGranted || SMB2_LEASE_NONE == pHolder->leaseState || pHolder->isBreakingLease)
+            continue;
+        if (pFile != NULL && pFile->leaseGranted && sameLease(pHolder, pFile->leaseKey))
+            continue;
+
+        ackRequired = 0 != (pHolder->leaseState & (SMB2_LEASE_WRITE_CACHING | SMB2_LEASE_HANDLE_CACHING));
+        if (!breakLease(pHolder, SMB2_LEASE_NONE, ackRequired))
+            ackRequired = FALSE;
+        for (pSibling = pName->first; pSibling != NULL; pSibling = pSibling->next)
+        {
+            if (!sameLease(pSibling, pHolder->leaseKey))
+                continue;
+            pSibling->leaseEpoch++;
+            if (ackRequired)
+            {
+                pSibling->isBreakingLease = TRUE;
+                pSibling->leaseBreakTo = SMB2_LEASE_NONE;
+            }
+            else
+            {
+                pSibling->leaseState = SMB2_LEASE_NONE;
+            }
+        }
+    }
+}
+
+#endif /* UD_NQ_INCLUDESMB2 */
+
 /*
 Compose and send an NTCreateAndX/Create response according to the protocol. This is done in a static buffer using the pContext's pFile.
 */
@@ -275,7 +583,7 @@ static NQ_BOOL csSignalPendingCreate(CSLateResponseContext * pContext, void * pH
     if (pContext->isSmb2)
     {
         LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "compose and send Create response");
-        cmBufferWriterInit(&writer, pContext->commandData, sizeof(buffer));
+        cmBufferWriterInit(&writer, pContext->commandData, pContext->commandDataSize);
         pFile = csGetFileByFid(pContext->prot.smb2.commandData.oplockBreak.fid, (CSTid)pContext->prot.smb2.tid, (CSUid)sessionIdToUid(pContext->prot.smb2.sid.low));
         if (pFile == NULL)
         {
@@ -285,8 +593,19 @@ static NQ_BOOL csSignalPendingCreate(CSLateResponseContext * pContext, void * pH
         }
         if (NQ_SUCCESS == pContext->status)
         {
+            CSCreateContext *pCreateContext = &pContext->prot.smb2.commandData.oplockBreak.context;
+
             cmBufferWriteUint16(&writer, 89);    /* structure size */
-            cmBufferWriteByte(&writer, SMB2_OPLOCK_LEVEL_NONE);
+            if (pCreateContext->leaseRequested)
+            {
+                /* the lease is granted against the handles that survived the break */
+                csBreakGrantLease(pFile, pCreateContext);
+                cmBufferWriteByte(&writer, SMB2_OPLOCK_LEVEL_LEASE);
+            }
+            else
+            {
+                cmBufferWriteByte(&writer, SMB2_OPLOCK_LEVEL_NONE);
+            }
             cmBufferWriteByte(&writer, 0);       /* reserved */
             cmBufferWriteUint32(&writer, pContext->prot.smb2.commandData.oplockBreak.createAction);
             csWriteFileTimes(&pContext->prot.smb2.commandData.oplockBreak.fileInfo, csGetNameByNid(pFile->nid), cmBufferWriterGetPosition(&writer));
@@ -307,7 +626,7 @@ static NQ_BOOL csSignalPendingCreate(CSLateResponseContext * pContext, void * pH
 
                 cmBufferWriterBranch(&writer, &cwriter, 8);
                 cmBufferWriteUint32(&writer, SMB2_HEADERSIZE + (NQ_UINT32)cmBufferWriterGetDataCount(&writer) + 8); /* offset to contexts */ 
-                cmBufferWriteUint32(&writer, cs2PackCreateContexts(&cwriter, &pContext->prot.smb2.commandData.oplockBreak.context));  /* contexts length */
+                cmBufferWriteUint32(&writer, cs2PackCreateContexts(&cwriter, pCreateContext));  /* contexts length */
                 cmBufferWriterSync(&writer, &cwriter);
             }
         }
@@ -403,6 +722,95 @@ NQ_BOOL csBreakComplete(CSFile *pFile, void * pHeaderOut, NQ_UINT32 headerInFlag
 
 #define OPLOCK_BREAK_RESPONSE_LENGTH 24  /* length of the oplock break response not including header */
 
+/*====================================================================
+ * PURPOSE: Perform Lease Break Acknowledgment processing
+ *--------------------------------------------------------------------
+ * PARAMS:  IN in - pointer to the parsed SMB2 header descriptor
+ *          IN out - pointer to the response header structure
+ *          IN reader - request reader pointing to the reserved field
+ *          IN session - pointer to the user structure
+ *
+ * RETURNS: SMB_STATUS_NORESPONSE on success or error code in NT format
+ *
+ * NOTES:   the response is sent from here since completing the break
+ *          sends late Create responses through the response buffer
+ *====================================================================
+ */
+
+static NQ_UINT32 onLeaseBreakAck(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *reader, CSUser *session)
+{
+    NQ_BYTE leaseKey[SMB2_LEASE_KEY_SIZE];  /* acknowledged lease */
+    NQ_UINT32 state;                        /* state accepted by the client */
+    CSFile *pFile;                          /* file by lease key */
+    CSFile *pSibling;                       /* next file on the same name */
+    CSName *pName;                          /* file name descriptor */
+    NQ_BOOL isPending = FALSE;              /* other breaks are still waiting */
+    CMBufferWriter stWriter;                /* response writer */
+    NQ_UINT32 result = SMB_STATUS_NORESPONSE;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL);
+
+    cmBufferReaderSkip(reader, 2 + 4);      /* reserved, flags */
+    cmBufferReadBytes(reader, leaseKey, SMB2_LEASE_KEY_SIZE);
+    cmBufferReadUint32(reader, &state);
+
+    if ((pFile = cs2GetFileByLeaseKey(leaseKey, session->uid)) == NULL || (pName = csGetNameByNid(pFile->nid)) == NULL)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Unknown lease key");
+        result = SMB_STATUS_OBJECT_NAME_NOT_FOUND;
+        goto Exit;
+    }
+    if (!pFile->isBreakingLease)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "No lease break in progress");
+        result = SMB_STATUS_UNSUCCESSFUL;
+        goto Exit;
+    }
+    if (state & ~pFile->leaseBreakTo)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Acknowledged state 0x%x exceeds 0x%x", state, pFile->leaseBreakTo);
+        result = SMB_STATUS_REQUEST_NOT_ACCEPTED;
+        goto Exit;
+    }
+
+    for (pSibling = pName->first; pSibling != NULL; pSibling = pSibling->next)
+    {
+        if (sameLease(pSibling, leaseKey))
+        {
+            pSibling->leaseState = state;
+            pSibling->isBreakingLease = FALSE;
+        }
+        else if (pSibling->isBreakingLease)
+        {
+            isPending = TRUE;
+        }
+    }
+
+    /* compose Lease Break Response packet in a static buffer */
+    cmBufferWriterInit(&stWriter, buffer + sizeof(CMNetBiosSessionMessage), sizeof(buffer));
+    cmSmb2HeaderWrite(out, &stWriter);
+    cmBufferWriteUint16(&stWriter, SMB2_LEASE_ACK_SIZE);
+    cmBufferWriteUint16(&stWriter, 0);          /* reserved */
+    cmBufferWriteUint32(&stWriter, 0);          /* flags */
+    cmBufferWriteBytes(&stWriter, leaseKey, SMB2_LEASE_KEY_SIZE);
+    cmBufferWriteUint32(&stWriter, state);
+    cmBufferWriteZeroes(&stWriter, 8);          /* lease duration */
+    if (!sendSmb2Break(pFile, cmBufferWriterGetDataCount(&stWriter)))
+    {
+        result = SMB_STATUS_UNSUCCESSFUL;
+        goto Exit;
+    }
+
+    /* send Create responses once no other lease is breaking */
+    if (!isPending)
+        csBreakComplete(pFile, NULL, in->flags);
+    LOGMSG(CM_TRC_LEVEL_MESS_ALWAYS, "Lease break completed, state: 0x%x", state);
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+    return result;
+}
+
 /*====================================================================
  * PURPOSE: Perform Oplock Break Acknowledgment processing
  *--------------------------------------------------------------------
@@ -424,6 +832,7 @@ NQ_BOOL csBreakComplete(CSFile *pFile, void * pHeaderOut, NQ_UINT32 headerInFlag
 It should parse the request, call csBreakComplete() and compose the response.  */
 NQ_UINT32 csSmb2OnOplockBreak(CMSmb2Header *in, CMSmb2Header *out, CMBufferReader *reader, CSSession *connection, CSUser *session, CSTree *tree, CMBufferWriter *writer)
 {
+    NQ_UINT16 structureSize;
     NQ_BYTE oplockLevel;
     CSFid   fid;
     CSFile *pFile;
@@ -437,6 +846,17 @@ NQ_UINT32 csSmb2OnOplockBreak(CMSmb2Header *in, CMSmb2Header *out, CMBufferReade
 #endif /* UD_NQ_INCLUDESMBCAPTURE */
     
     LOGFB(CM_TRC_LEVEL_FUNC_PROTOCOL);
+
+    /* lease break acknowledgment is told apart by its structure size */
+    cmBufferReaderSetPosition(reader, cmBufferReaderGetPosition(reader) - 2);
+    cmBufferReadUint16(reader, &structureSize);
+    if (SMB2_LEASE_ACK_SIZE == structureSize)
+    {
+        NQ_UINT32 status = onLeaseBreakAck(in, out, reader, session);
+
+        LOGFE(CM_TRC_LEVEL_FUNC_PROTOCOL);
+        return status;
+    }
    
     /* read Oplock Break Acknowledgment request */
     cmBufferReadByte(reader, &oplockLevel);
@@ -536,14 +956,7 @@ static NQ_BOOL breakSmb2(CSFile *pFile)
 {
     CMSmb2Header header;
     CMBufferWriter writer;
-    NQ_COUNT packetLen;
-#ifdef UD_NQ_INCLUDESMB3
-    NQ_BYTE			encryptBuf[200 + SMB2_TRANSFORMHEADER_SIZE];
-    NQ_BOOL			doEncrypt = pFile->breakContext.doEncrypt;
-#endif
-#ifdef UD_NQ_INCLUDESMBCAPTURE
-    CSSocketDescriptor * sockDescr;
-#endif /* UD_NQ_INCLUDESMBCAPTURE */
+    NQ_BOOL result;
 
     LOGFB(CM_TRC_LEVEL_FUNC_TOOL, "Fid: %d", pFile->fid);
 
@@ -568,7 +981,59 @@ static NQ_BOOL breakSmb2(CSFile *pFile)
     cmBufferWriteZeroes(&writer, 14);         /* fid */
 
     /* send */
-	packetLen = cmBufferWriterGetDataCount(&writer);
+    result = sendSmb2Break(pFile, cmBufferWriterGetDataCount(&writer));
+    LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+    return result;
+}
+
+static NQ_BOOL breakLease(CSFile *pFile, NQ_UINT32 newState, NQ_BOOL ackRequired)
+{
+    CMSmb2Header header;
+    CMBufferWriter writer;
+    NQ_BOOL result;
+
+    LOGFB(CM_TRC_LEVEL_FUNC_TOOL, "Fid: %d, state: 0x%x -> 0x%x", pFile->fid, pFile->leaseState, newState);
+
+    /* compose Lease Break notification */
+    cmBufferWriterInit(&writer, buffer + sizeof(CMNetBiosSessionMessage), sizeof(buffer));
+
+    /* header - unsolicited response not bound to a session */
+    cmSmb2HeaderInitForResponse(&header, &writer, 0);
+    header.command = SMB2_CMD_OPLOCKBREAK;
+    header.credits = 0;
+    header.mid.low = 0xFFFFFFFF;
+    header.mid.high = 0xFFFFFFFF;
+    header.sid.low = 0;
+    header.sid.high = 0;
+    header.tid = 0;
+    cmSmb2HeaderWrite(&header, &writer);
+
+    /* data */
+    cmBufferWriteUint16(&writer, SMB2_LEASE_BREAK_SIZE);
+    cmBufferWriteUint16(&writer, pFile->leaseV2 ? (NQ_UINT16)(pFile->leaseEpoch + 1) : 0);  /* new epoch */
+    cmBufferWriteUint32(&writer, ackRequired ? SMB2_NOTIFY_BREAK_LEASE_FLAG_ACK_REQUIRED : 0);
+    cmBufferWriteBytes(&writer, pFile->leaseKey, SMB2_LEASE_KEY_SIZE);
+    cmBufferWriteUint32(&writer, pFile->leaseState);    /* current lease state */
+    cmBufferWriteUint32(&writer, newState);             /* new lease state */
+    cmBufferWriteZeroes(&writer, 12);                   /* break reason, access mask hint, share mask hint */
+
+    /* send */
+    result = sendSmb2Break(pFile, cmBufferWriterGetDataCount(&writer));
+    LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
+    return result;
+}
+
+static NQ_BOOL sendSmb2Break(CSFile *pFile, NQ_COUNT packetLen)
+{
+#ifdef UD_NQ_INCLUDESMB3
+    NQ_BYTE			encryptBuf[200 + SMB2_TRANSFORMHEADER_SIZE];
+    NQ_BOOL			doEncrypt = pFile->breakContext.doEncrypt;
+#endif
+#ifdef UD_NQ_INCLUDESMBCAPTURE
+    CSSocketDescriptor * sockDescr;
+#endif /* UD_NQ_INCLUDESMBCAPTURE */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_TOOL, "Fid: %d", pFile->fid);
 
 #ifdef UD_NQ_INCLUDESMBCAPTURE
     sockDescr = csGetClientSocketDescriptorBySocket(pFile->breakContext.socket);
@@ -36,6 +36,36 @@ csBreakComplete(
     NQ_UINT32 headerInFlags
     );
 
+#ifdef UD_NQ_INCLUDESMB2
+
+NQ_BOOL
+csBreakLeaseConflict(
+    const CSCreateParams * pParams
+    );
+
+NQ_UINT32
+csBreakGrantLease(
+    CSFile * pFile,
+    CSCreateContext * pContext
+    );
+
+NQ_BOOL
+csBreakLeaseClose(
+    CSFile * pFile
+    );
+
+void
+csBreakParentLease(
+    const NQ_WCHAR * fileName
+    );
+
+void
+csBreakLeaseOnChange(
+    const NQ_WCHAR * fileName,
+    const CSFile * pFile
+    );
+
+#endif /* UD_NQ_INCLUDESMB2 */
 
 #endif /* UD_NQ_INCLUDECIFSSERVER */
 #endif /* _CSBREAK_H_ */
@@ -313,6 +313,7 @@ NQ_STATUS csCtrlSetEncryptionMethods(NQ_UINT mask);
 #define CS_CONTROL_CHANGEMSGSIGN 12
 #endif /* UD_CS_MESSAGESIGNINGPOLICY*/
 #define CS_CONTROL_ENUMFILES 13
+#define CS_CONTROL_LOGONDONE 14     /* internal: pass-through logon completed */
 
 /* 
  * Protocol definition (IDL)
@@ -866,6 +866,27 @@ openFile(
     CSFile** pFile              /* OUT: file descriptor */
     );
 
+/* open file relative to its parent directory and allocate FID */
+
+static NQ_UINT32                          /* error code or 0 */
+openFileAt(
+    const NQ_WCHAR* pFileName,  /* file name */
+    CSTid tid,                  /* master tree ID */
+    NQ_UINT16 desiredAccess,    /* desired access as in the request */
+    NQ_UINT16* grantedAccess,   /* place for granted access */
+    CSFile** pFile,             /* OUT: file descriptor */
+    SYFile dir,                 /* parent directory handle or invalid handle */
+    const SYFileInformation* pFileInfo  /* file information when already known or NULL */
+    );
+
+/* common Create processing with the parent directory handle */
+
+static NQ_UINT32                          /* error code or 0 */
+createCommonProcessing(
+    CSCreateParams * params,    /* IN/OUT parameter structure */
+    SYFile* pDir                /* OUT parent directory handle */
+    );
+
 /* create file or directory and allocate FID */
 
 static NQ_UINT32                   /* error code or 0 */
@@ -2396,6 +2417,7 @@ csComCreateDirectory(
     );
     eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+    csInvalidateNameCache(pFileName);
     if (syCreateDirectory(pFileName) == NQ_FAIL)
     {
         error = csErrorGetLast();
@@ -2692,12 +2714,16 @@ csComNtCreateAndX(
     params.pid = pid;
     params.uid = uid;
 	params.context.flags = 0;
+#ifdef UD_NQ_INCLUDESMB2
+    params.context.leaseRequested = FALSE;
+#endif /* UD_NQ_INCLUDESMB2 */
     params.unicodeRequired = unicodeRequired;
     params.fileAttributes = cmLtoh32(cmGetSUint32(createRequest->fileAttributes));
 
     /* call common processing */
 
     returnValue = csCreateCommonProcessing(&params);
+    params.sharingViolation = (SMB_STATUS_SHARING_VIOLATION == returnValue);
     if (0 != returnValue && SMB_STATUS_SHARING_VIOLATION != returnValue)
     {
         TRCE();
@@ -2757,7 +2783,11 @@ csComNtCreateAndX(
     }
 
     TRC("oplockLevel requested: %d", oplockLevel);
-    if ((oplockLevel != SMB_NTCREATEANDX_REQUESTOPLOCKNONE) && csBreakCheck(&params) == TRUE)
+    if ((oplockLevel != SMB_NTCREATEANDX_REQUESTOPLOCKNONE
+#ifdef UD_NQ_INCLUDESMB2
+         || csBreakLeaseConflict(&params)
+#endif /* UD_NQ_INCLUDESMB2 */
+        ) && csBreakCheck(&params) == TRUE)
     {
         TRC("Breaking oplock was sent");
         TRCE();
@@ -2886,6 +2916,33 @@ csComNtCreateAndX(
     return 0;
 }
 
+/*====================================================================
+ * PURPOSE: Read information of a file opened by Create
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT pointer to the parameter structure
+ *
+ * RETURNS: NQ_SUCCESS or NQ_FAIL
+ *
+ * NOTES:   uses the file handle when there is one so that the path is
+ *          not resolved again
+ *====================================================================
+ */
+
+static NQ_STATUS
+readOpenedFileInformation(
+    CSCreateParams * params
+    )
+{
+    if (syIsValidFile(params->file->file))
+        return csGetFileInformation(params->file, params->fileName, &params->fileInfo);
+
+    return csGetFileInformationByName(params->share, params->fileName, &params->fileInfo
+#ifdef UD_NQ_INCLUDEEVENTLOG
+        ,params->user
+#endif /* UD_NQ_INCLUDEEVENTLOG */
+        );
+}
+
 /*====================================================================
  * PURPOSE: Perform common Create processing
  *--------------------------------------------------------------------
@@ -2903,6 +2960,36 @@ NQ_UINT32
 csCreateCommonProcessing(
     CSCreateParams * params
     )
+{
+    NQ_UINT32 returnValue;          /* error code in NT format or 0 for no error */
+    SYFile dir;                     /* parent directory handle */
+
+    returnValue = createCommonProcessing(params, &dir);
+    if (syIsValidFile(dir))
+        syCloseFile(dir);
+    return returnValue;
+}
+
+/*====================================================================
+ * PURPOSE: Perform common Create processing relative to the parent directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT pointer to the parameter structure
+ *          OUT parent directory handle - invalid when not opened
+ *
+ * RETURNS: 0 on success or error code in NT format
+ *
+ * NOTES:   The parent directory is opened once while checking the path. The
+ *          file is then looked up and opened relative to it and the
+ *          information read on the lookup is reused for access evaluation
+ *          and for the response.
+ *====================================================================
+ */
+
+static NQ_UINT32
+createCommonProcessing(
+    CSCreateParams * params,
+    SYFile* pDir
+    )
 {
     NQ_UINT32 returnValue;          /* error code in NT format or 0 for no error */
     CMCifsStatus error;             /* for composing DOS-style error */
@@ -2939,11 +3026,12 @@ csCreateCommonProcessing(
 		);
 	eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEXTENDEDEVENTLOG */
-    if (!csCheckPath(
+    if (!csCheckPathAt(
             params->share, 
             params->fileName, 
             (NQ_UINT)syWStrlen(params->share->map), 
-            params->user->preservesCase
+            params->user->preservesCase,
+            pDir
             )
        )
     {
@@ -3014,7 +3102,7 @@ csCreateCommonProcessing(
     	eventInfo.before = FALSE;
     }
 #endif
-    fileExists = csCheckFile(params->share, params->fileName, params->user->preservesCase);
+    fileExists = csCheckFileAt(params->share, params->fileName, params->user->preservesCase, *pDir, &params->fileInfo);
 #ifdef UD_NQ_INCLUDEEXTENDEDEVENTLOG
     {
     	udEventLog(
@@ -3066,30 +3154,7 @@ csCreateCommonProcessing(
                 return csErrorReturn(SMB_STATUS_OBJECT_NAME_COLLISION, DOS_ERRfileexists);
             }
     
-            /* define if the required file is a directory */
-    
-            if ( NQ_SUCCESS != csGetFileInformationByName(params->share, params->fileName, &params->fileInfo
-#ifdef UD_NQ_INCLUDEEVENTLOG
-					,params->user
-#endif /* UD_NQ_INCLUDEEVENTLOG */
-                	))
-            {
-                error = csErrorGetLast();
-#ifdef UD_NQ_INCLUDEEVENTLOG
-                udEventLog(
-                    UD_LOG_MODULE_CS,
-                    UD_LOG_CLASS_FILE,
-                    UD_LOG_FILE_OPEN,
-                    params->user->name,
-                    params->user->ip,
-                    error,
-                    (const NQ_BYTE*)&eventInfo
-                );
-#endif /* UD_NQ_INCLUDEEVENTLOG */
-                TRCERR("Unable to read file information");
-                TRCE();
-                return error;
-            }
+            /* define if the required file is a directory (the information was read on lookup) */
     
             directoryFound = params->fileInfo.attributes & SMB_ATTR_DIRECTORY;
             
@@ -3190,12 +3255,14 @@ csCreateCommonProcessing(
                 return csErrorReturn(SMB_STATUS_ACCESS_DENIED, DOS_ERRnoaccess);          
             }
     
-            if ((returnValue = openFile(
+            if ((returnValue = openFileAt(
                     params->fileName, 
                     params->tid, 
                     (NQ_UINT16)params->desiredAccess, 
                     NULL, 
-                    &params->file
+                    &params->file,
+                    *pDir,
+                    &params->fileInfo
                     )
                  ) != 0)
             {
@@ -3234,7 +3301,9 @@ csCreateCommonProcessing(
 					);
 					eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
-					params->file->file = syOpenFileForWrite(params->fileName , FALSE ,FALSE ,FALSE);
+					params->file->file = syIsValidFile(*pDir) ?
+					    syOpenFileAt(*pDir, syWStrrchr(params->fileName, cmWChar(SY_PATHSEPARATOR)) + 1, SY_OPENFILE_WRITE, FALSE, FALSE, FALSE) :
+					    syOpenFileForWrite(params->fileName , FALSE ,FALSE ,FALSE);
             		if (!syIsValidFile(params->file->file))
             		{
             			TRCERR("Failed to open file for write");
@@ -3355,12 +3424,14 @@ csCreateCommonProcessing(
 					{
 						csReleaseFile(params->file->fid);
 					}
-					if ((returnValue = openFile(
+					if ((returnValue = openFileAt(
 					                    params->fileName,
 					                    params->tid,
 					                    (NQ_UINT16)params->desiredAccess,
 					                    NULL,
-					                    &params->file
+					                    &params->file,
+					                    *pDir,
+					                    &params->fileInfo
 					                    )
 					                 ) != 0)
 					{
@@ -3451,17 +3522,17 @@ csCreateCommonProcessing(
         params->file->pid = params->pid;
         params->file->options = params->createOptions;
     
-        /* update file attributes */
+        /* update file attributes - an existing file opened for read keeps the
+           information read on lookup */
     
-        if (csGetFileInformationByName(
-            params->share, 
-            params->fileName, 
-            &params->fileInfo
-#ifdef UD_NQ_INCLUDEEVENTLOG
-			,params->user
-#endif /* UD_NQ_INCLUDEEVENTLOG */
-             )
-             != NQ_SUCCESS)
+        if (   (params->takenAction != SMB_OPENANDX_WASOPENED
+                || (   (params->desiredAccess & SMB_ACCESS_A) != SMB_ACCESS_A_NONE
+                    && (params->desiredAccess & SMB_ACCESS_A) != SMB_ACCESS_A_READ
+                    && (params->desiredAccess & SMB_ACCESS_A) != SMB_ACCESS_A_EXECUTE
+                   )
+               )
+            && readOpenedFileInformation(params) != NQ_SUCCESS
+           )
         {
             error = csErrorGetLast();
             csReleaseFile(params->file->fid);      /* also closes the file */
@@ -3494,11 +3565,7 @@ csCreateCommonProcessing(
                 return csErrorReturn(SMB_STATUS_ACCESS_DENIED, DOS_ERRnoaccess);
             }
             
-            if (NQ_SUCCESS != csGetFileInformationByName(params->share, params->fileName, &params->fileInfo
-#ifdef UD_NQ_INCLUDEEVENTLOG
-					,params->user
-#endif /* UD_NQ_INCLUDEEVENTLOG */
-                	))
+            if (NQ_SUCCESS != readOpenedFileInformation(params))
             {
                 error = csErrorGetLast();
                 csReleaseFile(params->file->fid);      /* also closes the file */
@@ -4801,6 +4868,7 @@ csTransaction2CreateDirectory(
 	);
 	eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+    csInvalidateNameCache(pFileName);
     if (syCreateDirectory(pFileName) == NQ_FAIL)
     {
         error = csErrorGetLast();
@@ -4864,6 +4932,38 @@ openFile(
     NQ_UINT16* grantedAccess,
     CSFile** pFile
     )
+{
+    return openFileAt(pFileName, tid, desiredAccess, grantedAccess, pFile, syInvalidFile(), NULL);
+}
+
+/*====================================================================
+ * PURPOSE: Open a file relative to its parent directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN file name
+ *          IN tree ID
+ *          IN desired access as in the request
+ *          OUT pointer to the resulting granted access (may be NULL)
+ *          OUT pointer to place a new file descriptor
+ *          IN parent directory handle or invalid handle to open by full path
+ *          IN file information read on lookup or NULL to read it here
+ *
+ * RETURNS: 0 on success or error code in NT format
+ *
+ * NOTES:   allocates file descriptor and opens the file
+ *          on error - file descriptor is deallocated
+ *====================================================================
+ */
+
+static NQ_UINT32
+openFileAt(
+    const NQ_WCHAR* pFileName,
+    CSTid tid,
+    NQ_UINT16 desiredAccess,
+    NQ_UINT16* grantedAccess,
+    CSFile** pFile,
+    SYFile dir,
+    const SYFileInformation* pFileInfo
+    )
 {
     NQ_BOOL denyRead;       /* deny flag*/
     NQ_BOOL denyWrite;      /* deny flag */
@@ -4876,6 +4976,7 @@ openFile(
     NQ_BOOL readOnly;               /* whether file is read-only */
     SYFileInformation fileInfo;     /* for querying file information */
     NQ_BOOL isDirectory = FALSE;
+    const NQ_WCHAR* pBaseName = NULL;   /* file name relative to the parent directory */
 #ifdef UD_NQ_INCLUDEEVENTLOG
     const CSUser* pUser;           /* user structure pointer */
     UDFileAccessEvent eventInfo;   /* share event information */
@@ -4941,7 +5042,12 @@ openFile(
             return csErrorReturn(SMB_STATUS_TOO_MANY_OPENED_FILES, DOS_ERRnofids);
         }
     }
-    if (NQ_SUCCESS != csGetFileInformationByName(pTree->share, pName->name, &fileInfo
+    if (pFileInfo != NULL)
+    {
+        readOnly = pFileInfo->attributes & SMB_ATTR_READONLY;
+        isDirectory = pFileInfo->attributes & SMB_ATTR_DIRECTORY;
+    }
+    else if (NQ_SUCCESS != csGetFileInformationByName(pTree->share, pName->name, &fileInfo
 #ifdef UD_NQ_INCLUDEEVENTLOG
 			,pUser
 #endif /* UD_NQ_INCLUDEEVENTLOG */
@@ -4958,6 +5064,9 @@ openFile(
         isDirectory = fileInfo.attributes & SMB_ATTR_DIRECTORY;
     }
 
+    if (syIsValidFile(dir))
+        pBaseName = syWStrrchr(pFileName, cmWChar(SY_PATHSEPARATOR)) + 1;
+
     if ((tempGrantedAccess = isAccessAllowed(pName, &desiredAccess, pTree->uid, readOnly)) > 0xFFFF)
     {
         TRCERR("Access is not allowed");
@@ -5065,25 +5174,35 @@ openFile(
 #ifdef SY_FS_SEPARATEINFOMODE
 			(*pFile)->file = syOpenFileForInfo(pFileName, denyRead, denyWrite, denyExecute);
 #else
-			(*pFile)->file = syOpenFileForRead(pFileName, denyRead, denyWrite, denyExecute);
+			(*pFile)->file = pBaseName != NULL ?
+                syOpenFileAt(dir, pBaseName, SY_OPENFILE_READ, denyRead, denyWrite, denyExecute) :
+                syOpenFileForRead(pFileName, denyRead, denyWrite, denyExecute);
 #endif /* SY_FS_SEPARATEINFOMODE */
 			break;
 		case SMB_ACCESS_A_READ:
 			TRC("SMB_ACCESS_A_READ");
-            (*pFile)->file = syOpenFileForRead(pFileName, denyRead, denyWrite, denyExecute);
+            (*pFile)->file = pBaseName != NULL ?
+                syOpenFileAt(dir, pBaseName, SY_OPENFILE_READ, denyRead, denyWrite, denyExecute) :
+                syOpenFileForRead(pFileName, denyRead, denyWrite, denyExecute);
             break;
         case SMB_ACCESS_A_WRITE:
             TRC("SMB_ACCESS_A_WRITE");
-            (*pFile)->file = syOpenFileForWrite(pFileName, denyRead, denyWrite, denyExecute);
+            (*pFile)->file = pBaseName != NULL ?
+                syOpenFileAt(dir, pBaseName, SY_OPENFILE_WRITE, denyRead, denyWrite, denyExecute) :
+                syOpenFileForWrite(pFileName, denyRead, denyWrite, denyExecute);
             break;
         case SMB_ACCESS_A_FCB:
         case SMB_ACCESS_A_READWRITE:
             TRC("SMB_ACCESS_A_READWRITE");
-            (*pFile)->file = syOpenFileForReadWrite(pFileName, denyRead, denyWrite, denyExecute);
+            (*pFile)->file = pBaseName != NULL ?
+                syOpenFileAt(dir, pBaseName, SY_OPENFILE_READWRITE, denyRead, denyWrite, denyExecute) :
+                syOpenFileForReadWrite(pFileName, denyRead, denyWrite, denyExecute);
             break;
         case SMB_ACCESS_A_EXECUTE:
             TRC("SMB_ACCESS_A_EXECUTE");
-            (*pFile)->file = syOpenFileForRead(pFileName, denyRead, denyWrite, denyExecute);
+            (*pFile)->file = pBaseName != NULL ?
+                syOpenFileAt(dir, pBaseName, SY_OPENFILE_READ, denyRead, denyWrite, denyExecute) :
+                syOpenFileForRead(pFileName, denyRead, denyWrite, denyExecute);
             break;
         default:
 #ifdef UD_NQ_INCLUDEEVENTLOG
@@ -5356,6 +5475,7 @@ createFile(
 		);
 		eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+        csInvalidateNameCache(pFileName);
         if (syCreateDirectory(pFileName) == NQ_FAIL)
         {
             error = csErrorGetLast();
@@ -5460,6 +5580,7 @@ createFile(
 		);
 		eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+        csInvalidateNameCache(pFileName);
         (*pFile)->file = syCreateFile(pFileName, denyRead, denyExecute, denyWrite);
         if (!syIsValidFile((*pFile)->file))
         {
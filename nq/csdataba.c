@@ -71,6 +71,31 @@
    each slot has a "self" index. A value of -1 means an empty slot.
  */
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+/*
+   Durable handle journal
+   ----------------------
+
+   Durable v2 opens are appended to a journal file as fixed size records: one record when
+   the open is granted and another one when it is closed. On start the journal is replayed
+   into the durable table so that DH2C reconnects find the open by its create GUID and reopen
+   the file. The journal is rewritten from the table on start and whenever it grows twice
+   the table size, so it never holds more than three table sizes of records. Records are
+   collected in memory and written together when the batch is full or has waited long enough,
+   so that a durable open does not wait for the disk.
+*/
+
+#define JOURNAL_SIGNATURE   0x4A44514E  /* "NQDJ" */
+#define JOURNAL_VERSION     2
+#define JOURNAL_HEADERSIZE  8           /* signature, version */
+#define JOURNAL_RECORDSIZE  612         /* see journalWrite() */
+#define JOURNAL_NAMELENGTH  256         /* user name characters kept in a record */
+#define JOURNAL_SIDSUBS     6           /* domain SID sub-authorities kept in a record */
+#define JOURNAL_ADD         1           /* record type: open granted */
+#define JOURNAL_REMOVE      2           /* record type: open closed */
+#define JOURNAL_BATCHSIZE   16          /* records collected before they are written */
+#define JOURNAL_FLUSHTIME   1           /* seconds a collected record may wait to be written */
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 
 typedef struct
 {
@@ -101,6 +126,15 @@ typedef struct
     NQ_BOOL signingEnabled;                      /* whether message signing is enabled */
     NQ_BOOL signingRequired;                     /* whether message signing is required */
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */   
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+    CSDurableRecord durables[UD_CS_DURABLEJOURNAL_SIZE]; /* durable opens recorded in the journal */
+    SYFile journal;                              /* durable handle journal opened for append */
+    NQ_COUNT journalRecords;                     /* records in the journal file, including pending ones */
+    NQ_CHAR journalName[UD_FS_MAXPATHLEN];       /* journal file path */
+    NQ_BYTE journalBuffer[JOURNAL_BATCHSIZE * JOURNAL_RECORDSIZE]; /* records not written yet */
+    NQ_COUNT journalPending;                     /* records in the buffer */
+    NQ_UINT32 journalDue;                        /* time to write the pending records */
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 }
 StaticData;
 
@@ -142,6 +176,14 @@ static void (*resumeServer)();
 
 /* converting FIDs to indexes and vice versa */
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+static void journalReplay(void);
+static void journalCompact(void);
+static void journalAppend(const CSDurableRecord * pRecord, NQ_BYTE type);
+static void journalFlush(void);
+static void journalRelease(const NQ_BYTE * guid);
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #define fid2Index(_fid)    ((_fid) == CS_ILLEGALID? CS_ILLEGALID:(_fid) - 0x4001)
 #define index2Fid(_idx)    ((_idx) == CS_ILLEGALID? CS_ILLEGALID:(_idx) + 0x4001)
 
@@ -155,6 +197,9 @@ static void (*resumeServer)();
 #define Tid2Index(_uid)    ((_uid) == CS_ILLEGALID? CS_ILLEGALID:(_uid) - 10)
 #define Index2Tid(_idx)    ((_idx) == CS_ILLEGALID? CS_ILLEGALID:(_idx) + 10)
 
+/* check that an object of a session and a user may be used over the current socket */
+static NQ_BOOL isOnCurrentSocket(CSSessionKey session, CSUid uid);
+
 
 /*====================================================================
  * PURPOSE: Add share to the database
@@ -304,6 +349,7 @@ addShare(
 #endif /* UD_NQ_INCLUDESMB3 */
             if (staticData->shares[i].isHidden)
                 staticData->adminShare = &staticData->shares[i];
+            staticData->shares[i].sdVersion++;
 #ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
             if (staticData->shares[i].isHidden)
             {
@@ -658,6 +704,9 @@ csInitDatabase(
         staticData->files[i].fid = CS_ILLEGALID;
         syInvalidateFile(&staticData->files[i].file);
         syInvalidateDirectory(&staticData->files[i].directory);
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+        staticData->files[i].durableFlags = 0;
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
     }
 
     for (i=0; i < UD_FS_NUMSERVERSEARCHES; i++)
@@ -693,6 +742,11 @@ csInitDatabase(
     staticData->signingRequired = UD_CS_MESSAGESIGNINGPOLICY == 2;
 #endif
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+    /* durable opens that survived the previous run */
+    journalReplay();
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
     TRCE();
     return NQ_SUCCESS;
 }
@@ -713,6 +767,13 @@ csCloseDatabase(
     void
     )
 {
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+    /* the journal is kept for the next run */
+    journalFlush();
+    if (syIsValidFile(staticData->journal))
+        syCloseFile(staticData->journal);
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
     /* delete mutex */
     syMutexDelete(&staticData->dbGuard);
 
@@ -761,6 +822,13 @@ csGetNewSession(
             s->signingOn = FALSE;
             s->sequenceNum = s->sequenceNumRes = 0;
 #endif
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+            s->bindingUid = (CSUid)CS_ILLEGALID;
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+            s->compressionAlgorithm = SMB2_COMPRESSION_NONE;
+            s->compressionChained = FALSE;
+#endif /* UD_NQ_INCLUDECOMPRESSION */
             return s;
         }
     }
@@ -959,6 +1027,24 @@ csReleaseSessions(
                 {
                     csReleaseUser((CSUid)Index2Uid(user) , expected);
                 }
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+                else if (staticData->users[user].uid != (CSUid)CS_ILLEGALID)
+                {
+                    NQ_COUNT i;   /* index in channels */
+
+                    /* unbind this session from users created on other sessions */
+                    for (i = 0; i < UD_CS_MAXCHANNELS; i++)
+                    {
+                        CSChannel * pChannel = &staticData->users[user].channels[i];
+
+                        if (pChannel->isUsed && pChannel->session == staticData->sessions[session].key)
+                        {
+                            LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "Channel unbound from uid %d", staticData->users[user].uid);
+                            pChannel->isUsed = FALSE;
+                        }
+                    }
+                }
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
             }
         #ifdef UD_NQ_INCLUDEEVENTLOG
             udEventLog(UD_LOG_MODULE_CS,
@@ -1016,6 +1102,7 @@ csGetNewUser(
             u->isAnonymous = FALSE;
             u->token.isAnon = FALSE;
             u->isDomainUser = FALSE;
+            u->domain[0] = cmWChar('\0');
             u->isGuest = FALSE;
             u->rid = CS_ILLEGALID;
 #ifdef UD_CS_MESSAGESIGNINGPOLICY
@@ -1024,10 +1111,14 @@ csGetNewUser(
 #endif
 #ifdef UD_CS_INCLUDEPASSTHROUGH
             u->authBySamlogon = FALSE;
+            u->pendingLogon = 0;
 #endif     
 #ifdef UD_CS_INCLUDEEXTENDEDSECURITY
             u->isExtendSecAuth = FALSE;   
 #endif
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+            syMemset(u->channels, 0, sizeof(u->channels));
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
             staticData->numUsers++;
             TRCE();
             return u;
@@ -1050,6 +1141,9 @@ csGetNewUser(
             expUser->session = session->key;
             expUser->ip = &session->ip;
             expUser->createdTime = (NQ_UINT32)syGetTimeInSec();
+#ifdef UD_CS_INCLUDEPASSTHROUGH
+            expUser->pendingLogon = 0;
+#endif
             staticData->numUsers++;
             return expUser;
         }
@@ -1142,6 +1236,53 @@ csGetUserByNameAndSession(
     return NULL;
 }
 
+/*====================================================================
+ * PURPOSE: check that an object may be used over the current socket
+ *--------------------------------------------------------------------
+ * PARAMS:  IN session the object was created on
+ *          IN user the object belongs to
+ *
+ * RETURNS: TRUE when the current socket is the session socket or
+ *          a channel bound to the user
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static NQ_BOOL
+isOnCurrentSocket(
+    CSSessionKey session,
+    CSUid uid
+    )
+{
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    NQ_COUNT i;     /* index in channels */
+    NQ_INT idx;     /* index in users */
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+
+    if (staticData->sessions[session].socket == csDispatchGetSocket())
+    {
+        return TRUE;
+    }
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    idx = Uid2Index(uid);
+    if (idx < 0 || idx >= UD_FS_NUMSERVERUSERS || staticData->users[idx].uid != uid)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < UD_CS_MAXCHANNELS; i++)
+    {
+        const CSChannel * pChannel = &staticData->users[idx].channels[i];
+
+        if (pChannel->isUsed && staticData->sessions[pChannel->session].socket == csDispatchGetSocket())
+        {
+            return TRUE;
+        }
+    }
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+    return FALSE;
+}
+
 /*====================================================================
  * PURPOSE: find a user providing UID
  *--------------------------------------------------------------------
@@ -1170,7 +1311,7 @@ csGetUserByUid(
         return NULL;
     }
 
-    if (staticData->sessions[staticData->users[Uid2Index(uid)].session].socket != csDispatchGetSocket())
+    if (!isOnCurrentSocket(staticData->users[Uid2Index(uid)].session, uid))
     {
         TRCERR("UID for unexpected socket, expected: %d, is: %d", staticData->sessions[staticData->users[Uid2Index(uid)].session].socket, csDispatchGetSocket());
         return NULL;
@@ -1265,6 +1406,9 @@ csReleaseUser(
     		   (const NQ_BYTE *)&eventInfo
     		   );
 #endif
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    syMemset(staticData->users[index].channels, 0, sizeof(staticData->users[index].channels));
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
     staticData->users[index].uid = CS_ILLEGALID;
     staticData->numUsers--;
     LOGFE(CM_TRC_LEVEL_FUNC_TOOL);
@@ -1426,6 +1570,117 @@ csRenewUserTimeStamp(
     TRCE();
 }
 
+/*
+ *====================================================================
+ * PURPOSE: get the key for signing packets of a user
+ *--------------------------------------------------------------------
+ * PARAMS:  IN pointer to user slot
+ *
+ * RETURNS: pointer to the signing key
+ *
+ * NOTES:   a channel bound to the user over the current socket has
+ *          its own key, otherwise the user signing key is used
+ *====================================================================
+ */
+
+const NQ_BYTE*
+csGetUserSigningKey(
+    const CSUser* pUser
+    )
+{
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    NQ_COUNT i;     /* index in channels */
+
+    for (i = 0; i < UD_CS_MAXCHANNELS; i++)
+    {
+        const CSChannel * pChannel = &pUser->channels[i];
+
+        if (pChannel->isUsed && staticData->sessions[pChannel->session].socket == csDispatchGetSocket())
+        {
+            return pChannel->signingKey;
+        }
+    }
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+    return pUser->signingKey;
+}
+
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+
+/*
+ *====================================================================
+ * PURPOSE: find a user for binding a channel to it
+ *--------------------------------------------------------------------
+ * PARAMS:  IN user ID
+ *
+ * RETURNS: pointer to a slot or NULL
+ *
+ * NOTES:   unlike csGetUserByUid() the user may belong to
+ *          any socket
+ *====================================================================
+ */
+
+CSUser*
+csGetUserToBind(
+    CSUid uid
+    )
+{
+    if (Uid2Index(uid) >= UD_FS_NUMSERVERUSERS || Uid2Index(uid) < 0)
+    {
+        TRCERR("Illegal UID value, uid: %d", uid);
+        return NULL;
+    }
+
+    if (staticData->users[Uid2Index(uid)].uid != uid)
+    {
+        TRCERR("Illegal UID in the slot, expected: %d, is: %d", uid, staticData->users[Uid2Index(uid)].uid);
+        return NULL;
+    }
+    return &staticData->users[Uid2Index(uid)];
+}
+
+/*
+ *====================================================================
+ * PURPOSE: bind another session to a user
+ *--------------------------------------------------------------------
+ * PARAMS:  IN pointer to user slot
+ *          IN session to bind
+ *          IN channel signing key
+ *
+ * RETURNS: TRUE on success, FALSE when all channel slots are in use
+ *
+ * NOTES:   requests of the user are accepted over the bound session
+ *          until either it or the user is released
+ *====================================================================
+ */
+
+NQ_BOOL
+csBindUserChannel(
+    CSUser* pUser,
+    const CSSession* pSession,
+    const NQ_BYTE* signingKey
+    )
+{
+    NQ_COUNT i;     /* index in channels */
+
+    for (i = 0; i < UD_CS_MAXCHANNELS; i++)
+    {
+        CSChannel * pChannel = &pUser->channels[i];
+
+        if (!pChannel->isUsed)
+        {
+            pChannel->isUsed = TRUE;
+            pChannel->session = pSession->key;
+            syMemcpy(pChannel->signingKey, signingKey, sizeof(pChannel->signingKey));
+            return TRUE;
+        }
+    }
+
+    TRCERR("No more channel slots for uid: %d", pUser->uid);
+    return FALSE;
+}
+
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+
 
 #endif /* UD_NQ_INCLUDESMB2 */
 
@@ -1476,6 +1731,8 @@ csGetNewTree(
             staticData->trees[i].uid = pUser->uid;
             staticData->trees[i].session = pUser->session;
             staticData->trees[i].maxAccessRights = 0x001f01ff;
+            staticData->trees[i].shareAccess = 0;
+            staticData->trees[i].sdVersion = 0;
             return &staticData->trees[i];
         }
     }
@@ -1516,7 +1773,7 @@ csGetTreeByTid(
         return NULL;
     }
 
-    if (staticData->sessions[staticData->trees[Tid2Index(tid)].session].socket != csDispatchGetSocket())
+    if (!isOnCurrentSocket(staticData->trees[Tid2Index(tid)].session, staticData->trees[Tid2Index(tid)].uid))
     {
         TRCERR("TID for unexpected socket, expected: %d, is: %d", staticData->sessions[staticData->trees[Tid2Index(tid)].session].socket, csDispatchGetSocket());
         TRCE();
@@ -1614,7 +1871,10 @@ csReleaseTree(
         {
 #ifdef UD_CS_INCLUDEPERSISTENTFIDS
             if (staticData->files[idx].durableFlags & CS_DURABLE_REQUIRED)
+            {
                 staticData->files[idx].durableFlags |= CS_DURABLE_DISCONNECTED;
+                staticData->files[idx].durableExpire = (NQ_UINT32)syGetTimeInSec() + (staticData->files[idx].durableTimeout + 999) / 1000;
+            }
             else
 #endif
                 csReleaseFile(staticData->files[idx].fid);
@@ -1914,6 +2174,7 @@ csReleaseName(
 			eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
 
+            csInvalidateNameCache(pName->name);
         	if (fileInfo.attributes & SMB_ATTR_DIRECTORY)
             {
                 status = syDeleteDirectory(pName->name);
@@ -2130,6 +2391,11 @@ csGetNewFile(
         staticData->files[candidate].oplockGranted = FALSE;
         staticData->files[candidate].isBreakingOpLock = FALSE;
         staticData->files[candidate].isCreatePending = FALSE;
+#ifdef UD_NQ_INCLUDESMB2
+        staticData->files[candidate].leaseGranted = FALSE;
+        staticData->files[candidate].isBreakingLease = FALSE;
+        staticData->files[candidate].leaseState = SMB2_LEASE_NONE;
+#endif /* UD_NQ_INCLUDESMB2 */
         staticData->numFiles++;
         return &staticData->files[candidate];
     }
@@ -2214,7 +2480,7 @@ csGetFileByFid(
         return NULL;
     }
 
-    if (staticData->sessions[staticData->files[fid2Index(fid)].session].socket != csDispatchGetSocket())
+    if (!isOnCurrentSocket(staticData->files[fid2Index(fid)].session, staticData->files[fid2Index(fid)].uid))
     {
         TRCERR("FID for unexpected socket");
         return NULL;
@@ -2341,6 +2607,697 @@ cs2GetFileByContext(
     return NULL;
 }
 
+/*====================================================================
+ * PURPOSE: find a file holding a lease
+ *--------------------------------------------------------------------
+ * PARAMS:  IN lease key
+ *          IN user ID
+ *
+ * RETURNS: Pointer to a file or NULL
+ *
+ * NOTES:   a handle with lease break in progress is preferred
+ *====================================================================
+ */
+
+CSFile*
+cs2GetFileByLeaseKey(
+    const NQ_BYTE* leaseKey,
+    CSUid uid
+    )
+{
+    CSFile* pFound = NULL;
+    NQ_INT i;
+
+    for (i = 0; i < UD_FS_NUMSERVERFILEOPEN; i++)
+    {
+        if (   staticData->files[i].fid != CS_ILLEGALID
+            && staticData->files[i].leaseGranted
+            && staticData->files[i].uid == uid
+            && syMemcmp(staticData->files[i].leaseKey, leaseKey, sizeof(staticData->files[i].leaseKey)) == 0
+           )
+        {
+            if (staticData->files[i].isBreakingLease)
+                return &staticData->files[i];
+            if (pFound == NULL)
+                pFound = &staticData->files[i];
+        }
+    }
+    return pFound;
+}
+
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+
+/*====================================================================
+ * PURPOSE: find a disconnected durable file
+ *--------------------------------------------------------------------
+ * PARAMS:  IN create GUID
+ *
+ * RETURNS: Pointer to a file or NULL
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+CSFile*
+cs2GetFileByDurableGuid(
+    const NQ_BYTE* guid
+    )
+{
+    NQ_INT i;
+
+    for (i = 0; i < UD_FS_NUMSERVERFILEOPEN; i++)
+    {
+        if (   staticData->files[i].fid != CS_ILLEGALID
+            && (staticData->files[i].durableFlags & (CS_DURABLE_V2 | CS_DURABLE_DISCONNECTED)) == (CS_DURABLE_V2 | CS_DURABLE_DISCONNECTED)
+            && syMemcmp(staticData->files[i].durableGuid, guid, sizeof(staticData->files[i].durableGuid)) == 0
+           )
+        {
+            return &staticData->files[i];
+        }
+    }
+    return NULL;
+}
+
+/*====================================================================
+ * PURPOSE: remember the user a durable open belongs to
+ *--------------------------------------------------------------------
+ * PARAMS:  IN durable file
+ *          IN user that opened it
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+void
+csDurableSetOwner(
+    CSFile* pFile,
+    const CSUser* pUser
+    )
+{
+    syMemset(&pFile->durableOwner, 0, sizeof(pFile->durableOwner));
+    if (NULL == pUser)
+        return;
+    cmWStrncpy(pFile->durableOwner.name, pUser->name, CM_USERNAMELENGTH);
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    syMemcpy(&pFile->durableOwner.domain, &pUser->token.domain, sizeof(pFile->durableOwner.domain));
+    if (pUser->token.numRids > 0)
+        pFile->durableOwner.rid = pUser->token.rids[0];
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+}
+
+/*====================================================================
+ * PURPOSE: check that a reconnect comes from the owner of an open
+ *--------------------------------------------------------------------
+ * PARAMS:  IN owner of the durable open
+ *          IN reconnecting user
+ *
+ * RETURNS: TRUE when the user name, domain SID and RID match
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+NQ_BOOL
+csDurableIsOwner(
+    const CSDurableOwner* pOwner,
+    const CSUser* pUser
+    )
+{
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    const CMSdDomainSid* pDomain;
+    NQ_INT i;
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+
+    if (NULL == pUser || 0 != cmWStricmp(pOwner->name, pUser->name))
+        return FALSE;
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    pDomain = &pUser->token.domain;
+    if (pOwner->rid != (pUser->token.numRids > 0 ? pUser->token.rids[0] : 0))
+        return FALSE;
+    if (pOwner->domain.revision != pDomain->revision || pOwner->domain.numAuths != pDomain->numAuths
+        || 0 != syMemcmp(pOwner->domain.idAuth, pDomain->idAuth, sizeof(pDomain->idAuth)))
+        return FALSE;
+    for (i = 0; i < pDomain->numAuths && i < JOURNAL_SIDSUBS; i++)
+    {
+        if (pOwner->domain.subs[i] != pDomain->subs[i])
+            return FALSE;
+    }
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+    return TRUE;
+}
+
+/*====================================================================
+ * PURPOSE: close disconnected durable opens whose timeout has passed
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: None
+ *
+ * NOTES:   called periodically by the server loop, replayed journal
+ *          records that were never reconnected are dropped as well
+ *====================================================================
+ */
+
+void
+csDurableScavenge(
+    void
+    )
+{
+    NQ_UINT32 now = (NQ_UINT32)syGetTimeInSec();
+    NQ_INT i;
+
+    for (i = 0; i < UD_FS_NUMSERVERFILEOPEN; i++)
+    {
+        CSFile* pFile = &staticData->files[i];
+
+        if (pFile->fid != (CSFid)CS_ILLEGALID && (pFile->durableFlags & CS_DURABLE_DISCONNECTED) && now >= pFile->durableExpire)
+        {
+            TRC("Durable open expired, fid: %d", pFile->fid);
+            csReleaseFile(pFile->fid);
+        }
+    }
+    for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+    {
+        CSDurableRecord* pRecord = &staticData->durables[i];
+
+        if (pRecord->isUsed && pRecord->isReplayed && now > pRecord->expire)
+            journalRelease(pRecord->guid);
+    }
+    if (staticData->journalPending > 0 && now >= staticData->journalDue)
+        journalFlush();
+}
+
+/*====================================================================
+ * PURPOSE: hash a name for the journal
+ *--------------------------------------------------------------------
+ * PARAMS:  IN name
+ *
+ * RETURNS: FNV-1a hash of the name characters
+ *
+ * NOTES:   the journal does not keep file names, a reconnect presents
+ *          them again
+ *====================================================================
+ */
+
+static NQ_UINT32
+journalHash(
+    const NQ_WCHAR* name
+    )
+{
+    NQ_UINT32 hash = 2166136261U;
+
+    for (; *name != 0; name++)
+    {
+        hash ^= (NQ_UINT32)*name;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/*====================================================================
+ * PURPOSE: record a durable open in the journal
+ *--------------------------------------------------------------------
+ * PARAMS:  IN durable file
+ *          IN create parameters
+ *
+ * RETURNS: None
+ *
+ * NOTES:   only opens with a create GUID are recorded, others cannot
+ *          be matched after restart
+ *====================================================================
+ */
+
+void
+csDurableJournalAdd(
+    CSFile* pFile,
+    const CSCreateParams* pParams
+    )
+{
+    CSDurableRecord* pRecord = NULL;
+    NQ_INT i;
+
+    TRCB();
+
+    if (!(pFile->durableFlags & CS_DURABLE_V2))
+        goto Exit;
+
+    for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+    {
+        if (!staticData->durables[i].isUsed)
+        {
+            pRecord = &staticData->durables[i];
+            break;
+        }
+    }
+    if (NULL == pRecord)
+    {
+        TRCERR("Durable journal is full");
+        goto Exit;
+    }
+
+    syMemset(pRecord, 0, sizeof(*pRecord));
+    pRecord->isUsed = TRUE;
+    pRecord->isReplayed = FALSE;
+    syMemcpy(pRecord->guid, pFile->durableGuid, sizeof(pRecord->guid));
+    pRecord->pathHash = journalHash(pParams->fileName);
+    syMemcpy(&pRecord->owner, &pFile->durableOwner, sizeof(pRecord->owner));
+    pRecord->desiredAccess = pParams->desiredAccess;
+    pRecord->sharedAccess = pParams->sharedAccess;
+    pRecord->createOptions = pParams->createOptions;
+    if (pFile->leaseGranted)
+    {
+        pRecord->leaseState = pFile->leaseState;
+        syMemcpy(pRecord->leaseKey, pFile->leaseKey, sizeof(pRecord->leaseKey));
+    }
+    pRecord->timeout = pFile->durableTimeout;
+    journalAppend(pRecord, JOURNAL_ADD);
+
+Exit:
+    TRCE();
+}
+
+/*====================================================================
+ * PURPOSE: find a durable open preserved over server restart
+ *--------------------------------------------------------------------
+ * PARAMS:  IN create GUID
+ *          IN localized file name
+ *          IN reconnecting user
+ *
+ * RETURNS: Pointer to a journal record or NULL
+ *
+ * NOTES:   expired records are dropped
+ *====================================================================
+ */
+
+CSDurableRecord*
+csDurableJournalFind(
+    const NQ_BYTE* guid,
+    const NQ_WCHAR* fileName,
+    const CSUser* pUser
+    )
+{
+    NQ_UINT32 now = (NQ_UINT32)syGetTimeInSec();
+    NQ_INT i;
+
+    for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+    {
+        CSDurableRecord* pRecord = &staticData->durables[i];
+
+        if (!pRecord->isUsed || !pRecord->isReplayed || syMemcmp(pRecord->guid, guid, sizeof(pRecord->guid)) != 0)
+            continue;
+        if (now > pRecord->expire)
+        {
+            TRC("Durable open expired");
+            journalRelease(pRecord->guid);
+            return NULL;
+        }
+        if (pRecord->pathHash != journalHash(fileName) || !csDurableIsOwner(&pRecord->owner, pUser))
+        {
+            TRCERR("Durable open does not match the reconnect");
+            return NULL;
+        }
+        return pRecord;
+    }
+    return NULL;
+}
+
+/*====================================================================
+ * PURPOSE: bind a preserved durable open to its reopened file
+ *--------------------------------------------------------------------
+ * PARAMS:  IN journal record
+ *          IN reopened file
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the journal already holds this open, nothing is written
+ *====================================================================
+ */
+
+void
+csDurableJournalClaim(
+    CSDurableRecord* pRecord,
+    CSFile* pFile
+    )
+{
+    pRecord->isReplayed = FALSE;
+    pFile->durableFlags = CS_DURABLE_REQUIRED | CS_DURABLE_V2;
+    syMemcpy(pFile->durableGuid, pRecord->guid, sizeof(pFile->durableGuid));
+    pFile->durableTimeout = pRecord->timeout;
+    syMemcpy(&pFile->durableOwner, &pRecord->owner, sizeof(pFile->durableOwner));
+}
+
+/*====================================================================
+ * PURPOSE: drop a durable open from the journal
+ *--------------------------------------------------------------------
+ * PARAMS:  IN create GUID
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+journalRelease(
+    const NQ_BYTE * guid
+    )
+{
+    NQ_INT i;
+
+    for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+    {
+        if (staticData->durables[i].isUsed && syMemcmp(staticData->durables[i].guid, guid, sizeof(staticData->durables[i].guid)) == 0)
+        {
+            journalAppend(&staticData->durables[i], JOURNAL_REMOVE);
+            staticData->durables[i].isUsed = FALSE;
+            break;
+        }
+    }
+}
+
+/*====================================================================
+ * PURPOSE: compose a journal record
+ *--------------------------------------------------------------------
+ * PARAMS:  OUT buffer of JOURNAL_RECORDSIZE bytes
+ *          IN record
+ *          IN record type
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+journalWrite(
+    NQ_BYTE * buffer,
+    const CSDurableRecord * pRecord,
+    NQ_BYTE type
+    )
+{
+    CMBufferWriter writer;
+    NQ_INT i;
+
+    cmBufferWriterInit(&writer, buffer, JOURNAL_RECORDSIZE);
+    cmBufferWriteByte(&writer, type);
+    cmBufferWriteZeroes(&writer, 3);                    /* reserved */
+    cmBufferWriteBytes(&writer, pRecord->guid, sizeof(pRecord->guid));
+    cmBufferWriteUint32(&writer, pRecord->pathHash);
+    for (i = 0; i < JOURNAL_NAMELENGTH; i++)            /* user name, zero padded */
+        cmBufferWriteUint16(&writer, i < CM_USERNAMELENGTH ? (NQ_UINT16)pRecord->owner.name[i] : 0);
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    cmBufferWriteByte(&writer, pRecord->owner.domain.revision);
+    cmBufferWriteByte(&writer, pRecord->owner.domain.numAuths);
+    cmBufferWriteBytes(&writer, pRecord->owner.domain.idAuth, sizeof(pRecord->owner.domain.idAuth));
+    for (i = 0; i < JOURNAL_SIDSUBS; i++)
+        cmBufferWriteUint32(&writer, i < pRecord->owner.domain.numAuths ? pRecord->owner.domain.subs[i] : 0);
+    cmBufferWriteUint32(&writer, pRecord->owner.rid);
+#else /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+    cmBufferWriteZeroes(&writer, 8 + 4 * JOURNAL_SIDSUBS + 4);   /* domain SID, RID */
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+    cmBufferWriteUint32(&writer, pRecord->desiredAccess);
+    cmBufferWriteUint32(&writer, pRecord->sharedAccess);
+    cmBufferWriteUint32(&writer, pRecord->createOptions);
+    cmBufferWriteUint32(&writer, pRecord->leaseState);
+    cmBufferWriteBytes(&writer, pRecord->leaseKey, sizeof(pRecord->leaseKey));
+    cmBufferWriteUint32(&writer, pRecord->timeout);
+    cmBufferWriteZeroes(&writer, 4);                    /* reserved */
+}
+
+/*====================================================================
+ * PURPOSE: append a record to the journal
+ *--------------------------------------------------------------------
+ * PARAMS:  IN record
+ *          IN record type
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the record is collected and written with the next batch,
+ *          the journal is compacted when it grows too long
+ *====================================================================
+ */
+
+static void
+journalAppend(
+    const CSDurableRecord * pRecord,
+    NQ_BYTE type
+    )
+{
+    if (!syIsValidFile(staticData->journal))
+        return;
+
+    if (staticData->journalPending == 0)
+        staticData->journalDue = (NQ_UINT32)syGetTimeInSec() + JOURNAL_FLUSHTIME;
+    journalWrite(staticData->journalBuffer + staticData->journalPending * JOURNAL_RECORDSIZE, pRecord, type);
+    if (++staticData->journalPending == JOURNAL_BATCHSIZE)
+        journalFlush();
+    if (++staticData->journalRecords > 2 * UD_CS_DURABLEJOURNAL_SIZE)
+        journalCompact();
+}
+
+/*====================================================================
+ * PURPOSE: write the collected records to the journal
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+journalFlush(
+    void
+    )
+{
+    NQ_COUNT length = staticData->journalPending * JOURNAL_RECORDSIZE;
+
+    if (staticData->journalPending == 0)
+        return;
+    staticData->journalPending = 0;
+    if (!syIsValidFile(staticData->journal))
+        return;
+    if (syWriteFile(staticData->journal, staticData->journalBuffer, length) != (NQ_INT)length || syFlushFile(staticData->journal) != NQ_SUCCESS)
+    {
+        TRCERR("Failed to write durable journal");
+    }
+}
+
+/*====================================================================
+ * PURPOSE: rewrite the journal from the durable table
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the new journal is written aside and renamed over the old
+ *          one, so a crash leaves either of them complete
+ *====================================================================
+ */
+
+static void
+journalCompact(
+    void
+    )
+{
+    NQ_WCHAR name[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN)];
+    NQ_WCHAR tempName[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN + 4)];
+    NQ_CHAR tempNameA[UD_FS_MAXPATHLEN + 4];
+    NQ_BYTE buffer[JOURNAL_RECORDSIZE];
+    CMBufferWriter writer;
+    SYFile file;
+    NQ_UINT32 now = (NQ_UINT32)syGetTimeInSec();
+    NQ_INT i;
+
+    TRCB();
+
+    syAnsiToUnicode(name, staticData->journalName);
+    syStrcpy(tempNameA, staticData->journalName);
+    syStrcat(tempNameA, ".new");
+    syAnsiToUnicode(tempName, tempNameA);
+
+    /* the table already holds the collected records */
+    if (syIsValidFile(staticData->journal))
+    {
+        syCloseFile(staticData->journal);
+        syInvalidateFile(&staticData->journal);
+    }
+    staticData->journalRecords = 0;
+    staticData->journalPending = 0;
+
+    syDeleteFile(tempName);
+    file = syCreateFile(tempName, FALSE, FALSE, FALSE);
+    if (!syIsValidFile(file))
+    {
+        TRCERR("Unable to create durable journal");
+        goto Exit;
+    }
+    cmBufferWriterInit(&writer, buffer, JOURNAL_HEADERSIZE);
+    cmBufferWriteUint32(&writer, JOURNAL_SIGNATURE);
+    cmBufferWriteUint32(&writer, JOURNAL_VERSION);
+    syWriteFile(file, buffer, JOURNAL_HEADERSIZE);
+    for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+    {
+        CSDurableRecord * pRecord = &staticData->durables[i];
+
+        if (pRecord->isUsed && pRecord->isReplayed && now > pRecord->expire)
+            pRecord->isUsed = FALSE;
+        if (!pRecord->isUsed)
+            continue;
+        journalWrite(buffer, pRecord, JOURNAL_ADD);
+        syWriteFile(file, buffer, JOURNAL_RECORDSIZE);
+        staticData->journalRecords++;
+    }
+    syFlushFile(file);
+    syCloseFile(file);
+
+    syDeleteFile(name);
+    if (syRenameFile(tempName, name) != NQ_SUCCESS)
+    {
+        TRCERR("Unable to replace durable journal");
+        goto Exit;
+    }
+    staticData->journal = syOpenFileForWrite(name, FALSE, FALSE, FALSE);
+    if (syIsValidFile(staticData->journal))
+        sySeekFileEnd(staticData->journal, 0, 0);
+
+Exit:
+    TRCE();
+}
+
+/*====================================================================
+ * PURPOSE: load durable opens of the previous run
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: None
+ *
+ * NOTES:   replayed opens wait for reconnect as long as their durable
+ *          timeout, counting from server start
+ *====================================================================
+ */
+
+static void
+journalReplay(
+    void
+    )
+{
+    NQ_WCHAR name[CM_BUFFERLENGTH(NQ_WCHAR, UD_FS_MAXPATHLEN)];
+    NQ_BYTE buffer[JOURNAL_RECORDSIZE];
+    CMBufferReader reader;
+    SYFile file;
+    NQ_UINT32 signature = 0, version = 0;
+    NQ_UINT32 now = (NQ_UINT32)syGetTimeInSec();
+    NQ_INT i;
+
+    TRCB();
+
+    for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+        staticData->durables[i].isUsed = FALSE;
+    syInvalidateFile(&staticData->journal);
+    staticData->journalRecords = 0;
+    staticData->journalPending = 0;
+
+    udGetDurableJournalFile(staticData->journalName);
+    syAnsiToUnicode(name, staticData->journalName);
+    file = syOpenFileForRead(name, FALSE, FALSE, FALSE);
+    if (!syIsValidFile(file))
+        goto Compact;
+
+    if (syReadFile(file, buffer, JOURNAL_HEADERSIZE) == JOURNAL_HEADERSIZE)
+    {
+        cmBufferReaderInit(&reader, buffer, JOURNAL_HEADERSIZE);
+        cmBufferReadUint32(&reader, &signature);
+        cmBufferReadUint32(&reader, &version);
+    }
+    if (JOURNAL_SIGNATURE != signature || JOURNAL_VERSION != version)
+    {
+        TRCERR("Durable journal ignored: unknown format");
+        syCloseFile(file);
+        goto Compact;
+    }
+
+    /* a torn record at the end is ignored */
+    while (syReadFile(file, buffer, JOURNAL_RECORDSIZE) == JOURNAL_RECORDSIZE)
+    {
+        CSDurableRecord record;
+        NQ_BYTE type;
+        CSDurableRecord * pSlot = NULL;
+
+        cmBufferReaderInit(&reader, buffer, JOURNAL_RECORDSIZE);
+        cmBufferReadByte(&reader, &type);
+        cmBufferReaderSkip(&reader, 3);                 /* reserved */
+        cmBufferReadBytes(&reader, record.guid, sizeof(record.guid));
+        cmBufferReadUint32(&reader, &record.pathHash);
+        syMemset(&record.owner, 0, sizeof(record.owner));
+        for (i = 0; i < JOURNAL_NAMELENGTH; i++)
+        {
+            NQ_UINT16 c;
+
+            cmBufferReadUint16(&reader, &c);
+            if (i < CM_USERNAMELENGTH)
+                record.owner.name[i] = (NQ_WCHAR)c;
+        }
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+        cmBufferReadByte(&reader, &record.owner.domain.revision);
+        cmBufferReadByte(&reader, &record.owner.domain.numAuths);
+        cmBufferReadBytes(&reader, record.owner.domain.idAuth, sizeof(record.owner.domain.idAuth));
+        for (i = 0; i < JOURNAL_SIDSUBS; i++)
+        {
+            NQ_UINT32 sub;
+
+            cmBufferReadUint32(&reader, &sub);
+            record.owner.domain.subs[i] = sub;
+        }
+        cmBufferReadUint32(&reader, &record.owner.rid);
+#else /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+        cmBufferReaderSkip(&reader, 8 + 4 * JOURNAL_SIDSUBS + 4);   /* domain SID, RID */
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+        cmBufferReadUint32(&reader, &record.desiredAccess);
+        cmBufferReadUint32(&reader, &record.sharedAccess);
+        cmBufferReadUint32(&reader, &record.createOptions);
+        cmBufferReadUint32(&reader, &record.leaseState);
+        cmBufferReadBytes(&reader, record.leaseKey, sizeof(record.leaseKey));
+        cmBufferReadUint32(&reader, &record.timeout);
+
+        for (i = 0; i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+        {
+            if (staticData->durables[i].isUsed && syMemcmp(staticData->durables[i].guid, record.guid, sizeof(record.guid)) == 0)
+            {
+                pSlot = &staticData->durables[i];
+                break;
+            }
+        }
+        if (JOURNAL_REMOVE == type)
+        {
+            if (NULL != pSlot)
+                pSlot->isUsed = FALSE;
+            continue;
+        }
+        for (i = 0; NULL == pSlot && i < UD_CS_DURABLEJOURNAL_SIZE; i++)
+        {
+            if (!staticData->durables[i].isUsed)
+                pSlot = &staticData->durables[i];
+        }
+        if (JOURNAL_ADD != type || NULL == pSlot)
+            continue;
+        record.isUsed = TRUE;
+        record.isReplayed = TRUE;
+        record.expire = now + (record.timeout + 999) / 1000;
+        *pSlot = record;
+    }
+    syCloseFile(file);
+
+Compact:
+    journalCompact();
+    TRCE();
+}
+
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #endif /* UD_NQ_INCLUDESMB2 */
 
 /*====================================================================
@@ -2420,6 +3377,12 @@ csReleaseFile(
     }
     pFile = &staticData->files[index];
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+    if (pFile->durableFlags & CS_DURABLE_V2)
+        journalRelease(pFile->durableGuid);
+    pFile->durableFlags = 0;
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #ifdef UD_NQ_INCLUDEEVENTLOG
     eventInfo.fileName = staticData->names[pFile->nid].name;
     eventInfo.access = 0;
@@ -2686,7 +3649,7 @@ csGetShareByUidTid(
         return NULL;
     }
 
-    if (staticData->sessions[staticData->trees[Tid2Index(tid)].session].socket != csDispatchGetSocket())
+    if (!isOnCurrentSocket(staticData->trees[Tid2Index(tid)].session, tree->uid))
     {
         TRCERR("TID for unexpected socket");
         return NULL;
@@ -2728,6 +3691,7 @@ csSetShareSecurityDescriptor(
     CSShare* share
     )
 {
+    share->sdVersion++;     /* invalidates access cached in trees */
     udSaveShareSecurityDescriptor(share->name, share->sd.data, (NQ_COUNT)share->sd.length);
     return TRUE;
 }
@@ -2761,6 +3725,7 @@ csLoadShareSecurityDescriptor(
         TRC("   loading default security descriptor");
         cmSdGetShareSecurityDescriptor(&staticData->shares[share->idx].sd);
     }
+    staticData->shares[share->idx].sdVersion++;
     return TRUE;
 }
 
@@ -109,6 +109,7 @@ typedef struct                  /* share descriptor */
 #ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
     CMSdSecurityDescriptor sd;                      /* security descriptor */
 #endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+    NQ_UINT32 sdVersion;                            /* changes with each change of the security descriptor */
 } CSShare;
 
 typedef struct                  /* server session */
@@ -146,6 +147,13 @@ typedef struct                  /* server session */
 #ifdef UD_CS_INCLUDEEXTENDEDSECURITY
     const void * securityMech;  /* abstract pointer to security mechanism */
 #endif /* UD_CS_INCLUDEEXTENDEDSECURITY */
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    CSUid bindingUid;           /* temporary user authenticating a channel binding on this session or CS_ILLEGALID */
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+#ifdef UD_NQ_INCLUDECOMPRESSION
+    NQ_UINT16 compressionAlgorithm; /* negotiated compression algorithm or SMB2_COMPRESSION_NONE */
+    NQ_BOOL compressionChained; /* client supports chained compression */
+#endif /* UD_NQ_INCLUDECOMPRESSION */
 } 
 CSSession;
 
@@ -155,6 +163,16 @@ CSSession;
 #define uidToSessionId(_id) (_id + 1001)  /* 1001-based */
 #endif /* UD_NQ_INCLUDESMB2 */  
 
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+typedef struct                  /* another session (connection) bound to a user (SMB3 channel) */
+{
+    NQ_BOOL isUsed;             /* whether the slot is in use */
+    CSSessionKey session;       /* the index in array of sessions */
+    NQ_BYTE signingKey[SMB_SESSIONKEY_LENGTH];      /* a key for signing packets over this channel */
+}
+CSChannel;
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
+
 typedef struct                  /* server session */
 {
     CSSessionKey session;       /* the index in array of sessions */
@@ -164,6 +182,7 @@ typedef struct                  /* server session */
     NQ_BOOL supportsReadAhead;  /* TRUE for case a client supporting read ahead */
     NQ_BOOL isAnonymous;        /* TRUE for an anonymous user */
     NQ_WCHAR name[CM_BUFFERLENGTH(NQ_WCHAR, CM_USERNAMELENGTH)];    /* user name */
+    NQ_WCHAR domain[CM_BUFFERLENGTH(NQ_WCHAR, CM_NQ_HOSTNAMESIZE)]; /* user domain as sent by the client */
     NQ_BYTE credentials[SMB_SESSIONSETUPANDX_CREDENTIALS_LENGTH];   /* saved user credentials */
     NQ_BOOL isDomainUser;       /* TRUE for domain user */
     CMSdAccessToken token;      /* security token for the session user */
@@ -181,6 +200,7 @@ typedef struct                  /* server session */
 #endif /* UD_CS_MESSAGESIGNINGPOLICY */
 #ifdef UD_CS_INCLUDEPASSTHROUGH
      NQ_BOOL authBySamlogon;    /* whether user was authenticated by Netlogon SamLogon */ 
+     NQ_UINT32 pendingLogon;    /* ID of the pass-through logon in progress or zero */
 #endif /* UD_CS_INCLUDEPASSTHROUGH */
     NQ_BOOL isGuest;            /* whether user has no password and authenticated as guest */
     NQ_UINT32 rid;              /* user RID*/
@@ -197,6 +217,9 @@ typedef struct                  /* server session */
     NQ_BOOL preauthIntegOn;		/* for smb 311 and higher pre authentication integrity is on during negotiation and session setup stages */
 #endif /* UD_NQ_INCLUDESMB3 */
 #endif /* UD_NQ_INCLUDESMB2 */
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+    CSChannel channels[UD_CS_MAXCHANNELS];          /* sessions bound to this user besides the one it was created on */
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
 }
 CSUser;
 
@@ -207,10 +230,25 @@ typedef struct                  /* tree descriptor */
     CSTid tid;                  /* "self" index */
     CSShare* share;             /* pointer to the share */
     NQ_UINT32 maxAccessRights;  /* max access rights */
+    NQ_UINT32 shareAccess;      /* cached share access (READDATA/WRITEDATA bits) for this user */
+    NQ_UINT32 sdVersion;        /* share SD version the cached access was evaluated for */
 } CSTree;
 
 #define CS_DURABLE_REQUIRED     0x1     /* this flag is set when FID is requested to be durable */
 #define CS_DURABLE_DISCONNECTED 0x2     /* this flag is set when FID was disconnected and was not re-open yet */
+#define CS_DURABLE_V2           0x4     /* this flag is set when FID was opened with a create GUID (DH2Q) */
+
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+typedef struct                          /* user a durable open belongs to */
+{
+    NQ_WCHAR name[CM_BUFFERLENGTH(NQ_WCHAR, CM_USERNAMELENGTH)];    /* user name */
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    CMSdDomainSid domain;               /* domain SID of the user token */
+    CMSdRid rid;                        /* user RID */
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+}
+CSDurableOwner;
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
 
 typedef struct _CSFile                  /* file descriptor */
 {
@@ -221,6 +259,10 @@ typedef struct _CSFile                  /* file descriptor */
     CSFid fid;                          /* "self" index */
 #ifdef UD_CS_INCLUDEPERSISTENTFIDS
     NQ_UINT16 durableFlags;            /* see above */
+    NQ_BYTE durableGuid[16];           /* create GUID of a DH2Q open */
+    NQ_UINT32 durableTimeout;          /* milliseconds to preserve the open after disconnect */
+    NQ_UINT32 durableExpire;           /* disconnected open: time in seconds it is closed at */
+    CSDurableOwner durableOwner;       /* only this user may reconnect the open */
 #endif
 #ifdef UD_CS_INCLUDERPC
     NQ_BOOL isPipe;
@@ -251,13 +293,42 @@ typedef struct _CSFile                  /* file descriptor */
 #ifdef UD_NQ_INCLUDESMB2
     CSSid sid;                          /* search id */
     NQ_UINT64 notifyAid;                /* async ID of the interim Notify response */
+    NQ_UINT32 notifyBufferLength;       /* maximum length of notify data the client accepts */
 #endif
     CSLateResponseContext breakContext; /* context for oplock breaks */
     NQ_BOOL oplockGranted;              /* TRUE when oplock was granted */
     NQ_BOOL isBreakingOpLock;			/* this file is breaking its oplock */
     NQ_BOOL isCreatePending;			/* this file caused oplock break - waiting for late create response */
+#ifdef UD_NQ_INCLUDESMB2
+    NQ_BOOL leaseGranted;               /* TRUE when this handle belongs to a lease */
+    NQ_BOOL isBreakingLease;            /* lease break sent, waiting for acknowledgment */
+    NQ_BOOL leaseV2;                    /* lease was requested with version 2 context */
+    NQ_BYTE leaseKey[16];               /* client lease key, handles with the same key share the lease */
+    NQ_UINT32 leaseState;               /* SMB2_LEASE_xxx caching state */
+    NQ_UINT32 leaseBreakTo;             /* state the lease is being broken to */
+    NQ_UINT16 leaseEpoch;               /* lease epoch (version 2) */
+#endif /* UD_NQ_INCLUDESMB2 */
 }CSFile;
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+typedef struct                          /* durable open as recorded in the journal */
+{
+    NQ_BOOL isUsed;                     /* slot is occupied */
+    NQ_BOOL isReplayed;                 /* read from the journal on start, waits for reconnect */
+    NQ_BYTE guid[16];                   /* create GUID */
+    NQ_UINT32 pathHash;                 /* hash of the localized file name */
+    CSDurableOwner owner;               /* user that opened the file */
+    NQ_UINT32 desiredAccess;            /* access the file was opened with */
+    NQ_UINT32 sharedAccess;             /* share mode the file was opened with */
+    NQ_UINT32 createOptions;            /* NT create options */
+    NQ_UINT32 leaseState;               /* lease state held at the time of the open */
+    NQ_BYTE leaseKey[16];               /* lease key or zeroes */
+    NQ_UINT32 timeout;                  /* durable timeout in milliseconds */
+    NQ_UINT32 expire;                   /* replayed record: time in seconds it expires at */
+}
+CSDurableRecord;
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 typedef struct
 {
     NQ_UINT32 creationTimeLow;          /* UTC times */
@@ -318,6 +389,7 @@ typedef struct
     NQ_WCHAR * fileName;        /* IN file name pointer - localized and normalized */
     SYFileInformation fileInfo; /* IN OUT file information */
     CSFile * file;              /* OUT file pointer */
+    NQ_BOOL sharingViolation;   /* IN the open failed on share access (for breaking handle caching) */
     NQ_UINT32 takenAction;      /* OUT response action */
     CSCreateContext context;    /* OUT data used for composing contexts */
 } 
@@ -508,6 +580,33 @@ void
 csRenewUserTimeStamp(
     CSUser* pUser           /* pointer to user */     
     );
+
+/* get the key for signing packets of a user over the current socket */
+
+const NQ_BYTE*              /* channel signing key or user signing key */
+csGetUserSigningKey(
+    const CSUser* pUser     /* pointer to user */
+    );
+
+#ifdef UD_CS_INCLUDEMULTICHANNEL
+
+/* find a user providing UID regardless of the socket it was created on */
+
+CSUser*                     /* pointer or NULL */
+csGetUserToBind(
+    CSUid uid               /* UID to find the user descriptor */
+    );
+
+/* bind another session to a user as an SMB3 channel */
+
+NQ_BOOL                     /* TRUE on success, FALSE when there are no free channel slots */
+csBindUserChannel(
+    CSUser* pUser,              /* pointer to user */
+    const CSSession* pSession,  /* session to bind */
+    const NQ_BYTE* signingKey   /* channel signing key */
+    );
+
+#endif /* UD_CS_INCLUDEMULTICHANNEL */
     
 #endif /* UD_NQ_INCLUDESMB2 */  
 
@@ -663,6 +762,73 @@ cs2GetFileByContext(
     CSUid uid               /* user ID */
     );
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+
+/* find a disconnected durable file by its create GUID */
+
+CSFile*                     /* pointer or NULL */
+cs2GetFileByDurableGuid(
+    const NQ_BYTE* guid     /* create GUID */
+    );
+
+/* record a durable open in the journal */
+
+void
+csDurableJournalAdd(
+    CSFile* pFile,                  /* durable file */
+    const CSCreateParams* pParams   /* parameters it was opened with */
+    );
+
+/* find a durable open preserved over server restart */
+
+CSDurableRecord*            /* pointer or NULL */
+csDurableJournalFind(
+    const NQ_BYTE* guid,        /* create GUID */
+    const NQ_WCHAR* fileName,   /* localized file name */
+    const CSUser* pUser         /* reconnecting user */
+    );
+
+/* remember the user a durable open belongs to */
+
+void
+csDurableSetOwner(
+    CSFile* pFile,              /* durable file */
+    const CSUser* pUser         /* user that opened it */
+    );
+
+/* check that a reconnect comes from the user the durable open belongs to */
+
+NQ_BOOL                     /* TRUE when the user owns the open */
+csDurableIsOwner(
+    const CSDurableOwner* pOwner,   /* owner of the open */
+    const CSUser* pUser             /* reconnecting user */
+    );
+
+/* close disconnected durable opens whose timeout has passed */
+
+void
+csDurableScavenge(
+    void
+    );
+
+/* bind a preserved durable open to the file it was reopened as */
+
+void
+csDurableJournalClaim(
+    CSDurableRecord* pRecord,   /* journal record */
+    CSFile* pFile               /* reopened file */
+    );
+
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
+/* find a file holding a lease, a handle with lease break in progress is preferred */
+
+CSFile*                     /* pointer or NULL */
+cs2GetFileByLeaseKey(
+    const NQ_BYTE* leaseKey,/* lease key */
+    CSUid uid               /* user ID */
+    );
+
 #endif /* UD_NQ_INCLUDESMB2 */
 
 /* obtain file providing FID */
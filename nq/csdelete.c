@@ -736,6 +736,10 @@ csComDelete(
 					);
 					eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+                    csInvalidateNameCache(nextFile);
+#ifdef UD_NQ_INCLUDESMB2
+                    csBreakLeaseOnChange(nextFile, NULL);
+#endif /* UD_NQ_INCLUDESMB2 */
                     if (syDeleteFile(nextFile) == NQ_FAIL)
                     {
                         error = csErrorGetLast();
@@ -1683,6 +1687,11 @@ csRenameFile(
             		);
                 eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+                csInvalidateNameCache(nextSrcFile);
+                csInvalidateNameCache(nextDstFile);
+#ifdef UD_NQ_INCLUDESMB2
+                csBreakLeaseOnChange(nextSrcFile, NULL);
+#endif /* UD_NQ_INCLUDESMB2 */
                 if (syRenameFile(nextSrcFile, nextDstFile) == NQ_FAIL)
                 {
                     error = csErrorGetLast();
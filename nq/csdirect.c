@@ -679,6 +679,7 @@ csComDeleteDirectory(
 			);
 		eventInfo.before = FALSE;
 #endif /* UD_NQ_INCLUDEEVENTLOG */
+        csInvalidateNameCache(pFileName);
         if (syDeleteDirectory(pFileName) == NQ_FAIL)
         {
             error = csErrorGetLast();
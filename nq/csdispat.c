@@ -934,7 +934,11 @@ csDispatchRequest(
     /* check for SMB2 signature */
     staticData->isSmb2 = FALSE;
     if (syMemcmp(rcvBuf, cmSmb2ProtocolId, sizeof(cmSmb2ProtocolId)) == 0
-	 || syMemcmp(rcvBuf , cmSmb2TrnsfrmHdrProtocolId , sizeof(cmSmb2TrnsfrmHdrProtocolId)) == 0)
+	 || syMemcmp(rcvBuf , cmSmb2TrnsfrmHdrProtocolId , sizeof(cmSmb2TrnsfrmHdrProtocolId)) == 0
+#ifdef UD_NQ_INCLUDECOMPRESSION
+	 || syMemcmp(rcvBuf , cmSmb2CmprsHdrProtocolId , sizeof(cmSmb2CmprsHdrProtocolId)) == 0
+#endif /* UD_NQ_INCLUDECOMPRESSION */
+	)
     {
         /* handle SMB2 request, then release request buffer */
         NQ_BOOL result;
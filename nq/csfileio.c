@@ -965,6 +965,9 @@ csComWrite(
                 }
 #endif /* UD_CS_INCLUDEDIRECTTRANSFER */
                 csGetNameByNid(pFile->nid)->isDirty = TRUE;
+#ifdef UD_NQ_INCLUDESMB2
+                csBreakLeaseOnChange(NULL, pFile);
+#endif /* UD_NQ_INCLUDESMB2 */
             }
 
             /* update file offsets */
@@ -1273,6 +1276,9 @@ csComWriteAndX(
                   }
                }
                 csGetNameByNid(pFile->nid)->isDirty = TRUE;   
+#ifdef UD_NQ_INCLUDESMB2
+                csBreakLeaseOnChange(NULL, pFile);
+#endif /* UD_NQ_INCLUDESMB2 */
             }
             
             /* update file offsets */
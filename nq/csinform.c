@@ -28,6 +28,7 @@
 #endif
 #include "csinform.h"
 #include "csdelete.h"
+#include "csbreak.h"
 #include "cmsmb1.h"
 
 #ifdef UD_NQ_INCLUDECIFSSERVER
@@ -2930,6 +2931,24 @@ csSetFileInformationByName(
     /* get pointer to Name slot */
     pName = csGetNameByName(ctx->pFileName);
 
+#ifdef UD_NQ_INCLUDESMB2
+    /* leases of other clients must not keep serving data that is about to change */
+    switch (ctx->level)
+    {
+    case SMB_PASSTHRU_FILE_DISPOSITIONINFO:
+    case SMB_SETPATH2_NT_DISPOSITIONINFO:
+    case SMB_PASSTHRU_FILE_ALLOCATIONINFO:
+    case SMB_SETPATH2_NT_ALLOCATIONINFO:
+    case SMB_PASSTHRU_FILE_ENDOFFILEINFO:
+    case SMB_SETPATH2_NT_ENDOFFILEINFO:
+    case SMB_PASSTHRU_FILE_RENAMEINFO:
+        csBreakLeaseOnChange(ctx->pFileName, pFile);
+        break;
+    default:
+        break;
+    }
+#endif /* UD_NQ_INCLUDESMB2 */
+
     syMemcpy(&oldFileInfo, &fileInfo, sizeof(fileInfo));
 
     /* fill information according to the information level */
@@ -3584,6 +3603,7 @@ csSetFileInformationByName(
 				eventInfo.before = FALSE;
 			}
 #endif /* UD_NQ_INCLUDEEXTENDEDEVENTLOG */
+                csInvalidateNameCache(pDestFileName);
                 if (NQ_SUCCESS != syDeleteFile(pDestFileName))
                 {
 #ifdef UD_NQ_INCLUDEEXTENDEDEVENTLOG
@@ -39,20 +39,25 @@
     ---------------------------
  */
 
-/* Callback parameters for Get name by SID */
-#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
-typedef struct {
-    const CMSdDomainSid* sid;
-    NQ_UINT16 type;
-    NQ_COUNT requestCount;
-} LookupSids2Params;
-#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
-
 /* packet sizes - maximum packet sizes not including strings */
 #define QUERYINFO_ENTRYSIZE     40
 #define LOOKUPNAMES3_ENTRYSIZE    12
 #define MAX_NAMESTRANSLATED 20    /* max number of RIDS in a lookup request */
 #define MAX_SIDSTRANSLATED 10    /* max number of RIDS in a lookup request */
+#define MAX_SIDSPERPDCLOOKUP 32   /* max number of SIDS in one lookup on PDC */
+#define MAX_PDCLOOKUPDOMAINS 4    /* max number of referenced domains remembered from PDC */
+
+/* Callback parameters for Get name by SID */
+#if defined(UD_CS_INCLUDESECURITYDESCRIPTORS) && defined(UD_CS_INCLUDEPASSTHROUGH)
+typedef struct {
+    const CMSdDomainSid* sids[MAX_SIDSPERPDCLOOKUP];    /* SIDs to resolve */
+    NQ_COUNT numSids;           /* number of SIDs to resolve */
+    NQ_COUNT requestCount;      /* number of SIDs placed into the request */
+    NQ_COUNT responseCount;     /* number of names parsed from the response */
+    NQ_COUNT numDomains;        /* number of referenced domains */
+    NQ_WCHAR domains[MAX_PDCLOOKUPDOMAINS][CM_BUFFERLENGTH(NQ_WCHAR, CM_SD_NAMECACHELENGTH)];  /* referenced domain names */
+} LookupSids2Params;
+#endif /* defined(UD_CS_INCLUDESECURITYDESCRIPTORS) && defined(UD_CS_INCLUDEPASSTHROUGH) */
 
 /* Policy handles */
 #define HOSTNAME_HANDLE     1
@@ -359,6 +364,14 @@ lookupSids2NamesCallback(
     NQ_BYTE* params             /* pointer to callback parameters */
     );
 
+/* resolve domain SIDs on PDC */
+
+static void
+lookupDomainSids(
+    CMSdDomainSid* sids,        /* SIDs to resolve */
+    NQ_UINT32 numSids           /* number of SIDs */
+    );
+
 #endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
 #endif /* UD_CS_INCLUDEPASSTHROUGH */
 
@@ -614,6 +627,12 @@ lsaLookupSids2(
     switch (infoLevel)
     {
     case 1:
+        /* keep every translation of this request cached until the last pass */
+        cmSdCacheReserve(originalCount);
+#ifdef UD_CS_INCLUDEPASSTHROUGH
+        /* resolve all domain SIDs at once so that the passes below hit the cache */
+        lookupDomainSids(lookupSids, originalCount);
+#endif /* UD_CS_INCLUDEPASSTHROUGH */
         /* try to resolve SIDs (first pass) and count mapped count */
         /* place referent domain list */
         cmRpcPackUint32(out, refId++);          /* ref id */
@@ -1108,11 +1127,9 @@ static NQ_BOOL
 {
     LookupSids2Params *params = (LookupSids2Params *)abstractParams;
 
-    if (params->requestCount == 0)
+    if (params->requestCount >= params->numSids)
         return FALSE;
-    syMemcpy(out, params->sid, sizeof(*out));
-    params->type = CM_SD_RIDTYPE_UNKNOWN;
-    params->requestCount--;
+    syMemcpy(out, params->sids[params->requestCount++], sizeof(*out));
     return TRUE;
 }
 
@@ -1127,7 +1144,7 @@ static NQ_BOOL
  *
  * RETURNS: TRUE always
  *
- * NOTES:   Packs the TRUSTED DOMAINS LIST component of the response
+ * NOTES:   Remembers referenced domain names in their order
  *====================================================================
  */
 
@@ -1140,7 +1157,15 @@ lookupSids2DomainsCallback(
     NQ_BYTE* abstractParams
     )
 {
-    syWStrcpy(staticData->txtBufferT, name);
+    LookupSids2Params *params = (LookupSids2Params *)abstractParams;
+
+    if (params->numDomains >= MAX_PDCLOOKUPDOMAINS)
+        return TRUE;
+    if (NULL == name || syWStrlen(name) > CM_SD_NAMECACHELENGTH)
+        params->domains[params->numDomains][0] = cmWChar(0);
+    else
+        syWStrcpy(params->domains[params->numDomains], name);
+    params->numDomains++;
     return TRUE;
 }
 
@@ -1154,9 +1179,10 @@ lookupSids2DomainsCallback(
  *          IN total number of names
  *          IN/OUT pointer to callback parameters
  *
- * RETURNS: always
+ * RETURNS: TRUE always
  *
- * NOTES:
+ * NOTES:   Names come in the order of requested SIDs. Each translation,
+ *          including an unmapped SID, is cached
  *====================================================================
  */
 
@@ -1171,14 +1197,112 @@ lookupSids2NamesCallback(
     )
 {
     LookupSids2Params *params = (LookupSids2Params *)abstractParams;
+    const CMSdDomainSid* sid;       /* SID for this name */
 
-    if (type != CM_SD_RIDTYPE_UNKNOWN && type != CM_SD_RIDTYPE_DOMAIN)
-        syWStrcpy(staticData->nameW, name);
-    params->type = type;
-    params->requestCount++;
+    if (params->responseCount >= params->requestCount)
+        return TRUE;
+    sid = params->sids[params->responseCount++];
+    if (CM_SD_RIDTYPE_UNKNOWN == type)
+    {
+        cmSdCacheAdd(sid, NULL, NULL, type);
+    }
+    else if (index < params->numDomains && cmWChar(0) != params->domains[index][0])
+    {
+        cmSdCacheAdd(sid, CM_SD_RIDTYPE_DOMAIN == type? NULL : name, params->domains[index], type);
+    }
     return TRUE;
 }
 
+/*====================================================================
+ * PURPOSE: resolve domain SIDs on PDC
+ *--------------------------------------------------------------------
+ * PARAMS:  IN SIDs to resolve
+ *          IN number of SIDs
+ *
+ * RETURNS: None
+ *
+ * NOTES:   Local and already cached SIDs are skipped. The rest are sent
+ *          to PDC in batches over one LSA connection. Results are placed
+ *          into the SID cache
+ *====================================================================
+ */
+
+static void
+lookupDomainSids(
+    CMSdDomainSid* sids,
+    NQ_UINT32 numSids
+    )
+{
+    const NQ_CHAR *dc;                  /* DC name */
+    NQ_WCHAR * dcW;                     /* DC NQ_WCHAR name*/
+    NQ_HANDLE lsa = NULL;               /* LSA open handle */
+    LookupSids2Params params;           /* callback parameters for domain SIDs */
+    NQ_UINT16 type;                     /* cached type */
+    NQ_UINT32 i;                        /* just a counter */
+
+    TRCB();
+
+    if (cmNetBiosGetDomain()->isGroup)      /* workgroup - standalone server */
+        goto Exit;
+
+    params.numSids = 0;
+    for (i = 0; i < numSids; i++)
+    {
+#ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
+        if (NULL != sidHasLocalDomain(&sids[i]))
+            continue;
+#endif /* UD_CS_INCLUDELOCALUSERMANAGEMENT */
+        if (cmSdCacheFindSid(&sids[i], NULL, NULL, &type))
+            continue;
+        params.sids[params.numSids++] = &sids[i];
+        if (params.numSids < MAX_SIDSPERPDCLOOKUP && i + 1 < numSids)
+            continue;
+
+        if (NULL == lsa)
+        {
+            dc = csAuthGetPDCName();
+            if (dc == NULL)
+            {
+                TRCERR("Could not obtain PDC name");
+                goto Exit;
+            }
+            syAnsiToUnicode(staticData->txtBufferT, dc);
+            dcW = (NQ_WCHAR *)cmMemoryAllocate((NQ_UINT)(sizeof(NQ_WCHAR) * (syWStrlen(staticData->txtBufferT) + 1)));
+            if (NULL == dcW)
+            {
+                TRCERR("Out of memory");
+                goto Exit;
+            }
+            syWStrcpy(dcW, staticData->txtBufferT);
+
+            lsa = ccDcerpcConnect(dcW, NULL, ccLsaGetPipe(), FALSE);
+            cmMemoryFree(dcW);
+            if (lsa == NULL)
+            {
+                TRCERR("Unable to open LSA on PDC");
+                goto Exit;
+            }
+        }
+        params.requestCount = 0;
+        params.responseCount = 0;
+        params.numDomains = 0;
+        ccLsaLookupSids(
+            lsa,
+            (CCLsaLookupSidsRequestCallback)lookupSids2RequestCallback,
+            (CCLsaLookupSidsDomainsCallback)lookupSids2DomainsCallback,
+            (CCLsaLookupSidsNamesCallback)lookupSids2NamesCallback,
+            params.numSids,
+            (NQ_BYTE *)&params
+            );
+        params.numSids = 0;
+    }
+
+Exit:
+    if (NULL != lsa)
+        ccDcerpcDisconnect(lsa);
+    TRCE();
+}
+
 #endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
 #endif /* UD_CS_INCLUDEPASSTHROUGH */
 
@@ -1346,6 +1470,10 @@ resolveSid(
 {
     NQ_UINT16 type;     /* the result */
 
+    /* recently resolved SIDs */
+    if (cmSdCacheFindSid(sid, staticData->nameW, staticData->txtBufferT, &type))
+        return type;
+
 #ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
     if (NULL != sidHasLocalDomain(sid))
     {
@@ -1356,9 +1484,13 @@ resolveSid(
         domainName = sidHasLocalDomain(sid);
         type = (NQ_UINT16)cmSdGetRidType(rid);
         if (!cmSdLookupRid(rid, staticData->txtBufferT, staticData->fullNameT))
+        {
+            cmSdCacheAdd(sid, NULL, NULL, CM_SD_RIDTYPE_UNKNOWN);
             return CM_SD_RIDTYPE_UNKNOWN;
+        }
         syWStrcpy(staticData->nameW, staticData->txtBufferT);
         syAnsiToUnicode(staticData->txtBufferT, domainName);
+        cmSdCacheAdd(sid, staticData->nameW, staticData->txtBufferT, type);
     }
     else
     {
@@ -1372,49 +1504,9 @@ resolveSid(
         }
         else
         {
-            const NQ_CHAR *dc;                  /* DC name */
-            NQ_WCHAR * dcW;                     /* DC NQ_WCHAR name*/
-            NQ_HANDLE lsa;                      /* LSA open handle */
-            LookupSids2Params params;           /* callback parameters for domain SIDs */
-
-            dc = csAuthGetPDCName();
-            if (dc == NULL)
-            {
-                TRCERR("Could not obtain PDC name");
-                TRCE();
-                return FALSE;
-            }
-            syAnsiToUnicode(staticData->txtBufferT, dc);
-            dcW = (NQ_WCHAR *)cmMemoryAllocate((NQ_UINT)(sizeof(NQ_WCHAR) * (syWStrlen(staticData->txtBufferT) + 1)));
-            if (NULL == dcW)
-            {
-                TRCERR("Out of memory");
-                TRCE();
-                return 1;
-            }
-            syWStrcpy(dcW, staticData->txtBufferT);
-
-            lsa = ccDcerpcConnect(dcW, NULL, ccLsaGetPipe(), FALSE);
-            cmMemoryFree(dcW);
-            if (lsa == NULL)
-            {
-                TRCERR("Unable to open LSA on PDC");
-                TRCE();
-                return 1;
-            }
-            /* prepare parameters */
-			params.sid = sid;
-			params.requestCount = 1;
-            ccLsaLookupSids(
-                lsa,
-                (CCLsaLookupSidsRequestCallback)lookupSids2RequestCallback,
-                (CCLsaLookupSidsDomainsCallback)lookupSids2DomainsCallback,
-                (CCLsaLookupSidsNamesCallback)lookupSids2NamesCallback,
-                1,
-                (NQ_BYTE *)&params
-                );
-            ccDcerpcDisconnect(lsa);
-            type = (NQ_UINT16)(params.requestCount == 1? params.type : CM_SD_RIDTYPE_UNKNOWN);
+            lookupDomainSids(sid, 1);
+            if (!cmSdCacheFindSid(sid, staticData->nameW, staticData->txtBufferT, &type))
+                type = CM_SD_RIDTYPE_UNKNOWN;
         }
 #endif /* UD_CS_INCLUDEPASSTHROUGH */
 #ifdef UD_CS_INCLUDELOCALUSERMANAGEMENT
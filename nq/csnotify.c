@@ -22,9 +22,14 @@
 #include "csnttran.h"
 #include "csdataba.h"
 #include "csparams.h"
+#include "csutils.h"
 #ifdef UD_NQ_INCLUDESMB2
 #include "cs2notify.h"
+#include "csbreak.h"
 #endif /* UD_NQ_INCLUDESMB2 */
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+#include "cmmemory.h"
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
 
 
 #ifdef UD_NQ_INCLUDECIFSSERVER
@@ -42,6 +47,14 @@
     a one command boundary. This means, in particular, that NT_CANCEL always cancels a
     notification and never "hurries it up". All notified files are expected to reside in the
     same directory.
+
+    With UD_CS_INCLUDENOTIFYWATCH the directory of each notify request is also watched by
+    the OS (syFileWatchXXX). Changes made outside of the server are collected per directory,
+    coalesced and delivered from the server loop (csNotifyWatchPoll) once they settle for
+    a second. SMB2 requests receive FILE_NOTIFY_INFORMATION records, SMB1 requests receive
+    the same empty response as above. The OS watch is not recursive: for a WATCH_TREE request
+    every subdirectory is watched as well, and directories created or moved in later are added
+    as they are reported (up to WATCH_MAXWATCHES).
  */
 
 /*
@@ -49,6 +62,32 @@
     -------------------------
  */
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+
+#define WATCH_HASHSIZE      1024    /* number of hash buckets, power of two */
+#define WATCH_MAXWATCHES    8192    /* maximum number of watched directories */
+#define WATCH_MAXCHANGES    64      /* changes kept per directory, more are reported as overflow */
+#define WATCH_IDLETIME      60      /* seconds to keep watching a directory without requests */
+
+/* watched directory */
+typedef struct _Watch
+{
+    struct _Watch* nextByWd;        /* next in the watch descriptor chain */
+    struct _Watch* nextByPath;      /* next in the path hash chain */
+    NQ_INT wd;                      /* watch descriptor */
+    NQ_UINT32 pathHash;             /* hash of the path */
+    NQ_UINT32 lastUsed;             /* time when a request was pending on this directory */
+    NQ_UINT32 firstChange;          /* time of the oldest undelivered change */
+    NQ_COUNT numChanges;            /* number of undelivered changes */
+    NQ_BOOL overflow;               /* TRUE when changes were lost */
+    NQ_BOOL tree;                   /* TRUE when subdirectories are watched too */
+    CSNotifyChange* changes;        /* undelivered changes, allocated on the first change */
+    NQ_WCHAR path[1];               /* full directory path (variable length) */
+}
+Watch;
+
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
 typedef struct
 {
     NQ_BYTE notifyResponse[CM_NB_DATAGRAMBUFFERSIZE - sizeof(CMCifsHeader)];/* buffer for notify response */
@@ -64,6 +103,15 @@ typedef struct
     NQ_UINT32 completionFilter;              /* value to match the request (the same for all entries) */
     NQ_BOOL notifyPending;                   /* TRUE when notify information is ready to be sent */
     NQ_UINT32 action;                        /* action to notify */
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+    SYFileWatch fileWatch;                   /* OS directory watch */
+    Watch* watchesByWd[WATCH_HASHSIZE];              /* watched directories by watch descriptor */
+    Watch* watchesByPath[WATCH_HASHSIZE];            /* watched directories by path hash */
+    NQ_COUNT numWatches;                     /* number of watched directories */
+    NQ_COUNT numChanged;                     /* number of watched directories with undelivered changes */
+    NQ_UINT32 lastExpire;                    /* time of the last idle watch expiration */
+    NQ_WCHAR prefix[UD_FS_FILENAMELEN + 1];  /* relative path for a recursive request */
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
 }
 StaticData;
 
@@ -74,6 +122,13 @@ static StaticData staticDataSrc;
 static StaticData* staticData = &staticDataSrc;
 #endif /* SY_FORCEALLOCATION */
 
+static void finalizeResponse(void);                         /* fix NT_TRANSACT fields of SMB1 response */
+static void sendResponse(CSFile* pFile, NQ_UINT32 status);  /* send SMB1 response to a pending request */
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+static void removeWatch(Watch* watch);                      /* stop watching a directory */
+static Watch* addWatch(const NQ_WCHAR* path, NQ_BOOL tree, NQ_UINT32 now);  /* start watching a directory */
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
 /*====================================================================
  * PURPOSE: initialize resources
  *--------------------------------------------------------------------
@@ -106,6 +161,20 @@ csNotifyInit(
     staticData->pathSet = FALSE;
     staticData->notifyPending = FALSE;
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+    syMemset(staticData->watchesByWd, 0, sizeof(staticData->watchesByWd));
+    syMemset(staticData->watchesByPath, 0, sizeof(staticData->watchesByPath));
+    staticData->numWatches = 0;
+    staticData->numChanged = 0;
+    staticData->lastExpire = (NQ_UINT32)syGetTimeInSec();
+    staticData->fileWatch = syFileWatchOpen();
+    if (!syIsValidFileWatch(staticData->fileWatch))
+    {
+        /* not fatal, only changes made by this server will be notified */
+        TRCERR("Unable to open directory watch");
+    }
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
 #ifdef UD_NQ_INCLUDESMB2
     if (NQ_SUCCESS != cs2NotifyInit())
         return NQ_FAIL;
@@ -132,6 +201,21 @@ csNotifyExit(
 {
     TRCB();
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+    if (NULL != staticData)
+    {
+        NQ_INT i;
+
+        for (i = 0; i < WATCH_HASHSIZE; i++)
+        {
+            while (staticData->watchesByWd[i] != NULL)
+                removeWatch(staticData->watchesByWd[i]);
+        }
+        if (syIsValidFileWatch(staticData->fileWatch))
+            syFileWatchClose(staticData->fileWatch);
+    }
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
     /* release memory */
 #ifdef SY_FORCEALLOCATION
     if (NULL != staticData)
@@ -285,6 +369,9 @@ csNtTransactionNotifyChange(
             TRCE();
             return csErrorReturn(SMB_STATUS_DELETE_PENDING, DOS_ERRbadfid);
         }
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+        csNotifyWatch(pName->name, notifyRequest->watchTree != 0);
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
     }
 
     /* write request information into the file descriptor */
@@ -473,41 +560,22 @@ csNotifyFile(
 }
 
 /*====================================================================
- * PURPOSE: Send notification info gathered so far
+ * PURPOSE: Fix NT_TRANSACT fields of the SMB1 response
  *--------------------------------------------------------------------
  * PARAMS:  None
  *
- * RETURNS: None (errors are ignored)
+ * RETURNS: None
  *
- * NOTES:   scan all directories with notify request and match directory as a
- *          a part of the notify path.
+ * NOTES:   file information gathered so far is included
  *====================================================================
  */
 
 static void
-csNotifySend(
+finalizeResponse(
     void
     )
 {
-    CSFile* nextDir;        /* open directory descriptor */
-    CSName* pName;          /* descriptor of this directory's file */
-    NQ_COUNT dataLen;       /* number of bytes to send */
     CMCifsNtTransactionFileNotify* pFileInfo;   /* casted pointer to the last file info */
-    NSSocketHandle savedSocket; /* saved socket */
-
-    TRCB();
-
-#ifdef UD_NQ_INCLUDESMB2
-    cs2NotifySend();
-#endif /* UD_NQ_INCLUDESMB2 */
-
-    if (!staticData->notifyPending)
-    {
-        TRCE();
-        return;
-    }
-
-    /* fix NT_TRANSACT fields */
 
     if (staticData->pFirstFileInfo != NULL)
     {
@@ -532,6 +600,74 @@ csNotifySend(
             cmPutSUint32(pFileInfo->nextEntryOffset, 0);
         }
     }
+}
+
+/*====================================================================
+ * PURPOSE: Send the SMB1 response to a pending notify request
+ *--------------------------------------------------------------------
+ * PARAMS:  IN directory with a pending request
+ *          IN response status
+ *
+ * RETURNS: None (errors are ignored)
+ *
+ * NOTES:   the request is cleared, the caller restores the socket
+ *====================================================================
+ */
+
+static void
+sendResponse(
+    CSFile* pFile,
+    NQ_UINT32 status
+    )
+{
+    NQ_COUNT dataLen;       /* number of bytes to send */
+
+    csDispatchSetSocket(pFile->notifyContext.socket);
+    csDispatchPrepareLateResponse(&pFile->notifyContext);
+    dataLen = (NQ_COUNT)(staticData->pNextFileInfo - staticData->notifyResponse);
+    syMemcpy(pFile->notifyContext.commandData, staticData->notifyResponse, dataLen);
+    if (!csDispatchSendLateResponse(&pFile->notifyContext, status, dataLen))
+    {
+        TRCERR("Error sending NOTIFY CHANGE response");
+    }
+    /* clear notify request */
+    pFile->notifyPending = FALSE;
+}
+
+/*====================================================================
+ * PURPOSE: Send notification info gathered so far
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: None (errors are ignored)
+ *
+ * NOTES:   scan all directories with notify request and match directory as a
+ *          a part of the notify path.
+ *====================================================================
+ */
+
+static void
+csNotifySend(
+    void
+    )
+{
+    CSFile* nextDir;        /* open directory descriptor */
+    CSName* pName;          /* descriptor of this directory's file */
+    NSSocketHandle savedSocket; /* saved socket */
+
+    TRCB();
+
+#ifdef UD_NQ_INCLUDESMB2
+    cs2NotifySend();
+#endif /* UD_NQ_INCLUDESMB2 */
+
+    if (!staticData->notifyPending)
+    {
+        TRCE();
+        return;
+    }
+
+    finalizeResponse();
 
     /* save socket */
     savedSocket = csDispatchGetSocket();
@@ -593,20 +729,10 @@ csNotifySend(
         if (NULL != pSess && pSess->dialect == CS_DIALECT_SMB1)
         {
 #endif /* UD_NQ_INCLUDESMB2 */
-            csDispatchSetSocket(nextDir->notifyContext.socket);
-            csDispatchPrepareLateResponse(&nextDir->notifyContext);
-            dataLen = (NQ_COUNT)(staticData->pNextFileInfo - staticData->notifyResponse);
-            syMemcpy(nextDir->notifyContext.commandData, staticData->notifyResponse, dataLen);
-            if (!csDispatchSendLateResponse(
-                &nextDir->notifyContext, 
-                ((staticData->action & SMB_NOTIFYCHANGE_ACTIONMASK) == SMB_NOTIFYCHANGE_REMOVED)? SMB_STATUS_DELETE_PENDING : 0, 
-                dataLen)
-               )
-            {
-                TRCERR("Error sending NOTIFY CHANGE response");
-            }
-            /* clear notify request */
-            nextDir->notifyPending = FALSE;
+            sendResponse(
+                nextDir,
+                ((staticData->action & SMB_NOTIFYCHANGE_ACTIONMASK) == SMB_NOTIFYCHANGE_REMOVED)? SMB_STATUS_DELETE_PENDING : 0
+                );
 #ifdef UD_NQ_INCLUDESMB2
         }
 #endif /* UD_NQ_INCLUDESMB2 */
@@ -644,6 +770,9 @@ csNotifyImmediatelly(
 {
     TRCB();
 
+#ifdef UD_NQ_INCLUDESMB2
+    csBreakParentLease(fileName);   /* cached directory contents are stale */
+#endif /* UD_NQ_INCLUDESMB2 */
     csNotifyStart(filter);
     csNotifyFile(fileName, SMB_NOTIFYCHANGE_MODIFIED, TRUE);  /* notify parent folder */
     csNotifyEnd();
@@ -656,5 +785,772 @@ csNotifyImmediatelly(
     TRCE();
 }
 
-#endif /* UD_NQ_INCLUDECIFSSERVER */
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+
+#define WATCH_HOLDTIME      5       /* seconds to keep changes that no request was pending for */
+
+/*====================================================================
+ * PURPOSE: calculate hash of a directory path
+ *--------------------------------------------------------------------
+ * PARAMS:  IN full path
+ *
+ * RETURNS: hash value
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static NQ_UINT32
+hashPath(
+    const NQ_WCHAR* path
+    )
+{
+    NQ_UINT32 hash = 5381;      /* djb2 */
+
+    for (; *path != 0; path++)
+        hash = (hash << 5) + hash + (NQ_UINT32)*path;
+    return hash;
+}
+
+/*====================================================================
+ * PURPOSE: find a watched directory by its path
+ *--------------------------------------------------------------------
+ * PARAMS:  IN full path
+ *          IN path hash
+ *
+ * RETURNS: pointer to the watch or NULL
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static Watch*
+findWatchByPath(
+    const NQ_WCHAR* path,
+    NQ_UINT32 hash
+    )
+{
+    Watch* watch;       /* next watch in the chain */
+
+    for (watch = staticData->watchesByPath[hash & (WATCH_HASHSIZE - 1)]; watch != NULL; watch = watch->nextByPath)
+    {
+        if (watch->pathHash == hash && syWStrcmp(watch->path, path) == 0)
+            return watch;
+    }
+    return NULL;
+}
+
+/*====================================================================
+ * PURPOSE: find a watched directory by its watch descriptor
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch descriptor
+ *
+ * RETURNS: pointer to the watch or NULL
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static Watch*
+findWatchByWd(
+    NQ_INT wd
+    )
+{
+    Watch* watch;       /* next watch in the chain */
+
+    for (watch = staticData->watchesByWd[(NQ_UINT)wd & (WATCH_HASHSIZE - 1)]; watch != NULL; watch = watch->nextByWd)
+    {
+        if (watch->wd == wd)
+            return watch;
+    }
+    return NULL;
+}
+
+/*====================================================================
+ * PURPOSE: discard undelivered changes of a watched directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the change buffer itself is kept for reuse
+ *====================================================================
+ */
+
+static void
+clearChanges(
+    Watch* watch
+    )
+{
+    NQ_COUNT i;
+
+    if (watch->numChanges == 0 && !watch->overflow)
+        return;
+    for (i = 0; i < watch->numChanges; i++)
+        cmMemoryFree(watch->changes[i].name);
+    watch->numChanges = 0;
+    watch->overflow = FALSE;
+    staticData->numChanged--;
+}
+
+/*====================================================================
+ * PURPOSE: mark a watched directory as having undelivered changes
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch
+ *          IN current time
+ *
+ * RETURNS: None
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+markChanged(
+    Watch* watch,
+    NQ_UINT32 now
+    )
+{
+    if (watch->numChanges == 0 && !watch->overflow)
+    {
+        watch->firstChange = now;
+        staticData->numChanged++;
+    }
+}
+
+/*====================================================================
+ * PURPOSE: stop watching a directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch
+ *
+ * RETURNS: None
+ *
+ * NOTES:   the watch is unlinked and released
+ *====================================================================
+ */
+
+static void
+removeWatch(
+    Watch* watch
+    )
+{
+    Watch** pLink;      /* pointer to the link to this watch */
+
+    for (pLink = &staticData->watchesByWd[(NQ_UINT)watch->wd & (WATCH_HASHSIZE - 1)]; *pLink != NULL; pLink = &(*pLink)->nextByWd)
+    {
+        if (*pLink == watch)
+        {
+            *pLink = watch->nextByWd;
+            break;
+        }
+    }
+    for (pLink = &staticData->watchesByPath[watch->pathHash & (WATCH_HASHSIZE - 1)]; *pLink != NULL; pLink = &(*pLink)->nextByPath)
+    {
+        if (*pLink == watch)
+        {
+            *pLink = watch->nextByPath;
+            break;
+        }
+    }
+
+    syFileWatchRemove(staticData->fileWatch, watch->wd);
+    clearChanges(watch);
+    if (watch->changes != NULL)
+        cmMemoryFree(watch->changes);
+    cmMemoryFree(watch);
+    staticData->numWatches--;
+}
+
+/*====================================================================
+ * PURPOSE: stop watching directories that no request was pending for
+ *--------------------------------------------------------------------
+ * PARAMS:  IN current time
+ *
+ * RETURNS: None
+ *
+ * NOTES:   directories with pending requests are refreshed first
+ *====================================================================
+ */
+
+static void
+expireWatches(
+    NQ_UINT32 now
+    )
+{
+    CSFile* nextDir;        /* open directory descriptor */
+    CSName* pName;          /* descriptor of this directory's file */
+    Watch* watch;           /* next watch */
+    Watch* next;            /* watch after it */
+    NQ_INT i;
+
+    staticData->lastExpire = now;
+
+    csStartNotifyRequestSearch();
+    while ((nextDir = csEnumerateNotifyRequest()) != NULL)
+    {
+        NQ_COUNT dirLen;    /* request directory path length */
+
+        pName = csGetNameByNid(nextDir->nid);
+        if (pName == NULL)
+            continue;
+        if ((watch = findWatchByPath(pName->name, hashPath(pName->name))) != NULL)
+            watch->lastUsed = now;
+        if (!nextDir->notifyTree)
+            continue;
+
+        /* subdirectories watched for a recursive request */
+        dirLen = syWStrlen(pName->name);
+        for (i = 0; i < WATCH_HASHSIZE; i++)
+        {
+            for (watch = staticData->watchesByWd[i]; watch != NULL; watch = watch->nextByWd)
+            {
+                if (syWStrncmp(watch->path, pName->name, dirLen) == 0 && watch->path[dirLen] == cmWChar(SY_PATHSEPARATOR))
+                    watch->lastUsed = now;
+            }
+        }
+    }
+
+    for (i = 0; i < WATCH_HASHSIZE; i++)
+    {
+        for (watch = staticData->watchesByWd[i]; watch != NULL; watch = next)
+        {
+            next = watch->nextByWd;
+            if (now - watch->lastUsed >= WATCH_IDLETIME)
+                removeWatch(watch);
+        }
+    }
+}
+
+/*====================================================================
+ * PURPOSE: record one change in a watched directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch
+ *          IN SY_FILEWATCH_xxx event
+ *          IN entry name
+ *          IN current time
+ *
+ * RETURNS: None
+ *
+ * NOTES:   repeated changes are coalesced, changes that do not fit turn
+ *          into overflow
+ *====================================================================
+ */
+
+static void
+addChange(
+    Watch* watch,
+    NQ_UINT32 event,
+    const NQ_WCHAR* name,
+    NQ_UINT32 now
+    )
+{
+    CSNotifyChange* change; /* next change */
+    NQ_UINT32 action;       /* SMB action */
+    NQ_COUNT i;
+
+    switch (event & ~SY_FILEWATCH_ISDIRECTORY)
+    {
+        case SY_FILEWATCH_ADDED:
+            action = SMB_NOTIFYCHANGE_ADDED;
+            break;
+        case SY_FILEWATCH_REMOVED:
+            action = SMB_NOTIFYCHANGE_REMOVED;
+            break;
+        case SY_FILEWATCH_MODIFIED:
+            action = SMB_NOTIFYCHANGE_MODIFIED;
+            break;
+        case SY_FILEWATCH_RENAMEDOLD:
+            action = SMB_NOTIFYCHANGE_RENAMEDOLDNAME;
+            break;
+        case SY_FILEWATCH_RENAMEDNEW:
+            action = SMB_NOTIFYCHANGE_RENAMEDNEWNAME;
+            break;
+        default:
+            return;
+    }
+    if (event & SY_FILEWATCH_ISDIRECTORY)
+        action |= SMB_NOTIFYCHANGE_ISDIRECTORY;
+
+    /* changes of the directory itself are reported to its parent */
+    if (*name == 0)
+        return;
+
+    markChanged(watch, now);
+    if (watch->overflow)
+        return;
+
+    for (i = 0; i < watch->numChanges; i++)
+    {
+        change = &watch->changes[i];
+        if (syWStrcmp(change->name, name) != 0)
+            continue;
+        if (change->action == action)
+            return;
+        if ((action & SMB_NOTIFYCHANGE_ACTIONMASK) == SMB_NOTIFYCHANGE_MODIFIED &&
+            ((change->action & SMB_NOTIFYCHANGE_ACTIONMASK) == SMB_NOTIFYCHANGE_ADDED ||
+             (change->action & SMB_NOTIFYCHANGE_ACTIONMASK) == SMB_NOTIFYCHANGE_RENAMEDNEWNAME))
+            return;
+    }
+
+    if (watch->changes == NULL)
+        watch->changes = (CSNotifyChange*)cmMemoryAllocate(WATCH_MAXCHANGES * sizeof(CSNotifyChange));
+    if (watch->changes == NULL || watch->numChanges >= WATCH_MAXCHANGES)
+        goto Overflow;
+    change = &watch->changes[watch->numChanges];
+    change->name = cmMemoryCloneWString(name);
+    if (change->name == NULL)
+        goto Overflow;
+    change->action = action;
+    watch->numChanges++;
+    return;
+
+Overflow:
+    for (i = 0; i < watch->numChanges; i++)
+        cmMemoryFree(watch->changes[i].name);
+    watch->numChanges = 0;
+    watch->overflow = TRUE;
+}
+
+/*====================================================================
+ * PURPOSE: deliver changes of a watched directory to pending requests
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch
+ *
+ * RETURNS: TRUE when at least one request was completed
+ *
+ * NOTES:   requests on the directory itself and recursive requests on
+ *          its ancestors are completed
+ *====================================================================
+ */
+
+static NQ_BOOL
+deliverChanges(
+    Watch* watch
+    )
+{
+    CSFile* nextDir;            /* open directory descriptor */
+    CSName* pName;              /* descriptor of this directory's file */
+    NSSocketHandle savedSocket; /* saved socket */
+    NQ_COUNT pathLen;           /* watched path length */
+    NQ_BOOL delivered = FALSE;  /* return value */
+
+    if (staticData->headerSet)
+    {
+        /* SMB1 clients get an empty response, see csNotifyFile() */
+        staticData->pNextFileInfo = staticData->pFirstFileInfo;
+        staticData->pPrevFileInfo = NULL;
+        finalizeResponse();
+    }
+
+    pathLen = syWStrlen(watch->path);
+    savedSocket = csDispatchGetSocket();
+
+    csStartNotifyRequestSearch();
+    while ((nextDir = csEnumerateNotifyRequest()) != NULL)
+    {
+        const NQ_WCHAR* prefix = NULL;  /* watched path relative to the request directory */
+        NQ_COUNT dirLen;                /* request directory path length */
+        NQ_BOOL matched;                /* some change matches the completion filter */
+        NQ_COUNT i;
+#ifdef UD_NQ_INCLUDESMB2
+        CSSession * pSess;              /* to distinguish between SMB1 and SMB2 */
+#endif /* UD_NQ_INCLUDESMB2 */
+
+        pName = csGetNameByNid(nextDir->nid);
+        if (pName == NULL)
+            continue;
+
+        dirLen = syWStrlen(pName->name);
+        if (dirLen > pathLen || syWStrncmp(watch->path, pName->name, dirLen) != 0)
+            continue;
+        if (dirLen < pathLen)
+        {
+            NQ_WCHAR* p;
+
+            if (!nextDir->notifyTree || watch->path[dirLen] != cmWChar(SY_PATHSEPARATOR))
+                continue;
+            syWStrncpy(staticData->prefix, watch->path + dirLen + 1, UD_FS_FILENAMELEN);
+            staticData->prefix[UD_FS_FILENAMELEN] = 0;
+            for (p = staticData->prefix; *p != 0; p++)
+            {
+                if (*p == cmWChar(SY_PATHSEPARATOR))
+                    *p = cmWChar('\\');
+            }
+            prefix = staticData->prefix;
+        }
+
+#ifdef UD_NQ_INCLUDESMB2
+        pSess = csGetSessionById(nextDir->session);
+        if (NULL != pSess && pSess->dialect != CS_DIALECT_SMB1)
+        {
+            if (cs2NotifySendChanges(nextDir, prefix, watch->changes, watch->numChanges, watch->overflow))
+                delivered = TRUE;
+            continue;
+        }
+#endif /* UD_NQ_INCLUDESMB2 */
+
+        if (!staticData->headerSet)
+            continue;
+        matched = watch->overflow;
+        for (i = 0; !matched && i < watch->numChanges; i++)
+            matched = (nextDir->notifyFilter & csNotifyChangeFilter(watch->changes[i].action)) != 0;
+        if (matched)
+        {
+            sendResponse(nextDir, 0);
+            delivered = TRUE;
+        }
+    }
+
+    /* restore socket */
+    csDispatchSetSocket(savedSocket);
+
+    return delivered;
+}
+
+/*====================================================================
+ * PURPOSE: completion filter bits matching a change
+ *--------------------------------------------------------------------
+ * PARAMS:  IN SMB action with the directory flag
+ *
+ * RETURNS: SMB_NOTIFYCHANGE_xxx filter bits
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+NQ_UINT32
+csNotifyChangeFilter(
+    NQ_UINT32 action
+    )
+{
+    if ((action & SMB_NOTIFYCHANGE_ACTIONMASK) == SMB_NOTIFYCHANGE_MODIFIED)
+    {
+        return SMB_NOTIFYCHANGE_ATTRIBUTES | SMB_NOTIFYCHANGE_SIZE | SMB_NOTIFYCHANGE_LAST_WRITE |
+               SMB_NOTIFYCHANGE_LAST_ACCESS | SMB_NOTIFYCHANGE_CREATION | SMB_NOTIFYCHANGE_EA | SMB_NOTIFYCHANGE_SECURITY;
+    }
+    return (action & SMB_NOTIFYCHANGE_ISDIRECTORY) ? SMB_NOTIFYCHANGE_DIRNAME : SMB_NOTIFYCHANGE_FILENAME;
+}
+
+/*====================================================================
+ * PURPOSE: watch the subdirectories of a directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN full path to a watched directory
+ *          IN current time
+ *
+ * RETURNS: None (errors are ignored)
+ *
+ * NOTES:   called through addWatch() for each level of the tree
+ *====================================================================
+ */
+
+static void
+watchSubdirectories(
+    const NQ_WCHAR* path,
+    NQ_UINT32 now
+    )
+{
+    SYDirectory dir;                /* directory descriptor */
+    const NQ_WCHAR* name;           /* next entry name */
+    NQ_COUNT pathLen;               /* directory path length */
+    NQ_STATUS status;               /* operation status */
+
+    pathLen = syWStrlen(path);
+    if (syFirstDirectoryFile(path, &dir, &name) != NQ_SUCCESS)
+        return;
+    status = NQ_SUCCESS;
+    while (status == NQ_SUCCESS && name != NULL && staticData->numWatches < WATCH_MAXWATCHES)
+    {
+        SYFileInformation fileInfo; /* entry information */
+        NQ_WCHAR* subPath;          /* subdirectory path */
+
+        /* skip "." and ".." */
+        if (name[0] == cmWChar('.') && (name[1] == 0 || (name[1] == cmWChar('.') && name[2] == 0)))
+        {
+            status = syNextDirectoryFile(dir, &name);
+            continue;
+        }
+        subPath = (NQ_WCHAR*)cmMemoryAllocate((NQ_UINT)((pathLen + syWStrlen(name) + 2) * sizeof(NQ_WCHAR)));
+        if (subPath == NULL)
+        {
+            TRCERR("Out of memory");
+            break;
+        }
+        syWStrcpy(subPath, path);
+        subPath[pathLen] = cmWChar(SY_PATHSEPARATOR);
+        syWStrcpy(subPath + pathLen + 1, name);
+        if (syGetFileInformationByName(subPath, &fileInfo) == NQ_SUCCESS && (fileInfo.attributes & SY_ATTR_DIRECTORY))
+            addWatch(subPath, TRUE, now);
+        cmMemoryFree(subPath);
+        status = syNextDirectoryFile(dir, &name);
+    }
+    syCloseDirectory(dir);
+}
 
+/*====================================================================
+ * PURPOSE: start watching a directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN full path to a directory
+ *          IN TRUE to watch its subdirectories too
+ *          IN current time
+ *
+ * RETURNS: the watch or NULL when the directory cannot be watched
+ *
+ * NOTES:   a directory already watched is only refreshed
+ *====================================================================
+ */
+
+static Watch*
+addWatch(
+    const NQ_WCHAR* path,
+    NQ_BOOL tree,
+    NQ_UINT32 now
+    )
+{
+    Watch* watch;           /* watched directory */
+    NQ_UINT32 hash;         /* path hash */
+    NQ_INT wd;              /* watch descriptor */
+
+    hash = hashPath(path);
+    watch = findWatchByPath(path, hash);
+    if (watch != NULL)
+    {
+        watch->lastUsed = now;
+        if (tree && !watch->tree)
+        {
+            watch->tree = TRUE;
+            watchSubdirectories(watch->path, now);
+        }
+        return watch;
+    }
+
+    if (staticData->numWatches >= WATCH_MAXWATCHES)
+    {
+        expireWatches(now);
+        if (staticData->numWatches >= WATCH_MAXWATCHES)
+        {
+            TRCERR("Too many watched directories");
+            return NULL;
+        }
+    }
+
+    wd = syFileWatchAdd(staticData->fileWatch, path);
+    if (wd == NQ_FAIL)
+    {
+        TRCERR("Unable to watch directory");
+        TRC1P("  path %s", cmWDump(path));
+        return NULL;
+    }
+
+    /* another path to the same directory is already watched */
+    if ((watch = findWatchByWd(wd)) != NULL)
+    {
+        return watch;
+    }
+
+    watch = (Watch*)cmMemoryAllocate((NQ_UINT)(sizeof(Watch) + syWStrlen(path) * sizeof(NQ_WCHAR)));
+    if (watch == NULL)
+    {
+        syFileWatchRemove(staticData->fileWatch, wd);
+        TRCERR("Out of memory");
+        return NULL;
+    }
+    syWStrcpy(watch->path, path);
+    watch->wd = wd;
+    watch->pathHash = hash;
+    watch->lastUsed = now;
+    watch->numChanges = 0;
+    watch->overflow = FALSE;
+    watch->tree = tree;
+    watch->changes = NULL;
+    watch->nextByWd = staticData->watchesByWd[(NQ_UINT)wd & (WATCH_HASHSIZE - 1)];
+    staticData->watchesByWd[(NQ_UINT)wd & (WATCH_HASHSIZE - 1)] = watch;
+    watch->nextByPath = staticData->watchesByPath[hash & (WATCH_HASHSIZE - 1)];
+    staticData->watchesByPath[hash & (WATCH_HASHSIZE - 1)] = watch;
+    staticData->numWatches++;
+
+    if (tree)
+        watchSubdirectories(watch->path, now);
+
+    return watch;
+}
+
+/*====================================================================
+ * PURPOSE: watch a subdirectory reported in a recursively watched one
+ *--------------------------------------------------------------------
+ * PARAMS:  IN watch of the parent directory
+ *          IN subdirectory name
+ *          IN current time
+ *
+ * RETURNS: None (errors are ignored)
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+watchNewSubdirectory(
+    const Watch* parent,
+    const NQ_WCHAR* name,
+    NQ_UINT32 now
+    )
+{
+    NQ_WCHAR* subPath;      /* subdirectory path */
+    NQ_COUNT pathLen;       /* parent path length */
+
+    pathLen = syWStrlen(parent->path);
+    subPath = (NQ_WCHAR*)cmMemoryAllocate((NQ_UINT)((pathLen + syWStrlen(name) + 2) * sizeof(NQ_WCHAR)));
+    if (subPath == NULL)
+    {
+        TRCERR("Out of memory");
+        return;
+    }
+    syWStrcpy(subPath, parent->path);
+    subPath[pathLen] = cmWChar(SY_PATHSEPARATOR);
+    syWStrcpy(subPath + pathLen + 1, name);
+    addWatch(subPath, TRUE, now);
+    cmMemoryFree(subPath);
+}
+
+/*====================================================================
+ * PURPOSE: watch a directory for changes made outside of the server
+ *--------------------------------------------------------------------
+ * PARAMS:  IN full path to a directory with a pending notify request
+ *          IN TRUE for a recursive (WATCH_TREE) request
+ *
+ * RETURNS: None (errors are ignored)
+ *
+ * NOTES:   a directory already watched is only refreshed
+ *====================================================================
+ */
+
+void
+csNotifyWatch(
+    const NQ_WCHAR* path,
+    NQ_BOOL tree
+    )
+{
+    TRCB();
+
+    if (syIsValidFileWatch(staticData->fileWatch))
+        addWatch(path, tree, (NQ_UINT32)syGetTimeInSec());
+
+    TRCE();
+}
+
+/*====================================================================
+ * PURPOSE: deliver changes reported by the directory watch
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: None
+ *
+ * NOTES:   called from the server loop at least once a second while
+ *          csNotifyWatchActive() is TRUE. Changes are delivered one
+ *          second after the first of them so that bursts are reported
+ *          together.
+ *====================================================================
+ */
+
+void
+csNotifyWatchPoll(
+    void
+    )
+{
+    Watch* watch;               /* watched directory */
+    NQ_UINT32 now;              /* current time */
+    NQ_INT wd;                  /* watch descriptor */
+    NQ_UINT32 event;            /* SY_FILEWATCH_xxx event */
+    const NQ_WCHAR* name;       /* entry name */
+    NQ_INT i;
+
+    if (!syIsValidFileWatch(staticData->fileWatch) || staticData->numWatches == 0)
+        return;
+
+    TRCB();
+
+    now = (NQ_UINT32)syGetTimeInSec();
+
+    /* collect */
+    while (syFileWatchNext(staticData->fileWatch, &wd, &event, &name) == NQ_SUCCESS)
+    {
+        switch (event & ~SY_FILEWATCH_ISDIRECTORY)
+        {
+            case SY_FILEWATCH_OVERFLOW:
+                for (i = 0; i < WATCH_HASHSIZE; i++)
+                {
+                    for (watch = staticData->watchesByWd[i]; watch != NULL; watch = watch->nextByWd)
+                    {
+                        csInvalidateNameCache(watch->path);
+                        clearChanges(watch);
+                        markChanged(watch, now);
+                        watch->overflow = TRUE;
+                    }
+                }
+                break;
+            case SY_FILEWATCH_GONE:
+                if ((watch = findWatchByWd(wd)) != NULL)
+                    removeWatch(watch);
+                break;
+            default:
+                if ((watch = findWatchByWd(wd)) != NULL)
+                {
+                    /* the change may come from outside the server */
+                    csInvalidateNameCache(watch->path);
+                    addChange(watch, event, name, now);
+                    if (watch->tree && (event & SY_FILEWATCH_ISDIRECTORY) && *name != 0 &&
+                        ((event & ~SY_FILEWATCH_ISDIRECTORY) == SY_FILEWATCH_ADDED || (event & ~SY_FILEWATCH_ISDIRECTORY) == SY_FILEWATCH_RENAMEDNEW))
+                    {
+                        watchNewSubdirectory(watch, name, now);
+                    }
+                }
+                break;
+        }
+    }
+
+    /* deliver settled changes */
+    for (i = 0; staticData->numChanged > 0 && i < WATCH_HASHSIZE; i++)
+    {
+        for (watch = staticData->watchesByWd[i]; watch != NULL; watch = watch->nextByWd)
+        {
+            if ((watch->numChanges == 0 && !watch->overflow) || watch->firstChange == now)
+                continue;
+            if (deliverChanges(watch))
+            {
+                watch->lastUsed = now;
+                clearChanges(watch);
+            }
+            else if (now - watch->firstChange > WATCH_HOLDTIME)
+            {
+                clearChanges(watch);
+            }
+        }
+    }
+
+    if (now - staticData->lastExpire >= WATCH_IDLETIME / 4)
+        expireWatches(now);
+
+    TRCE();
+}
+
+/*====================================================================
+ * PURPOSE: whether some directory is being watched
+ *--------------------------------------------------------------------
+ * PARAMS:  None
+ *
+ * RETURNS: TRUE when the server should call csNotifyWatchPoll()
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+NQ_BOOL
+csNotifyWatchActive(
+    void
+    )
+{
+    return syIsValidFileWatch(staticData->fileWatch) && staticData->numWatches > 0;
+}
+
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
+#endif /* UD_NQ_INCLUDECIFSSERVER */
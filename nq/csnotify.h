@@ -46,6 +46,48 @@ csNotifyImmediatelly(
     NQ_UINT32 filter                /* filter */
     );
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+
+/* one change reported by the file watch */
+
+typedef struct
+{
+    NQ_UINT32 action;               /* SMB_NOTIFYCHANGE_xxx action with SMB_NOTIFYCHANGE_ISDIRECTORY for a directory */
+    NQ_WCHAR* name;                 /* entry name in the watched directory */
+}
+CSNotifyChange;
+
+/* completion filter bits matching a change */
+
+NQ_UINT32                           /* SMB_NOTIFYCHANGE_xxx filter bits */
+csNotifyChangeFilter(
+    NQ_UINT32 action                /* SMB_NOTIFYCHANGE_xxx action with the directory flag */
+    );
+
+/* watch a directory for changes made outside of the server */
+
+void
+csNotifyWatch(
+    const NQ_WCHAR* path,           /* full path to a directory with a pending notify request */
+    NQ_BOOL tree                    /* TRUE for a recursive (WATCH_TREE) request */
+    );
+
+/* deliver changes reported by the file watch to pending notify requests */
+
+void
+csNotifyWatchPoll(
+    void
+    );
+
+/* whether some directory is being watched */
+
+NQ_BOOL                             /* TRUE when the server should poll the watch */
+csNotifyWatchActive(
+    void
+    );
+
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
 #endif  /* _CSNOTIFY_H_ */
 
 
@@ -754,6 +754,7 @@ samrCreateUser2(
         TRCE();
         return CM_RP_FAULTLOGONFAILURE;
     }
+    cmSdCacheFlush();      /* forget unmapped SIDs */
     if (!udGetUserRidByName(staticData->txtBufferT, &rid))
     {
         TRCERR("User was not added");
@@ -2018,6 +2019,7 @@ samrDeleteUser(
         TRCE();
         return CM_RP_FAULTLOGONFAILURE;
     }
+    cmSdCacheFlush();      /* forget the deleted name */
 
     TRCE();
     return 0;
@@ -2228,6 +2230,7 @@ samrSetUserInfo(
             TRCE();
             return CM_RP_FAULTLOGONFAILURE;
         }
+        cmSdCacheFlush();  /* the name may have changed */
         break;
     case 23:
     {
@@ -2281,6 +2284,7 @@ samrSetUserInfo(
             TRCE();
             return CM_RP_FAULTLOGONFAILURE;
         }
+        cmSdCacheFlush();  /* the name may have changed */
         break;
     }
     default:
@@ -84,6 +84,9 @@ static NQ_BOOL changeEncryptLevel(CMBufferReader * reader, CMBufferWriter * writ
 static NQ_BOOL changeMsgSign(CMBufferReader * reader, CMBufferWriter * writer);
 #endif /*UD_CS_MESSAGESIGNINGPOLICY*/
 static NQ_BOOL enumFiles(CMBufferReader * reader, CMBufferWriter * writer);
+#ifdef CS_AUTH_ASYNCLOGON
+static NQ_BOOL completeLogons(CMBufferReader * reader, CMBufferWriter * writer);
+#endif /* CS_AUTH_ASYNCLOGON */
 
 static const ControlCommand controlCommands[] = 
 {
@@ -104,6 +107,9 @@ static const ControlCommand controlCommands[] =
     { CS_CONTROL_CHANGEMSGSIGN , changeMsgSign},
 #endif /*UD_CS_MESSAGESIGNINGPOLICY*/
     { CS_CONTROL_ENUMFILES , enumFiles},
+#ifdef CS_AUTH_ASYNCLOGON
+    { CS_CONTROL_LOGONDONE , completeLogons},
+#endif /* CS_AUTH_ASYNCLOGON */
 };
 
 typedef struct
@@ -277,6 +283,7 @@ serverCycle(
     NQ_INT ret;                 /* value returned from various calls */
     NQ_UINT idx;                /* index in the table of client sockets */
     NQ_UINT32 curTime;          /* current system time */
+    NQ_UINT32 selectTimeout;    /* select timeout in seconds */
     
     TRCB();
 
@@ -339,6 +346,12 @@ serverCycle(
         TRCE();
         return NQ_FAIL;
     }
+    if (NQ_FAIL == csInitNameCache())
+    {
+        releaseResources();
+        TRCE();
+        return NQ_FAIL;
+    }
 
 #ifdef UD_CS_INCLUDERPC
     if (NQ_FAIL == csDcerpcInit())
@@ -565,12 +578,17 @@ serverCycle(
         }
 
 #ifdef UD_NQ_USETRANSPORTNETBIOS
-        TRC1P("SERVER --->> Select, next timeout = %ld sec", staticData->nextAnnouncementInterval);
-        ret = nsSelect(&staticData->socketSet, staticData->nextAnnouncementInterval);
+        selectTimeout = staticData->nextAnnouncementInterval;
 #else /* UD_NQ_USETRANSPORTNETBIOS */
-        TRC("SERVER --->> Select, infinite");
-        ret = nsSelect(&staticData->socketSet, SMB_MAX_SERVER_ANNOUNCEMENT_INTERVAL);
+        selectTimeout = SMB_MAX_SERVER_ANNOUNCEMENT_INTERVAL;
 #endif /* UD_NQ_USETRANSPORTNETBIOS */
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+        /* poll directory changes once a second */
+        if (csNotifyWatchActive() && selectTimeout > 1)
+            selectTimeout = 1;
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+        TRC1P("SERVER --->> Select, next timeout = %ld sec", selectTimeout);
+        ret = nsSelect(&staticData->socketSet, selectTimeout);
 
         TRC1P("select returned: %d", ret);
 
@@ -582,7 +600,8 @@ serverCycle(
 #ifdef UD_NQ_USETRANSPORTNETBIOS
         /* Check for timeout and calculate the time to announce the server*/
 
-        if (ret == 0 || curTime >= (staticData->lastTimeout + staticData->nextAnnouncementInterval))       /* timeout */
+        if ((ret == 0 && selectTimeout == staticData->nextAnnouncementInterval) ||
+            curTime >= (staticData->lastTimeout + staticData->nextAnnouncementInterval))       /* timeout */
         {
             staticData->lastTimeout = curTime;
             if ((NQ_INT)(staticData->nextAnnouncementInterval = csAnnounceServer()) == NQ_FAIL)
@@ -593,6 +612,20 @@ serverCycle(
         }
 #endif /* UD_NQ_USETRANSPORTNETBIOS */
 
+#ifdef UD_CS_INCLUDENOTIFYWATCH
+        /* report changes made outside of the server */
+        syMutexTake(&staticData->dbGuard);
+        csNotifyWatchPoll();
+        syMutexGive(&staticData->dbGuard);
+#endif /* UD_CS_INCLUDENOTIFYWATCH */
+
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+        /* close durable opens nobody reconnected in time */
+        syMutexTake(&staticData->dbGuard);
+        csDurableScavenge();
+        syMutexGive(&staticData->dbGuard);
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
         /* on timeout do not continue */
         if (ret == 0)
             continue;
@@ -1123,6 +1156,7 @@ releaseResources(
 #ifdef UD_CS_INCLUDERPC
     csDcerpcStop();
 #endif /* UD_CS_INCLUDERPC */
+    csExitNameCache();
     csCloseDatabase();
     syMutexDelete(&staticData->dbGuard);
     if (!staticData->restart)
@@ -1742,6 +1776,20 @@ static NQ_BOOL changeEncryptLevel(CMBufferReader * reader, CMBufferWriter * writ
 	return TRUE;
 }
 
+#ifdef CS_AUTH_ASYNCLOGON
+/* sent by the logon thread when a pass-through logon completes */
+static NQ_BOOL completeLogons(CMBufferReader * reader, CMBufferWriter * writer)
+{
+    syMutexTake(&staticData->dbGuard);
+    csAuthCompleteLogons();
+    syMutexGive(&staticData->dbGuard);
+
+    cmBufferWriteUint32(writer, NQ_SUCCESS);
+
+    return TRUE;
+}
+#endif /* CS_AUTH_ASYNCLOGON */
+
 #ifdef UD_CS_MESSAGESIGNINGPOLICY
 static NQ_BOOL changeMsgSign(CMBufferReader * reader, CMBufferWriter * writer)
 {
@@ -300,7 +300,7 @@ csCreateMessageSignatureSMB3(
         {
         	if (!pUser->isGuest && ((pSession->signingOn && !pUser->isAnonymous) || (isPacketSigned)) && pUser->authenticated)
 			{
-        		cmSmb3CalculateMessageSignature(pUser->signingKey, sizeof(pUser->signingKey), pHeaderOut, dataLength, NULL, 0, pHeaderOut + SMB2_SECURITY_SIGNATURE_OFFSET);
+        		cmSmb3CalculateMessageSignature(csGetUserSigningKey(pUser), sizeof(pUser->signingKey), pHeaderOut, dataLength, NULL, 0, pHeaderOut + SMB2_SECURITY_SIGNATURE_OFFSET);
 			}
 			else
 			{
@@ -342,7 +342,7 @@ csCheckMessageSignatureSMB3(
 			syMemcpy(sigReceived, sig, sizeof(sigReceived));
 			syMemset(sig, 0, SMB2_SECURITY_SIGNATURE_SIZE);
 
-			cmSmb3CalculateMessageSignature(pUser->signingKey, sizeof(pUser->signingKey), pHeaderIn, dataLength, NULL, 0, sig);
+			cmSmb3CalculateMessageSignature(csGetUserSigningKey(pUser), sizeof(pUser->signingKey), pHeaderIn, dataLength, NULL, 0, sig);
 			result = syMemcmp(sigReceived, sig, 16) == 0;
             LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "signatures %s", result ? "match" : "not match");
             return result;
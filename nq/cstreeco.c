@@ -378,6 +378,7 @@ csComTreeConnect(
     /* fill tree information */
 
     pTree->share = pShare;
+    csEvaluateShareAccess(pTree);
 
     if (!pShare->ipcFlag)
     {
@@ -790,6 +791,7 @@ csComTreeConnectAndX(
         return csErrorReturn(SMB_STATUS_UNSUCCESSFUL, SRV_ERRerror);
     }
     pTree->share = pShare;
+    csEvaluateShareAccess(pTree);
 
     /* prepare the response */
 
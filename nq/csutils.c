@@ -34,6 +34,87 @@ findFileInPath(
     NQ_WCHAR* file              /* file name to look for (may have incorrect case) */
     );
 
+/* Name cache: when the client is not case-preserving each path component is
+   looked up ignoring case. For large directories the names are hashed by their
+   folded form so that each lookup is a hash probe instead of a directory scan.
+   A directory is remembered as large once a direct scan has passed
+   NAMECACHE_MINENTRIES names and its next scan collects the names into the index,
+   so that small directories are still scanned without allocations and a directory
+   is never read twice for one lookup. An index is dropped when the directory
+   changes and rebuilt by the next scan */
+
+#define NAMECACHE_NUMDIRS       16      /* number of directories with a name index */
+#define NAMECACHE_MINENTRIES    128     /* smaller directories are scanned directly */
+
+#define NAMECACHE_UNKNOWN       0       /* lookup result: cache could not be used */
+#define NAMECACHE_FOUND         1       /* lookup result: name found */
+#define NAMECACHE_NOTFOUND      2       /* lookup result: name does not exist */
+#define NAMECACHE_BUILD         3       /* lookup result: index the directory while scanning */
+
+typedef struct _cachedname
+{
+    struct _cachedname* next;   /* next name in the same bucket */
+    NQ_UINT32 hash;             /* folded name hash */
+    NQ_WCHAR name[1];           /* actual name - variable length */
+}
+CachedName;
+
+typedef struct
+{
+    NQ_WCHAR* path;             /* directory path in correct case or NULL for a free slot */
+    NQ_TIME modified;           /* directory modification time the index was built for */
+    NQ_UINT32 lastUsed;         /* usage stamp for replacement */
+    CachedName** buckets;       /* name index or NULL until the directory is scanned again */
+    NQ_COUNT numBuckets;        /* number of buckets (a power of two) */
+}
+CachedDirectory;
+
+typedef struct
+{
+    SYMutex guard;              /* cache protection */
+    NQ_BOOL isReady;            /* TRUE after initialization */
+    NQ_UINT32 useStamp;         /* incremented on each lookup */
+    CachedDirectory dirs[NAMECACHE_NUMDIRS];    /* cached directories */
+}
+NameCache;
+
+static NameCache nameCache;
+
+static NQ_INT
+lookupNameCache(
+    const NQ_WCHAR* path,       /* path to the containing directory (in correct case) */
+    NQ_WCHAR* file              /* file name to look for (may have incorrect case) */
+    );
+
+/* folded name hash and release of collected names */
+
+static NQ_UINT32
+hashFoldedName(
+    const NQ_WCHAR* name        /* name to hash */
+    );
+
+static void
+freeCachedNames(
+    CachedName* pName           /* first name in the list */
+    );
+
+/* remember a large directory after a direct scan */
+
+static void
+markNameCache(
+    const NQ_WCHAR* path        /* path to the directory (in correct case) */
+    );
+
+/* index the names collected while scanning a large directory */
+
+static void
+storeNameCache(
+    const NQ_WCHAR* path,       /* path to the directory (in correct case) */
+    const NQ_TIME* modified,    /* directory modification time before the scan */
+    CachedName* names,          /* all names in the directory */
+    NQ_COUNT numNames           /* number of names */
+    );
+
 /*
  *====================================================================
  * PURPOSE: create a socket and bind it to the host name
@@ -224,25 +305,64 @@ csCheckFile(
     NQ_WCHAR* pName,
     NQ_BOOL preservesCase
     )
+{
+    return csCheckFileAt(pShare, pName, preservesCase, syInvalidFile(), NULL);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: find the file (case insensitive) relative to its parent
+ *          directory and read its information
+ *--------------------------------------------------------------------
+ * PARAMS:  IN share pointer or NULL if we do not care of share type
+ *          IN/OUT pointer to the full path
+ *          IN whether client file system is case preserving
+ *          IN parent directory handle from csCheckPathAt() or invalid handle
+ *          OUT file information or NULL when not required
+ *
+ * RETURNS: TRUE if the file exists
+ *
+ * NOTES:   on TRUE the file information is valid so that the caller does
+ *          not have to stat the file again
+ *====================================================================
+ */
+
+NQ_BOOL
+csCheckFileAt(
+    const CSShare* pShare,
+    NQ_WCHAR* pName,
+    NQ_BOOL preservesCase,
+    SYFile dir,
+    SYFileInformation* pFileInfo
+    )
 {
     NQ_WCHAR* pSeparator;    /* pointer to the separator before the file name in the path */
     NQ_BOOL resValue;       /* the result value */
-    SYFileInformation fileInfo;     /* placeholder - value not used */
+    SYFileInformation fileInfo;     /* placeholder when the caller does not need the value */
+    NQ_BOOL infoRequired = pFileInfo != NULL;   /* whether file information should be returned */
 
     TRCB();
     
+    if (!infoRequired)
+        pFileInfo = &fileInfo;
+
     if (pShare != NULL && (pShare->ipcFlag || pShare->isPrintQueue))
     {
+        syMemset(pFileInfo, 0, sizeof(*pFileInfo));
         TRCE();
         return TRUE;
     }
+    pSeparator = syWStrrchr(pName, cmWChar(SY_PATHSEPARATOR));
     if (preservesCase || (pShare != NULL && 0==syWStrcmp(pShare->map, pName)))
     {
-        resValue =  syGetFileInformationByName(pName, &fileInfo) == NQ_SUCCESS;
+        if (syIsValidFile(dir) && pSeparator != NULL)
+            resValue = syGetFileInformationAt(dir, pSeparator + 1, pFileInfo) == NQ_SUCCESS;
+        else
+            resValue = syGetFileInformationByName(pName, pFileInfo) == NQ_SUCCESS;
     }
     else
     {
-        if ((pSeparator = syWStrrchr(pName, cmWChar(SY_PATHSEPARATOR))) != NULL)
+        if (pSeparator != NULL)
         {
             *pSeparator = cmWChar(0);
             resValue = findFileInPath(pName, pSeparator + 1);
@@ -252,6 +372,15 @@ csCheckFile(
         {
             resValue = findFileInPath(NULL, pName);
         }
+
+        /* the name was corrected to the actual case - read its information */
+        if (resValue && infoRequired)
+        {
+            if (syIsValidFile(dir) && pSeparator != NULL)
+                resValue = syGetFileInformationAt(dir, pSeparator + 1, pFileInfo) == NQ_SUCCESS;
+            else
+                resValue = syGetFileInformationByName(pName, pFileInfo) == NQ_SUCCESS;
+        }
     }
 
     TRCE();
@@ -282,6 +411,38 @@ csCheckPath(
     NQ_UINT treeLen,
     NQ_BOOL preservesCase
     )
+{
+    return csCheckPathAt(pShare, pName, treeLen, preservesCase, NULL);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: find the path to a given file (case insensitive) and open
+ *          its parent directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN share pointer
+ *          IN/OUT pointer to the full path
+ *          IN length of the tree map
+ *          IN whether client file system is case preserving
+ *          OUT parent directory handle or NULL when not required
+ *
+ * RETURNS: TRUE if the path exists
+ *
+ * NOTES:   the parent directory handle lets the caller look up and open the
+ *          file without walking the path again; it is left invalid for
+ *          pipes and for the share root and should be closed with
+ *          syCloseFile() when valid
+ *====================================================================
+ */
+
+NQ_BOOL
+csCheckPathAt(
+    const CSShare* pShare,
+    NQ_WCHAR* pName,
+    NQ_UINT treeLen,
+    NQ_BOOL preservesCase,
+    SYFile* pDir
+    )
 {
     NQ_WCHAR* pSeparator1;          /* pointer to the separator before the directory being checked */
     NQ_WCHAR* pSeparator2 = NULL;   /* pointer to the separator after the directory being checked */
@@ -295,6 +456,9 @@ csCheckPath(
     TRC3P("  Share [%s], map [%s], name [%s]", cmWDump(pShare->name), cmWDump(pShare->map), cmWDump(pName));
     TRC2P("  tree length %d, preserves case %d", treeLen, preservesCase);
     
+    if (pDir != NULL)
+        syInvalidateFile(pDir);
+
     if (pShare->ipcFlag)
     {
         TRCE();
@@ -343,7 +507,21 @@ csCheckPath(
         resValue = TRUE;
         pSeparator1 = syWStrchr(pName + treeLen, cmWChar(SY_PATHSEPARATOR));
 
-        if (preservesCase)
+        if (preservesCase && pDir != NULL)
+        {
+            /* the handle proves that the directory exists */
+            *pDir = syOpenDirectoryHandle(pName);
+            *pFileSeparator = cmWChar(SY_PATHSEPARATOR);
+            if (!syIsValidFile(*pDir))
+            {
+                TRCERR("syOpenDirectoryHandle failed");
+                TRCE();
+                return FALSE;
+            }
+            TRCE();
+            return TRUE;
+        }
+        else if (preservesCase)
         {
             SYDirectory dir;            /* directory descriptor */
             NQ_STATUS status;           /* operation status */
@@ -387,6 +565,8 @@ csCheckPath(
                 *pSeparator1 = cmWChar(SY_PATHSEPARATOR);
             if (pSeparator2 != NULL)
                 *pSeparator2 = cmWChar(SY_PATHSEPARATOR);
+            if (resValue && pDir != NULL)
+                *pDir = syOpenDirectoryHandle(pName);
             *pFileSeparator = cmWChar(SY_PATHSEPARATOR);
         }
     }
@@ -1080,7 +1260,9 @@ csGetHostType(
  *
  * RETURNS: TRUE if the file exists
  *
- * NOTES:   The file name is corrected to reflect the actual file name
+ * NOTES:   The file name is corrected to reflect the actual file name.
+ *          In a directory known to be large the names are collected
+ *          into an index during the same scan.
  *====================================================================
  */
 
@@ -1090,14 +1272,37 @@ findFileInPath(
     NQ_WCHAR* file
     )
 {
+    SYFileInformation dirInfo;  /* directory information */
     SYDirectory dir;            /* directory descriptor */
     NQ_STATUS status;           /* operation status */
     const NQ_WCHAR* nextName;   /* name in the next directory entry */
+    CachedName* names = NULL;   /* names collected for the index */
+    NQ_COUNT numScanned = 0;    /* number of names scanned */
+    NQ_BOOL collect = FALSE;    /* whether to index the names while scanning */
+    NQ_BOOL found = FALSE;      /* whether the name was found */
 
     TRCB();
 
     TRC2P("  Path [%s], file [%s]", cmWDump(path), cmWDump(file));
-    
+
+    switch (lookupNameCache(path, file))
+    {
+        case NAMECACHE_FOUND:
+            TRCE();
+            return TRUE;
+        case NAMECACHE_NOTFOUND:
+            TRCERR("    File not found!");
+            TRCE();
+            return FALSE;
+        case NAMECACHE_BUILD:
+            /* a change within the modification second would not be noticed */
+            collect = syGetFileInformationByName(path, &dirInfo) == NQ_SUCCESS
+                      && (NQ_UINT32)syGetTimeInSec() > cmTimeConvertMSecToSec(&dirInfo.lastWriteTime);
+            break;
+        default:
+            break;
+    }
+
     status = syFirstDirectoryFile(
         path,
         &dir,
@@ -1114,16 +1319,36 @@ findFileInPath(
 
     while (status == NQ_SUCCESS && nextName != NULL)
     {
-        if (cmWStricmp(file, nextName) == 0)
+        if (!found && cmWStricmp(file, nextName) == 0)
         {
             cmWStrcpy(file, nextName);
-            if (syCloseDirectory(dir) != NQ_SUCCESS)
+            found = TRUE;
+            if (!collect)
+                break;
+        }
+        if (collect)
+        {
+            CachedName* pName;      /* new name */
+
+            pName = (CachedName*)cmMemoryAllocate((NQ_UINT)(sizeof(CachedName) + sizeof(NQ_WCHAR) * cmWStrlen(nextName)));
+            if (pName == NULL)
             {
-                TRCERR("Close directory failed");
+                TRCERR("Out of memory");
+                freeCachedNames(names);
+                names = NULL;
+                collect = FALSE;
+                if (found)
+                    break;
+            }
+            else
+            {
+                cmWStrcpy(pName->name, nextName);
+                pName->hash = hashFoldedName(nextName);
+                pName->next = names;
+                names = pName;
             }
-            TRCE();
-            return TRUE;
         }
+        numScanned++;
         status = syNextDirectoryFile(
             dir,
             &nextName
@@ -1133,54 +1358,525 @@ findFileInPath(
     {
         TRCERR("Close directory failed");
     }
+    if (collect && status == NQ_SUCCESS)
+    {
+        storeNameCache(path, &dirInfo.lastWriteTime, names, numScanned);
+    }
+    else
+    {
+        freeCachedNames(names);
+        if (numScanned >= NAMECACHE_MINENTRIES)
+            markNameCache(path);
+    }
 
-    TRCERR("    File not found!");
+    if (!found)
+    {
+        TRCERR("    File not found!");
+    }
     TRCE();
-    return FALSE;
+    return found;
 }
 
 /*
  *====================================================================
- * PURPOSE: check if the given user can read from share
+ * PURPOSE: calculate hash of a name ignoring case
  *--------------------------------------------------------------------
- * PARAMS:  IN TID to use
+ * PARAMS:  IN name
  *
- * RETURNS: NQ_SUCCESS if access allowed or error code
+ * RETURNS: hash value
  *
  * NOTES:
  *====================================================================
  */
 
-NQ_UINT32
-csCanReadShare(
-    CSTid tid
+static NQ_UINT32
+hashFoldedName(
+    const NQ_WCHAR* name
+    )
+{
+    NQ_UINT32 hash = 5381;      /* djb2 */
+
+    for (; *name != 0; name++)
+    {
+        NQ_WCHAR c;             /* folded character */
+
+        cmWToupper(&c, name);
+        hash = (hash << 5) + hash + cmLtoh16(c);
+    }
+    return hash;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: release a list of cached names
+ *--------------------------------------------------------------------
+ * PARAMS:  IN first name in the list
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+freeCachedNames(
+    CachedName* pName
+    )
+{
+    while (pName != NULL)
+    {
+        CachedName* pNext = pName->next;
+
+        cmMemoryFree(pName);
+        pName = pNext;
+    }
+}
+
+/*
+ *====================================================================
+ * PURPOSE: drop the name index of a cached directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN cached directory slot
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   the cache should be protected. The directory stays known
+ *          as a large one
+ *====================================================================
+ */
+
+static void
+dropNameIndex(
+    CachedDirectory* pDir
+    )
+{
+    NQ_COUNT i;     /* just a counter */
+
+    if (pDir->buckets != NULL)
+    {
+        for (i = 0; i < pDir->numBuckets; i++)
+            freeCachedNames(pDir->buckets[i]);
+        cmMemoryFree(pDir->buckets);
+        pDir->buckets = NULL;
+    }
+    pDir->numBuckets = 0;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: release a cached directory slot
+ *--------------------------------------------------------------------
+ * PARAMS:  IN cached directory slot
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   the cache should be protected
+ *====================================================================
+ */
+
+static void
+disposeCachedDirectory(
+    CachedDirectory* pDir
+    )
+{
+    dropNameIndex(pDir);
+    cmMemoryFree(pDir->path);
+    pDir->path = NULL;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: get the slot of a directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN path to the directory (in correct case)
+ *
+ * RETURNS: slot of this directory or NULL when out of memory
+ *
+ * NOTES:   the cache should be protected. When the directory has no
+ *          slot the least recently used one is replaced
+ *====================================================================
+ */
+
+static CachedDirectory*
+getCachedDirectory(
+    const NQ_WCHAR* path
+    )
+{
+    CachedDirectory* pDir = NULL;   /* slot to use */
+    NQ_COUNT i;                     /* just a counter */
+
+    for (i = 0; i < NAMECACHE_NUMDIRS; i++)
+    {
+        CachedDirectory* pNext = &nameCache.dirs[i];
+
+        if (pNext->path != NULL && cmWStrcmp(pNext->path, path) == 0)
+            return pNext;
+        if (pDir == NULL || (pDir->path != NULL && (pNext->path == NULL || pNext->lastUsed < pDir->lastUsed)))
+            pDir = pNext;
+    }
+    disposeCachedDirectory(pDir);
+    pDir->path = cmMemoryCloneWString(path);
+    if (pDir->path == NULL)
+    {
+        TRCERR("Out of memory");
+        return NULL;
+    }
+    return pDir;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: look for a file name in the name cache
+ *--------------------------------------------------------------------
+ * PARAMS:  IN path to the containing directory (in correct case)
+ *          IN/OUT file name to look for (may have incorrect case)
+ *
+ * RETURNS: NAMECACHE_FOUND, NAMECACHE_NOTFOUND, NAMECACHE_BUILD when
+ *          a large directory should be indexed during the scan or
+ *          NAMECACHE_UNKNOWN when it should be scanned directly
+ *
+ * NOTES:   directories that are not known as large cost only a
+ *          comparison of the cached paths. An index that no longer
+ *          matches the directory modification time is dropped.
+ *====================================================================
+ */
+
+static NQ_INT
+lookupNameCache(
+    const NQ_WCHAR* path,
+    NQ_WCHAR* file
+    )
+{
+    SYFileInformation dirInfo;      /* directory information */
+    CachedDirectory* pDir = NULL;   /* cached directory */
+    CachedName* pName;              /* next name in the bucket */
+    NQ_UINT32 hash;                 /* folded hash of the required name */
+    NQ_INT result = NAMECACHE_UNKNOWN;
+    NQ_COUNT i;                     /* just a counter */
+
+    if (!nameCache.isReady || path == NULL)
+        return NAMECACHE_UNKNOWN;
+
+    syMutexTake(&nameCache.guard);
+    for (i = 0; i < NAMECACHE_NUMDIRS; i++)
+    {
+        if (nameCache.dirs[i].path != NULL && cmWStrcmp(nameCache.dirs[i].path, path) == 0)
+        {
+            pDir = &nameCache.dirs[i];
+            break;
+        }
+    }
+    if (pDir == NULL)
+        goto Exit;
+
+    pDir->lastUsed = ++nameCache.useStamp;
+    if (pDir->buckets == NULL)
+    {
+        result = NAMECACHE_BUILD;
+        goto Exit;
+    }
+    if (syGetFileInformationByName(path, &dirInfo) != NQ_SUCCESS || cmU64Cmp(&pDir->modified, &dirInfo.lastWriteTime) != 0)
+    {
+        dropNameIndex(pDir);
+        result = NAMECACHE_BUILD;
+        goto Exit;
+    }
+
+    hash = hashFoldedName(file);
+    result = NAMECACHE_NOTFOUND;
+    for (pName = pDir->buckets[hash & (pDir->numBuckets - 1)]; pName != NULL; pName = pName->next)
+    {
+        if (pName->hash == hash && cmWStricmp(file, pName->name) == 0)
+        {
+            cmWStrcpy(file, pName->name);
+            result = NAMECACHE_FOUND;
+            break;
+        }
+    }
+
+Exit:
+    syMutexGive(&nameCache.guard);
+    return result;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: remember a large directory
+ *--------------------------------------------------------------------
+ * PARAMS:  IN path to the directory (in correct case)
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   called after a direct scan has seen at least
+ *          NAMECACHE_MINENTRIES names so that the next scan of this
+ *          directory indexes it
+ *====================================================================
+ */
+
+static void
+markNameCache(
+    const NQ_WCHAR* path
+    )
+{
+    CachedDirectory* pDir;  /* directory slot */
+
+    if (!nameCache.isReady)
+        return;
+
+    syMutexTake(&nameCache.guard);
+    pDir = getCachedDirectory(path);
+    if (pDir != NULL)
+        pDir->lastUsed = ++nameCache.useStamp;
+    syMutexGive(&nameCache.guard);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: index the names collected during a directory scan
+ *--------------------------------------------------------------------
+ * PARAMS:  IN path to the directory (in correct case)
+ *          IN directory modification time before the scan
+ *          IN list of all names in the directory (released here)
+ *          IN number of names
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+static void
+storeNameCache(
+    const NQ_WCHAR* path,
+    const NQ_TIME* modified,
+    CachedName* names,
+    NQ_COUNT numNames
+    )
+{
+    CachedDirectory* pDir;          /* slot to fill */
+    NQ_COUNT numBuckets = 1;        /* number of buckets */
+
+    if (!nameCache.isReady)
+    {
+        freeCachedNames(names);
+        return;
+    }
+
+    syMutexTake(&nameCache.guard);
+    pDir = getCachedDirectory(path);
+    if (pDir == NULL)
+        goto Exit;
+    dropNameIndex(pDir);
+
+    while (numBuckets < numNames)
+        numBuckets <<= 1;
+    pDir->buckets = (CachedName**)cmMemoryAllocate((NQ_UINT)(sizeof(CachedName*) * numBuckets));
+    if (pDir->buckets == NULL)
+    {
+        TRCERR("Out of memory");
+        goto Exit;
+    }
+    syMemset(pDir->buckets, 0, sizeof(CachedName*) * numBuckets);
+    pDir->numBuckets = numBuckets;
+    while (names != NULL)
+    {
+        CachedName* pName = names;
+
+        names = names->next;
+        pName->next = pDir->buckets[pName->hash & (numBuckets - 1)];
+        pDir->buckets[pName->hash & (numBuckets - 1)] = pName;
+    }
+    pDir->modified = *modified;
+    pDir->lastUsed = ++nameCache.useStamp;
+
+Exit:
+    freeCachedNames(names);
+    syMutexGive(&nameCache.guard);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: initialize the name cache
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NQ_SUCCESS or NQ_FAIL
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+NQ_STATUS
+csInitNameCache(
+    void
+    )
+{
+    NQ_COUNT i;     /* just a counter */
+
+    syMutexCreate(&nameCache.guard);
+    nameCache.useStamp = 0;
+    for (i = 0; i < NAMECACHE_NUMDIRS; i++)
+    {
+        nameCache.dirs[i].path = NULL;
+        nameCache.dirs[i].buckets = NULL;
+        nameCache.dirs[i].numBuckets = 0;
+    }
+    nameCache.isReady = TRUE;
+    return NQ_SUCCESS;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: release the name cache
+ *--------------------------------------------------------------------
+ * PARAMS:  NONE
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:
+ *====================================================================
+ */
+
+void
+csExitNameCache(
+    void
+    )
+{
+    NQ_COUNT i;     /* just a counter */
+
+    if (!nameCache.isReady)
+        return;
+    syMutexTake(&nameCache.guard);
+    nameCache.isReady = FALSE;
+    for (i = 0; i < NAMECACHE_NUMDIRS; i++)
+        disposeCachedDirectory(&nameCache.dirs[i]);
+    syMutexGive(&nameCache.guard);
+    syMutexDelete(&nameCache.guard);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: drop cached names affected by a change in the file system
+ *--------------------------------------------------------------------
+ * PARAMS:  IN full path of a file or a directory that was created,
+ *             renamed or deleted
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   the containing directory index is dropped. When the path
+ *          designates a cached directory, its slot is released too.
+ *====================================================================
+ */
+
+void
+csInvalidateNameCache(
+    const NQ_WCHAR* pName
+    )
+{
+    const NQ_WCHAR* pSeparator;     /* the last separator in the path */
+    NQ_COUNT parentLen;             /* length of the containing directory path */
+    NQ_COUNT i;                     /* just a counter */
+
+    if (!nameCache.isReady || pName == NULL)
+        return;
+
+    pSeparator = syWStrrchr(pName, cmWChar(SY_PATHSEPARATOR));
+    parentLen = pSeparator == NULL ? 0 : (NQ_COUNT)(pSeparator - pName);
+
+    syMutexTake(&nameCache.guard);
+    for (i = 0; i < NAMECACHE_NUMDIRS; i++)
+    {
+        CachedDirectory* pDir = &nameCache.dirs[i];
+
+        if (pDir->path == NULL)
+            continue;
+        if (cmWStrcmp(pDir->path, pName) == 0)
+        {
+            disposeCachedDirectory(pDir);
+        }
+        else if (cmWStrlen(pDir->path) == parentLen && cmWStrncmp(pDir->path, pName, parentLen) == 0)
+        {
+            dropNameIndex(pDir);
+        }
+    }
+    syMutexGive(&nameCache.guard);
+}
+
+/*
+ *====================================================================
+ * PURPOSE: evaluate share access for the tree user
+ *--------------------------------------------------------------------
+ * PARAMS:  IN/OUT tree pointer
+ *
+ * RETURNS: NONE
+ *
+ * NOTES:   called on tree connect - the result is cached in the tree
+ *          together with the version of the share security descriptor
+ *          so that read/write checks do not walk the ACL each time
+ *====================================================================
+ */
+
+void
+csEvaluateShareAccess(
+    CSTree* pTree
     )
 {
-    const CSTree* pTree;        /* tree structure pointer */
-    const CSShare* pShare;      /* share structure pointer */
     const CSUser* pUser;        /* user structure pointer */
+    const NQ_BYTE* sd = NULL;   /* share security descriptor */
+
+    pTree->shareAccess = 0;
+    pTree->sdVersion = pTree->share->sdVersion;
+
+    pUser = csGetUserByUid(pTree->uid);
+    if (NULL == pUser)
+        return;
+#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
+    sd = pTree->share->sd.data;
+#endif /* UD_CS_INCLUDESECURITYDESCRIPTORS */
+    if (cmSdHasAccess(&pUser->token, sd, SMB_DESIREDACCESS_READDATA))
+        pTree->shareAccess |= SMB_DESIREDACCESS_READDATA;
+    if (cmSdHasAccess(&pUser->token, sd, SMB_DESIREDACCESS_WRITEDATA))
+        pTree->shareAccess |= SMB_DESIREDACCESS_WRITEDATA;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: check share access cached in the tree
+ *--------------------------------------------------------------------
+ * PARAMS:  IN TID to use
+ *          IN desired access - either READDATA or WRITEDATA
+ *
+ * RETURNS: NQ_SUCCESS if access allowed or error code
+ *
+ * NOTES:   the access is evaluated again when the share security
+ *          descriptor has changed since the last evaluation
+ *====================================================================
+ */
+
+static NQ_UINT32
+checkShareAccess(
+    CSTid tid,
+    NQ_UINT32 access
+    )
+{
+    CSTree* pTree;              /* tree structure pointer */
 
     pTree = csGetTreeByTid(tid);
     if (NULL == pTree)
         return csErrorReturn(0, SRV_ERRinvtid);
-    
-    pShare = pTree->share;
-    pUser = csGetUserByUid(pTree->uid);
-
-    if (NULL == pShare || NULL == pUser)
+    if (NULL == pTree->share || NULL == csGetUserByUid(pTree->uid))
         return csErrorReturn(SMB_STATUS_ACCESS_VIOLATION, DOS_ERRbadaccess);
-#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
-    return cmSdHasAccess(&pUser->token, pShare->sd.data, SMB_DESIREDACCESS_READDATA) ? 
+
+    if (pTree->sdVersion != pTree->share->sdVersion)
+        csEvaluateShareAccess(pTree);
+
+    return (pTree->shareAccess & access) != 0 ? 
                          NQ_SUCCESS : csErrorReturn(SMB_STATUS_ACCESS_VIOLATION, DOS_ERRbadaccess);
-#else
-    return cmSdHasAccess(&pUser->token, NULL, SMB_DESIREDACCESS_READDATA) ?
-                             NQ_SUCCESS : csErrorReturn(SMB_STATUS_ACCESS_VIOLATION, DOS_ERRbadaccess);
-#endif
 }
 
 /*
  *====================================================================
- * PURPOSE: check if the given user can write to share
+ * PURPOSE: check if the given user can read from share
  *--------------------------------------------------------------------
  * PARAMS:  IN TID to use
  *
@@ -1191,29 +1887,31 @@ csCanReadShare(
  */
 
 NQ_UINT32
-csCanWriteShare(
+csCanReadShare(
     CSTid tid
     )
 {
-    const CSTree* pTree;        /* tree structure pointer */
-    const CSShare* pShare;      /* share structure pointer */
-    const CSUser* pUser;        /* user structure pointer */
+    return checkShareAccess(tid, SMB_DESIREDACCESS_READDATA);
+}
 
-    pTree = csGetTreeByTid(tid);
-    if (NULL == pTree)
-        return csErrorReturn(0, SRV_ERRinvtid);
-    pShare = pTree->share;
-    pUser = csGetUserByUid(pTree->uid);
+/*
+ *====================================================================
+ * PURPOSE: check if the given user can write to share
+ *--------------------------------------------------------------------
+ * PARAMS:  IN TID to use
+ *
+ * RETURNS: NQ_SUCCESS if access allowed or error code
+ *
+ * NOTES:
+ *====================================================================
+ */
 
-    if (NULL == pShare || NULL == pUser)
-        return csErrorReturn(SMB_STATUS_ACCESS_VIOLATION, DOS_ERRbadaccess);
-#ifdef UD_CS_INCLUDESECURITYDESCRIPTORS
-    return cmSdHasAccess(&pUser->token, pShare->sd.data, SMB_DESIREDACCESS_WRITEDATA) ? 
-                         NQ_SUCCESS : csErrorReturn(SMB_STATUS_ACCESS_VIOLATION, DOS_ERRbadaccess);
-#else
-    return cmSdHasAccess(&pUser->token, NULL, SMB_DESIREDACCESS_WRITEDATA) ?
-                             NQ_SUCCESS : csErrorReturn(SMB_STATUS_ACCESS_VIOLATION, DOS_ERRbadaccess);
-#endif
+NQ_UINT32
+csCanWriteShare(
+    CSTid tid
+    )
+{
+    return checkShareAccess(tid, SMB_DESIREDACCESS_WRITEDATA);
 }
 
 
@@ -59,6 +59,17 @@ csCheckFile(
     NQ_BOOL preservesCase           /* whether the client's file system preserves case */
     );
 
+/* find the file (case insensitive) relative to its parent and read its information */
+
+NQ_BOOL                             /* TRUE if the file exists */
+csCheckFileAt(
+    const CSShare* pShare,          /* share pointer */
+    NQ_WCHAR* pName,                /* full path pointer */
+    NQ_BOOL preservesCase,          /* whether the client's file system preserves case */
+    SYFile dir,                     /* parent directory handle or invalid handle */
+    SYFileInformation* pFileInfo    /* buffer for file information or NULL */
+    );
+
 /* find the path of a given name in a case insensitive manner */
 
 NQ_BOOL                             /* TRUE if the path exists */
@@ -69,6 +80,38 @@ csCheckPath(
     NQ_BOOL preservesCase           /* whether the client's file system preserves case */
     );
 
+/* find the path of a given name and open its parent directory */
+
+NQ_BOOL                             /* TRUE if the path exists */
+csCheckPathAt(
+    const CSShare* pShare,          /* share pointer */
+    NQ_WCHAR* pName,                /* full path pointer */
+    NQ_UINT treeLen,                /* length of the tree map */
+    NQ_BOOL preservesCase,          /* whether the client's file system preserves case */
+    SYFile* pDir                    /* OUT parent directory handle or NULL */
+    );
+
+/* initialize the cache of names for case insensitive lookup */
+
+NQ_STATUS                           /* NQ_SUCCESS or NQ_FAIL */
+csInitNameCache(
+    void
+    );
+
+/* release the cache of names for case insensitive lookup */
+
+void
+csExitNameCache(
+    void
+    );
+
+/* drop cached names after a file or a directory was created, renamed or deleted */
+
+void
+csInvalidateNameCache(
+    const NQ_WCHAR* pName           /* full path of the changed file or directory */
+    );
+
 /* find the full path to a file in a case insensitive manner */
 
 NQ_BOOL                             /* TRUE if the full path exists */
@@ -138,6 +181,13 @@ csGetHostType(
     void
     );
 
+/* evaluate share access for the tree user and cache it in the tree */
+
+void
+csEvaluateShareAccess(
+    CSTree* pTree           /* tree pointer */
+    );
+
 /* check if the given user can read from share */
 
 NQ_UINT32                   /* NQ_SUCCESS when user is allowed to access for read or error code */
@@ -112,6 +112,20 @@ nsConnect(
     CMNetBiosNameInfo* name         /* called name as a NetBIOS name */
     );
 
+NQ_STATUS
+nsConnectStart(
+    NSSocketHandle socket,          /* socket to connect on */
+    NQ_IPADDRESS *ip,               /* IP of the remote host */
+    CMNetBiosNameInfo* name         /* called name as a NetBIOS name */
+    );
+
+NQ_STATUS
+nsConnectComplete(
+    NSSocketHandle socket,          /* socket started with nsConnectStart() */
+    NQ_IPADDRESS *ip,               /* IP of the remote host */
+    CMNetBiosNameInfo* name         /* called name as a NetBIOS name */
+    );
+
 NQ_STATUS
 nsListen(
     NSSocketHandle socket,      /* socket to listen on */
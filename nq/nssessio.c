@@ -95,7 +95,8 @@ doConnect(
     CMNetBiosNameInfo* name,
     NQ_IPADDRESS *ip,
     NQ_PORT port,
-    NQ_UINT16 level
+    NQ_UINT16 level,
+    NQ_BOOL isConnected
     );
 
 #ifdef UD_NQ_USETRANSPORTNETBIOS
@@ -784,7 +785,7 @@ nsConnect(
         case NS_TRANSPORT_NETBIOS:
             pSock->remotePort = CM_NB_SESSIONSERVICEPORT;
             LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "NS_TRANSPORT_NETBIOS, port: %d", pSock->remotePort);
-            res = doConnect(pSock, calledName, ip, syHton16(pSock->remotePort), 0);
+            res = doConnect(pSock, calledName, ip, syHton16(pSock->remotePort), 0, FALSE);
             break;
 #endif /* UD_NQ_USETRANSPORTNETBIOS */
 
@@ -793,7 +794,7 @@ nsConnect(
         case NS_TRANSPORT_IPV6:
             pSock->remotePort = CM_NB_SESSIONSERVICEPORTIP;
             LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, "NS_TRANSPORT_IPV4, port: %d", pSock->remotePort);
-            res = doConnect(pSock, calledName, ip, syHton16(pSock->remotePort), 0);
+            res = doConnect(pSock, calledName, ip, syHton16(pSock->remotePort), 0, FALSE);
             break;
 #endif /* defined(UD_NQ_USETRANSPORTIPV4) || defined(UD_NQ_USETRANSPORTIPV6) */
 
@@ -815,6 +816,141 @@ Exit:
     return res;
 }
 
+/*
+ *====================================================================
+ * PURPOSE: Start connecting a socket without blocking
+ *--------------------------------------------------------------------
+ * PARAMS:  IN socket descriptor
+ *          IN IP of the remote host (NBO)
+ *          IN called name
+ *
+ * RETURNS: SUSSESS or NQ_FAIL
+ *
+ * NOTES:   only the TCP connection is started here. When the
+ *          underlying socket becomes writable the caller completes the
+ *          connection with nsConnectComplete(). This allows connecting
+ *          to several addresses in parallel.
+ *====================================================================
+ */
+
+NQ_STATUS
+nsConnectStart(
+    NSSocketHandle sockHandle,
+    NQ_IPADDRESS *ip,
+    CMNetBiosNameInfo* calledName
+    )
+{
+    SocketSlot* pSock;       /* the same as sockHandle but properly casted */
+    NQ_STATUS res = NQ_FAIL; /* operation result */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "sockHandle:%p ip:%p calledName:%p", sockHandle, ip, calledName);
+
+    pSock = (SocketSlot*)sockHandle;
+
+#if SY_DEBUGMODE
+    if (!checkSocketSlot(pSock))    /* Is a valid slot (used)? */
+    {
+        sySetLastError(CM_NBERR_ILLEGALSOCKETSLOT);
+        LOGERR(CM_TRC_LEVEL_ERROR, "Illegal slot");
+        goto Exit;
+    }
+#endif
+
+    if (pSock->transport == NS_TRANSPORT_NETBIOS && !cmNetBiosCheckName(calledName)) /* valid netBIOS name? */
+    {
+        sySetLastError(CM_NBERR_NOTNETBIOSNAME);
+        LOGERR(CM_TRC_LEVEL_ERROR, "Not a NetBIOS name");
+        goto Exit;
+    }
+
+    pSock->isNetBios = TRUE;   /* is an NB socket */
+
+    switch (pSock->transport)
+    {
+#ifdef UD_NQ_USETRANSPORTNETBIOS
+        case NS_TRANSPORT_NETBIOS:
+            pSock->remotePort = CM_NB_SESSIONSERVICEPORT;
+            break;
+#endif /* UD_NQ_USETRANSPORTNETBIOS */
+
+#if defined(UD_NQ_USETRANSPORTIPV4) || defined(UD_NQ_USETRANSPORTIPV6)
+        case NS_TRANSPORT_IPV4:
+        case NS_TRANSPORT_IPV6:
+            pSock->remotePort = CM_NB_SESSIONSERVICEPORTIP;
+            break;
+#endif /* defined(UD_NQ_USETRANSPORTIPV4) || defined(UD_NQ_USETRANSPORTIPV6) */
+
+      default:
+        sySetLastError(CM_NBERR_INVALIDPARAMETER);
+        LOGERR(CM_TRC_LEVEL_ERROR, "Invalid transport value");
+        goto Exit;
+    }
+
+    sySetStreamSocketOptions(pSock->socket);
+    res = syConnectSocketStart(pSock->socket, ip, syHton16(pSock->remotePort));
+    if (res == NQ_FAIL)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Connect failed");
+        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " ip - %s", cmIPDump(ip));
+    }
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+    return res;
+}
+
+/*
+ *====================================================================
+ * PURPOSE: Complete a connection started by nsConnectStart()
+ *--------------------------------------------------------------------
+ * PARAMS:  IN socket descriptor
+ *          IN IP of the remote host (NBO)
+ *          IN called name
+ *
+ * RETURNS: SUSSESS or NQ_FAIL
+ *
+ * NOTES:   for a NetBIOS socket SESSION REQUEST is sent over the
+ *          established TCP connection as in nsConnect()
+ *====================================================================
+ */
+
+NQ_STATUS
+nsConnectComplete(
+    NSSocketHandle sockHandle,
+    NQ_IPADDRESS *ip,
+    CMNetBiosNameInfo* calledName
+    )
+{
+    SocketSlot* pSock;       /* the same as sockHandle but properly casted */
+    NQ_STATUS res = NQ_FAIL; /* operation result */
+
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "sockHandle:%p ip:%p calledName:%p", sockHandle, ip, calledName);
+
+    pSock = (SocketSlot*)sockHandle;
+
+    if (syConnectSocketComplete(pSock->socket) == NQ_FAIL)
+    {
+        LOGERR(CM_TRC_LEVEL_ERROR, "Connect failed");
+        LOGMSG(CM_TRC_LEVEL_MESS_NORMAL, " ip - %s", cmIPDump(ip));
+        goto Exit;
+    }
+
+    res = doConnect(pSock, calledName, ip, syHton16(pSock->remotePort), 0, TRUE);
+    if (res == NQ_FAIL)
+        goto Exit;
+
+    /* copy the remote name and ip */
+    syMemcpy(&pSock->remoteName, calledName, sizeof(*calledName));
+    pSock->remoteIP = *ip;
+
+    /* determine self IP address and port */
+    syGetSocketPortAndIP(pSock->socket, &pSock->ip, &pSock->port);
+
+Exit:
+    LOGFE(CM_TRC_LEVEL_FUNC_COMMON, "result:%d", res);
+    return res;
+}
+
 /*
  *====================================================================
  * PURPOSE: Close a socket
@@ -1443,20 +1579,24 @@ doConnect(
     CMNetBiosNameInfo* name,
     NQ_IPADDRESS *ip,
     NQ_PORT port,
-    NQ_UINT16 level
+    NQ_UINT16 level,
+    NQ_BOOL isConnected
     )
 {
     NQ_STATUS result = NQ_FAIL;
 
-    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "slot:%p name:%p ip:%p port:%u level:%u", slot, name, ip, port, level);
+    LOGFB(CM_TRC_LEVEL_FUNC_COMMON, "slot:%p name:%p ip:%p port:%u level:%u connected:%s", slot, name, ip, port, level, isConnected ? "TRUE" : "FALSE");
 
-    sySetStreamSocketOptions(slot->socket);
+    if (!isConnected)
+    {
+        sySetStreamSocketOptions(slot->socket);
+    }
 
 #ifdef UD_NQ_USETRANSPORTNETBIOS
     if ((port == syHton16(CM_NB_SESSIONSERVICEPORT)) || ((port != syHton16(CM_NB_SESSIONSERVICEPORTIP)) && level > 0))
     {
         /* limit the number of retargets to 1 by checking the recursion level */
-        if (level < 2 && syConnectSocket(slot->socket, ip, port) != NQ_FAIL)
+        if (level < 2 && (isConnected || syConnectSocket(slot->socket, ip, port) != NQ_FAIL))
         {
             NQ_UINT16 retries;
 
@@ -1535,7 +1675,7 @@ doConnect(
                             if (syIsValidSocket(slot->socket))
                             {
                                 /* go to the next recursion level */
-                                result = doConnect(slot, name, ip, port, (NQ_UINT16)(level + 1));
+                                result = doConnect(slot, name, ip, port, (NQ_UINT16)(level + 1), FALSE);
                                 goto Exit;
                             }
                             else
@@ -1574,7 +1714,7 @@ doConnect(
 #if defined(UD_NQ_USETRANSPORTIPV4) || defined(UD_NQ_USETRANSPORTIPV6)
     if (port == syHton16(CM_NB_SESSIONSERVICEPORTIP))
     {
-        if (syConnectSocket(slot->socket, ip, port) == NQ_SUCCESS)
+        if (isConnected || syConnectSocket(slot->socket, ip, port) == NQ_SUCCESS)
         {
             result = NQ_SUCCESS;
             goto Exit;
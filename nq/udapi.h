@@ -1389,6 +1389,17 @@ udNetBiosError(
     const NQ_CHAR* name             /* NetBIOS name that caused that error */
     );
 
+#ifdef UD_CS_INCLUDEPERSISTENTFIDS
+
+/* get full path of the durable handle journal (up to UD_FS_MAXPATHLEN characters) */
+
+void
+udGetDurableJournalFile(
+    NQ_CHAR* buffer                 /* buffer for the result */
+    );
+
+#endif /* UD_CS_INCLUDEPERSISTENTFIDS */
+
 #ifdef UD_CS_INCLUDEDOMAINMEMBERSHIP
 
 NQ_BOOL